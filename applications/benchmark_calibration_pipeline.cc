@@ -0,0 +1,743 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Times the stages of the calibration pipeline on synthetic data: board
+// extraction per board type, pose estimation, camera calibration, spline
+// residual evaluation, spline initialization and optimization, Allan
+// variance and telemetry / scene loading. Board views are rendered from the
+// targets in resource/, scene and telemetry are simulated from a random
+// spline trajectory, so no recordings are needed.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "OpenCameraCalibrator/allanvariance/allan_gyr.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_analytic_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_fixed_size_cost_function.h"
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/core/camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/pose_estimator.h"
+#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/io/write_telemetry.h"
+#include "OpenCameraCalibrator/utils/synthetic_data.h"
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+
+DEFINE_string(stages,
+              "extraction,loading,pose_estimation,camera_calibration,"
+              "spline_residuals,spline_optimization,allan",
+              "Comma separated list of stages to run.");
+DEFINE_int32(repetitions, 3, "Repetitions of every measurement.");
+DEFINE_string(resource_dir,
+              "resource",
+              "Folder with the board images and the charuco detector "
+              "parameters.");
+DEFINE_string(output_dir, "/tmp", "Folder for the intermediate files.");
+DEFINE_int32(num_extraction_views,
+             20,
+             "Number of rendered views per board type.");
+DEFINE_double(scene_duration_s, 60.0, "Duration of the simulated scene.");
+DEFINE_double(telemetry_duration_s,
+              600.0,
+              "Duration of the telemetry for the loading and Allan variance "
+              "stages.");
+DEFINE_double(imu_rate_hz, 200.0, "Rate of the simulated IMU.");
+DEFINE_double(camera_fps, 30.0, "Frame rate of the simulated camera.");
+DEFINE_string(camera_model,
+              "PINHOLE",
+              "Camera model that is calibrated in the camera calibration "
+              "stage.");
+DEFINE_int32(num_residual_evaluations,
+             100000,
+             "Number of evaluations per spline residual type.");
+DEFINE_int32(spline_iterations, 10, "Iterations of the spline optimization.");
+DEFINE_string(spline_orders,
+              "4,5,6",
+              "Comma separated spline orders of the spline optimization "
+              "stage.");
+DEFINE_int32(num_threads,
+             std::thread::hardware_concurrency(),
+             "Number of threads of the multi threaded stages.");
+
+const int kImageWidth = 1920;
+const int kImageHeight = 1080;
+const double kFocalLength = 1000.0;
+const double kPixelNoise = 0.3;
+const double kSquareLength = 0.021;
+const int N = SPLINE_N;
+
+//! Runs setup and run FLAGS_repetitions times and prints the minimum and
+//! median wall time of run. run gets the result of setup and returns a short
+//! description of its output. With num_items > 0 the time per item is
+//! printed as well.
+template <typename Setup, typename Run>
+void TimeStage(const std::string& name,
+               const size_t num_items,
+               const Setup& setup,
+               const Run& run) {
+  std::vector<double> times_s;
+  std::string info;
+  for (int r = 0; r < std::max(1, FLAGS_repetitions); ++r) {
+    auto state = setup();
+    const auto start = std::chrono::steady_clock::now();
+    info = run(state);
+    const auto end = std::chrono::steady_clock::now();
+    times_s.push_back(std::chrono::duration<double>(end - start).count());
+  }
+  std::sort(times_s.begin(), times_s.end());
+  const double median_s = times_s[times_s.size() / 2];
+  std::cout << std::left << std::setw(34) << name << std::right << std::fixed
+            << std::setprecision(4) << " min " << std::setw(10) << times_s[0]
+            << "s  median " << std::setw(10) << median_s << "s";
+  if (num_items > 0) {
+    std::cout << "  " << std::setprecision(3)
+              << median_s / num_items * S_TO_US << "us/item";
+  }
+  std::cout << "  " << info << std::endl;
+}
+
+//! Setup for stages without per repetition state
+int NoSetup() { return 0; }
+
+theia::Camera SyntheticCamera() {
+  theia::Camera camera;
+  camera.SetCameraIntrinsicsModelType(
+      theia::CameraIntrinsicsModelType::PINHOLE);
+  camera.SetImageSize(kImageWidth, kImageHeight);
+  camera.SetFocalLength(kFocalLength);
+  camera.SetPrincipalPoint(kImageWidth / 2.0, kImageHeight / 2.0);
+  return camera;
+}
+
+//! Warps the board image into num_views images with random perspective and
+//! adds image noise
+std::vector<cv::Mat> RenderBoardViews(const cv::Mat& board,
+                                      const int num_views,
+                                      const unsigned int seed) {
+  cv::RNG rng(seed);
+  const double scale = 0.6 * std::min(kImageWidth / double(board.cols),
+                                      kImageHeight / double(board.rows));
+  const std::vector<cv::Point2f> src = {cv::Point2f(0, 0),
+                                        cv::Point2f(board.cols, 0),
+                                        cv::Point2f(board.cols, board.rows),
+                                        cv::Point2f(0, board.rows)};
+  const cv::Point2f board_center(board.cols / 2.0f, board.rows / 2.0f);
+  std::vector<cv::Mat> views;
+  for (int v = 0; v < num_views; ++v) {
+    const cv::Point2f center(
+        kImageWidth * (0.5 + rng.uniform(-0.1, 0.1)),
+        kImageHeight * (0.5 + rng.uniform(-0.1, 0.1)));
+    const double angle = rng.uniform(-0.3, 0.3);
+    const double c = std::cos(angle), s = std::sin(angle);
+    std::vector<cv::Point2f> dst;
+    for (const cv::Point2f& p : src) {
+      const cv::Point2f d = scale * (p - board_center);
+      const double jitter = 0.05 * scale * board.cols;
+      dst.emplace_back(center.x + c * d.x - s * d.y + rng.gaussian(jitter),
+                       center.y + s * d.x + c * d.y + rng.gaussian(jitter));
+    }
+    cv::Mat view;
+    cv::warpPerspective(board,
+                        view,
+                        cv::getPerspectiveTransform(src, dst),
+                        cv::Size(kImageWidth, kImageHeight),
+                        cv::INTER_LINEAR,
+                        cv::BORDER_CONSTANT,
+                        cv::Scalar(255));
+    cv::Mat noise(view.size(), CV_16SC1), view_noisy;
+    rng.fill(noise, cv::RNG::NORMAL, 0, 3);
+    view.convertTo(view_noisy, CV_16SC1);
+    view_noisy += noise;
+    view_noisy.convertTo(view, CV_8UC1);
+    views.push_back(view);
+  }
+  return views;
+}
+
+void BenchmarkExtraction() {
+  struct BoardConfig {
+    std::string name;
+    std::string image;
+    BoardType type;
+  };
+  const std::vector<BoardConfig> boards = {
+      {"charuco", "board.png", BoardType::CHARUCO},
+      {"radon", "checkerboard_radon.png", BoardType::RADON},
+      {"apriltag", "april_6x6.png", BoardType::APRILTAG}};
+
+  for (const BoardConfig& config : boards) {
+    const std::string image_path = FLAGS_resource_dir + "/" + config.image;
+    cv::Mat board = cv::imread(image_path, cv::IMREAD_GRAYSCALE);
+    if (board.empty()) {
+      LOG(WARNING) << "Skipping " << config.name
+                   << " extraction. Could not read " << image_path;
+      continue;
+    }
+    // the board only covers part of the view, so the full resolution of the
+    // printable targets is not needed
+    const double max_side = 2000.0;
+    if (std::max(board.cols, board.rows) > max_side) {
+      const double f = max_side / std::max(board.cols, board.rows);
+      cv::resize(board, board, cv::Size(), f, f, cv::INTER_AREA);
+    }
+    const std::vector<cv::Mat> views =
+        RenderBoardViews(board, FLAGS_num_extraction_views, 42);
+
+    BoardExtractor extractor;
+    bool initialized = false;
+    if (config.type == BoardType::CHARUCO) {
+      initialized = extractor.InitializeCharucoBoard(
+          FLAGS_resource_dir + "/charuco_detector_params.yml",
+          kSquareLength / 2.0f,
+          kSquareLength,
+          10,
+          8,
+          cv::aruco::DICT_ARUCO_ORIGINAL);
+    } else if (config.type == BoardType::RADON) {
+      initialized = extractor.InitializeRadonBoard(kSquareLength, 14, 9);
+    } else {
+      initialized = extractor.InitializeAprilBoard(0.04, 0.3, 6, 6);
+    }
+    if (!initialized) {
+      LOG(WARNING) << "Skipping " << config.name
+                   << " extraction. Could not initialize the board.";
+      continue;
+    }
+
+    TimeStage("extraction_" + config.name, views.size(), NoSetup, [&](int&) {
+      size_t nr_corners = 0, nr_detected = 0;
+      for (const cv::Mat& view : views) {
+        aligned_vector<Eigen::Vector2d> corners;
+        std::vector<int> ids;
+        if (extractor.ExtractBoard(view, corners, ids) && !corners.empty()) {
+          ++nr_detected;
+        }
+        nr_corners += corners.size();
+      }
+      return std::to_string(nr_detected) + "/" + std::to_string(views.size()) +
+             " views, " + std::to_string(nr_corners) + " corners";
+    });
+  }
+}
+
+//! Draws random spline knots, intrinsics and measurements and evaluates the
+//! IMU residuals with Jacobians as the solver does
+void BenchmarkSplineResiduals() {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  auto random_vec = [&]() {
+    return Eigen::Vector3d(dist(rng), dist(rng), dist(rng));
+  };
+  std::vector<Sophus::SO3d> so3_knots;
+  std::vector<Eigen::Vector3d> r3_knots, bias_knots;
+  for (int i = 0; i < N; ++i) {
+    so3_knots.push_back(Sophus::SO3d::exp(random_vec()));
+    r3_knots.push_back(random_vec());
+  }
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    bias_knots.push_back(0.1 * random_vec());
+  }
+  Eigen::Vector3d gravity(0.0, 0.0, GRAVITY_MAGN);
+  Eigen::Matrix<double, 6, 1> accl_intrinsics;
+  accl_intrinsics << 0.0, 0.0, 0.0, 1.0, 1.0, 1.0;
+  Eigen::Matrix<double, 9, 1> gyro_intrinsics;
+  gyro_intrinsics << 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 1.0, 1.0;
+
+  std::vector<double*> accl_params, gyro_params;
+  for (int i = 0; i < N; ++i) {
+    accl_params.push_back(so3_knots[i].data());
+    gyro_params.push_back(so3_knots[i].data());
+  }
+  for (int i = 0; i < N; ++i) {
+    accl_params.push_back(r3_knots[i].data());
+  }
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    accl_params.push_back(bias_knots[i].data());
+    gyro_params.push_back(bias_knots[i].data());
+  }
+  accl_params.push_back(gravity.data());
+  accl_params.push_back(accl_intrinsics.data());
+  gyro_params.push_back(gyro_intrinsics.data());
+
+  const Eigen::Vector3d meas = random_vec();
+  const double u = 0.3, inv_dt = 10.0, inv_bias_dt = 0.1, inv_std = 1.0;
+  using AcclFunctor = AccelerationCostFunctorSplit<N>;
+  using GyroFunctor = GyroCostFunctorSplit<N, Sophus::SO3, false>;
+  std::vector<std::pair<std::string, std::shared_ptr<ceres::CostFunction>>>
+      accl_costs = {
+          {"spline_accl_residual_analytic",
+           std::make_shared<AccelerationCostFunctionSplitAnalytic<N>>(
+               meas, u, inv_dt, u, inv_dt, inv_std, u, inv_bias_dt)},
+          {"spline_accl_residual_autodiff",
+           std::shared_ptr<ceres::CostFunction>(
+               CreateFixedSizeCostFunction<3, AccelerationBlockSizes<N>>(
+                   new AcclFunctor(
+                       meas, u, inv_dt, u, inv_dt, inv_std, u, inv_bias_dt)))}};
+  std::vector<std::pair<std::string, std::shared_ptr<ceres::CostFunction>>>
+      gyro_costs = {
+          {"spline_gyro_residual_analytic",
+           std::make_shared<GyroCostFunctionSplitAnalytic<N>>(
+               meas, u, inv_dt, inv_std, u, inv_bias_dt)},
+          {"spline_gyro_residual_autodiff",
+           std::shared_ptr<ceres::CostFunction>(
+               CreateFixedSizeCostFunction<3, GyroBlockSizes<N>>(
+                   new GyroFunctor(
+                       meas, u, inv_dt, inv_std, u, inv_bias_dt)))}};
+
+  auto time_cost = [&](const std::string& name,
+                       const ceres::CostFunction& cost,
+                       const std::vector<double*>& params) {
+    std::vector<std::vector<double>> jacobians;
+    std::vector<double*> jacobian_ptrs;
+    for (const int32_t size : cost.parameter_block_sizes()) {
+      jacobians.emplace_back(3 * size);
+    }
+    for (auto& jacobian : jacobians) {
+      jacobian_ptrs.push_back(jacobian.data());
+    }
+    const size_t nr_evals = std::max(1, FLAGS_num_residual_evaluations);
+    TimeStage(name, nr_evals, NoSetup, [&](int&) {
+      double residuals[3];
+      double sum = 0.0;
+      for (size_t i = 0; i < nr_evals; ++i) {
+        CHECK(cost.Evaluate(params.data(), residuals, jacobian_ptrs.data()));
+        sum += residuals[0];
+      }
+      std::ostringstream info;
+      info << "checksum " << sum;
+      return info.str();
+    });
+  };
+  for (const auto& cost : accl_costs) {
+    time_cost(cost.first, *cost.second, accl_params);
+  }
+  for (const auto& cost : gyro_costs) {
+    time_cost(cost.first, *cost.second, gyro_params);
+  }
+}
+
+//! Global shutter reprojection residual of one view with double and single
+//! precision corner observations
+void BenchmarkReprojectionResiduals() {
+  const int kNumCorners = 144;
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  std::normal_distribution<double> noise(0.0, kPixelNoise);
+
+  // identity spline pose, the camera looks along z at the scene points
+  std::vector<Sophus::SO3d> so3_knots(N);
+  std::vector<Eigen::Vector3d> r3_knots(N, Eigen::Vector3d::Zero());
+  Sophus::SE3d T_i_c;
+  const theia::Camera camera = SyntheticCamera();
+  auto obs = std::make_shared<ViewObservations>();
+  obs->camera_model = camera.GetCameraIntrinsicsModelType();
+  obs->nr_intrinsics = camera.CameraIntrinsics()->NumParameters();
+  for (int i = 0; i < obs->nr_intrinsics; ++i) {
+    obs->intrinsics[i] = camera.intrinsics()[i];
+  }
+  aligned_vector<Eigen::Vector4d> scene_points;
+  for (int i = 0; i < kNumCorners; ++i) {
+    const Eigen::Vector3d p(dist(rng), 0.5 * dist(rng), 3.0 + dist(rng));
+    scene_points.push_back(p.homogeneous());
+    Eigen::Vector2d pixel;
+    camera.ProjectPoint(p.homogeneous(), &pixel);
+    obs->corners.push_back({pixel[0] + noise(rng),
+                            pixel[1] + noise(rng),
+                            1.0 / kPixelNoise,
+                            1.0 / kPixelNoise});
+  }
+  auto compact_obs = std::make_shared<ViewObservations>(*obs);
+  for (const ViewObservations::Corner& c : obs->corners) {
+    compact_obs->compact_corners.push_back({static_cast<float>(c.x),
+                                            static_cast<float>(c.y),
+                                            static_cast<float>(c.inv_std_x),
+                                            static_cast<float>(c.inv_std_y)});
+  }
+  compact_obs->corners.clear();
+
+  std::vector<double*> params;
+  for (int i = 0; i < N; ++i) params.push_back(so3_knots[i].data());
+  for (int i = 0; i < N; ++i) params.push_back(r3_knots[i].data());
+  params.push_back(T_i_c.data());
+  for (Eigen::Vector4d& p : scene_points) params.push_back(p.data());
+
+  auto make_cost = [&](std::shared_ptr<const ViewObservations> observations) {
+    std::shared_ptr<ceres::CostFunction> cost(
+        CreateReprojectionCostFunction<GSReprojectionCostFunctorSplit, N>(
+            observations, 0.3, 0.3, 10.0, 10.0));
+    CHECK(cost) << "Unsupported camera model";
+    return cost;
+  };
+  const auto double_cost = make_cost(obs);
+  const auto compact_cost = make_cost(compact_obs);
+
+  std::vector<double> double_residuals(2 * kNumCorners);
+  std::vector<double> compact_residuals(2 * kNumCorners);
+  auto time_cost = [&](const std::string& name,
+                       const ceres::CostFunction& cost,
+                       std::vector<double>& residuals) {
+    std::vector<std::vector<double>> jacobians;
+    std::vector<double*> jacobian_ptrs;
+    for (const int32_t size : cost.parameter_block_sizes()) {
+      jacobians.emplace_back(2 * kNumCorners * size);
+    }
+    for (auto& jacobian : jacobians) {
+      jacobian_ptrs.push_back(jacobian.data());
+    }
+    const size_t nr_evals =
+        std::max(1, FLAGS_num_residual_evaluations / kNumCorners);
+    TimeStage(name, nr_evals * kNumCorners, NoSetup, [&](int&) {
+      double sum = 0.0;
+      for (size_t i = 0; i < nr_evals; ++i) {
+        CHECK(cost.Evaluate(
+            params.data(), residuals.data(), jacobian_ptrs.data()));
+        sum += residuals[0];
+      }
+      std::ostringstream info;
+      info << "checksum " << sum;
+      return info.str();
+    });
+  };
+  time_cost("spline_gs_reprojection_double", *double_cost, double_residuals);
+  time_cost("spline_gs_reprojection_compact", *compact_cost, compact_residuals);
+
+  double max_diff = 0.0;
+  for (size_t i = 0; i < double_residuals.size(); ++i) {
+    max_diff = std::max(max_diff,
+                        std::abs(double_residuals[i] - compact_residuals[i]));
+  }
+  std::cout << "compact observations: max residual difference " << max_diff
+            << " (" << max_diff * kPixelNoise << "px)" << std::endl;
+}
+
+//! Vision dataset for the spline with the ground truth camera poses
+void SceneToCalibDataset(const nlohmann::json& scene_json,
+                         const utils::SyntheticTrajectory& trajectory,
+                         const theia::Camera& camera,
+                         theia::Reconstruction* recon) {
+  io::scene_to_calib_dataset(scene_json, *recon);
+  const theia::CameraIntrinsicsPrior intrinsics_prior =
+      camera.CameraIntrinsicsPriorFromIntrinsics();
+  for (const theia::ViewId view_id : recon->ViewIds()) {
+    theia::View* view = recon->MutableView(view_id);
+    theia::Camera* view_cam = view->MutableCamera();
+    view_cam->SetFromCameraIntrinsicsPriors(intrinsics_prior);
+    const Sophus::SE3d T_w_c = trajectory.CameraPose(view->GetTimestamp());
+    view_cam->SetOrientationFromRotationMatrix(T_w_c.so3().inverse().matrix());
+    view_cam->SetPosition(T_w_c.translation());
+  }
+}
+
+void BenchmarkLoading(const utils::SyntheticImuOptions& imu_options,
+                      const std::string& scene_path) {
+  utils::SyntheticMotionOptions motion_options;
+  motion_options.duration_s = FLAGS_telemetry_duration_s;
+  const utils::SyntheticTrajectory trajectory(
+      motion_options, Eigen::Vector3d::Zero(), Sophus::SE3d());
+  CameraTelemetryData telemetry;
+  utils::SimulateTelemetry(
+      trajectory, imu_options, FLAGS_camera_fps, &telemetry);
+  const std::string json_path = FLAGS_output_dir + "/benchmark_telemetry.json";
+  const std::string binary_path =
+      FLAGS_output_dir + "/benchmark_telemetry.bin";
+  CHECK(io::WriteTelemetryJSON(json_path, telemetry))
+      << "Could not write " << json_path;
+  CHECK(io::WriteTelemetryBinary(binary_path, telemetry))
+      << "Could not write " << binary_path;
+
+  const size_t nr_samples = telemetry.accelerometer.size();
+  auto time_reader = [&](const std::string& name,
+                         const std::string& path,
+                         bool (*reader)(const std::string&,
+                                        CameraTelemetryData&)) {
+    TimeStage(name, nr_samples, NoSetup, [&](int&) {
+      CameraTelemetryData loaded;
+      CHECK(reader(path, loaded)) << "Could not read " << path;
+      return std::to_string(loaded.accelerometer.size()) + " samples";
+    });
+  };
+  time_reader("loading_telemetry_json", json_path, io::ReadTelemetryJSON);
+  time_reader(
+      "loading_telemetry_json_dom", json_path, io::ReadTelemetryJSONDom);
+  time_reader("loading_telemetry_binary", binary_path, io::ReadTelemetry);
+
+  TimeStage("loading_scene", 0, NoSetup, [&](int&) {
+    nlohmann::json scene_json;
+    CHECK(io::read_scene_bson(scene_path, scene_json))
+        << "Failed to load " << scene_path;
+    return std::to_string(scene_json["views"].size()) + " views";
+  });
+}
+
+void BenchmarkAllan(const utils::SyntheticImuOptions& imu_options) {
+  utils::SyntheticMotionOptions motion_options;
+  motion_options.duration_s = FLAGS_telemetry_duration_s;
+  motion_options.position_std_m = 0.0;
+  motion_options.rotation_std_rad = 0.0;
+  const utils::SyntheticTrajectory trajectory(
+      motion_options, Eigen::Vector3d::Zero(), Sophus::SE3d());
+  CameraTelemetryData telemetry;
+  utils::SimulateTelemetry(
+      trajectory, imu_options, FLAGS_camera_fps, &telemetry);
+
+  auto setup = [&]() {
+    std::unique_ptr<allanvar::AllanGyr> allan(
+        new allanvar::AllanGyr("gyr_x"));
+    allan->setNumThreads(FLAGS_num_threads);
+    for (const auto& reading : telemetry.gyroscope) {
+      allan->pushRadPerSec(reading.x(), reading.timestamp_s());
+    }
+    return allan;
+  };
+  TimeStage("allan_gyr_calc",
+            0,
+            setup,
+            [&](std::unique_ptr<allanvar::AllanGyr>& allan) {
+              allan->calc();
+              return std::to_string(allan->getFactors().size()) +
+                     " cluster sizes";
+            });
+}
+
+void BenchmarkPoseEstimation(const nlohmann::json& scene_json,
+                             const theia::Camera& camera) {
+  TimeStage("pose_estimation",
+            scene_json["views"].size(),
+            NoSetup,
+            [&](int&) {
+              PoseEstimator pose_estimator;
+              pose_estimator.SetNumThreads(FLAGS_num_threads);
+              pose_estimator.EstimatePosesFromJson(scene_json, camera);
+              theia::Reconstruction pose_dataset;
+              pose_estimator.GetPoseDataset(pose_dataset);
+              return std::to_string(pose_dataset.NumViews()) + " poses";
+            });
+}
+
+void BenchmarkCameraCalibration(const nlohmann::json& scene_json) {
+  TimeStage("camera_calibration", 0, NoSetup, [&](int&) {
+    CameraCalibrator camera_calibrator(FLAGS_camera_model, false);
+    camera_calibrator.SetNumThreads(FLAGS_num_threads);
+    const bool success = camera_calibrator.CalibrateCameraFromJson(
+        scene_json, FLAGS_output_dir + "/benchmark_calibration");
+    return std::string(success ? "converged" : "failed");
+  });
+}
+
+//! Initializes and optimizes a spline of order kN. Besides the timing the
+//! optimize stage reports the errors w.r.t. the ground truth, so the orders
+//! can be compared for speed and accuracy.
+template <int kN>
+void BenchmarkSplineOptimization(
+    const nlohmann::json& scene_json,
+    const utils::SyntheticTrajectory& trajectory,
+    const theia::Camera& camera,
+    const CameraTelemetryData& telemetry,
+    const utils::SyntheticImuOptions& imu_options) {
+  auto recon = std::make_shared<theia::Reconstruction>();
+  SceneToCalibDataset(scene_json, trajectory, camera, recon.get());
+
+  SplineWeightingData weight_data;
+  weight_data.dt_r3 = 0.1;
+  weight_data.dt_so3 = 0.1;
+  weight_data.std_r3 =
+      imu_options.accl_noise_density * std::sqrt(imu_options.imu_rate_hz);
+  weight_data.std_so3 =
+      imu_options.gyro_noise_density * std::sqrt(imu_options.imu_rate_hz);
+  weight_data.cam_fps = FLAGS_camera_fps;
+
+  using Calibrator = ImuCameraCalibratorT<kN>;
+  const std::string suffix = "_n" + std::to_string(kN);
+  auto init_spline = [&]() {
+    std::unique_ptr<Calibrator> calibrator(new Calibrator());
+    calibrator->SetNumThreads(FLAGS_num_threads);
+    calibrator->BatchInitSpline(recon,
+                                trajectory.T_i_c(),
+                                weight_data,
+                                0.0,
+                                telemetry,
+                                0.0,
+                                ThreeAxisSensorCalibParams<double>(),
+                                ThreeAxisSensorCalibParams<double>());
+    return calibrator;
+  };
+  TimeStage("spline_init" + suffix,
+            telemetry.accelerometer.size(),
+            NoSetup,
+            [&](int&) {
+              std::unique_ptr<Calibrator> calibrator = init_spline();
+              return std::to_string(
+                         calibrator->trajectory_.GetNumSO3Knots()) +
+                     " so3 knots";
+            });
+
+  SplineSolverOptions solver_options;
+  solver_options.num_threads = FLAGS_num_threads;
+  TimeStage("spline_optimize" + suffix,
+            0,
+            init_spline,
+            [&](std::unique_ptr<Calibrator>& calibrator) {
+              const double reproj_error = calibrator->Optimize(
+                  FLAGS_spline_iterations,
+                  SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C |
+                      SplineOptimFlags::GRAVITY_DIR,
+                  solver_options);
+              // imu positions at the camera times against the ground truth
+              double sq_error_sum = 0.0;
+              int nr_poses = 0;
+              for (const double t_s : calibrator->GetCamTimestamps()) {
+                const int64_t t_ns = t_s * S_TO_NS;
+                Sophus::SE3d T_w_i;
+                if (calibrator->trajectory_.GetPose(t_ns, T_w_i)) {
+                  sq_error_sum += (T_w_i.translation() -
+                                   trajectory.ImuPose(t_s).translation())
+                                      .squaredNorm();
+                  ++nr_poses;
+                }
+              }
+              const Sophus::SE3d T_i_c_error =
+                  trajectory.T_i_c().inverse() *
+                  calibrator->trajectory_.GetT_i_c();
+              std::ostringstream info;
+              info << std::setprecision(3) << "reprojection error "
+                   << reproj_error << "px, position rmse "
+                   << std::sqrt(sq_error_sum / std::max(1, nr_poses)) * 1e3
+                   << "mm, T_i_c error "
+                   << T_i_c_error.so3().log().norm() * 180.0 / M_PI
+                   << "deg " << T_i_c_error.translation().norm() * 1e3
+                   << "mm";
+              return info.str();
+            });
+}
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  std::set<std::string> stages;
+  std::stringstream stage_stream(FLAGS_stages);
+  for (std::string stage; std::getline(stage_stream, stage, ',');) {
+    stages.insert(stage);
+  }
+  auto run_stage = [&](const std::string& stage) {
+    return stages.count(stage) > 0;
+  };
+
+  if (run_stage("extraction")) {
+    BenchmarkExtraction();
+  }
+  if (run_stage("spline_residuals")) {
+    BenchmarkSplineResiduals();
+    BenchmarkReprojectionResiduals();
+  }
+
+  utils::SyntheticImuOptions imu_options;
+  imu_options.imu_rate_hz = FLAGS_imu_rate_hz;
+  if (run_stage("allan")) {
+    BenchmarkAllan(imu_options);
+  }
+
+  // the scene uses the radon board geometry, which needs no detector
+  // parameters
+  BoardExtractor scene_board;
+  scene_board.InitializeRadonBoard(kSquareLength, 14, 9);
+  const std::vector<cv::Point3f> board_pts = scene_board.GetBoardPts()[0];
+  const std::vector<int> board_pt_ids = scene_board.GetRadonBoardIDs();
+  Eigen::Vector3d board_center(0.0, 0.0, 0.0);
+  for (const cv::Point3f& p : board_pts) {
+    board_center += Eigen::Vector3d(p.x, p.y, p.z) / board_pts.size();
+  }
+  const theia::Camera camera = SyntheticCamera();
+  const Sophus::SE3d T_i_c(
+      Sophus::SO3d::exp(Eigen::Vector3d(0.01, -0.02, M_PI / 2.0)),
+      Eigen::Vector3d(0.01, 0.02, 0.005));
+
+  utils::SyntheticMotionOptions motion_options;
+  motion_options.duration_s = FLAGS_scene_duration_s;
+  const utils::SyntheticTrajectory trajectory(
+      motion_options, board_center, T_i_c);
+  CameraTelemetryData telemetry;
+  utils::SimulateTelemetry(
+      trajectory, imu_options, FLAGS_camera_fps, &telemetry);
+
+  const std::string scene_path = FLAGS_output_dir + "/benchmark_scene.uson";
+  std::unique_ptr<io::SceneWriter> scene_writer =
+      io::CreateSceneWriter(scene_path);
+  CHECK(scene_writer->Open(scene_path)) << "Could not open " << scene_path;
+  utils::SimulateScene(trajectory,
+                       camera,
+                       board_pts,
+                       board_pt_ids,
+                       telemetry.img_timestamps_s,
+                       kPixelNoise,
+                       42,
+                       scene_writer.get());
+  CHECK(scene_writer->Close(utils::SyntheticSceneHeader(camera,
+                                                        FLAGS_camera_fps,
+                                                        BoardType::RADON,
+                                                        kSquareLength,
+                                                        board_pts,
+                                                        board_pt_ids)))
+      << "Could not write " << scene_path;
+  nlohmann::json scene_json;
+  CHECK(io::read_scene_bson(scene_path, scene_json))
+      << "Failed to load " << scene_path;
+  LOG(INFO) << "Simulated " << scene_json["views"].size() << " views and "
+            << telemetry.accelerometer.size() << " IMU samples.";
+
+  if (run_stage("loading")) {
+    BenchmarkLoading(imu_options, scene_path);
+  }
+  if (run_stage("pose_estimation")) {
+    BenchmarkPoseEstimation(scene_json, camera);
+  }
+  if (run_stage("camera_calibration")) {
+    BenchmarkCameraCalibration(scene_json);
+  }
+  if (run_stage("spline_optimization")) {
+    std::stringstream order_stream(FLAGS_spline_orders);
+    for (std::string order; std::getline(order_stream, order, ',');) {
+      const bool supported_order =
+          DispatchSplineOrder(std::stoi(order), [&](auto n) {
+            BenchmarkSplineOptimization<decltype(n)::value>(
+                scene_json, trajectory, camera, telemetry, imu_options);
+          });
+      if (!supported_order) {
+        LOG(WARNING) << "Skipping unsupported spline order " << order;
+      }
+    }
+  }
+  return 0;
+}
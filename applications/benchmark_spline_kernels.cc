@@ -0,0 +1,376 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmarks of the spline kernels for the orders 4 to 6:
+// CeresSplineHelper::evaluate_lie and evaluate<DIM, DERIV> in double and in
+// ceres Jets of the size of the SO3 and R3 knot blocks of a residual, and the
+// closed form So3Spline / RdSpline evaluations with Jacobians. The closed
+// form Jacobians are checked against autodiff of CeresSplineHelper at random
+// times. Returns 1 if they do not agree.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/basalt_spline/ceres_spline_helper.h"
+#include "OpenCameraCalibrator/basalt_spline/rd_spline.h"
+#include "OpenCameraCalibrator/basalt_spline/so3_spline.h"
+
+DEFINE_int32(num_evaluations, 200000, "Evaluations per kernel.");
+DEFINE_int32(repetitions, 3, "Repetitions of every measurement.");
+DEFINE_int32(num_knots, 100, "Number of random knots of the splines.");
+DEFINE_int32(num_checks,
+             100,
+             "Random times at which the closed form Jacobians are compared "
+             "against autodiff.");
+DEFINE_double(tolerance, 1e-8, "Maximum allowed absolute difference.");
+DEFINE_int32(seed, 42, "Seed of the random knots and times.");
+
+namespace {
+
+using Eigen::Matrix3d;
+using Eigen::Vector3d;
+
+const int64_t kKnotSpacingNs = 100000000;
+const double kKnotRotationStd = 0.3;
+
+//! Runs run FLAGS_repetitions times and prints the minimum and median time
+//! per evaluation. run evaluates the kernel FLAGS_num_evaluations times and
+//! returns a sum of its outputs, so that the evaluations are not optimized
+//! away.
+template <typename Run>
+void TimeKernel(const std::string& name, const Run& run) {
+  std::vector<double> times_s;
+  double sink = 0.0;
+  for (int r = 0; r < std::max(1, FLAGS_repetitions); ++r) {
+    const auto start = std::chrono::steady_clock::now();
+    sink += run();
+    const auto end = std::chrono::steady_clock::now();
+    times_s.push_back(std::chrono::duration<double>(end - start).count());
+  }
+  std::sort(times_s.begin(), times_s.end());
+  const double to_ns = 1e9 / std::max(1, FLAGS_num_evaluations);
+  std::cout << std::left << std::setw(30) << name << std::right << std::fixed
+            << std::setprecision(1) << " min " << std::setw(9)
+            << times_s[0] * to_ns << "ns  median " << std::setw(9)
+            << times_s[times_s.size() / 2] * to_ns << "ns  (sum "
+            << std::setprecision(3) << sink << ")" << std::endl;
+}
+
+//! Random SO3 and R3 splines and evaluation times within them
+template <int N>
+struct SplineKernels {
+  explicit SplineKernels(std::mt19937& rng)
+      : so3(kKnotSpacingNs), r3(kKnotSpacingNs) {
+    // neighbouring knots of a random walk, far from the cut locus of log
+    std::normal_distribution<double> dist(0.0, kKnotRotationStd);
+    Sophus::SO3d knot;
+    for (int i = 0; i < FLAGS_num_knots; ++i) {
+      knot *= Sophus::SO3d::exp(Vector3d(dist(rng), dist(rng), dist(rng)));
+      so3.knots_push_back(knot);
+    }
+    r3.genRandomTrajectory(FLAGS_num_knots);
+    std::uniform_int_distribution<int64_t> time_dist(so3.minTimeNs(),
+                                                     so3.maxTimeNs());
+    for (int i = 0; i < FLAGS_num_evaluations; ++i) {
+      times_ns.push_back(time_dist(rng));
+    }
+  }
+
+  //! Segment index and normalized time of time_ns
+  void Segment(const int64_t time_ns, int64_t* s, double* u) const {
+    const int64_t st_ns = time_ns - so3.minTimeNs();
+    *s = st_ns / kKnotSpacingNs;
+    *u = double(st_ns % kKnotSpacingNs) / double(kKnotSpacingNs);
+  }
+
+  void SO3Knots(const int64_t s, const double** knots) const {
+    for (int i = 0; i < N; ++i) knots[i] = so3.getKnot(s + i).data();
+  }
+
+  void R3Knots(const int64_t s, const double** knots) const {
+    for (int i = 0; i < N; ++i) knots[i] = r3.getKnot(s + i).data();
+  }
+
+  So3Spline<N> so3;
+  RdSpline<3, N> r3;
+  std::vector<int64_t> times_ns;
+  const double inv_dt = 1e9 / kKnotSpacingNs;
+};
+
+//! Knots as Jets of kNumParams derivatives, the derivative of each knot
+//! parameter set to one
+template <int kNumParams>
+void ToJets(const double* const* knots,
+            const int num_knots,
+            const int knot_size,
+            ceres::Jet<double, kNumParams>* jets,
+            const ceres::Jet<double, kNumParams>** jet_knots) {
+  for (int i = 0; i < num_knots; ++i) {
+    for (int j = 0; j < knot_size; ++j) {
+      const int k = knot_size * i + j;
+      jets[k] = ceres::Jet<double, kNumParams>(knots[i][j], k);
+    }
+    jet_knots[i] = &jets[knot_size * i];
+  }
+}
+
+template <int N>
+void BenchmarkKernels(const SplineKernels<N>& kernels) {
+  using Helper = CeresSplineHelper<double, N>;
+  const std::string suffix = "_n" + std::to_string(N);
+  const std::vector<int64_t>& times_ns = kernels.times_ns;
+
+  TimeKernel("helper_so3_value" + suffix, [&]() {
+    double sum = 0.0;
+    for (const int64_t t_ns : times_ns) {
+      int64_t s;
+      double u;
+      kernels.Segment(t_ns, &s, &u);
+      const double* knots[N];
+      kernels.SO3Knots(s, knots);
+      Sophus::SO3d R;
+      Helper::template evaluate_lie<Sophus::SO3>(knots, u, kernels.inv_dt, &R);
+      sum += R.unit_quaternion().w();
+    }
+    return sum;
+  });
+  TimeKernel("helper_so3_accel" + suffix, [&]() {
+    double sum = 0.0;
+    for (const int64_t t_ns : times_ns) {
+      int64_t s;
+      double u;
+      kernels.Segment(t_ns, &s, &u);
+      const double* knots[N];
+      kernels.SO3Knots(s, knots);
+      Sophus::SO3d R;
+      Vector3d vel, accel;
+      Helper::template evaluate_lie<Sophus::SO3>(
+          knots, u, kernels.inv_dt, &R, &vel, &accel);
+      sum += vel[0] + accel[0];
+    }
+    return sum;
+  });
+  TimeKernel("helper_r3_accel" + suffix, [&]() {
+    double sum = 0.0;
+    for (const int64_t t_ns : times_ns) {
+      int64_t s;
+      double u;
+      kernels.Segment(t_ns, &s, &u);
+      const double* knots[N];
+      kernels.R3Knots(s, knots);
+      Vector3d accel;
+      Helper::template evaluate<3, 2>(knots, u, kernels.inv_dt, &accel);
+      sum += accel[0];
+    }
+    return sum;
+  });
+
+  // Jets of the size of the knot parameter blocks of one residual
+  using SO3Jet = ceres::Jet<double, 4 * N>;
+  using R3Jet = ceres::Jet<double, 3 * N>;
+  TimeKernel("helper_so3_vel_jet" + suffix, [&]() {
+    double sum = 0.0;
+    for (const int64_t t_ns : times_ns) {
+      int64_t s;
+      double u;
+      kernels.Segment(t_ns, &s, &u);
+      const double* knots[N];
+      kernels.SO3Knots(s, knots);
+      SO3Jet jets[4 * N];
+      const SO3Jet* jet_knots[N];
+      ToJets<4 * N>(knots, N, 4, jets, jet_knots);
+      Sophus::SO3<SO3Jet> R;
+      Eigen::Matrix<SO3Jet, 3, 1> vel;
+      CeresSplineHelper<SO3Jet, N>::template evaluate_lie<Sophus::SO3>(
+          jet_knots, SO3Jet(u), SO3Jet(kernels.inv_dt), &R, &vel);
+      sum += vel[0].a + vel[0].v[0];
+    }
+    return sum;
+  });
+  TimeKernel("helper_r3_accel_jet" + suffix, [&]() {
+    double sum = 0.0;
+    for (const int64_t t_ns : times_ns) {
+      int64_t s;
+      double u;
+      kernels.Segment(t_ns, &s, &u);
+      const double* knots[N];
+      kernels.R3Knots(s, knots);
+      R3Jet jets[3 * N];
+      const R3Jet* jet_knots[N];
+      ToJets<3 * N>(knots, N, 3, jets, jet_knots);
+      Eigen::Matrix<R3Jet, 3, 1> accel;
+      CeresSplineHelper<R3Jet, N>::template evaluate<3, 2>(
+          jet_knots, R3Jet(u), R3Jet(kernels.inv_dt), &accel);
+      sum += accel[0].a + accel[0].v[0];
+    }
+    return sum;
+  });
+
+  TimeKernel("closed_form_so3_value_J" + suffix, [&]() {
+    double sum = 0.0;
+    typename So3Spline<N>::JacobianStruct J;
+    for (const int64_t t_ns : times_ns) {
+      sum += kernels.so3.evaluate(t_ns, &J).unit_quaternion().w() +
+             J.d_val_d_knot[0](0, 0);
+    }
+    return sum;
+  });
+  TimeKernel("closed_form_so3_vel_J" + suffix, [&]() {
+    double sum = 0.0;
+    typename So3Spline<N>::JacobianStruct J;
+    for (const int64_t t_ns : times_ns) {
+      sum += kernels.so3.velocityBody(t_ns, &J)[0] + J.d_val_d_knot[0](0, 0);
+    }
+    return sum;
+  });
+  TimeKernel("closed_form_so3_accel_J" + suffix, [&]() {
+    double sum = 0.0;
+    typename So3Spline<N>::JacobianStruct J_accel, J_vel;
+    for (const int64_t t_ns : times_ns) {
+      Vector3d vel;
+      sum += kernels.so3.accelerationBody(t_ns, &J_accel, &vel, &J_vel)[0] +
+             J_accel.d_val_d_knot[0](0, 0) + J_vel.d_val_d_knot[0](0, 0);
+    }
+    return sum;
+  });
+  TimeKernel("closed_form_r3_accel_J" + suffix, [&]() {
+    double sum = 0.0;
+    typename RdSpline<3, N>::JacobianStruct J;
+    for (const int64_t t_ns : times_ns) {
+      sum += kernels.r3.template evaluate<2>(t_ns, &J)[0] + J.d_val_d_knot[0];
+    }
+    return sum;
+  });
+}
+
+//! Maximum difference of the closed form values and Jacobians to
+//! CeresSplineHelper and its autodiff Jacobians. The SO3 Jacobians are
+//! w.r.t. a left increment exp(delta) * knot, as in So3Spline, and the value
+//! Jacobian is the one of log(R(delta) * R(0)^-1).
+template <int N>
+double CheckJacobians(const SplineKernels<N>& kernels, std::mt19937& rng) {
+  using Jet = ceres::Jet<double, 3 * N>;
+  using Vec3Jet = Eigen::Matrix<Jet, 3, 1>;
+  std::uniform_int_distribution<size_t> time_idx(0,
+                                                 kernels.times_ns.size() - 1);
+  double max_diff = 0.0;
+  for (int c = 0; c < FLAGS_num_checks; ++c) {
+    const int64_t t_ns = kernels.times_ns[time_idx(rng)];
+    int64_t s;
+    double u;
+    kernels.Segment(t_ns, &s, &u);
+
+    typename So3Spline<N>::JacobianStruct J_val, J_vel, J_accel;
+    const Sophus::SO3d R = kernels.so3.evaluate(t_ns, &J_val);
+    Vector3d vel;
+    const Vector3d accel =
+        kernels.so3.accelerationBody(t_ns, &J_accel, &vel, &J_vel);
+
+    Sophus::SO3<Jet> jet_knots[N];
+    const Jet* jet_knot_ptrs[N];
+    for (int i = 0; i < N; ++i) {
+      Vec3Jet delta;
+      for (int j = 0; j < 3; ++j) delta[j] = Jet(0.0, 3 * i + j);
+      jet_knots[i] = Sophus::SO3<Jet>::exp(delta) *
+                     kernels.so3.getKnot(s + i).template cast<Jet>();
+      jet_knot_ptrs[i] = jet_knots[i].data();
+    }
+    Sophus::SO3<Jet> R_jet;
+    Vec3Jet vel_jet, accel_jet;
+    CeresSplineHelper<Jet, N>::template evaluate_lie<Sophus::SO3>(
+        jet_knot_ptrs, Jet(u), Jet(kernels.inv_dt), &R_jet, &vel_jet,
+        &accel_jet);
+    const Vec3Jet d_R = (R_jet * R.inverse().template cast<Jet>()).log();
+
+    for (int j = 0; j < 3; ++j) {
+      max_diff = std::max(max_diff, std::abs(d_R[j].a));
+      max_diff = std::max(max_diff, std::abs(vel_jet[j].a - vel[j]));
+      max_diff = std::max(max_diff, std::abs(accel_jet[j].a - accel[j]));
+    }
+    for (int i = 0; i < N; ++i) {
+      for (int r = 0; r < 3; ++r) {
+        for (int j = 0; j < 3; ++j) {
+          const int k = 3 * i + j;
+          const double diffs[] = {
+              d_R[r].v[k] - J_val.d_val_d_knot[i](r, j),
+              vel_jet[r].v[k] - J_vel.d_val_d_knot[i](r, j),
+              accel_jet[r].v[k] - J_accel.d_val_d_knot[i](r, j)};
+          for (const double diff : diffs) {
+            max_diff = std::max(max_diff, std::abs(diff));
+          }
+        }
+      }
+    }
+
+    typename RdSpline<3, N>::JacobianStruct J_pos;
+    const Vector3d pos_accel = kernels.r3.template evaluate<2>(t_ns, &J_pos);
+    const double* r3_knots[N];
+    kernels.R3Knots(s, r3_knots);
+    Jet r3_jets[3 * N];
+    const Jet* r3_jet_knots[N];
+    ToJets<3 * N>(r3_knots, N, 3, r3_jets, r3_jet_knots);
+    Vec3Jet pos_accel_jet;
+    CeresSplineHelper<Jet, N>::template evaluate<3, 2>(
+        r3_jet_knots, Jet(u), Jet(kernels.inv_dt), &pos_accel_jet);
+    for (int r = 0; r < 3; ++r) {
+      max_diff =
+          std::max(max_diff, std::abs(pos_accel_jet[r].a - pos_accel[r]));
+      for (int i = 0; i < N; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          const double expected = r == j ? J_pos.d_val_d_knot[i] : 0.0;
+          max_diff = std::max(
+              max_diff, std::abs(pos_accel_jet[r].v[3 * i + j] - expected));
+        }
+      }
+    }
+  }
+  return max_diff;
+}
+
+template <int N>
+bool RunOrder(std::mt19937& rng) {
+  const SplineKernels<N> kernels(rng);
+  BenchmarkKernels<N>(kernels);
+  const double max_diff = CheckJacobians<N>(kernels, rng);
+  const bool ok = max_diff <= FLAGS_tolerance;
+  std::cout << "closed form vs autodiff n" << N << ": max difference "
+            << std::scientific << max_diff << std::defaultfloat
+            << (ok ? "" : " FAILED") << std::endl;
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_num_evaluations, 0);
+  CHECK_GT(FLAGS_num_knots, 6);
+
+  std::mt19937 rng(FLAGS_seed);
+  bool ok = RunOrder<4>(rng);
+  ok = RunOrder<5>(rng) && ok;
+  ok = RunOrder<6>(rng) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,359 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Measures how the continuous time IMU to camera calibration scales with the
+// recording length, the knot spacing and the number of threads. For every
+// combination a synthetic recording in front of a radon board is simulated,
+// the spline is initialized (problem construction) and optimized for a fixed
+// number of iterations. Problem size, timings and peak memory are written as
+// one CSV row per run.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/synthetic_data.h"
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+
+DEFINE_string(durations_s,
+              "30,120,600,1800",
+              "Comma separated recording lengths in seconds.");
+DEFINE_string(knot_spacings_s,
+              "0.1,0.05",
+              "Comma separated SO3 and R3 knot spacings in seconds.");
+DEFINE_string(num_threads,
+              "1,2,4,8",
+              "Comma separated thread counts for construction and solve.");
+DEFINE_int32(spline_order, SPLINE_N, "Order of the estimated spline.");
+DEFINE_int32(iterations, 5, "Solver iterations per run.");
+DEFINE_double(imu_rate_hz, 200.0, "Rate of the simulated IMU.");
+DEFINE_double(camera_fps, 30.0, "Frame rate of the simulated camera.");
+DEFINE_string(output_dir, "/tmp", "Folder for the simulated scenes.");
+DEFINE_string(output_csv,
+              "spline_scaling.csv",
+              "One row per duration, knot spacing and thread count.");
+
+namespace {
+
+const int kImageWidth = 1920;
+const int kImageHeight = 1080;
+const double kFocalLength = 1000.0;
+const double kPixelNoise = 0.3;
+const double kSquareLength = 0.021;
+
+//! Problem size and timings of one run
+struct ScalingRun {
+  double duration_s = 0.0;
+  double knot_spacing_s = 0.0;
+  int num_threads = 0;
+  size_t num_views = 0;
+  size_t num_imu_samples = 0;
+  size_t num_so3_knots = 0;
+  size_t num_r3_knots = 0;
+  SplineProblemMemoryReport problem;
+  double construction_s = 0.0;
+  double solve_s = 0.0;
+  size_t iterations = 0;
+  double residual_evaluation_s = 0.0;
+  double jacobian_evaluation_s = 0.0;
+  double linear_solver_s = 0.0;
+  double final_cost = 0.0;
+  double peak_rss_mb = 0.0;
+};
+
+//! Synthetic recording of one duration
+struct Recording {
+  double duration_s = 0.0;
+  CameraTelemetryData telemetry;
+  std::shared_ptr<theia::Reconstruction> recon;
+  std::unique_ptr<utils::SyntheticTrajectory> trajectory;
+};
+
+template <typename T>
+std::vector<T> ParseList(const std::string& str) {
+  std::vector<T> values;
+  std::stringstream stream(str);
+  for (std::string value; std::getline(stream, value, ',');) {
+    std::stringstream value_stream(value);
+    T v;
+    if (value_stream >> v) {
+      values.push_back(v);
+    }
+  }
+  return values;
+}
+
+theia::Camera SyntheticCamera() {
+  theia::Camera camera;
+  camera.SetCameraIntrinsicsModelType(
+      theia::CameraIntrinsicsModelType::PINHOLE);
+  camera.SetImageSize(kImageWidth, kImageHeight);
+  camera.SetFocalLength(kFocalLength);
+  camera.SetPrincipalPoint(kImageWidth / 2.0, kImageHeight / 2.0);
+  return camera;
+}
+
+//! Resets the peak resident set size of the process, so that the next
+//! PeakRssMB only covers the following run. False if the kernel does not
+//! support it, the peak then covers all runs so far.
+bool ResetPeakRss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  if (!clear_refs.is_open()) {
+    return false;
+  }
+  clear_refs << "5";
+  return static_cast<bool>(clear_refs.flush());
+}
+
+//! VmHWM of /proc/self/status in MB, which follows ResetPeakRss. Falls back
+//! to utils::PeakRssMB
+double PeakRssMB() {
+  std::ifstream status("/proc/self/status");
+  for (std::string line; std::getline(status, line);) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stod(line.substr(6)) / 1024.0;
+    }
+  }
+  return utils::PeakRssMB();
+}
+
+//! Vision dataset for the spline with the ground truth camera poses
+void SceneToCalibDataset(const nlohmann::json& scene_json,
+                         const utils::SyntheticTrajectory& trajectory,
+                         const theia::Camera& camera,
+                         theia::Reconstruction* recon) {
+  io::scene_to_calib_dataset(scene_json, *recon);
+  const theia::CameraIntrinsicsPrior intrinsics_prior =
+      camera.CameraIntrinsicsPriorFromIntrinsics();
+  for (const theia::ViewId view_id : recon->ViewIds()) {
+    theia::View* view = recon->MutableView(view_id);
+    theia::Camera* view_cam = view->MutableCamera();
+    view_cam->SetFromCameraIntrinsicsPriors(intrinsics_prior);
+    const Sophus::SE3d T_w_c = trajectory.CameraPose(view->GetTimestamp());
+    view_cam->SetOrientationFromRotationMatrix(T_w_c.so3().inverse().matrix());
+    view_cam->SetPosition(T_w_c.translation());
+  }
+}
+
+Recording SimulateRecording(const double duration_s,
+                            const utils::SyntheticImuOptions& imu_options) {
+  // the radon board geometry needs no detector parameters
+  BoardExtractor board;
+  board.InitializeRadonBoard(kSquareLength, 14, 9);
+  const std::vector<cv::Point3f> board_pts = board.GetBoardPts()[0];
+  const std::vector<int> board_pt_ids = board.GetRadonBoardIDs();
+  Eigen::Vector3d board_center(0.0, 0.0, 0.0);
+  for (const cv::Point3f& p : board_pts) {
+    board_center += Eigen::Vector3d(p.x, p.y, p.z) / board_pts.size();
+  }
+  const theia::Camera camera = SyntheticCamera();
+  const Sophus::SE3d T_i_c(
+      Sophus::SO3d::exp(Eigen::Vector3d(0.01, -0.02, M_PI / 2.0)),
+      Eigen::Vector3d(0.01, 0.02, 0.005));
+
+  Recording recording;
+  recording.duration_s = duration_s;
+  utils::SyntheticMotionOptions motion_options;
+  motion_options.duration_s = duration_s;
+  recording.trajectory.reset(
+      new utils::SyntheticTrajectory(motion_options, board_center, T_i_c));
+  utils::SimulateTelemetry(*recording.trajectory,
+                           imu_options,
+                           FLAGS_camera_fps,
+                           &recording.telemetry);
+
+  const std::string scene_path =
+      FLAGS_output_dir + "/spline_scaling_scene.uson";
+  std::unique_ptr<io::SceneWriter> scene_writer =
+      io::CreateSceneWriter(scene_path);
+  CHECK(scene_writer->Open(scene_path)) << "Could not open " << scene_path;
+  utils::SimulateScene(*recording.trajectory,
+                       camera,
+                       board_pts,
+                       board_pt_ids,
+                       recording.telemetry.img_timestamps_s,
+                       kPixelNoise,
+                       42,
+                       scene_writer.get());
+  CHECK(scene_writer->Close(utils::SyntheticSceneHeader(camera,
+                                                        FLAGS_camera_fps,
+                                                        BoardType::RADON,
+                                                        kSquareLength,
+                                                        board_pts,
+                                                        board_pt_ids)))
+      << "Could not write " << scene_path;
+  nlohmann::json scene_json;
+  CHECK(io::read_scene_bson(scene_path, scene_json))
+      << "Failed to load " << scene_path;
+  recording.recon = std::make_shared<theia::Reconstruction>();
+  SceneToCalibDataset(
+      scene_json, *recording.trajectory, camera, recording.recon.get());
+  return recording;
+}
+
+template <int kN>
+ScalingRun RunCalibration(const Recording& recording,
+                          const utils::SyntheticImuOptions& imu_options,
+                          const double knot_spacing_s,
+                          const int num_threads) {
+  ScalingRun run;
+  run.duration_s = recording.duration_s;
+  run.knot_spacing_s = knot_spacing_s;
+  run.num_threads = num_threads;
+  run.num_views = recording.recon->NumViews();
+  run.num_imu_samples = recording.telemetry.accelerometer.size();
+
+  SplineWeightingData weight_data;
+  weight_data.dt_r3 = knot_spacing_s;
+  weight_data.dt_so3 = knot_spacing_s;
+  weight_data.std_r3 =
+      imu_options.accl_noise_density * std::sqrt(imu_options.imu_rate_hz);
+  weight_data.std_so3 =
+      imu_options.gyro_noise_density * std::sqrt(imu_options.imu_rate_hz);
+  weight_data.cam_fps = FLAGS_camera_fps;
+
+  ResetPeakRss();
+  std::unique_ptr<ImuCameraCalibratorT<kN>> calibrator(
+      new ImuCameraCalibratorT<kN>());
+  calibrator->SetNumThreads(num_threads);
+  const auto construction_start = std::chrono::steady_clock::now();
+  calibrator->BatchInitSpline(recording.recon,
+                              recording.trajectory->T_i_c(),
+                              weight_data,
+                              0.0,
+                              recording.telemetry,
+                              0.0,
+                              ThreeAxisSensorCalibParams<double>(),
+                              ThreeAxisSensorCalibParams<double>());
+  run.construction_s = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() -
+                           construction_start)
+                           .count();
+  run.num_so3_knots = calibrator->trajectory_.GetNumSO3Knots();
+  run.num_r3_knots = calibrator->trajectory_.GetNumR3Knots();
+  run.problem = calibrator->trajectory_.GetProblemMemoryReport();
+
+  SplineSolverOptions solver_options;
+  solver_options.num_threads = num_threads;
+  calibrator->trajectory_.ClearSolverLog();
+  const auto solve_start = std::chrono::steady_clock::now();
+  calibrator->Optimize(FLAGS_iterations,
+                       SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C |
+                           SplineOptimFlags::GRAVITY_DIR,
+                       solver_options);
+  run.solve_s = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - solve_start)
+                    .count();
+  for (const SolverRunLog& log : calibrator->trajectory_.GetSolverLog()) {
+    run.iterations += log.iterations.size();
+    run.residual_evaluation_s += log.residual_evaluation_time_s;
+    run.jacobian_evaluation_s += log.jacobian_evaluation_time_s;
+    run.linear_solver_s += log.linear_solver_time_s;
+    run.final_cost = log.final_cost;
+  }
+  run.peak_rss_mb = PeakRssMB();
+  return run;
+}
+
+void WriteCsvHeader(std::ostream& csv) {
+  csv << "duration_s,knot_spacing_s,num_threads,num_views,num_imu_samples,"
+         "num_so3_knots,num_r3_knots,num_parameter_blocks,num_parameters,"
+         "num_residual_blocks,num_residuals,construction_s,solve_s,"
+         "iterations,time_per_iteration_s,residual_evaluation_s,"
+         "jacobian_evaluation_s,linear_solver_s,final_cost,peak_rss_mb\n";
+}
+
+void WriteCsvRow(const ScalingRun& run, std::ostream& csv) {
+  const double time_per_iteration_s =
+      run.iterations > 0 ? run.solve_s / run.iterations : 0.0;
+  csv << run.duration_s << "," << run.knot_spacing_s << ","
+      << run.num_threads << "," << run.num_views << ","
+      << run.num_imu_samples << "," << run.num_so3_knots << ","
+      << run.num_r3_knots << "," << run.problem.num_parameter_blocks << ","
+      << run.problem.num_parameters << ","
+      << run.problem.num_residual_blocks << ","
+      << run.problem.num_residuals << "," << run.construction_s << ","
+      << run.solve_s << "," << run.iterations << ","
+      << time_per_iteration_s << "," << run.residual_evaluation_s << ","
+      << run.jacobian_evaluation_s << "," << run.linear_solver_s << ","
+      << run.final_cost << "," << run.peak_rss_mb << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  const std::vector<double> durations_s = ParseList<double>(FLAGS_durations_s);
+  const std::vector<double> knot_spacings_s =
+      ParseList<double>(FLAGS_knot_spacings_s);
+  const std::vector<int> thread_counts = ParseList<int>(FLAGS_num_threads);
+  CHECK(!durations_s.empty() && !knot_spacings_s.empty() &&
+        !thread_counts.empty())
+      << "Empty sweep.";
+
+  std::ofstream csv(FLAGS_output_csv);
+  CHECK(csv.is_open()) << "Could not open " << FLAGS_output_csv;
+  WriteCsvHeader(csv);
+  if (!ResetPeakRss()) {
+    LOG(WARNING) << "Can not reset the peak memory, peak_rss_mb covers all "
+                    "runs up to the current one.";
+  }
+
+  utils::SyntheticImuOptions imu_options;
+  imu_options.imu_rate_hz = FLAGS_imu_rate_hz;
+  for (const double duration_s : durations_s) {
+    const Recording recording = SimulateRecording(duration_s, imu_options);
+    LOG(INFO) << "Simulated " << duration_s << "s with "
+              << recording.recon->NumViews() << " views and "
+              << recording.telemetry.accelerometer.size() << " IMU samples.";
+    for (const double knot_spacing_s : knot_spacings_s) {
+      for (const int num_threads : thread_counts) {
+        ScalingRun run;
+        const bool supported_order =
+            DispatchSplineOrder(FLAGS_spline_order, [&](auto n) {
+              run = RunCalibration<decltype(n)::value>(
+                  recording, imu_options, knot_spacing_s, num_threads);
+            });
+        CHECK(supported_order)
+            << "Unsupported spline order " << FLAGS_spline_order;
+        WriteCsvRow(run, csv);
+        csv.flush();
+        std::cout << duration_s << "s, knots every " << knot_spacing_s
+                  << "s, " << num_threads << " threads: construction "
+                  << run.construction_s << "s, " << run.iterations
+                  << " iterations in " << run.solve_s << "s, peak "
+                  << run.peak_rss_mb << "MB" << std::endl;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,104 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+
+using namespace OpenICC;
+
+DEFINE_string(telemetry_json,
+              "/tmp/synthetic_telemetry.json",
+              "Telemetry json to load. Generated if it does not exist.");
+DEFINE_double(duration_s, 3600.0, "Duration of the synthetic telemetry.");
+DEFINE_double(imu_rate_hz, 1600.0, "IMU rate of the synthetic telemetry.");
+
+bool WriteSyntheticTelemetry(const std::string& path,
+                             const double duration_s,
+                             const double rate_hz) {
+  std::ofstream file(path);
+  if (!file.is_open()) {
+    return false;
+  }
+  const size_t nr_samples = static_cast<size_t>(duration_s * rate_hz);
+  const double dt_ns = 1e9 / rate_hz;
+  file << std::setprecision(12);
+  file << "{\"timestamps_ns\":[";
+  for (size_t i = 0; i < nr_samples; ++i) {
+    file << (i ? "," : "") << static_cast<int64_t>(i * dt_ns);
+  }
+  file << "],\"accelerometer\":[";
+  for (size_t i = 0; i < nr_samples; ++i) {
+    const double t = i / rate_hz;
+    file << (i ? "," : "") << "[" << 0.1 * std::sin(t) << ","
+         << 0.1 * std::cos(t) << "," << 9.81 + 0.01 * std::sin(3 * t) << "]";
+  }
+  file << "],\"gyroscope\":[";
+  for (size_t i = 0; i < nr_samples; ++i) {
+    const double t = i / rate_hz;
+    file << (i ? "," : "") << "[" << 0.5 * std::sin(2 * t) << ","
+         << 0.5 * std::cos(2 * t) << "," << 0.01 * t << "]";
+  }
+  file << "]}";
+  return true;
+}
+
+template <typename Reader>
+double TimeReader(Reader reader, CameraTelemetryData& telemetry) {
+  const auto start = std::chrono::steady_clock::now();
+  CHECK(reader(FLAGS_telemetry_json, telemetry))
+      << "Could not read: " << FLAGS_telemetry_json;
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  std::ifstream test_exist(FLAGS_telemetry_json);
+  if (!test_exist.good()) {
+    LOG(INFO) << "Writing synthetic telemetry to " << FLAGS_telemetry_json;
+    CHECK(WriteSyntheticTelemetry(
+        FLAGS_telemetry_json, FLAGS_duration_s, FLAGS_imu_rate_hz));
+  }
+
+  CameraTelemetryData telemetry_sax, telemetry_dom;
+  const double t_sax = TimeReader(io::ReadTelemetryJSON, telemetry_sax);
+  const double t_dom = TimeReader(io::ReadTelemetryJSONDom, telemetry_dom);
+
+  CHECK_EQ(telemetry_sax.accelerometer.size(),
+           telemetry_dom.accelerometer.size());
+  for (size_t i = 0; i < telemetry_sax.accelerometer.size(); ++i) {
+    CHECK_EQ(telemetry_sax.accelerometer[i].timestamp_s(),
+             telemetry_dom.accelerometer[i].timestamp_s());
+    CHECK(telemetry_sax.accelerometer[i].data() ==
+          telemetry_dom.accelerometer[i].data());
+    CHECK(telemetry_sax.gyroscope[i].data() ==
+          telemetry_dom.gyroscope[i].data());
+  }
+
+  std::cout << "Samples: " << telemetry_sax.accelerometer.size() << "\n";
+  std::cout << "Streaming reader: " << t_sax << "s\n";
+  std::cout << "DOM reader:       " << t_dom << "s\n";
+  return 0;
+}
@@ -15,10 +15,18 @@
 
 #include <gflags/gflags.h>
 
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "OpenCameraCalibrator/core/camera_calibrator.h"
 #include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/execution_context.h"
 #include "OpenCameraCalibrator/utils/intrinsic_initializer.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
 
 using namespace OpenICC;
 using namespace OpenICC::core;
@@ -28,36 +36,175 @@ DEFINE_string(camera_model_to_calibrate,
               "DOUBLE_SPHERE",
               "What camera model do you want to calibrate. Options:"
               "PINHOLE,PINHOLE_RADIAL_TANGENTIAL,DIVISION_UNDISTORTION,DOUBLE_"
-              "SPHERE,EXTENDED_UNIFIED,FISHEYE");
+              "SPHERE,EXTENDED_UNIFIED,FISHEYE. A comma separated list "
+              "calibrates all of them concurrently and reports the one with "
+              "the lowest reprojection error.");
 DEFINE_string(save_path_calib_dataset,
               "",
               "Where to save the recon dataset to.");
 DEFINE_double(grid_size,
               0.04,
               "Only take images that are at least grid_size apart");
+DEFINE_double(orientation_bin_size_deg,
+              0.0,
+              "Also keep views with the same position but a viewing direction "
+              "in another bin of this angular size. 0 only bins positions.");
+DEFINE_bool(keep_most_corners_per_voxel,
+            false,
+            "Keep the view with the most corners per voxel instead of the "
+            "first one.");
+DEFINE_int32(max_information_views,
+             0,
+             "Greedily keep at most this many of the voxel filtered views by "
+             "their information on the intrinsics. 0 keeps all of them.");
+DEFINE_double(min_information_gain,
+              1e-2,
+              "Stop the information based view selection once no view "
+              "increases the log determinant by this much.");
 DEFINE_bool(optimize_board_points,
             false,
             "If in the end also the scene points should be adjusted. (if the "
             "board is not planar)");
+DEFINE_bool(fast_board_point_refinement,
+            false,
+            "Refine the board points jointly with the camera poses by a "
+            "Schur complement solver before the final bundle adjustment.");
+DEFINE_int32(max_intrinsics_candidates,
+             64,
+             "Number of per view intrinsics that are scored to initialize "
+             "the distortion models. 0 scores all views.");
+DEFINE_int32(max_intrinsics_scoring_views,
+             64,
+             "Number of random views every intrinsics candidate is scored "
+             "on. 0 uses all views.");
+DEFINE_double(time_budget_s,
+              0.0,
+              "Wall clock budget in seconds of the bundle adjustment stages, "
+              "the best solution so far is kept when it is used up. 0 is "
+              "unlimited.");
 DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_int32(num_threads,
+             0,
+             "Number of threads used to initialize the views and in the "
+             "bundle adjustment. 0 uses every CPU the process may run on.");
+DEFINE_string(cpu_affinity,
+              "",
+              "Optional. CPUs to pin the process to, e.g. \"0-3,8\". Keeps "
+              "concurrent calibrations on one machine from competing for the "
+              "same cores.");
+DEFINE_int32(numa_node,
+             -1,
+             "Optional. Pin the process to the CPUs of this NUMA node.");
+DEFINE_bool(deterministic,
+            false,
+            "Reproduce the results bit for bit, independent of num_threads. "
+            "The Ceres solves run on one thread.");
+DEFINE_string(profile_report_json,
+              "",
+              "Optional. Writes wall time, cpu time, peak memory and item "
+              "counts of the pipeline stages to this json.");
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
+  if (!utils::ConfigureExecutionContext(
+          FLAGS_num_threads,
+          FLAGS_cpu_affinity,
+          FLAGS_numa_node,
+          FLAGS_deterministic)) {
+    LOG(ERROR) << "Could not configure the execution context.";
+    return -1;
+  }
+  FLAGS_num_threads = utils::ExecutionContext::NumThreads();
+  utils::Profiler::Instance().SetEnabled(!FLAGS_profile_report_json.empty());
 
   nlohmann::json scene_json;
   CHECK(io::read_scene_bson(FLAGS_input_corners, scene_json))
       << "Failed to load " << FLAGS_input_corners;
 
-  CameraCalibrator camera_calibrator(FLAGS_camera_model_to_calibrate,
-                                     FLAGS_optimize_board_points);
-  camera_calibrator.SetGridSize(FLAGS_grid_size);
-  if (FLAGS_verbose) {
-    camera_calibrator.SetVerbose();
+  std::vector<std::string> camera_models;
+  std::stringstream model_list(FLAGS_camera_model_to_calibrate);
+  for (std::string model; std::getline(model_list, model, ',');) {
+    if (!model.empty()) camera_models.push_back(model);
+  }
+  CHECK(!camera_models.empty()) << "No camera model to calibrate.";
+  const int nr_models = static_cast<int>(camera_models.size());
+  // the threads are split between the models that run concurrently
+  const int threads_per_model = std::max(1, FLAGS_num_threads / nr_models);
+
+  std::vector<std::unique_ptr<CameraCalibrator>> calibrators;
+  for (const std::string& camera_model : camera_models) {
+    std::unique_ptr<CameraCalibrator> camera_calibrator(
+        new CameraCalibrator(camera_model, FLAGS_optimize_board_points));
+    camera_calibrator->SetGridSize(FLAGS_grid_size);
+    camera_calibrator->SetOrientationBinSize(FLAGS_orientation_bin_size_deg);
+    camera_calibrator->SetKeepMostCornersPerVoxel(
+        FLAGS_keep_most_corners_per_voxel);
+    camera_calibrator->SetInformationViewSelection(
+        std::max(0, FLAGS_max_information_views), FLAGS_min_information_gain);
+    camera_calibrator->SetNumThreads(threads_per_model);
+    camera_calibrator->SetFastBoardPointRefinement(
+        FLAGS_fast_board_point_refinement);
+    camera_calibrator->SetIntrinsicsCandidateSampling(
+        std::max(0, FLAGS_max_intrinsics_candidates),
+        std::max(0, FLAGS_max_intrinsics_scoring_views));
+    if (nr_models > 1) {
+      camera_calibrator->SetBundleAdjustmentThreads(threads_per_model);
+    }
+    camera_calibrator->SetTimeBudget(FLAGS_time_budget_s);
+    if (FLAGS_verbose) {
+      camera_calibrator->SetVerbose();
+    }
+    calibrators.push_back(std::move(camera_calibrator));
+  }
+
+  // all calibrators only read the scene json
+  auto calibrate = [&](const int m) {
+    std::string save_path = FLAGS_save_path_calib_dataset;
+    if (nr_models > 1 && !save_path.empty()) {
+      save_path += "_" + camera_models[m];
+    }
+    calibrators[m]->CalibrateCameraFromJson(scene_json, save_path);
+  };
+  if (nr_models == 1) {
+    calibrate(0);
+  } else {
+    std::vector<std::thread> threads;
+    for (int m = 0; m < nr_models; ++m) {
+      threads.emplace_back(calibrate, m);
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+  int best_model = -1;
+  for (int m = 0; m < nr_models; ++m) {
+    const double reproj_error = calibrators[m]->GetReprojectionError();
+    if (reproj_error < 0.0) {
+      std::cout << camera_models[m] << ": calibration failed.\n";
+      continue;
+    }
+    std::cout << camera_models[m] << ": reprojection error " << reproj_error
+              << "px\n";
+    calibrators[m]->PrintResult();
+    if (!calibrators[m]->GetTimeBudgetReport().is_null()) {
+      std::cout << "Time budget: "
+                << calibrators[m]->GetTimeBudgetReport().dump() << "\n";
+    }
+    if (best_model < 0 ||
+        reproj_error < calibrators[best_model]->GetReprojectionError()) {
+      best_model = m;
+    }
+  }
+  if (nr_models > 1 && best_model >= 0) {
+    std::cout << "Best camera model: " << camera_models[best_model]
+              << " with reprojection error "
+              << calibrators[best_model]->GetReprojectionError() << "px\n";
+  }
+  if (!FLAGS_profile_report_json.empty()) {
+    utils::Profiler::Instance().WriteReport(FLAGS_profile_report_json);
   }
-  camera_calibrator.CalibrateCameraFromJson(scene_json,
-                                            FLAGS_save_path_calib_dataset);
-  camera_calibrator.PrintResult();
 
   return 0;
 }
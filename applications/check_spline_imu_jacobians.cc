@@ -0,0 +1,228 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Compares the closed form and the compile time sized autodiff Jacobians of
+// the spline IMU residuals against DynamicAutoDiffCostFunction on random
+// splines. Returns 1 if they do not agree.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_analytic_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_fixed_size_cost_function.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+
+DEFINE_int32(num_trials, 100, "Number of random splines to check.");
+DEFINE_double(tolerance, 1e-6, "Maximum allowed absolute difference.");
+
+using Eigen::Matrix;
+using Eigen::RowMajor;
+using Eigen::Vector3d;
+
+const int N = OpenICC::core::SPLINE_N;
+
+struct RandomParameters {
+  std::vector<Sophus::SO3d> so3_knots;
+  std::vector<Vector3d> r3_knots;
+  std::vector<Vector3d> bias_knots;
+  Vector3d gravity;
+  Matrix<double, 6, 1> accl_intrinsics;
+  Matrix<double, 9, 1> gyro_intrinsics;
+};
+
+RandomParameters CreateRandomParameters(std::mt19937& rng) {
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  auto random_vec = [&]() { return Vector3d(dist(rng), dist(rng), dist(rng)); };
+  RandomParameters params;
+  for (int i = 0; i < N; ++i) {
+    params.so3_knots.push_back(Sophus::SO3d::exp(random_vec()));
+    params.r3_knots.push_back(random_vec());
+  }
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    params.bias_knots.push_back(0.1 * random_vec());
+  }
+  params.gravity = Vector3d(0.0, 0.0, -9.81) + 0.1 * random_vec();
+  params.accl_intrinsics << 0.01 * dist(rng), 0.01 * dist(rng),
+      0.01 * dist(rng), 1.0 + 0.01 * dist(rng), 1.0 + 0.01 * dist(rng),
+      1.0 + 0.01 * dist(rng);
+  params.gyro_intrinsics.head<6>() = 0.01 * Matrix<double, 6, 1>::Random();
+  params.gyro_intrinsics.tail<3>() =
+      Vector3d::Ones() + 0.01 * Vector3d::Random();
+  return params;
+}
+
+//! Evaluates both cost functions and compares residuals and Jacobians. SO3
+//! knot Jacobians are compared in the tangent space of the local
+//! parameterization, as that is what the solver uses.
+double MaxDifference(const ceres::CostFunction& analytic,
+                     const ceres::CostFunction& autodiff,
+                     const std::vector<double*>& params,
+                     const int num_so3_blocks) {
+  const std::vector<int32_t>& sizes = analytic.parameter_block_sizes();
+  CHECK(sizes == autodiff.parameter_block_sizes());
+  const int num_residuals = analytic.num_residuals();
+
+  std::vector<double> res_analytic(num_residuals), res_autodiff(num_residuals);
+  std::vector<std::vector<double>> jac_analytic(sizes.size()),
+      jac_autodiff(sizes.size());
+  std::vector<double*> jac_analytic_ptrs, jac_autodiff_ptrs;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    jac_analytic[i].resize(num_residuals * sizes[i]);
+    jac_autodiff[i].resize(num_residuals * sizes[i]);
+    jac_analytic_ptrs.push_back(jac_analytic[i].data());
+    jac_autodiff_ptrs.push_back(jac_autodiff[i].data());
+  }
+  CHECK(analytic.Evaluate(
+      params.data(), res_analytic.data(), jac_analytic_ptrs.data()));
+  CHECK(autodiff.Evaluate(
+      params.data(), res_autodiff.data(), jac_autodiff_ptrs.data()));
+
+  double max_diff = 0.0;
+  for (int r = 0; r < num_residuals; ++r) {
+    max_diff = std::max(max_diff, std::abs(res_analytic[r] - res_autodiff[r]));
+  }
+
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    Eigen::Map<Matrix<double, Eigen::Dynamic, Eigen::Dynamic, RowMajor>> J_an(
+        jac_analytic[i].data(), num_residuals, sizes[i]);
+    Eigen::Map<Matrix<double, Eigen::Dynamic, Eigen::Dynamic, RowMajor>> J_ad(
+        jac_autodiff[i].data(), num_residuals, sizes[i]);
+    if (static_cast<int>(i) < num_so3_blocks) {
+      Eigen::Map<Sophus::SO3d const> const R(params[i]);
+      const Matrix<double, 4, 3> J_plus = R.Dx_this_mul_exp_x_at_0();
+      max_diff = std::max(
+          max_diff, (J_an * J_plus - J_ad * J_plus).cwiseAbs().maxCoeff());
+    } else {
+      max_diff = std::max(max_diff, (J_an - J_ad).cwiseAbs().maxCoeff());
+    }
+  }
+  return max_diff;
+}
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+  double max_diff_accl = 0.0;
+  double max_diff_gyro = 0.0;
+  for (int trial = 0; trial < FLAGS_num_trials; ++trial) {
+    RandomParameters p = CreateRandomParameters(rng);
+    const Vector3d meas = Vector3d::Random();
+    const double u_so3 = unit(rng), u_r3 = unit(rng), u_bias = unit(rng);
+    const double inv_so3_dt = 10.0, inv_r3_dt = 10.0, inv_bias_dt = 0.5;
+    const double inv_std = 2.0;
+
+    // accelerometer
+    {
+      using FunctorT = AccelerationCostFunctorSplit<N>;
+      auto* autodiff = new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+          new FunctorT(meas,
+                       u_r3,
+                       inv_r3_dt,
+                       u_so3,
+                       inv_so3_dt,
+                       inv_std,
+                       u_bias,
+                       inv_bias_dt));
+      std::unique_ptr<ceres::CostFunction> autodiff_ptr(autodiff);
+      AccelerationCostFunctionSplitAnalytic<N> analytic(meas,
+                                                        u_r3,
+                                                        inv_r3_dt,
+                                                        u_so3,
+                                                        inv_so3_dt,
+                                                        inv_std,
+                                                        u_bias,
+                                                        inv_bias_dt);
+      std::vector<double*> params;
+      for (int i = 0; i < N; ++i) {
+        autodiff->AddParameterBlock(4);
+        params.push_back(p.so3_knots[i].data());
+      }
+      for (int i = 0; i < N; ++i) {
+        autodiff->AddParameterBlock(3);
+        params.push_back(p.r3_knots[i].data());
+      }
+      for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+        autodiff->AddParameterBlock(3);
+        params.push_back(p.bias_knots[i].data());
+      }
+      autodiff->AddParameterBlock(3);
+      params.push_back(p.gravity.data());
+      autodiff->AddParameterBlock(6);
+      params.push_back(p.accl_intrinsics.data());
+      autodiff->SetNumResiduals(3);
+      std::unique_ptr<ceres::CostFunction> fixed_size(
+          CreateFixedSizeCostFunction<3, AccelerationBlockSizes<N>>(
+              new FunctorT(meas,
+                           u_r3,
+                           inv_r3_dt,
+                           u_so3,
+                           inv_so3_dt,
+                           inv_std,
+                           u_bias,
+                           inv_bias_dt)));
+      max_diff_accl = std::max(max_diff_accl,
+                               MaxDifference(analytic, *autodiff, params, N));
+      max_diff_accl = std::max(
+          max_diff_accl, MaxDifference(*fixed_size, *autodiff, params, N));
+    }
+
+    // gyroscope
+    {
+      using FunctorT = GyroCostFunctorSplit<N, Sophus::SO3, false>;
+      auto* autodiff = new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+          new FunctorT(meas, u_so3, inv_so3_dt, inv_std, u_bias, inv_bias_dt));
+      std::unique_ptr<ceres::CostFunction> autodiff_ptr(autodiff);
+      GyroCostFunctionSplitAnalytic<N> analytic(
+          meas, u_so3, inv_so3_dt, inv_std, u_bias, inv_bias_dt);
+      std::vector<double*> params;
+      for (int i = 0; i < N; ++i) {
+        autodiff->AddParameterBlock(4);
+        params.push_back(p.so3_knots[i].data());
+      }
+      for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+        autodiff->AddParameterBlock(3);
+        params.push_back(p.bias_knots[i].data());
+      }
+      autodiff->AddParameterBlock(9);
+      params.push_back(p.gyro_intrinsics.data());
+      autodiff->SetNumResiduals(3);
+      std::unique_ptr<ceres::CostFunction> fixed_size(
+          CreateFixedSizeCostFunction<3, GyroBlockSizes<N>>(new FunctorT(
+              meas, u_so3, inv_so3_dt, inv_std, u_bias, inv_bias_dt)));
+      max_diff_gyro = std::max(max_diff_gyro,
+                               MaxDifference(analytic, *autodiff, params, N));
+      max_diff_gyro = std::max(
+          max_diff_gyro, MaxDifference(*fixed_size, *autodiff, params, N));
+    }
+  }
+
+  LOG(INFO) << "Max difference accelerometer residual: " << max_diff_accl;
+  LOG(INFO) << "Max difference gyroscope residual: " << max_diff_gyro;
+  if (max_diff_accl > FLAGS_tolerance || max_diff_gyro > FLAGS_tolerance) {
+    LOG(ERROR) << "Jacobians differ from DynamicAutoDiffCostFunction!";
+    return 1;
+  }
+  LOG(INFO) << "All Jacobians agree.";
+  return 0;
+}
@@ -0,0 +1,249 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Checks that the hot paths do not allocate in steady state: one evaluation
+// of the spline IMU residuals and of the static gyroscope residual, and the
+// board extraction of a frame after a few warm up frames. Needs a build with
+// BUILD_WITH_ALLOCATION_COUNTING, which counts the operator new calls of the
+// calling thread (see utils/allocation_counter.h). The board extraction is
+// only checked if an image is given. Returns 1 if anything allocates.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_analytic_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_fixed_size_cost_function.h"
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/static_imu_calibrator.h"
+#include "OpenCameraCalibrator/utils/allocation_counter.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+
+DEFINE_int32(num_evaluations, 1000, "Evaluations per residual.");
+DEFINE_string(image_path,
+              "",
+              "Optional. Image of a board to check the board extraction on.");
+DEFINE_string(board_type,
+              "apriltag",
+              "Board type of the image. (charuco, radon, apriltag)");
+DEFINE_string(aruco_detector_params, "", "Path detector yaml.");
+DEFINE_double(checker_square_length_m,
+              0.022,
+              "Size of one square on the checkerboard in [m].");
+DEFINE_int32(num_squares_x, 9, "Number of squares in x.");
+DEFINE_int32(num_squares_y, 7, "Number of squares in y");
+DEFINE_int32(aruco_dict,
+             cv::aruco::DICT_ARUCO_ORIGINAL,
+             "Aruco dictionary id.");
+DEFINE_int32(num_warmup_frames,
+             3,
+             "Frames extracted before counting, e.g. to size the buffers.");
+DEFINE_int32(num_frames, 10, "Counted frames.");
+DEFINE_string(profile_report_json,
+              "",
+              "Optional. Writes the allocations per stage of the counted "
+              "frames to this json, to find the stage that allocates.");
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+using namespace OpenICC::utils;
+
+using Eigen::Vector3d;
+
+const int N = SPLINE_N;
+
+//! Allocations of FLAGS_num_evaluations evaluations of cost with and without
+//! Jacobians. The first evaluation is not counted.
+size_t CountEvaluationAllocations(const std::string& name,
+                                  const ceres::CostFunction& cost,
+                                  const std::vector<double*>& params) {
+  const std::vector<int32_t>& sizes = cost.parameter_block_sizes();
+  CHECK_EQ(sizes.size(), params.size());
+  std::vector<double> residuals(cost.num_residuals());
+  std::vector<std::vector<double>> jacobians(sizes.size());
+  std::vector<double*> jacobian_ptrs;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    jacobians[i].resize(cost.num_residuals() * sizes[i]);
+    jacobian_ptrs.push_back(jacobians[i].data());
+  }
+
+  CHECK(cost.Evaluate(params.data(), residuals.data(), jacobian_ptrs.data()));
+  ScopedAllocationCounter counter;
+  for (int i = 0; i < FLAGS_num_evaluations; ++i) {
+    cost.Evaluate(params.data(), residuals.data(), nullptr);
+    cost.Evaluate(params.data(), residuals.data(), jacobian_ptrs.data());
+  }
+  const AllocationCount count = counter.Count();
+  LOG(INFO) << name << ": " << count.allocations << " allocations, "
+            << count.bytes << " bytes in " << 2 * FLAGS_num_evaluations
+            << " evaluations.";
+  return count.allocations;
+}
+
+//! Allocations of the spline IMU and the static gyroscope residuals
+size_t CheckResiduals() {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  auto random_vec = [&]() { return Vector3d(dist(rng), dist(rng), dist(rng)); };
+
+  std::vector<Sophus::SO3d> so3_knots;
+  std::vector<Vector3d> r3_knots, bias_knots;
+  for (int i = 0; i < N; ++i) {
+    so3_knots.push_back(Sophus::SO3d::exp(random_vec()));
+    r3_knots.push_back(random_vec());
+  }
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    bias_knots.push_back(0.1 * random_vec());
+  }
+  Vector3d gravity(0.0, 0.0, -9.81);
+  Eigen::Matrix<double, 6, 1> accl_intrinsics;
+  accl_intrinsics << 0.0, 0.0, 0.0, 1.0, 1.0, 1.0;
+  Eigen::Matrix<double, 9, 1> gyro_intrinsics;
+  gyro_intrinsics << 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 1.0, 1.0;
+
+  const Vector3d meas = random_vec();
+  const double u = 0.3, inv_dt = 10.0, inv_bias_dt = 0.5, inv_std = 2.0;
+
+  std::vector<double*> accl_params, gyro_params;
+  for (int i = 0; i < N; ++i) {
+    accl_params.push_back(so3_knots[i].data());
+    gyro_params.push_back(so3_knots[i].data());
+  }
+  for (int i = 0; i < N; ++i) accl_params.push_back(r3_knots[i].data());
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    accl_params.push_back(bias_knots[i].data());
+    gyro_params.push_back(bias_knots[i].data());
+  }
+  accl_params.push_back(gravity.data());
+  accl_params.push_back(accl_intrinsics.data());
+  gyro_params.push_back(gyro_intrinsics.data());
+
+  size_t allocations = 0;
+  {
+    AccelerationCostFunctionSplitAnalytic<N> analytic(
+        meas, u, inv_dt, u, inv_dt, inv_std, u, inv_bias_dt);
+    allocations += CountEvaluationAllocations(
+        "acceleration_analytic", analytic, accl_params);
+    using FunctorT = AccelerationCostFunctorSplit<N>;
+    std::unique_ptr<ceres::CostFunction> fixed_size(
+        CreateFixedSizeCostFunction<3, AccelerationBlockSizes<N>>(new FunctorT(
+            meas, u, inv_dt, u, inv_dt, inv_std, u, inv_bias_dt)));
+    allocations += CountEvaluationAllocations(
+        "acceleration_autodiff", *fixed_size, accl_params);
+  }
+  {
+    GyroCostFunctionSplitAnalytic<N> analytic(
+        meas, u, inv_dt, inv_std, u, inv_bias_dt);
+    allocations +=
+        CountEvaluationAllocations("gyroscope_analytic", analytic, gyro_params);
+    using FunctorT = GyroCostFunctorSplit<N, Sophus::SO3, false>;
+    std::unique_ptr<ceres::CostFunction> fixed_size(
+        CreateFixedSizeCostFunction<3, GyroBlockSizes<N>>(
+            new FunctorT(meas, u, inv_dt, inv_std, u, inv_bias_dt)));
+    allocations += CountEvaluationAllocations(
+        "gyroscope_autodiff", *fixed_size, gyro_params);
+  }
+  {
+    // rotation between two static positions of the static IMU calibration
+    const double dt = 0.005;
+    ImuReadings gyro_samples;
+    for (int i = 0; i < 200; ++i) {
+      gyro_samples.push_back(ImuReading<double>(i * dt, 0.1 * random_vec()));
+    }
+    const DataInterval interval(0, static_cast<int>(gyro_samples.size()) - 1);
+    MultiPosGyroAnalyticResidual<9> residual(Vector3d(0.0, 0.0, 1.0),
+                                             Vector3d(0.0, 1.0, 0.0),
+                                             gyro_samples,
+                                             interval,
+                                             dt);
+    allocations += CountEvaluationAllocations(
+        "multi_pos_gyroscope", residual, {gyro_intrinsics.data()});
+  }
+  return allocations;
+}
+
+//! Allocations of the counted frames of the board extraction
+size_t CheckBoardExtraction() {
+  BoardExtractor board_extractor;
+  const BoardType board_type = StringToBoardType(FLAGS_board_type);
+  if (board_type == BoardType::CHARUCO) {
+    board_extractor.InitializeCharucoBoard(FLAGS_aruco_detector_params,
+                                           FLAGS_checker_square_length_m / 2.0,
+                                           FLAGS_checker_square_length_m,
+                                           FLAGS_num_squares_x,
+                                           FLAGS_num_squares_y,
+                                           FLAGS_aruco_dict);
+  } else if (board_type == BoardType::RADON) {
+    board_extractor.InitializeRadonBoard(FLAGS_checker_square_length_m,
+                                         FLAGS_num_squares_x,
+                                         FLAGS_num_squares_y);
+  } else {
+    board_extractor.InitializeAprilBoard(FLAGS_checker_square_length_m,
+                                         0.3,
+                                         FLAGS_num_squares_x,
+                                         FLAGS_num_squares_y);
+  }
+
+  const cv::Mat image = cv::imread(FLAGS_image_path, cv::IMREAD_GRAYSCALE);
+  CHECK(!image.empty()) << "Could not read " << FLAGS_image_path;
+
+  aligned_vector<Eigen::Vector2d> corners;
+  std::vector<int> object_pt_ids;
+  for (int i = 0; i < FLAGS_num_warmup_frames; ++i) {
+    board_extractor.ExtractBoard(image, corners, object_pt_ids);
+  }
+  CHECK(!corners.empty()) << "No board found in " << FLAGS_image_path;
+
+  Profiler::Instance().SetEnabled(!FLAGS_profile_report_json.empty());
+  ScopedAllocationCounter counter;
+  for (int i = 0; i < FLAGS_num_frames; ++i) {
+    board_extractor.ExtractBoard(image, corners, object_pt_ids);
+  }
+  const AllocationCount count = counter.Count();
+  if (!FLAGS_profile_report_json.empty()) {
+    Profiler::Instance().WriteReport(FLAGS_profile_report_json);
+  }
+  LOG(INFO) << "board_extraction: " << count.allocations << " allocations, "
+            << count.bytes << " bytes in " << FLAGS_num_frames << " frames.";
+  return count.allocations;
+}
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  if (!AllocationCountingEnabled()) {
+    LOG(ERROR) << "Allocations are not counted in this build. Configure with "
+                  "-DBUILD_WITH_ALLOCATION_COUNTING=ON.";
+    return 1;
+  }
+
+  size_t allocations = CheckResiduals();
+  if (!FLAGS_image_path.empty()) {
+    allocations += CheckBoardExtraction();
+  }
+  if (allocations > 0) {
+    LOG(ERROR) << allocations << " allocations in the hot paths!";
+    return 1;
+  }
+  LOG(INFO) << "No allocations in the hot paths.";
+  return 0;
+}
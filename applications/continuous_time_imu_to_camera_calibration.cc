@@ -13,19 +13,36 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
 #include <gflags/gflags.h>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <set>
+#include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/reprojection_video_renderer.h"
+#include "OpenCameraCalibrator/core/spline_error_weighting.h"
 #include "OpenCameraCalibrator/io/read_camera_calibration.h"
 #include "OpenCameraCalibrator/io/read_gopro_imu_json.h"
 #include "OpenCameraCalibrator/io/read_misc.h"
 #include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/spline_snapshot.h"
 
 #include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/async_writer.h"
+#include "OpenCameraCalibrator/utils/checkpoint.h"
+#include "OpenCameraCalibrator/utils/execution_context.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/stage_cache.h"
+#include "OpenCameraCalibrator/utils/time_budget.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
@@ -39,11 +56,34 @@ DEFINE_string(
 
     telemetry_json,
     "",
-    "Path to gopro telemetry json extracted with Sparsnet extractor.");
+    "Path to gopro telemetry json extracted with Sparsnet extractor. A comma "
+    "separated list calibrates several recordings jointly, in the same order "
+    "as --input_pose_dataset, --input_corners and "
+    "--gyro_to_cam_initial_calibration.");
 DEFINE_string(input_pose_dataset, "", "Path to pose dataset.");
 DEFINE_string(input_corners,
               "",
               "Corners of the original imu to cam calibration video file.");
+DEFINE_string(rig_camera_calibration_json,
+              "",
+              "Comma separated camera calibrations of further cameras of the "
+              "rig that observe the board at the same time. The cameras share "
+              "the spline and the IMU parameters, each gets its own T_i_c and "
+              "line delay.");
+DEFINE_string(rig_input_pose_dataset,
+              "",
+              "Comma separated pose datasets of the further rig cameras.");
+DEFINE_string(rig_input_corners,
+              "",
+              "Comma separated corner files of the further rig cameras.");
+DEFINE_string(rig_gyro_to_cam_initial_calibration,
+              "",
+              "Comma separated initial gyro to camera calibrations of the "
+              "further rig cameras.");
+DEFINE_double(recording_gap_s,
+              2.0,
+              "Gap in seconds between the recordings of a joint calibration "
+              "on the merged time axis.");
 DEFINE_string(camera_calibration_json, "", "Camera calibration.");
 DEFINE_string(gyro_to_cam_initial_calibration,
               "",
@@ -57,13 +97,36 @@ DEFINE_bool(global_shutter, false, "If camera has a global shutter.");
 
 DEFINE_string(spline_error_weighting_json,
               "",
-              "Path to spline error weighting data");
+              "Path to spline error weighting data. If empty it is computed "
+              "from the telemetry.");
+DEFINE_double(sew_quality_so3,
+              0.98,
+              "Spline error weighting: fraction of the gyroscope signal "
+              "energy kept by the SO3 spline.");
+DEFINE_double(sew_quality_r3,
+              0.96,
+              "Spline error weighting: fraction of the accelerometer signal "
+              "energy kept by the R3 spline.");
 DEFINE_string(output_path, "", "");
 DEFINE_bool(calibrate_cam_line_delay,
             false,
             "If camera rolling shutter line delay should be calibrated.");
 DEFINE_string(result_output_json, "", "Path to result json file");
+DEFINE_string(solver_log_json,
+              "",
+              "Optional. Writes cost, gradient norm and timing of every "
+              "solver iteration of all spline optimizations to this json.");
 DEFINE_double(max_t, 1000., "Maximum nr of seconds to take");
+DEFINE_double(time_budget_s,
+              0.0,
+              "Wall clock budget in seconds of the spline optimization stages. "
+              "Stages are stopped when their share is used up and later ones "
+              "are skipped when the budget is exhausted, keeping the best "
+              "solution so far. 0 is unlimited.");
+DEFINE_bool(compute_covariance,
+            false,
+            "Write the covariance of T_i_c, line delay, gravity and IMU "
+            "intrinsics to the result json, with the spline marginalized.");
 DEFINE_bool(reestimate_biases,
             false,
             "If accelerometer and gyroscope biases should be estimated during "
@@ -75,9 +138,194 @@ DEFINE_string(known_grav_dir_axis,
               "your calibration board is exactly known (e.g. supplying Z we "
               "will fix gravity to [0,0,gravity_const]. UNKNOWN means it is "
               "not known and will be estimated.");
+DEFINE_double(telemetry_window_start_s,
+              -1.0,
+              "Only load IMU samples after this time from binary telemetry. "
+              "-1 loads everything.");
+DEFINE_double(telemetry_window_end_s,
+              -1.0,
+              "Only load IMU samples before this time from binary telemetry. "
+              "-1 loads everything.");
+DEFINE_double(bias_knot_spacing_s,
+              10.0,
+              "Knot spacing of the accelerometer and gyroscope bias splines "
+              "in seconds.");
+DEFINE_int32(imu_decimation,
+             1,
+             "Average this many consecutive IMU samples into one residual. "
+             "1 uses every sample. Keep decimation / imu_rate well below the "
+             "spline knot spacing.");
+DEFINE_int32(num_threads,
+             1,
+             "Number of threads used to build the spline IMU residuals.");
+DEFINE_string(cpu_affinity,
+              "",
+              "Optional. CPUs to pin the process to, e.g. \"0-3,8\". Keeps "
+              "concurrent calibrations on one machine from competing for the "
+              "same cores.");
+DEFINE_int32(numa_node,
+             -1,
+             "Optional. Pin the process to the CPUs of this NUMA node.");
+DEFINE_bool(deterministic,
+            false,
+            "Reproduce the results bit for bit, independent of num_threads. "
+            "The Ceres solves run on one thread.");
+DEFINE_double(spline_window_s,
+              0.0,
+              "Optimize the spline in windows of this many seconds. 0 solves "
+              "the whole sequence at once.");
+DEFINE_double(spline_window_overlap_s,
+              2.0,
+              "Overlap of consecutive spline windows in seconds.");
+DEFINE_double(excitation_window_s,
+              0.0,
+              "Only calibrate on segments of sufficient IMU excitation, "
+              "scored in windows of this many seconds. 0 uses the whole "
+              "recording.");
+DEFINE_double(excitation_min_gyro_rms,
+              0.3,
+              "Minimum gyroscope RMS in rad/s of an excited window.");
+DEFINE_double(excitation_min_accl_std,
+              0.5,
+              "Minimum accelerometer standard deviation in m/s^2 of an "
+              "excited window.");
+DEFINE_double(spline_online_step_s,
+              0.0,
+              "Replay the dataset as an online calibration that appends "
+              "knots and optimizes every this many seconds. 0 calibrates "
+              "the whole sequence in batch.");
+DEFINE_double(spline_online_lag_s,
+              5.0,
+              "Length in seconds of the fixed lag window of the online "
+              "calibration.");
+DEFINE_string(spline_linear_solver,
+              "sparse_normal_cholesky",
+              "Ceres linear solver for the spline problem, e.g. "
+              "sparse_normal_cholesky, sparse_schur, iterative_schur.");
+DEFINE_string(spline_preconditioner,
+              "cluster_tridiagonal",
+              "Ceres preconditioner for iterative linear solvers.");
+DEFINE_string(spline_dense_linear_algebra,
+              "eigen",
+              "Ceres dense linear algebra library of the dense and Schur "
+              "linear solvers, e.g. eigen, lapack or cuda. cuda runs the "
+              "dense factorizations on the GPU if ceres was built with it.");
+DEFINE_bool(spline_inner_iterations,
+            true,
+            "Use inner iterations when optimizing the spline.");
+DEFINE_bool(spline_time_banded_ordering,
+            false,
+            "Eliminate spline knots in time order. Schur solvers eliminate "
+            "the scene points first instead.");
+DEFINE_bool(spline_banded_solver,
+            false,
+            "Solve the spline with the block banded solver instead of the "
+            "ceres linear solvers.");
+DEFINE_int32(spline_knot_freeze_rounds,
+             0,
+             "Solve the spline in this many rounds, freezing the knots that "
+             "converged after every round and only solving the residuals of "
+             "the remaining ones, then polish all knots. 0 disables it.");
+DEFINE_double(spline_knot_freeze_threshold,
+              1e-5,
+              "Knots whose update in a round is below this many radians "
+              "(SO3) or meters (R3) are frozen, see "
+              "--spline_knot_freeze_rounds.");
+DEFINE_bool(spline_corner_residuals,
+            false,
+            "Global shutter only: one reprojection residual per corner with "
+            "the view pose evaluated once per iteration, instead of one "
+            "residual per view.");
+DEFINE_bool(spline_profile_residuals,
+            false,
+            "Count the evaluations and time of the spline residuals per "
+            "type (accelerometer, gyroscope, reprojection, ...) and report "
+            "them after every solve and in the solver log.");
+DEFINE_bool(spline_compact_observations,
+            false,
+            "Store the corner observations in single precision. Halves their "
+            "memory traffic in the reprojection residuals, which are still "
+            "evaluated in double.");
+DEFINE_bool(spline_fit_initial_knots,
+            false,
+            "Initialize the R3 knots with a least squares fit to the view "
+            "positions instead of interpolating them at the knot times.");
+DEFINE_string(spline_warm_start,
+              "",
+              "Binary spline snapshot of a previous calibration of the same "
+              "rig (see --spline_snapshot) used as initialization.");
+DEFINE_string(spline_snapshot,
+              "",
+              "Write the optimized spline state to this binary snapshot.");
+DEFINE_string(checkpoint_path,
+              "",
+              "Batch optimization only: periodically write the spline state "
+              "to this snapshot and the finished stages to "
+              "<checkpoint_path>.json. Both are removed once the calibration "
+              "finished.");
+DEFINE_double(checkpoint_interval_s,
+              300.0,
+              "Seconds between two spline checkpoints.");
+DEFINE_bool(resume,
+            false,
+            "Continue from --checkpoint_path if it was written for the same "
+            "inputs and settings. Finished stages are skipped.");
+DEFINE_string(spline_parameter_ordering,
+              "",
+              "Optional json with the elimination ordering of a previous "
+              "calibration with the same problem shape. Used if it matches "
+              "and overwritten with the ordering of this calibration.");
+DEFINE_string(trajectory_export,
+              "full",
+              "full: evaluate the spline at every IMU sample and write it to "
+              "the trajectory of the result json. snapshot: only write the "
+              "binary spline snapshot, which SplineTrajectoryQuery evaluates "
+              "at arbitrary times. Defaults to output_path/spline.snapshot "
+              "if --spline_snapshot is not set.");
+DEFINE_double(spline_rs_band_rows,
+              0.0,
+              "Rolling shutter only: evaluate the spline pose every this many "
+              "image rows and interpolate between them. 0 evaluates it at the "
+              "row of every corner.");
+DEFINE_int32(spline_order,
+             OpenICC::core::SPLINE_N,
+             "Order of the SO3 and R3 splines, 4 (cubic) to 6. Every residual "
+             "touches this many knots of each spline, so lower orders are "
+             "faster.");
+DEFINE_int32(spline_solver_threads,
+             -1,
+             "Number of solver threads. -1 uses all hardware threads.");
+DEFINE_int32(spline_coarse_levels,
+             1,
+             "Number of knot spacing levels. Levels above 1 first optimize "
+             "the spline at 2^(levels-1), ..., 2 times the knot spacing.");
+DEFINE_int32(spline_coarse_iterations,
+             20,
+             "Maximum number of iterations per coarse knot spacing level.");
+DEFINE_int32(spline_rotation_presolve_iterations,
+             20,
+             "Maximum number of iterations of the rotation only pre-solve "
+             "(gyroscope and view orientations), followed by a fit of the R3 "
+             "knots, before the joint problem. 0 skips it.");
 DEFINE_string(debug_video_path,
               "",
-              "Load the video to display the reprojection error.");
+              "Optional. Renders the reprojection of the board points with "
+              "the spline poses into the frames of this video. Runs in the "
+              "background while the results are written.");
+DEFINE_string(debug_video_output,
+              "",
+              "Rendered debug video. Defaults to "
+              "output_path/reprojection_debug.mp4.");
+DEFINE_int32(debug_video_stride,
+             1,
+             "Only render every n-th frame with observations.");
+DEFINE_int32(debug_video_max_frames,
+             0,
+             "Maximum number of rendered frames, 0 renders all.");
+DEFINE_string(profile_report_json,
+              "",
+              "Optional. Writes wall time, cpu time, peak memory and item "
+              "counts of the pipeline stages to this json.");
 
 using json = nlohmann::json;
 
@@ -88,115 +336,163 @@ using namespace OpenICC::core;
 using namespace OpenICC::utils;
 using namespace OpenICC::io;
 
-int main(int argc, char* argv[]) {
-  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
-
-  // Get pose dataset
-  theia::Reconstruction pose_dataset;
-  CHECK(theia::ReadReconstruction(FLAGS_input_pose_dataset, &pose_dataset))
-      << "Could not read Reconstruction file.";
-  nlohmann::json scene_json;
-  CHECK(io::read_scene_bson(FLAGS_input_corners, scene_json))
-      << "Failed to load " << FLAGS_input_corners;
-
-  theia::Camera camera;
-  double fps;
-  CHECK(io::read_camera_calibration(FLAGS_camera_calibration_json, camera, fps))
-      << "Could not read camera calibration: " << FLAGS_camera_calibration_json;
-
-  // fill tracks. we use the ones from pose estimation because they might have
-  // been optimized (to account for non planarity of the target)
-  theia::Reconstruction recon_calib_dataset;
-  // io::scene_points_to_calib_dataset(scene_json, recon_calib_dataset);
-  for (const auto& old_track_id : pose_dataset.TrackIds()) {
-    recon_calib_dataset.AddTrack(old_track_id);
-    theia::Track* new_track = recon_calib_dataset.MutableTrack(old_track_id);
-    const theia::Track* old_track = pose_dataset.Track(old_track_id);
-    Eigen::Vector4d* new_point = new_track->MutablePoint();
-    for (int j = 0; j < 4; ++j) {
-      (*new_point)[j] = old_track->Point()[j];
+//! Key of the inputs and settings a spline checkpoint belongs to
+StageKey SplineCheckpointKey() {
+  StageKey key;
+  for (const std::string& list : {FLAGS_input_pose_dataset,
+                                  FLAGS_input_corners,
+                                  FLAGS_telemetry_json,
+                                  FLAGS_gyro_to_cam_initial_calibration}) {
+    std::stringstream path_list(list);
+    for (std::string path; std::getline(path_list, path, ',');) {
+      key.AddFile(path);
     }
   }
+  key.AddFile(FLAGS_camera_calibration_json)
+      .AddFile(FLAGS_imu_intrinsics)
+      .AddFile(FLAGS_imu_bias_file)
+      .AddFile(FLAGS_spline_error_weighting_json)
+      .AddFile(FLAGS_rig_camera_calibration_json)
+      .Add(FLAGS_global_shutter)
+      .Add(FLAGS_sew_quality_so3)
+      .Add(FLAGS_sew_quality_r3)
+      .Add(FLAGS_calibrate_cam_line_delay)
+      .Add(FLAGS_max_t)
+      .Add(FLAGS_reestimate_biases)
+      .Add(FLAGS_known_grav_dir_axis)
+      .Add(FLAGS_telemetry_window_start_s)
+      .Add(FLAGS_telemetry_window_end_s)
+      .Add(FLAGS_bias_knot_spacing_s)
+      .Add(FLAGS_imu_decimation)
+      .Add(FLAGS_spline_order)
+      .Add(FLAGS_spline_coarse_levels)
+      .Add(FLAGS_spline_rotation_presolve_iterations);
+  return key;
+}
 
-  // read gopro telemetry
-  CameraTelemetryData telemetry_data;
-  CHECK(ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data))
-      << "Could not read: " << FLAGS_telemetry_json;
-
-  double t_offset_cam_s = 0.0;
-  if (telemetry_data.img_timestamps_s.size() > 0) {
-    t_offset_cam_s = telemetry_data.img_timestamps_s[0];
+//! Calibrates with a spline of order N, see --spline_order, and writes the
+//! results
+template <int N>
+void CalibrateSpline(const theia::Camera& camera,
+                     const nlohmann::json& scene_json,
+                     const theia::Reconstruction& recon_calib_dataset,
+                     const Sophus::SE3<double>& T_i_c_init,
+                     const SplineWeightingData& weight_data,
+                     const double time_offset_imu_to_cam,
+                     CameraTelemetryData& telemetry_data,
+                     const double init_line_delay_us,
+                     const ThreeAxisSensorCalibParams<double>& acc_intr,
+                     const ThreeAxisSensorCalibParams<double>& gyr_intr,
+                     const bool export_full_trajectory,
+                     const std::string& spline_snapshot_path,
+                     const std::vector<std::pair<double, double>>&
+                         recording_segments_s,
+                     const aligned_vector<Sophus::SE3d>& rig_T_i_c_init,
+                     const std::vector<double>& rig_line_delays_s) {
+  ImuCameraCalibratorT<N> imu_cam_calibrator;
+  imu_cam_calibrator.SetRecordingSegments(recording_segments_s);
+  imu_cam_calibrator.SetRigCameras(rig_T_i_c_init, rig_line_delays_s);
+  imu_cam_calibrator.SetImuDecimation(FLAGS_imu_decimation);
+  imu_cam_calibrator.SetBiasKnotSpacing(FLAGS_bias_knot_spacing_s,
+                                        FLAGS_bias_knot_spacing_s);
+  imu_cam_calibrator.SetNumThreads(FLAGS_num_threads);
+  imu_cam_calibrator.SetCornerReprojectionResiduals(
+      FLAGS_spline_corner_residuals);
+  imu_cam_calibrator.SetRollingShutterBandRows(FLAGS_spline_rs_band_rows);
+  imu_cam_calibrator.SetCompactObservations(FLAGS_spline_compact_observations);
+  imu_cam_calibrator.SetResidualProfiling(FLAGS_spline_profile_residuals);
+  imu_cam_calibrator.SetFitInitialKnots(FLAGS_spline_fit_initial_knots);
+  if (FLAGS_excitation_window_s > 0.0) {
+    ExcitationOptions excitation_options;
+    excitation_options.window_s = FLAGS_excitation_window_s;
+    excitation_options.min_gyro_rms_rad_s = FLAGS_excitation_min_gyro_rms;
+    excitation_options.min_accl_std_m_s2 = FLAGS_excitation_min_accl_std;
+    imu_cam_calibrator.SetExcitationSegmentSelection(excitation_options);
   }
-
-  for (const auto& view : scene_json["views"].items()) {
-    const double timestamp_us = std::stod(view.key());
-    const double timestamp_s = timestamp_us * US_TO_S;  // to seconds
-    std::string view_name = std::to_string((uint64_t)timestamp_us);
-    theia::ViewId view_id =
-        recon_calib_dataset.AddView(view_name, 0, timestamp_s + t_offset_cam_s);
-
-    theia::ViewId old_view_id = pose_dataset.ViewIdFromName(view_name);
-    if (old_view_id == theia::kInvalidViewId) {
-      recon_calib_dataset.RemoveView(view_id);
-      continue;
+  if (!FLAGS_spline_parameter_ordering.empty()) {
+    std::ifstream ordering_file(FLAGS_spline_parameter_ordering);
+    if (ordering_file.good()) {
+      json ordering_json;
+      ordering_file >> ordering_json;
+      imu_cam_calibrator.trajectory_.ImportParameterOrdering(ordering_json);
     }
-    theia::View* view_new = recon_calib_dataset.MutableView(view_id);
-    theia::Camera* mutable_cam = view_new->MutableCamera();
-    const theia::Camera cam_old = pose_dataset.View(old_view_id)->Camera();
-    mutable_cam->SetOrientationFromAngleAxis(
-        cam_old.GetOrientationAsAngleAxis());
-    mutable_cam->SetPosition(cam_old.GetPosition());
-    mutable_cam->SetFromCameraIntrinsicsPriors(
-        camera.CameraIntrinsicsPriorFromIntrinsics());
+  }
+  if (!FLAGS_spline_warm_start.empty()) {
+    auto snapshot = std::make_shared<SplineSnapshot>();
+    CHECK(ReadSplineSnapshot(FLAGS_spline_warm_start, *snapshot))
+        << "Could not read spline snapshot " << FLAGS_spline_warm_start;
+    imu_cam_calibrator.SetWarmStart(snapshot);
+  }
+  const bool online = FLAGS_spline_online_step_s > 0.0;
 
-    const auto image_points = view.value()["image_points"];
-    for (const auto& img_pts : image_points.items()) {
-      const int board_pt3_id = std::stoi(img_pts.key());
-      const Eigen::Vector2d corner(
-          Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
-      Eigen::Matrix2d cov = Eigen::Matrix2d::Identity();
-      theia::Feature feat(corner, cov);
-      recon_calib_dataset.AddObservation(view_id, board_pt3_id, feat);
+  // the checkpoint snapshot holds the spline state, the json the finished
+  // stages. The json is written after the snapshot, so it never lists a
+  // stage the snapshot does not contain
+  const bool checkpoints = !FLAGS_checkpoint_path.empty() && !online;
+  if (!FLAGS_checkpoint_path.empty() && online) {
+    LOG(WARNING) << "Only the batch optimization writes checkpoints.";
+  }
+  Checkpointer snapshot_checkpointer(checkpoints ? FLAGS_checkpoint_path : "",
+                                     FLAGS_checkpoint_interval_s);
+  Checkpointer progress_checkpointer(
+      checkpoints ? FLAGS_checkpoint_path + ".json" : "");
+  const std::string checkpoint_key = SplineCheckpointKey().Hex();
+  std::set<std::string> finished_stages;
+  if (FLAGS_resume && snapshot_checkpointer.Exists() &&
+      progress_checkpointer.Exists()) {
+    std::ifstream progress_file(progress_checkpointer.Path());
+    const json progress = json::parse(progress_file, nullptr, false);
+    auto snapshot = std::make_shared<SplineSnapshot>();
+    if (!progress.is_object() ||
+        progress.value("key", std::string()) != checkpoint_key) {
+      LOG(WARNING) << "Checkpoint " << FLAGS_checkpoint_path
+                   << " was written for other inputs, starting over.";
+    } else if (!ReadSplineSnapshot(FLAGS_checkpoint_path, *snapshot)) {
+      LOG(WARNING) << "Could not read the checkpoint "
+                   << FLAGS_checkpoint_path << ", starting over.";
+    } else {
+      finished_stages =
+          progress.value("finished_stages", std::set<std::string>());
+      imu_cam_calibrator.SetWarmStart(snapshot);
+      LOG(INFO) << "Resuming from " << FLAGS_checkpoint_path << " after "
+                << finished_stages.size() << " finished stages.";
     }
   }
-
-  // read a gyro to cam calibration json to initialize rotation between imu and
-  // camera
-  Eigen::Quaterniond imu2cam;
-  double time_offset_imu_to_cam;
-  CHECK(ReadIMU2CamInit(
-      FLAGS_gyro_to_cam_initial_calibration, imu2cam, time_offset_imu_to_cam))
-      << "Could not read: " << FLAGS_gyro_to_cam_initial_calibration;
-  Sophus::SE3<double> T_i_c_init(imu2cam.conjugate(), Eigen::Vector3d(0, 0, 0));
-
-  // Read a imu intrinsics
-  ThreeAxisSensorCalibParams<double> acc_intr, gyr_intr;
-  CHECK(ReadIMUIntrinsics(
-      FLAGS_imu_intrinsics, FLAGS_imu_bias_file, acc_intr, gyr_intr))
-      << "Could not open " << FLAGS_imu_intrinsics;
-  std::cout << "Loaded IMU intrinsics.\n";
-  CHECK(FLAGS_spline_error_weighting_json != "")
-      << "You need to provide spline error weighting factors. Create with "
-         "get_sew_for_dataset.py.";
-  SplineWeightingData weight_data;
-  CHECK(
-      ReadSplineErrorWeighting(FLAGS_spline_error_weighting_json, weight_data))
-      << "Could not open " << FLAGS_spline_error_weighting_json;
-
-  double init_line_delay_us = 1. / fps / camera.ImageHeight();
-  if (FLAGS_global_shutter) {
-    init_line_delay_us = 0.0;
+  auto write_checkpoint = [&]() {
+    SplineSnapshot snapshot;
+    imu_cam_calibrator.GetSnapshot(snapshot);
+    return snapshot_checkpointer.Write([&](const std::string& path) {
+      return WriteSplineSnapshot(path, snapshot);
+    });
+  };
+  double t0_s = std::numeric_limits<double>::max();
+  double t_end_s = std::numeric_limits<double>::lowest();
+  for (const theia::ViewId view_id : recon_calib_dataset.ViewIds()) {
+    const double t = recon_calib_dataset.View(view_id)->GetTimestamp();
+    t0_s = std::min(t0_s, t);
+    t_end_s = std::max(t_end_s, t);
+  }
+  if (online) {
+    imu_cam_calibrator.InitOnlineSpline(
+        std::make_shared<const theia::Reconstruction>(recon_calib_dataset),
+        T_i_c_init,
+        weight_data,
+        t0_s,
+        init_line_delay_us,
+        acc_intr,
+        gyr_intr);
+  } else {
+    imu_cam_calibrator.BatchInitSpline(recon_calib_dataset,
+                                       T_i_c_init,
+                                       weight_data,
+                                       time_offset_imu_to_cam,
+                                       telemetry_data,
+                                       init_line_delay_us,
+                                       acc_intr,
+                                       gyr_intr);
+    // the calibrator keeps its own copy of the samples inside the spline
+    telemetry_data = CameraTelemetryData();
   }
-
-  ImuCameraCalibrator imu_cam_calibrator;
-  imu_cam_calibrator.BatchInitSpline(recon_calib_dataset,
-                                     T_i_c_init,
-                                     weight_data,
-                                     time_offset_imu_to_cam,
-                                     telemetry_data,
-                                     init_line_delay_us,
-                                     acc_intr,
-                                     gyr_intr);
   const int grav_dir_axis = GravDirStringToInt(FLAGS_known_grav_dir_axis);
   int flags = SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C;
   if (FLAGS_reestimate_biases) {
@@ -212,16 +508,178 @@ int main(int argc, char* argv[]) {
     flags |= SplineOptimFlags::GRAVITY_DIR;
   }
 
-  double reproj_error = imu_cam_calibrator.Optimize(50, flags);
+  SplineSolverOptions solver_options;
+  CHECK(ceres::StringToLinearSolverType(FLAGS_spline_linear_solver,
+                                        &solver_options.linear_solver_type))
+      << "Unknown linear solver " << FLAGS_spline_linear_solver;
+  CHECK(ceres::StringToPreconditionerType(FLAGS_spline_preconditioner,
+                                          &solver_options.preconditioner_type))
+      << "Unknown preconditioner " << FLAGS_spline_preconditioner;
+  CHECK(ceres::StringToDenseLinearAlgebraLibraryType(
+      FLAGS_spline_dense_linear_algebra,
+      &solver_options.dense_linear_algebra_library_type))
+      << "Unknown dense linear algebra library "
+      << FLAGS_spline_dense_linear_algebra;
+  solver_options.use_inner_iterations = FLAGS_spline_inner_iterations;
+  solver_options.use_time_banded_ordering = FLAGS_spline_time_banded_ordering;
+  solver_options.use_banded_solver = FLAGS_spline_banded_solver;
+  solver_options.knot_freeze_rounds = FLAGS_spline_knot_freeze_rounds;
+  solver_options.knot_freeze_rotation_rad = FLAGS_spline_knot_freeze_threshold;
+  solver_options.knot_freeze_translation_m =
+      FLAGS_spline_knot_freeze_threshold;
+  if (FLAGS_spline_solver_threads > 0) {
+    solver_options.num_threads = FLAGS_spline_solver_threads;
+  }
+  if (checkpoints) {
+    solver_options.iteration_callback = [&]() {
+      if (snapshot_checkpointer.Due()) {
+        write_checkpoint();
+      }
+    };
+  }
+
+  // coarse levels, full spline and line delay share the time budget, stages
+  // finished before the checkpoint are skipped
+  TimeBudgetScheduler scheduler(FLAGS_time_budget_s);
+  auto add_stage = [&](const std::string& name, const double weight) {
+    if (!finished_stages.count(name)) {
+      scheduler.AddStage(name, weight);
+    }
+  };
+  if (!online && FLAGS_spline_rotation_presolve_iterations > 0) {
+    add_stage("rotation_presolve", 0.5);
+  }
+  if (FLAGS_spline_coarse_levels > 1) {
+    add_stage("coarse_levels", FLAGS_spline_coarse_levels - 1);
+  }
+  add_stage("spline", 4.0);
+  if (FLAGS_calibrate_cam_line_delay && !FLAGS_global_shutter) {
+    add_stage("line_delay", 1.0);
+  }
+  auto run_stage = [&](const std::string& name,
+                       const std::function<double()>& stage,
+                       const double skipped_result) {
+    if (finished_stages.count(name)) {
+      LOG(INFO) << "Stage " << name << " finished before the checkpoint.";
+      return skipped_result;
+    }
+    solver_options.max_solver_time_s = scheduler.BeginStage(name);
+    if (solver_options.max_solver_time_s <= 0.0) {
+      return skipped_result;
+    }
+    const std::vector<SolverRunLog>& solver_log =
+        imu_cam_calibrator.trajectory_.GetSolverLog();
+    const size_t first_run = solver_log.size();
+    const double result = stage();
+    if (solver_log.size() > first_run) {
+      scheduler.EndStage(solver_log[first_run].initial_cost,
+                         solver_log.back().final_cost);
+    } else {
+      scheduler.EndStage(0.0, 0.0);
+    }
+    if (checkpoints && write_checkpoint()) {
+      finished_stages.insert(name);
+      progress_checkpointer.Write([&](const std::string& path) {
+        json progress;
+        progress["key"] = checkpoint_key;
+        progress["finished_stages"] = finished_stages;
+        std::ofstream progress_file(path);
+        progress_file << progress << std::endl;
+        return progress_file.good();
+      });
+    }
+    return result;
+  };
+
+  auto optimize = [&](const int iterations, const int optim_flags) {
+    if (FLAGS_spline_window_s > 0.0) {
+      return imu_cam_calibrator.OptimizeWindowed(iterations,
+                                                 optim_flags,
+                                                 FLAGS_spline_window_s,
+                                                 FLAGS_spline_window_overlap_s,
+                                                 solver_options);
+    }
+    return imu_cam_calibrator.Optimize(iterations, optim_flags, solver_options);
+  };
+  double reproj_error = 0.0;
+  if (online) {
+    // the samples of the recorded telemetry arrive step by step
+    for (double t_now_s = t0_s + FLAGS_spline_online_step_s;;
+         t_now_s += FLAGS_spline_online_step_s) {
+      t_now_s = std::min(t_now_s, t_end_s);
+      imu_cam_calibrator.AddImuSamples(
+          telemetry_data, time_offset_imu_to_cam, t_now_s);
+      reproj_error = imu_cam_calibrator.OptimizeOnline(
+          t_now_s, FLAGS_spline_online_lag_s, 10, flags, solver_options);
+      LOG(INFO) << "Online step at " << t_now_s
+                << "s, mean reprojection error " << reproj_error << "px";
+      if (t_now_s >= t_end_s) break;
+    }
+    telemetry_data = CameraTelemetryData();
+  } else {
+    if (FLAGS_spline_rotation_presolve_iterations > 0) {
+      run_stage(
+          "rotation_presolve",
+          [&]() {
+            return imu_cam_calibrator.PreSolveRotation(
+                FLAGS_spline_rotation_presolve_iterations,
+                flags,
+                solver_options);
+          },
+          0.0);
+    }
+    if (FLAGS_spline_coarse_levels > 1) {
+      std::vector<int> coarse_factors;
+      for (int level = FLAGS_spline_coarse_levels - 1; level > 0; --level) {
+        coarse_factors.push_back(1 << level);
+      }
+      run_stage(
+          "coarse_levels",
+          [&]() {
+            return imu_cam_calibrator.OptimizeCoarseLevels(
+                coarse_factors,
+                FLAGS_spline_coarse_iterations,
+                flags,
+                solver_options);
+          },
+          0.0);
+    }
+    reproj_error = run_stage(
+        "spline",
+        [&]() { return optimize(50, flags); },
+        imu_cam_calibrator.trajectory_.GetMeanReprojectionError());
+  }
 
   double reproj_error_after_ld = reproj_error;
   if (FLAGS_calibrate_cam_line_delay && !FLAGS_global_shutter) {
     flags = SplineOptimFlags::CAM_LINE_DELAY;
-    reproj_error_after_ld = imu_cam_calibrator.Optimize(10, flags);
+    reproj_error_after_ld = run_stage(
+        "line_delay", [&]() { return optimize(10, flags); }, reproj_error);
   }
   LOG(INFO) << "Mean reprojection error " << reproj_error << "px\n";
   LOG(INFO) << "Mean reprojection error after line delay optim "
             << reproj_error_after_ld << "px\n";
+  if (!spline_snapshot_path.empty()) {
+    SplineSnapshot snapshot;
+    imu_cam_calibrator.GetSnapshot(snapshot);
+    CHECK(WriteSplineSnapshot(spline_snapshot_path, snapshot))
+        << "Could not write spline snapshot " << spline_snapshot_path;
+  }
+  if (!FLAGS_spline_parameter_ordering.empty()) {
+    const json ordering_json =
+        imu_cam_calibrator.trajectory_.ExportParameterOrdering();
+    if (!ordering_json.is_null()) {
+      std::ofstream ordering_file(FLAGS_spline_parameter_ordering);
+      ordering_file << ordering_json << std::endl;
+    }
+  }
+  if (!FLAGS_solver_log_json.empty()) {
+    std::ofstream solver_log_file(FLAGS_solver_log_json);
+    solver_log_file << std::setw(4)
+                    << SolverLogToJson(
+                           imu_cam_calibrator.trajectory_.GetSolverLog())
+                    << std::endl;
+  }
 
   std::cout << "g: " << imu_cam_calibrator.trajectory_.GetGravity().transpose()
             << std::endl;
@@ -254,6 +712,9 @@ int main(int argc, char* argv[]) {
   json_calibspline_results_out["t_i_c"]["y"] = t_i_c[1];
   json_calibspline_results_out["t_i_c"]["z"] = t_i_c[2];
   json_calibspline_results_out["final_reproj_error"] = reproj_error;
+  json_calibspline_results_out["reprojection_errors"] =
+      ReprojectionErrorReportToJson(
+          imu_cam_calibrator.GetReprojectionErrorReport());
   json_calibspline_results_out["r3_dt"] = weight_data.dt_r3;
   json_calibspline_results_out["so3_dt"] = weight_data.dt_so3;
   json_calibspline_results_out["init_line_delay_us"] =
@@ -261,86 +722,162 @@ int main(int argc, char* argv[]) {
   json_calibspline_results_out["calib_line_delay_us"] = calib_line_delay_us;
   json_calibspline_results_out["time_offset_imu_to_cam_s"] =
       time_offset_imu_to_cam;
+  if (scheduler.IsLimited()) {
+    json_calibspline_results_out["time_budget"] = scheduler.Report();
+  }
+  if (FLAGS_compute_covariance) {
+    SplineGlobalCovariance covariance;
+    if (imu_cam_calibrator.trajectory_.ComputeGlobalCovariance(
+            covariance, FLAGS_num_threads)) {
+      json& json_covariance = json_calibspline_results_out["covariance"];
+      for (size_t b = 0; b < covariance.names.size(); ++b) {
+        const Eigen::VectorXd std_dev = covariance.StdDev(covariance.names[b]);
+        json block;
+        block["name"] = covariance.names[b];
+        block["offset"] = covariance.offsets[b];
+        block["size"] = covariance.sizes[b];
+        block["std_dev"] = std::vector<double>(
+            std_dev.data(), std_dev.data() + std_dev.size());
+        json_covariance["blocks"].push_back(block);
+        std::cout << "Std dev " << covariance.names[b] << ": "
+                  << std_dev.transpose() << std::endl;
+      }
+      for (int r = 0; r < covariance.covariance.rows(); ++r) {
+        const Eigen::VectorXd row = covariance.covariance.row(r);
+        json_covariance["matrix"].push_back(
+            std::vector<double>(row.data(), row.data() + row.size()));
+      }
+    } else {
+      LOG(WARNING) << "Could not compute the covariance.";
+    }
+  }
+  for (size_t c = 1; c < imu_cam_calibrator.trajectory_.NumRigCameras(); ++c) {
+    const Sophus::SE3d T_i_c =
+        imu_cam_calibrator.trajectory_.GetRigCameraT_i_c(c);
+    const Eigen::Quaterniond& q = T_i_c.so3().unit_quaternion();
+    json rig_camera;
+    rig_camera["q_i_c"]["w"] = q.w();
+    rig_camera["q_i_c"]["x"] = q.x();
+    rig_camera["q_i_c"]["y"] = q.y();
+    rig_camera["q_i_c"]["z"] = q.z();
+    rig_camera["t_i_c"]["x"] = T_i_c.translation()[0];
+    rig_camera["t_i_c"]["y"] = T_i_c.translation()[1];
+    rig_camera["t_i_c"]["z"] = T_i_c.translation()[2];
+    rig_camera["calib_line_delay_us"] =
+        imu_cam_calibrator.trajectory_.GetRigCameraLineDelay(c) * S_TO_US;
+    json_calibspline_results_out["rig_cameras"].push_back(rig_camera);
+    std::cout << "Rig camera " << c << " T_i_c t: "
+              << T_i_c.translation().transpose() << std::endl;
+  }
 
   std::vector<double> cam_timestamps_s = imu_cam_calibrator.GetCamTimestamps();
   std::sort(cam_timestamps_s.begin(), cam_timestamps_s.end(), std::less<>());
 
-  aligned_map<double, Eigen::Vector3d> gyro_meas =
-      imu_cam_calibrator.GetGyroMeasurements();
-  aligned_map<double, Eigen::Vector3d> accl_meas =
-      imu_cam_calibrator.GetAcclMeasurements();
-
-  // Evaluate spline for all accelerometer and gyro and output them
-  for (auto& g : gyro_meas) {
-    const int64_t t_ns = g.first * S_TO_NS;
-    const std::string t_ns_s = std::to_string(t_ns);
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_imu"]["x"] =
-        g.second[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_imu"]["y"] =
-        g.second[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_imu"]["z"] =
-        g.second[2];
-    // write out spline estimates
-    Eigen::Vector3d gyro_spline;
-    imu_cam_calibrator.trajectory_.GetAngularVelocity(t_ns, gyro_spline);
-
-    const auto bias = imu_cam_calibrator.trajectory_.GetGyroBias(t_ns);
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_spline"]["x"] =
-        gyro_spline[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_spline"]["y"] =
-        gyro_spline[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_spline"]["z"] =
-        gyro_spline[2];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_bias"]["x"] =
-        bias[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_bias"]["y"] =
-        bias[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["gyro_bias"]["z"] =
-        bias[2];
-  }
-  for (auto& a : accl_meas) {
-    const int64_t t_ns = a.first * S_TO_NS;
-    const std::string t_ns_s = std::to_string(t_ns);
-    // accelerometer
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_imu"]["x"] =
-        a.second[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_imu"]["y"] =
-        a.second[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_imu"]["z"] =
-        a.second[2];
-    // write out spline estimates
-    Eigen::Vector3d accl_spline;
-    imu_cam_calibrator.trajectory_.GetAcceleration(t_ns, accl_spline);
-    const auto bias = imu_cam_calibrator.trajectory_.GetAcclBias(t_ns);
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_spline"]["x"] =
-        accl_spline[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_spline"]["y"] =
-        accl_spline[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_spline"]["z"] =
-        accl_spline[2];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_bias"]["x"] =
-        bias[0];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_bias"]["y"] =
-        bias[1];
-    json_calibspline_results_out["trajectory"][t_ns_s]["accl_bias"]["z"] =
-        bias[2];
-  }
-
-  std::ofstream calibspline_output_json_file(FLAGS_result_output_json);
-  calibspline_output_json_file << std::setw(4) << json_calibspline_results_out
-                               << std::endl;
-  calibspline_output_json_file.close();
-
-  // read camera calibration
-  theia::Reconstruction output_spline_recon;
-  for (size_t i = 0; i < cam_timestamps_s.size(); ++i) {
-    const int64_t t_ns = cam_timestamps_s[i] * S_TO_NS;
-    Sophus::SE3d T_w_i;
-    imu_cam_calibrator.trajectory_.GetPose(t_ns, T_w_i);
-    Sophus::SE3d T_w_c = T_w_i * imu_cam_calibrator.trajectory_.GetT_i_c();
+  // camera poses first, so the debug video renders while the results are
+  // written
+  std::vector<int64_t> cam_times_ns;
+  cam_times_ns.reserve(cam_timestamps_s.size());
+  for (const double t_s : cam_timestamps_s) {
+    cam_times_ns.push_back(t_s * S_TO_NS);
+  }
+  aligned_vector<TrajectorySample> cam_samples;
+  imu_cam_calibrator.trajectory_.EvaluateTrajectory(
+      cam_times_ns, cam_samples, FLAGS_num_threads);
+  aligned_map<int64_t, Sophus::SE3d> cam_T_w_c;
+  for (size_t i = 0; i < cam_times_ns.size(); ++i) {
+    cam_T_w_c[cam_times_ns[i]] =
+        cam_samples[i].pose * imu_cam_calibrator.trajectory_.GetT_i_c();
+  }
+  std::unique_ptr<ReprojectionVideoRenderer> debug_renderer;
+  if (FLAGS_debug_video_path != "" && recording_segments_s.size() > 1) {
+    LOG(WARNING) << "No debug video for a joint calibration of several "
+                    "recordings.";
+  } else if (FLAGS_debug_video_path != "") {
+    const std::string debug_video_output =
+        FLAGS_debug_video_output.empty()
+            ? FLAGS_output_path + "/reprojection_debug.mp4"
+            : FLAGS_debug_video_output;
+    debug_renderer.reset(
+        new ReprojectionVideoRenderer(camera, scene_json, cam_T_w_c));
+    debug_renderer->SetNumThreads(FLAGS_num_threads);
+    debug_renderer->SetFrameStride(FLAGS_debug_video_stride);
+    debug_renderer->SetMaxFrames(FLAGS_debug_video_max_frames);
+    debug_renderer->Start(FLAGS_debug_video_path, debug_video_output);
+  }
+
+  // the result json and the ply files are serialized in the background while
+  // the next outputs are prepared
+  utils::AsyncWriter output_writer(2);
+  if (export_full_trajectory) {
+    const std::vector<double>& imu_timestamps_s =
+        imu_cam_calibrator.GetImuTimestamps();
+    const vec3_vector& gyro_meas = imu_cam_calibrator.GetGyroMeasurements();
+    const vec3_vector& accl_meas = imu_cam_calibrator.GetAcclMeasurements();
+
+    // Evaluate spline for all accelerometer and gyro and output them, both
+    // share the IMU timestamps
+    std::vector<int64_t> imu_times_ns;
+    imu_times_ns.reserve(imu_timestamps_s.size());
+    for (const double t_s : imu_timestamps_s) {
+      imu_times_ns.push_back(t_s * S_TO_NS);
+    }
+    aligned_vector<TrajectorySample> imu_samples;
+    imu_cam_calibrator.trajectory_.EvaluateTrajectory(
+        imu_times_ns, imu_samples, FLAGS_num_threads);
+
+    // the measurements are owned by the calibrator, which outlives the writer
+    output_writer.Submit(
+        FLAGS_result_output_json,
+        [json_out = std::move(json_calibspline_results_out),
+         imu_times_ns = std::move(imu_times_ns),
+         imu_samples = std::move(imu_samples),
+         &gyro_meas,
+         &accl_meas](const std::string& path) mutable {
+          auto write_vec3 = [](json& j, const Eigen::Vector3d& v) {
+            j["x"] = v[0];
+            j["y"] = v[1];
+            j["z"] = v[2];
+          };
+          json& json_trajectory = json_out["trajectory"];
+          for (size_t i = 0; i < imu_times_ns.size(); ++i) {
+            const TrajectorySample& sample = imu_samples[i];
+            const std::string t_ns_s = std::to_string(imu_times_ns[i]);
+            auto& json_t = json_trajectory[t_ns_s];
+            write_vec3(json_t["gyro_imu"], gyro_meas[i]);
+            write_vec3(json_t["accl_imu"], accl_meas[i]);
+            // write out spline estimates
+            write_vec3(json_t["gyro_spline"], sample.angular_velocity);
+            write_vec3(json_t["gyro_bias"], sample.gyro_bias);
+            write_vec3(json_t["accl_spline"], sample.acceleration);
+            write_vec3(json_t["accl_bias"], sample.accl_bias);
+          }
+          std::ofstream file(path);
+          file << std::setw(4) << json_out << std::endl;
+          return file.good();
+        });
+  } else {
+    json_calibspline_results_out["spline_snapshot"] = spline_snapshot_path;
+    output_writer.SubmitJson(FLAGS_result_output_json,
+                             std::move(json_calibspline_results_out));
+  }
+
+  // save spline recon as nvm to perform dense recon
+  const Eigen::Vector3i cam_spline_color(0, 255, 0);
+  const Eigen::Vector3i cam_recon_calib_color(255, 0, 0);
+  output_writer.Submit(
+      FLAGS_output_path + "/" + "sparse_recon_calib_dataset.ply",
+      [&recon_calib_dataset, cam_recon_calib_color](const std::string& path) {
+        return theia::WritePlyFile(
+            path, recon_calib_dataset, cam_recon_calib_color, 2);
+      });
+
+  auto output_spline_recon = std::make_shared<theia::Reconstruction>();
+  for (size_t i = 0; i < cam_times_ns.size(); ++i) {
+    const int64_t t_ns = cam_times_ns[i];
+    const Sophus::SE3d& T_w_c = cam_T_w_c[t_ns];
     theia::ViewId v_id_theia =
-        output_spline_recon.AddView(std::to_string(t_ns), 0, t_ns);
-    theia::View* view = output_spline_recon.MutableView(v_id_theia);
+        output_spline_recon->AddView(std::to_string(t_ns), 0, t_ns);
+    theia::View* view = output_spline_recon->MutableView(v_id_theia);
     view->SetEstimated(true);
     theia::Camera* camera_ptr = view->MutableCamera();
     camera_ptr->SetFromCameraIntrinsicsPriors(
@@ -349,108 +886,254 @@ int main(int argc, char* argv[]) {
         T_w_c.rotationMatrix().transpose());
     camera_ptr->SetPosition(T_w_c.translation());
   }
+  output_writer.Submit(
+      FLAGS_output_path + "/" + "sparse_recon_spline.ply",
+      [output_spline_recon, cam_spline_color](const std::string& path) {
+        return theia::WritePlyFile(
+            path, *output_spline_recon, cam_spline_color, 2);
+      });
 
-  // save spline recon as nvm to perform dense recon
-  const Eigen::Vector3i cam_spline_color(0, 255, 0);
-  const Eigen::Vector3i cam_recon_calib_color(255, 0, 0);
-  CHECK(theia::WritePlyFile(FLAGS_output_path + "/" + "sparse_recon_spline.ply",
-                            output_spline_recon,
-                            cam_spline_color,
-                            2));
-  CHECK(theia::WritePlyFile(
-      FLAGS_output_path + "/" + "sparse_recon_calib_dataset.ply",
-      recon_calib_dataset,
-      cam_recon_calib_color,
-      2));
-
-  if (FLAGS_debug_video_path != "") {
-    nlohmann::json scene_json;
-    CHECK(io::read_scene_bson(FLAGS_input_corners, scene_json))
-        << "Failed to load " << FLAGS_input_corners;
-
-    theia::Reconstruction recon_calib_dataset;
-
-    io::scene_points_to_calib_dataset(scene_json, recon_calib_dataset);
-    for (const auto& view : scene_json["views"].items()) {
-      const double timestamp_us = std::stod(view.key());
-      const double timestamp_s = timestamp_us * 1e-6;  // to seconds
-      const auto image_points = view.value()["image_points"];
-      std::string view_name = std::to_string((uint64_t)(timestamp_s * S_TO_NS));
-      theia::ViewId view_id =
-          recon_calib_dataset.AddView(view_name, 0, timestamp_s);
-
-      for (const auto& img_pts : image_points.items()) {
-        const int board_pt3_id = std::stoi(img_pts.key());
-        const Eigen::Vector2d corner(
-            Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
-        Eigen::Matrix2d cov;
-        cov << 0.5, 0, 0, 0.5;
-        const theia::Feature feat(corner, cov);
-        recon_calib_dataset.AddObservation(view_id, board_pt3_id, feat);
-      }
+  CHECK(output_writer.Wait()) << "Could not write the calibration results.";
+  if (debug_renderer && !debug_renderer->Wait()) {
+    LOG(ERROR) << "Could not render the debug video.";
+  }
+  snapshot_checkpointer.Remove();
+  progress_checkpointer.Remove();
+}
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  // the solver threads default to every CPU of the execution context
+  if (!utils::ConfigureExecutionContext(
+          0, FLAGS_cpu_affinity, FLAGS_numa_node, FLAGS_deterministic)) {
+    LOG(ERROR) << "Could not configure the execution context.";
+    return -1;
+  }
+  FLAGS_num_threads =
+      std::min(FLAGS_num_threads, utils::ExecutionContext::NumThreads());
+  Profiler::Instance().SetEnabled(!FLAGS_profile_report_json.empty());
+  CHECK(FLAGS_trajectory_export == "full" ||
+        FLAGS_trajectory_export == "snapshot")
+      << "Unknown trajectory export: " << FLAGS_trajectory_export;
+  const bool export_full_trajectory = FLAGS_trajectory_export == "full";
+  const std::string spline_snapshot_path =
+      FLAGS_spline_snapshot.empty() && !export_full_trajectory
+          ? FLAGS_output_path + "/spline.snapshot"
+          : FLAGS_spline_snapshot;
+
+  std::vector<std::string> pose_dataset_paths, corner_paths, telemetry_paths,
+      imu2cam_paths;
+  for (const auto& list :
+       {std::make_pair(FLAGS_input_pose_dataset, &pose_dataset_paths),
+        std::make_pair(FLAGS_input_corners, &corner_paths),
+        std::make_pair(FLAGS_telemetry_json, &telemetry_paths),
+        std::make_pair(FLAGS_gyro_to_cam_initial_calibration,
+                       &imu2cam_paths)}) {
+    std::stringstream path_list(list.first);
+    for (std::string path; std::getline(path_list, path, ',');) {
+      list.second->push_back(path);
     }
-    VideoCapture input_video;
-    input_video.open(FLAGS_debug_video_path);
-    int cnt_wrong = 0;
-    int nr_frames = 0;
-    while (true) {
-      Mat image;
-      if (!input_video.read(image)) {
-        cnt_wrong++;
-        if (cnt_wrong > 500) break;
-        continue;
-      }
+  }
+  const size_t num_recordings = pose_dataset_paths.size();
+  CHECK(num_recordings > 0 && corner_paths.size() == num_recordings &&
+        telemetry_paths.size() == num_recordings &&
+        imu2cam_paths.size() == num_recordings)
+      << "Need the same number of pose datasets, corner files, telemetry "
+         "files and initial calibrations.";
+  CHECK(num_recordings == 1 || FLAGS_spline_online_step_s <= 0.0)
+      << "The online calibration takes a single recording.";
 
-      const double timstamp_s =
-          input_video.get(cv::CAP_PROP_POS_MSEC) * MS_TO_S;
-
-      const int64_t t_ns = timstamp_s * S_TO_NS;
-
-      const theia::ViewId view_id_spline =
-          output_spline_recon.ViewIdFromName(std::to_string(t_ns));
-      const theia::ViewId view_id_calib =
-          recon_calib_dataset.ViewIdFromName(std::to_string(t_ns));
-
-      if (view_id_spline == theia::kInvalidViewId &&
-          view_id_calib == theia::kInvalidViewId)
-        continue;
-
-      theia::View* view_spline =
-          output_spline_recon.MutableView(view_id_spline);
-      const theia::View* view_calib = recon_calib_dataset.View(view_id_calib);
-      if (!view_spline || !view_calib) continue;
-      cv::resize(
-          image, image, cv::Size(camera.ImageWidth(), camera.ImageHeight()));
-
-      double reproj_error = 0.0;
-      for (size_t i = 0; i < view_calib->TrackIds().size(); ++i) {
-        theia::TrackId id = view_calib->TrackIds()[i];
-        Eigen::Vector2d pixel;
-        view_spline->Camera().ProjectPoint(
-            recon_calib_dataset.Track(id)->Point(), &pixel);
-        const theia::Feature measurement = (*view_calib->GetFeature(id));
-        cv::drawMarker(image,
-                       cv::Point(cvRound(pixel[0]), cvRound(pixel[1])),
-                       cv::Scalar(0, 0, 255),
-                       cv::MARKER_CROSS,
-                       10,
-                       1);
-
-        reproj_error += (measurement.point_ - pixel).norm();
-      }
-      reproj_error /= (double)view_calib->TrackIds().size();
-      cv::putText(
-          image,
-          "Reprojection error: " + std::to_string(reproj_error) + " pixel",
-          cv::Point(20, 20),
-          cv::FONT_HERSHEY_COMPLEX_SMALL,
-          1.0,
-          cv::Scalar(255, 0, 0));
-      cv::imshow("spline reprojection", image);
-      cv::waitKey(0);
-      ++nr_frames;
-      if (nr_frames > 500) break;
+  theia::Camera camera;
+  double fps;
+  CHECK(io::read_camera_calibration(FLAGS_camera_calibration_json, camera, fps))
+      << "Could not read camera calibration: " << FLAGS_camera_calibration_json;
+
+  std::vector<SplineRecording> recordings;
+  nlohmann::json scene_json;
+  Eigen::Quaterniond imu2cam;
+  for (size_t r = 0; r < num_recordings; ++r) {
+    // Get pose dataset
+    theia::Reconstruction pose_dataset;
+    CHECK(theia::ReadReconstruction(pose_dataset_paths[r], &pose_dataset))
+        << "Could not read Reconstruction file " << pose_dataset_paths[r];
+    nlohmann::json recording_scene_json;
+    CHECK(io::read_scene_bson(corner_paths[r], recording_scene_json))
+        << "Failed to load " << corner_paths[r];
+
+    // read gopro telemetry
+    auto telemetry = std::make_shared<CameraTelemetryData>();
+    if (IsBinaryTelemetry(telemetry_paths[r]) &&
+        FLAGS_telemetry_window_end_s > 0.0) {
+      TelemetryBinaryReader telemetry_reader;
+      CHECK(telemetry_reader.Open(telemetry_paths[r]))
+          << "Could not read: " << telemetry_paths[r];
+      CHECK(telemetry_reader.ReadTimeWindow(
+          std::max(0.0, FLAGS_telemetry_window_start_s),
+          FLAGS_telemetry_window_end_s,
+          *telemetry))
+          << "Could not read: " << telemetry_paths[r];
+      telemetry->img_timestamps_s = telemetry_reader.ImageTimestamps();
+    } else {
+      CHECK(ReadTelemetry(telemetry_paths[r], *telemetry))
+          << "Could not read: " << telemetry_paths[r];
+    }
+
+    double t_offset_cam_s = 0.0;
+    if (telemetry->img_timestamps_s.size() > 0) {
+      t_offset_cam_s = telemetry->img_timestamps_s[0];
+    }
+
+    auto recon = std::make_shared<theia::Reconstruction>();
+    BuildSplineCalibrationDataset(
+        pose_dataset, recording_scene_json, camera, t_offset_cam_s, *recon);
+
+    // read a gyro to cam calibration json to initialize rotation between imu
+    // and camera, the rotation of the first recording is used for all
+    Eigen::Quaterniond recording_imu2cam;
+    SplineRecording recording;
+    CHECK(ReadIMU2CamInit(imu2cam_paths[r],
+                          recording_imu2cam,
+                          recording.time_offset_imu_to_cam))
+        << "Could not read: " << imu2cam_paths[r];
+    if (r == 0) {
+      imu2cam = recording_imu2cam;
+      scene_json = std::move(recording_scene_json);
+    }
+    recording.vision_dataset = recon;
+    recording.telemetry_data = telemetry;
+    recordings.push_back(recording);
+  }
+  Sophus::SE3<double> T_i_c_init(imu2cam.conjugate(), Eigen::Vector3d(0, 0, 0));
+
+  std::shared_ptr<const theia::Reconstruction> recon_calib_dataset =
+      recordings[0].vision_dataset;
+  CameraTelemetryData telemetry_data;
+  double time_offset_imu_to_cam = recordings[0].time_offset_imu_to_cam;
+  std::vector<std::pair<double, double>> recording_segments_s;
+  if (num_recordings == 1) {
+    telemetry_data = *recordings[0].telemetry_data;
+  } else {
+    auto merged_dataset = std::make_shared<theia::Reconstruction>();
+    CHECK(MergeSplineRecordings(recordings,
+                                FLAGS_recording_gap_s,
+                                FLAGS_num_threads,
+                                *merged_dataset,
+                                telemetry_data,
+                                recording_segments_s))
+        << "Could not merge the recordings.";
+    recon_calib_dataset = merged_dataset;
+    time_offset_imu_to_cam = 0.0;
+  }
+  recordings.clear();
+
+  // further cameras of the rig, on the time axis of the first camera
+  std::vector<std::string> rig_calibration_paths, rig_pose_dataset_paths,
+      rig_corner_paths, rig_imu2cam_paths;
+  for (const auto& list :
+       {std::make_pair(FLAGS_rig_camera_calibration_json,
+                       &rig_calibration_paths),
+        std::make_pair(FLAGS_rig_input_pose_dataset, &rig_pose_dataset_paths),
+        std::make_pair(FLAGS_rig_input_corners, &rig_corner_paths),
+        std::make_pair(FLAGS_rig_gyro_to_cam_initial_calibration,
+                       &rig_imu2cam_paths)}) {
+    std::stringstream path_list(list.first);
+    for (std::string path; std::getline(path_list, path, ',');) {
+      list.second->push_back(path);
     }
   }
+  const size_t num_rig_cameras = rig_calibration_paths.size();
+  CHECK(rig_pose_dataset_paths.size() == num_rig_cameras &&
+        rig_corner_paths.size() == num_rig_cameras &&
+        rig_imu2cam_paths.size() == num_rig_cameras)
+      << "Need a pose dataset, corners and an initial calibration for every "
+         "rig camera.";
+  CHECK(num_rig_cameras == 0 || num_recordings == 1)
+      << "Rig cameras need a single recording.";
+  aligned_vector<Sophus::SE3d> rig_T_i_c_init;
+  std::vector<double> rig_line_delays_s;
+  if (num_rig_cameras > 0) {
+    auto rig_dataset = std::make_shared<theia::Reconstruction>();
+    AddRigCameraViews(*recon_calib_dataset, 0, 0.0, *rig_dataset);
+    for (size_t c = 0; c < num_rig_cameras; ++c) {
+      theia::Camera rig_camera;
+      double rig_fps;
+      CHECK(io::read_camera_calibration(
+          rig_calibration_paths[c], rig_camera, rig_fps))
+          << "Could not read camera calibration: " << rig_calibration_paths[c];
+      theia::Reconstruction pose_dataset;
+      CHECK(theia::ReadReconstruction(rig_pose_dataset_paths[c], &pose_dataset))
+          << "Could not read Reconstruction file " << rig_pose_dataset_paths[c];
+      nlohmann::json rig_scene_json;
+      CHECK(io::read_scene_bson(rig_corner_paths[c], rig_scene_json))
+          << "Failed to load " << rig_corner_paths[c];
+      Eigen::Quaterniond rig_imu2cam;
+      double rig_time_offset_imu_to_cam;
+      CHECK(ReadIMU2CamInit(
+          rig_imu2cam_paths[c], rig_imu2cam, rig_time_offset_imu_to_cam))
+          << "Could not read: " << rig_imu2cam_paths[c];
+
+      theia::Reconstruction camera_dataset;
+      BuildSplineCalibrationDataset(
+          pose_dataset, rig_scene_json, rig_camera, 0.0, camera_dataset);
+      AddRigCameraViews(camera_dataset,
+                        c + 1,
+                        time_offset_imu_to_cam - rig_time_offset_imu_to_cam,
+                        *rig_dataset);
+      rig_T_i_c_init.emplace_back(rig_imu2cam.conjugate(),
+                                  Eigen::Vector3d(0, 0, 0));
+      rig_line_delays_s.push_back(
+          FLAGS_global_shutter ? 0.0
+                               : 1. / rig_fps / rig_camera.ImageHeight());
+    }
+    recon_calib_dataset = rig_dataset;
+  }
+
+  // Read a imu intrinsics
+  ThreeAxisSensorCalibParams<double> acc_intr, gyr_intr;
+  CHECK(ReadIMUIntrinsics(
+      FLAGS_imu_intrinsics, FLAGS_imu_bias_file, acc_intr, gyr_intr))
+      << "Could not open " << FLAGS_imu_intrinsics;
+  std::cout << "Loaded IMU intrinsics.\n";
+  SplineWeightingData weight_data;
+  if (FLAGS_spline_error_weighting_json.empty()) {
+    SplineErrorWeightingOptions sew_options;
+    sew_options.quality_so3 = FLAGS_sew_quality_so3;
+    sew_options.quality_r3 = FLAGS_sew_quality_r3;
+    sew_options.camera_fps = fps;
+    CHECK(ComputeSplineErrorWeighting(telemetry_data, sew_options, weight_data))
+        << "Could not compute the spline error weighting.";
+  } else {
+    CHECK(ReadSplineErrorWeighting(FLAGS_spline_error_weighting_json,
+                                   weight_data))
+        << "Could not open " << FLAGS_spline_error_weighting_json;
+  }
+
+  double init_line_delay_us = 1. / fps / camera.ImageHeight();
+  if (FLAGS_global_shutter) {
+    init_line_delay_us = 0.0;
+  }
+
+  const bool supported_order =
+      DispatchSplineOrder(FLAGS_spline_order, [&](auto order) {
+        CalibrateSpline<decltype(order)::value>(camera,
+                                                scene_json,
+                                                *recon_calib_dataset,
+                                                T_i_c_init,
+                                                weight_data,
+                                                time_offset_imu_to_cam,
+                                                telemetry_data,
+                                                init_line_delay_us,
+                                                acc_intr,
+                                                gyr_intr,
+                                                export_full_trajectory,
+                                                spline_snapshot_path,
+                                                recording_segments_s,
+                                                rig_T_i_c_init,
+                                                rig_line_delays_s);
+      });
+  CHECK(supported_order) << "Unsupported spline order " << FLAGS_spline_order;
+  if (!FLAGS_profile_report_json.empty()) {
+    Profiler::Instance().WriteReport(FLAGS_profile_report_json);
+  }
   return 0;
 }
@@ -0,0 +1,41 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/write_telemetry.h"
+
+using namespace OpenICC;
+
+DEFINE_string(telemetry_json, "", "Path to the telemetry json.");
+DEFINE_string(output_path, "", "Path to the binary telemetry output.");
+DEFINE_int32(samples_per_block, 4096, "Number of IMU samples per block.");
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  CameraTelemetryData telemetry_data;
+  CHECK(io::ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data))
+      << "Could not read: " << FLAGS_telemetry_json;
+  CHECK(io::WriteTelemetryBinary(
+      FLAGS_output_path, telemetry_data, FLAGS_samples_per_block))
+      << "Could not write: " << FLAGS_output_path;
+  LOG(INFO) << "Wrote " << telemetry_data.accelerometer.size()
+            << " IMU samples to " << FLAGS_output_path;
+  return 0;
+}
@@ -0,0 +1,63 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/io/calibration_bundle.h"
+#include "OpenCameraCalibrator/utils/json.h"
+
+using namespace OpenICC;
+
+DEFINE_string(manifest,
+              "",
+              "Json object with one entry per device name, each with the "
+              "optional paths camera_calibration, imu_intrinsics, imu_bias "
+              "and imu_to_camera_result.");
+DEFINE_string(output_bundle, "", "Where to write the calibration bundle.");
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  std::ifstream manifest_file(FLAGS_manifest);
+  CHECK(manifest_file.is_open()) << "Could not open " << FLAGS_manifest;
+  nlohmann::json manifest;
+  manifest_file >> manifest;
+
+  std::vector<io::CalibrationRecord> records;
+  for (const auto& device : manifest.items()) {
+    const nlohmann::json& paths = device.value();
+    io::CalibrationRecord record;
+    CHECK(io::CalibrationRecordFromJson(
+        device.key(),
+        paths.value("camera_calibration", ""),
+        paths.value("imu_intrinsics", ""),
+        paths.value("imu_bias", ""),
+        paths.value("imu_to_camera_result", ""),
+        record))
+        << "Could not read the calibration of " << device.key();
+    records.push_back(record);
+  }
+  CHECK(io::WriteCalibrationBundle(FLAGS_output_bundle, records))
+      << "Could not write " << FLAGS_output_bundle;
+  LOG(INFO) << "Wrote " << records.size() << " calibrations to "
+            << FLAGS_output_bundle;
+  return 0;
+}
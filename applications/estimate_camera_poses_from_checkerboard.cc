@@ -21,6 +21,8 @@
 #include "OpenCameraCalibrator/core/pose_estimator.h"
 #include "OpenCameraCalibrator/io/read_camera_calibration.h"
 #include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/async_writer.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
@@ -39,10 +41,31 @@ DEFINE_string(output_pose_dataset,
 DEFINE_bool(optimize_board_points,
             false,
             "If board points should be optimized.");
+DEFINE_bool(board_point_covariance,
+            false,
+            "Compute and print the covariance of the optimized board points.");
+DEFINE_int32(num_threads,
+             1,
+             "Number of threads used to estimate the view poses.");
+DEFINE_int32(undistortion_lut_step,
+             0,
+             "Undistort the corners with a lookup table sampled every this "
+             "many pixels, cached next to the camera calibration. 0 solves "
+             "every corner exactly.");
+DEFINE_bool(temporal_pose_prediction,
+            true,
+            "Seed each view with the pose of the previous view and only run "
+            "RANSAC if that pose does not explain the corners.");
+DEFINE_string(profile_report_json,
+              "",
+              "Optional. Writes wall time, cpu time, peak memory and item "
+              "counts of the pipeline stages to this json.");
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
+  OpenICC::utils::Profiler::Instance().SetEnabled(
+      !FLAGS_profile_report_json.empty());
 
   nlohmann::json scene_json;
   CHECK(read_scene_bson(FLAGS_input_corners, scene_json))
@@ -56,11 +79,21 @@ int main(int argc, char* argv[]) {
 
   LOG(INFO) << "Start pose estimation.\n";
   PoseEstimator pose_estimator;
+  pose_estimator.SetNumThreads(FLAGS_num_threads);
+  pose_estimator.SetTemporalPrediction(FLAGS_temporal_pose_prediction);
+  if (FLAGS_undistortion_lut_step > 0) {
+    pose_estimator.SetUndistortionLut(
+        OpenICC::utils::LoadOrBuildUndistortionLut(
+            FLAGS_camera_calibration_json,
+            camera,
+            FLAGS_undistortion_lut_step,
+            FLAGS_num_threads));
+  }
   pose_estimator.EstimatePosesFromJson(scene_json, camera);
   LOG(INFO) << "Finished pose estimation.\n";
   if (FLAGS_optimize_board_points) {
     LOG(INFO) << "Optimizing board points.\n";
-    pose_estimator.OptimizeBoardPoints();
+    pose_estimator.OptimizeBoardPoints(FLAGS_board_point_covariance);
     pose_estimator.OptimizeAllPoses();
   }
   LOG(INFO) << "Filtering bad poses.\n";
@@ -68,11 +101,23 @@ int main(int argc, char* argv[]) {
 
   theia::Reconstruction pose_dataset;
   pose_estimator.GetPoseDataset(pose_dataset);
-  theia::WriteReconstruction(pose_dataset, FLAGS_output_pose_dataset);
-  theia::WritePlyFile(FLAGS_output_pose_dataset + ".ply",
-                      pose_dataset,
-                      Eigen::Vector3i(255, 0, 0),
-                      2);
+  // both outputs only read the pose dataset, so they are written concurrently
+  OpenICC::utils::AsyncWriter output_writer(2);
+  output_writer.Submit(FLAGS_output_pose_dataset,
+                       [&pose_dataset](const std::string& path) {
+                         return theia::WriteReconstruction(pose_dataset, path);
+                       });
+  output_writer.Submit(FLAGS_output_pose_dataset + ".ply",
+                       [&pose_dataset](const std::string& path) {
+                         return theia::WritePlyFile(
+                             path, pose_dataset, Eigen::Vector3i(255, 0, 0), 2);
+                       });
+  if (!output_writer.Wait()) {
+    LOG(ERROR) << "Could not write the pose dataset.";
+  }
+  if (!FLAGS_profile_report_json.empty()) {
+    OpenICC::utils::Profiler::Instance().WriteReport(FLAGS_profile_report_json);
+  }
 
   return 0;
 }
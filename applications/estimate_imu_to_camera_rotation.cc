@@ -19,6 +19,7 @@
 #include "OpenCameraCalibrator/core/imu_to_camera_rotation_estimator.h"
 #include "OpenCameraCalibrator/io/read_misc.h"
 #include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/utils/imu_timing.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
@@ -52,6 +53,18 @@ DEFINE_double(delta_t_imu_to_cam,
               0.0,
               "You can supply a time offset guess if you have one available. "
               "t_cam=t_imu+delta_t.");
+DEFINE_bool(full_time_offset_search,
+            false,
+            "Search the time offset over the whole range instead of refining "
+            "a cross-correlation estimate.");
+DEFINE_bool(sanitize_imu_timestamps,
+            false,
+            "Drop repeated IMU timestamps, detect gaps and de-jitter the "
+            "timestamps before the estimation.");
+DEFINE_bool(resample_imu,
+            false,
+            "Sanitize the IMU timestamps and resample the gyroscope onto a "
+            "uniform grid, so dt_imu is its exact period.");
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
@@ -75,97 +88,30 @@ int main(int argc, char* argv[]) {
     // if no bias is given we can also estimate it here
     rotation_estimator.EnableGyroBiasEstimation();
   }
+  if (FLAGS_full_time_offset_search) {
+    rotation_estimator.EnableFullOffsetSearch();
+  }
 
   // read gopro telemetry
   OpenICC::CameraTelemetryData telemetry_data;
-  if (!OpenICC::io::ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data)) {
+  if (!OpenICC::io::ReadTelemetry(FLAGS_telemetry_json, telemetry_data)) {
     std::cout << "Could not read: " << FLAGS_telemetry_json << std::endl;
   }
-
-  double t_imu_to_cam_0 = 0.0;
-  double delta_t0_cam = 0.0;
-  if (telemetry_data.img_timestamps_s.size() > 0) {
-    delta_t0_cam = telemetry_data.img_timestamps_s[0];
-    LOG(INFO) << "It seems there are accurate image timestamps. Using first image timestamp as offset to video timestamps! Offset: "
-              << delta_t0_cam << " s."<<std::endl;
-    // if we have a more accurate image timestamp
-    // in the case of gopro the cori timestamp
-
-  }
-  else if (t_imu_to_cam_0 != 0.0) {
-    t_imu_to_cam_0 = FLAGS_delta_t_imu_to_cam;
-    LOG(INFO) << "Using supplied initial imu 2 camera time offset: "
-                << t_imu_to_cam_0 << std::endl;
-  }
-
-  // fill measurementes
-  vec3_map angular_velocities;
-  for (size_t i = 0; i < telemetry_data.gyroscope.size(); ++i) {
-    angular_velocities[telemetry_data.gyroscope[i].timestamp_s()] =
-        telemetry_data.gyroscope[i].data() - gyro_bias;
-  }
-
-  // get mean hz imu
-  double imu_dt_s = 0.0;
-  for (size_t i = 1; i < telemetry_data.gyroscope.size(); ++i) {
-    imu_dt_s += telemetry_data.gyroscope[i].timestamp_s() -
-                telemetry_data.gyroscope[i - 1].timestamp_s();
-  }
-  imu_dt_s /= static_cast<double>(telemetry_data.gyroscope.size() - 1);
-  LOG(INFO) << "Mean IMU data rate: "<<1./imu_dt_s<<"Hz";
-
-  quat_map visual_rotations;
-  for (size_t i = 0; i < pose_dataset.ViewIds().size(); ++i) {
-    const theia::View* view = pose_dataset.View(pose_dataset.ViewIds()[i]);
-    const double timestamp_s = view->GetTimestamp() + delta_t0_cam;
-    // cam to world trafo, so transposed rotation matrix
-    Eigen::Quaterniond vis_quat(
-        view->Camera().GetOrientationAsRotationMatrix());
-    visual_rotations[timestamp_s] = vis_quat;
-  }
-  std::vector<double> timestamps_images;
-  for (const auto& vis_rot : visual_rotations) {
-    timestamps_images.push_back(vis_rot.first);
+  if (FLAGS_sanitize_imu_timestamps || FLAGS_resample_imu) {
+    ImuTimingOptions timing_options;
+    timing_options.resample = FLAGS_resample_imu;
+    double imu_period_s = 0.0;
+    CHECK(SanitizeImuTelemetry(timing_options, telemetry_data, imu_period_s))
+        << "Could not sanitize the IMU timestamps.";
   }
 
-  // get mean hz camera
-  std::vector<double> cams_dt_s;
-  for (size_t i = 1; i < timestamps_images.size(); ++i) {
-    cams_dt_s.push_back(timestamps_images[i] - timestamps_images[i - 1]);
-  }
-  // we take the median as some images might not have been estimated
-  const double cam_dt_s = OpenICC::utils::MedianOfDoubleVec(cams_dt_s);
-
-  std::vector<double> tVis_all_frames, tVis_missing_frames;
-  for (double t = visual_rotations.begin()->first;
-       t < visual_rotations.rbegin()->first;
-       t += cam_dt_s) {
-    tVis_all_frames.push_back(t);
-  }
-  quat_vector visual_rotations_missing_frames;
-  for (auto const& vis : visual_rotations) {
-    tVis_missing_frames.push_back(vis.first);
-    visual_rotations_missing_frames.push_back(vis.second);
-  }
-  LOG(INFO) << "Interpolating visual quaternions to IMU rate.";
-  // interpolate visual rotations as some views might be missing
-  quat_vector visual_rotations_interpolated_vec;
-  OpenICC::utils::InterpolateQuaternions(tVis_missing_frames,
-                                         tVis_all_frames,
-                                         visual_rotations_missing_frames,
-                                         visual_rotations_interpolated_vec);
-  quat_map visual_rotations_interpolated;
-  for (size_t i = 0; i < visual_rotations_interpolated_vec.size(); ++i) {
-    visual_rotations_interpolated[tVis_all_frames[i]] =
-        visual_rotations_interpolated_vec[i];
-  }
+  const double imu_dt_s = rotation_estimator.SetMeasurementsFromPoseDataset(
+      pose_dataset, telemetry_data, gyro_bias);
 
   Eigen::Matrix3d R_gyro_to_camera;
   double time_offset_gyro_to_camera;
   vec3_vector ang_vel, imu_vel;
 
-  rotation_estimator.SetAngularVelocities(angular_velocities);
-  rotation_estimator.SetVisualRotations(visual_rotations_interpolated);
   rotation_estimator.EstimateCameraImuRotation(imu_dt_s,
                                                R_gyro_to_camera,
                                                time_offset_gyro_to_camera,
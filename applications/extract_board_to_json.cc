@@ -13,21 +13,37 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <fstream>
 #include <gflags/gflags.h>
 #include <ios>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <sys/stat.h>
 #include <vector>
 
+#include <opencv2/videoio.hpp>
+
 #include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/checkpoint.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/stage_cache.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
 using namespace cv;
 
-DEFINE_string(input_path, "", "Input path.");
+DEFINE_string(input_path,
+              "",
+              "Input path. A comma separated list extracts all inputs on one "
+              "pool of detection threads.");
 DEFINE_string(board_type, "charuco", "Board type. (charuco, radon, apriltag)");
 DEFINE_string(aruco_detector_params, "", "Path detector yaml.");
 DEFINE_double(downsample_factor,
@@ -35,7 +51,9 @@ DEFINE_double(downsample_factor,
               "Downsample factor for images. I_new = 1/factor * I");
 DEFINE_string(save_corners_json_path,
               "",
-              "Where to save the recon dataset to.");
+              "Where to save the recon dataset to. Paths ending with .scene "
+              "are written in the binary scene format, .cscene in the "
+              "compact one. Comma separated, one per input path.");
 DEFINE_double(checker_square_length_m,
               0.022,
               "Size of one square on the checkerboard in [m]. Needed to only "
@@ -46,20 +64,331 @@ DEFINE_int32(aruco_dict,
              cv::aruco::DICT_ARUCO_ORIGINAL,
              "Aruco dictionary id.");
 DEFINE_bool(recompute_corners, false, "If corners should be extracted again.");
+DEFINE_string(cache_dir,
+              "",
+              "Optional. Stores the extracted corners under a hash of the "
+              "input and of all extraction flags. Without it, existing save "
+              "paths are skipped regardless of how they were extracted.");
 DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_int32(num_threads,
+             1,
+             "Number of board detection threads. 1 runs the serial extraction.");
+
+DEFINE_int32(frame_stride,
+             1,
+             "Only detect the board on every n-th video frame.");
+DEFINE_int32(sparse_num_frames,
+             0,
+             "Only decode this many video frames, spread evenly over the "
+             "video. Far away frames are reached by seeking. 0 decodes every "
+             "frame.");
+DEFINE_double(t_start_s,
+              -1.0,
+              "Only extract frames from this time on, in the time base of "
+              "the scene. Negative starts at the first frame. Shards of one "
+              "input can be merged with merge_scene_shards.");
+DEFINE_double(t_end_s,
+              -1.0,
+              "Only extract frames before this time. Negative extracts to "
+              "the last frame.");
+DEFINE_double(min_frame_difference,
+              0.0,
+              "Skip video frames whose thumbnail differs by less than this "
+              "mean absolute intensity (0-255) from the last detected frame. "
+              "0 detects on every frame.");
+
+DEFINE_string(video_hw_acceleration,
+              "none",
+              "Hardware video decoder (none, any, d3d11, vaapi, mfx). Falls "
+              "back to the default decoder if not available.");
+DEFINE_bool(gpu_preprocessing,
+            false,
+            "Convert the frames to gray and downsample them on the GPU. Needs "
+            "a build with BUILD_WITH_CUDA, falls back to the CPU otherwise.");
+DEFINE_bool(refine_full_resolution,
+            false,
+            "Detect on the downsampled image and refine the corners on the "
+            "full resolution image. Corners are written at full resolution.");
+DEFINE_bool(track_board_roi,
+            false,
+            "Search the board around its detection in the previous frame "
+            "first.");
+DEFINE_double(board_roi_margin,
+              0.5,
+              "Enlargement of the tracked board bounding box relative to its "
+              "size.");
+DEFINE_bool(track_board_corners,
+            false,
+            "Track the corners from frame to frame with Lucas-Kanade instead "
+            "of detecting the board on every frame.");
+DEFINE_int32(corner_redetect_interval,
+             10,
+             "Detect the board on every n-th frame when tracking the "
+             "corners.");
+DEFINE_double(max_corner_homography_change_px,
+              0.5,
+              "Drop tracked corners whose offset from the board homography "
+              "changes by more than this from the previous frame.");
+DEFINE_bool(stop_when_covered,
+            false,
+            "Stop the extraction of an input once its views cover the image "
+            "and enough board tilts for an intrinsic calibration.");
+DEFINE_int32(coverage_min_views,
+             50,
+             "With stop_when_covered: minimum number of views.");
+DEFINE_double(coverage_min_cell_fraction,
+              0.9,
+              "With stop_when_covered: fraction of the 8x6 image grid cells "
+              "that has to contain corners.");
+DEFINE_int32(coverage_min_views_per_tilt,
+             5,
+             "With stop_when_covered: minimum number of frontal views and of "
+             "views per board tilt direction.");
+DEFINE_double(apriltag_quad_decimate,
+              1.0,
+              "Apriltag boards with the apriltag3 backend only: decimation "
+              "of the image for quad detection.");
+DEFINE_int32(apriltag_threads,
+             1,
+             "Apriltag boards with the apriltag3 backend only: threads per "
+             "detector.");
+DEFINE_bool(adaptive_marker_refinement,
+            false,
+            "Charuco boards only: skip the marker refinement if all markers "
+            "of the board were detected or no candidate was rejected.");
+DEFINE_int32(radon_proxy_size,
+             0,
+             "Radon boards only: detect the board on a proxy image with "
+             "this longer side and refine at full resolution. Falls back to "
+             "the exhaustive search if that fails. 0 disables it.");
+DEFINE_string(frame_timestamps,
+              "",
+              "Videos only: per frame timestamps instead of the container "
+              "times. A .txt file with one timestamp in ns per line, or a "
+              "telemetry file with image timestamps (img_timestamps_ns).");
+DEFINE_string(mcap_image_topic,
+              "",
+              "MCAP inputs only: image topic to extract. The first "
+              "sensor_msgs/msg/Image or CompressedImage topic if empty.");
+DEFINE_string(profile_report_json,
+              "",
+              "Optional. Writes wall time, cpu time, peak memory and item "
+              "counts of the pipeline stages to this json.");
+DEFINE_string(checkpoint_path,
+              "",
+              "Optional. Single video inputs only: extracts the video in "
+              "time shards next to this path and records the finished "
+              "shards, so that an interrupted extraction can be resumed "
+              "with --resume. The shards are merged into the save path at "
+              "the end.");
+DEFINE_double(checkpoint_chunk_s,
+              60.0,
+              "With checkpoint_path: video time per shard. Frame to frame "
+              "tracking restarts at every shard.");
+DEFINE_bool(resume,
+            false,
+            "Resume from the shards recorded in checkpoint_path.");
 
 using namespace OpenICC;
 using namespace OpenICC::utils;
 using namespace OpenICC::core;
 using nlohmann::json;
 
+//! Splits a comma separated list
+std::vector<std::string> SplitString(const std::string& list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  for (std::string item; std::getline(stream, item, ',');) {
+    if (!item.empty()) items.push_back(item);
+  }
+  return items;
+}
+
+//! Key of the corners of one input, covers everything that changes them
+StageKey CornerExtractionKey(const std::string& input_path,
+                             const std::string& save_path) {
+  StageKey key;
+  key.AddFile(input_path)
+      .Add(FLAGS_board_type)
+      .AddFile(FLAGS_aruco_detector_params)
+      .Add(FLAGS_checker_square_length_m)
+      .Add(FLAGS_num_squares_x)
+      .Add(FLAGS_num_squares_y)
+      .Add(FLAGS_aruco_dict)
+      .Add(FLAGS_downsample_factor)
+      .Add(FLAGS_frame_stride)
+      .Add(FLAGS_sparse_num_frames)
+      .Add(FLAGS_t_start_s)
+      .Add(FLAGS_t_end_s)
+      .Add(FLAGS_min_frame_difference)
+      .Add(FLAGS_refine_full_resolution)
+      .Add(FLAGS_track_board_roi)
+      .Add(FLAGS_board_roi_margin)
+      .Add(FLAGS_track_board_corners)
+      .Add(FLAGS_corner_redetect_interval)
+      .Add(FLAGS_max_corner_homography_change_px)
+      .Add(FLAGS_stop_when_covered)
+      .Add(FLAGS_coverage_min_views)
+      .Add(FLAGS_coverage_min_cell_fraction)
+      .Add(FLAGS_coverage_min_views_per_tilt)
+      .Add(FLAGS_apriltag_quad_decimate)
+      .Add(FLAGS_adaptive_marker_refinement)
+      .Add(FLAGS_radon_proxy_size)
+      .Add(FLAGS_mcap_image_topic)
+      .AddFile(FLAGS_frame_timestamps)
+      // the file format follows the extension
+      .Add(save_path.substr(save_path.find_last_of('.') + 1));
+  return key;
+}
+
+//! Time range [t_first_s, t_last_s] of the frames of a video, from the frame
+//! timestamps if given or from the frame count and rate of the container
+bool VideoTimeRange(const std::string& video_path,
+                    const std::vector<double>& frame_timestamps_s,
+                    double& t_first_s,
+                    double& t_last_s) {
+  if (!frame_timestamps_s.empty()) {
+    t_first_s = frame_timestamps_s.front();
+    t_last_s = frame_timestamps_s.back();
+    return true;
+  }
+  cv::VideoCapture capture(video_path);
+  if (!capture.isOpened()) {
+    return false;
+  }
+  const double fps = capture.get(cv::CAP_PROP_FPS);
+  const double num_frames = capture.get(cv::CAP_PROP_FRAME_COUNT);
+  if (fps <= 0.0 || num_frames <= 0.0) {
+    return false;
+  }
+  t_first_s = 0.0;
+  t_last_s = num_frames / fps;
+  return true;
+}
+
+//! Extracts a video in time shards of FLAGS_checkpoint_chunk_s and merges
+//! them into save_path. The number of finished shards is written to
+//! FLAGS_checkpoint_path after each shard, with resume the extraction
+//! continues after the last finished one.
+bool ExtractVideoWithCheckpoints(BoardExtractor& board_extractor,
+                                 const std::string& video_path,
+                                 const std::string& save_path,
+                                 const std::vector<double>& frame_timestamps_s,
+                                 const StageKey& key) {
+  const double t_start_s = FLAGS_t_start_s < 0.0
+                               ? -std::numeric_limits<double>::infinity()
+                               : FLAGS_t_start_s;
+  const double t_end_s = FLAGS_t_end_s < 0.0
+                             ? std::numeric_limits<double>::infinity()
+                             : FLAGS_t_end_s;
+  double t_first_s = 0.0, t_last_s = 0.0;
+  if (!VideoTimeRange(video_path, frame_timestamps_s, t_first_s, t_last_s)) {
+    LOG(WARNING) << "Could not read the duration of " << video_path
+                 << ", extracting without checkpoints.";
+    return board_extractor.ExtractVideoToJson(
+        video_path, save_path, FLAGS_downsample_factor);
+  }
+  t_first_s = std::max(t_first_s, t_start_s);
+  t_last_s = std::min(t_last_s, t_end_s);
+  const int num_chunks = std::max(
+      1,
+      static_cast<int>(std::ceil((t_last_s - t_first_s) /
+                                 std::max(FLAGS_checkpoint_chunk_s, 1e-3))));
+
+  // the shards keep the extension, it selects the scene format
+  const size_t dot = save_path.find_last_of('.');
+  const std::string extension =
+      dot == std::string::npos ? "" : save_path.substr(dot);
+  std::vector<std::string> shard_paths;
+  for (int i = 0; i < num_chunks; ++i) {
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".part%03d", i);
+    shard_paths.push_back(FLAGS_checkpoint_path + suffix + extension);
+  }
+
+  Checkpointer checkpointer(FLAGS_checkpoint_path);
+  int finished_chunks = 0;
+  if (FLAGS_resume && checkpointer.Exists()) {
+    std::ifstream progress_file(checkpointer.Path());
+    const json progress = json::parse(progress_file, nullptr, false);
+    if (progress.is_object() &&
+        progress.value("key", std::string()) == key.Hex() &&
+        progress.value("num_chunks", 0) == num_chunks) {
+      finished_chunks = progress.value("finished_chunks", 0);
+      LOG(INFO) << "Resuming the extraction of " << video_path << " after "
+                << finished_chunks << " of " << num_chunks << " shards.";
+    } else {
+      LOG(WARNING) << "The checkpoint " << checkpointer.Path()
+                   << " belongs to another extraction, starting over.";
+    }
+  }
+
+  for (int i = finished_chunks; i < num_chunks; ++i) {
+    const double chunk_t_start_s =
+        i == 0 ? t_start_s : t_first_s + i * FLAGS_checkpoint_chunk_s;
+    const double chunk_t_end_s =
+        i == num_chunks - 1 ? t_end_s
+                            : t_first_s + (i + 1) * FLAGS_checkpoint_chunk_s;
+    board_extractor.SetTimeRange(chunk_t_start_s, chunk_t_end_s);
+    if (!board_extractor.ExtractVideoToJson(
+            video_path, shard_paths[i], FLAGS_downsample_factor)) {
+      return false;
+    }
+    const json progress = {{"key", key.Hex()},
+                           {"num_chunks", num_chunks},
+                           {"finished_chunks", i + 1}};
+    checkpointer.Write([&](const std::string& path) {
+      std::ofstream file(path);
+      file << progress.dump(2);
+      return static_cast<bool>(file);
+    });
+  }
+
+  if (!io::MergeSceneFiles(shard_paths, save_path)) {
+    LOG(ERROR) << "Could not merge the shards of " << video_path << " into "
+               << save_path;
+    return false;
+  }
+  for (const std::string& shard_path : shard_paths) {
+    std::remove(shard_path.c_str());
+  }
+  checkpointer.Remove();
+  return true;
+}
+
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
+  Profiler::Instance().SetEnabled(!FLAGS_profile_report_json.empty());
 
-  if (DoesFileExist(FLAGS_save_corners_json_path) && !FLAGS_recompute_corners) {
-    LOG(INFO) << "Skipping corner extraction. Already extracted for: "
-              << FLAGS_input_path << "\n";
+  const std::vector<std::string> all_input_paths =
+      SplitString(FLAGS_input_path);
+  const std::vector<std::string> all_save_paths =
+      SplitString(FLAGS_save_corners_json_path);
+  CHECK_EQ(all_input_paths.size(), all_save_paths.size())
+      << "Need one save path per input path.";
+  const StageCache cache(FLAGS_cache_dir);
+  std::vector<std::string> input_paths, save_paths;
+  std::vector<StageKey> keys;
+  for (size_t i = 0; i < all_input_paths.size(); ++i) {
+    const StageKey key =
+        CornerExtractionKey(all_input_paths[i], all_save_paths[i]);
+    if (cache.Enabled() && !FLAGS_recompute_corners) {
+      if (cache.Restore("corners", key, "", all_save_paths[i])) {
+        LOG(INFO) << "Restored corners of " << all_input_paths[i]
+                  << " from the cache.\n";
+        continue;
+      }
+    } else if (DoesFileExist(all_save_paths[i]) && !FLAGS_recompute_corners) {
+      LOG(INFO) << "Skipping corner extraction. Already extracted for: "
+                << all_input_paths[i] << "\n";
+      continue;
+    }
+    input_paths.push_back(all_input_paths[i]);
+    save_paths.push_back(all_save_paths[i]);
+    keys.push_back(key);
+  }
+  if (input_paths.empty()) {
     return 0;
   }
 
@@ -67,6 +396,42 @@ int main(int argc, char* argv[]) {
   if (FLAGS_verbose) {
     board_extractor.SetVerbosePlot();
   }
+  board_extractor.SetNumThreads(FLAGS_num_threads);
+  board_extractor.SetFrameStride(FLAGS_frame_stride);
+  board_extractor.SetSparseSampling(FLAGS_sparse_num_frames);
+  board_extractor.SetTimeRange(
+      FLAGS_t_start_s < 0.0 ? -std::numeric_limits<double>::infinity()
+                            : FLAGS_t_start_s,
+      FLAGS_t_end_s < 0.0 ? std::numeric_limits<double>::infinity()
+                          : FLAGS_t_end_s);
+  board_extractor.SetMinFrameDifference(FLAGS_min_frame_difference);
+  board_extractor.SetVideoHwAcceleration(FLAGS_video_hw_acceleration);
+  board_extractor.SetFullResolutionRefinement(FLAGS_refine_full_resolution);
+  board_extractor.SetGpuPreprocessing(FLAGS_gpu_preprocessing);
+  board_extractor.SetRoiTracking(FLAGS_track_board_roi, FLAGS_board_roi_margin);
+  board_extractor.SetCornerTracking(FLAGS_track_board_corners,
+                                    FLAGS_corner_redetect_interval,
+                                    FLAGS_max_corner_homography_change_px);
+  ExtractionCoverageOptions coverage_options;
+  coverage_options.min_views = FLAGS_coverage_min_views;
+  coverage_options.min_cell_fraction = FLAGS_coverage_min_cell_fraction;
+  coverage_options.min_views_per_tilt = FLAGS_coverage_min_views_per_tilt;
+  board_extractor.SetCoverageTermination(FLAGS_stop_when_covered,
+                                         coverage_options);
+  board_extractor.SetApriltagOptions(FLAGS_apriltag_quad_decimate,
+                                     FLAGS_apriltag_threads);
+  board_extractor.SetAdaptiveMarkerRefinement(
+      FLAGS_adaptive_marker_refinement);
+  board_extractor.SetRadonProxyDetection(FLAGS_radon_proxy_size);
+  board_extractor.SetMcapImageTopic(FLAGS_mcap_image_topic);
+  std::vector<double> frame_timestamps_s;
+  if (!FLAGS_frame_timestamps.empty()) {
+    CHECK_EQ(input_paths.size(), 1)
+        << "Frame timestamps are only supported for a single video.";
+    CHECK(io::ReadFrameTimestamps(FLAGS_frame_timestamps, frame_timestamps_s))
+        << "Could not read the frame timestamps " << FLAGS_frame_timestamps;
+    board_extractor.SetVideoFrameTimestamps(frame_timestamps_s);
+  }
   BoardType board_type = StringToBoardType(FLAGS_board_type);
   if (board_type == BoardType::CHARUCO) {
     const float aruco_marker_length = FLAGS_checker_square_length_m / 2.0f;
@@ -89,15 +454,52 @@ int main(int argc, char* argv[]) {
     LOG(ERROR) << "This board type does not exist! Choose Charuco or Radon";
   }
 
+  bool use_checkpoints = !FLAGS_checkpoint_path.empty();
+  if (use_checkpoints &&
+      (input_paths.size() > 1 || !IsPathAFile(input_paths[0]) ||
+       FLAGS_sparse_num_frames > 0 || FLAGS_stop_when_covered)) {
+    LOG(WARNING) << "Checkpoints are only supported for a single video "
+                    "without sparse_num_frames and stop_when_covered, "
+                    "extracting without them.";
+    use_checkpoints = false;
+  }
+
   LOG(INFO) << "Starting board extraction. This might take a while...";
-  if (IsPathAFile(FLAGS_input_path)) {
-    board_extractor.ExtractVideoToJson(FLAGS_input_path,
-                                       FLAGS_save_corners_json_path,
-                                       FLAGS_downsample_factor);
+  bool success = false;
+  if (input_paths.size() > 1) {
+    std::vector<std::unique_ptr<io::SceneWriter>> scene_writers;
+    std::vector<io::SceneWriter*> scene_writer_ptrs;
+    for (const std::string& save_path : save_paths) {
+      scene_writers.push_back(io::CreateSceneWriter(save_path));
+      CHECK(scene_writers.back()->Open(save_path))
+          << "Could not open " << save_path;
+      scene_writer_ptrs.push_back(scene_writers.back().get());
+    }
+    success = board_extractor.ExtractBatch(
+        input_paths, FLAGS_downsample_factor, scene_writer_ptrs);
+  } else if (IsPathAFile(input_paths[0])) {
+    if (use_checkpoints) {
+      success = ExtractVideoWithCheckpoints(board_extractor,
+                                            input_paths[0],
+                                            save_paths[0],
+                                            frame_timestamps_s,
+                                            keys[0]);
+    } else {
+      success = board_extractor.ExtractVideoToJson(
+          input_paths[0], save_paths[0], FLAGS_downsample_factor);
+    }
   } else {
-    board_extractor.ExtractImageFolderToJson(FLAGS_input_path,
-                                             FLAGS_save_corners_json_path,
-                                             FLAGS_downsample_factor);
+    success = board_extractor.ExtractImageFolderToJson(
+        input_paths[0], save_paths[0], FLAGS_downsample_factor);
+  }
+  for (size_t i = 0; i < save_paths.size() && success && cache.Enabled();
+       ++i) {
+    if (!cache.Store("corners", keys[i], "", save_paths[i])) {
+      LOG(WARNING) << "Could not store " << save_paths[i] << " in the cache.";
+    }
+  }
+  if (!FLAGS_profile_report_json.empty()) {
+    Profiler::Instance().WriteReport(FLAGS_profile_report_json);
   }
   return 0;
 }
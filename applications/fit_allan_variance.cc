@@ -15,12 +15,22 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
 #include "OpenCameraCalibrator/core/allan_variance_fitter.h"
+#include "OpenCameraCalibrator/core/psd_noise_estimator.h"
 #include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/utils/imu_timing.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
 
 using namespace OpenICC;
 using namespace OpenICC::core;
+using json = nlohmann::json;
 
 DEFINE_string(telemetry_json,
               "/media/Data/Sparsenet/"
@@ -28,17 +38,224 @@ DEFINE_string(telemetry_json,
               "Path to the telemetry json.");
 
 DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_bool(streaming,
+            false,
+            "Accumulate the Allan variance while reading the samples instead "
+            "of storing them.");
+DEFINE_int32(num_threads, 1, "Number of threads for the Allan variance.");
+DEFINE_string(telemetry_list,
+              "",
+              "Batch mode: text file with one telemetry json per line. All "
+              "devices are fitted in streaming mode and written to "
+              "result_table_csv.");
+DEFINE_int32(max_concurrent_devices,
+             2,
+             "Batch mode: number of telemetry files that are loaded at the "
+             "same time. Bounds the memory, the num_threads are shared "
+             "between them.");
+DEFINE_bool(psd_quick_look,
+            false,
+            "Estimate the noise densities from the Welch PSD instead of the "
+            "Allan variance. Needs only a few minutes of static data.");
+DEFINE_int32(psd_segment_length, 4096, "Samples per Welch PSD segment.");
+DEFINE_string(noise_output_json,
+              "",
+              "Optional output json of the PSD quick look noise parameters.");
+DEFINE_string(result_table_csv,
+              "allan_variance_results.csv",
+              "Batch mode: output table with one row per telemetry file.");
+DEFINE_bool(sanitize_imu_timestamps,
+            false,
+            "Drop repeated IMU timestamps, detect gaps and de-jitter the "
+            "timestamps before the fit.");
+DEFINE_bool(resample_imu,
+            false,
+            "Sanitize the IMU timestamps and resample both streams onto a "
+            "uniform grid, so the cluster times use the exact period.");
+DEFINE_string(checkpoint_path,
+              "",
+              "Streaming mode: periodically write the accumulated Allan "
+              "variance state to this file. It is removed once the "
+              "accumulation finished.");
+DEFINE_double(checkpoint_interval_s,
+              300.0,
+              "Seconds between two checkpoints.");
+DEFINE_bool(resume,
+            false,
+            "Continue from --checkpoint_path if it was written for the same "
+            "telemetry.");
+
+namespace {
+
+//! One row of the batch result table
+struct DeviceResult {
+  std::string telemetry_json;
+  bool success = false;
+  size_t nr_samples = 0;
+  Eigen::Vector3d gyro_white_noise = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_bias_instability = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_bias_instability_time_s = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_white_noise = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_bias_instability = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_bias_instability_time_s = Eigen::Vector3d::Zero();
+};
+
+//! Sanitizes the IMU timestamps if one of the flags is set
+bool PrepareImu(CameraTelemetryData& telemetry_data) {
+  if (!FLAGS_sanitize_imu_timestamps && !FLAGS_resample_imu) {
+    return true;
+  }
+  utils::ImuTimingOptions timing_options;
+  timing_options.resample = FLAGS_resample_imu;
+  double imu_period_s = 0.0;
+  return utils::SanitizeImuTelemetry(
+      timing_options, telemetry_data, imu_period_s);
+}
+
+//! Loads and fits one device. The telemetry only lives for this call, so at
+//! most max_concurrent_devices files are held in memory.
+void FitDevice(const int num_threads, DeviceResult& result) {
+  CameraTelemetryData telemetry_data;
+  if (!io::ReadTelemetry(result.telemetry_json, telemetry_data)) {
+    LOG(ERROR) << "Could not read: " << result.telemetry_json;
+    return;
+  }
+  if (!PrepareImu(telemetry_data)) {
+    LOG(ERROR) << "Could not sanitize the IMU of: " << result.telemetry_json;
+    return;
+  }
+  result.nr_samples = telemetry_data.accelerometer.size();
+  AllanVarianceFitter fitter(telemetry_data, 10000, true, num_threads);
+  // the streaming fitter keeps no copy of the samples
+  telemetry_data = CameraTelemetryData();
+  if (!fitter.RunFit()) {
+    LOG(ERROR) << "Allan variance fit failed for: " << result.telemetry_json;
+    return;
+  }
+  result.gyro_white_noise = fitter.GetGyroWhiteNoise();
+  result.gyro_bias_instability = fitter.GetGyroBiasInstability();
+  result.gyro_bias_instability_time_s = fitter.GetGyroBiasInstabilityTime();
+  result.accl_white_noise = fitter.GetAcclWhiteNoise();
+  result.accl_bias_instability = fitter.GetAcclBiasInstability();
+  result.accl_bias_instability_time_s = fitter.GetAcclBiasInstabilityTime();
+  result.success = true;
+}
+
+bool WriteResultTable(const std::string& path,
+                      const std::vector<DeviceResult>& results) {
+  std::ofstream table(path);
+  if (!table.is_open()) {
+    LOG(ERROR) << "Could not open " << path;
+    return false;
+  }
+  const std::string columns[6] = {"gyro_white_noise",
+                                  "gyro_bias_instability",
+                                  "gyro_bias_instability_time_s",
+                                  "accl_white_noise",
+                                  "accl_bias_instability",
+                                  "accl_bias_instability_time_s"};
+  const std::string axis[3] = {"x", "y", "z"};
+  table << "telemetry_json,success,nr_samples";
+  for (const std::string& column : columns) {
+    for (const std::string& a : axis) table << "," << column << "_" << a;
+  }
+  table << "\n" << std::setprecision(10);
+  for (const DeviceResult& result : results) {
+    const Eigen::Vector3d* values[6] = {&result.gyro_white_noise,
+                                        &result.gyro_bias_instability,
+                                        &result.gyro_bias_instability_time_s,
+                                        &result.accl_white_noise,
+                                        &result.accl_bias_instability,
+                                        &result.accl_bias_instability_time_s};
+    table << result.telemetry_json << "," << result.success << ","
+          << result.nr_samples;
+    for (const Eigen::Vector3d* value : values) {
+      for (int a = 0; a < 3; ++a) table << "," << (*value)[a];
+    }
+    table << "\n";
+  }
+  return true;
+}
+
+int RunBatch() {
+  std::ifstream list_file(FLAGS_telemetry_list);
+  CHECK(list_file.is_open()) << "Could not open " << FLAGS_telemetry_list;
+  std::vector<DeviceResult> results;
+  std::string line;
+  while (std::getline(list_file, line)) {
+    line.erase(0, line.find_first_not_of(" \t"));
+    line.erase(line.find_last_not_of(" \t\r") + 1);
+    if (line.empty() || line[0] == '#') continue;
+    results.emplace_back();
+    results.back().telemetry_json = line;
+  }
+  CHECK(!results.empty()) << "No telemetry file in " << FLAGS_telemetry_list;
+
+  const int nr_devices = static_cast<int>(results.size());
+  const int concurrent_devices =
+      std::max(1, std::min(FLAGS_max_concurrent_devices, nr_devices));
+  const int device_threads =
+      std::max(1, FLAGS_num_threads / concurrent_devices);
+  LOG(INFO) << "Fitting " << nr_devices << " devices, " << concurrent_devices
+            << " at a time with " << device_threads << " threads each.";
+  utils::ParallelFor(0, nr_devices, concurrent_devices, [&](const int i) {
+    FitDevice(device_threads, results[i]);
+  });
+
+  const int nr_failed = std::count_if(
+      results.begin(), results.end(), [](const DeviceResult& result) {
+        return !result.success;
+      });
+  if (nr_failed > 0) {
+    LOG(WARNING) << nr_failed << " of " << nr_devices << " devices failed.";
+  }
+  if (!WriteResultTable(FLAGS_result_table_csv, results)) return 1;
+  LOG(INFO) << "Wrote " << FLAGS_result_table_csv;
+  return nr_failed > 0 ? 1 : 0;
+}
+
+}  // namespace
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
 
+  if (!FLAGS_telemetry_list.empty()) {
+    return RunBatch();
+  }
+
   // read telemetry
   CameraTelemetryData telemetry_data;
-  CHECK(io::ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data))
+  CHECK(io::ReadTelemetry(FLAGS_telemetry_json, telemetry_data))
       << "Could not read: " << FLAGS_telemetry_json;
+  CHECK(PrepareImu(telemetry_data)) << "Could not sanitize the IMU timestamps.";
+
+  if (FLAGS_psd_quick_look) {
+    PsdNoiseEstimatorOptions options;
+    options.segment_length = FLAGS_psd_segment_length;
+    PsdNoiseEstimator estimator(options);
+    estimator.Push(telemetry_data);
+    if (!estimator.Finish()) return 1;
+    const json noise_json = estimator.ToJson();
+    std::cout << noise_json.dump(4) << std::endl;
+    if (!FLAGS_noise_output_json.empty()) {
+      std::ofstream noise_file(FLAGS_noise_output_json);
+      CHECK(noise_file.is_open()) << "Could not open "
+                                  << FLAGS_noise_output_json;
+      noise_file << std::setw(4) << noise_json << std::endl;
+    }
+    return 0;
+  }
 
-  AllanVarianceFitter fitter(telemetry_data, 10000);
+  AllanCheckpointOptions checkpoint;
+  checkpoint.path = FLAGS_checkpoint_path;
+  checkpoint.interval_s = FLAGS_checkpoint_interval_s;
+  checkpoint.resume = FLAGS_resume;
+  AllanVarianceFitter fitter(telemetry_data,
+                             10000,
+                             FLAGS_streaming,
+                             FLAGS_num_threads,
+                             checkpoint);
   fitter.RunFit();
 
   return 0;
@@ -0,0 +1,320 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Simulates a deterministic dataset from a random ground truth spline
+// trajectory in front of a calibration board: board corners in the scene
+// format of extract_board_to_json and telemetry in the format of the
+// telemetry readers. The ground truth imu to camera transformation and the
+// initial IMU biases are written in the formats of the calibration inputs.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/io/write_telemetry.h"
+#include "OpenCameraCalibrator/utils/async_writer.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/synthetic_data.h"
+#include "OpenCameraCalibrator/utils/utils.h"
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+using nlohmann::json;
+
+DEFINE_string(output_corners,
+              "",
+              "Where to save the board corners. Paths ending with .scene are "
+              "written in the binary scene format, .cscene in the compact "
+              "one and everything else as UBJSON.");
+DEFINE_string(output_telemetry,
+              "",
+              "Where to save the telemetry. Paths ending with .bin are "
+              "written in the binary telemetry format, everything else as "
+              "JSON.");
+DEFINE_string(output_imu_to_cam,
+              "",
+              "Optional. Where to save the ground truth imu to camera "
+              "rotation and time offset (format of "
+              "estimate_imu_to_camera_rotation).");
+DEFINE_string(output_imu_bias,
+              "",
+              "Optional. Where to save the initial IMU biases (format of "
+              "static_imu_calibration).");
+
+DEFINE_string(camera_calibration_json,
+              "",
+              "Optional camera calibration json. If empty, a pinhole camera "
+              "is set up from the image size and focal length flags.");
+DEFINE_int32(image_width, 1920, "Image width of the default camera.");
+DEFINE_int32(image_height, 1080, "Image height of the default camera.");
+DEFINE_double(focal_length, 1000.0, "Focal length of the default camera.");
+DEFINE_double(camera_fps,
+              30.0,
+              "Frame rate. Overwritten by the camera calibration json.");
+
+DEFINE_string(board_type, "radon", "Board type. (charuco, radon, apriltag)");
+DEFINE_string(aruco_detector_params,
+              "",
+              "Path detector yaml. Needed for charuco boards.");
+DEFINE_double(checker_square_length_m,
+              0.022,
+              "Size of one square on the checkerboard in [m].");
+DEFINE_int32(num_squares_x, 14, "Number of squares in x.");
+DEFINE_int32(num_squares_y, 9, "Number of squares in y");
+DEFINE_int32(aruco_dict,
+             cv::aruco::DICT_ARUCO_ORIGINAL,
+             "Aruco dictionary id.");
+
+DEFINE_double(duration_s, 60.0, "Length of the dataset in seconds.");
+DEFINE_double(knot_spacing_s,
+              0.5,
+              "Knot spacing of the ground truth spline. Smaller values give "
+              "faster motion.");
+DEFINE_double(distance_m, 0.5, "Mean distance of the camera to the board.");
+DEFINE_double(position_std_m,
+              0.15,
+              "Std of the camera position around its mean.");
+DEFINE_double(rotation_std_deg,
+              10.0,
+              "Std of the camera rotation around looking at the board.");
+DEFINE_string(imu_to_cam_rotation_deg,
+              "0,0,90",
+              "Rotation of T_i_c as angle axis x,y,z in degrees.");
+DEFINE_string(imu_to_cam_translation_m,
+              "0.01,0.02,0.005",
+              "Translation of T_i_c as x,y,z in meters.");
+
+DEFINE_double(imu_rate_hz, 200.0, "Rate of accelerometer and gyroscope.");
+DEFINE_double(gyro_noise_density, 1e-3, "Gyroscope noise in rad/s/sqrt(Hz).");
+DEFINE_double(accl_noise_density,
+              1e-2,
+              "Accelerometer noise in m/s^2/sqrt(Hz).");
+DEFINE_double(gyro_bias_random_walk,
+              1e-5,
+              "Gyroscope bias random walk in rad/s^2/sqrt(Hz).");
+DEFINE_double(accl_bias_random_walk,
+              1e-4,
+              "Accelerometer bias random walk in m/s^3/sqrt(Hz).");
+DEFINE_string(gyro_bias, "0,0,0", "Initial gyroscope bias x,y,z in rad/s.");
+DEFINE_string(accl_bias, "0,0,0", "Initial accelerometer bias x,y,z in m/s^2.");
+DEFINE_double(pixel_noise, 0.5, "Std of the corner noise in pixels.");
+DEFINE_int32(min_corners,
+             10,
+             "Views with less visible corners are not written.");
+DEFINE_int32(seed, 0, "Seed of the trajectory and all noise.");
+
+namespace {
+
+bool ParseVector3(const std::string& str, Eigen::Vector3d* vec) {
+  std::stringstream stream(str);
+  std::string value;
+  int i = 0;
+  while (std::getline(stream, value, ',')) {
+    if (i == 3) {
+      return false;
+    }
+    (*vec)[i++] = std::stod(value);
+  }
+  return i == 3;
+}
+
+bool HasSuffix(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool InitializeBoard(BoardExtractor* board_extractor) {
+  const BoardType board_type = StringToBoardType(FLAGS_board_type);
+  if (board_type == BoardType::CHARUCO) {
+    const float aruco_marker_length = FLAGS_checker_square_length_m / 2.0f;
+    return board_extractor->InitializeCharucoBoard(
+        FLAGS_aruco_detector_params,
+        aruco_marker_length,
+        FLAGS_checker_square_length_m,
+        FLAGS_num_squares_x,
+        FLAGS_num_squares_y,
+        FLAGS_aruco_dict);
+  } else if (board_type == BoardType::RADON) {
+    return board_extractor->InitializeRadonBoard(FLAGS_checker_square_length_m,
+                                                 FLAGS_num_squares_x,
+                                                 FLAGS_num_squares_y);
+  } else if (board_type == BoardType::APRILTAG) {
+    return board_extractor->InitializeAprilBoard(FLAGS_checker_square_length_m,
+                                                 0.3,
+                                                 FLAGS_num_squares_x,
+                                                 FLAGS_num_squares_y);
+  }
+  LOG(ERROR) << "This board type does not exist! Choose Charuco or Radon";
+  return false;
+}
+
+theia::Camera DefaultCamera() {
+  theia::Camera camera;
+  camera.SetCameraIntrinsicsModelType(
+      theia::CameraIntrinsicsModelType::PINHOLE);
+  camera.SetImageSize(FLAGS_image_width, FLAGS_image_height);
+  camera.SetFocalLength(FLAGS_focal_length);
+  camera.SetPrincipalPoint(FLAGS_image_width / 2.0, FLAGS_image_height / 2.0);
+  return camera;
+}
+
+bool WriteJson(const std::string& path, const json& output_json) {
+  std::ofstream out_file(path);
+  if (!out_file.is_open()) {
+    LOG(ERROR) << "Could not open " << path;
+    return false;
+  }
+  out_file << std::setw(4) << output_json << std::endl;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  CHECK(!FLAGS_output_corners.empty()) << "Set --output_corners.";
+  CHECK(!FLAGS_output_telemetry.empty()) << "Set --output_telemetry.";
+
+  Eigen::Vector3d rotation_deg, translation_m;
+  CHECK(ParseVector3(FLAGS_imu_to_cam_rotation_deg, &rotation_deg))
+      << "Could not parse --imu_to_cam_rotation_deg";
+  CHECK(ParseVector3(FLAGS_imu_to_cam_translation_m, &translation_m))
+      << "Could not parse --imu_to_cam_translation_m";
+  utils::SyntheticImuOptions imu_options;
+  CHECK(ParseVector3(FLAGS_gyro_bias, &imu_options.gyro_bias))
+      << "Could not parse --gyro_bias";
+  CHECK(ParseVector3(FLAGS_accl_bias, &imu_options.accl_bias))
+      << "Could not parse --accl_bias";
+  imu_options.imu_rate_hz = FLAGS_imu_rate_hz;
+  imu_options.gyro_noise_density = FLAGS_gyro_noise_density;
+  imu_options.accl_noise_density = FLAGS_accl_noise_density;
+  imu_options.gyro_bias_random_walk = FLAGS_gyro_bias_random_walk;
+  imu_options.accl_bias_random_walk = FLAGS_accl_bias_random_walk;
+  imu_options.seed = FLAGS_seed + 1;
+
+  theia::Camera camera = DefaultCamera();
+  double camera_fps = FLAGS_camera_fps;
+  if (!FLAGS_camera_calibration_json.empty()) {
+    CHECK(io::read_camera_calibration(
+        FLAGS_camera_calibration_json, camera, camera_fps))
+        << "Could not read " << FLAGS_camera_calibration_json;
+  }
+
+  BoardExtractor board_extractor;
+  CHECK(InitializeBoard(&board_extractor)) << "Could not initialize the board";
+  const std::vector<cv::Point3f> board_pts = board_extractor.GetBoardPts()[0];
+  std::vector<int> board_pt_ids(board_pts.size());
+  if (StringToBoardType(FLAGS_board_type) == BoardType::RADON) {
+    board_pt_ids = board_extractor.GetRadonBoardIDs();
+  } else {
+    for (size_t i = 0; i < board_pts.size(); ++i) {
+      board_pt_ids[i] = i;
+    }
+  }
+  Eigen::Vector3d board_center(0.0, 0.0, 0.0);
+  for (const cv::Point3f& p : board_pts) {
+    board_center += Eigen::Vector3d(p.x, p.y, p.z) / board_pts.size();
+  }
+
+  const Sophus::SE3d T_i_c(Sophus::SO3d::exp(rotation_deg * M_PI / 180.0),
+                           translation_m);
+  utils::SyntheticMotionOptions motion_options;
+  motion_options.duration_s = FLAGS_duration_s;
+  motion_options.knot_dt_s = FLAGS_knot_spacing_s;
+  motion_options.distance_m = FLAGS_distance_m;
+  motion_options.position_std_m = FLAGS_position_std_m;
+  motion_options.rotation_std_rad = FLAGS_rotation_std_deg * M_PI / 180.0;
+  motion_options.seed = FLAGS_seed;
+  const utils::SyntheticTrajectory trajectory(
+      motion_options, board_center, T_i_c);
+
+  LOG(INFO) << "Simulating " << FLAGS_duration_s << "s of telemetry.";
+  CameraTelemetryData telemetry;
+  utils::SimulateTelemetry(trajectory, imu_options, camera_fps, &telemetry);
+  // the scene simulation only reads the telemetry, so it is written meanwhile
+  utils::AsyncWriter output_writer(1);
+  const bool binary_telemetry = HasSuffix(FLAGS_output_telemetry, ".bin");
+  output_writer.Submit(
+      FLAGS_output_telemetry,
+      [&telemetry, binary_telemetry](const std::string& path) {
+        return binary_telemetry ? io::WriteTelemetryBinary(path, telemetry)
+                                : io::WriteTelemetryJSON(path, telemetry);
+      });
+
+  LOG(INFO) << "Simulating " << telemetry.img_timestamps_s.size()
+            << " board views.";
+  std::unique_ptr<io::SceneWriter> scene_writer =
+      io::CreateSceneWriter(FLAGS_output_corners);
+  CHECK(scene_writer->Open(FLAGS_output_corners))
+      << "Could not open " << FLAGS_output_corners;
+  const size_t nr_views = utils::SimulateScene(trajectory,
+                                               camera,
+                                               board_pts,
+                                               board_pt_ids,
+                                               telemetry.img_timestamps_s,
+                                               FLAGS_pixel_noise,
+                                               FLAGS_seed + 2,
+                                               scene_writer.get(),
+                                               FLAGS_min_corners);
+  CHECK(scene_writer->Close(utils::SyntheticSceneHeader(
+      camera,
+      camera_fps,
+      StringToBoardType(FLAGS_board_type),
+      FLAGS_checker_square_length_m,
+      board_pts,
+      board_pt_ids)))
+      << "Could not write " << FLAGS_output_corners;
+  CHECK(output_writer.Wait()) << "Could not write " << FLAGS_output_telemetry;
+  LOG(INFO) << "Wrote " << nr_views << " views and "
+            << telemetry.gyroscope.size() << " IMU samples.";
+
+  if (!FLAGS_output_imu_to_cam.empty()) {
+    // the calibration expects the rotation from gyro to camera, R_c_i
+    const Eigen::Quaterniond q_gyro_to_cam =
+        T_i_c.so3().inverse().unit_quaternion();
+    json output_json;
+    output_json["gyro_to_camera_rotation"]["w"] = q_gyro_to_cam.w();
+    output_json["gyro_to_camera_rotation"]["x"] = q_gyro_to_cam.x();
+    output_json["gyro_to_camera_rotation"]["y"] = q_gyro_to_cam.y();
+    output_json["gyro_to_camera_rotation"]["z"] = q_gyro_to_cam.z();
+    output_json["time_offset_gyro_to_cam"] = 0.0;
+    output_json["imu_to_camera_translation"] = {
+        translation_m[0], translation_m[1], translation_m[2]};
+    CHECK(WriteJson(FLAGS_output_imu_to_cam, output_json));
+  }
+  if (!FLAGS_output_imu_bias.empty()) {
+    json output_json;
+    const char* axes[3] = {"x", "y", "z"};
+    for (int i = 0; i < 3; ++i) {
+      output_json["accl_bias"][axes[i]] = imu_options.accl_bias[i];
+      output_json["gyro_bias"][axes[i]] = imu_options.gyro_bias[i];
+    }
+    CHECK(WriteJson(FLAGS_output_imu_bias, output_json));
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/io/write_scene.h"
+
+using namespace OpenICC;
+
+DEFINE_string(input_scenes,
+              "",
+              "Comma separated scenes of one input, extracted with disjoint "
+              "--t_start_s/--t_end_s ranges of extract_board_to_json.");
+DEFINE_string(output_scene,
+              "",
+              "Merged scene. Paths ending with .scene are written in the "
+              "binary scene format, .cscene in the compact one.");
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+
+  std::vector<std::string> input_scenes;
+  std::stringstream stream(FLAGS_input_scenes);
+  for (std::string item; std::getline(stream, item, ',');) {
+    if (!item.empty()) input_scenes.push_back(item);
+  }
+  CHECK(!input_scenes.empty()) << "No input scenes given.";
+  CHECK(io::MergeSceneFiles(input_scenes, FLAGS_output_scene))
+      << "Could not merge the scenes into " << FLAGS_output_scene;
+  LOG(INFO) << "Merged " << input_scenes.size() << " scenes into "
+            << FLAGS_output_scene;
+  return 0;
+}
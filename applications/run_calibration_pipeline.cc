@@ -0,0 +1,1209 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Runs the camera and IMU to camera calibration stages of
+// python/run_gopro_calibration.py in one process: corner extraction of both
+// videos, camera calibration, pose estimation, IMU to camera rotation
+// initialization and the continuous time calibration. The stages hand their
+// results over in memory. With --checkpoint_dir, every stage additionally
+// writes the files of the standalone application, so single stages can be
+// rerun from them. With --cache_dir, stage outputs are kept under a hash of
+// their inputs and flags, and a rerun only recomputes the stages whose
+// inputs changed and the stages after them. IMU biases and the spline error
+// weighting still come from get_imu_biases.py and get_sew_for_dataset.py.
+//
+// With --batch_manifest_json, several devices are calibrated at once. The
+// stages of all devices form one dependency graph that is scheduled on
+// --num_threads threads, so independent stages of different devices, e.g.
+// the static IMU calibration and the Allan variance, run concurrently.
+// Manifest: {"devices": [{"name": ..., "cam_calib_video": ...}, ...]} with
+// the keys of DeviceConfig.
+//
+// With --serve_socket, the process stays resident and calibrates the
+// manifests it receives on a Unix domain socket, one json line per
+// connection. The reply is one json line with the stage results. Initialized
+// board extractors and their detector pools are kept between the jobs, so a
+// job pays neither the process startup nor the board setup. {"command":
+// "shutdown"} stops the service.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/allan_variance_fitter.h"
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/core/camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_to_camera_rotation_estimator.h"
+#include "OpenCameraCalibrator/core/pose_estimator.h"
+#include "OpenCameraCalibrator/core/pose_stream_writer.h"
+#include "OpenCameraCalibrator/core/spline_error_weighting.h"
+#include "OpenCameraCalibrator/core/static_imu_calibrator.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/spline_snapshot.h"
+#include "OpenCameraCalibrator/io/write_camera_calibration.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/execution_context.h"
+#include "OpenCameraCalibrator/utils/job_scheduler.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/stage_cache.h"
+#include "OpenCameraCalibrator/utils/types.h"
+#include "OpenCameraCalibrator/utils/utils.h"
+
+#include <theia/io/reconstruction_reader.h>
+#include <theia/io/reconstruction_writer.h>
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+using namespace OpenICC::io;
+using namespace OpenICC::utils;
+using json = nlohmann::json;
+
+// Inputs.
+DEFINE_string(cam_calib_video,
+              "",
+              "Video or image folder for the camera calibration.");
+DEFINE_string(cam_imu_video,
+              "",
+              "Video or image folder for the IMU to camera calibration.");
+DEFINE_string(telemetry_json,
+              "",
+              "Telemetry of the IMU to camera calibration video.");
+DEFINE_string(imu_bias_json, "", "IMU bias json, e.g. from get_imu_biases.py.");
+DEFINE_string(imu_intrinsics,
+              "",
+              "IMU intrinsics, scale and misalignment matrices. E.g. estimated "
+              "with static_imu_calibration or from a datasheet.");
+DEFINE_string(spline_error_weighting_json,
+              "",
+              "Spline error weighting, created with get_sew_for_dataset.py. "
+              "If empty it is computed from the telemetry.");
+DEFINE_double(sew_quality_so3,
+              0.98,
+              "Spline error weighting: fraction of the gyroscope signal "
+              "energy kept by the SO3 spline.");
+DEFINE_double(sew_quality_r3,
+              0.96,
+              "Spline error weighting: fraction of the accelerometer signal "
+              "energy kept by the R3 spline.");
+DEFINE_string(static_imu_telemetry_json,
+              "",
+              "Optional. Telemetry of a static multi pose recording. The IMU "
+              "intrinsics are then calibrated from it instead of read from "
+              "--imu_intrinsics.");
+DEFINE_string(allan_telemetry_json,
+              "",
+              "Optional. Telemetry of a long static recording to fit the "
+              "Allan variance of.");
+DEFINE_string(batch_manifest_json,
+              "",
+              "Optional. Json with one entry per device to calibrate, see "
+              "above. Replaces the single device input and output flags.");
+
+// Outputs.
+DEFINE_string(checkpoint_dir,
+              "",
+              "Optional. Writes the output files of every stage to this "
+              "folder.");
+DEFINE_string(result_output_json, "", "Path to the result json file.");
+DEFINE_string(cache_dir,
+              "",
+              "Optional. Keeps the stage outputs under a hash of their "
+              "inputs, so reruns skip the stages whose inputs did not "
+              "change.");
+
+// Board extraction.
+DEFINE_string(board_type, "charuco", "Board type. (charuco, radon, apriltag)");
+DEFINE_string(aruco_detector_params, "", "Path detector yaml.");
+DEFINE_double(downsample_factor,
+              1.0,
+              "Downsample factor for images. I_new = 1/factor * I");
+DEFINE_double(checker_square_length_m,
+              0.022,
+              "Size of one square on the checkerboard in [m].");
+DEFINE_int32(num_squares_x, 9, "Number of squares in x.");
+DEFINE_int32(num_squares_y, 7, "Number of squares in y");
+DEFINE_int32(aruco_dict,
+             cv::aruco::DICT_ARUCO_ORIGINAL,
+             "Aruco dictionary id.");
+
+// Camera calibration.
+DEFINE_string(camera_model_to_calibrate,
+              "DOUBLE_SPHERE",
+              "What camera model do you want to calibrate. Options:"
+              "PINHOLE,PINHOLE_RADIAL_TANGENTIAL,DIVISION_UNDISTORTION,DOUBLE_"
+              "SPHERE,EXTENDED_UNIFIED,FISHEYE");
+DEFINE_double(grid_size,
+              0.04,
+              "Only take images that are at least grid_size apart");
+DEFINE_bool(optimize_board_points,
+            false,
+            "If the board points should be optimized during camera "
+            "calibration and after pose estimation.");
+DEFINE_bool(streaming_pose_estimation,
+            false,
+            "Extract the corners of the IMU camera video in the pose "
+            "estimation stage and estimate the poses while the video is "
+            "decoded, instead of after the whole video was extracted.");
+
+// IMU calibration.
+DEFINE_bool(global_shutter, false, "If camera has a global shutter.");
+DEFINE_bool(calibrate_cam_line_delay,
+            false,
+            "If camera rolling shutter line delay should be calibrated.");
+DEFINE_bool(reestimate_biases,
+            false,
+            "If accelerometer and gyroscope biases should be estimated during "
+            "spline optim");
+DEFINE_double(gravity_const, 9.81, "gravity constant");
+DEFINE_string(known_grav_dir_axis,
+              "Z",
+              "Possible values (X,Y,Z,UNKNOWN) if the gravity direction of "
+              "your calibration board is exactly known.");
+DEFINE_double(bias_knot_spacing_s,
+              10.0,
+              "Knot spacing of the accelerometer and gyroscope bias splines "
+              "in seconds.");
+DEFINE_bool(adaptive_bias_knot_spacing,
+            false,
+            "Choose the bias knot spacing from the bias instability of the "
+            "Allan variance fit of allan_telemetry_json instead.");
+DEFINE_double(initial_static_interval_s,
+              10.0,
+              "Static IMU calibration: length of the initial static interval "
+              "for bias estimation.");
+
+DEFINE_int32(num_threads,
+             0,
+             "Number of threads shared by all stages. 0 uses every CPU the "
+             "process may run on.");
+DEFINE_string(cpu_affinity,
+              "",
+              "Optional. CPUs to pin the process to, e.g. \"0-3,8\". Keeps "
+              "concurrent calibrations on one machine from competing for the "
+              "same cores.");
+DEFINE_int32(numa_node,
+             -1,
+             "Optional. Pin the process to the CPUs of this NUMA node.");
+DEFINE_bool(deterministic,
+            false,
+            "Reproduce the results bit for bit, independent of num_threads. "
+            "The Ceres solves run on one thread.");
+DEFINE_int32(job_threads,
+             0,
+             "Threads requested by each multi threaded stage. 0 splits "
+             "num_threads evenly between the devices.");
+DEFINE_string(serve_socket,
+              "",
+              "Optional. Run as a resident service that calibrates the batch "
+              "manifests sent to this Unix domain socket, see above.");
+DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_string(profile_report_json,
+              "",
+              "Optional. Writes wall time, cpu time, peak memory and item "
+              "counts of the pipeline stages to this json.");
+
+//! Inputs and outputs of one device
+struct DeviceConfig {
+  std::string name;
+  std::string cam_calib_video;
+  std::string cam_imu_video;
+  std::string telemetry_json;
+  std::string imu_bias_json;
+  std::string imu_intrinsics;
+  std::string spline_error_weighting_json;
+  std::string static_imu_telemetry_json;
+  std::string allan_telemetry_json;
+  std::string checkpoint_dir;
+  std::string cache_dir;
+  std::string result_output_json;
+};
+
+//! Stage results of one device. Every stage only reads the results of the
+//! stages it depends on, so the stages need no locking.
+struct DeviceCalibration {
+  DeviceConfig config;
+  StageCache cache;
+
+  // inputs
+  CameraTelemetryData telemetry_data;
+  SplineWeightingData weight_data;
+  ThreeAxisSensorCalibParams<double> acc_intr, gyr_intr;
+  Eigen::Vector3d gyro_bias = Eigen::Vector3d::Zero();
+
+  // corner extraction
+  json cam_scene_json;
+  json cam_imu_scene_json;
+  StageKey cam_scene_key, cam_imu_scene_key;
+
+  // camera calibration
+  theia::Camera camera;
+  double fps = 0.0;
+  double camera_reproj_error = -1.0;
+  StageKey camera_key;
+
+  // pose estimation
+  theia::Reconstruction pose_dataset;
+  StageKey pose_key;
+
+  // IMU to camera rotation
+  Eigen::Quaterniond imu2cam;
+  double time_offset_imu_to_cam = 0.0;
+  StageKey imu_rotation_key;
+
+  // Allan variance, tau of the bias instability per axis
+  bool allan_fitted = false;
+  Eigen::Vector3d accl_bias_instability_time_s = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_bias_instability_time_s = Eigen::Vector3d::Zero();
+
+  //! Checkpoint path of a stage output, empty without a checkpoint dir
+  std::string CheckpointPath(const std::string& file_name) const {
+    if (config.checkpoint_dir.empty()) {
+      return "";
+    }
+    return config.checkpoint_dir + "/" + file_name;
+  }
+
+  //! Where a stage writes its output to: the checkpoint if there is one,
+  //! else a scratch file that is moved into the cache afterwards
+  std::string OutputPath(const std::string& checkpoint_name,
+                         const std::string& stage,
+                         const StageKey& key,
+                         const std::string& extension) const {
+    if (!config.checkpoint_dir.empty()) {
+      return CheckpointPath(checkpoint_name);
+    }
+    return cache.Enabled() ? ScratchPath(stage, key, extension) : "";
+  }
+
+  std::string ScratchPath(const std::string& stage,
+                          const StageKey& key,
+                          const std::string& extension) const {
+    return cache.EntryPath(stage, key, extension) + ".part";
+  }
+
+  //! Stores the output written to OutputPath in the cache
+  void CacheOutput(const std::string& output_path,
+                   const std::string& stage,
+                   const StageKey& key,
+                   const std::string& extension) const {
+    if (!cache.Enabled()) {
+      return;
+    }
+    if (!cache.Store(stage, key, extension, output_path)) {
+      LOG(WARNING) << config.name << ": could not cache " << output_path;
+    }
+    if (output_path == ScratchPath(stage, key, extension)) {
+      std::remove(output_path.c_str());
+    }
+  }
+
+  //! Copies a cache entry to its checkpoint
+  void RestoreCheckpoint(const std::string& checkpoint_name,
+                         const std::string& stage,
+                         const StageKey& key,
+                         const std::string& extension) const {
+    if (!config.checkpoint_dir.empty()) {
+      cache.Restore(stage, key, extension, CheckpointPath(checkpoint_name));
+    }
+    LOG(INFO) << config.name << ": " << stage << " restored from the cache.";
+  }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+bool InitializeBoard(BoardExtractor& board_extractor) {
+  if (FLAGS_verbose) {
+    board_extractor.SetVerbosePlot();
+  }
+  const BoardType board_type = StringToBoardType(FLAGS_board_type);
+  if (board_type == BoardType::CHARUCO) {
+    const float aruco_marker_length = FLAGS_checker_square_length_m / 2.0f;
+    return board_extractor.InitializeCharucoBoard(FLAGS_aruco_detector_params,
+                                                  aruco_marker_length,
+                                                  FLAGS_checker_square_length_m,
+                                                  FLAGS_num_squares_x,
+                                                  FLAGS_num_squares_y,
+                                                  FLAGS_aruco_dict);
+  } else if (board_type == BoardType::RADON) {
+    return board_extractor.InitializeRadonBoard(FLAGS_checker_square_length_m,
+                                                FLAGS_num_squares_x,
+                                                FLAGS_num_squares_y);
+  }
+  return board_extractor.InitializeAprilBoard(FLAGS_checker_square_length_m,
+                                              0.3,
+                                              FLAGS_num_squares_x,
+                                              FLAGS_num_squares_y);
+}
+
+//! Initialized board extractors, so the detector parameters are read and the
+//! board is built once per process. Their detector pools stay allocated too.
+class BoardExtractorPool {
+ public:
+  //! nullptr if the board could not be initialized
+  std::unique_ptr<BoardExtractor> Acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        std::unique_ptr<BoardExtractor> extractor = std::move(free_.back());
+        free_.pop_back();
+        return extractor;
+      }
+    }
+    std::unique_ptr<BoardExtractor> extractor(new BoardExtractor);
+    if (!InitializeBoard(*extractor)) {
+      return nullptr;
+    }
+    return extractor;
+  }
+
+  void Release(std::unique_ptr<BoardExtractor> extractor) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(std::move(extractor));
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<BoardExtractor>> free_;
+};
+
+BoardExtractorPool& WarmBoardExtractors() {
+  static BoardExtractorPool pool;
+  return pool;
+}
+
+bool LoadInputs(DeviceCalibration& device) {
+  const DeviceConfig& config = device.config;
+  if (config.spline_error_weighting_json != "" &&
+      !ReadSplineErrorWeighting(config.spline_error_weighting_json,
+                                device.weight_data)) {
+    LOG(ERROR) << "Could not open " << config.spline_error_weighting_json;
+    return false;
+  }
+  if (config.static_imu_telemetry_json == "" &&
+      !ReadIMUIntrinsics(config.imu_intrinsics,
+                         config.imu_bias_json,
+                         device.acc_intr,
+                         device.gyr_intr)) {
+    LOG(ERROR) << "Could not open " << config.imu_intrinsics;
+    return false;
+  }
+  Eigen::Vector3d accl_bias;
+  if (config.imu_bias_json != "" &&
+      !ReadIMUBias(config.imu_bias_json, device.gyro_bias, accl_bias)) {
+    LOG(ERROR) << "Could not open " << config.imu_bias_json;
+    return false;
+  }
+  if (!ReadTelemetry(config.telemetry_json, device.telemetry_data)) {
+    LOG(ERROR) << "Could not read: " << config.telemetry_json;
+    return false;
+  }
+  if (config.spline_error_weighting_json == "") {
+    SplineErrorWeightingOptions sew_options;
+    sew_options.quality_so3 = FLAGS_sew_quality_so3;
+    sew_options.quality_r3 = FLAGS_sew_quality_r3;
+    if (!ComputeSplineErrorWeighting(
+            device.telemetry_data, sew_options, device.weight_data)) {
+      LOG(ERROR) << config.name
+                 << ": Could not compute the spline error weighting.";
+      return false;
+    }
+  }
+  return true;
+}
+
+//! Key of the corners of one video
+StageKey CornerExtractionKey(const std::string& video_path) {
+  StageKey key;
+  key.AddFile(video_path)
+      .Add(FLAGS_board_type)
+      .AddFile(FLAGS_aruco_detector_params)
+      .Add(FLAGS_checker_square_length_m)
+      .Add(FLAGS_num_squares_x)
+      .Add(FLAGS_num_squares_y)
+      .Add(FLAGS_aruco_dict)
+      .Add(FLAGS_downsample_factor);
+  return key;
+}
+
+bool ExtractCorners(DeviceCalibration& device, const int num_threads) {
+  device.cam_scene_key = CornerExtractionKey(device.config.cam_calib_video);
+  device.cam_imu_scene_key = CornerExtractionKey(device.config.cam_imu_video);
+  const std::string videos[2] = {device.config.cam_calib_video,
+                                 device.config.cam_imu_video};
+  const std::string checkpoints[2] = {"cam_corners.uson",
+                                      "cam_imu_corners.uson"};
+  const StageKey* keys[2] = {&device.cam_scene_key, &device.cam_imu_scene_key};
+  json* scenes[2] = {&device.cam_scene_json, &device.cam_imu_scene_json};
+
+  // both videos share the detection threads
+  SceneMemoryWriter scene_writers[2];
+  std::string output_paths[2];
+  bool extracted[2] = {false, false};
+  std::vector<std::string> input_paths;
+  std::vector<SceneWriter*> scene_writer_ptrs;
+  for (int i = 0; i < 2; ++i) {
+    const std::string entry_path =
+        device.cache.EntryPath("corners", *keys[i], ".uson");
+    if (device.cache.Contains("corners", *keys[i], ".uson") &&
+        read_scene_bson(entry_path, *scenes[i])) {
+      device.RestoreCheckpoint(checkpoints[i], "corners", *keys[i], ".uson");
+      continue;
+    }
+    // extracted by the pose estimation, see ExtractCornersAndPoses
+    if (i == 1 && FLAGS_streaming_pose_estimation) {
+      continue;
+    }
+    output_paths[i] =
+        device.OutputPath(checkpoints[i], "corners", *keys[i], ".uson");
+    if (!scene_writers[i].Open(output_paths[i])) {
+      return false;
+    }
+    input_paths.push_back(videos[i]);
+    scene_writer_ptrs.push_back(&scene_writers[i]);
+    extracted[i] = true;
+  }
+  if (input_paths.empty()) {
+    return true;
+  }
+
+  std::unique_ptr<BoardExtractor> board_extractor =
+      WarmBoardExtractors().Acquire();
+  if (!board_extractor) {
+    LOG(ERROR) << "Could not initialize the board.";
+    return false;
+  }
+  board_extractor->SetNumThreads(num_threads);
+  const bool extraction_success = board_extractor->ExtractBatch(
+      input_paths, FLAGS_downsample_factor, scene_writer_ptrs);
+  WarmBoardExtractors().Release(std::move(board_extractor));
+  if (!extraction_success) {
+    LOG(ERROR) << device.config.name << ": corner extraction failed.";
+    return false;
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (extracted[i]) {
+      *scenes[i] = scene_writers[i].Scene();
+      device.CacheOutput(output_paths[i], "corners", *keys[i], ".uson");
+    }
+  }
+  return true;
+}
+
+//! Reads a cached camera calibration
+bool ReadCachedCameraCalibration(const std::string& path,
+                                 DeviceCalibration& device) {
+  if (!read_camera_calibration(path, device.camera, device.fps)) {
+    return false;
+  }
+  std::ifstream file(path);
+  json calib_json;
+  file >> calib_json;
+  device.camera_reproj_error = calib_json["final_reproj_error"];
+  return true;
+}
+
+bool CalibrateCamera(DeviceCalibration& device, const int num_threads) {
+  device.camera_key.Add(device.cam_scene_key)
+      .Add(FLAGS_camera_model_to_calibrate)
+      .Add(FLAGS_grid_size)
+      .Add(FLAGS_optimize_board_points);
+  const StageKey& key = device.camera_key;
+  if (device.cache.Contains("camera_calibration", key, ".json") &&
+      ReadCachedCameraCalibration(
+          device.cache.EntryPath("camera_calibration", key, ".json"),
+          device)) {
+    device.RestoreCheckpoint(
+        "cam_calib.json", "camera_calibration", key, ".json");
+    return true;
+  }
+
+  CameraCalibrator camera_calibrator(FLAGS_camera_model_to_calibrate,
+                                     FLAGS_optimize_board_points);
+  camera_calibrator.SetGridSize(FLAGS_grid_size);
+  camera_calibrator.SetNumThreads(num_threads);
+  camera_calibrator.SetBundleAdjustmentThreads(num_threads);
+  if (FLAGS_verbose) {
+    camera_calibrator.SetVerbose();
+  }
+  if (!camera_calibrator.CalibrateCameraFromJson(
+          device.cam_scene_json, device.CheckpointPath("cam_calib")) ||
+      !camera_calibrator.GetCalibratedCamera(device.camera)) {
+    LOG(ERROR) << device.config.name << ": camera calibration failed.";
+    return false;
+  }
+  device.camera_reproj_error = camera_calibrator.GetReprojectionError();
+  device.fps = device.cam_scene_json["camera_fps"];
+
+  // the calibrator already wrote the checkpoint
+  const std::string output_path =
+      device.OutputPath("cam_calib.json", "camera_calibration", key, ".json");
+  if (device.config.checkpoint_dir.empty() && !output_path.empty()) {
+    write_camera_calibration(output_path,
+                             device.camera,
+                             device.fps,
+                             camera_calibrator.GetNumCalibrationViews(),
+                             device.camera_reproj_error);
+  }
+  device.CacheOutput(output_path, "camera_calibration", key, ".json");
+  return true;
+}
+
+//! Extracts the corners of the IMU camera video into a streaming pose
+//! estimation, see --streaming_pose_estimation
+bool ExtractCornersAndPoses(DeviceCalibration& device,
+                            PoseEstimator& pose_estimator,
+                            const int num_threads) {
+  const StageKey& key = device.cam_imu_scene_key;
+  const std::string output_path =
+      device.OutputPath("cam_imu_corners.uson", "corners", key, ".uson");
+  SceneMemoryWriter scene_writer;
+  if (!scene_writer.Open(output_path)) {
+    return false;
+  }
+  std::unique_ptr<BoardExtractor> board_extractor =
+      WarmBoardExtractors().Acquire();
+  if (!board_extractor) {
+    LOG(ERROR) << "Could not initialize the board.";
+    return false;
+  }
+  json board_json;
+  board_extractor->GetSceneHeader(device.fps, board_json);
+  pose_estimator.StartStreaming(board_json, device.camera);
+  PoseStreamSceneWriter pose_writer(&pose_estimator, &scene_writer);
+  board_extractor->SetNumThreads(num_threads);
+  const bool extraction_success = board_extractor->ExtractBatch(
+      {device.config.cam_imu_video}, FLAGS_downsample_factor, {&pose_writer});
+  WarmBoardExtractors().Release(std::move(board_extractor));
+  if (!extraction_success) {
+    LOG(ERROR) << device.config.name << ": corner extraction failed.";
+    return false;
+  }
+  device.cam_imu_scene_json = scene_writer.Scene();
+  device.CacheOutput(output_path, "corners", key, ".uson");
+  return true;
+}
+
+bool EstimatePoses(DeviceCalibration& device, const int num_threads) {
+  device.pose_key.Add(device.camera_key)
+      .Add(device.cam_imu_scene_key)
+      .Add(FLAGS_optimize_board_points);
+  const StageKey& key = device.pose_key;
+  // streamed corners are only extracted together with the poses
+  if (!device.cam_imu_scene_json.is_null() &&
+      device.cache.Contains("pose_estimation", key, ".calibdata") &&
+      theia::ReadReconstruction(
+          device.cache.EntryPath("pose_estimation", key, ".calibdata"),
+          &device.pose_dataset)) {
+    device.RestoreCheckpoint(
+        "pose_calib.calibdata", "pose_estimation", key, ".calibdata");
+    return true;
+  }
+
+  PoseEstimator pose_estimator;
+  pose_estimator.SetNumThreads(num_threads);
+  if (device.cam_imu_scene_json.is_null()) {
+    // the corners were not restored from the cache, see ExtractCorners
+    if (!ExtractCornersAndPoses(device, pose_estimator, num_threads)) {
+      LOG(ERROR) << device.config.name << ": pose estimation failed.";
+      return false;
+    }
+  } else if (!pose_estimator.EstimatePosesFromJson(device.cam_imu_scene_json,
+                                                   device.camera)) {
+    LOG(ERROR) << device.config.name << ": pose estimation failed.";
+    return false;
+  }
+  if (FLAGS_optimize_board_points) {
+    pose_estimator.OptimizeBoardPoints();
+    pose_estimator.OptimizeAllPoses();
+  }
+  pose_estimator.FilterBadPoses();
+  pose_estimator.GetPoseDataset(device.pose_dataset);
+  const std::string output_path = device.OutputPath(
+      "pose_calib.calibdata", "pose_estimation", key, ".calibdata");
+  if (!output_path.empty()) {
+    theia::WriteReconstruction(device.pose_dataset, output_path);
+  }
+  device.CacheOutput(output_path, "pose_estimation", key, ".calibdata");
+  return true;
+}
+
+bool EstimateImuToCameraRotation(DeviceCalibration& device) {
+  device.imu_rotation_key.Add(device.pose_key)
+      .AddFile(device.config.telemetry_json)
+      .AddFile(device.config.imu_bias_json);
+  const StageKey& key = device.imu_rotation_key;
+  if (device.cache.Contains("imu_to_camera_rotation", key, ".json") &&
+      ReadIMU2CamInit(
+          device.cache.EntryPath("imu_to_camera_rotation", key, ".json"),
+          device.imu2cam,
+          device.time_offset_imu_to_cam)) {
+    device.RestoreCheckpoint(
+        "imu_to_cam_calibration.json", "imu_to_camera_rotation", key, ".json");
+    return true;
+  }
+
+  ImuToCameraRotationEstimator rotation_estimator;
+  if (device.config.imu_bias_json == "") {
+    rotation_estimator.EnableGyroBiasEstimation();
+  }
+  const double imu_dt_s = rotation_estimator.SetMeasurementsFromPoseDataset(
+      device.pose_dataset, device.telemetry_data, device.gyro_bias);
+  Eigen::Matrix3d R_gyro_to_camera;
+  vec3_vector ang_vel, imu_vel;
+  if (!rotation_estimator.EstimateCameraImuRotation(
+          imu_dt_s,
+          R_gyro_to_camera,
+          device.time_offset_imu_to_cam,
+          device.gyro_bias,
+          imu_vel,
+          ang_vel)) {
+    LOG(ERROR) << device.config.name
+               << ": IMU to camera rotation estimation failed.";
+    return false;
+  }
+  device.imu2cam = Eigen::Quaterniond(R_gyro_to_camera);
+  const std::string output_path = device.OutputPath(
+      "imu_to_cam_calibration.json", "imu_to_camera_rotation", key, ".json");
+  if (!output_path.empty()) {
+    const Eigen::Quaterniond& q = device.imu2cam;
+    const Eigen::Vector3d& bias = device.gyro_bias;
+    json imu2cam_json;
+    imu2cam_json["gyro_bias"] = {bias[0], bias[1], bias[2]};
+    imu2cam_json["gyro_to_camera_rotation"]["w"] = q.w();
+    imu2cam_json["gyro_to_camera_rotation"]["x"] = q.x();
+    imu2cam_json["gyro_to_camera_rotation"]["y"] = q.y();
+    imu2cam_json["gyro_to_camera_rotation"]["z"] = q.z();
+    imu2cam_json["time_offset_gyro_to_cam"] = device.time_offset_imu_to_cam;
+    std::ofstream imu2cam_file(output_path);
+    imu2cam_file << std::setw(4) << imu2cam_json << std::endl;
+  }
+  device.CacheOutput(output_path, "imu_to_camera_rotation", key, ".json");
+  return true;
+}
+
+bool CalibrateStaticImu(DeviceCalibration& device, const int num_threads) {
+  CameraTelemetryData telemetry_data;
+  if (!ReadTelemetry(device.config.static_imu_telemetry_json,
+                     telemetry_data)) {
+    LOG(ERROR) << "Could not read: " << device.config.static_imu_telemetry_json;
+    return false;
+  }
+  StaticImuCalibrator multi_pose_calibrator;
+  multi_pose_calibrator.SetGravityMagnitude(FLAGS_gravity_const);
+  multi_pose_calibrator.SetInitStaticIntervalDuration(
+      FLAGS_initial_static_interval_s);
+  multi_pose_calibrator.EnableVerboseOutput(FLAGS_verbose);
+  multi_pose_calibrator.SetNumThreads(num_threads);
+  multi_pose_calibrator.CalibrateAccGyro(telemetry_data.accelerometer,
+                                         telemetry_data.gyroscope);
+  device.acc_intr = multi_pose_calibrator.getAccCalib();
+  device.gyr_intr = multi_pose_calibrator.getGyroCalib();
+  // the bias recording is closer in time to the IMU camera recording
+  Eigen::Vector3d gyro_bias, accl_bias;
+  if (device.config.imu_bias_json != "" &&
+      ReadIMUBias(device.config.imu_bias_json, gyro_bias, accl_bias)) {
+    device.acc_intr.SetBias(accl_bias);
+    device.gyr_intr.SetBias(gyro_bias);
+  }
+  return true;
+}
+
+bool FitAllanVariance(DeviceCalibration& device, const int num_threads) {
+  CameraTelemetryData telemetry_data;
+  if (!ReadTelemetry(device.config.allan_telemetry_json, telemetry_data)) {
+    LOG(ERROR) << "Could not read: " << device.config.allan_telemetry_json;
+    return false;
+  }
+  AllanVarianceFitter fitter(telemetry_data, 10000, false, num_threads);
+  if (!fitter.RunFit()) {
+    return false;
+  }
+  device.accl_bias_instability_time_s = fitter.GetAcclBiasInstabilityTime();
+  device.gyro_bias_instability_time_s = fitter.GetGyroBiasInstabilityTime();
+  device.allan_fitted = true;
+  return true;
+}
+
+//! Adaptive bias knot spacing needs the Allan variance of the device
+bool UseAdaptiveBiasKnotSpacing(const DeviceConfig& config) {
+  return FLAGS_adaptive_bias_knot_spacing &&
+         !config.allan_telemetry_json.empty();
+}
+
+//! Prints the result json of the IMU to camera calibration. Devices finish
+//! concurrently, so the result is printed at once.
+void PrintImuToCameraResult(const std::string& device_name,
+                            const json& result_json) {
+  const json& q = result_json["q_i_c"];
+  const json& t = result_json["t_i_c"];
+  const json& g = result_json["gravity"];
+  std::stringstream result;
+  result << device_name << ":\n"
+         << "Camera reprojection error " << result_json["camera_reproj_error"]
+         << "px\n"
+         << "Mean reprojection error " << result_json["final_reproj_error"]
+         << "px\n"
+         << "Mean reprojection error after line delay optim "
+         << result_json["line_delay_reproj_error"] << "px\n"
+         << "g: " << g["x"] << " " << g["y"] << " " << g["z"] << "\n"
+         << "T_i_c qw,qx,qy,qz: " << q["w"] << " " << q["x"] << " " << q["y"]
+         << " " << q["z"] << "\n"
+         << "T_i_c t: " << t["x"] << " " << t["y"] << " " << t["z"] << "\n"
+         << "Calibrated line delay [us]: " << result_json["calib_line_delay_us"]
+         << "\n";
+  std::cout << result.str();
+}
+
+bool CalibrateImuToCamera(DeviceCalibration& device, const int num_threads) {
+  const DeviceConfig& config = device.config;
+  StageKey key;
+  key.Add(device.imu_rotation_key)
+      .AddFile(config.spline_error_weighting_json)
+      .Add(FLAGS_sew_quality_so3)
+      .Add(FLAGS_sew_quality_r3)
+      .AddFile(config.imu_bias_json)
+      .Add(FLAGS_global_shutter)
+      .Add(FLAGS_calibrate_cam_line_delay)
+      .Add(FLAGS_reestimate_biases)
+      .Add(FLAGS_gravity_const)
+      .Add(FLAGS_known_grav_dir_axis);
+  if (UseAdaptiveBiasKnotSpacing(config)) {
+    key.AddFile(config.allan_telemetry_json);
+  } else {
+    key.Add(FLAGS_bias_knot_spacing_s);
+  }
+  if (config.static_imu_telemetry_json.empty()) {
+    key.AddFile(config.imu_intrinsics);
+  } else {
+    key.AddFile(config.static_imu_telemetry_json)
+        .Add(FLAGS_initial_static_interval_s);
+  }
+  const std::string entry_path =
+      device.cache.EntryPath("imu_to_camera_calibration", key, ".json");
+  if (device.cache.Contains("imu_to_camera_calibration", key, ".json")) {
+    std::ifstream entry_file(entry_path);
+    json result_json;
+    entry_file >> result_json;
+    PrintImuToCameraResult(config.name, result_json);
+    if (!config.result_output_json.empty()) {
+      device.cache.Restore("imu_to_camera_calibration",
+                           key,
+                           ".json",
+                           config.result_output_json);
+    }
+    LOG(INFO) << config.name
+              << ": imu_to_camera_calibration restored from the cache.";
+    return true;
+  }
+
+  double t_offset_cam_s = 0.0;
+  if (device.telemetry_data.img_timestamps_s.size() > 0) {
+    t_offset_cam_s = device.telemetry_data.img_timestamps_s[0];
+  }
+  theia::Reconstruction recon_calib_dataset;
+  BuildSplineCalibrationDataset(device.pose_dataset,
+                                device.cam_imu_scene_json,
+                                device.camera,
+                                t_offset_cam_s,
+                                recon_calib_dataset);
+  const Sophus::SE3<double> T_i_c_init(device.imu2cam.conjugate(),
+                                       Eigen::Vector3d(0, 0, 0));
+  double init_line_delay_s = 1. / device.fps / device.camera.ImageHeight();
+  if (FLAGS_global_shutter) {
+    init_line_delay_s = 0.0;
+  }
+
+  ImuCameraCalibrator imu_cam_calibrator;
+  imu_cam_calibrator.SetNumThreads(num_threads);
+  if (UseAdaptiveBiasKnotSpacing(config) && device.allan_fitted) {
+    imu_cam_calibrator.SetBiasKnotSpacingFromAllanVariance(
+        device.accl_bias_instability_time_s,
+        device.gyro_bias_instability_time_s);
+  } else {
+    imu_cam_calibrator.SetBiasKnotSpacing(FLAGS_bias_knot_spacing_s,
+                                          FLAGS_bias_knot_spacing_s);
+  }
+  imu_cam_calibrator.BatchInitSpline(recon_calib_dataset,
+                                     T_i_c_init,
+                                     device.weight_data,
+                                     device.time_offset_imu_to_cam,
+                                     device.telemetry_data,
+                                     init_line_delay_s,
+                                     device.acc_intr,
+                                     device.gyr_intr);
+  // last user of the telemetry, the calibrator keeps its own copy of the
+  // samples inside the spline
+  device.telemetry_data = CameraTelemetryData();
+  const int grav_dir_axis = GravDirStringToInt(FLAGS_known_grav_dir_axis);
+  int flags = SplineOptimFlags::SPLINE | SplineOptimFlags::T_I_C;
+  if (FLAGS_reestimate_biases) {
+    flags |= SplineOptimFlags::IMU_BIASES;
+  }
+  if (grav_dir_axis != -1) {
+    Eigen::Vector3d grav_dir(0, 0, 0);
+    grav_dir[grav_dir_axis] = FLAGS_gravity_const;
+    imu_cam_calibrator.SetKnownGravityDir(grav_dir);
+  } else {
+    flags |= SplineOptimFlags::GRAVITY_DIR;
+  }
+  SplineSolverOptions solver_options;
+  solver_options.num_threads = num_threads;
+  const double reproj_error =
+      imu_cam_calibrator.Optimize(50, flags, solver_options);
+  double reproj_error_after_ld = reproj_error;
+  if (FLAGS_calibrate_cam_line_delay && !FLAGS_global_shutter) {
+    reproj_error_after_ld = imu_cam_calibrator.Optimize(
+        10, SplineOptimFlags::CAM_LINE_DELAY, solver_options);
+  }
+  if (!device.config.checkpoint_dir.empty()) {
+    SplineSnapshot snapshot;
+    imu_cam_calibrator.GetSnapshot(snapshot);
+    if (!WriteSplineSnapshot(device.CheckpointPath("spline.snapshot"),
+                             snapshot)) {
+      LOG(ERROR) << "Could not write the spline snapshot.";
+    }
+  }
+
+  const Eigen::Quaterniond q_i_c =
+      imu_cam_calibrator.trajectory_.GetT_i_c().so3().unit_quaternion();
+  const Eigen::Vector3d t_i_c =
+      imu_cam_calibrator.trajectory_.GetT_i_c().translation();
+  const Eigen::Vector3d gravity = imu_cam_calibrator.trajectory_.GetGravity();
+  json result_json;
+  result_json["camera_reproj_error"] = device.camera_reproj_error;
+  result_json["q_i_c"]["w"] = q_i_c.w();
+  result_json["q_i_c"]["x"] = q_i_c.x();
+  result_json["q_i_c"]["y"] = q_i_c.y();
+  result_json["q_i_c"]["z"] = q_i_c.z();
+  result_json["t_i_c"]["x"] = t_i_c[0];
+  result_json["t_i_c"]["y"] = t_i_c[1];
+  result_json["t_i_c"]["z"] = t_i_c[2];
+  result_json["gravity"]["x"] = gravity[0];
+  result_json["gravity"]["y"] = gravity[1];
+  result_json["gravity"]["z"] = gravity[2];
+  result_json["final_reproj_error"] = reproj_error;
+  result_json["line_delay_reproj_error"] = reproj_error_after_ld;
+  result_json["r3_dt"] = device.weight_data.dt_r3;
+  result_json["so3_dt"] = device.weight_data.dt_so3;
+  result_json["init_line_delay_us"] = init_line_delay_s * S_TO_US;
+  result_json["calib_line_delay_us"] =
+      imu_cam_calibrator.GetCalibratedRSLineDelay() * S_TO_US;
+  result_json["time_offset_imu_to_cam_s"] = device.time_offset_imu_to_cam;
+  PrintImuToCameraResult(config.name, result_json);
+
+  std::string output_path = config.result_output_json;
+  if (output_path.empty() && device.cache.Enabled()) {
+    output_path = device.ScratchPath("imu_to_camera_calibration", key, ".json");
+  }
+  if (!output_path.empty()) {
+    std::ofstream result_file(output_path);
+    result_file << std::setw(4) << result_json << std::endl;
+  }
+  device.CacheOutput(output_path, "imu_to_camera_calibration", key, ".json");
+  return true;
+}
+
+//! Adds the stage graph of one device to the scheduler
+void AddDeviceJobs(DeviceCalibration& device,
+                   const int job_threads,
+                   JobScheduler& scheduler) {
+  DeviceCalibration* d = &device;
+  const std::string& name = device.config.name;
+  const int inputs = scheduler.AddJob(
+      name + "/load_inputs", 1, [d](int) { return LoadInputs(*d); });
+  const int extraction =
+      scheduler.AddJob(name + "/corner_extraction", job_threads, [d](int n) {
+        return ExtractCorners(*d, n);
+      });
+  const int camera_calibration = scheduler.AddJob(
+      name + "/camera_calibration",
+      job_threads,
+      [d](int n) { return CalibrateCamera(*d, n); },
+      {extraction});
+  const int pose_estimation = scheduler.AddJob(
+      name + "/pose_estimation",
+      job_threads,
+      [d](int n) { return EstimatePoses(*d, n); },
+      {camera_calibration});
+  const int imu_rotation = scheduler.AddJob(
+      name + "/imu_to_camera_rotation",
+      1,
+      [d](int) { return EstimateImuToCameraRotation(*d); },
+      {pose_estimation, inputs});
+  std::vector<int> spline_dependencies = {imu_rotation};
+  if (!device.config.static_imu_telemetry_json.empty()) {
+    spline_dependencies.push_back(scheduler.AddJob(
+        name + "/static_imu_calibration",
+        job_threads,
+        [d](int n) { return CalibrateStaticImu(*d, n); },
+        {inputs}));
+  }
+  if (!device.config.allan_telemetry_json.empty()) {
+    const int allan_variance =
+        scheduler.AddJob(name + "/allan_variance", job_threads, [d](int n) {
+          return FitAllanVariance(*d, n);
+        });
+    if (UseAdaptiveBiasKnotSpacing(device.config)) {
+      spline_dependencies.push_back(allan_variance);
+    }
+  }
+  scheduler.AddJob(
+      name + "/imu_to_camera_calibration",
+      job_threads,
+      [d](int n) { return CalibrateImuToCamera(*d, n); },
+      spline_dependencies);
+}
+
+//! Reads the devices of a batch manifest
+void ReadManifestDevices(
+    const json& manifest,
+    std::vector<std::unique_ptr<DeviceCalibration>>& devices) {
+  if (!manifest.contains("devices")) {
+    return;
+  }
+  for (const auto& entry : manifest["devices"]) {
+    devices.emplace_back(new DeviceCalibration);
+    DeviceConfig& config = devices.back()->config;
+    config.name =
+        entry.value("name", "device_" + std::to_string(devices.size() - 1));
+    config.cam_calib_video = entry.value("cam_calib_video", "");
+    config.cam_imu_video = entry.value("cam_imu_video", "");
+    config.telemetry_json = entry.value("telemetry_json", "");
+    config.imu_bias_json = entry.value("imu_bias_json", "");
+    config.imu_intrinsics = entry.value("imu_intrinsics", "");
+    config.spline_error_weighting_json =
+        entry.value("spline_error_weighting_json", "");
+    config.static_imu_telemetry_json =
+        entry.value("static_imu_telemetry_json", "");
+    config.allan_telemetry_json = entry.value("allan_telemetry_json", "");
+    config.checkpoint_dir = entry.value("checkpoint_dir", "");
+    config.cache_dir = entry.value("cache_dir", FLAGS_cache_dir);
+    config.result_output_json = entry.value("result_output_json", "");
+  }
+}
+
+//! Runs the stages of all devices and prints their times. stage_results
+//! gets the name, time and success of every stage
+bool CalibrateDevices(
+    std::vector<std::unique_ptr<DeviceCalibration>>& devices,
+    json& stage_results) {
+  for (auto& device : devices) {
+    device->cache = StageCache(device->config.cache_dir);
+  }
+
+  const int num_threads = std::max(1, FLAGS_num_threads);
+  const int nr_devices = static_cast<int>(devices.size());
+  const int job_threads = FLAGS_job_threads > 0
+                              ? FLAGS_job_threads
+                              : std::max(1, num_threads / nr_devices);
+  JobScheduler scheduler;
+  for (auto& device : devices) {
+    AddDeviceJobs(*device, job_threads, scheduler);
+  }
+  const bool success = scheduler.Run(num_threads);
+
+  std::cout << "Stage times:\n";
+  stage_results = json::array();
+  for (size_t j = 0; j < scheduler.NumJobs(); ++j) {
+    std::cout << std::left << std::setw(48) << scheduler.JobName(j)
+              << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << scheduler.JobTime(j) << "s"
+              << (scheduler.Succeeded(j) ? "" : "  failed") << "\n";
+    json stage;
+    stage["name"] = scheduler.JobName(j);
+    stage["time_s"] = scheduler.JobTime(j);
+    stage["succeeded"] = scheduler.Succeeded(j);
+    stage_results.push_back(stage);
+  }
+  return success;
+}
+
+//! Reads one line or up to the end of the stream of a connection
+bool ReadRequest(const int connection, std::string& request) {
+  request.clear();
+  char buffer[4096];
+  while (true) {
+    const ssize_t nr_read = read(connection, buffer, sizeof(buffer));
+    if (nr_read < 0) {
+      return false;
+    }
+    if (nr_read == 0) {
+      return !request.empty();
+    }
+    request.append(buffer, nr_read);
+    const size_t newline = request.find('\n');
+    if (newline != std::string::npos) {
+      request.resize(newline);
+      return true;
+    }
+  }
+}
+
+void SendReply(const int connection, const json& reply) {
+  const std::string message = reply.dump() + "\n";
+  size_t nr_sent = 0;
+  while (nr_sent < message.size()) {
+    // a client that went away must not kill the service with SIGPIPE
+    const ssize_t n = send(connection,
+                           message.data() + nr_sent,
+                           message.size() - nr_sent,
+                           MSG_NOSIGNAL);
+    if (n <= 0) {
+      LOG(WARNING) << "Could not send the reply.";
+      return;
+    }
+    nr_sent += n;
+  }
+}
+
+//! Calibrates the manifests sent to socket_path one after the other until a
+//! shutdown command arrives
+int Serve(const std::string& socket_path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    LOG(ERROR) << "Socket path too long: " << socket_path;
+    return -1;
+  }
+  std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+
+  const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0) {
+    LOG(ERROR) << "Could not create the socket.";
+    return -1;
+  }
+  unlink(socket_path.c_str());
+  const sockaddr* server_address = reinterpret_cast<sockaddr*>(&address);
+  if (bind(server, server_address, sizeof(address)) < 0 ||
+      listen(server, 16) < 0) {
+    LOG(ERROR) << "Could not listen on " << socket_path;
+    close(server);
+    return -1;
+  }
+  LOG(INFO) << "Calibration service listening on " << socket_path;
+
+  bool shutdown = false;
+  while (!shutdown) {
+    const int connection = accept(server, nullptr, nullptr);
+    if (connection < 0) {
+      continue;
+    }
+    std::string request;
+    json reply;
+    if (!ReadRequest(connection, request)) {
+      close(connection);
+      continue;
+    }
+    const json manifest = json::parse(request, nullptr, false);
+    if (manifest.is_discarded() || !manifest.is_object()) {
+      reply["success"] = false;
+      reply["error"] = "request is not a json object";
+    } else if (manifest.value("command", "") == "shutdown") {
+      reply["success"] = true;
+      shutdown = true;
+    } else {
+      std::vector<std::unique_ptr<DeviceCalibration>> devices;
+      ReadManifestDevices(manifest, devices);
+      if (devices.empty()) {
+        reply["success"] = false;
+        reply["error"] = "no device to calibrate";
+      } else {
+        json stages;
+        reply["success"] = CalibrateDevices(devices, stages);
+        reply["stages"] = stages;
+      }
+    }
+    SendReply(connection, reply);
+    close(connection);
+  }
+  close(server);
+  unlink(socket_path.c_str());
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  if (!utils::ConfigureExecutionContext(
+          FLAGS_num_threads,
+          FLAGS_cpu_affinity,
+          FLAGS_numa_node,
+          FLAGS_deterministic)) {
+    LOG(ERROR) << "Could not configure the execution context.";
+    return -1;
+  }
+  FLAGS_num_threads = utils::ExecutionContext::NumThreads();
+  Profiler::Instance().SetEnabled(!FLAGS_profile_report_json.empty());
+
+  if (!FLAGS_serve_socket.empty()) {
+    const int status = Serve(FLAGS_serve_socket);
+    if (!FLAGS_profile_report_json.empty()) {
+      Profiler::Instance().WriteReport(FLAGS_profile_report_json);
+    }
+    return status;
+  }
+
+  std::vector<std::unique_ptr<DeviceCalibration>> devices;
+  if (FLAGS_batch_manifest_json.empty()) {
+    devices.emplace_back(new DeviceCalibration);
+    DeviceConfig& config = devices.back()->config;
+    config.name = "device";
+    config.cam_calib_video = FLAGS_cam_calib_video;
+    config.cam_imu_video = FLAGS_cam_imu_video;
+    config.telemetry_json = FLAGS_telemetry_json;
+    config.imu_bias_json = FLAGS_imu_bias_json;
+    config.imu_intrinsics = FLAGS_imu_intrinsics;
+    config.spline_error_weighting_json = FLAGS_spline_error_weighting_json;
+    config.static_imu_telemetry_json = FLAGS_static_imu_telemetry_json;
+    config.allan_telemetry_json = FLAGS_allan_telemetry_json;
+    config.checkpoint_dir = FLAGS_checkpoint_dir;
+    config.cache_dir = FLAGS_cache_dir;
+    config.result_output_json = FLAGS_result_output_json;
+  } else {
+    std::ifstream manifest_file(FLAGS_batch_manifest_json);
+    CHECK(manifest_file.is_open())
+        << "Could not open " << FLAGS_batch_manifest_json;
+    json manifest;
+    manifest_file >> manifest;
+    ReadManifestDevices(manifest, devices);
+  }
+  CHECK(!devices.empty()) << "No device to calibrate.";
+
+  json stage_results;
+  const bool success = CalibrateDevices(devices, stage_results);
+  if (!FLAGS_profile_report_json.empty()) {
+    Profiler::Instance().WriteReport(FLAGS_profile_report_json);
+  }
+  return success ? 0 : 1;
+}
@@ -16,9 +16,12 @@
 #include <glog/logging.h>
 
 #include <fstream>
+#include <thread>
 
 #include "OpenCameraCalibrator/core/static_imu_calibrator.h"
 #include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/utils/execution_context.h"
+#include "OpenCameraCalibrator/utils/imu_timing.h"
 #include "OpenCameraCalibrator/utils/json.h"
 
 using namespace OpenICC;
@@ -34,21 +37,67 @@ DEFINE_double(initial_static_interval_s,
 
 DEFINE_string(output_calibration_path, "", "path to output calibration json");
 DEFINE_bool(verbose, false, "If more stuff should be printed");
+DEFINE_int32(num_threads,
+             0,
+             "Number of threads for the accelerometer threshold sweep. 0 uses "
+             "every CPU the process may run on.");
+DEFINE_string(cpu_affinity,
+              "",
+              "Optional. CPUs to pin the process to, e.g. \"0-3,8\". Keeps "
+              "concurrent calibrations on one machine from competing for the "
+              "same cores.");
+DEFINE_int32(numa_node,
+             -1,
+             "Optional. Pin the process to the CPUs of this NUMA node.");
+DEFINE_bool(deterministic,
+            false,
+            "Reproduce the results bit for bit, independent of num_threads. "
+            "The Ceres solves run on one thread.");
+DEFINE_bool(sanitize_imu_timestamps,
+            false,
+            "Drop repeated IMU timestamps, detect gaps and de-jitter the "
+            "timestamps before the calibration.");
+DEFINE_bool(resample_imu,
+            false,
+            "Sanitize the IMU timestamps and resample both streams onto a "
+            "uniform grid, so the gyroscope is integrated with a fixed "
+            "period.");
 
 int main(int argc, char* argv[]) {
   GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   ::google::InitGoogleLogging(argv[0]);
+  if (!utils::ConfigureExecutionContext(
+          FLAGS_num_threads,
+          FLAGS_cpu_affinity,
+          FLAGS_numa_node,
+          FLAGS_deterministic)) {
+    LOG(ERROR) << "Could not configure the execution context.";
+    return -1;
+  }
+  FLAGS_num_threads = utils::ExecutionContext::NumThreads();
 
   // read telemetry
   CameraTelemetryData telemetry_data;
-  CHECK(io::ReadTelemetryJSON(FLAGS_telemetry_json, telemetry_data))
+  CHECK(io::ReadTelemetry(FLAGS_telemetry_json, telemetry_data))
       << "Could not read: " << FLAGS_telemetry_json;
+  double imu_period_s = -1.0;
+  if (FLAGS_sanitize_imu_timestamps || FLAGS_resample_imu) {
+    utils::ImuTimingOptions timing_options;
+    timing_options.resample = FLAGS_resample_imu;
+    CHECK(utils::SanitizeImuTelemetry(
+        timing_options, telemetry_data, imu_period_s))
+        << "Could not sanitize the IMU timestamps.";
+  }
 
   StaticImuCalibrator multi_pose_calibrator;
   multi_pose_calibrator.SetGravityMagnitude(FLAGS_gravity_magnitude);
   multi_pose_calibrator.SetInitStaticIntervalDuration(
       FLAGS_initial_static_interval_s);
   multi_pose_calibrator.EnableVerboseOutput(FLAGS_verbose);
+  multi_pose_calibrator.SetNumThreads(FLAGS_num_threads);
+  if (FLAGS_resample_imu) {
+    multi_pose_calibrator.SetGyroDataPeriod(imu_period_s);
+  }
   multi_pose_calibrator.CalibrateAccGyro(telemetry_data.accelerometer,
                                          telemetry_data.gyroscope);
 
@@ -0,0 +1,92 @@
+// see https://github.com/gaowenliang/imu_utils
+
+#pragma once
+
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace allanvar {
+
+// Prefix sums S_i = sum_{j <= i} (v_j - ref) of a sample stream, centered
+// with the mean ref of the first block. They are stored blockwise: a double
+// base per block of kBlockSize samples and float offsets to it. The second
+// differences of the Allan variance are evaluated in float on the offsets,
+// plus the double difference of the bases once per chunk, and accumulated
+// in double, so they keep float precision on hour long logs.
+class BlockedPrefixSums {
+ public:
+  static const int kBlockSize = 1024;
+
+  void push(double value);
+
+  // flushes the samples buffered to find ref, call before evaluating
+  void finish();
+
+  int size() const { return numData + (int)m_head.size(); }
+
+  // sum of the pushed values
+  double valueSum() const { return m_sum + m_ref * numData; }
+
+  // sum over i < size() - 2 * factor of
+  // (S_{i + 2 factor} - 2 S_{i + factor} + S_i)^2
+  double secondDifferenceSquaredNorm(int factor) const;
+
+ private:
+  void append(double centered);
+
+  int numData = 0;
+  double m_ref = 0.0;
+  // centered sum of all appended values
+  double m_sum = 0.0;
+  std::vector<double> m_head;
+  std::vector<double> m_bases;
+  std::vector<float> m_offsets;
+};
+
+// Overlapping Allan variance of one sensor axis. The samples are integrated
+// into BlockedPrefixSums while they are pushed, calc() derives the
+// variance, deviation, cluster times and average statistics from them and
+// the getters only return the cached results.
+class AllanBase {
+ public:
+  AllanBase(std::string name, int maxCluster);
+
+  void calc();
+  // number of threads for the cluster factor loop
+  void setNumThreads(int numThreads) { m_numThreads = numThreads; }
+
+  const std::vector<double>& getVariance() const { return mVariance; }
+  const std::vector<double>& getDeviation() const { return mDeviation; }
+  const std::vector<double>& getTimes() const { return mTimes; }
+  const std::vector<int>& getFactors() const { return mFactors; }
+  double getAvgValue() const { return m_avgValue; }
+  double getAvgDt() const { return m_avgDt; }
+  double getFreq() const { return m_freq; }
+
+ protected:
+  // data in the unit of the derived class
+  void push(double data, double time);
+
+ private:
+  std::string m_name;
+  int numCluster;
+
+  BlockedPrefixSums m_sums;
+  double m_firstT = 0.0;
+  double m_lastT = 0.0;
+
+  double m_freq = 0.0;
+  double m_avgDt = 0.0;
+  double m_avgValue = 0.0;
+  std::vector<int> mFactors;
+  std::vector<double> mVariance;
+  std::vector<double> mDeviation;
+  std::vector<double> mTimes;
+  int m_numThreads = 1;
+};
+
+}  // namespace allanvar
+}  // namespace OpenICC
@@ -0,0 +1,76 @@
+// see https://github.com/gaowenliang/imu_utils
+
+#pragma once
+
+#include <ceres/ceres.h>
+#include <cmath>
+#include <vector>
+
+namespace OpenICC {
+namespace allanvar {
+
+// Result of FitAllanGyr / FitAllanAcc. Q, N, B, K and R are the coefficients
+// of sigma2(tau) = Q^2 / tau^2 + N^2 / tau + B^2 + K^2 tau + R^2 tau^2 in the
+// unit of the fitted Allan variance (degree/h for the gyroscope)
+struct AllanFitResult {
+  double Q = 0.0;
+  double N = 0.0;
+  double B = 0.0;
+  double K = 0.0;
+  double R = 0.0;
+  // minimum of the fitted Allan deviation [rad/s, m/s^2]
+  double biasInstability = 0.0;
+  // tau [s] at which the bias instability is reached
+  double biasInstabilityTime = 0.0;
+  // white noise density [rad/s/sqrt(Hz), m/s^2/sqrt(Hz)]
+  double whiteNoise = 0.0;
+};
+
+// log10 residual of the Allan variance model with analytic derivatives,
+// parameters are Q, N, B, K, R
+class AllanSigmaCostFunction : public ceres::SizedCostFunction<1, 5> {
+ public:
+  AllanSigmaCostFunction(const double sigma2, const double tau)
+      : log10Sigma2(std::log10(sigma2)), tau(tau) {}
+
+  bool Evaluate(double const* const* parameters,
+                double* residuals,
+                double** jacobians) const override {
+    const double* p = parameters[0];
+    // d sigma2 / d p_j = 2 p_j tau^(j - 2)
+    const double powers[5] = {1.0 / (tau * tau), 1.0 / tau, 1.0, tau,
+                              tau * tau};
+    double sigma2 = 0.0;
+    for (int j = 0; j < 5; ++j) sigma2 += p[j] * p[j] * powers[j];
+    residuals[0] = std::log10(sigma2) - log10Sigma2;
+    if (jacobians && jacobians[0]) {
+      const double scale = 2.0 / (sigma2 * std::log(10.0));
+      for (int j = 0; j < 5; ++j) jacobians[0][j] = scale * p[j] * powers[j];
+    }
+    return true;
+  }
+
+ private:
+  double log10Sigma2;
+  double tau;
+};
+
+// Solves for Q, N, B, K, R starting from param
+inline void solveAllanModel(const std::vector<double>& sigma2s,
+                            const std::vector<double>& taus,
+                            double* param) {
+  ceres::Problem problem;
+  for (size_t i = 0; i < sigma2s.size(); ++i) {
+    problem.AddResidualBlock(
+        new AllanSigmaCostFunction(sigma2s[i], taus[i]), nullptr, param);
+  }
+  ceres::Solver::Options options;
+  options.minimizer_progress_to_stdout = false;
+  options.logging_type = ceres::SILENT;
+  options.trust_region_strategy_type = ceres::DOGLEG;
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &problem, &summary);
+}
+
+}  // namespace allanvar
+}  // namespace OpenICC
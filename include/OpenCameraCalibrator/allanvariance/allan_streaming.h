@@ -0,0 +1,72 @@
+// see https://github.com/gaowenliang/imu_utils
+
+#pragma once
+
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace allanvar {
+
+// cluster factors as used by AllanAcc / AllanGyr for numData samples
+std::vector<int> allanFactors(int numData, int maxCluster);
+
+// Overlapping Allan variance that is accumulated while the samples are
+// pushed. Instead of the raw samples and the full theta array only a ring
+// buffer of the last 2 * max factor cumulative sums is kept. The cluster
+// factors are derived from the expected number of samples, so getVariance()
+// and getTimes() match AllanAcc / AllanGyr for the same data.
+// maxClusterTime limits the largest cluster (and the buffer size) if > 0.
+class AllanStreaming {
+ public:
+  AllanStreaming(std::string name,
+                 int expectedNumData,
+                 int maxCluster = 10000,
+                 double unitScale = 1.0,
+                 double maxClusterTime = -1.0,
+                 double expectedFreq = 0.0);
+
+  void push(double data, double time);
+  void calc();
+
+  const std::vector<double>& getVariance() const { return mVariance; }
+  const std::vector<double>& getDeviation() const { return mDeviation; }
+  const std::vector<double>& getTimes() const { return mTimes; }
+  const std::vector<int>& getFactors() const { return mFactors; }
+  double getAvgValue() const;
+  double getFreq() const;
+  int getNumData() const { return numData; }
+
+  // Writes the accumulated state in binary, so that a preempted run can
+  // continue with readState() and the remaining samples.
+  bool writeState(std::ostream& out) const;
+  // Restores a state of writeState(). False if it was written by an
+  // estimator with other cluster factors.
+  bool readState(std::istream& in);
+
+ private:
+  std::string m_name;
+  double m_unitScale;
+  double m_freq;
+
+  int numData;
+  double m_sum;
+  double m_sumDt;
+  double m_firstT;
+  double m_lastT;
+
+  std::vector<int> mFactors;
+  std::vector<double> mAccum;
+  // cumulative sums of the last m_ringSize samples
+  std::vector<double> m_ring;
+  int m_ringSize;
+
+  std::vector<double> mVariance;
+  std::vector<double> mDeviation;
+  std::vector<double> mTimes;
+};
+
+}  // namespace allanvar
+}  // namespace OpenICC
@@ -4,6 +4,7 @@
 #include "calib_helpers.h"
 #include "ceres_local_param.h"
 #include "common_types.h"
+#include <algorithm>
 #include <thread>
 
 #include "ceres_calib_split_residuals.h"
@@ -11,6 +12,9 @@
 
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
 
+#include "OpenCameraCalibrator/core/reprojection_error_report.h"
+#include "OpenCameraCalibrator/utils/execution_context.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
@@ -426,25 +430,21 @@ public:
                          "s " << s_r3 << " N " << N << " knots.size() "
                               << trans_knots_.size());
 
-    using FunctorT = RSReprojectionCostFunctorSplit<N>;
-    FunctorT *functor = new FunctorT(view, calib, cam, u_so3, u_r3, inv_so3_dt_,
-                                     inv_r3_dt_);
-    ceres::DynamicAutoDiffCostFunction<FunctorT> *cost_function =
-        new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
-
-    for (int i = 0; i < N; i++) {
-      cost_function->AddParameterBlock(4);
+    // corners of view with the intrinsics of cam
+    auto observations = std::make_shared<ViewObservations>(
+        *ViewObservations::FromView(*view));
+    observations->camera_model = cam->GetCameraIntrinsicsModelType();
+    observations->nr_intrinsics = cam->CameraIntrinsics()->NumParameters();
+    for (int i = 0; i < observations->nr_intrinsics; ++i) {
+      observations->intrinsics[i] = cam->intrinsics()[i];
     }
-    for (int i = 0; i < N; i++) {
-      cost_function->AddParameterBlock(3);
+    ceres::CostFunction *cost_function =
+        CreateReprojectionCostFunction<RSReprojectionCostFunctorSplit, N>(
+            observations, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_);
+    if (!cost_function) {
+      LOG(ERROR) << "Unsupported camera model of view " << view->Name();
+      return;
     }
-    // T_i_c_ -> quaternion
-    cost_function->AddParameterBlock(7);
-
-    // cam line delay time
-    cost_function->AddParameterBlock(1);
-
-    cost_function->SetNumResiduals(view->TrackIds().size() * 2);
 
     std::vector<double *> vec;
     for (int i = 0; i < N; i++) {
@@ -463,9 +463,18 @@ public:
     // line delay for rolling shutter cameras
     vec.emplace_back(&cam_line_delay_s_);
 
+    // the scene points of calib are not optimized
+    for (const theia::TrackId track_id : observations->track_ids) {
+      vec.emplace_back(
+          const_cast<double *>(calib->Track(track_id)->Point().data()));
+    }
+
     ceres::LossFunction *loss_function =
         new ceres::HuberLoss(robust_loss_width);
     problem_.AddResidualBlock(cost_function, loss_function, vec);
+    for (size_t i = 2 * N + 2; i < vec.size(); ++i) {
+      problem_.SetParameterBlockConstant(vec[i]);
+    }
   }
 
   int64_t maxTimeNs() const {
@@ -474,94 +483,39 @@ public:
 
   int64_t minTimeNs() const { return start_t_ns; }
 
-  double meanRSReprojection(const theia::Reconstruction& image_data) const {
-    double sum_error = 0;
-    int num_points = 0;
+  //! Mean reprojection error of all views inside the spline. The views are
+  //! evaluated concurrently, report receives their errors if not null
+  double meanRSReprojection(
+      const theia::Reconstruction& image_data,
+      OpenICC::core::ReprojectionErrorReport* report = nullptr) const {
+    OpenICC::core::ReprojectionErrorReport local_report;
+    OpenICC::core::ReprojectionErrorReport& errors =
+        report ? *report : local_report;
+    const OpenICC::core::ReprojectionHistogramOptions histogram =
+        errors.histogram_options;
 
     const auto view_ids = image_data.ViewIds();
-
-    for (auto i = 0; i < view_ids.size(); ++i) {
-      const theia::View *view = image_data.View(view_ids[i]);
-      const double time_ns = view->GetTimestamp() * S_TO_NS;
-
-      if (time_ns < minTimeNs() || time_ns >= maxTimeNs())
-        continue;
-      const int64_t st_ns = (time_ns - start_t_ns);
-
-      BASALT_ASSERT_STREAM(st_ns >= 0, "st_ns " << st_ns << " time_ns "
-                                                << time_ns << " start_t_ns "
-                                                << start_t_ns);
-
-      const int64_t s_so3 = st_ns / dt_so3_ns_;
-      double u_so3 = double(st_ns % dt_so3_ns_) / double(dt_so3_ns_);
-      const int64_t s_r3 = st_ns / dt_r3_ns_;
-      double u_r3 = double(st_ns % dt_r3_ns_) / double(dt_r3_ns_);
-
-      BASALT_ASSERT_STREAM(s_so3 >= 0, "s " << s_so3);
-      BASALT_ASSERT_STREAM(s_r3 >= 0, "s " << s_r3);
-
-      BASALT_ASSERT_STREAM(size_t(s_so3 + N) <= so3_knots_.size(),
-                           "s " << s_so3 << " N " << N << " knots.size() "
-                                << so3_knots_.size());
-      BASALT_ASSERT_STREAM(size_t(s_r3 + N) <= trans_knots_.size(),
-                           "s " << s_r3 << " N " << N << " knots.size() "
-                                << trans_knots_.size());
-
-      using FunctorT = RSReprojectionCostFunctorSplit<N>;
-      FunctorT *functor = new FunctorT(view, &image_data, &view->Camera(), u_so3, u_r3,
-                                       inv_so3_dt_, inv_r3_dt_);
-      ceres::DynamicAutoDiffCostFunction<FunctorT> *cost_function =
-          new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
-
-      for (int i = 0; i < N; i++) {
-        cost_function->AddParameterBlock(4);
-      }
-      for (int i = 0; i < N; i++) {
-        cost_function->AddParameterBlock(3);
-      }
-      // T_i_c_ -> quaternion
-      cost_function->AddParameterBlock(7);
-
-      // cam line delay time
-      cost_function->AddParameterBlock(1);
-
-      cost_function->SetNumResiduals(view->TrackIds().size() * 2);
-
-      std::vector<const double *> vec;
-      for (int i = 0; i < N; i++) {
-        const int t = s_so3 + i;
-        vec.emplace_back(so3_knots_[t].data());
-      }
-      for (int i = 0; i < N; i++) {
-        const int t = s_r3 + i;
-        vec.emplace_back(trans_knots_[t].data());
-      }
-      // camera to imu transformation
-      vec.emplace_back(T_i_c_.data());
-
-      // line delay for rolling shutter cameras
-      vec.emplace_back(&cam_line_delay_s_);
-
-      {
-        Eigen::VectorXd residual;
-        residual.setZero(view->TrackIds().size() * 2);
-
-        cost_function->Evaluate(&vec[0], residual.data(), NULL);
-
-        for (size_t i = 0; i < view->TrackIds().size(); ++i) {
-          Eigen::Vector2d res_point = residual.segment<2>(2 * i);
-          if (res_point[0] != 0.0 && res_point[1] != 0.0) {
-            sum_error += res_point.norm();
-            num_points += 1;
-          }
-        }
-      }
-    }
-
-    std::cout << "mean rolling shutter reproj error " << sum_error / num_points
-              << " num_points " << num_points << std::endl;
-
-    return sum_error / num_points;
+    errors.views.assign(view_ids.size(),
+                        OpenICC::core::ViewReprojectionErrors());
+    OpenICC::utils::ParallelFor(
+        0, static_cast<int>(view_ids.size()),
+        OpenICC::utils::ExecutionContext::NumThreads(), [&](const int v) {
+          viewRSReprojection(image_data, view_ids[v], histogram,
+                             errors.views[v]);
+        });
+
+    // views outside of the spline have no points
+    errors.views.erase(
+        std::remove_if(errors.views.begin(), errors.views.end(),
+                       [](const OpenICC::core::ViewReprojectionErrors& e) {
+                         return e.nr_points == 0;
+                       }),
+        errors.views.end());
+
+    std::cout << "mean rolling shutter reproj error " << errors.MeanError()
+              << " num_points " << errors.NumPoints() << std::endl;
+
+    return errors.MeanError();
   }
 
   ceres::Solver::Summary optimize(const int iterations,
@@ -572,7 +526,8 @@ public:
     ceres::Solver::Options options;
     options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
     options.max_num_iterations = iterations;
-    options.num_threads = std::thread::hardware_concurrency();
+    options.num_threads = OpenICC::utils::ExecutionContext::SolverThreads(
+        OpenICC::utils::ExecutionContext::NumThreads());
     // options.logging_type = ceres::LoggingType::PER_MINIMIZER_ITERATION;
     options.minimizer_progress_to_stdout = true;
 
@@ -653,6 +608,72 @@ public:
   }
 
 private:
+  void viewRSReprojection(
+      const theia::Reconstruction &image_data, const theia::ViewId view_id,
+      const OpenICC::core::ReprojectionHistogramOptions &histogram,
+      OpenICC::core::ViewReprojectionErrors &errors) const {
+    const theia::View *view = image_data.View(view_id);
+    errors.view_id = view_id;
+    errors.timestamp_s = view->GetTimestamp();
+    errors.histogram.assign(histogram.nr_bins, 0);
+
+    const double time_ns = view->GetTimestamp() * S_TO_NS;
+    if (time_ns < minTimeNs() || time_ns >= maxTimeNs())
+      return;
+    const int64_t st_ns = (time_ns - start_t_ns);
+
+    const int64_t s_so3 = st_ns / dt_so3_ns_;
+    double u_so3 = double(st_ns % dt_so3_ns_) / double(dt_so3_ns_);
+    const int64_t s_r3 = st_ns / dt_r3_ns_;
+    double u_r3 = double(st_ns % dt_r3_ns_) / double(dt_r3_ns_);
+
+    BASALT_ASSERT_STREAM(size_t(s_so3 + N) <= so3_knots_.size(),
+                         "s " << s_so3 << " N " << N << " knots.size() "
+                              << so3_knots_.size());
+    BASALT_ASSERT_STREAM(size_t(s_r3 + N) <= trans_knots_.size(),
+                         "s " << s_r3 << " N " << N << " knots.size() "
+                              << trans_knots_.size());
+
+    const std::shared_ptr<const ViewObservations> observations =
+        ViewObservations::FromView(*view);
+    const std::vector<theia::TrackId> &tracks = observations->track_ids;
+
+    const std::unique_ptr<ceres::CostFunction> cost_function(
+        CreateReprojectionCostFunction<RSReprojectionCostFunctorSplit, N>(
+            observations, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_));
+    if (!cost_function)
+      return;
+
+    std::vector<const double *> vec;
+    for (int i = 0; i < N; i++) {
+      vec.emplace_back(so3_knots_[s_so3 + i].data());
+    }
+    for (int i = 0; i < N; i++) {
+      vec.emplace_back(trans_knots_[s_r3 + i].data());
+    }
+    // camera to imu transformation
+    vec.emplace_back(T_i_c_.data());
+
+    // line delay for rolling shutter cameras
+    vec.emplace_back(&cam_line_delay_s_);
+
+    // all object points
+    for (const theia::TrackId track_id : tracks) {
+      vec.emplace_back(image_data.Track(track_id)->Point().data());
+    }
+
+    Eigen::VectorXd residual;
+    residual.setZero(tracks.size() * 2);
+    cost_function->Evaluate(vec.data(), residual.data(), NULL);
+
+    for (size_t i = 0; i < tracks.size(); ++i) {
+      const Eigen::Vector2d res_point = residual.segment<2>(2 * i);
+      if (res_point[0] != 0.0 && res_point[1] != 0.0) {
+        errors.Add(res_point.norm(), histogram);
+      }
+    }
+  }
+
   int64_t dt_so3_ns_, dt_r3_ns_, start_t_ns;
   double inv_so3_dt_, inv_r3_dt_;
   double cam_line_delay_s_ = 0.0;
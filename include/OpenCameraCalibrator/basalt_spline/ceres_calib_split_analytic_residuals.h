@@ -0,0 +1,651 @@
+#pragma once
+
+#include "ceres_calib_split_residuals.h"
+#include "ceres_spline_helper.h"
+#include "sophus_utils.h"
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include <Eigen/Core>
+#include <ceres/ceres.h>
+#include <sophus/so3.hpp>
+
+// Closed form Jacobians of the SO3 and R3 splines, following the Basalt
+// So3Spline / RdSpline derivations, evaluated directly on the raw knot
+// pointers that ceres hands to a cost function.
+template <int _N>
+struct CeresSplineJacobianHelper {
+  static constexpr int N = _N;        // Order of the spline.
+  static constexpr int DEG = _N - 1;  // Degree of the spline.
+
+  using VecN = Eigen::Matrix<double, _N, 1>;
+  using Vec3 = Eigen::Matrix<double, 3, 1>;
+  using Mat3 = Eigen::Matrix<double, 3, 3>;
+  using SO3 = Sophus::SO3d;
+  using Helper = CeresSplineHelper<double, _N>;
+
+  /// @brief Blending coefficients of an Euclidean spline for derivative DERIV
+  template <int DERIV>
+  static inline VecN coeffs(const double u, const double inv_dt) {
+    return Helper::template coeffs<DERIV, false>(u, inv_dt);
+  }
+
+  /// @brief Cumulative blending coefficients of a Lie group spline
+  template <int DERIV>
+  static inline VecN cumulativeCoeffs(const double u, const double inv_dt) {
+    return Helper::template coeffs<DERIV, true>(u, inv_dt);
+  }
+
+  /// @brief Value of the SO3 spline and its Jacobians w.r.t. a left (world
+  /// frame) increment of each of the N knots
+  static inline SO3 evaluate(double const* const* sKnots,
+                             const double u,
+                             Mat3* d_val_d_knot) {
+    return evaluate(sKnots, cumulativeCoeffs<0>(u, 1.0), d_val_d_knot);
+  }
+
+  /// @brief Same as above with precomputed cumulativeCoeffs<0>
+  static inline SO3 evaluate(double const* const* sKnots,
+                             const VecN& coeff,
+                             Mat3* d_val_d_knot) {
+    Vec3 delta[DEG];
+    knotDeltas(sKnots, delta);
+    return evaluate(sKnots, delta, coeff, d_val_d_knot);
+  }
+
+  /// @brief Logarithms of the relative rotations between consecutive knots,
+  /// shared by evaluate and velocityBody
+  static inline void knotDeltas(double const* const* sKnots, Vec3* delta) {
+    for (int i = 0; i < DEG; i++) {
+      Eigen::Map<SO3 const> const p0(sKnots[i]);
+      Eigen::Map<SO3 const> const p1(sKnots[i + 1]);
+      delta[i] = (p0.inverse() * p1).log();
+    }
+  }
+
+  /// @brief Same as above with precomputed knotDeltas
+  static inline SO3 evaluate(double const* const* sKnots,
+                             const Vec3* delta_vec,
+                             const VecN& coeff,
+                             Mat3* d_val_d_knot) {
+    SO3 res = Eigen::Map<SO3 const>(sKnots[0]);
+    Mat3 J_helper = Mat3::Identity();
+
+    for (int i = 0; i < DEG; i++) {
+      Eigen::Map<SO3 const> const p0(sKnots[i]);
+
+      const Vec3& delta = delta_vec[i];
+      const Vec3 kdelta = delta * coeff[i + 1];
+
+      Mat3 Jl_inv_delta, Jl_k_delta;
+      Sophus::leftJacobianInvSO3(delta, Jl_inv_delta);
+      Sophus::leftJacobianSO3(kdelta, Jl_k_delta);
+
+      d_val_d_knot[i] = J_helper;
+      J_helper = coeff[i + 1] * res.matrix() * Jl_k_delta * Jl_inv_delta *
+                 p0.inverse().matrix();
+      d_val_d_knot[i] -= J_helper;
+
+      res *= SO3::exp(kdelta);
+    }
+    d_val_d_knot[DEG] = J_helper;
+
+    return res;
+  }
+
+  /// @brief Body frame rotational velocity of the SO3 spline and its
+  /// Jacobians w.r.t. a left (world frame) increment of each of the N knots
+  static inline Vec3 velocityBody(double const* const* sKnots,
+                                  const double u,
+                                  const double inv_dt,
+                                  Mat3* d_vel_d_knot) {
+    return velocityBody(sKnots,
+                        cumulativeCoeffs<0>(u, inv_dt),
+                        cumulativeCoeffs<1>(u, inv_dt),
+                        d_vel_d_knot);
+  }
+
+  /// @brief Same as above with precomputed cumulativeCoeffs<0> and
+  /// cumulativeCoeffs<1>
+  static inline Vec3 velocityBody(double const* const* sKnots,
+                                  const VecN& coeff,
+                                  const VecN& dcoeff,
+                                  Mat3* d_vel_d_knot) {
+    Vec3 delta_vec[DEG];
+    knotDeltas(sKnots, delta_vec);
+    return velocityBody(sKnots, delta_vec, coeff, dcoeff, d_vel_d_knot);
+  }
+
+  /// @brief Same as above with precomputed knotDeltas
+  static inline Vec3 velocityBody(double const* const* sKnots,
+                                  const Vec3* delta_vec,
+                                  const VecN& coeff,
+                                  const VecN& dcoeff,
+                                  Mat3* d_vel_d_knot) {
+    Mat3 R_tmp[DEG];
+    SO3 accum;
+    SO3 exp_k_delta[DEG];
+    Mat3 Jr_delta_inv[DEG], Jr_kdelta[DEG];
+
+    for (int i = DEG - 1; i >= 0; i--) {
+      Eigen::Map<SO3 const> const p1(sKnots[i + 1]);
+
+      Sophus::rightJacobianInvSO3(delta_vec[i], Jr_delta_inv[i]);
+      Jr_delta_inv[i] *= p1.inverse().matrix();
+
+      const Vec3 k_delta = coeff[i + 1] * delta_vec[i];
+      Sophus::rightJacobianSO3(-k_delta, Jr_kdelta[i]);
+
+      R_tmp[i] = accum.matrix();
+      exp_k_delta[i] = SO3::exp(-k_delta);
+      accum *= exp_k_delta[i];
+    }
+
+    Mat3 d_vel_d_delta[DEG];
+    d_vel_d_delta[0] = dcoeff[1] * R_tmp[0] * Jr_delta_inv[0];
+    Vec3 rot_vel = delta_vec[0] * dcoeff[1];
+    for (int i = 1; i < DEG; i++) {
+      d_vel_d_delta[i] =
+          R_tmp[i - 1] * SO3::hat(rot_vel) * Jr_kdelta[i] * coeff[i + 1] +
+          R_tmp[i] * dcoeff[i + 1];
+      d_vel_d_delta[i] *= Jr_delta_inv[i];
+
+      rot_vel = exp_k_delta[i] * rot_vel + delta_vec[i] * dcoeff[i + 1];
+    }
+
+    for (int i = 0; i < N; i++) d_vel_d_knot[i].setZero();
+    for (int i = 0; i < DEG; i++) {
+      d_vel_d_knot[i] -= d_vel_d_delta[i];
+      d_vel_d_knot[i + 1] += d_vel_d_delta[i];
+    }
+
+    return rot_vel;
+  }
+
+  /// @brief Converts the Jacobian w.r.t. a left increment of an SO3 knot to
+  /// the 4 ambient quaternion parameters. LieLocalParameterization uses a
+  /// right increment (T * exp(x)), so the result multiplied by its plus
+  /// Jacobian gives back the Jacobian in the tangent space.
+  template <int ROWS>
+  static inline void so3LeftToAmbient(
+      const double* knot,
+      const Eigen::Matrix<double, ROWS, 3>& J_left,
+      double* jacobian) {
+    Eigen::Map<SO3 const> const R(knot);
+    const Eigen::Matrix<double, 4, 3> J_plus = R.Dx_this_mul_exp_x_at_0();
+    const Eigen::Matrix<double, 3, 4> J_plus_pinv =
+        (J_plus.transpose() * J_plus).inverse() * J_plus.transpose();
+    Eigen::Map<Eigen::Matrix<double, ROWS, 4, Eigen::RowMajor>> J(jacobian);
+    J = J_left * R.matrix() * J_plus_pinv;
+  }
+};
+
+namespace OpenICC {
+
+/// @brief Jacobian of ThreeAxisSensorCalibParams::UnbiasNormalize w.r.t. the
+/// misalignment (yz, zy, zx, xz, xy, yx) and scale (x, y, z) parameters
+inline Eigen::Matrix<double, 3, 9> UnbiasNormalizeJacobian(
+    const ThreeAxisSensorCalibParamsd& triad,
+    const Eigen::Vector3d& raw_data) {
+  const Eigen::Vector3d d = triad.Unbias(raw_data);
+  const Eigen::Vector3d e = triad.GetScaleMatrix() * d;
+  const Eigen::Matrix3d& M = triad.GetMisalignmentMatrix();
+
+  Eigen::Matrix<double, 3, 9> J;
+  J.setZero();
+  J(0, 0) = -e[1];
+  J(0, 1) = e[2];
+  J(1, 2) = -e[2];
+  J(1, 3) = e[0];
+  J(2, 4) = -e[0];
+  J(2, 5) = e[1];
+  J.col(6) = M.col(0) * d[0];
+  J.col(7) = M.col(1) * d[1];
+  J.col(8) = M.col(2) * d[2];
+  return J;
+}
+
+}  // namespace OpenICC
+
+/// @brief Accelerometer residual of AccelerationCostFunctorSplit with closed
+/// form Jacobians. Parameter blocks: N so3 knots, N r3 knots, BIAS_SPLINE_N
+/// bias knots, gravity and the 6 accelerometer intrinsics.
+template <int _N>
+class AccelerationCostFunctionSplitAnalytic : public ceres::CostFunction {
+ public:
+  static constexpr int N = _N;
+
+  using Vec3 = Eigen::Matrix<double, 3, 1>;
+  using Mat3 = Eigen::Matrix<double, 3, 3>;
+  using Mat3RM = Eigen::Matrix<double, 3, 3, Eigen::RowMajor>;
+  using Helper = CeresSplineJacobianHelper<_N>;
+  using BiasHelper = CeresSplineJacobianHelper<BIAS_SPLINE_N>;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  AccelerationCostFunctionSplitAnalytic(const Eigen::Vector3d& measurement,
+                                        double u_r3,
+                                        double inv_r3_dt,
+                                        double u_so3,
+                                        double inv_so3_dt,
+                                        double inv_std,
+                                        double u_bias,
+                                        double inv_bias_dt)
+      : measurement(measurement),
+        u_r3(u_r3),
+        inv_r3_dt(inv_r3_dt),
+        u_so3(u_so3),
+        inv_so3_dt(inv_so3_dt),
+        inv_std(inv_std),
+        u_bias(u_bias),
+        inv_bias_dt(inv_bias_dt),
+        so3_coeff(Helper::template cumulativeCoeffs<0>(u_so3, inv_so3_dt)),
+        accel_coeff(Helper::template coeffs<2>(u_r3, inv_r3_dt)),
+        bias_coeff(BiasHelper::template coeffs<0>(u_bias, inv_bias_dt)) {
+    set_num_residuals(3);
+    std::vector<int32_t>* sizes = mutable_parameter_block_sizes();
+    for (int i = 0; i < N; ++i) sizes->push_back(4);
+    for (int i = 0; i < N; ++i) sizes->push_back(3);
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) sizes->push_back(3);
+    sizes->push_back(3);
+    sizes->push_back(6);
+  }
+
+  bool Evaluate(double const* const* sKnots,
+                double* sResiduals,
+                double** jacobians) const override {
+    Mat3 d_R_d_knot[N];
+    const Sophus::SO3d R_w_i = Helper::evaluate(sKnots, so3_coeff, d_R_d_knot);
+
+    Vec3 accel_w = Vec3::Zero();
+    for (int i = 0; i < N; ++i) {
+      accel_w += accel_coeff[i] * Eigen::Map<Vec3 const>(sKnots[N + i]);
+    }
+
+    Vec3 bias_spline = Vec3::Zero();
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+      bias_spline +=
+          bias_coeff[i] * Eigen::Map<Vec3 const>(sKnots[2 * N + i]);
+    }
+
+    const int gravity_idx = 2 * N + BIAS_SPLINE_N;
+    const int intrinsics_idx = gravity_idx + 1;
+    Eigen::Map<Vec3 const> const gravity(sKnots[gravity_idx]);
+    const double* acl_intrs = sKnots[intrinsics_idx];
+
+    const OpenICC::ThreeAxisSensorCalibParamsd accel_calib_triad(
+        acl_intrs[0],
+        acl_intrs[1],
+        acl_intrs[2],
+        0.0,
+        0.0,
+        0.0,
+        acl_intrs[3],
+        acl_intrs[4],
+        acl_intrs[5],
+        bias_spline[0],
+        bias_spline[1],
+        bias_spline[2]);
+
+    const Mat3 R_i_w = R_w_i.inverse().matrix();
+    const Vec3 accel_g = accel_w + gravity;
+    Eigen::Map<Vec3> residuals(sResiduals);
+    residuals = inv_std * (R_i_w * accel_g -
+                           accel_calib_triad.UnbiasNormalize(measurement));
+
+    if (!jacobians) return true;
+
+    const Mat3 d_res_d_R = inv_std * R_i_w * Sophus::SO3d::hat(accel_g);
+    for (int i = 0; i < N; ++i) {
+      if (jacobians[i]) {
+        Helper::template so3LeftToAmbient<3>(
+            sKnots[i], d_res_d_R * d_R_d_knot[i], jacobians[i]);
+      }
+    }
+    for (int i = 0; i < N; ++i) {
+      if (jacobians[N + i]) {
+        Eigen::Map<Mat3RM> J(jacobians[N + i]);
+        J = inv_std * accel_coeff[i] * R_i_w;
+      }
+    }
+    const Mat3 MK = accel_calib_triad.GetMisalignmentMatrix() *
+                    accel_calib_triad.GetScaleMatrix();
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+      if (jacobians[2 * N + i]) {
+        Eigen::Map<Mat3RM> J(jacobians[2 * N + i]);
+        J = inv_std * bias_coeff[i] * MK;
+      }
+    }
+    if (jacobians[gravity_idx]) {
+      Eigen::Map<Mat3RM> J(jacobians[gravity_idx]);
+      J = inv_std * R_i_w;
+    }
+    if (jacobians[intrinsics_idx]) {
+      const Eigen::Matrix<double, 3, 9> J_intr =
+          OpenICC::UnbiasNormalizeJacobian(accel_calib_triad, measurement);
+      Eigen::Map<Eigen::Matrix<double, 3, 6, Eigen::RowMajor>> J(
+          jacobians[intrinsics_idx]);
+      J.leftCols<3>() = -inv_std * J_intr.leftCols<3>();
+      J.rightCols<3>() = -inv_std * J_intr.rightCols<3>();
+    }
+    return true;
+  }
+
+ private:
+  Eigen::Vector3d measurement;
+  double u_r3;
+  double inv_r3_dt;
+  double u_so3;
+  double inv_so3_dt;
+  double inv_std;
+  // bias spline
+  double u_bias;
+  double inv_bias_dt;
+  // blending coefficients, fixed per measurement
+  typename Helper::VecN so3_coeff;
+  typename Helper::VecN accel_coeff;
+  typename BiasHelper::VecN bias_coeff;
+};
+
+/// @brief Gyroscope residual of GyroCostFunctorSplit with closed form
+/// Jacobians. Parameter blocks: N so3 knots, BIAS_SPLINE_N bias knots and the
+/// 9 gyroscope intrinsics.
+template <int _N>
+class GyroCostFunctionSplitAnalytic : public ceres::CostFunction {
+ public:
+  static constexpr int N = _N;
+
+  using Vec3 = Eigen::Matrix<double, 3, 1>;
+  using Mat3 = Eigen::Matrix<double, 3, 3>;
+  using Mat3RM = Eigen::Matrix<double, 3, 3, Eigen::RowMajor>;
+  using Helper = CeresSplineJacobianHelper<_N>;
+  using BiasHelper = CeresSplineJacobianHelper<BIAS_SPLINE_N>;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  GyroCostFunctionSplitAnalytic(const Eigen::Vector3d& measurement,
+                                double u_so3,
+                                double inv_so3_dt,
+                                double inv_std,
+                                double u_bias,
+                                double inv_bias_dt)
+      : measurement(measurement),
+        u_so3(u_so3),
+        inv_so3_dt(inv_so3_dt),
+        inv_std(inv_std),
+        u_bias(u_bias),
+        inv_bias_dt(inv_bias_dt),
+        so3_coeff(Helper::template cumulativeCoeffs<0>(u_so3, inv_so3_dt)),
+        so3_dcoeff(Helper::template cumulativeCoeffs<1>(u_so3, inv_so3_dt)),
+        bias_coeff(BiasHelper::template coeffs<0>(u_bias, inv_bias_dt)) {
+    set_num_residuals(3);
+    std::vector<int32_t>* sizes = mutable_parameter_block_sizes();
+    for (int i = 0; i < N; ++i) sizes->push_back(4);
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) sizes->push_back(3);
+    sizes->push_back(9);
+  }
+
+  bool Evaluate(double const* const* sKnots,
+                double* sResiduals,
+                double** jacobians) const override {
+    Mat3 d_vel_d_knot[N];
+    const Vec3 rot_vel =
+        Helper::velocityBody(sKnots, so3_coeff, so3_dcoeff, d_vel_d_knot);
+
+    Vec3 bias_spline = Vec3::Zero();
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+      bias_spline += bias_coeff[i] * Eigen::Map<Vec3 const>(sKnots[N + i]);
+    }
+
+    const int intrinsics_idx = N + BIAS_SPLINE_N;
+    const double* gyr_intrs = sKnots[intrinsics_idx];
+    const OpenICC::ThreeAxisSensorCalibParamsd gyro_calib_triad(
+        gyr_intrs[0],
+        gyr_intrs[1],
+        gyr_intrs[2],
+        gyr_intrs[3],
+        gyr_intrs[4],
+        gyr_intrs[5],
+        gyr_intrs[6],
+        gyr_intrs[7],
+        gyr_intrs[8],
+        bias_spline[0],
+        bias_spline[1],
+        bias_spline[2]);
+
+    Eigen::Map<Vec3> residuals(sResiduals);
+    residuals =
+        inv_std * (rot_vel - gyro_calib_triad.UnbiasNormalize(measurement));
+
+    if (!jacobians) return true;
+
+    for (int i = 0; i < N; ++i) {
+      if (jacobians[i]) {
+        Helper::template so3LeftToAmbient<3>(
+            sKnots[i], inv_std * d_vel_d_knot[i], jacobians[i]);
+      }
+    }
+    const Mat3 MK = gyro_calib_triad.GetMisalignmentMatrix() *
+                    gyro_calib_triad.GetScaleMatrix();
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+      if (jacobians[N + i]) {
+        Eigen::Map<Mat3RM> J(jacobians[N + i]);
+        J = inv_std * bias_coeff[i] * MK;
+      }
+    }
+    if (jacobians[intrinsics_idx]) {
+      Eigen::Map<Eigen::Matrix<double, 3, 9, Eigen::RowMajor>> J(
+          jacobians[intrinsics_idx]);
+      J = -inv_std *
+          OpenICC::UnbiasNormalizeJacobian(gyro_calib_triad, measurement);
+    }
+    return true;
+  }
+
+ private:
+  Eigen::Vector3d measurement;
+  double u_so3;
+  double inv_so3_dt;
+  double inv_std;
+  // bias
+  double u_bias;
+  double inv_bias_dt;
+  // blending coefficients, fixed per measurement
+  typename Helper::VecN so3_coeff;
+  typename Helper::VecN so3_dcoeff;
+  typename BiasHelper::VecN bias_coeff;
+};
+
+/// @brief Accelerometer and gyroscope residual of one IMU sample with closed
+/// form Jacobians. The SO3 knot deltas are shared by the rotation and the
+/// angular velocity. Residuals: 3 accelerometer and 3 gyroscope. Parameter
+/// blocks: N so3 knots, N r3 knots, BIAS_SPLINE_N accelerometer and
+/// BIAS_SPLINE_N gyroscope bias knots, gravity, the 6 accelerometer and the 9
+/// gyroscope intrinsics.
+template <int _N>
+class ImuCostFunctionSplitAnalytic : public ceres::CostFunction {
+ public:
+  static constexpr int N = _N;
+  static constexpr int DEG = _N - 1;
+
+  using Vec3 = Eigen::Matrix<double, 3, 1>;
+  using Mat3 = Eigen::Matrix<double, 3, 3>;
+  using Mat63 = Eigen::Matrix<double, 6, 3>;
+  using Mat63RM = Eigen::Matrix<double, 6, 3, Eigen::RowMajor>;
+  using Helper = CeresSplineJacobianHelper<_N>;
+  using BiasHelper = CeresSplineJacobianHelper<BIAS_SPLINE_N>;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  ImuCostFunctionSplitAnalytic(const Eigen::Vector3d& accl_measurement,
+                               const Eigen::Vector3d& gyro_measurement,
+                               double u_r3,
+                               double inv_r3_dt,
+                               double u_so3,
+                               double inv_so3_dt,
+                               double accl_inv_std,
+                               double gyro_inv_std,
+                               double u_accl_bias,
+                               double inv_accl_bias_dt,
+                               double u_gyro_bias,
+                               double inv_gyro_bias_dt)
+      : accl_measurement(accl_measurement),
+        gyro_measurement(gyro_measurement),
+        accl_inv_std(accl_inv_std),
+        gyro_inv_std(gyro_inv_std),
+        so3_coeff(Helper::template cumulativeCoeffs<0>(u_so3, inv_so3_dt)),
+        so3_dcoeff(Helper::template cumulativeCoeffs<1>(u_so3, inv_so3_dt)),
+        accel_coeff(Helper::template coeffs<2>(u_r3, inv_r3_dt)),
+        accl_bias_coeff(
+            BiasHelper::template coeffs<0>(u_accl_bias, inv_accl_bias_dt)),
+        gyro_bias_coeff(
+            BiasHelper::template coeffs<0>(u_gyro_bias, inv_gyro_bias_dt)) {
+    set_num_residuals(6);
+    std::vector<int32_t>* sizes = mutable_parameter_block_sizes();
+    for (int i = 0; i < N; ++i) sizes->push_back(4);
+    for (int i = 0; i < N; ++i) sizes->push_back(3);
+    for (int i = 0; i < 2 * BIAS_SPLINE_N; ++i) sizes->push_back(3);
+    sizes->push_back(3);
+    sizes->push_back(6);
+    sizes->push_back(9);
+  }
+
+  bool Evaluate(double const* const* sKnots,
+                double* sResiduals,
+                double** jacobians) const override {
+    Vec3 delta[DEG];
+    Helper::knotDeltas(sKnots, delta);
+    Mat3 d_R_d_knot[N], d_vel_d_knot[N];
+    const Sophus::SO3d R_w_i =
+        Helper::evaluate(sKnots, delta, so3_coeff, d_R_d_knot);
+    const Vec3 rot_vel = Helper::velocityBody(
+        sKnots, delta, so3_coeff, so3_dcoeff, d_vel_d_knot);
+
+    Vec3 accel_w = Vec3::Zero();
+    for (int i = 0; i < N; ++i) {
+      accel_w += accel_coeff[i] * Eigen::Map<Vec3 const>(sKnots[N + i]);
+    }
+    const int accl_bias_idx = 2 * N;
+    const int gyro_bias_idx = accl_bias_idx + BIAS_SPLINE_N;
+    Vec3 accl_bias = Vec3::Zero();
+    Vec3 gyro_bias = Vec3::Zero();
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+      accl_bias += accl_bias_coeff[i] *
+                   Eigen::Map<Vec3 const>(sKnots[accl_bias_idx + i]);
+      gyro_bias += gyro_bias_coeff[i] *
+                   Eigen::Map<Vec3 const>(sKnots[gyro_bias_idx + i]);
+    }
+
+    const int gravity_idx = gyro_bias_idx + BIAS_SPLINE_N;
+    const int accl_intrinsics_idx = gravity_idx + 1;
+    const int gyro_intrinsics_idx = accl_intrinsics_idx + 1;
+    Eigen::Map<Vec3 const> const gravity(sKnots[gravity_idx]);
+    const double* acl_intrs = sKnots[accl_intrinsics_idx];
+    const double* gyr_intrs = sKnots[gyro_intrinsics_idx];
+    const OpenICC::ThreeAxisSensorCalibParamsd accel_calib_triad(
+        acl_intrs[0],
+        acl_intrs[1],
+        acl_intrs[2],
+        0.0,
+        0.0,
+        0.0,
+        acl_intrs[3],
+        acl_intrs[4],
+        acl_intrs[5],
+        accl_bias[0],
+        accl_bias[1],
+        accl_bias[2]);
+    const OpenICC::ThreeAxisSensorCalibParamsd gyro_calib_triad(
+        gyr_intrs[0],
+        gyr_intrs[1],
+        gyr_intrs[2],
+        gyr_intrs[3],
+        gyr_intrs[4],
+        gyr_intrs[5],
+        gyr_intrs[6],
+        gyr_intrs[7],
+        gyr_intrs[8],
+        gyro_bias[0],
+        gyro_bias[1],
+        gyro_bias[2]);
+
+    const Mat3 R_i_w = R_w_i.inverse().matrix();
+    const Vec3 accel_g = accel_w + gravity;
+    Eigen::Map<Vec3> accl_residuals(sResiduals);
+    Eigen::Map<Vec3> gyro_residuals(sResiduals + 3);
+    accl_residuals =
+        accl_inv_std * (R_i_w * accel_g -
+                        accel_calib_triad.UnbiasNormalize(accl_measurement));
+    gyro_residuals =
+        gyro_inv_std *
+        (rot_vel - gyro_calib_triad.UnbiasNormalize(gyro_measurement));
+
+    if (!jacobians) return true;
+
+    const Mat3 d_res_d_R = accl_inv_std * R_i_w * Sophus::SO3d::hat(accel_g);
+    for (int i = 0; i < N; ++i) {
+      if (jacobians[i]) {
+        Mat63 J_left;
+        J_left.topRows<3>() = d_res_d_R * d_R_d_knot[i];
+        J_left.bottomRows<3>() = gyro_inv_std * d_vel_d_knot[i];
+        Helper::template so3LeftToAmbient<6>(sKnots[i], J_left, jacobians[i]);
+      }
+    }
+    for (int i = 0; i < N; ++i) {
+      if (jacobians[N + i]) {
+        Eigen::Map<Mat63RM> J(jacobians[N + i]);
+        J.topRows<3>() = accl_inv_std * accel_coeff[i] * R_i_w;
+        J.bottomRows<3>().setZero();
+      }
+    }
+    const Mat3 accl_MK = accel_calib_triad.GetMisalignmentMatrix() *
+                         accel_calib_triad.GetScaleMatrix();
+    const Mat3 gyro_MK = gyro_calib_triad.GetMisalignmentMatrix() *
+                         gyro_calib_triad.GetScaleMatrix();
+    for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+      if (jacobians[accl_bias_idx + i]) {
+        Eigen::Map<Mat63RM> J(jacobians[accl_bias_idx + i]);
+        J.topRows<3>() = accl_inv_std * accl_bias_coeff[i] * accl_MK;
+        J.bottomRows<3>().setZero();
+      }
+      if (jacobians[gyro_bias_idx + i]) {
+        Eigen::Map<Mat63RM> J(jacobians[gyro_bias_idx + i]);
+        J.topRows<3>().setZero();
+        J.bottomRows<3>() = gyro_inv_std * gyro_bias_coeff[i] * gyro_MK;
+      }
+    }
+    if (jacobians[gravity_idx]) {
+      Eigen::Map<Mat63RM> J(jacobians[gravity_idx]);
+      J.topRows<3>() = accl_inv_std * R_i_w;
+      J.bottomRows<3>().setZero();
+    }
+    if (jacobians[accl_intrinsics_idx]) {
+      const Eigen::Matrix<double, 3, 9> J_intr =
+          OpenICC::UnbiasNormalizeJacobian(accel_calib_triad,
+                                           accl_measurement);
+      Eigen::Map<Eigen::Matrix<double, 6, 6, Eigen::RowMajor>> J(
+          jacobians[accl_intrinsics_idx]);
+      J.topLeftCorner<3, 3>() = -accl_inv_std * J_intr.leftCols<3>();
+      J.topRightCorner<3, 3>() = -accl_inv_std * J_intr.rightCols<3>();
+      J.bottomRows<3>().setZero();
+    }
+    if (jacobians[gyro_intrinsics_idx]) {
+      Eigen::Map<Eigen::Matrix<double, 6, 9, Eigen::RowMajor>> J(
+          jacobians[gyro_intrinsics_idx]);
+      J.topRows<3>().setZero();
+      J.bottomRows<3>() =
+          -gyro_inv_std *
+          OpenICC::UnbiasNormalizeJacobian(gyro_calib_triad, gyro_measurement);
+    }
+    return true;
+  }
+
+ private:
+  Eigen::Vector3d accl_measurement;
+  Eigen::Vector3d gyro_measurement;
+  double accl_inv_std;
+  double gyro_inv_std;
+  // blending coefficients, fixed per measurement
+  typename Helper::VecN so3_coeff;
+  typename Helper::VecN so3_dcoeff;
+  typename Helper::VecN accel_coeff;
+  typename BiasHelper::VecN accl_bias_coeff;
+  typename BiasHelper::VecN gyro_bias_coeff;
+};
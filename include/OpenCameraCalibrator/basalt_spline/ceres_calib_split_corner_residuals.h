@@ -0,0 +1,252 @@
+#pragma once
+
+#include "ceres_calib_split_residuals.h"
+#include "ceres_spline_helper.h"
+
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+#include <Eigen/Core>
+#include <ceres/ceres.h>
+#include <sophus/se3.hpp>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+// Global shutter reprojection residuals with one residual block per corner.
+// The camera pose of a view only depends on the 2N spline knots and T_i_c, so
+// SplineViewPoseCallback evaluates it together with its Jacobian once per
+// linearization point. The corner residuals only differentiate the
+// projection and apply the chain rule.
+
+/// @brief Camera pose T_c_w of one view and its Jacobian w.r.t. the SO3
+/// knots, the R3 knots and T_i_c, in this order and in ambient parameters
+template <int _N>
+struct SplineViewPose {
+  static constexpr int N = _N;
+  static constexpr int kNumParams = 4 * N + 3 * N + 7;
+
+  using VecN = Eigen::Matrix<double, N, 1>;
+  using PoseJacobian = Eigen::Matrix<double, 7, kNumParams, Eigen::RowMajor>;
+
+  SplineViewPose(const std::array<const double*, N>& so3_knots,
+                 const std::array<const double*, N>& r3_knots,
+                 const double* T_i_c,
+                 const VecN& so3_coeff,
+                 const VecN& r3_coeff)
+      : so3_knots(so3_knots),
+        r3_knots(r3_knots),
+        T_i_c(T_i_c),
+        so3_coeff(so3_coeff),
+        r3_coeff(r3_coeff) {}
+
+  /// @brief Updates T_c_w from the current knot values, and J if jacobian
+  void Evaluate(const bool jacobian) {
+    if (!jacobian) {
+      const double* sKnots[2 * N];
+      for (int i = 0; i < N; ++i) {
+        sKnots[i] = so3_knots[i];
+        sKnots[N + i] = r3_knots[i];
+      }
+      Eigen::Map<Sophus::SE3d const> const T_i_c_map(T_i_c);
+      Eigen::Map<Sophus::SE3d> T_c_w_map(T_c_w.data());
+      T_c_w_map = PoseFromKnots<double>(sKnots, T_i_c_map);
+      return;
+    }
+
+    using Jet = ceres::Jet<double, kNumParams>;
+    std::array<Jet, kNumParams> params;
+    for (int i = 0; i < N; ++i) {
+      for (int j = 0; j < 4; ++j) {
+        params[4 * i + j] = Jet(so3_knots[i][j], 4 * i + j);
+      }
+      for (int j = 0; j < 3; ++j) {
+        const int k = 4 * N + 3 * i + j;
+        params[k] = Jet(r3_knots[i][j], k);
+      }
+    }
+    for (int j = 0; j < 7; ++j) {
+      params[7 * N + j] = Jet(T_i_c[j], 7 * N + j);
+    }
+
+    const Jet* sKnots[2 * N];
+    for (int i = 0; i < N; ++i) {
+      sKnots[i] = &params[4 * i];
+      sKnots[N + i] = &params[4 * N + 3 * i];
+    }
+    Eigen::Map<Sophus::SE3<Jet> const> const T_i_c_map(&params[7 * N]);
+    const Sophus::SE3<Jet> T_c_w_jet = PoseFromKnots<Jet>(sKnots, T_i_c_map);
+    for (int r = 0; r < 7; ++r) {
+      T_c_w[r] = T_c_w_jet.data()[r].a;
+      J.row(r) = T_c_w_jet.data()[r].v.transpose();
+    }
+  }
+
+  std::array<const double*, N> so3_knots;
+  std::array<const double*, N> r3_knots;
+  const double* T_i_c;
+  // blending coefficients, fixed per view
+  VecN so3_coeff;
+  VecN r3_coeff;
+
+  //! Sophus::SE3d parameters of T_c_w (quaternion x, y, z, w, translation)
+  Eigen::Matrix<double, 7, 1> T_c_w;
+  //! d T_c_w / d (so3 knots, r3 knots, T_i_c), only valid after a jacobian
+  //! evaluation
+  PoseJacobian J;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  template <class T, class TicT>
+  Sophus::SE3<T> PoseFromKnots(T const* const* sKnots,
+                               const TicT& T_i_c_map) const {
+    Sophus::SO3<T> R_w_i;
+    CeresSplineHelper<T, N>::template evaluate_lie_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff, nullptr, nullptr, nullptr, &R_w_i);
+    Eigen::Matrix<T, 3, 1> t_w_i;
+    CeresSplineHelper<T, N>::template evaluate_coeffs<3>(
+        sKnots + N, r3_coeff, &t_w_i);
+    return (Sophus::SE3<T>(R_w_i, t_w_i) * T_i_c_map).inverse();
+  }
+};
+
+/// @brief Evaluates the poses of all views before ceres evaluates the
+/// residuals, see ceres::EvaluationCallback
+template <int _N>
+class SplineViewPoseCallback : public ceres::EvaluationCallback {
+ public:
+  //! Adds a view, the pose is owned by the callback until Clear
+  SplineViewPose<_N>* AddView(const std::array<const double*, _N>& so3_knots,
+                              const std::array<const double*, _N>& r3_knots,
+                              const double* T_i_c,
+                              const typename SplineViewPose<_N>::VecN& so3_c,
+                              const typename SplineViewPose<_N>::VecN& r3_c) {
+    poses_.emplace_back(
+        new SplineViewPose<_N>(so3_knots, r3_knots, T_i_c, so3_c, r3_c));
+    jacobians_valid_ = false;
+    return poses_.back().get();
+  }
+
+  void Clear() {
+    poses_.clear();
+    jacobians_valid_ = false;
+  }
+
+  size_t NumViews() const { return poses_.size(); }
+
+  void SetNumThreads(const int num_threads) { num_threads_ = num_threads; }
+
+  void PrepareForEvaluation(bool evaluate_jacobians,
+                            bool new_evaluation_point) override {
+    if (!new_evaluation_point && (jacobians_valid_ || !evaluate_jacobians)) {
+      return;
+    }
+    OpenICC::utils::ParallelFor(
+        0, static_cast<int>(poses_.size()), num_threads_, [&](const int i) {
+          poses_[i]->Evaluate(evaluate_jacobians);
+        });
+    jacobians_valid_ = evaluate_jacobians;
+  }
+
+ private:
+  std::vector<std::unique_ptr<SplineViewPose<_N>>> poses_;
+  bool jacobians_valid_ = false;
+  int num_threads_ = 1;
+};
+
+/// @brief Reprojection residual of a single corner of a global shutter view
+///
+/// Parameter blocks: N SO3 knots, N R3 knots, T_i_c and the scene point. The
+/// knots and T_i_c are only read through the SplineViewPose of the view, so
+/// the problem needs a SplineViewPoseCallback that owns it. CameraModel is the
+/// theia camera model of the view, see DispatchCameraModel.
+template <int _N, class CameraModel>
+class GSCornerReprojectionCostFunction : public ceres::CostFunction {
+ public:
+  static constexpr int N = _N;
+
+  GSCornerReprojectionCostFunction(
+      const SplineViewPose<_N>* pose,
+      std::shared_ptr<const ViewObservations> observations,
+      const size_t corner_idx)
+      : pose_(pose),
+        observations_(std::move(observations)),
+        corner_idx_(corner_idx) {
+    set_num_residuals(2);
+    std::vector<int32_t>* block_sizes = mutable_parameter_block_sizes();
+    for (int i = 0; i < N; ++i) block_sizes->push_back(4);
+    for (int i = 0; i < N; ++i) block_sizes->push_back(3);
+    block_sizes->push_back(7);
+    block_sizes->push_back(4);
+  }
+
+  bool Evaluate(double const* const* parameters,
+                double* residuals,
+                double** jacobians) const override {
+    const double* scene_point = parameters[2 * N + 1];
+    if (!jacobians) {
+      Project(pose_->T_c_w.data(), scene_point, residuals);
+      return true;
+    }
+
+    // differentiate w.r.t. the 7 pose and 4 point parameters only
+    using Jet = ceres::Jet<double, 11>;
+    Jet pose_jet[7], point_jet[4], residuals_jet[2];
+    for (int i = 0; i < 7; ++i) pose_jet[i] = Jet(pose_->T_c_w[i], i);
+    for (int i = 0; i < 4; ++i) point_jet[i] = Jet(scene_point[i], 7 + i);
+    Project(pose_jet, point_jet, residuals_jet);
+
+    Eigen::Matrix<double, 2, 7, Eigen::RowMajor> d_res_d_pose;
+    Eigen::Matrix<double, 2, 4, Eigen::RowMajor> d_res_d_point;
+    for (int r = 0; r < 2; ++r) {
+      residuals[r] = residuals_jet[r].a;
+      d_res_d_pose.row(r) = residuals_jet[r].v.template head<7>().transpose();
+      d_res_d_point.row(r) = residuals_jet[r].v.template tail<4>().transpose();
+    }
+
+    // chain rule through the spline pose
+    using JacobianMap =
+        Eigen::Map<Eigen::Matrix<double, 2, Eigen::Dynamic, Eigen::RowMajor>>;
+    for (int b = 0; b < 2 * N + 1; ++b) {
+      if (!jacobians[b]) continue;
+      const int size = b < N ? 4 : (b < 2 * N ? 3 : 7);
+      const int offset = b < N ? 4 * b : 4 * N + 3 * (b - N);
+      JacobianMap(jacobians[b], 2, size) =
+          d_res_d_pose * pose_->J.middleCols(offset, size);
+    }
+    if (jacobians[2 * N + 1]) {
+      Eigen::Map<Eigen::Matrix<double, 2, 4, Eigen::RowMajor>> J(
+          jacobians[2 * N + 1]);
+      J = d_res_d_point;
+    }
+    return true;
+  }
+
+ private:
+  template <class T>
+  void Project(const T* T_c_w, const T* scene_point, T* res) const {
+    const ViewObservations& obs = *observations_;
+    const ViewObservations::Corner corner = obs.CornerAt(corner_idx_);
+    const ViewIntrinsics<T> intr(obs);
+
+    Eigen::Map<Sophus::SE3<T> const> const T_c_w_map(T_c_w);
+    Eigen::Map<Eigen::Matrix<T, 4, 1> const> const point(scene_point);
+    const Eigen::Matrix<T, 3, 1> p3d =
+        (T_c_w_map.matrix() * point).hnormalized();
+
+    T reprojection[2];
+    if (!CameraModel::CameraToPixelCoordinates(
+            intr.data(), p3d.data(), reprojection)) {
+      res[0] = T(1e10);
+      res[1] = T(1e10);
+    } else {
+      res[0] = corner.inv_std_x * (reprojection[0] - corner.x);
+      res[1] = corner.inv_std_y * (reprojection[1] - corner.y);
+    }
+  }
+
+  const SplineViewPose<_N>* pose_;
+  std::shared_ptr<const ViewObservations> observations_;
+  size_t corner_idx_;
+};
@@ -6,6 +6,8 @@
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include <Eigen/Core>
+#include <ceres/ceres.h>
+#include <glog/logging.h>
 #include <theia/sfm/camera/camera.h>
 #include <theia/sfm/camera/camera_intrinsics_model.h>
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
@@ -18,8 +20,161 @@
 
 #include <sophus/so3.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
 static constexpr int BIAS_SPLINE_N = 3;
 
+/// @brief Camera and corner observations of one view, copied out of theia
+/// so the reprojection functors do not need to look up features
+struct ViewObservations {
+  static constexpr int kMaxIntrinsics = 10;
+
+  /// @brief Everything the residual of one corner reads, kept together so
+  /// the residual loop walks a single contiguous array
+  struct Corner {
+    double x;
+    double y;
+    double inv_std_x;
+    double inv_std_y;
+  };
+
+  /// @brief Single precision Corner, half the memory traffic per residual.
+  /// Pixel coordinates keep a resolution of better than 1e-3 px up to
+  /// 8192 px, well below the corner detection noise.
+  struct CompactCorner {
+    float x;
+    float y;
+    float inv_std_x;
+    float inv_std_y;
+  };
+
+  theia::CameraIntrinsicsModelType camera_model;
+  int nr_intrinsics = 0;
+  double intrinsics[kMaxIntrinsics];
+
+  /// track of every corner, only used to set up the parameter blocks
+  std::vector<theia::TrackId> track_ids;
+  /// either corners or compact_corners is filled, see FromView
+  std::vector<Corner> corners;
+  std::vector<CompactCorner> compact_corners;
+
+  size_t size() const {
+    return compact_corners.empty() ? corners.size() : compact_corners.size();
+  }
+
+  /// @brief Corner i in double precision, the residuals accumulate in double
+  /// in both storage modes
+  Corner CornerAt(const size_t i) const {
+    if (compact_corners.empty()) {
+      return corners[i];
+    }
+    const CompactCorner& c = compact_corners[i];
+    return {c.x, c.y, c.inv_std_x, c.inv_std_y};
+  }
+
+  /// @brief compact stores the corners as CompactCorner
+  static std::shared_ptr<const ViewObservations> FromView(
+      const theia::View& view, const bool compact = false) {
+    auto obs = std::make_shared<ViewObservations>();
+    const theia::Camera& cam = view.Camera();
+    obs->camera_model = cam.GetCameraIntrinsicsModelType();
+    obs->nr_intrinsics = cam.CameraIntrinsics()->NumParameters();
+    CHECK_LE(obs->nr_intrinsics, kMaxIntrinsics);
+    for (int i = 0; i < obs->nr_intrinsics; ++i) {
+      obs->intrinsics[i] = cam.intrinsics()[i];
+    }
+    obs->track_ids = view.TrackIds();
+    if (compact) {
+      obs->compact_corners.reserve(obs->track_ids.size());
+    } else {
+      obs->corners.reserve(obs->track_ids.size());
+    }
+    for (const theia::TrackId tid : obs->track_ids) {
+      const theia::Feature& feature = *view.GetFeature(tid);
+      const Corner corner = {feature.x(),
+                             feature.y(),
+                             1. / std::sqrt(feature.covariance_(0, 0)),
+                             1. / std::sqrt(feature.covariance_(1, 1))};
+      if (compact) {
+        obs->compact_corners.push_back({static_cast<float>(corner.x),
+                                        static_cast<float>(corner.y),
+                                        static_cast<float>(corner.inv_std_x),
+                                        static_cast<float>(corner.inv_std_y)});
+      } else {
+        obs->corners.push_back(corner);
+      }
+    }
+    return obs;
+  }
+};
+
+/// @brief Type tag of a theia camera model, see DispatchCameraModel
+template <class Model>
+struct CameraModelTag {
+  using type = Model;
+};
+
+/// @brief Calls f(CameraModelTag<Model>()) for the theia camera model class
+/// of cam_model. The reprojection residuals are instantiated per camera
+/// model this way, so they do not dispatch at every corner. False if the
+/// model is not supported
+template <typename F>
+bool DispatchCameraModel(const theia::CameraIntrinsicsModelType cam_model,
+                         F&& f) {
+  switch (cam_model) {
+    case theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION:
+      f(CameraModelTag<theia::DivisionUndistortionCameraModel>());
+      return true;
+    case theia::CameraIntrinsicsModelType::DOUBLE_SPHERE:
+      f(CameraModelTag<theia::DoubleSphereCameraModel>());
+      return true;
+    case theia::CameraIntrinsicsModelType::PINHOLE:
+      f(CameraModelTag<theia::PinholeCameraModel>());
+      return true;
+    case theia::CameraIntrinsicsModelType::FISHEYE:
+      f(CameraModelTag<theia::FisheyeCameraModel>());
+      return true;
+    case theia::CameraIntrinsicsModelType::EXTENDED_UNIFIED:
+      f(CameraModelTag<theia::ExtendedUnifiedCameraModel>());
+      return true;
+    case theia::CameraIntrinsicsModelType::PINHOLE_RADIAL_TANGENTIAL:
+      f(CameraModelTag<theia::PinholeRadialTangentialCameraModel>());
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// @brief Intrinsics of a view as constants of type T, the double
+/// intrinsics are used directly without a copy
+template <class T>
+class ViewIntrinsics {
+ public:
+  explicit ViewIntrinsics(const ViewObservations& obs) {
+    for (int i = 0; i < obs.nr_intrinsics; ++i) {
+      intr_[i] = T(obs.intrinsics[i]);
+    }
+  }
+  const T* data() const { return intr_; }
+
+ private:
+  T intr_[ViewObservations::kMaxIntrinsics];
+};
+
+template <>
+class ViewIntrinsics<double> {
+ public:
+  explicit ViewIntrinsics(const ViewObservations& obs)
+      : intr_(obs.intrinsics) {}
+  const double* data() const { return intr_; }
+
+ private:
+  const double* intr_;
+};
+
 template <int _N>
 struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
   static constexpr int N = _N;        // Order of the spline.
@@ -47,7 +202,17 @@ struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
         inv_so3_dt(inv_so3_dt),
         inv_std(inv_std),
         u_bias(u_bias),
-        inv_bias_dt(inv_bias_dt) {}
+        inv_bias_dt(inv_bias_dt) {
+    so3_coeff =
+        CeresSplineHelper<double, N>::template coeffs<0, true>(u_so3,
+                                                               inv_so3_dt);
+    r3_accel_coeff =
+        CeresSplineHelper<double, N>::template coeffs<2, false>(u_r3,
+                                                                inv_r3_dt);
+    bias_coeff =
+        CeresSplineHelper<double, BIAS_SPLINE_N>::template coeffs<0, false>(
+            u_bias, inv_bias_dt);
+  }
 
   template <class T>
   bool operator()(T const* const* sKnots, T* sResiduals) const {
@@ -57,38 +222,31 @@ struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
     Eigen::Map<Vector3> residuals(sResiduals);
 
     Sophus::SO3<T> R_w_i;
-    CeresSplineHelper<T, N>::template evaluate_lie<Sophus::SO3>(
-        sKnots, T(u_so3), T(inv_so3_dt), &R_w_i);
+    CeresSplineHelper<T, N>::template evaluate_lie_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff, nullptr, nullptr, nullptr, &R_w_i);
 
     Vector3 accel_w;
-    CeresSplineHelper<T, N>::template evaluate<3, 2>(
-        sKnots + N, T(u_r3), T(inv_r3_dt), &accel_w);
+    CeresSplineHelper<T, N>::template evaluate_coeffs<3>(
+        sKnots + N, r3_accel_coeff, &accel_w);
 
     Vector3 bias_spline;
-    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate<3, 0>(
-        sKnots + 2 * N, T(u_bias), T(inv_bias_dt), &bias_spline);
+    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate_coeffs<3>(
+        sKnots + 2 * N, bias_coeff, &bias_spline);
 
     Eigen::Map<Vector3 const> const gravity(sKnots[2 * N + BIAS_SPLINE_N]);
     Eigen::Map<Vector6 const> const acl_intrs(
         sKnots[2 * N + BIAS_SPLINE_N + 1]);
 
-    OpenICC::ThreeAxisSensorCalibParams<T> accel_calib_triad(acl_intrs[0],
-                                                             acl_intrs[1],
-                                                             acl_intrs[2],
-                                                             T(0),
-                                                             T(0),
-                                                             T(0),
-                                                             acl_intrs[3],
-                                                             acl_intrs[4],
-                                                             acl_intrs[5],
-                                                             bias_spline[0],
-                                                             bias_spline[1],
-                                                             bias_spline[2]);
-
     Vector3 accl_raw;
     accl_raw << T(measurement[0]), T(measurement[1]), T(measurement[2]);
-    residuals = T(inv_std) * (R_w_i.inverse() * (accel_w + gravity) -
-                              accel_calib_triad.UnbiasNormalize(accl_raw));
+    residuals =
+        T(inv_std) *
+        (R_w_i.inverse() * (accel_w + gravity) -
+         OpenICC::ThreeAxisSensorCalibParams<T>::ApplyUnbiasNormalizeBodyFrame(
+             acl_intrs.data(),
+             acl_intrs.data() + 3,
+             bias_spline.data(),
+             accl_raw));
     return true;
   }
 
@@ -101,6 +259,10 @@ struct AccelerationCostFunctorSplit : public CeresSplineHelper<double, _N> {
   // bias spline
   double u_bias;
   double inv_bias_dt;
+  // blending coefficients, fixed per measurement
+  VecN so3_coeff;
+  VecN r3_accel_coeff;
+  Eigen::Matrix<double, BIAS_SPLINE_N, 1> bias_coeff;
 };
 
 template <int _N, template <class> class GroupT, bool OLD_TIME_DERIV>
@@ -128,7 +290,17 @@ struct GyroCostFunctorSplit : public CeresSplineHelper<double, _N> {
         inv_so3_dt(inv_so3_dt),
         inv_std(inv_std),
         u_bias(u_bias),
-        inv_bias_dt(inv_bias_dt) {}
+        inv_bias_dt(inv_bias_dt) {
+    so3_coeff =
+        CeresSplineHelper<double, N>::template coeffs<0, true>(u_so3,
+                                                               inv_so3_dt);
+    so3_dcoeff =
+        CeresSplineHelper<double, N>::template coeffs<1, true>(u_so3,
+                                                               inv_so3_dt);
+    bias_coeff =
+        CeresSplineHelper<double, BIAS_SPLINE_N>::template coeffs<0, false>(
+            u_bias, inv_bias_dt);
+  }
 
   template <class T>
   bool operator()(T const* const* sKnots, T* sResiduals) const {
@@ -140,30 +312,18 @@ struct GyroCostFunctorSplit : public CeresSplineHelper<double, _N> {
 
     Tangent rot_vel;
 
-    CeresSplineHelper<T, N>::template evaluate_lie<GroupT>(
-        sKnots, T(u_so3), T(inv_so3_dt), nullptr, &rot_vel);
+    CeresSplineHelper<T, N>::template evaluate_lie_coeffs<GroupT>(
+        sKnots, so3_coeff, &so3_dcoeff, nullptr, nullptr, nullptr, &rot_vel);
 
     Vector3 bias_spline;
-    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate<3, 0>(
-        sKnots + N, T(u_bias), T(inv_bias_dt), &bias_spline);
+    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate_coeffs<3>(
+        sKnots + N, bias_coeff, &bias_spline);
 
     Eigen::Map<Vector9 const> const gyr_intrs(sKnots[N + BIAS_SPLINE_N]);
-    OpenICC::ThreeAxisSensorCalibParams<T> gyro_calib_triad(gyr_intrs[0],
-                                                            gyr_intrs[1],
-                                                            gyr_intrs[2],
-                                                            gyr_intrs[3],
-                                                            gyr_intrs[4],
-                                                            gyr_intrs[5],
-                                                            gyr_intrs[6],
-                                                            gyr_intrs[7],
-                                                            gyr_intrs[8],
-                                                            bias_spline[0],
-                                                            bias_spline[1],
-                                                            bias_spline[2]);
-
     Vector3 gyro_raw;
     gyro_raw << T(measurement[0]), T(measurement[1]), T(measurement[2]);
-    Tangent tang(gyro_calib_triad.UnbiasNormalize(gyro_raw));
+    Tangent tang(OpenICC::ThreeAxisSensorCalibParams<T>::ApplyUnbiasNormalize(
+        gyr_intrs.data(), gyr_intrs.data() + 6, bias_spline.data(), gyro_raw));
     residuals = T(inv_std) * (rot_vel - tang);
     return true;
   }
@@ -175,9 +335,195 @@ struct GyroCostFunctorSplit : public CeresSplineHelper<double, _N> {
   // bias
   double u_bias, inv_std_bias;
   double inv_bias_dt;
+  // blending coefficients, fixed per measurement
+  VecN so3_coeff;
+  VecN so3_dcoeff;
+  Eigen::Matrix<double, BIAS_SPLINE_N, 1> bias_coeff;
+};
+
+/// @brief Accelerometer and gyroscope residual of one IMU sample. The SO3
+/// spline is evaluated once for the rotation and the angular velocity.
+/// Residuals: 3 accelerometer and 3 gyroscope. Parameter blocks: N so3 knots,
+/// N r3 knots, accelerometer and gyroscope bias knots, gravity, accelerometer
+/// and gyroscope intrinsics.
+template <int _N>
+struct ImuCostFunctorSplit : public CeresSplineHelper<double, _N> {
+  static constexpr int N = _N;        // Order of the spline.
+  static constexpr int DEG = _N - 1;  // Degree of the spline.
+
+  using VecN = Eigen::Matrix<double, _N, 1>;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  ImuCostFunctorSplit(const Eigen::Vector3d& accl_measurement,
+                      const Eigen::Vector3d& gyro_measurement,
+                      double u_r3,
+                      double inv_r3_dt,
+                      double u_so3,
+                      double inv_so3_dt,
+                      double accl_inv_std,
+                      double gyro_inv_std,
+                      double u_accl_bias,
+                      double inv_accl_bias_dt,
+                      double u_gyro_bias,
+                      double inv_gyro_bias_dt)
+      : accl_measurement(accl_measurement),
+        gyro_measurement(gyro_measurement),
+        accl_inv_std(accl_inv_std),
+        gyro_inv_std(gyro_inv_std) {
+    so3_coeff =
+        CeresSplineHelper<double, N>::template coeffs<0, true>(u_so3,
+                                                               inv_so3_dt);
+    so3_dcoeff =
+        CeresSplineHelper<double, N>::template coeffs<1, true>(u_so3,
+                                                               inv_so3_dt);
+    r3_accel_coeff =
+        CeresSplineHelper<double, N>::template coeffs<2, false>(u_r3,
+                                                                inv_r3_dt);
+    accl_bias_coeff =
+        CeresSplineHelper<double, BIAS_SPLINE_N>::template coeffs<0, false>(
+            u_accl_bias, inv_accl_bias_dt);
+    gyro_bias_coeff =
+        CeresSplineHelper<double, BIAS_SPLINE_N>::template coeffs<0, false>(
+            u_gyro_bias, inv_gyro_bias_dt);
+  }
+
+  template <class T>
+  bool operator()(T const* const* sKnots, T* sResiduals) const {
+    using Vector3 = Eigen::Matrix<T, 3, 1>;
+    using Vector6 = Eigen::Matrix<T, 6, 1>;
+    using Vector9 = Eigen::Matrix<T, 9, 1>;
+
+    Sophus::SO3<T> R_w_i;
+    Vector3 rot_vel;
+    CeresSplineHelper<T, N>::template evaluate_lie_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff, &so3_dcoeff, nullptr, nullptr, &R_w_i, &rot_vel);
+
+    Vector3 accel_w;
+    CeresSplineHelper<T, N>::template evaluate_coeffs<3>(
+        sKnots + N, r3_accel_coeff, &accel_w);
+
+    Vector3 accl_bias, gyro_bias;
+    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate_coeffs<3>(
+        sKnots + 2 * N, accl_bias_coeff, &accl_bias);
+    CeresSplineHelper<T, BIAS_SPLINE_N>::template evaluate_coeffs<3>(
+        sKnots + 2 * N + BIAS_SPLINE_N, gyro_bias_coeff, &gyro_bias);
+
+    const int gravity_idx = 2 * N + 2 * BIAS_SPLINE_N;
+    Eigen::Map<Vector3 const> const gravity(sKnots[gravity_idx]);
+    Eigen::Map<Vector6 const> const acl_intrs(sKnots[gravity_idx + 1]);
+    Eigen::Map<Vector9 const> const gyr_intrs(sKnots[gravity_idx + 2]);
+
+    const Vector3 accl_raw = accl_measurement.template cast<T>();
+    const Vector3 gyro_raw = gyro_measurement.template cast<T>();
+    Eigen::Map<Vector3> accl_residuals(sResiduals);
+    Eigen::Map<Vector3> gyro_residuals(sResiduals + 3);
+    accl_residuals =
+        T(accl_inv_std) *
+        (R_w_i.inverse() * (accel_w + gravity) -
+         OpenICC::ThreeAxisSensorCalibParams<T>::ApplyUnbiasNormalizeBodyFrame(
+             acl_intrs.data(),
+             acl_intrs.data() + 3,
+             accl_bias.data(),
+             accl_raw));
+    gyro_residuals =
+        T(gyro_inv_std) *
+        (rot_vel -
+         OpenICC::ThreeAxisSensorCalibParams<T>::ApplyUnbiasNormalize(
+             gyr_intrs.data(),
+             gyr_intrs.data() + 6,
+             gyro_bias.data(),
+             gyro_raw));
+    return true;
+  }
+
+  Eigen::Vector3d accl_measurement;
+  Eigen::Vector3d gyro_measurement;
+  double accl_inv_std;
+  double gyro_inv_std;
+  // blending coefficients, fixed per measurement
+  VecN so3_coeff;
+  VecN so3_dcoeff;
+  VecN r3_accel_coeff;
+  Eigen::Matrix<double, BIAS_SPLINE_N, 1> accl_bias_coeff;
+  Eigen::Matrix<double, BIAS_SPLINE_N, 1> gyro_bias_coeff;
 };
 
+/// @brief Position residual of the R3 spline, e.g. for GPS measurements that
+/// were converted to the (ENU) world frame of the spline
 template <int _N>
+struct PositionCostFunctorSplit : public CeresSplineHelper<double, _N> {
+  static constexpr int N = _N;        // Order of the spline.
+  static constexpr int DEG = _N - 1;  // Degree of the spline.
+
+  using VecN = Eigen::Matrix<double, _N, 1>;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  PositionCostFunctorSplit(const Eigen::Vector3d& measurement,
+                           double u_r3,
+                           double inv_r3_dt,
+                           double inv_std)
+      : measurement(measurement), inv_std(inv_std) {
+    r3_coeff = CeresSplineHelper<double, N>::template coeffs<0, false>(
+        u_r3, inv_r3_dt);
+  }
+
+  template <class T>
+  bool operator()(T const* const* sKnots, T* sResiduals) const {
+    using Vector3 = Eigen::Matrix<T, 3, 1>;
+    Eigen::Map<Vector3> residuals(sResiduals);
+
+    Vector3 p_w_i;
+    CeresSplineHelper<T, N>::template evaluate_coeffs<3>(
+        sKnots, r3_coeff, &p_w_i);
+    residuals = T(inv_std) * (p_w_i - measurement.template cast<T>());
+    return true;
+  }
+
+  Eigen::Vector3d measurement;
+  double inv_std;
+  // blending coefficients, fixed per measurement
+  VecN r3_coeff;
+};
+
+/// @brief Orientation residual of the SO3 spline, e.g. for the IMU
+/// orientation R_w_i of a view. Residual: inv_std * log(R_meas^-1 * R_w_i)
+template <int _N>
+struct OrientationCostFunctorSplit : public CeresSplineHelper<double, _N> {
+  static constexpr int N = _N;        // Order of the spline.
+  static constexpr int DEG = _N - 1;  // Degree of the spline.
+
+  using VecN = Eigen::Matrix<double, _N, 1>;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  OrientationCostFunctorSplit(const Sophus::SO3d& measurement,
+                              double u_so3,
+                              double inv_so3_dt,
+                              double inv_std)
+      : measurement_inv(measurement.inverse()), inv_std(inv_std) {
+    so3_coeff = CeresSplineHelper<double, N>::template coeffs<0, true>(
+        u_so3, inv_so3_dt);
+  }
+
+  template <class T>
+  bool operator()(T const* const* sKnots, T* sResiduals) const {
+    Eigen::Map<Eigen::Matrix<T, 3, 1>> residuals(sResiduals);
+
+    Sophus::SO3<T> R_w_i;
+    CeresSplineHelper<T, N>::template evaluate_lie_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff, nullptr, nullptr, nullptr, &R_w_i);
+    residuals = T(inv_std) * (measurement_inv.template cast<T>() * R_w_i).log();
+    return true;
+  }
+
+  Sophus::SO3d measurement_inv;
+  double inv_std;
+  // blending coefficients, fixed per measurement
+  VecN so3_coeff;
+};
+
+/// @brief Reprojection residuals of all corners of a global shutter view
+/// with the camera model CameraModel, see CreateReprojectionCostFunction
+template <int _N, class CameraModel>
 struct GSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
   static constexpr int N = _N;        // Order of the spline.
   static constexpr int DEG = _N - 1;  // Degree of the spline.
@@ -189,20 +535,32 @@ struct GSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
   using Mat3 = Eigen::Matrix<double, 3, 3>;
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  GSReprojectionCostFunctorSplit(const theia::View* view,
-                                 const theia::Reconstruction* image_data,
-                                 const double u_so3,
-                                 const double u_r3,
-                                 const double inv_so3_dt,
-                                 const double inv_r3_dt,
-                                 std::vector<theia::TrackId> track_ids)
-      : view(view),
-        image_data(image_data),
+  GSReprojectionCostFunctorSplit(
+      std::shared_ptr<const ViewObservations> observations,
+      const double u_so3,
+      const double u_r3,
+      const double inv_so3_dt,
+      const double inv_r3_dt)
+      : observations(std::move(observations)),
         u_so3(u_so3),
-        u_r3(u_r3),
         inv_so3_dt(inv_so3_dt),
-        inv_r3_dt(inv_r3_dt),
-        track_ids(track_ids) {}
+        u_r3(u_r3),
+        inv_r3_dt(inv_r3_dt) {
+    so3_coeff =
+        CeresSplineHelper<double, N>::template coeffs<0, true>(u_so3,
+                                                               inv_so3_dt);
+    r3_coeff = CeresSplineHelper<double, N>::template coeffs<0, false>(
+        u_r3, inv_r3_dt);
+  }
+
+  //! N SO3 knots, N R3 knots, T_i_c and one scene point per corner
+  static std::vector<int> ParameterBlockSizes(const size_t nr_corners) {
+    std::vector<int> sizes(2 * N + 1 + nr_corners, 4);
+    std::fill_n(sizes.begin() + N, N, 3);
+    sizes[2 * N] = 7;
+    return sizes;
+  }
+
   template <class T>
   bool operator()(T const* const* sKnots, T* sResiduals) const {
     using Vector3 = Eigen::Matrix<T, 3, 1>;
@@ -212,85 +570,52 @@ struct GSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
     const int N2 = 2 * N;
     Eigen::Map<Sophus::SE3<T> const> const T_i_c(sKnots[N2]);
 
-    const auto cam = view->Camera();
-    const auto cam_model = cam.GetCameraIntrinsicsModelType();
-
-    T intr[10];
-    for (int i = 0; i < cam.CameraIntrinsics()->NumParameters(); ++i) {
-      intr[i] = T(cam.intrinsics()[i]);
-    }
-
-    const T t_so3_row = T(u_so3);
-    const T t_r3_row = T(u_r3);
+    const ViewObservations& obs = *observations;
+    const ViewIntrinsics<T> intr(obs);
 
     Sophus::SO3<T> R_w_i;
-    CeresSplineHelper<T, N>::template evaluate_lie<Sophus::SO3>(
-        sKnots, t_so3_row, T(inv_so3_dt), &R_w_i);
+    CeresSplineHelper<T, N>::template evaluate_lie_coeffs<Sophus::SO3>(
+        sKnots, so3_coeff, nullptr, nullptr, nullptr, &R_w_i);
 
     Vector3 t_w_i;
-    CeresSplineHelper<T, N>::template evaluate<3, 0>(
-        sKnots + N, t_r3_row, T(inv_r3_dt), &t_w_i);
+    CeresSplineHelper<T, N>::template evaluate_coeffs<3>(
+        sKnots + N, r3_coeff, &t_w_i);
 
     Sophus::SE3<T> T_w_c = Sophus::SE3<T>(R_w_i, t_w_i) * T_i_c;
     Matrix4 T_c_w_matrix = T_w_c.inverse().matrix();
 
-    for (size_t i = 0; i < track_ids.size(); ++i) {
-      const auto feature = *view->GetFeature(track_ids[i]);
-
+    for (size_t i = 0; i < obs.size(); ++i) {
       // get corresponding 3d point
       Eigen::Map<Vector4 const> const scene_point(sKnots[N2 + i]);
 
       Vector3 p3d = (T_c_w_matrix * scene_point).hnormalized();
 
       T reprojection[2];
-      bool success = false;
-      if (theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION ==
-          cam.GetCameraIntrinsicsModelType()) {
-        success =
-            theia::DivisionUndistortionCameraModel::CameraToPixelCoordinates(
-                intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::DOUBLE_SPHERE == cam_model) {
-        success = theia::DoubleSphereCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::PINHOLE == cam_model) {
-        success = theia::PinholeCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::FISHEYE == cam_model) {
-        success = theia::FisheyeCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::EXTENDED_UNIFIED ==
-                 cam_model) {
-        success = theia::ExtendedUnifiedCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::PINHOLE_RADIAL_TANGENTIAL ==
-                 cam_model) {
-        success =
-            theia::PinholeRadialTangentialCameraModel::CameraToPixelCoordinates(
-                intr, p3d.data(), reprojection);
-      }
-
-      if (!success) {
+      if (!CameraModel::CameraToPixelCoordinates(
+              intr.data(), p3d.data(), reprojection)) {
         sResiduals[2 * i + 0] = T(1e10);
         sResiduals[2 * i + 1] = T(1e10);
       } else {
-        const T inv_info_x = T(1. / ceres::sqrt(feature.covariance_(0, 0)));
-        const T inv_info_y = T(1. / ceres::sqrt(feature.covariance_(1, 1)));
-        sResiduals[2 * i + 0] = inv_info_x * (reprojection[0] - T(feature.x()));
-        sResiduals[2 * i + 1] = inv_info_y * (reprojection[1] - T(feature.y()));
+        const ViewObservations::Corner corner = obs.CornerAt(i);
+        sResiduals[2 * i + 0] = corner.inv_std_x * (reprojection[0] - corner.x);
+        sResiduals[2 * i + 1] = corner.inv_std_y * (reprojection[1] - corner.y);
       }
     }
     return true;
   }
-  const theia::View* view;
-  const theia::Reconstruction* image_data;
-  std::vector<theia::TrackId> track_ids;
+  std::shared_ptr<const ViewObservations> observations;
   double u_so3;
   double inv_so3_dt;
   double u_r3;
   double inv_r3_dt;
+  // blending coefficients, fixed per view
+  VecN so3_coeff;
+  VecN r3_coeff;
 };
 
-template <int _N>
+/// @brief Reprojection residuals of all corners of a rolling shutter view
+/// with the camera model CameraModel, see CreateReprojectionCostFunction
+template <int _N, class CameraModel>
 struct RSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
   static constexpr int N = _N;        // Order of the spline.
   static constexpr int DEG = _N - 1;  // Degree of the spline.
@@ -302,20 +627,71 @@ struct RSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
   using Mat3 = Eigen::Matrix<double, 3, 3>;
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  RSReprojectionCostFunctorSplit(const theia::View* view,
-                                 const theia::Reconstruction* image_data,
-                                 const double u_so3,
-                                 const double u_r3,
-                                 const double inv_so3_dt,
-                                 const double inv_r3_dt,
-                                 std::vector<theia::TrackId> track_ids)
-      : view(view),
-        image_data(image_data),
+  //! band_rows > 0 evaluates the spline pose only at row bands that are
+  //! band_rows apart and interpolates the pose of each corner in between.
+  //! The interpolation is linear over dt = band_rows * line_delay, so its
+  //! error is bounded by dt^2 / 8 times the maximum (angular) acceleration.
+  //! 0 evaluates the spline at the row of every corner.
+  RSReprojectionCostFunctorSplit(
+      std::shared_ptr<const ViewObservations> observations,
+      const double u_so3,
+      const double u_r3,
+      const double inv_so3_dt,
+      const double inv_r3_dt,
+      const double band_rows = 0.0)
+      : observations(std::move(observations)),
         u_so3(u_so3),
-        u_r3(u_r3),
         inv_so3_dt(inv_so3_dt),
-        inv_r3_dt(inv_r3_dt),
-        track_ids(track_ids) {}
+        u_r3(u_r3),
+        inv_r3_dt(inv_r3_dt) {
+    const ViewObservations& obs = *this->observations;
+    if (band_rows <= 0.0 || obs.size() == 0) return;
+    double y_min = obs.CornerAt(0).y;
+    double y_max = y_min;
+    for (size_t i = 1; i < obs.size(); ++i) {
+      y_min = std::min(y_min, obs.CornerAt(i).y);
+      y_max = std::max(y_max, obs.CornerAt(i).y);
+    }
+    const int nr_bands =
+        std::max(1, static_cast<int>(std::ceil((y_max - y_min) / band_rows)));
+    // only worth it if there are fewer band nodes than corners
+    if (static_cast<size_t>(nr_bands + 1) >= obs.size()) return;
+
+    band_rows_ = band_rows;
+    band_y_min_ = y_min;
+    nr_bands_ = nr_bands;
+    corner_band_.resize(obs.size());
+    corner_band_weight_.resize(obs.size());
+    for (size_t i = 0; i < obs.size(); ++i) {
+      const double y_rel = (obs.CornerAt(i).y - y_min) / band_rows;
+      const int band =
+          std::min(nr_bands - 1, static_cast<int>(std::floor(y_rel)));
+      corner_band_[i] = band;
+      corner_band_weight_[i] = y_rel - band;
+    }
+  }
+
+  //! N SO3 knots, N R3 knots, T_i_c, the line delay and one scene point per
+  //! corner
+  static std::vector<int> ParameterBlockSizes(const size_t nr_corners) {
+    std::vector<int> sizes(2 * N + 2 + nr_corners, 4);
+    std::fill_n(sizes.begin() + N, N, 3);
+    sizes[2 * N] = 7;
+    sizes[2 * N + 1] = 1;
+    return sizes;
+  }
+
+  template <class T>
+  void EvaluatePoseAtRow(T const* const* sKnots,
+                         const T& row_time,
+                         Sophus::SO3<T>* R_w_i,
+                         Eigen::Matrix<T, 3, 1>* t_w_i) const {
+    CeresSplineHelper<T, N>::template evaluate_lie<Sophus::SO3>(
+        sKnots, T(u_so3) + row_time, T(inv_so3_dt), R_w_i);
+    CeresSplineHelper<T, N>::template evaluate<3, 0>(
+        sKnots + N, T(u_r3) + row_time, T(inv_r3_dt), t_w_i);
+  }
+
   template <class T>
   bool operator()(T const* const* sKnots, T* sResiduals) const {
     using Vector3 = Eigen::Matrix<T, 3, 1>;
@@ -327,31 +703,45 @@ struct RSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
     Eigen::Map<Sophus::SE3<T> const> const T_i_c(sKnots[N2]);
     Eigen::Map<Vector1 const> const line_delay(sKnots[N2 + 1]);
 
-    const auto cam = view->Camera();
-    const auto cam_model = cam.GetCameraIntrinsicsModelType();
-
-    T intr[10];
-    for (int i = 0; i < cam.CameraIntrinsics()->NumParameters(); ++i) {
-      intr[i] = T(cam.intrinsics()[i]);
+    const ViewObservations& obs = *observations;
+    const ViewIntrinsics<T> intr(obs);
+
+    // pose at the band nodes and the relative motion to the next node
+    const bool banded = nr_bands_ > 0;
+    OpenICC::aligned_vector<Sophus::SO3<T>> band_R;
+    OpenICC::aligned_vector<Vector3> band_rot_delta;
+    OpenICC::aligned_vector<Vector3> band_t;
+    OpenICC::aligned_vector<Vector3> band_t_delta;
+    if (banded) {
+      band_R.resize(nr_bands_ + 1);
+      band_t.resize(nr_bands_ + 1);
+      for (int k = 0; k <= nr_bands_; ++k) {
+        const T y_coord = T(band_y_min_ + k * band_rows_) * line_delay[0];
+        EvaluatePoseAtRow(sKnots, y_coord, &band_R[k], &band_t[k]);
+      }
+      band_rot_delta.resize(nr_bands_);
+      band_t_delta.resize(nr_bands_);
+      for (int k = 0; k < nr_bands_; ++k) {
+        band_rot_delta[k] = (band_R[k].inverse() * band_R[k + 1]).log();
+        band_t_delta[k] = band_t[k + 1] - band_t[k];
+      }
     }
 
     // if we have a rolling shutter cam we will always need to evaluate with
     // line delay
-    for (size_t i = 0; i < track_ids.size(); ++i) {
-      const auto feature = *view->GetFeature(track_ids[i]);
-
-      // get time for respective RS line
-      const T y_coord = T(feature.y()) * line_delay[0];
-      const T t_so3_row = T(u_so3) + y_coord;
-      const T t_r3_row = T(u_r3) + y_coord;
-
+    for (size_t i = 0; i < obs.size(); ++i) {
       Sophus::SO3<T> R_w_i;
-      CeresSplineHelper<T, N>::template evaluate_lie<Sophus::SO3>(
-          sKnots, t_so3_row, T(inv_so3_dt), &R_w_i);
-
       Vector3 t_w_i;
-      CeresSplineHelper<T, N>::template evaluate<3, 0>(
-          sKnots + N, t_r3_row, T(inv_r3_dt), &t_w_i);
+      if (banded) {
+        const int k = corner_band_[i];
+        const T w(corner_band_weight_[i]);
+        R_w_i = band_R[k] * Sophus::SO3<T>::exp(w * band_rot_delta[k]);
+        t_w_i = band_t[k] + w * band_t_delta[k];
+      } else {
+        // get time for respective RS line
+        const T y_coord = T(obs.CornerAt(i).y) * line_delay[0];
+        EvaluatePoseAtRow(sKnots, y_coord, &R_w_i, &t_w_i);
+      }
 
       Sophus::SE3<T> T_w_c = Sophus::SE3<T>(R_w_i, t_w_i) * T_i_c;
       Matrix4 T_c_w_matrix = T_w_c.inverse().matrix();
@@ -362,53 +752,55 @@ struct RSReprojectionCostFunctorSplit : public CeresSplineHelper<double, _N> {
       Vector3 p3d = (T_c_w_matrix * scene_point).hnormalized();
 
       T reprojection[2];
-      bool success = false;
-      if (theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION ==
-          cam.GetCameraIntrinsicsModelType()) {
-        success =
-            theia::DivisionUndistortionCameraModel::CameraToPixelCoordinates(
-                intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::DOUBLE_SPHERE == cam_model) {
-        success = theia::DoubleSphereCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::PINHOLE == cam_model) {
-        success = theia::PinholeCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::FISHEYE == cam_model) {
-        success = theia::FisheyeCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::EXTENDED_UNIFIED ==
-                 cam_model) {
-        success = theia::ExtendedUnifiedCameraModel::CameraToPixelCoordinates(
-            intr, p3d.data(), reprojection);
-      } else if (theia::CameraIntrinsicsModelType::PINHOLE_RADIAL_TANGENTIAL ==
-                 cam_model) {
-        success =
-            theia::PinholeRadialTangentialCameraModel::CameraToPixelCoordinates(
-                intr, p3d.data(), reprojection);
-      }
-
-      if (!success) {
+      if (!CameraModel::CameraToPixelCoordinates(
+              intr.data(), p3d.data(), reprojection)) {
         sResiduals[2 * i + 0] = T(1e10);
         sResiduals[2 * i + 1] = T(1e10);
       } else {
-        const T inv_info_x = T(1. / ceres::sqrt(feature.covariance_(0, 0)));
-        const T inv_info_y = T(1. / ceres::sqrt(feature.covariance_(1, 1)));
-        sResiduals[2 * i + 0] = inv_info_x * (reprojection[0] - T(feature.x()));
-        sResiduals[2 * i + 1] = inv_info_y * (reprojection[1] - T(feature.y()));
+        const ViewObservations::Corner corner = obs.CornerAt(i);
+        sResiduals[2 * i + 0] = corner.inv_std_x * (reprojection[0] - corner.x);
+        sResiduals[2 * i + 1] = corner.inv_std_y * (reprojection[1] - corner.y);
       }
     }
     return true;
   }
-  const theia::View* view;
-  const theia::Reconstruction* image_data;
-  std::vector<theia::TrackId> track_ids;
+  std::shared_ptr<const ViewObservations> observations;
   double u_so3;
   double inv_so3_dt;
   double u_r3;
   double inv_r3_dt;
+
+  // row banding, nr_bands_ == 0 if every corner is evaluated exactly
+  double band_rows_ = 0.0;
+  double band_y_min_ = 0.0;
+  int nr_bands_ = 0;
+  std::vector<int> corner_band_;
+  std::vector<double> corner_band_weight_;
 };
 
+/// @brief DynamicAutoDiffCostFunction of Functor<N, CameraModel> for the
+/// camera model of observations, with the parameter blocks and residuals of
+/// all its corners. The functor is constructed from observations and args.
+/// nullptr if the camera model is not supported
+template <template <int, class> class Functor, int N, class... Args>
+ceres::CostFunction* CreateReprojectionCostFunction(
+    const std::shared_ptr<const ViewObservations>& observations,
+    const Args&... args) {
+  ceres::CostFunction* cost_function = nullptr;
+  DispatchCameraModel(observations->camera_model, [&](auto tag) {
+    using FunctorT = Functor<N, typename decltype(tag)::type>;
+    auto* dynamic_cost_function =
+        new ceres::DynamicAutoDiffCostFunction<FunctorT>(
+            new FunctorT(observations, args...));
+    for (const int size : FunctorT::ParameterBlockSizes(observations->size())) {
+      dynamic_cost_function->AddParameterBlock(size);
+    }
+    dynamic_cost_function->SetNumResiduals(2 * observations->size());
+    cost_function = dynamic_cost_function;
+  });
+  return cost_function;
+}
+
 // template <int _N>
 // struct RSInvDepthReprojCostFunctorSplit : public CeresSplineHelper<double,
 // _N> {
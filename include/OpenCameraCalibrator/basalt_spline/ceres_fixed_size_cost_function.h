@@ -0,0 +1,167 @@
+#pragma once
+
+#include "ceres_calib_split_residuals.h"
+
+#include "OpenCameraCalibrator/utils/monotonic_arena.h"
+
+#include <ceres/ceres.h>
+
+#include <memory>
+#include <tuple>
+#include <utility>
+
+// Compile time sized autodiff cost functions for the spline functors in
+// ceres_calib_split_residuals.h. The functors take an array of knot pointers
+// (T const* const*), which is what DynamicAutoDiffCostFunction hands them.
+// As the spline order N is a template parameter, the block layout is known at
+// compile time and we can use ceres::AutoDiffCostFunction instead, which
+// evaluates on stack allocated jets without dynamic chunking.
+
+/// @brief List of parameter block sizes
+template <int... Ns>
+struct BlockSizes {};
+
+template <class A, class B>
+struct ConcatBlockSizes;
+
+template <int... As, int... Bs>
+struct ConcatBlockSizes<BlockSizes<As...>, BlockSizes<Bs...>> {
+  using type = BlockSizes<As..., Bs...>;
+};
+
+/// @brief Count parameter blocks of size Size
+template <int Size, int Count>
+struct RepeatBlockSizes {
+  using type = typename ConcatBlockSizes<
+      BlockSizes<Size>,
+      typename RepeatBlockSizes<Size, Count - 1>::type>::type;
+};
+
+template <int Size>
+struct RepeatBlockSizes<Size, 0> {
+  using type = BlockSizes<>;
+};
+
+template <class... Lists>
+struct JoinBlockSizes;
+
+template <class List>
+struct JoinBlockSizes<List> {
+  using type = List;
+};
+
+template <class List, class... Lists>
+struct JoinBlockSizes<List, Lists...> {
+  using type =
+      typename ConcatBlockSizes<List,
+                                typename JoinBlockSizes<Lists...>::type>::type;
+};
+
+/// @brief Adapts a knot array functor to the per block argument list that
+/// ceres::AutoDiffCostFunction expects
+template <class Functor, int kNumBlocks>
+class KnotArrayFunctorAdapter {
+ public:
+  explicit KnotArrayFunctorAdapter(
+      Functor* functor,
+      const ceres::Ownership ownership = ceres::TAKE_OWNERSHIP)
+      : functor_(functor), ownership_(ownership) {}
+  ~KnotArrayFunctorAdapter() {
+    if (ownership_ == ceres::TAKE_OWNERSHIP) delete functor_;
+  }
+
+  KnotArrayFunctorAdapter(const KnotArrayFunctorAdapter&) = delete;
+  KnotArrayFunctorAdapter& operator=(const KnotArrayFunctorAdapter&) = delete;
+
+  template <typename... Args>
+  bool operator()(Args... args) const {
+    static_assert(sizeof...(Args) == kNumBlocks + 1,
+                  "Wrong number of parameter blocks");
+    return Call(std::make_index_sequence<kNumBlocks>(),
+                std::tuple<Args...>(args...));
+  }
+
+ private:
+  template <typename Tuple, size_t... Is>
+  bool Call(std::index_sequence<Is...>, const Tuple& args) const {
+    using T = typename std::remove_pointer<
+        typename std::tuple_element<kNumBlocks, Tuple>::type>::type;
+    T const* const knots[] = {std::get<Is>(args)...};
+    return (*functor_)(knots, std::get<kNumBlocks>(args));
+  }
+
+  Functor* functor_;
+  ceres::Ownership ownership_;
+};
+
+template <class Functor, int kNumResiduals, class Sizes>
+struct FixedSizeCostFunctionHelper;
+
+template <class Functor, int kNumResiduals, int... Ns>
+struct FixedSizeCostFunctionHelper<Functor, kNumResiduals, BlockSizes<Ns...>> {
+  using Adapter = KnotArrayFunctorAdapter<Functor, sizeof...(Ns)>;
+  using type = ceres::AutoDiffCostFunction<Adapter, kNumResiduals, Ns...>;
+
+  static type* Create(Functor* functor) {
+    return new type(new Adapter(functor));
+  }
+
+  static type* Create(OpenICC::utils::MonotonicArena& arena,
+                      Functor* functor) {
+    return arena.Create<type>(
+        arena.Create<Adapter>(functor, ceres::DO_NOT_TAKE_OWNERSHIP),
+        ceres::DO_NOT_TAKE_OWNERSHIP);
+  }
+};
+
+/// @brief ceres::AutoDiffCostFunction for a knot array functor with the
+/// parameter block layout Sizes. Takes ownership of the functor.
+template <int kNumResiduals, class Sizes, class Functor>
+ceres::CostFunction* CreateFixedSizeCostFunction(Functor* functor) {
+  return FixedSizeCostFunctionHelper<Functor, kNumResiduals, Sizes>::Create(
+      functor);
+}
+
+/// @brief Same as above, but the functor, the adapter and the cost function
+/// are all constructed in arena and live until it is cleared. The problem must
+/// not take ownership of the cost function.
+template <int kNumResiduals, class Sizes, class Functor, class... Args>
+ceres::CostFunction* CreateFixedSizeCostFunction(
+    OpenICC::utils::MonotonicArena& arena, Args&&... args) {
+  return FixedSizeCostFunctionHelper<Functor, kNumResiduals, Sizes>::Create(
+      arena, arena.Create<Functor>(std::forward<Args>(args)...));
+}
+
+/// @brief Block layout of AccelerationCostFunctorSplit: N so3 knots, N r3
+/// knots, bias knots, gravity and the accelerometer intrinsics
+template <int N>
+using AccelerationBlockSizes =
+    typename JoinBlockSizes<typename RepeatBlockSizes<4, N>::type,
+                            typename RepeatBlockSizes<3, N>::type,
+                            typename RepeatBlockSizes<3, BIAS_SPLINE_N>::type,
+                            BlockSizes<3, 6>>::type;
+
+/// @brief Block layout of GyroCostFunctorSplit: N so3 knots, bias knots and
+/// the gyroscope intrinsics
+template <int N>
+using GyroBlockSizes =
+    typename JoinBlockSizes<typename RepeatBlockSizes<4, N>::type,
+                            typename RepeatBlockSizes<3, BIAS_SPLINE_N>::type,
+                            BlockSizes<9>>::type;
+
+/// @brief Block layout of ImuCostFunctorSplit: N so3 knots, N r3 knots,
+/// accelerometer and gyroscope bias knots, gravity and both intrinsics
+template <int N>
+using ImuBlockSizes = typename JoinBlockSizes<
+    typename RepeatBlockSizes<4, N>::type,
+    typename RepeatBlockSizes<3, N>::type,
+    typename RepeatBlockSizes<3, 2 * BIAS_SPLINE_N>::type,
+    BlockSizes<3, 6, 9>>::type;
+
+/// @brief Block layout of PositionCostFunctorSplit: N r3 knots
+template <int N>
+using PositionBlockSizes = typename RepeatBlockSizes<3, N>::type;
+
+/// @brief Block layout of OrientationCostFunctorSplit: N so3 knots
+template <int N>
+using OrientationBlockSizes = typename RepeatBlockSizes<4, N>::type;
@@ -53,6 +53,13 @@ struct CeresSplineHelper {
   using MatN = Eigen::Matrix<T, _N, _N>;
   using VecN = Eigen::Matrix<T, _N, 1>;
 
+  /// Pointer to precomputed coefficients. S is only deduced from the value
+  /// coefficients, so the derivative coefficients can be passed as nullptr.
+  template <class S>
+  struct CoeffPtr {
+    using type = const Eigen::Matrix<S, _N, 1>*;
+  };
+
   static const MatN blending_matrix_;
   static const MatN cumulative_blending_matrix_;
   static const MatN base_coefficients_;
@@ -86,6 +93,25 @@ struct CeresSplineHelper {
     }
   }
 
+  /// @brief Blending coefficients of the DERIV-th time derivative.
+  ///
+  /// The coefficients only depend on the normalized time, so residuals with a
+  /// fixed u can compute them once and use evaluate_lie_coeffs /
+  /// evaluate_coeffs.
+  /// @param[in] u normalized time
+  /// @param[in] inv_dt inverse of the time spacing in seconds between spline
+  /// knots
+  /// @tparam CUMULATIVE cumulative (Lie group) or standard (Euclidean) basis
+  template <int DERIV, bool CUMULATIVE>
+  static inline VecN coeffs(const T u, const T inv_dt) {
+    VecN p;
+    baseCoeffsWithTime<DERIV>(p, u);
+    T scale = T(1);
+    for (int i = 0; i < DERIV; i++) scale = scale * inv_dt;
+    return scale *
+           (CUMULATIVE ? cumulative_blending_matrix_ : blending_matrix_) * p;
+  }
+
   /// @brief Evaluate Lie group cummulative B-spline and time derivatives.
   ///
   /// @param[in] sKnots array of pointers of the spline knots. The size of each
@@ -107,35 +133,94 @@ struct CeresSplineHelper {
       typename GroupT<T>::Tangent* vel_out = nullptr,
       typename GroupT<T>::Tangent* accel_out = nullptr,
       typename GroupT<T>::Tangent* jerk_out = nullptr) {
-    using Group = GroupT<T>;
-    using Tangent = typename GroupT<T>::Tangent;
-    using Adjoint = typename GroupT<T>::Adjoint;
-
-    VecN p, coeff, dcoeff, ddcoeff, dddcoeff;
-
-    CeresSplineHelper<T, N>::template baseCoeffsWithTime<0>(p, u);
-    coeff = CeresSplineHelper<T, N>::cumulative_blending_matrix_ * p;
+    VecN coeff, dcoeff, ddcoeff, dddcoeff;
 
+    coeff = coeffs<0, true>(u, inv_dt);
     if (vel_out || accel_out || jerk_out) {
-      CeresSplineHelper<T, N>::template baseCoeffsWithTime<1>(p, u);
-      dcoeff =
-          inv_dt * CeresSplineHelper<T, N>::cumulative_blending_matrix_ * p;
-
+      dcoeff = coeffs<1, true>(u, inv_dt);
       if (accel_out || jerk_out) {
-        CeresSplineHelper<T, N>::template baseCoeffsWithTime<2>(p, u);
-        ddcoeff = inv_dt * inv_dt *
-                  CeresSplineHelper<T, N>::cumulative_blending_matrix_ * p;
-
+        ddcoeff = coeffs<2, true>(u, inv_dt);
         if (jerk_out) {
-          CeresSplineHelper<T, N>::template baseCoeffsWithTime<3>(p, u);
-          dddcoeff = inv_dt * inv_dt * inv_dt *
-                     CeresSplineHelper<T, N>::cumulative_blending_matrix_ * p;
+          dddcoeff = coeffs<3, true>(u, inv_dt);
         }
       }
     }
 
+    evaluate_lie_coeffs<GroupT>(sKnots,
+                                coeff,
+                                &dcoeff,
+                                &ddcoeff,
+                                &dddcoeff,
+                                transform_out,
+                                vel_out,
+                                accel_out,
+                                jerk_out);
+  }
+
+  /// @brief Evaluate Lie group cummulative B-spline and time derivatives with
+  /// precomputed coefficients (see coeffs<DERIV, true>).
+  ///
+  /// The coefficients may be of a different scalar type than the knots, e.g.
+  /// double coefficients with Jet knots, which saves the polynomial
+  /// evaluation on Jets. dcoeff, ddcoeff and dddcoeff are only
+  /// read if the respective derivative is requested.
+  template <template <class> class GroupT, class S>
+  static inline void evaluate_lie_coeffs(
+      T const* const* sKnots,
+      const Eigen::Matrix<S, N, 1>& coeff,
+      typename CoeffPtr<S>::type dcoeff_ptr,
+      typename CoeffPtr<S>::type ddcoeff_ptr,
+      typename CoeffPtr<S>::type dddcoeff_ptr,
+      GroupT<T>* transform_out = nullptr,
+      typename GroupT<T>::Tangent* vel_out = nullptr,
+      typename GroupT<T>::Tangent* accel_out = nullptr,
+      typename GroupT<T>::Tangent* jerk_out = nullptr) {
+    using Group = GroupT<T>;
+    using Tangent = typename GroupT<T>::Tangent;
+
+    Eigen::Map<Group const> const p00(sKnots[0]);
+    Tangent deltas[DEG];
+    for (int i = 0; i < DEG; i++) {
+      Eigen::Map<Group const> const p0(sKnots[i]);
+      Eigen::Map<Group const> const p1(sKnots[i + 1]);
+      deltas[i] = (p0.inverse() * p1).log();
+    }
+
+    evaluate_lie_deltas<GroupT>(Group(p00),
+                                deltas,
+                                coeff,
+                                dcoeff_ptr,
+                                ddcoeff_ptr,
+                                dddcoeff_ptr,
+                                transform_out,
+                                vel_out,
+                                accel_out,
+                                jerk_out);
+  }
+
+  /// @brief Evaluate Lie group cummulative B-spline and time derivatives with
+  /// precomputed coefficients and knot increments.
+  ///
+  /// The increments deltas[i] = log(p_i^-1 * p_i+1) of the DEG knot pairs and
+  /// the first knot p00 only depend on the segment, so evaluations at many
+  /// times in the same segment can compute them once.
+  template <template <class> class GroupT, class S>
+  static inline void evaluate_lie_deltas(
+      const GroupT<T>& p00,
+      typename GroupT<T>::Tangent const* deltas,
+      const Eigen::Matrix<S, N, 1>& coeff,
+      typename CoeffPtr<S>::type dcoeff_ptr,
+      typename CoeffPtr<S>::type ddcoeff_ptr,
+      typename CoeffPtr<S>::type dddcoeff_ptr,
+      GroupT<T>* transform_out = nullptr,
+      typename GroupT<T>::Tangent* vel_out = nullptr,
+      typename GroupT<T>::Tangent* accel_out = nullptr,
+      typename GroupT<T>::Tangent* jerk_out = nullptr) {
+    using Group = GroupT<T>;
+    using Tangent = typename GroupT<T>::Tangent;
+    using Adjoint = typename GroupT<T>::Adjoint;
+
     if (transform_out) {
-      Eigen::Map<Group const> const p00(sKnots[0]);
       *transform_out = p00;
     }
 
@@ -146,35 +231,34 @@ struct CeresSplineHelper {
     if (jerk_out) rot_jerk.setZero();
 
     for (int i = 0; i < DEG; i++) {
-      Eigen::Map<Group const> const p0(sKnots[i]);
-      Eigen::Map<Group const> const p1(sKnots[i + 1]);
-
-      Group r01 = p0.inverse() * p1;
-      Tangent delta = r01.log();
+      const Tangent& delta = deltas[i];
 
       Group exp_kdelta = Group::exp(delta * coeff[i + 1]);
 
       if (transform_out) (*transform_out) *= exp_kdelta;
 
       if (vel_out || accel_out || jerk_out) {
+        const S dcoeff = (*dcoeff_ptr)[i + 1];
         Adjoint A = exp_kdelta.inverse().Adj();
 
         rot_vel = A * rot_vel;
-        Tangent rot_vel_current = delta * dcoeff[i + 1];
+        Tangent rot_vel_current = delta * dcoeff;
         rot_vel += rot_vel_current;
 
         if (accel_out || jerk_out) {
+          const S ddcoeff = (*ddcoeff_ptr)[i + 1];
           rot_accel = A * rot_accel;
           Tangent accel_lie_bracket =
               Group::lieBracket(rot_vel, rot_vel_current);
-          rot_accel += ddcoeff[i + 1] * delta + accel_lie_bracket;
+          rot_accel += ddcoeff * delta + accel_lie_bracket;
 
           if (jerk_out) {
+            const S dddcoeff = (*dddcoeff_ptr)[i + 1];
             rot_jerk = A * rot_jerk;
-            rot_jerk += dddcoeff[i + 1] * delta +
-                        Group::lieBracket(ddcoeff[i + 1] * rot_vel +
-                                              T(2) * dcoeff[i + 1] * rot_accel -
-                                              dcoeff[i + 1] * accel_lie_bracket,
+            rot_jerk += dddcoeff * delta +
+                        Group::lieBracket(ddcoeff * rot_vel +
+                                              T(2) * dcoeff * rot_accel -
+                                              dcoeff * accel_lie_bracket,
                                           delta);
           }
         }
@@ -201,14 +285,19 @@ struct CeresSplineHelper {
                               const T inv_dt,
                               Eigen::Matrix<T, DIM, 1>* vec_out) {
     if (!vec_out) return;
+    const VecN coeff = coeffs<DERIV, false>(u, inv_dt);
+    evaluate_coeffs<DIM>(sKnots, coeff, vec_out);
+  }
 
-    using VecD = Eigen::Matrix<T, DIM, 1>;
-
-    VecN p, coeff;
+  /// @brief Evaluate Euclidean B-spline or time derivatives with precomputed
+  /// coefficients (see coeffs<DERIV, false>).
+  template <int DIM, class S>
+  static inline void evaluate_coeffs(T const* const* sKnots,
+                                     const Eigen::Matrix<S, N, 1>& coeff,
+                                     Eigen::Matrix<T, DIM, 1>* vec_out) {
+    if (!vec_out) return;
 
-    CeresSplineHelper<T, N>::template baseCoeffsWithTime<DERIV>(p, u);
-    coeff = ceres::pow(inv_dt, DERIV) *
-            CeresSplineHelper<T, N>::blending_matrix_ * p;
+    using VecD = Eigen::Matrix<T, DIM, 1>;
 
     vec_out->setZero();
 
@@ -287,6 +287,92 @@ class RdSpline {
     return evaluate<2>(time_ns, J);
   }
 
+  /// @brief Polynomial of one segment
+  ///
+  /// In segment s the spline is the polynomial \f$ p(u) = C (1, u, \dots,
+  /// u^{N-1})^T \f$ with \f$ C = (p_s, \dots, p_{s+N-1}) M_N \f$. With C
+  /// cached, queries into the same segment skip the knot blending.
+  struct SegmentCache {
+    int64_t segment = -1;  ///< Cached segment, -1 if empty
+    Eigen::Matrix<_Scalar, _DIM, _N> poly;  ///< \f$ C \f$
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /// @brief Evaluate value and derivatives of the spline using a segment
+  /// cache
+  ///
+  /// The cache is updated if time_ns lies in a different segment than the
+  /// cached one.
+  ///
+  /// @param[in] time_ns time for evaluating the spline in nanoseconds
+  /// @param[in,out] cache segment cache, may be shared by subsequent calls
+  /// @param[out] pos if not nullptr, return the value of the spline
+  /// @param[out] vel if not nullptr, return the first derivative
+  /// @param[out] accel if not nullptr, return the second derivative
+  void evaluateCached(int64_t time_ns, SegmentCache& cache, VecD* pos,
+                      VecD* vel = nullptr, VecD* accel = nullptr) const {
+    int64_t st_ns = (time_ns - start_t_ns);
+
+    BASALT_ASSERT_STREAM(st_ns >= 0,
+                         "st_ns " << st_ns << " time_ns " << time_ns
+                                  << " start_t_ns " << start_t_ns);
+
+    int64_t s = st_ns / dt_ns;
+    double u = double(st_ns % dt_ns) / double(dt_ns);
+
+    BASALT_ASSERT_STREAM(s >= 0, "s " << s);
+    BASALT_ASSERT_STREAM(
+        size_t(s + N) <= knots.size(),
+        "s " << s << " N " << N << " knots.size() " << knots.size());
+
+    if (cache.segment != s) {
+      cache.segment = s;
+      cache.poly.setZero();
+      for (int i = 0; i < N; i++) {
+        cache.poly += knots[s + i] * blending_matrix_.row(i);
+      }
+    }
+
+    VecN p;
+    if (pos) {
+      baseCoeffsWithTime<0>(p, u);
+      *pos = cache.poly * p;
+    }
+    if (vel) {
+      baseCoeffsWithTime<1>(p, u);
+      *vel = pow_inv_dt[1] * (cache.poly * p);
+    }
+    if (accel) {
+      baseCoeffsWithTime<2>(p, u);
+      *accel = pow_inv_dt[2] * (cache.poly * p);
+    }
+  }
+
+  /// @brief Evaluate the spline at many times into preallocated arrays
+  ///
+  /// The times are split into chunks of consecutive entries that are
+  /// evaluated on num_threads threads, every chunk with its own \ref
+  /// SegmentCache.
+  ///
+  /// @param[in] times_ns n times in nanoseconds
+  /// @param[in] n number of times
+  /// @param[out] pos if not nullptr, array of n values of the spline
+  /// @param[out] vel if not nullptr, array of n first derivatives
+  /// @param[out] accel if not nullptr, array of n second derivatives
+  /// @param[in] num_threads number of threads
+  void evaluateSpan(const int64_t* times_ns, size_t n, VecD* pos,
+                    VecD* vel = nullptr, VecD* accel = nullptr,
+                    int num_threads = 1) const {
+    parallelForSpanChunks(n, num_threads, [&](size_t begin, size_t end) {
+      SegmentCache cache;
+      for (size_t i = begin; i < end; i++) {
+        evaluateCached(times_ns[i], cache, pos ? pos + i : nullptr,
+                       vel ? vel + i : nullptr, accel ? accel + i : nullptr);
+      }
+    });
+  }
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  protected:
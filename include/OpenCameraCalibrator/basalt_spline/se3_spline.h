@@ -42,8 +42,6 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "rd_spline.h"
 #include "so3_spline.h"
 
-#include "calib_bias.h"
-
 #include <array>
 
 /// @brief Uniform B-spline for SE(3) of order N. Internally uses an SO(3) (\ref
@@ -362,122 +360,6 @@ class Se3Spline {
     J.template tail<3>() = rotVelBody(time_ns);
   }
 
-  /// @brief Evaluate gyroscope residual.
-  ///
-  /// @param[in] time_ns time of the measurement
-  /// @param[in] measurement gyroscope measurement
-  /// @param[in] gyro_bias_full gyroscope calibration
-  /// @return gyroscope residual
-  Vec3 gyroResidual(int64_t time_ns,
-                    const Vec3& measurement,
-                    const CalibGyroBias<_Scalar>& gyro_bias_full) const {
-    return so3_spline.velocityBody(time_ns) -
-           gyro_bias_full.getCalibrated(measurement);
-  }
-
-  /// @brief Evaluate gyroscope residual and compute Jacobians.
-  ///
-  /// @param[in] time_ns time of the measurement
-  /// @param[in] measurement gyroscope measurement
-  /// @param[in] gyro_bias_full gyroscope calibration
-  /// @param[out] J_knots Jacobian with respect to SO(3) spline knots
-  /// @param[out] J_bias Jacobian with respect to gyroscope calibration
-  /// @return gyroscope residual
-  Vec3 gyroResidual(int64_t time_ns,
-                    const Vec3& measurement,
-                    const CalibGyroBias<_Scalar>& gyro_bias_full,
-                    SO3JacobianStruct* J_knots,
-                    Mat312* J_bias = nullptr) const {
-    if (J_bias) {
-      J_bias->setZero();
-      J_bias->template block<3, 3>(0, 0).diagonal().array() = 1.0;
-      J_bias->template block<3, 3>(0, 3).diagonal().array() = -measurement[0];
-      J_bias->template block<3, 3>(0, 6).diagonal().array() = -measurement[1];
-      J_bias->template block<3, 3>(0, 9).diagonal().array() = -measurement[2];
-    }
-
-    return so3_spline.velocityBody(time_ns, J_knots) -
-           gyro_bias_full.getCalibrated(measurement);
-  }
-
-  /// @brief Evaluate accelerometer residual.
-  ///
-  /// @param[in] time_ns time of the measurement
-  /// @param[in] measurement accelerometer measurement
-  /// @param[in] accel_bias_full accelerometer calibration
-  /// @param[in] g gravity
-  /// @return accelerometer residual
-  Vec3 accelResidual(int64_t time_ns,
-                     const Eigen::Vector3d& measurement,
-                     const CalibAccelBias<_Scalar>& accel_bias_full,
-                     const Eigen::Vector3d& g) const {
-    Sophus::SO3d R = so3_spline.evaluate(time_ns);
-    Eigen::Vector3d accel_world = pos_spline.acceleration(time_ns);
-
-    return R.inverse() * (accel_world + g) -
-           accel_bias_full.getCalibrated(measurement);
-  }
-
-  /// @brief Evaluate accelerometer residual and Jacobians.
-  ///
-  /// @param[in] time_ns time of the measurement
-  /// @param[in] measurement accelerometer measurement
-  /// @param[in] accel_bias_full accelerometer calibration
-  /// @param[in] g gravity
-  /// @param[out] J_knots Jacobian with respect to spline knots
-  /// @param[out] J_bias Jacobian with respect to accelerometer calibration
-  /// @param[out] J_g Jacobian with respect to gravity
-  /// @return accelerometer residual
-  Vec3 accelResidual(int64_t time_ns,
-                     const Vec3& measurement,
-                     const CalibAccelBias<_Scalar>& accel_bias_full,
-                     const Vec3& g,
-                     AccelPosSO3JacobianStruct* J_knots,
-                     Mat39* J_bias = nullptr,
-                     Mat3* J_g = nullptr) const {
-    typename So3Spline<_N, _Scalar>::JacobianStruct Jr;
-    typename RdSpline<3, N, _Scalar>::JacobianStruct Jp;
-
-    Sophus::SO3d R = so3_spline.evaluate(time_ns, &Jr);
-    Eigen::Vector3d accel_world = pos_spline.acceleration(time_ns, &Jp);
-
-    Eigen::Matrix3d RT = R.inverse().matrix();
-    Eigen::Matrix3d tmp = RT * Sophus::SO3d::hat(accel_world + g);
-
-    BASALT_ASSERT_STREAM(
-        Jr.start_idx == Jp.start_idx,
-        "Jr.start_idx " << Jr.start_idx << " Jp.start_idx " << Jp.start_idx);
-
-    BASALT_ASSERT_STREAM(
-        so3_spline.getKnots().size() == pos_spline.getKnots().size(),
-        "so3_spline.getKnots().size() " << so3_spline.getKnots().size()
-                                        << " pos_spline.getKnots().size() "
-                                        << pos_spline.getKnots().size());
-
-    J_knots->start_idx = Jp.start_idx;
-    for (int i = 0; i < N; i++) {
-      J_knots->d_val_d_knot[i].template topLeftCorner<3, 3>() =
-          RT * Jp.d_val_d_knot[i];
-      J_knots->d_val_d_knot[i].template bottomRightCorner<3, 3>() =
-          tmp * Jr.d_val_d_knot[i];
-    }
-
-    if (J_bias) {
-      J_bias->setZero();
-      J_bias->template block<3, 3>(0, 0).diagonal().array() = 1.0;
-      J_bias->template block<3, 3>(0, 3).diagonal().array() = -measurement[0];
-      (*J_bias)(1, 6) = -measurement[1];
-      (*J_bias)(2, 7) = -measurement[1];
-      (*J_bias)(2, 8) = -measurement[2];
-    }
-    if (J_g) (*J_g) = RT;
-
-    Vec3 res =
-        RT * (accel_world + g) - accel_bias_full.getCalibrated(measurement);
-
-    return res;
-  }
-
   /// @brief Evaluate position residual.
   ///
   /// @param[in] time_ns time of the measurement
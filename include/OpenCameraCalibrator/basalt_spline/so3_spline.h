@@ -710,6 +710,129 @@ class So3Spline {
     return rot_jerk;
   }
 
+  /// @brief Knot values of one segment that do not depend on the time inside
+  /// the segment
+  ///
+  /// All evaluations in segment s use the first knot \f$ R_s \f$ and the
+  /// increments \f$ d_j = \log(R_{s+j-1}^{-1}R_{s+j}) \f$. Keeping them
+  /// saves DEG logarithms per query into the same segment.
+  struct SegmentCache {
+    int64_t segment = -1;  ///< Cached segment, -1 if empty
+    SO3 first_knot;        ///< \f$ R_s \f$
+    std::array<Vec3, DEG> delta;  ///< \f$ d_1, \dots, d_{DEG} \f$
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /// @brief Evaluate value and body frame derivatives of the spline using a
+  /// segment cache
+  ///
+  /// The cache is updated if time_ns lies in a different segment than the
+  /// cached one. Leaves the results of \ref evaluate, \ref velocityBody
+  /// and \ref accelerationBody unchanged.
+  ///
+  /// @param[in] time_ns time for evaluating the spline in nanoseconds
+  /// @param[in,out] cache segment cache, may be shared by subsequent calls
+  /// @param[out] rot if not nullptr, return the value of the spline
+  /// @param[out] vel_body if not nullptr, return the rotational velocity in
+  /// the body frame
+  /// @param[out] accel_body if not nullptr, return the rotational
+  /// acceleration in the body frame
+  void evaluateCached(int64_t time_ns, SegmentCache& cache, SO3* rot,
+                      Vec3* vel_body = nullptr,
+                      Vec3* accel_body = nullptr) const {
+    int64_t st_ns = (time_ns - start_t_ns);
+
+    BASALT_ASSERT_STREAM(st_ns >= 0,
+                         "st_ns " << st_ns << " time_ns " << time_ns
+                                  << " start_t_ns " << start_t_ns);
+
+    int64_t s = st_ns / dt_ns;
+    double u = double(st_ns % dt_ns) / double(dt_ns);
+
+    BASALT_ASSERT_STREAM(s >= 0, "s " << s);
+    BASALT_ASSERT_STREAM(
+        size_t(s + N) <= knots.size(),
+        "s " << s << " N " << N << " knots.size() " << knots.size());
+
+    if (cache.segment != s) {
+      cache.segment = s;
+      cache.first_knot = knots[s];
+      for (int i = 0; i < DEG; i++) {
+        cache.delta[i] = (knots[s + i].inverse() * knots[s + i + 1]).log();
+      }
+    }
+
+    VecN p;
+    baseCoeffsWithTime<0>(p, u);
+    const VecN coeff = blending_matrix_ * p;
+
+    VecN dcoeff, ddcoeff;
+    if (vel_body || accel_body) {
+      baseCoeffsWithTime<1>(p, u);
+      dcoeff = pow_inv_dt[1] * blending_matrix_ * p;
+    }
+    if (accel_body) {
+      baseCoeffsWithTime<2>(p, u);
+      ddcoeff = pow_inv_dt[2] * blending_matrix_ * p;
+    }
+
+    SO3 res = cache.first_knot;
+    Vec3 rot_vel = Vec3::Zero();
+    Vec3 rot_accel = Vec3::Zero();
+
+    for (int i = 0; i < DEG; i++) {
+      const Vec3& delta = cache.delta[i];
+      const SO3 exp_kdelta = SO3::exp(delta * coeff[i + 1]);
+
+      if (rot) res *= exp_kdelta;
+
+      if (vel_body || accel_body) {
+        const SO3 exp_kdelta_inv = exp_kdelta.inverse();
+        rot_vel = exp_kdelta_inv * rot_vel;
+        const Vec3 vel_current = dcoeff[i + 1] * delta;
+        rot_vel += vel_current;
+
+        if (accel_body) {
+          rot_accel = exp_kdelta_inv * rot_accel;
+          rot_accel += ddcoeff[i + 1] * delta + rot_vel.cross(vel_current);
+        }
+      }
+    }
+
+    if (rot) *rot = res;
+    if (vel_body) *vel_body = rot_vel;
+    if (accel_body) *accel_body = rot_accel;
+  }
+
+  /// @brief Evaluate the spline at many times into preallocated arrays
+  ///
+  /// The times are split into chunks of consecutive entries that are
+  /// evaluated on num_threads threads, every chunk with its own \ref
+  /// SegmentCache. Sorted times therefore compute the knot increments of
+  /// each segment only once per chunk.
+  ///
+  /// @param[in] times_ns n times in nanoseconds
+  /// @param[in] n number of times
+  /// @param[out] rot if not nullptr, array of n values of the spline
+  /// @param[out] vel_body if not nullptr, array of n rotational velocities in
+  /// the body frame
+  /// @param[out] accel_body if not nullptr, array of n rotational
+  /// accelerations in the body frame
+  /// @param[in] num_threads number of threads
+  void evaluateSpan(const int64_t* times_ns, size_t n, SO3* rot,
+                    Vec3* vel_body = nullptr, Vec3* accel_body = nullptr,
+                    int num_threads = 1) const {
+    parallelForSpanChunks(n, num_threads, [&](size_t begin, size_t end) {
+      SegmentCache cache;
+      for (size_t i = begin; i < end; i++) {
+        evaluateCached(times_ns[i], cache, rot ? rot + i : nullptr,
+                       vel_body ? vel_body + i : nullptr,
+                       accel_body ? accel_body + i : nullptr);
+      }
+    });
+  }
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
  protected:
@@ -38,8 +38,18 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
 #include <Eigen/Dense>
+#include <algorithm>
 #include <cstdint>
+#include <deque>
+
+namespace Eigen {
+/// @brief std::deque with Eigen aligned allocator, used for the spline knots
+template <typename T>
+using aligned_deque = std::deque<T, Eigen::aligned_allocator<T>>;
+}  // namespace Eigen
 
 /// @brief Compute binomial coefficient.
 ///
@@ -131,3 +141,18 @@ Eigen::Matrix<_Scalar, _N, _N> computeBaseCoefficients() {
   }
   return base_coefficients.template cast<_Scalar>();
 }
+
+/// @brief Split [0, n) into chunks of consecutive indices and call
+/// fn(begin, end) for each chunk on num_threads threads.
+///
+/// Used by the evaluateSpan functions of the splines. Consecutive times stay
+/// in one chunk, so each chunk can keep a per segment cache.
+template <typename Function>
+void parallelForSpanChunks(size_t n, int num_threads, const Function& fn) {
+  constexpr size_t chunk_size = 1024;
+  const int num_chunks = static_cast<int>((n + chunk_size - 1) / chunk_size);
+  OpenICC::utils::ParallelFor(0, num_chunks, num_threads, [&](int chunk) {
+    const size_t begin = size_t(chunk) * chunk_size;
+    fn(begin, std::min(n, begin + chunk_size));
+  });
+}
@@ -5,30 +5,114 @@
 
 #include "OpenCameraCalibrator/allanvariance/allan_acc.h"
 #include "OpenCameraCalibrator/allanvariance/allan_gyr.h"
-
-#include "OpenCameraCalibrator/allanvariance/allan_gyr.h"
+#include "OpenCameraCalibrator/allanvariance/allan_streaming.h"
 #include "OpenCameraCalibrator/allanvariance/fitallan_acc.h"
 
+#include <memory>
+#include <string>
+
 namespace OpenICC {
 namespace core {
 
+//! Periodic checkpoints of the streaming accumulation, which takes hours
+//! for long recordings
+struct AllanCheckpointOptions {
+  //! checkpoint file, empty disables the checkpoints
+  std::string path;
+  double interval_s = 300.0;
+  //! continue from the checkpoint at path if it was written for the same
+  //! telemetry
+  bool resume = false;
+};
+
 class AllanVarianceFitter {
  public:
-  AllanVarianceFitter(const CameraTelemetryData& telemetry_data,
-                      const int nr_clusters);
+  //! streaming accumulates the Allan variance while the samples are pushed
+  //! and does not keep a copy of the telemetry. With num_threads > 1 the six
+  //! sensor axes are processed concurrently and the remaining threads split
+  //! the cluster factor loop. Only the streaming accumulation writes
+  //! checkpoints, the checkpoint is removed once it finished.
+  AllanVarianceFitter(
+      const CameraTelemetryData& telemetry_data,
+      const int nr_clusters,
+      const bool streaming = false,
+      const int num_threads = 1,
+      const AllanCheckpointOptions& checkpoint = AllanCheckpointOptions());
+  ~AllanVarianceFitter();
 
   bool RunFit();
 
+  //! Per axis bias instability [m/s^2, rad/s] of the last fit
+  const Eigen::Vector3d& GetAcclBiasInstability() const {
+    return accl_bias_instability_;
+  }
+  const Eigen::Vector3d& GetGyroBiasInstability() const {
+    return gyro_bias_instability_;
+  }
+
+  //! Per axis tau [s] at which the bias instability was reached, see
+  //! FitAllanGyr::getBiasInstabilityTime
+  const Eigen::Vector3d& GetAcclBiasInstabilityTime() const {
+    return accl_bias_instability_time_s_;
+  }
+  const Eigen::Vector3d& GetGyroBiasInstabilityTime() const {
+    return gyro_bias_instability_time_s_;
+  }
+
+  //! Per axis white noise density [m/s^2/sqrt(Hz), rad/s/sqrt(Hz)] of the
+  //! last fit
+  const Eigen::Vector3d& GetAcclWhiteNoise() const {
+    return accl_white_noise_;
+  }
+  const Eigen::Vector3d& GetGyroWhiteNoise() const {
+    return gyro_white_noise_;
+  }
+
  private:
+  //! Allan variance of one axis, input of the model fit
+  struct AllanCurve {
+    const std::vector<double>* variance;
+    const std::vector<double>* times;
+    double freq;
+    double avg_value;
+  };
+
+  bool RunStreamingFit();
+  //! Streaming estimator states after the first next_sample samples
+  bool WriteCheckpoint(const std::string& path,
+                       const CameraTelemetryData& telemetry_data,
+                       const size_t next_sample) const;
+  //! False if the checkpoint was written for other telemetry or settings,
+  //! the estimators have to be recreated then
+  bool ReadCheckpoint(const std::string& path,
+                      const CameraTelemetryData& telemetry_data,
+                      size_t& next_sample);
+  //! Fits the gyro x, y, z and acc x, y, z curves concurrently and stores
+  //! the results
+  bool FitCurves(const AllanCurve (&curves)[6]);
+
   CameraTelemetryData telemetry_data_;
 
-  allanvar::AllanAcc* data_acc_x_;
-  allanvar::AllanAcc* data_acc_y_;
-  allanvar::AllanAcc* data_acc_z_;
+  bool streaming_ = false;
+  int num_threads_ = 1;
+  //! x, y, z streaming estimators
+  std::vector<std::unique_ptr<allanvar::AllanStreaming>> streaming_acc_;
+  std::vector<std::unique_ptr<allanvar::AllanStreaming>> streaming_gyr_;
+
+  allanvar::AllanAcc* data_acc_x_ = nullptr;
+  allanvar::AllanAcc* data_acc_y_ = nullptr;
+  allanvar::AllanAcc* data_acc_z_ = nullptr;
+
+  allanvar::AllanGyr* data_gyr_x_ = nullptr;
+  allanvar::AllanGyr* data_gyr_y_ = nullptr;
+  allanvar::AllanGyr* data_gyr_z_ = nullptr;
 
-  allanvar::AllanGyr* data_gyr_x_;
-  allanvar::AllanGyr* data_gyr_y_;
-  allanvar::AllanGyr* data_gyr_z_;
+  Eigen::Vector3d accl_bias_instability_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_bias_instability_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_bias_instability_time_s_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_bias_instability_time_s_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_white_noise_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_white_noise_ = Eigen::Vector3d::Zero();
 };
 
 }  // namespace core
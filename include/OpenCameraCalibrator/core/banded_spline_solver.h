@@ -0,0 +1,108 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <ceres/ceres.h>
+
+#include <Eigen/Core>
+
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+//! Levenberg-Marquardt solver for spline problems. The variable parameter
+//! blocks are split into the knots, given in time order, and a small dense
+//! border of everything else (T_i_c, gravity, intrinsics, bias knots, line
+//! delay, points). As every residual only touches N consecutive knots, the
+//! knot part of the normal equations is block banded. The border is
+//! eliminated with a Schur complement and the knots are solved with a banded
+//! Cholesky, so each iteration is linear in the number of knots.
+class BandedSplineSolver {
+ public:
+  struct Options {
+    int max_num_iterations = 50;
+    double function_tolerance = 1e-4;
+    double parameter_tolerance = 1e-7;
+    double initial_lambda = 1e-4;
+    //! wall clock limit, the last accepted step is kept when it is reached
+    double max_solver_time_s = 1e9;
+    int num_threads = 1;
+    bool minimizer_progress_to_stdout = true;
+    //! called after every iteration, as ceres::Solver::Options::callbacks.
+    //! Not owned.
+    std::vector<ceres::IterationCallback*> callbacks;
+  };
+
+  //! banded_blocks: knot parameter blocks in time order. Constant blocks and
+  //! blocks that are not in the problem are skipped.
+  BandedSplineSolver(ceres::Problem* problem,
+                     const std::vector<double*>& banded_blocks);
+
+  //! Fills the cost, iteration, timing and termination fields of summary.
+  //! The evaluation times split into residual only evaluations of the trial
+  //! steps and residual plus Jacobian evaluations.
+  void Solve(const Options& options, ceres::Solver::Summary* summary);
+
+  //! Scalar half bandwidth of the knot block found in the last Solve
+  int Bandwidth() const { return bandwidth_; }
+
+ private:
+  struct NormalEquations {
+    //! lower band of the knot block, band(i, d) = H(i, i - d)
+    Eigen::MatrixXd band;
+    //! coupling of border (rows) and knots (cols)
+    Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+        border_knots;
+    //! border block, lower triangle
+    Eigen::MatrixXd border;
+    Eigen::VectorXd gradient;
+  };
+
+  bool Evaluate(const int num_threads,
+                double* cost,
+                ceres::CRSMatrix* jacobian,
+                Eigen::VectorXd* residuals);
+
+  int ComputeBandwidth(const ceres::CRSMatrix& jacobian) const;
+
+  void BuildNormalEquations(const ceres::CRSMatrix& jacobian,
+                            const Eigen::VectorXd& residuals,
+                            NormalEquations* normal_equations) const;
+
+  //! Solves (H + lambda * diag(H)) delta = -gradient
+  bool SolveDampedSystem(const NormalEquations& normal_equations,
+                         const double lambda,
+                         Eigen::VectorXd* delta) const;
+
+  void ApplyStep(const Eigen::VectorXd& delta);
+  void StoreParameters();
+  void RestoreParameters();
+
+  ceres::Problem* problem_;
+
+  //! variable blocks, knots first
+  std::vector<double*> blocks_;
+  std::vector<int> local_offsets_;
+  int num_banded_blocks_ = 0;
+  int num_banded_cols_ = 0;
+  int num_cols_ = 0;
+  int bandwidth_ = 0;
+
+  std::vector<std::vector<double>> stored_parameters_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
@@ -20,11 +20,32 @@
 #include <opencv2/opencv.hpp>
 #include <third_party/apriltag/apriltag.h>
 
+#ifdef OPENICC_CUDA
+#include <opencv2/core/cuda.hpp>
+#endif
+
+// OpenCV 4.7 moved the aruco detection into objdetect, with detector objects
+// that keep their parameters and buffers between frames
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 7)
+#include <opencv2/objdetect/charuco_detector.hpp>
+#define OPENICC_ARUCO_DETECTOR
+#endif
+
+#include "OpenCameraCalibrator/core/extraction_coverage.h"
+#include "OpenCameraCalibrator/io/read_mcap.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/mailbox.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include <algorithm>
+#include <atomic>
 #include <dirent.h>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 namespace OpenICC {
@@ -49,22 +70,78 @@ class BoardExtractor {
  public:
   BoardExtractor();
 
-  //! Extracts an initialized board type from an image
+  //! Extracts an initialized board type from an image. With ROI tracking,
+  //! the board is searched around its last detection first.
   bool ExtractBoard(const cv::Mat& image,
                     aligned_vector<Eigen::Vector2d>& corners,
                     std::vector<int>& object_pt_ids);
 
+  //! Track the board over consecutive images: detect inside the bounding box
+  //! of the last corners, enlarged by margin times its size on every side,
+  //! and only search the full image if that finds clearly fewer corners.
+  void SetRoiTracking(const bool track_roi, const double margin = 0.5) {
+    track_roi_ = track_roi;
+    roi_margin_ = margin;
+  }
+
+  //! Track the corners of the previous frame with pyramidal Lucas-Kanade
+  //! instead of detecting the board on every frame. Tracked corners keep
+  //! their ids. Their offset from a homography of the board points may only
+  //! change by max_homography_change_px from the previous frame, which
+  //! tolerates the lens distortion. The board is detected again on every
+  //! redetect_interval-th frame, if the frames are not consecutive or if
+  //! fewer than 80% of the detected corners are tracked. The pipelined
+  //! extraction hands runs of redetect_interval frames to the same worker,
+  //! which buffers up to that many decoded frames per worker.
+  void SetCornerTracking(const bool track,
+                         const int redetect_interval = 10,
+                         const double max_homography_change_px = 0.5) {
+    corner_tracking_ = track;
+    redetect_interval_ = std::max(1, redetect_interval);
+    max_homography_change_px_ = max_homography_change_px;
+  }
+
+  //! Stop reading a source once its views cover the image and the board
+  //! tilts of an intrinsic calibration, see ExtractionCoverageOptions. The
+  //! statistics and whether the targets were met are written to the
+  //! "extraction_coverage" entry of the scene header.
+  void SetCoverageTermination(const bool stop_when_covered,
+                              const ExtractionCoverageOptions& options =
+                                  ExtractionCoverageOptions()) {
+    stop_when_covered_ = stop_when_covered;
+    coverage_options_ = options;
+  }
+
   //! Extracts a board from a video file to a json file and saves it to disk
   bool ExtractVideoToJson(const std::string& video_path,
                           const std::string& save_path,
                           const double img_downsample_factor);
 
-  //! Extract the board from a folder full of images. The image names has to be
-  //! time time in nanoseconds! e.g. 1000000000000.png
+  //! Extract the board from a folder full of png or jpg images. The image
+  //! names has to be time time in nanoseconds! e.g. 1000000000000.png
   bool ExtractImageFolderToJson(const std::string& image_folder,
                                 const std::string& save_path,
                                 const double img_downsample_factor);
 
+  //! Extracts a board from a video file into an opened scene writer, e.g. a
+  //! io::SceneMemoryWriter to keep the corners in memory
+  bool ExtractVideo(const std::string& video_path,
+                    const double img_downsample_factor,
+                    io::SceneWriter& scene_writer);
+
+  //! Image folder version of ExtractVideo, see ExtractImageFolderToJson
+  bool ExtractImageFolder(const std::string& image_folder,
+                          const double img_downsample_factor,
+                          io::SceneWriter& scene_writer);
+
+  //! Extracts several videos or image folders at once. The frames of all
+  //! inputs are detected on one pool of num_threads workers, so short inputs
+  //! do not leave cores idle. The corners of input_paths[i] are written to
+  //! the opened scene_writers[i].
+  bool ExtractBatch(const std::vector<std::string>& input_paths,
+                    const double img_downsample_factor,
+                    const std::vector<io::SceneWriter*>& scene_writers);
+
   //! Initializes a Charuco board
   bool InitializeCharucoBoard(std::string path_to_detector_params,
                               float marker_length,
@@ -82,19 +159,350 @@ class BoardExtractor {
                             int squaresX,
                             int squaresY);
 
+  //! Detects the Apriltag grid in a gray image into the detection buffers
+  //! of this extractor. True if any corner was found.
   bool DetectAprilBoard(const cv::Mat& image);
 
+  //! Converts to gray, downsamples and extracts the board from a frame that
+  //! does not come from a file, e.g. a live camera. Returns the size of the
+  //! image the corners refer to.
+  cv::Size ExtractFrame(const cv::Mat& image,
+                        const double img_downsample_factor,
+                        aligned_vector<Eigen::Vector2d>& corners,
+                        std::vector<int>& object_pt_ids) {
+    return PreprocessAndExtract(
+               image, img_downsample_factor, corners, object_pt_ids)
+        .size();
+  }
+
+  //! Scene header fields of the board (fps, board type, square size, board
+  //! points). Image size is added by the caller.
+  void GetSceneHeader(const double fps, nlohmann::json& header);
+
   //! Returns the 3d board points
   std::vector<std::vector<cv::Point3f>> GetBoardPts() { return board_pts3d_; }
 
   std::vector<int> GetRadonBoardIDs() { return continuous_board_indices_; }
 
-  //! Set verbose plot
+  //! Shows the extracted corners. A preview thread draws the latest frame,
+  //! frames it could not keep up with are skipped
   void SetVerbosePlot() { verbose_plot_ = true; }
 
+  //! Number of detector threads. With more than one thread, frames are
+  //! decoded, detected and collected in a pipeline (video and image folder)
+  void SetNumThreads(const int num_threads) {
+    num_threads_ = std::max(1, num_threads);
+  }
+
+  //! Quad decimation and threads of the apriltag3 backend (see
+  //! BUILD_WITH_APRILTAG3). Ignored by the default ETH detector.
+  void SetApriltagOptions(const float quad_decimate, const int num_threads) {
+    april_quad_decimate_ = quad_decimate;
+    april_num_threads_ = num_threads;
+    april_detector_.setQuadDecimate(quad_decimate);
+    april_detector_.setNumThreads(num_threads);
+  }
+
+  //! Creates num_workers extractors with the board configuration of this one.
+  //! Each keeps its detector scratch memory, so callers running their own
+  //! threads get allocation free detection from one worker per thread. The
+  //! pipelined extraction reuses the same pool. Not thread safe itself.
+  void ReserveDetectorPool(const int num_workers);
+
+  //! Extractor of a worker created by ReserveDetectorPool
+  BoardExtractor& PooledDetector(const int worker);
+
+  //! Hardware video decoder: "none", "any", "d3d11", "vaapi" or "mfx".
+  //! Falls back to the default decoder if it is not available.
+  void SetVideoHwAcceleration(const std::string& hw_acceleration) {
+    video_hw_acceleration_ = hw_acceleration;
+  }
+
+  //! Converts the frames to gray and downsamples them with the OpenCV CUDA
+  //! modules (see BUILD_WITH_CUDA). The detection stays on the CPU. Returns
+  //! false and keeps the CPU preprocessing if there is no CUDA device.
+  bool SetGpuPreprocessing(const bool use_gpu);
+
+  //! Detect on the image downsampled by img_downsample_factor, then refine
+  //! the corners with cornerSubPix on the full resolution image. Corners and
+  //! image size are written at full resolution.
+  void SetFullResolutionRefinement(const bool refine) {
+    refine_full_resolution_ = refine;
+  }
+
+  //! Charuco boards: only run refineDetectedMarkers if fewer markers than
+  //! the board has were detected and candidates were rejected. Otherwise
+  //! the refinement cannot recover anything.
+  void SetAdaptiveMarkerRefinement(const bool adaptive) {
+    adaptive_marker_refinement_ = adaptive;
+  }
+
+  //! Radon boards: detect the board without the exhaustive search on a
+  //! proxy image whose longer side has proxy_size pixels, then refine the
+  //! corners with cornerSubPix on the full image. Falls back to the
+  //! exhaustive search on the full image if the proxy detection fails. 0
+  //! always runs the exhaustive search.
+  void SetRadonProxyDetection(const int proxy_size) {
+    radon_proxy_size_ = std::max(0, proxy_size);
+  }
+
+  //! Only detect the board on every stride-th video frame. Skipped frames
+  //! are grabbed but not retrieved.
+  void SetFrameStride(const int stride) { frame_stride_ = std::max(1, stride); }
+
+  //! Only decode num_frames video frames spread evenly over the video. The
+  //! decoder seeks to the next sample if it is far ahead, so the extraction
+  //! time hardly depends on the video length. With more than one thread,
+  //! num_threads decoders read disjoint time ranges. 0 reads every frame.
+  void SetSparseSampling(const int num_frames) {
+    sparse_num_frames_ = std::max(0, num_frames);
+  }
+
+  //! Only extract frames with timestamps in [t_start_s, t_end_s), in the
+  //! time base of the scene (video time, or the image and message times of
+  //! image folders and MCAP files). Videos seek to t_start_s. Shards of one
+  //! input extracted with disjoint ranges can be merged with
+  //! io::MergeSceneFiles
+  void SetTimeRange(const double t_start_s, const double t_end_s) {
+    t_start_s_ = t_start_s;
+    t_end_s_ = t_end_s;
+  }
+
+  //! Skip video frames whose downsampled gray image differs by less than
+  //! min_difference mean absolute intensity from the last detected frame.
+  //! 0 detects on every frame.
+  void SetMinFrameDifference(const double min_difference) {
+    min_frame_difference_ = min_difference;
+  }
+
+  //! Timestamps of the decoded video frames, frame i gets timestamps_s[i]
+  //! instead of the container time. Used for videos whose container times
+  //! are not accurate, e.g. smartphone recordings with separately logged
+  //! frame times. Empty uses the container times.
+  void SetVideoFrameTimestamps(const std::vector<double>& timestamps_s) {
+    video_frame_timestamps_s_ = timestamps_s;
+  }
+
+  //! Image topic of MCAP inputs, the first sensor_msgs/msg/Image or
+  //! CompressedImage topic if empty
+  void SetMcapImageTopic(const std::string& topic) {
+    mcap_image_topic_ = topic;
+  }
+
  private:
+  //! Frame waiting for detection. If image is empty, it is read from
+  //! image_path or decoded from the MCAP message by the worker
+  struct FrameJob {
+    size_t source_idx = 0;
+    int frame_idx = 0;
+    double timestamp_s = 0.0;
+    std::string image_path;
+    std::string mcap_schema;
+    std::vector<uint8_t> mcap_message;
+    cv::Mat image;
+  };
+
+  //! Detection result of one frame
+  struct FrameResult {
+    size_t source_idx = 0;
+    int frame_idx = 0;
+    double timestamp_s = 0.0;
+    cv::Size image_size;
+    cv::Mat image;
+    aligned_vector<Eigen::Vector2d> corners;
+    std::vector<int> ids;
+  };
+
+  //! Frames of one video or image folder and the scene header fields
+  struct FrameSource {
+    nlohmann::json header;
+    int total_nr_frames = 0;
+    int next_frame_idx = 0;
+    //! video state, empty for image folders
+    std::unique_ptr<cv::VideoCapture> video;
+    int video_frame_idx = 0;
+    int nr_failed_reads = 0;
+    int nr_skipped_frames = 0;
+    cv::Mat last_thumbnail;
+    //! image folder state, timestamps_s are also the external frame
+    //! timestamps of videos
+    std::vector<std::string> filenames;
+    std::vector<double> timestamps_s;
+    size_t next_file = 0;
+    //! MCAP state, the frame times are kept in timestamps_s
+    std::unique_ptr<io::McapReader> mcap;
+    int mcap_channel = -1;
+    int mcap_message_idx = 0;
+    //! sparse sampling state, the video frames to decode. Frame i of them
+    //! gets frame index sample_offset + i
+    std::vector<int> sample_frames;
+    size_t next_sample = 0;
+    int sample_offset = 0;
+    //! sources with their own decoder over consecutive parts of
+    //! sample_frames, read instead of this source by the pipelined
+    //! extraction
+    std::vector<std::unique_ptr<FrameSource>> segments;
+    //! coverage of the written views, see SetCoverageTermination. Once the
+    //! targets are met the decoders of the source stop
+    std::unique_ptr<ExtractionCoverage> coverage;
+    std::atomic<bool> covered{false};
+  };
+
   void BoardToJson(nlohmann::json& output_json);
 
+  //! Adds a written view to the coverage of source, true once the coverage
+  //! targets are met
+  bool UpdateCoverage(FrameSource& source,
+                      const cv::Size& image_size,
+                      const aligned_vector<Eigen::Vector2d>& corners,
+                      const std::vector<int>& object_pt_ids);
+
+  bool OpenVideoSource(const std::string& video_path, FrameSource& source);
+
+  bool OpenImageFolderSource(const std::string& image_folder,
+                             FrameSource& source);
+
+  bool OpenMcapSource(const std::string& mcap_path, FrameSource& source);
+
+  //! Opens a video or an MCAP file
+  bool OpenFileSource(const std::string& path, FrameSource& source);
+
+  //! Next image message of an MCAP source
+  bool NextMcapFrame(FrameSource& source, FrameJob& job) const;
+
+  //! Next sample of a sparsely sampled video. Samples that could not be
+  //! read or were filtered keep an empty job.image
+  bool NextSampledVideoFrame(FrameSource& source, FrameJob& job) const;
+
+  bool InTimeRange(const double timestamp_s) const {
+    return timestamp_s >= t_start_s_ && timestamp_s < t_end_s_;
+  }
+
+  //! Container time or external timestamp of the frame that was just read.
+  //! False if the external timestamps do not cover it
+  bool VideoFrameTimestamp(const FrameSource& source,
+                           double& timestamp_s) const;
+
+  //! Reads or decodes job.image if the source did not. JPEG files are
+  //! decoded at 1/2, 1/4 or 1/8 resolution if img_downsample_factor allows
+  //! it. Returns the downsample factor that is left for the decoded image
+  double LoadFrameImage(FrameJob& job,
+                        const double img_downsample_factor) const;
+
+  //! Next frame of a source, video frames are read into job.image. False at
+  //! the end of the source
+  bool NextFrame(FrameSource& source, FrameJob& job) const;
+
+  //! Extracts all frames of source serially or pipelined and closes the
+  //! scene writer
+  bool ExtractFromSource(FrameSource& source,
+                         const double img_downsample_factor,
+                         io::SceneWriter& scene_writer);
+
+  //! Writes the header of source and closes its scene writer
+  bool FinishSource(FrameSource& source, io::SceneWriter& scene_writer) const;
+
+  //! Copies the board configuration of another extractor. The detector
+  //! state is not shared, so both extractors can run concurrently
+  void CopyBoardConfig(const BoardExtractor& other);
+
+#ifdef OPENICC_ARUCO_DETECTOR
+  //! Creates the marker and Charuco detectors of this extractor from the
+  //! board, dictionary and detector parameters
+  void CreateCharucoDetectors();
+#endif
+
+  //! Converts to gray, downsamples and extracts the board from an image.
+  //! Returns the gray image the corners refer to. It is either image or a
+  //! buffer of this extractor that is reused by the next call.
+  const cv::Mat& PreprocessAndExtract(const cv::Mat& image,
+                                      const double img_downsample_factor,
+                                      aligned_vector<Eigen::Vector2d>& corners,
+                                      std::vector<int>& object_pt_ids);
+
+#ifdef OPENICC_CUDA
+  //! PreprocessAndExtract with the conversion and downsampling on the GPU.
+  //! Only the images the detection and refinement need are downloaded.
+  const cv::Mat& PreprocessAndExtractGpu(
+      const cv::Mat& image,
+      const double img_downsample_factor,
+      aligned_vector<Eigen::Vector2d>& corners,
+      std::vector<int>& object_pt_ids);
+#endif
+
+  //! Pulls frames from every source on its own thread, detects on
+  //! num_threads_ shared workers and writes the views of sources[i] in frame
+  //! order to scene_writers[i]
+  void ExtractFramesPipelined(
+      const std::vector<FrameSource*>& sources,
+      const double img_downsample_factor,
+      const std::vector<io::SceneWriter*>& scene_writers);
+
+  //! Detection with the ROI tracking, see SetRoiTracking
+  bool DetectBoard(const cv::Mat& image,
+                   aligned_vector<Eigen::Vector2d>& corners,
+                   std::vector<int>& object_pt_ids);
+
+  //! Restarts the corner tracks unless frame_idx directly follows the last
+  //! frame of the same source, see SetCornerTracking
+  void ContinueCornerTracks(const size_t source_idx, const int frame_idx);
+
+  //! Tracks the corners of the last frame into image, whose pyramid is in
+  //! next_pyramid_. False if the board has to be detected
+  bool TrackCorners(const cv::Mat& image,
+                    aligned_vector<Eigen::Vector2d>& corners,
+                    std::vector<int>& object_pt_ids);
+
+  //! Offsets of corners from the least median of squares homography of
+  //! their board points. False if there are too few corners
+  bool BoardHomographyResiduals(const std::vector<cv::Point2f>& corners,
+                                const std::vector<int>& ids,
+                                std::vector<cv::Point2f>& residuals) const;
+
+  //! Detection on the full image
+  bool ExtractBoardInImage(const cv::Mat& image,
+                           aligned_vector<Eigen::Vector2d>& corners,
+                           std::vector<int>& object_pt_ids);
+
+  //! Fast radon detection on the proxy image, see SetRadonProxyDetection
+  bool DetectRadonOnProxy(const cv::Mat& image,
+                          std::vector<cv::Point2d>& corners,
+                          cv::Mat& meta);
+
+  //! Scales corners detected at 1/downsample_factor to full resolution and
+  //! refines them on the full resolution gray image
+  void RefineCornersFullResolution(const cv::Mat& gray_image,
+                                   const double downsample_factor,
+                                   aligned_vector<Eigen::Vector2d>& corners);
+
+  //! Sets the tracking ROI to the enlarged bounding box of corners
+  void UpdateBoardRoi(const aligned_vector<Eigen::Vector2d>& corners,
+                      const cv::Size& image_size);
+
+  //! Opens the video with the configured hardware decoder or the default one
+  bool OpenVideo(const std::string& video_path, cv::VideoCapture& video) const;
+
+  //! True if image is too similar to last_thumbnail to be worth a detection.
+  //! Otherwise last_thumbnail is replaced by the thumbnail of image.
+  bool IsNearDuplicateFrame(const cv::Mat& image,
+                            cv::Mat& last_thumbnail) const;
+
+  //! Draws the extracted corners and shows the image, only called by the
+  //! preview thread
+  void PlotCorners(const cv::Mat& image,
+                   const aligned_vector<Eigen::Vector2d>& corners,
+                   const std::vector<int>& object_pt_ids);
+
+  //! Starts the preview thread if the verbose plot is enabled
+  void StartPreview();
+  //! Shows the last posted frame and joins the preview thread
+  void StopPreview();
+  //! Hands a frame to the preview thread, replacing a frame it did not show
+  //! yet. Does nothing if the preview is not running
+  void PostPreview(const cv::Mat& image,
+                   const aligned_vector<Eigen::Vector2d>& corners,
+                   const std::vector<int>& object_pt_ids);
+
   //! Board type
   BoardType board_type_;
 
@@ -109,6 +517,18 @@ class BoardExtractor {
   cv::Ptr<cv::aruco::CharucoBoard> charucoboard_;
   //! Aruco board
   cv::Ptr<cv::aruco::Board> board_;
+#ifdef OPENICC_ARUCO_DETECTOR
+  //! detectors of this extractor, every pooled detector owns its own
+  std::unique_ptr<cv::aruco::ArucoDetector> aruco_detector_;
+  std::unique_ptr<cv::aruco::CharucoDetector> charuco_detector_;
+#endif
+  //! skip the marker refinement if it cannot find more markers
+  bool adaptive_marker_refinement_ = false;
+  //! Charuco detections reused from frame to frame
+  std::vector<std::vector<cv::Point2f>> charuco_marker_corners_;
+  std::vector<std::vector<cv::Point2f>> charuco_rejected_markers_;
+  std::vector<cv::Point2f> charuco_corners_;
+  std::vector<int> charuco_marker_ids_, charuco_ids_;
 
   //! radon board extraction flags
   int radon_flags_;
@@ -116,9 +536,23 @@ class BoardExtractor {
   cv::Size radon_pattern_size_;
   //! board pt continuous index
   std::vector<int> continuous_board_indices_;
+  //! longer side of the radon proxy image, 0 disables the proxy detection
+  int radon_proxy_size_ = 0;
+  //! radon proxy detection buffers reused from frame to frame
+  cv::Mat radon_proxy_buffer_;
+  std::vector<cv::Point2f> radon_subpix_corners_;
 
   //! Apriltag stuff
   ApriltagDetector april_detector_;
+  float april_quad_decimate_ = 1.f;
+  int april_num_threads_ = 1;
+  //! Apriltag detections reused from frame to frame
+  std::vector<cv::Point2f> april_corners_, april_rejected_corners_;
+  std::vector<int> april_ids_, april_rejected_ids_;
+  std::vector<double> april_radii_, april_rejected_radii_;
+
+  //! per worker extractors, see ReserveDetectorPool
+  std::vector<std::unique_ptr<BoardExtractor>> detector_pool_;
 
   //! if a board is already initialized
   bool board_initialized_ = false;
@@ -128,6 +562,97 @@ class BoardExtractor {
 
   //! display extracted corners
   bool verbose_plot_ = false;
+
+  //! number of detector threads
+  int num_threads_ = 1;
+
+  //! frame buffers reused from frame to frame, so steady state extraction
+  //! does not reallocate images
+  cv::Mat gray_buffer_;
+  cv::Mat downsampled_buffer_;
+  cv::Mat plot_buffer_;
+
+  //! convert and downsample the frames on the GPU
+  bool gpu_preprocessing_ = false;
+#ifdef OPENICC_CUDA
+  //! device buffers and stream of this extractor, so pooled workers
+  //! preprocess concurrently
+  cv::cuda::GpuMat gpu_image_;
+  cv::cuda::GpuMat gpu_gray_;
+  cv::cuda::GpuMat gpu_downsampled_;
+  cv::cuda::Stream gpu_stream_;
+#endif
+
+  //! frame and detections shown by the preview thread
+  struct PreviewFrame {
+    cv::Mat image;
+    aligned_vector<Eigen::Vector2d> corners;
+    std::vector<int> ids;
+  };
+  //! the extraction posts the latest frame and never waits for the display
+  std::unique_ptr<utils::Mailbox<PreviewFrame>> preview_mailbox_;
+  std::thread preview_thread_;
+  PreviewFrame preview_frame_;
+
+  //! hardware video decoder type
+  std::string video_hw_acceleration_ = "none";
+
+  //! refine corners detected on the downsampled image at full resolution
+  bool refine_full_resolution_ = false;
+
+  //! search the board around its last detection first
+  bool track_roi_ = false;
+  //! ROI enlargement relative to the board bounding box size
+  double roi_margin_ = 0.5;
+  //! ROI of the last detection, empty if the board was lost
+  cv::Rect board_roi_;
+  //! number of corners of the last detection
+  size_t last_nr_corners_ = 0;
+
+  //! track the corners from frame to frame, see SetCornerTracking
+  bool corner_tracking_ = false;
+  int redetect_interval_ = 10;
+  double max_homography_change_px_ = 0.5;
+  //! corners, ids and homography residuals of the last frame
+  std::vector<cv::Point2f> track_points_;
+  std::vector<int> track_ids_;
+  std::vector<cv::Point2f> track_residuals_;
+  //! image pyramids of the last and the current frame
+  std::vector<cv::Mat> track_pyramid_, next_pyramid_;
+  cv::Size track_image_size_;
+  //! frames tracked since the last detection, and its number of corners
+  int frames_since_detection_ = 0;
+  size_t detected_nr_corners_ = 0;
+  //! source and index of the last frame
+  size_t track_source_idx_ = 0;
+  int track_frame_idx_ = -1;
+  //! tracking buffers reused from frame to frame
+  std::vector<cv::Point2f> tracked_points_, back_tracked_points_;
+  std::vector<uchar> track_status_, back_track_status_;
+  std::vector<float> track_errors_;
+
+  //! stop a source once its coverage targets are met
+  bool stop_when_covered_ = false;
+  ExtractionCoverageOptions coverage_options_;
+
+  //! detect on every frame_stride_-th video frame
+  int frame_stride_ = 1;
+
+  //! minimum mean absolute thumbnail difference to the last detected frame
+  double min_frame_difference_ = 0.0;
+
+  //! image topic of MCAP inputs
+  std::string mcap_image_topic_;
+
+  //! external video frame timestamps, see SetVideoFrameTimestamps
+  std::vector<double> video_frame_timestamps_s_;
+
+  //! number of video frames to decode, 0 decodes all
+  int sparse_num_frames_ = 0;
+
+  //! time range of the extracted frames, see SetTimeRange
+  double t_start_s_ = -std::numeric_limits<double>::infinity();
+  double t_end_s_ = std::numeric_limits<double>::infinity();
 };
 
 }  // namespace core
@@ -0,0 +1,53 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <theia/sfm/reconstruction.h>
+
+namespace OpenICC {
+namespace core {
+
+struct BoardPointRefinementOptions {
+  int max_iterations = 20;
+  //! Huber loss width in pixel
+  double robust_loss_width = 1.345;
+  //! stop if the relative cost decrease of an accepted step is below
+  double function_tolerance = 1e-6;
+  //! initial Levenberg-Marquardt damping, relative to the Hessian diagonal
+  double initial_lambda = 1e-4;
+  int num_threads = 1;
+  bool verbose = false;
+};
+
+struct BoardPointRefinementSummary {
+  bool success = false;
+  int iterations = 0;
+  double initial_cost = 0.0;
+  double final_cost = 0.0;
+};
+
+//! Jointly refines the board points and the camera poses of all estimated
+//! views with fixed intrinsics. Each Levenberg-Marquardt step eliminates the
+//! poses with the Schur complement, as every 6x6 pose block only couples to
+//! the board points it observes. Only the small dense board point system is
+//! solved, the pose updates are back substituted view by view in parallel.
+//! Only the first three coordinates of the homogeneous board points change.
+BoardPointRefinementSummary RefineBoardPoints(
+    const BoardPointRefinementOptions& options,
+    theia::Reconstruction* reconstruction);
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,83 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ceres/ceres.h>
+#include <theia/sfm/bundle_adjustment/bundle_adjuster.h>
+#include <theia/sfm/camera/camera_intrinsics_model.h>
+#include <theia/sfm/reconstruction.h>
+
+#include <memory>
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+//! Bundle adjustment problem over all estimated views and tracks of a
+//! calibration dataset. The residual blocks are created once in Build.
+//! Every Optimize* call only changes which parameters are constant, so
+//! staged calibrations do not rebuild the problem for every stage.
+class CameraCalibrationProblem {
+ public:
+  //! Adds one reprojection residual per observation. The problem keeps
+  //! pointers into reconstruction, so views have to be removed with
+  //! RemoveView before they are removed from the reconstruction. Call Reset
+  //! before anything else of it is removed.
+  void Build(const theia::BundleAdjustmentOptions& options,
+             theia::Reconstruction* reconstruction);
+
+  bool IsBuilt() const { return problem_ != nullptr; }
+
+  void Reset();
+
+  //! Removes the residuals and the pose of a view, and the tracks only this
+  //! view observes. Call before removing the view from the reconstruction.
+  //! Returns false if the view is not part of the problem.
+  bool RemoveView(const theia::ViewId view_id);
+
+  //! Like theia::BundleAdjustViews: optimizes the camera extrinsics and
+  //! intrinsics selected by options, the tracks are constant
+  theia::BundleAdjustmentSummary OptimizeViews(
+      const theia::BundleAdjustmentOptions& options);
+
+  //! Like theia::BundleAdjustTracks: optimizes the tracks, the cameras are
+  //! constant
+  theia::BundleAdjustmentSummary OptimizeTracks(
+      const theia::BundleAdjustmentOptions& options);
+
+ private:
+  void SetCamerasConstant(const theia::BundleAdjustmentOptions& options,
+                          const bool constant);
+
+  void SetTracksConstant(const theia::BundleAdjustmentOptions& options,
+                         const bool constant);
+
+  theia::BundleAdjustmentSummary Solve(
+      const theia::BundleAdjustmentOptions& options);
+
+  theia::Reconstruction* reconstruction_ = nullptr;
+
+  std::unique_ptr<ceres::Problem> problem_;
+
+  std::vector<theia::ViewId> view_ids_;
+  std::vector<theia::TrackId> track_ids_;
+  //! every intrinsics group once, kept alive if all views of a group are
+  //! removed
+  std::vector<std::shared_ptr<theia::CameraIntrinsicsModel>> intrinsics_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
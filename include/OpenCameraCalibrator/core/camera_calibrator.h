@@ -18,7 +18,13 @@
 #include <theia/sfm/reconstruction.h>
 #include <theia/solvers/ransac.h>
 
+#include "OpenCameraCalibrator/core/camera_calibration_problem.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 namespace OpenICC {
 namespace core {
@@ -55,17 +61,164 @@ class CameraCalibrator {
   }
   void SetVerbose() { verbose_ = true; }
 
-  //! camera poses will only be used for calibration if there is no other camera
-  //! pose in a voxel
+  //! Only one camera pose per voxel of a hash grid over the camera positions
+  //! is used for calibration
   void SetGridSize(const double grid_size = 0.04) { grid_size_ = grid_size; }
 
+  //! Additionally bins the viewing direction with this angular size in
+  //! degrees, so views from one place with different orientations are kept.
+  //! 0 bins positions only.
+  void SetOrientationBinSize(const double bin_size_deg) {
+    orientation_bin_deg_ = bin_size_deg;
+  }
+
+  //! Keep the view with the most corners per voxel instead of the first one
+  void SetKeepMostCornersPerVoxel(const bool keep_most_corners) {
+    keep_most_corners_per_voxel_ = keep_most_corners;
+  }
+
+  //! After the voxel filter, greedily keep the views that maximize the log
+  //! determinant of the approximate information matrix of focal length,
+  //! principal point and radial distortion, with the view poses
+  //! marginalized. Stops after max_views views or once no view increases
+  //! the log determinant by min_log_det_gain. 0 keeps all voxel views.
+  void SetInformationViewSelection(const size_t max_views,
+                                   const double min_log_det_gain = 1e-2) {
+    max_information_views_ = max_views;
+    min_information_gain_ = min_log_det_gain;
+  }
+
+  //! Refine the board points jointly with the poses by the Schur complement
+  //! solver in board_point_refiner.h instead of a tracks only bundle
+  //! adjustment. Only used with optimize_board_pts.
+  void SetFastBoardPointRefinement(const bool fast_refinement) {
+    fast_board_pt_refinement_ = fast_refinement;
+  }
+
+  //! Number of threads used to initialize and to prune the views
+  void SetNumThreads(const int num_threads) {
+    num_threads_ = std::max(1, num_threads);
+  }
+
+  //! Number of threads of the bundle adjustment stages, 0 uses all hardware
+  //! threads. Lower it if several calibrators run concurrently.
+  void SetBundleAdjustmentThreads(const int num_threads) {
+    ba_num_threads_ = std::max(0, num_threads);
+  }
+
+  //! Wall clock budget of the bundle adjustment stages of RunCalibration,
+  //! see utils::TimeBudgetScheduler. When it is used up the remaining stages
+  //! are skipped and the best solution so far is kept. 0 is unlimited
+  void SetTimeBudget(const double budget_s) { time_budget_s_ = budget_s; }
+
+  //! Time spent in and cost reduction of every stage of the last
+  //! RunCalibration with a time budget
+  const nlohmann::json& GetTimeBudgetReport() const {
+    return time_budget_report_;
+  }
+
+  //! The initial intrinsics of the distortion models are chosen among the
+  //! per view estimates by how well they undistort the board of other views.
+  //! At most max_candidates estimates are scored on at most
+  //! max_scoring_views random views, 0 uses all of them.
+  void SetIntrinsicsCandidateSampling(const size_t max_candidates,
+                                      const size_t max_scoring_views) {
+    max_intrinsics_candidates_ = max_candidates;
+    max_intrinsics_scoring_views_ = max_scoring_views;
+  }
+
+  //! Mean reprojection error of the last calibration, negative if it failed
+  double GetReprojectionError() const { return reproj_error_; }
+
+  const std::string& GetCameraModel() const { return camera_model_; }
+
+  //! Calibrated camera of the last calibration, false if it failed
+  bool GetCalibratedCamera(theia::Camera& camera) const;
+
+  //! Number of views the last calibration used
+  int GetNumCalibrationViews() const {
+    return static_cast<int>(recon_calib_dataset_.NumViews());
+  }
+
   //! Print result
   void PrintResult();
 
  private:
+  //! Sets the initial pose and intrinsics of the camera of a view
+  void InitializeViewCamera(const theia::ViewId view_id,
+                            const Eigen::Matrix3d& initial_rotation,
+                            const Eigen::Vector3d& initial_position,
+                            const double initial_focal_length,
+                            const double initial_distortion,
+                            const int image_width,
+                            const int image_height);
+
+  //! Initial pose and intrinsics of one view
+  struct ViewInitialization {
+    double timestamp_s = 0.0;
+    std::vector<int> board_pt3_ids;
+    aligned_vector<Eigen::Vector2d> corners;
+    Eigen::Matrix3d rotation;
+    Eigen::Vector3d position;
+    double focal_length = 0.0;
+    double radial_distortion = 0.0;
+    bool success = false;
+  };
+
+  //! Indices of the successfully initialized views that survive the voxel
+  //! filter, in timestamp order
+  std::vector<size_t> SelectViewsPerVoxel(
+      const std::vector<ViewInitialization>& view_inits) const;
+
+  //! Greedy subset of candidate_views, see SetInformationViewSelection.
+  //! Returned in timestamp order
+  std::vector<size_t> SelectViewsByInformation(
+      const std::vector<ViewInitialization>& view_inits,
+      const std::vector<size_t>& candidate_views) const;
+
+  //! Initializes pose, focal length and distortion from the corners of one
+  //! view. Does not modify the calibrator, so views can be initialized in
+  //! parallel. The RANSAC random number generator is seeded with seed.
+  void InitializeView(const nlohmann::json& image_points,
+                      const int image_width,
+                      const int image_height,
+                      const unsigned int seed,
+                      ViewInitialization* view_init) const;
+
+  //! Initial focal length and distortion from the views that survived the
+  //! voxel filter. The pinhole models take the view with the median focal
+  //! length, the others score candidates in parallel with
+  //! ScoreIntrinsicsCandidate.
+  std::pair<double, double> SelectInitialIntrinsics(
+      const std::vector<ViewInitialization>& view_inits,
+      const std::vector<size_t>& selected_views,
+      const int image_width,
+      const int image_height) const;
+
+  //! Median RMSE in pixels of the board homography of the views after
+  //! undistorting their corners with a division model of these intrinsics
+  double ScoreIntrinsicsCandidate(
+      const std::vector<ViewInitialization>& view_inits,
+      const std::vector<size_t>& scoring_views,
+      const std::pair<double, double>& intrinsics,
+      const int image_width,
+      const int image_height) const;
+
+  //! Runs one bundle adjustment stage on calib_problem_, which is built on
+  //! the first call
+  theia::BundleAdjustmentSummary OptimizeViews(
+      const theia::BundleAdjustmentOptions& options);
+
+  theia::BundleAdjustmentSummary OptimizeTracks(
+      const theia::BundleAdjustmentOptions& options);
+
   //! holds all calibration information like views and features
   theia::Reconstruction recon_calib_dataset_;
 
+  //! bundle adjustment problem over recon_calib_dataset_, shared by the
+  //! calibration stages
+  CameraCalibrationProblem calib_problem_;
+
   //! Ransac parameters for initial pose estimation
   theia::RansacParameters ransac_params_;
 
@@ -76,13 +229,43 @@ class CameraCalibrator {
   bool verbose_ = false;
 
   //! voxel grid size
-  double grid_size_;
+  double grid_size_ = 0.04;
+
+  //! angular size of the orientation bins in degrees, 0 disables them
+  double orientation_bin_deg_ = 0.0;
+
+  //! keep the view with the most corners in a voxel
+  bool keep_most_corners_per_voxel_ = false;
+
+  //! information based view selection, 0 disables it
+  size_t max_information_views_ = 0;
+  double min_information_gain_ = 1e-2;
 
   //! also optimize board points in the end (e.g. for printed boards)
   bool optimize_board_pts_ = true;
 
+  //! refine board points with RefineBoardPoints
+  bool fast_board_pt_refinement_ = false;
+
   //! min number views for calibration
   int min_num_view_ = 10;
+
+  //! number of threads for the view initialization and pruning
+  int num_threads_ = 1;
+
+  //! number of bundle adjustment threads, 0 for all hardware threads
+  int ba_num_threads_ = 0;
+
+  //! see SetTimeBudget
+  double time_budget_s_ = 0.0;
+  nlohmann::json time_budget_report_;
+
+  //! bounds of the initial intrinsics scoring, 0 for all views
+  size_t max_intrinsics_candidates_ = 64;
+  size_t max_intrinsics_scoring_views_ = 64;
+
+  //! mean reprojection error of the last calibration
+  double reproj_error_ = -1.0;
 };
 
 }  // namespace core
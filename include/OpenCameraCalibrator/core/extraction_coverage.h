@@ -0,0 +1,89 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Targets of the extraction for an intrinsic calibration. The image is
+//! split into grid_cols x grid_rows cells, a cell is covered once it holds
+//! min_corners_per_cell corners of any view.
+struct ExtractionCoverageOptions {
+  int grid_cols = 8;
+  int grid_rows = 6;
+  int min_corners_per_cell = 5;
+  //! fraction of the cells that has to be covered
+  double min_cell_fraction = 0.9;
+  //! views with at least 4 corners
+  int min_views = 50;
+  //! views per board tilt, see ExtractionCoverage::TiltOfView
+  int min_views_per_tilt = 5;
+  //! a board is tilted if its depth changes by this fraction across it
+  double min_tilt = 0.1;
+};
+
+//! Image coverage and pose diversity of the views extracted so far
+class ExtractionCoverage {
+ public:
+  //! frontal, or the depth of the board grows along one of its axes
+  enum Tilt { FRONTAL = 0, TILT_X_POS, TILT_X_NEG, TILT_Y_POS, TILT_Y_NEG };
+  static constexpr int kNumTilts = 5;
+
+  ExtractionCoverage(const ExtractionCoverageOptions& options,
+                     const std::vector<cv::Point3f>& board_pts);
+
+  void AddView(const cv::Size& image_size,
+               const aligned_vector<Eigen::Vector2d>& corners,
+               const std::vector<int>& object_pt_ids);
+
+  //! True once all targets are met
+  bool TargetsMet() const;
+
+  //! Statistics and whether the targets were met
+  nlohmann::json ToJson() const;
+
+  //! Tilt from the perspective part of the homography of the board points,
+  //! centered and scaled to unit extent, which does not depend on the
+  //! intrinsics. False if there are too few corners.
+  bool TiltOfView(const aligned_vector<Eigen::Vector2d>& corners,
+                  const std::vector<int>& object_pt_ids,
+                  Tilt* tilt) const;
+
+  double CoveredCellFraction() const;
+
+  //! views with at least 4 corners
+  int NumViews() const { return nr_views_; }
+
+ private:
+  ExtractionCoverageOptions options_;
+  //! board points centered and scaled to unit extent
+  std::vector<cv::Point2f> board_xy_;
+  std::vector<int> cell_corners_;
+  int nr_covered_cells_ = 0;
+  int nr_views_ = 0;
+  std::array<int, kNumTilts> tilt_views_{};
+};
+
+}  // namespace core
+}  // namespace OpenICC
@@ -15,8 +15,16 @@
 
 #pragma once
 
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "OpenCameraCalibrator/utils/imu_excitation.h"
+#include "OpenCameraCalibrator/utils/json.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include "OpenCameraCalibrator/core/spline_trajectory_estimator.h"
@@ -24,11 +32,68 @@
 namespace OpenICC {
 namespace core {
 
+//! default spline order. ImuCameraCalibratorT and SplineTrajectoryEstimator
+//! are compiled for the orders [MIN_SPLINE_N, MAX_SPLINE_N]
 const int SPLINE_N = 6;
+const int MIN_SPLINE_N = 4;
+const int MAX_SPLINE_N = 6;
 
-class ImuCameraCalibrator {
+//! Builds the camera dataset of the spline calibration: the board points and
+//! poses of pose_dataset, which might have been optimized, and the corners of
+//! scene_json for every view that has a pose. The views are shifted by
+//! t_offset_cam_s and get the intrinsics of camera.
+void BuildSplineCalibrationDataset(const theia::Reconstruction& pose_dataset,
+                                   const nlohmann::json& scene_json,
+                                   const theia::Camera& camera,
+                                   const double t_offset_cam_s,
+                                   theia::Reconstruction& recon_calib_dataset);
+
+//! One recording of a joint calibration, see MergeSplineRecordings
+struct SplineRecording {
+  std::shared_ptr<const theia::Reconstruction> vision_dataset;
+  std::shared_ptr<const CameraTelemetryData> telemetry_data;
+  double time_offset_imu_to_cam = 0.0;
+};
+
+//! Lays several recordings of the same rig out on one time axis, each
+//! shifted to start gap_s after the end of the previous one, so one spline
+//! covers all of them. The views of all recordings share the board points.
+//! The IMU sample times include the time offset of their recording, so the
+//! merged telemetry has a time offset of 0. recording_segments_s are the
+//! [start, end] times of the recordings on the merged axis, see
+//! ImuCameraCalibratorT::SetRecordingSegments. False if a recording has no
+//! view.
+bool MergeSplineRecordings(
+    const std::vector<SplineRecording>& recordings,
+    const double gap_s,
+    const int num_threads,
+    theia::Reconstruction& merged_dataset,
+    CameraTelemetryData& merged_telemetry,
+    std::vector<std::pair<double, double>>& recording_segments_s);
+
+//! Adds the views of a further camera of the rig to rig_dataset, as
+//! camera intrinsics group camera, see
+//! SplineTrajectoryEstimator::SetNumRigCameras. The views are shifted by
+//! time_shift_s onto the time axis of the first camera, i.e. the time offset
+//! of the first camera minus the one of this camera. The board points are
+//! shared with the other cameras.
+void AddRigCameraViews(const theia::Reconstruction& camera_dataset,
+                       const theia::CameraIntrinsicsGroupId camera,
+                       const double time_shift_s,
+                       theia::Reconstruction& rig_dataset);
+
+//! Continuous time IMU to camera calibration with a spline of order _N.
+//! Every residual touches _N SO3 and _N R3 knots, so lower orders are
+//! cheaper but less flexible.
+template <int _N>
+class ImuCameraCalibratorT {
  public:
-  ImuCameraCalibrator() {}
+  static constexpr int N = _N;
+
+  ImuCameraCalibratorT() {}
+  //! Copies vision_dataset once into the shared observation store. Only the
+  //! IMU samples inside the spline are copied out of telemetry_data, it is
+  //! not referenced afterwards.
   void BatchInitSpline(
       const theia::Reconstruction& vision_dataset,
       const Sophus::SE3<double>& T_i_c_init,
@@ -39,27 +104,121 @@ class ImuCameraCalibrator {
       const ThreeAxisSensorCalibParams<double> accl_intrinsics,
       const ThreeAxisSensorCalibParams<double> gyro_intrinsics);
 
-  double Optimize(const int iterations, const int optim_flags);
+  //! vision_dataset is shared with the spline estimator without any copy
+  void BatchInitSpline(
+      std::shared_ptr<const theia::Reconstruction> vision_dataset,
+      const Sophus::SE3<double>& T_i_c_init,
+      const OpenICC::SplineWeightingData& spline_weight_data,
+      const double time_offset_imu_to_cam,
+      const OpenICC::CameraTelemetryData& telemetry_data,
+      const double initial_line_delay,
+      const ThreeAxisSensorCalibParams<double> accl_intrinsics,
+      const ThreeAxisSensorCalibParams<double> gyro_intrinsics);
+
+  //! Starts an online calibration at t0_s without any measurements. Views
+  //! can be added to vision_dataset between OptimizeOnline calls, IMU
+  //! samples are added with AddImuSamples.
+  void InitOnlineSpline(
+      std::shared_ptr<const theia::Reconstruction> vision_dataset,
+      const Sophus::SE3<double>& T_i_c_init,
+      const OpenICC::SplineWeightingData& spline_weight_data,
+      const double t0_s,
+      const double initial_line_delay,
+      const ThreeAxisSensorCalibParams<double> accl_intrinsics,
+      const ThreeAxisSensorCalibParams<double> gyro_intrinsics);
+
+  //! Copies the samples of telemetry_data before t_end_s that are newer
+  //! than the last added sample, so the same buffer can be passed again as
+  //! it grows
+  void AddImuSamples(const OpenICC::CameraTelemetryData& telemetry_data,
+                     const double time_offset_imu_to_cam,
+                     const double t_end_s =
+                         std::numeric_limits<double>::max());
+
+  //! Fixed lag online step: appends knots up to t_now_s and optimizes the
+  //! measurements of the last lag_s seconds. Older knots are kept at their
+  //! estimate instead of being marginalized, so the global parameters are
+  //! only constrained by the current window. Returns the mean reprojection
+  //! error, 0 if there is no view yet.
+  double OptimizeOnline(
+      const double t_now_s,
+      const double lag_s,
+      const int iterations,
+      const int optim_flags,
+      const SplineSolverOptions& solver_options = SplineSolverOptions());
+
+  double Optimize(
+      const int iterations,
+      const int optim_flags,
+      const SplineSolverOptions& solver_options = SplineSolverOptions());
+
+  //! Optimizes the spline in overlapping windows of window_s seconds instead
+  //! of one problem covering the whole sequence. Each window gets its own
+  //! ceres problem, so memory and factorization cost scale with the window
+  //! length. Global parameters (T_i_c, gravity, intrinsics, line delay) are
+  //! carried from window to window, knots reaching into the previous window
+  //! are kept fixed. Returns the mean reprojection error.
+  double OptimizeWindowed(
+      const int iterations,
+      const int optim_flags,
+      const double window_s,
+      const double overlap_s,
+      const SplineSolverOptions& solver_options = SplineSolverOptions());
+
+  //! Coarse to fine initialization. Optimizes the spline with the knot
+  //! spacing scaled by each of coarse_factors in turn (e.g. {4, 2}), each
+  //! level initialized from the previous one. Finally upsamples the spline
+  //! to the target spacing and adds all measurements again, so call Optimize
+  //! or OptimizeWindowed afterwards to refine. Returns the mean reprojection
+  //! error of the last coarse level.
+  double OptimizeCoarseLevels(
+      const std::vector<int>& coarse_factors,
+      const int iterations,
+      const int optim_flags,
+      const SplineSolverOptions& solver_options = SplineSolverOptions());
+
+  //! Decoupled initialization before the joint Optimize. First solves a
+  //! rotation only problem: the SO3 knots, and the gyroscope bias spline if
+  //! optim_flags frees the biases, against the gyroscope samples and the
+  //! view orientations, with T_i_c fixed. Then fits the R3 knots to the view
+  //! positions with the new rotations. Both problems are small compared to
+  //! the joint one, which then starts much closer to its optimum. All
+  //! measurements are added again afterwards. Returns the mean reprojection
+  //! error.
+  double PreSolveRotation(
+      const int iterations,
+      const int optim_flags,
+      const SplineSolverOptions& solver_options = SplineSolverOptions());
 
   void ToTheiaReconDataset(theia::Reconstruction& output_recon);
 
   void ClearSpline();
 
-  SplineTrajectoryEstimator<SPLINE_N> trajectory_;
+  SplineTrajectoryEstimator<_N> trajectory_;
 
-  //! camera timestamps in seconds
-  std::vector<double> GetCamTimestamps() { return cam_timestamps_; }
+  //! Per view reprojection errors of the last Optimize* call, gathered
+  //! with its mean reprojection error
+  const ReprojectionErrorReport& GetReprojectionErrorReport() const {
+    return reprojection_errors_;
+  }
 
-  //! get gyroscope measurements
-  aligned_map<double, Eigen::Vector3d> GetGyroMeasurements() {
-    return gyro_measurements_;
+  //! camera timestamps in seconds
+  const std::vector<double>& GetCamTimestamps() const {
+    return cam_timestamps_;
   }
 
-  //! get accelerometer measurements
-  aligned_map<double, Eigen::Vector3d> GetAcclMeasurements() {
-    return accl_measurements_;
+  //! sorted timestamps in seconds of the IMU samples inside the spline,
+  //! shared by GetGyroMeasurements and GetAcclMeasurements
+  const std::vector<double>& GetImuTimestamps() const {
+    return imu_timestamps_s_;
   }
 
+  //! gyroscope measurement i was taken at GetImuTimestamps()[i]
+  const vec3_vector& GetGyroMeasurements() const { return gyro_measurements_; }
+
+  //! accelerometer measurement i was taken at GetImuTimestamps()[i]
+  const vec3_vector& GetAcclMeasurements() const { return accl_measurements_; }
+
   //! Use this function if we really know the gravity direction of
   //! the calibration board (e.g. flat on the ground -> [0,0,9.81])
   void SetKnownGravityDir(const Eigen::Vector3d& gravity);
@@ -72,6 +231,125 @@ class ImuCameraCalibrator {
   double GetCalibratedRSLineDelay() { return trajectory_.GetRSLineDelay(); }
   double GetInitialRSLineDelay() { return inital_cam_line_delay_s_; }
 
+  //! Average up to decimation consecutive IMU samples into one accelerometer
+  //! and one gyroscope residual. Groups never cross a SO3 knot span and the
+  //! residual weight is scaled by sqrt(nr samples) to account for the reduced
+  //! noise of the average. Keep decimation * dt_imu well below the knot
+  //! spacing, as the average is treated as a measurement at the mean time.
+  //! 1 adds one residual per raw sample.
+  void SetImuDecimation(const int decimation) {
+    imu_decimation_ = std::max(1, decimation);
+  }
+
+  //! Fit the initial R3 knots to the view positions in a least squares
+  //! sense instead of only interpolating them at the knot times. Call
+  //! before BatchInitSpline
+  void SetFitInitialKnots(const bool fit) { fit_initial_knots_ = fit; }
+
+  //! Only add residuals inside the segments of sufficient IMU excitation,
+  //! see utils::SelectExcitedSegments. Knots between the segments are not
+  //! part of the problem, so the segments only share the global parameters
+  //! and the bias splines. Call before BatchInitSpline
+  void SetExcitationSegmentSelection(const utils::ExcitationOptions& options) {
+    select_excited_segments_ = true;
+    excitation_options_ = options;
+  }
+
+  //! Initial T_i_c and line delays of the cameras 1, 2, ... of a rig whose
+  //! views were added with AddRigCameraViews. Camera 0 is the one passed to
+  //! BatchInitSpline. All cameras share the spline and the IMU parameters.
+  //! Call before BatchInitSpline
+  void SetRigCameras(const aligned_vector<Sophus::SE3d>& T_i_c_init,
+                     const std::vector<double>& line_delays_s) {
+    rig_T_i_c_init_ = T_i_c_init;
+    rig_line_delays_s_ = line_delays_s;
+  }
+
+  //! Calibrate several recordings merged with MergeSplineRecordings
+  //! jointly. Residuals are only added inside the recordings and every
+  //! recording gets its own gravity, as the board can be placed differently.
+  //! T_i_c, IMU intrinsics, line delay and the bias splines are shared. The
+  //! gap between the recordings has to be longer than the support of a
+  //! knot, so no residual connects two recordings. Call before
+  //! BatchInitSpline
+  void SetRecordingSegments(
+      const std::vector<std::pair<double, double>>& recording_segments_s) {
+    recording_segments_ = recording_segments_s;
+  }
+
+  //! [start, end] times in seconds of the selected segments, empty if the
+  //! whole spline is used
+  const std::vector<std::pair<double, double>>& GetSegments() const {
+    return segments_;
+  }
+
+  //! Knot spacing of the accelerometer and gyroscope bias splines in
+  //! seconds, 10 s each by default. Call before BatchInitSpline
+  void SetBiasKnotSpacing(const double dt_accl_s, const double dt_gyro_s) {
+    bias_dt_accl_s_ = dt_accl_s;
+    bias_dt_gyro_s_ = dt_gyro_s;
+    adaptive_bias_dt_ = false;
+  }
+
+  //! Chooses the bias knot spacing from the per axis tau of the bias
+  //! instability of an Allan variance fit (see AllanVarianceFitter). The bias
+  //! is about constant below that tau, so the smallest tau over the axes is
+  //! used, clamped to [kMinBiasKnotSpacingS, spline duration]. Short
+  //! datasets then get a single bias segment. Call before BatchInitSpline
+  void SetBiasKnotSpacingFromAllanVariance(
+      const Eigen::Vector3d& accl_bias_instability_time_s,
+      const Eigen::Vector3d& gyro_bias_instability_time_s) {
+    bias_dt_accl_s_ = accl_bias_instability_time_s.minCoeff();
+    bias_dt_gyro_s_ = gyro_bias_instability_time_s.minCoeff();
+    adaptive_bias_dt_ = true;
+  }
+
+  //! One reprojection residual per corner for global shutter cameras, see
+  //! SplineTrajectoryEstimator::SetCornerReprojectionResiduals. Call before
+  //! BatchInitSpline
+  void SetCornerReprojectionResiduals(const bool corner_residuals) {
+    trajectory_.SetCornerReprojectionResiduals(corner_residuals);
+  }
+
+  //! Row band size for rolling shutter residuals, see
+  //! SplineTrajectoryEstimator::SetRollingShutterBandRows
+  void SetRollingShutterBandRows(const double band_rows) {
+    trajectory_.SetRollingShutterBandRows(band_rows);
+  }
+
+  //! Single precision corner observations, see
+  //! SplineTrajectoryEstimator::SetCompactObservations. Call before
+  //! BatchInitSpline
+  void SetCompactObservations(const bool compact) {
+    trajectory_.SetCompactObservations(compact);
+  }
+
+  //! Evaluation counts and times per residual type, see
+  //! SplineTrajectoryEstimator::SetResidualProfiling. Call before
+  //! BatchInitSpline
+  void SetResidualProfiling(const bool profile) {
+    trajectory_.SetResidualProfiling(profile);
+  }
+
+  //! Initialize the next BatchInitSpline from a previous solution of the
+  //! same rig. T_i_c, gravity, IMU intrinsics, line delay and biases replace
+  //! the initial values passed to BatchInitSpline. The knots are taken over
+  //! as well if the snapshot has the same knot grid, e.g. for the same
+  //! dataset. Otherwise they are initialized from the camera poses as usual.
+  void SetWarmStart(std::shared_ptr<const SplineSnapshot> snapshot) {
+    warm_start_ = std::move(snapshot);
+  }
+
+  //! Current state of the spline, e.g. to warm start another calibration
+  void GetSnapshot(SplineSnapshot& snapshot) const {
+    trajectory_.GetSnapshot(snapshot);
+  }
+
+  //! Number of threads used to build the IMU residuals
+  void SetNumThreads(const int num_threads) {
+    num_threads_ = std::max(1, num_threads);
+  }
+
   void GetIMUIntrinsics(ThreeAxisSensorCalibParams<double>& acc_intrinsics,
                         ThreeAxisSensorCalibParams<double>& gyr_intrinsics,
                         const int64_t time_ns = 0);
@@ -79,14 +357,47 @@ class ImuCameraCalibrator {
  private:
   void InitializeGravity(const OpenICC::CameraTelemetryData& telemetry_data);
 
+  //! Initializes gravity from the stored IMU sample closest to a view
+  void InitializeGravityFromImuSamples();
+
+  //! Gravity in the world frame from the stored IMU sample closest to the
+  //! first view in [t_start_s, t_end_s] that has one. False if none has
+  bool EstimateGravityFromImuSamples(const double t_start_s,
+                                     const double t_end_s,
+                                     Eigen::Vector3d& gravity) const;
+
+  //! Splits the gravity of trajectory_ at the recording segments and
+  //! initializes every segment from its IMU samples
+  void InitializeRecordingGravity();
+
+  //! Appends the samples in [last stored sample or t0_s_, t_end_s)
+  void AppendImuSamples(const OpenICC::CameraTelemetryData& telemetry_data,
+                        const double time_offset_imu_to_cam,
+                        const double t_end_s);
+
+  //! True if there are no segments or t_s is inside one of them
+  bool InSelectedSegment(const double t_s) const;
+
+  //! Adds the camera measurements in [t_start_s, t_end_s] to the spline
+  void AddVisionMeasurements(const double t_start_s, const double t_end_s);
+
+  //! Adds the IMU measurements in [t_start_s, t_end_s) to the spline, only
+  //! gyroscope residuals if gyro_only
+  void AddImuMeasurements(const double t_start_s,
+                          const double t_end_s,
+                          const bool gyro_only = false);
+
   //! camera timestamps
   std::vector<double> cam_timestamps_;
 
-  //! accl measurements
-  aligned_map<double, Eigen::Vector3d> gyro_measurements_;
+  //! sorted IMU timestamps in seconds, shared by accl and gyro measurements
+  std::vector<double> imu_timestamps_s_;
 
   //! gyro measurements
-  aligned_map<double, Eigen::Vector3d> accl_measurements_;
+  vec3_vector gyro_measurements_;
+
+  //! accl measurements
+  vec3_vector accl_measurements_;
 
   //! spline know spacing in R3 and SO3 in seconds
   SplineWeightingData spline_weight_data_;
@@ -111,11 +422,74 @@ class ImuCameraCalibrator {
 
   Sophus::SE3<double> T_i_c_init_;
 
+  //! cameras 1, 2, ... of a rig, see SetRigCameras
+  aligned_vector<Sophus::SE3d> rig_T_i_c_init_;
+  std::vector<double> rig_line_delays_s_;
+
   //! is gravity direction in sensor frame is initialized
   bool reestimate_biases_ = false;
 
-  theia::Reconstruction image_data_;
+  //! number of IMU samples averaged into one residual
+  int imu_decimation_ = 1;
+
+  bool fit_initial_knots_ = false;
+
+  //! excitation based segment selection, segments_ sorted by start time
+  bool select_excited_segments_ = false;
+  utils::ExcitationOptions excitation_options_;
+  std::vector<std::pair<double, double>> segments_;
+
+  //! recordings of a joint calibration, sorted by start time
+  std::vector<std::pair<double, double>> recording_segments_;
+
+  //! bias spline knot spacing in seconds, clamped to the spline duration if
+  //! it was chosen from the Allan variance
+  static constexpr double kMinBiasKnotSpacingS = 1.0;
+
+  //! standard deviation of the view orientations in PreSolveRotation
+  static constexpr double kPreSolveOrientationStdRad = 0.01;
+  double bias_dt_accl_s_ = 10.0;
+  double bias_dt_gyro_s_ = 10.0;
+  bool adaptive_bias_dt_ = false;
+
+  //! number of threads used to build the IMU residuals
+  int num_threads_ = 1;
+
+  //! previous solution used as initialization, can be empty
+  std::shared_ptr<const SplineSnapshot> warm_start_;
+
+  //! camera observations, shared with trajectory_
+  std::shared_ptr<const theia::Reconstruction> image_data_;
+
+  //! see GetReprojectionErrorReport
+  ReprojectionErrorReport reprojection_errors_;
 };
 
+using ImuCameraCalibrator = ImuCameraCalibratorT<SPLINE_N>;
+
+//! Calls f(std::integral_constant<int, N>()) for the runtime spline order N,
+//! e.g. to create an ImuCameraCalibratorT<N>. Returns false if N is not in
+//! [MIN_SPLINE_N, MAX_SPLINE_N]
+template <typename F>
+bool DispatchSplineOrder(const int spline_order, F&& f) {
+  switch (spline_order) {
+    case 4:
+      f(std::integral_constant<int, 4>());
+      return true;
+    case 5:
+      f(std::integral_constant<int, 5>());
+      return true;
+    case 6:
+      f(std::integral_constant<int, 6>());
+      return true;
+    default:
+      return false;
+  }
+}
+
+extern template class ImuCameraCalibratorT<4>;
+extern template class ImuCameraCalibratorT<5>;
+extern template class ImuCameraCalibratorT<6>;
+
 }  // namespace core
 }  // namespace OpenICC
@@ -15,6 +15,9 @@
 
 #pragma once
 
+#include <theia/sfm/reconstruction.h>
+
+#include "OpenCameraCalibrator/utils/time_series.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 namespace OpenICC {
@@ -23,19 +26,29 @@ namespace core {
 class ImuToCameraRotationEstimator {
  public:
   ImuToCameraRotationEstimator() {}
-  ImuToCameraRotationEstimator(const quat_map& visual_rotations,
-                               const vec3_map& imu_angular_vel)
-      : visual_rotations_(visual_rotations),
-        imu_angular_vel_(imu_angular_vel) {}
+  //! both series need to be sorted, see TimeSeries::Sort
+  ImuToCameraRotationEstimator(quat_series visual_rotations,
+                               vec3_series imu_angular_vel)
+      : visual_rotations_(std::move(visual_rotations)),
+        imu_angular_vel_(std::move(imu_angular_vel)) {}
 
-  void SetVisualRotations(const quat_map& visual_rotations) {
-    visual_rotations_ = visual_rotations;
+  void SetVisualRotations(quat_series visual_rotations) {
+    visual_rotations_ = std::move(visual_rotations);
   }
 
-  void SetAngularVelocities(const vec3_map& imu_angular_vel) {
-    imu_angular_vel_ = imu_angular_vel;
+  void SetAngularVelocities(vec3_series imu_angular_vel) {
+    imu_angular_vel_ = std::move(imu_angular_vel);
   }
 
+  //! Sets the visual rotations of the views of a pose dataset, interpolated
+  //! to the median camera rate, and the gyroscope measurements minus
+  //! gyro_bias. The views are shifted by the first image timestamp of the
+  //! telemetry if it has any. Returns the mean IMU sample interval in s.
+  double SetMeasurementsFromPoseDataset(
+      const theia::Reconstruction& pose_dataset,
+      const CameraTelemetryData& telemetry_data,
+      const Eigen::Vector3d& gyro_bias);
+
   bool EstimateCameraImuRotation(const double dt_imu,
                                  Eigen::Matrix3d& R_imu_to_camera,
                                  double& time_offset_imu_to_camera,
@@ -45,7 +58,7 @@ class ImuToCameraRotationEstimator {
 
   double SolveClosedForm(const vec3_vector& angVis,
                          const vec3_vector& angImu,
-                         const std::vector<double> timestamps_s,
+                         const std::vector<double>& timestamps_s,
                          const double td,
                          const double dt_imu,
                          Eigen::Matrix3d& Rs,
@@ -53,15 +66,52 @@ class ImuToCameraRotationEstimator {
 
   void EnableGyroBiasEstimation() { estimate_gyro_bias_ = true; }
 
+  //! Search the time offset with golden-section over the whole +-1s range
+  //! instead of refining the cross-correlation estimate
+  void EnableFullOffsetSearch() { full_offset_search_ = true; }
+
  private:
+  //! SolveClosedForm on signals resampled to a uniform grid with spacing
+  //! grid_dt, using the accumulated 3x3 covariance
+  double SolveClosedFormUniform(const vec3_vector& vis_grid,
+                                const vec3_vector& imu_grid,
+                                const double grid_dt,
+                                const double td,
+                                Eigen::Matrix3d& Rs,
+                                Eigen::Vector3d& bias) const;
+
+  //! Golden-section search of the time offset in [a, b] on uniform grids
+  //! until the bracket is smaller than tolerance. Returns the offset and the
+  //! solution of the best evaluated offset in Rs, bias and error.
+  double GoldenSectionTimeOffset(const vec3_vector& vis_grid,
+                                 const vec3_vector& imu_grid,
+                                 const double grid_dt,
+                                 double a,
+                                 double b,
+                                 const double tolerance,
+                                 Eigen::Matrix3d& Rs,
+                                 Eigen::Vector3d& bias,
+                                 double& error,
+                                 unsigned int& iter) const;
+
+  //! Coarse time offset from the FFT cross-correlation of the angular
+  //! velocity magnitudes, a multiple of grid_dt in [-max_offset, max_offset]
+  double CorrelateTimeOffset(const vec3_vector& vis_grid,
+                             const vec3_vector& imu_grid,
+                             const double grid_dt,
+                             const double max_offset) const;
+
   //! visual rotations
-  quat_map visual_rotations_;
+  quat_series visual_rotations_;
 
   //! imu angular velocities
-  vec3_map imu_angular_vel_;
+  vec3_series imu_angular_vel_;
 
   //! estimate bias
   bool estimate_gyro_bias_ = false;
+
+  //! skip the cross-correlation initialization
+  bool full_offset_search_ = false;
 };
 
 }  // namespace core
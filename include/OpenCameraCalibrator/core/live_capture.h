@@ -0,0 +1,127 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/spsc_ring_buffer.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+//! Pluggable IMU of a live capture, e.g. a serial or network device
+class ImuSource {
+ public:
+  virtual ~ImuSource() {}
+
+  //! Blocks until the next sample arrived. Timestamps are in seconds on the
+  //! clock of the camera frames. Returns false if the source ended.
+  virtual bool Read(ImuReading<double>& accelerometer,
+                    ImuReading<double>& gyroscope) = 0;
+
+  //! Called from LiveCapture::Stop to unblock a pending Read
+  virtual void Close() {}
+};
+
+//! Live camera and IMU front-end. The camera and the IMU are read on their
+//! own threads into lock free ring buffers, Process drains them on the
+//! calling thread. If board detection falls behind, new frames are dropped
+//! while IMU samples keep being buffered.
+class LiveCapture {
+ public:
+  LiveCapture(const size_t frame_buffer_size = 8,
+              const size_t imu_buffer_size = 1 << 14)
+      : frames_(frame_buffer_size), imu_samples_(imu_buffer_size) {}
+
+  ~LiveCapture() { Stop(); }
+
+  //! Opens a V4L2 device given by its index (e.g. "0") or anything else
+  //! as GStreamer pipeline ending in an appsink
+  bool OpenCamera(const std::string& device);
+
+  void SetImuSource(std::unique_ptr<ImuSource> imu_source) {
+    imu_source_ = std::move(imu_source);
+  }
+
+  //! Starts the capture threads
+  bool Start();
+
+  //! Stops and joins the capture threads. Buffered data can still be
+  //! processed afterwards.
+  void Stop();
+
+  //! Appends the buffered IMU samples to Telemetry() and detects the board
+  //! in the buffered frames. Views with corners are added to scene_writer.
+  //! Returns the number of processed frames.
+  size_t Process(BoardExtractor& extractor,
+                 const double img_downsample_factor,
+                 io::SceneWriter& scene_writer);
+
+  //! Writes the scene header of the processed frames and closes the writer
+  bool Finish(BoardExtractor& extractor, io::SceneWriter& scene_writer);
+
+  //! IMU samples processed so far, e.g. for
+  //! ImuCameraCalibratorT::AddImuSamples
+  const CameraTelemetryData& Telemetry() const { return telemetry_; }
+
+  size_t NumDroppedFrames() const { return nr_dropped_frames_; }
+  size_t NumDroppedImuSamples() const { return nr_dropped_imu_samples_; }
+
+ private:
+  struct Frame {
+    double timestamp_s = 0.0;
+    cv::Mat image;
+  };
+
+  struct ImuSample {
+    ImuReading<double> accelerometer;
+    ImuReading<double> gyroscope;
+  };
+
+  void CaptureFrames();
+
+  void CaptureImu();
+
+  cv::VideoCapture camera_;
+  std::unique_ptr<ImuSource> imu_source_;
+
+  utils::SpscRingBuffer<Frame> frames_;
+  utils::SpscRingBuffer<ImuSample> imu_samples_;
+
+  std::atomic<bool> running_{false};
+  std::thread camera_thread_;
+  std::thread imu_thread_;
+
+  std::atomic<size_t> nr_dropped_frames_{0};
+  std::atomic<size_t> nr_dropped_imu_samples_{0};
+
+  CameraTelemetryData telemetry_;
+  //! size and timestamps of the processed frames for the scene header
+  cv::Size image_size_;
+  std::vector<double> frame_timestamps_s_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
@@ -21,10 +21,18 @@
 #include <theia/sfm/reconstruction.h>
 #include <theia/solvers/ransac.h>
 
+#include "OpenCameraCalibrator/utils/bounded_queue.h"
 #include "OpenCameraCalibrator/utils/json.h"
 #include "OpenCameraCalibrator/utils/types.h"
+#include "OpenCameraCalibrator/utils/undistortion_lut.h"
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace OpenICC {
 namespace core {
@@ -40,25 +48,184 @@ class PoseEstimator {
  public:
   PoseEstimator();
 
+  ~PoseEstimator();
+
+  PoseEstimator(const PoseEstimator&) = delete;
+  PoseEstimator& operator=(const PoseEstimator&) = delete;
+
   bool EstimatePosePinhole(const theia::ViewId& view_id,
                            const std::vector<theia::FeatureCorrespondence2D3D>&
                                correspondences_undist,
                            const std::vector<int>& board_pts3_ids);
 
+  //! Undistortion and RANSAC run on num_threads threads, the views are then
+  //! added to the pose dataset in timestamp order, so the result does not
+  //! depend on the number of threads.
   bool EstimatePosesFromJson(const nlohmann::json& scene_json,
                              const theia::Camera camera);
 
+  //! Streaming version of EstimatePosesFromJson: the views are passed to
+  //! AddStreamingView while they are detected and blocks of views are
+  //! estimated on num_threads threads meanwhile. board_json holds the board
+  //! points like a scene header. Gives the same pose dataset as
+  //! EstimatePosesFromJson once FinishStreaming returns.
+  void StartStreaming(const nlohmann::json& board_json,
+                      const theia::Camera& camera);
+
+  //! Adds the corners of the next view, in timestamp order from one thread.
+  //! Views without corners are skipped.
+  void AddStreamingView(const double timestamp_us,
+                        const aligned_vector<Eigen::Vector2d>& corners,
+                        const std::vector<int>& ids);
+
+  //! Waits for the pending views and adds them to the pose dataset.
+  //! Returns false if StartStreaming was not called.
+  bool FinishStreaming();
+
+  //! Undistort the corners with a lookup table built for the camera passed
+  //! to EstimatePosesFromJson. nullptr solves every corner exactly.
+  void SetUndistortionLut(std::shared_ptr<const utils::UndistortionLut> lut) {
+    undistortion_lut_ = lut;
+  }
+
+  //! Number of threads used for the per view pose estimation
+  void SetNumThreads(const int num_threads) {
+    num_threads_ = std::max(1, num_threads);
+  }
+
+  //! Seed the pose of a view with the pose of the previous view if they are
+  //! at most max_gap_s apart and only run RANSAC if the refined pose does
+  //! not explain the correspondences. On by default.
+  void SetTemporalPrediction(const bool temporal_prediction,
+                             const double max_gap_s = 0.2) {
+    temporal_prediction_ = temporal_prediction;
+    max_temporal_prediction_gap_s_ = max_gap_s;
+  }
+
   void GetPoseDataset(theia::Reconstruction& pose_dataset) {
     pose_dataset = pose_dataset_;
   }
 
-  void OptimizeBoardPoints();
+  //! Refines the board points observed often enough with the poses held
+  //! fixed. With compute_covariance the empirical covariance of every
+  //! refined point is computed as well, see BoardPointCovariances.
+  void OptimizeBoardPoints(const bool compute_covariance = false);
+
+  //! Empirical covariances of the board points [m^2], only filled by
+  //! OptimizeBoardPoints with compute_covariance
+  const std::map<theia::TrackId, Eigen::Matrix3d>& BoardPointCovariances()
+      const {
+    return board_point_covariances_;
+  }
+
+  //! Variance factor of the last covariance computation
+  double EmpiricalVarianceFactor() const { return empirical_variance_factor_; }
 
+  //! Refines every view pose with the board points held fixed. The views
+  //! share no free parameters, so they are refined on num_threads threads
+  //! with RefinePose instead of one bundle adjustment problem per view.
   void OptimizeAllPoses();
 
   void FilterBadPoses();
 
  private:
+  //! Undistorted correspondences of one view and its RANSAC pose
+  struct ViewPoseEstimate {
+    double timestamp_s = 0.0;
+    std::vector<int> board_pts3_ids;
+    //! pixel corners, cleared once they are undistorted
+    vec2_vector corners;
+    std::vector<theia::FeatureCorrespondence2D3D> correspondences_undist;
+    theia::CalibratedAbsolutePose pose;
+    std::vector<int> inliers;
+    bool success = false;
+  };
+
+  //! Consecutive views that are estimated together, see StartStreaming
+  struct StreamBlock {
+    int first_view = 0;
+    std::vector<ViewPoseEstimate> estimates;
+  };
+
+  //! Sets the RANSAC threshold for camera and adds the board points of
+  //! scene_json to the pose dataset
+  void PrepareDataset(const nlohmann::json& scene_json,
+                      const theia::Camera& camera);
+
+  //! Fills the correspondences of estimate from its pixel corners
+  void UndistortView(const theia::Camera& camera,
+                     ViewPoseEstimate* estimate) const;
+
+  //! Estimates the poses of nr_views consecutive views, the first one has
+  //! the index first_view in the whole sequence. Counts the poses that were
+  //! predicted from the previous view and initialized from the homography.
+  void EstimateBlockPoses(const int first_view,
+                          const int nr_views,
+                          ViewPoseEstimate* estimates,
+                          int* nr_predicted,
+                          int* nr_planar) const;
+
+  //! Adds the views with a pose to the pose dataset in the given order and
+  //! removes the ones with a large reprojection error
+  bool AddEstimatesToDataset(const std::vector<ViewPoseEstimate>& estimates,
+                             const theia::Camera& camera);
+
+  //! RANSAC PnP with its own random number generator. Does not modify the
+  //! estimator, so it can run for several views in parallel.
+  bool RansacPose(const std::vector<theia::FeatureCorrespondence2D3D>&
+                      correspondences_undist,
+                  const unsigned int seed,
+                  theia::CalibratedAbsolutePose* pose,
+                  std::vector<int>* inliers) const;
+
+  //! Refines previous_pose on all correspondences. Succeeds if at least
+  //! kMinPredictionInlierRatio of them reproject within the RANSAC threshold
+  bool PredictPose(const std::vector<theia::FeatureCorrespondence2D3D>&
+                       correspondences_undist,
+                   const theia::CalibratedAbsolutePose& previous_pose,
+                   theia::CalibratedAbsolutePose* pose,
+                   std::vector<int>* inliers) const;
+
+  //! Initializes the pose from the homography of the planar board and
+  //! checks it like PredictPose. Fails for boards that are not planar.
+  bool PlanarPose(const std::vector<theia::FeatureCorrespondence2D3D>&
+                      correspondences_undist,
+                  theia::CalibratedAbsolutePose* pose,
+                  std::vector<int>* inliers) const;
+
+  //! Refines pose on all correspondences and collects the inliers, shared
+  //! by PredictPose and PlanarPose
+  bool RefineAndCheckPose(const std::vector<theia::FeatureCorrespondence2D3D>&
+                              correspondences_undist,
+                          theia::CalibratedAbsolutePose* pose,
+                          std::vector<int>* inliers) const;
+
+  //! Levenberg-Marquardt refinement of a calibrated pose (rotation world to
+  //! camera and camera position) on normalized image coordinates with a
+  //! Huber loss. Only touches its arguments, so it can run for several views
+  //! in parallel. Returns false if the normal equations became singular.
+  static bool RefinePose(const vec3_vector& points,
+                         const vec2_vector& features,
+                         const double huber_width,
+                         const int max_iterations,
+                         Eigen::Matrix3d* rotation,
+                         Eigen::Vector3d* position);
+
+  //! Empirical covariances of the given tracks with the poses held fixed.
+  //! The tracks share no free parameters, so the normal equations are 3x3
+  //! per track and are formed and inverted on num_threads threads.
+  void ComputeBoardPointCovariances(
+      const std::vector<theia::TrackId>& track_ids);
+
+  //! Sets the pose of the view, adds the inlier observations and refines the
+  //! pose with bundle adjustment
+  bool AddPoseToView(const theia::ViewId& view_id,
+                     const std::vector<theia::FeatureCorrespondence2D3D>&
+                         correspondences_undist,
+                     const std::vector<int>& board_pts3_ids,
+                     const theia::CalibratedAbsolutePose& pose,
+                     const std::vector<int>& inliers);
+
   //! Pose datasets
   theia::Reconstruction pose_dataset_;
 
@@ -74,11 +241,37 @@ class PoseEstimator {
   //! Save how often a board point has been observed (for point optimization)
   std::unordered_map<theia::TrackId, size_t> tracks_to_nr_obs_;
 
+  //! Board point covariances of OptimizeBoardPoints
+  std::map<theia::TrackId, Eigen::Matrix3d> board_point_covariances_;
+  double empirical_variance_factor_ = 0.0;
+
   //! Minimum number of observations of a scene point to be optimized
   size_t min_num_obs_for_optim_ = 30;
 
   //! PnP type
   theia::PnPType pnp_type_ = theia::PnPType::DLS;
+
+  //! Number of threads for the per view pose estimation
+  int num_threads_ = 1;
+
+  //! Temporal pose prediction, see SetTemporalPrediction
+  static constexpr int kTemporalBlockSize = 32;
+  static constexpr double kMinPredictionInlierRatio = 0.95;
+  bool temporal_prediction_ = true;
+  double max_temporal_prediction_gap_s_ = 0.2;
+
+  //! Optional corner undistortion table
+  std::shared_ptr<const utils::UndistortionLut> undistortion_lut_;
+
+  //! Streaming pose estimation, see StartStreaming. The blocks are only
+  //! appended by the thread adding the views, full blocks go to the workers.
+  theia::Camera stream_camera_;
+  std::vector<std::unique_ptr<StreamBlock>> stream_blocks_;
+  std::unique_ptr<utils::BoundedQueue<StreamBlock*>> stream_jobs_;
+  std::vector<std::thread> stream_threads_;
+  int stream_nr_views_ = 0;
+  std::atomic<int> stream_nr_predicted_{0};
+  std::atomic<int> stream_nr_planar_{0};
 };
 
 }  // namespace core
@@ -0,0 +1,51 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/pose_estimator.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Passes the views of a board extraction to a streaming PoseEstimator and
+//! to scene_writer, so the poses are estimated while the video is decoded.
+//! Close finishes the pose estimation. The estimator has to be started with
+//! PoseEstimator::StartStreaming and both have to outlive the writer.
+class PoseStreamSceneWriter : public io::SceneWriter {
+ public:
+  PoseStreamSceneWriter(PoseEstimator* pose_estimator,
+                        io::SceneWriter* scene_writer)
+      : pose_estimator_(pose_estimator), scene_writer_(scene_writer) {}
+
+  //! Opens scene_writer, which is usually opened already
+  bool Open(const std::string& save_path) override;
+
+  void AddView(const double timestamp_us,
+               const aligned_vector<Eigen::Vector2d>& corners,
+               const std::vector<int>& ids) override;
+
+  bool Close(const nlohmann::json& header) override;
+
+ private:
+  PoseEstimator* pose_estimator_;
+  io::SceneWriter* scene_writer_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,118 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Segmentation and frequency bands of the PSD noise estimate
+struct PsdNoiseEstimatorOptions {
+  //! samples per Welch segment, consecutive segments overlap by half
+  int segment_length = 4096;
+  //! band [min, max] * sample rate in which the PSD is averaged to the
+  //! white noise density
+  double white_noise_min_freq_ratio = 0.1;
+  double white_noise_max_freq_ratio = 0.4;
+  //! number of lowest non DC bins from which the bias random walk is taken
+  int nr_random_walk_bins = 4;
+};
+
+//! Quick look IMU noise estimate from the Welch power spectral density of
+//! a few minutes of static telemetry, an alternative to the hours of data
+//! AllanVarianceFitter needs. The samples are pushed once and every half
+//! segment a Hann windowed FFT of all six axes is accumulated, so only one
+//! segment is kept in memory.
+//! The two sided PSD of an IMU axis is S(f) = sigma^2 + sigma_b^2 /
+//! (2 pi f)^2. The white noise density sigma is taken from the mean PSD in
+//! the white noise band, the bias random walk sigma_b from the lowest
+//! frequency bins. The latter is only a rough check: it includes the bias
+//! instability and is only resolved if the random walk dominates the white
+//! noise at these bins, i.e. for drifting sensors. Otherwise it is close to
+//! zero and the Allan variance fit is needed.
+class PsdNoiseEstimator {
+ public:
+  explicit PsdNoiseEstimator(
+      const PsdNoiseEstimatorOptions& options = PsdNoiseEstimatorOptions());
+
+  void Push(const Eigen::Vector3d& accl,
+            const Eigen::Vector3d& gyro,
+            const double t_s);
+
+  //! Pushes all samples of telemetry_data
+  void Push(const CameraTelemetryData& telemetry_data);
+
+  //! Computes the noise parameters from the accumulated segments. Fails if
+  //! not a single segment was complete.
+  bool Finish();
+
+  //! Per axis white noise density [m/s^2/sqrt(Hz), rad/s/sqrt(Hz)]
+  const Eigen::Vector3d& GetAcclNoiseDensity() const {
+    return accl_noise_density_;
+  }
+  const Eigen::Vector3d& GetGyroNoiseDensity() const {
+    return gyro_noise_density_;
+  }
+
+  //! Per axis bias random walk [m/s^3/sqrt(Hz), rad/s^2/sqrt(Hz)]
+  const Eigen::Vector3d& GetAcclRandomWalk() const {
+    return accl_random_walk_;
+  }
+  const Eigen::Vector3d& GetGyroRandomWalk() const {
+    return gyro_random_walk_;
+  }
+
+  double GetSampleRate() const { return sample_rate_; }
+  int GetNumSegments() const { return nr_segments_; }
+
+  //! Noise parameters with the keys of the Kalibr IMU yaml, see
+  //! docs/compare_to_kalibr.md, averaged over the axes, and the per axis
+  //! values in accl_/gyro_noise_density and accl_/gyro_random_walk
+  nlohmann::json ToJson() const;
+
+ private:
+  //! Adds the periodograms of the six axes of the current segment
+  void AccumulateSegment();
+
+  PsdNoiseEstimatorOptions options_;
+
+  //! accl x, y, z, gyro x, y, z of the current segment
+  aligned_vector<Eigen::Matrix<double, 6, 1>> segment_;
+  int nr_buffered_ = 0;
+  std::vector<double> window_;
+  //! summed |X_k|^2 of the non negative frequency bins per axis
+  aligned_vector<Eigen::Matrix<double, 6, 1>> periodogram_sum_;
+  int nr_segments_ = 0;
+
+  size_t nr_samples_ = 0;
+  double first_t_s_ = 0.0;
+  double last_t_s_ = 0.0;
+  double sample_rate_ = 0.0;
+
+  Eigen::Vector3d accl_noise_density_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_noise_density_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_random_walk_ = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_random_walk_ = Eigen::Vector3d::Zero();
+};
+
+}  // namespace core
+}  // namespace OpenICC
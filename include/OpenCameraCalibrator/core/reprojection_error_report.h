@@ -0,0 +1,67 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <theia/sfm/types.h>
+
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Histogram of the corner reprojection errors of a view. The last bin
+//! collects every error of at least (nr_bins - 1) * bin_width_px
+struct ReprojectionHistogramOptions {
+  double bin_width_px = 0.25;
+  int nr_bins = 20;
+};
+
+//! Reprojection errors of the corners of one view
+struct ViewReprojectionErrors {
+  theia::ViewId view_id = theia::kInvalidViewId;
+  double timestamp_s = 0.0;
+  int nr_points = 0;
+  double sum_error = 0.0;
+  double max_error = 0.0;
+  std::vector<int> histogram;
+
+  //! Adds the error of one corner, histogram has to have options.nr_bins
+  //! entries
+  void Add(const double error, const ReprojectionHistogramOptions& options);
+
+  double MeanError() const;
+};
+
+//! Reprojection errors of all views, in the order of the evaluated view ids
+struct ReprojectionErrorReport {
+  ReprojectionHistogramOptions histogram_options;
+  std::vector<ViewReprojectionErrors> views;
+
+  int NumPoints() const;
+
+  //! 0 if there are no points
+  double MeanError() const;
+
+  //! Sum of the view histograms
+  std::vector<int> Histogram() const;
+};
+
+nlohmann::json ReprojectionErrorReportToJson(
+    const ReprojectionErrorReport& report);
+
+}  // namespace core
+}  // namespace OpenICC
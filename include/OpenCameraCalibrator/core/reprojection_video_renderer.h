@@ -0,0 +1,108 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <theia/sfm/camera/camera.h>
+
+#include <opencv2/opencv.hpp>
+#include <sophus/se3.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Renders the reprojection of the board points with the spline poses into
+//! the frames of the calibration video and writes them to a video file.
+//! Runs on its own threads, so it can overlap with the output of the
+//! calibration. Frames are decoded on one thread and drawn on num_threads
+//! workers, like the pipelined board extraction.
+class ReprojectionVideoRenderer {
+ public:
+  //! camera holds the intrinsics. The observations and board points are
+  //! taken from the already loaded scene_json. T_w_c are the spline camera
+  //! poses at the video timestamps in ns.
+  ReprojectionVideoRenderer(const theia::Camera& camera,
+                            const nlohmann::json& scene_json,
+                            const aligned_map<int64_t, Sophus::SE3d>& T_w_c);
+
+  ~ReprojectionVideoRenderer();
+
+  void SetNumThreads(const int num_threads) {
+    num_threads_ = std::max(1, num_threads);
+  }
+
+  //! Only render every stride-th frame with an observation
+  void SetFrameStride(const int stride) { frame_stride_ = std::max(1, stride); }
+
+  //! Stop after max_frames rendered frames, 0 renders all
+  void SetMaxFrames(const int max_frames) { max_frames_ = max_frames; }
+
+  //! Starts rendering in the background
+  bool Start(const std::string& video_path, const std::string& output_path);
+
+  //! Waits for the rendering, returns false if it failed
+  bool Wait();
+
+ private:
+  //! Observed corners of one frame
+  struct FrameObservations {
+    aligned_vector<Eigen::Vector2d> corners;
+    std::vector<int> ids;
+  };
+
+  struct RenderJob {
+    int frame_idx = 0;
+    int64_t t_ns = 0;
+    const FrameObservations* observations = nullptr;
+    const Sophus::SE3d* T_w_c = nullptr;
+    cv::Mat image;
+  };
+
+  void Run(const std::string& video_path, const std::string& output_path);
+
+  //! Draws the reprojections into job.image
+  void Render(RenderJob& job) const;
+
+  //! Entry of map closest to t_ns within max_dt_ns, nullptr if none
+  template <typename T, typename Map>
+  static const T* FindClosest(const Map& map,
+                              const int64_t t_ns,
+                              const int64_t max_dt_ns);
+
+  theia::Camera camera_;
+  std::map<int64_t, FrameObservations> observations_;
+  std::map<int, Eigen::Vector3d> board_pts_;
+  aligned_map<int64_t, Sophus::SE3d> T_w_c_;
+
+  int num_threads_ = 1;
+  int frame_stride_ = 1;
+  int max_frames_ = 0;
+
+  std::thread thread_;
+  std::atomic<bool> success_{false};
+};
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,116 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <ceres/ceres.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+//! Evaluation count and time of one residual type during a solve
+struct ResidualTypeProfile {
+  std::string type;
+  size_t evaluations = 0;
+  //! evaluations that also computed Jacobians
+  size_t jacobian_evaluations = 0;
+  double time_s = 0.0;
+};
+
+//! Counts the cost function evaluations per residual type. Every solver
+//! thread writes to counters of its own, Merge sums them up after the solve.
+class ResidualProfiler {
+ public:
+  enum Type {
+    ACCELEROMETER = 0,
+    GYROSCOPE,
+    IMU,
+    GPS,
+    GS_REPROJECTION,
+    RS_REPROJECTION,
+    ORIENTATION
+  };
+  static constexpr int kNumTypes = 7;
+
+  static const char* TypeName(const Type type);
+
+  ResidualProfiler();
+
+  ResidualProfiler(const ResidualProfiler&) = delete;
+  ResidualProfiler& operator=(const ResidualProfiler&) = delete;
+
+  void Record(const Type type, const bool jacobians, const double time_s);
+
+  //! Sums the counters of all threads, types without evaluations are left
+  //! out. Call when no solve is running
+  std::vector<ResidualTypeProfile> Merge() const;
+
+  //! Zeros all counters. Call when no solve is running
+  void Reset();
+
+ private:
+  struct Counter {
+    size_t evaluations = 0;
+    size_t jacobian_evaluations = 0;
+    double time_s = 0.0;
+  };
+  // one cache line per thread, so the counters are not shared
+  struct alignas(64) ThreadCounters {
+    std::thread::id thread;
+    std::array<Counter, kNumTypes> counters;
+  };
+
+  ThreadCounters& Local();
+
+  //! distinguishes profilers in the thread local lookup cache
+  uint64_t id_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadCounters>> threads_;
+};
+
+//! Forwards the evaluation to cost_function and records its time in
+//! profiler. Owns neither of them
+class ProfiledCostFunction : public ceres::CostFunction {
+ public:
+  ProfiledCostFunction(ceres::CostFunction* cost_function,
+                       ResidualProfiler* profiler,
+                       const ResidualProfiler::Type type);
+
+  bool Evaluate(double const* const* parameters,
+                double* residuals,
+                double** jacobians) const override;
+
+ private:
+  ceres::CostFunction* cost_function_;
+  ResidualProfiler* profiler_;
+  ResidualProfiler::Type type_;
+};
+
+//! One line per residual type with evaluations, time and time per
+//! evaluation
+void PrintResidualProfile(const std::vector<ResidualTypeProfile>& profile,
+                          std::ostream& os);
+
+}  // namespace core
+}  // namespace OpenICC
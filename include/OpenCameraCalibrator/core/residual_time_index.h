@@ -0,0 +1,98 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <ceres/ceres.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace OpenICC {
+namespace core {
+
+//! Residual blocks of a problem sorted by measurement time, one list per
+//! sensor. Selecting the residuals of a time window is a binary search plus
+//! the residuals in the window, instead of a scan over the whole problem.
+class ResidualTimeIndex {
+ public:
+  enum Sensor { ACCELEROMETER = 0, GYROSCOPE, IMU, GPS, CAMERA, ORIENTATION };
+  static constexpr int kNumSensors = 6;
+
+  //! s_so3 and s_r3 are the first SO3 and R3 knot of the residual, -1 if it
+  //! does not use the spline
+  struct Entry {
+    int64_t time_ns;
+    ceres::ResidualBlockId id;
+    int64_t s_so3;
+    int64_t s_r3;
+  };
+
+  //! [begin, end) of the entries of one sensor, sorted by time
+  struct Range {
+    const Entry* begin_;
+    const Entry* end_;
+    const Entry* begin() const { return begin_; }
+    const Entry* end() const { return end_; }
+    size_t size() const { return static_cast<size_t>(end_ - begin_); }
+    bool empty() const { return begin_ == end_; }
+  };
+
+  //! First and one past the last knot that a selection uses, empty if
+  //! first >= last
+  struct KnotRange {
+    int64_t first = 0;
+    int64_t last = 0;
+    bool empty() const { return first >= last; }
+  };
+
+  //! Residuals are usually added in time order, others are sorted in on the
+  //! next selection
+  void Add(const Sensor sensor,
+           const int64_t time_ns,
+           const ceres::ResidualBlockId id,
+           const int64_t s_so3,
+           const int64_t s_r3);
+
+  void Clear();
+
+  size_t Size(const Sensor sensor) const { return entries_[sensor].size(); }
+
+  //! Residuals of sensor with a time in [start_time_ns, end_time_ns]
+  Range Select(const Sensor sensor,
+               const int64_t start_time_ns,
+               const int64_t end_time_ns) const;
+
+  //! Appends the residuals of all sensors in [start_time_ns, end_time_ns]
+  void Select(const int64_t start_time_ns,
+              const int64_t end_time_ns,
+              std::vector<ceres::ResidualBlockId>* ids) const;
+
+  //! SO3 and R3 knots of the residuals in range, for a spline of order N
+  static KnotRange SO3Knots(const Range& range, const int N);
+  static KnotRange R3Knots(const Range& range, const int N);
+
+ private:
+  void Sort(const Sensor sensor) const;
+
+  // sorting is deferred to the selection, so it works on mutable entries
+  mutable std::array<std::vector<Entry>, kNumSensors> entries_;
+  mutable std::array<bool, kNumSensors> sorted_{
+      {true, true, true, true, true, true}};
+};
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,106 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <ceres/ceres.h>
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/residual_profiler.h"
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Cost and timing of one minimizer iteration
+struct SolverIterationLog {
+  int iteration = 0;
+  double cost = 0.0;
+  double cost_change = 0.0;
+  double gradient_norm = 0.0;
+  double gradient_max_norm = 0.0;
+  double step_norm = 0.0;
+  bool step_is_successful = false;
+  int linear_solver_iterations = 0;
+  double iteration_time_s = 0.0;
+  //! time to compute the step, i.e. the linear solve
+  double linear_solver_time_s = 0.0;
+  //! rest of the iteration, dominated by residual and Jacobian evaluation
+  double evaluation_time_s = 0.0;
+  double cumulative_time_s = 0.0;
+};
+
+//! Iterations and timing totals of one solve
+struct SolverRunLog {
+  std::string solver;
+  std::vector<SolverIterationLog> iterations;
+  double initial_cost = 0.0;
+  double final_cost = 0.0;
+  double total_time_s = 0.0;
+  double residual_evaluation_time_s = 0.0;
+  double jacobian_evaluation_time_s = 0.0;
+  double linear_solver_time_s = 0.0;
+  std::string termination;
+  //! cost function evaluations per residual type, empty unless the
+  //! estimator profiles its residuals
+  std::vector<ResidualTypeProfile> residual_profile;
+};
+
+//! Records every iteration of a ceres::Solve or BandedSplineSolver::Solve.
+//! Register it in the callbacks of the solver options.
+class SolverIterationRecorder : public ceres::IterationCallback {
+ public:
+  ceres::CallbackReturnType operator()(
+      const ceres::IterationSummary& summary) override;
+
+  const std::vector<SolverIterationLog>& Iterations() const {
+    return iterations_;
+  }
+
+  void Clear() { iterations_.clear(); }
+
+ private:
+  std::vector<SolverIterationLog> iterations_;
+};
+
+//! Calls a function after every minimizer iteration, see
+//! SplineSolverOptions::iteration_callback
+class FunctionIterationCallback : public ceres::IterationCallback {
+ public:
+  explicit FunctionIterationCallback(std::function<void()> function)
+      : function_(std::move(function)) {}
+
+  ceres::CallbackReturnType operator()(
+      const ceres::IterationSummary& /*summary*/) override {
+    function_();
+    return ceres::SOLVER_CONTINUE;
+  }
+
+ private:
+  std::function<void()> function_;
+};
+
+//! Combines the recorded iterations with the totals of summary
+SolverRunLog MakeSolverRunLog(const std::string& solver,
+                              const SolverIterationRecorder& recorder,
+                              const ceres::Solver::Summary& summary);
+
+nlohmann::json SolverLogToJson(const std::vector<SolverRunLog>& runs);
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,61 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Quality levels and knot spacing bounds of get_sew_for_dataset.py
+struct SplineErrorWeightingOptions {
+  //! fraction of the gyroscope signal energy the SO3 spline has to keep
+  double quality_so3 = 0.98;
+  //! fraction of the accelerometer signal energy the R3 spline has to keep
+  double quality_r3 = 0.96;
+  double min_dt_so3 = 0.01;
+  double max_dt_so3 = 0.2;
+  double min_dt_r3 = 0.01;
+  double max_dt_r3 = 0.15;
+  //! written to SplineWeightingData::cam_fps
+  double camera_fps = 30.0;
+};
+
+//! Spline Error Weighting (Ovren and Forssen, CVPR 2018). Finds the largest
+//! uniform knot spacing in [min_dt_s, max_dt_s] for which a cubic B-spline
+//! keeps the fraction quality of the signal energy, and the variance of the
+//! spline fit error at that spacing. Port of knot_spacing_and_variance in
+//! python/sew.py. times_s are the sorted sample times of signal.
+bool KnotSpacingAndVariance(const vec3_vector& signal,
+                            const std::vector<double>& times_s,
+                            const double quality,
+                            const double min_dt_s,
+                            const double max_dt_s,
+                            double& dt_s,
+                            double& variance);
+
+//! Knot spacings and weighting factors (std of the spline fit error) of the
+//! SO3 and R3 spline from the gyroscope and accelerometer of
+//! telemetry_data, like get_sew_for_dataset.py
+bool ComputeSplineErrorWeighting(
+    const CameraTelemetryData& telemetry_data,
+    const SplineErrorWeightingOptions& options,
+    SplineWeightingData& spline_weighting);
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,141 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <Eigen/Core>
+#include <sophus/so3.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+//! The knots of the trajectory and bias splines in one cache line aligned
+//! buffer. Every knot takes a block of kBlockSize doubles and the blocks of
+//! all splines are ordered by knot time, so the SO3, R3 and bias knots of a
+//! segment lie next to each other. Copying the arena copies all knots at
+//! once.
+class SplineParameterArena {
+ public:
+  enum Spline { SO3 = 0, R3, ACCL_BIAS, GYRO_BIAS };
+  static constexpr int kNumSplines = 4;
+  static constexpr int kBlockSize = 4;
+
+  //! Knot spacing of a spline, orders its blocks in the layout
+  void SetSpacing(const Spline spline, const int64_t dt_ns);
+
+  //! Keeps the first knots, new SO3 knots are the identity and all others
+  //! zero. Moves every block, so pointers into the arena become invalid
+  void Resize(const Spline spline, const size_t nr_knots);
+
+  size_t NumKnots(const Spline spline) const {
+    return offsets_[spline].size();
+  }
+
+  double* Block(const Spline spline, const size_t i) {
+    return Data() + offsets_[spline][i];
+  }
+  const double* Block(const Spline spline, const size_t i) const {
+    return Data() + offsets_[spline][i];
+  }
+
+  //! True if other has the same knots in the same order
+  bool SameLayout(const SplineParameterArena& other) const {
+    return offsets_ == other.offsets_;
+  }
+
+  //! Copies the values of other with a single memcpy. False if the layouts
+  //! differ
+  bool CopyValues(const SplineParameterArena& other);
+
+ private:
+  struct alignas(64) CacheLine {
+    double values[8];
+  };
+
+  double* Data() { return reinterpret_cast<double*>(lines_.data()); }
+  const double* Data() const {
+    return reinterpret_cast<const double*>(lines_.data());
+  }
+
+  //! Merges the knots of all splines by time and moves the values over
+  void Relayout(const std::array<size_t, kNumSplines>& nr_knots);
+
+  std::vector<CacheLine> lines_;
+  std::array<int64_t, kNumSplines> dt_ns_{};
+  //! first double of every knot block
+  std::array<std::vector<size_t>, kNumSplines> offsets_;
+};
+
+//! Knots of one spline of an arena with the interface of the aligned vector
+//! they replace. Element i maps the block of knot i and stays valid until the
+//! arena is resized.
+template <class T>
+class ArenaKnots {
+ public:
+  using Map = Eigen::Map<T>;
+  using ConstMap = Eigen::Map<const T>;
+
+  ArenaKnots(SplineParameterArena* arena,
+             const SplineParameterArena::Spline spline)
+      : arena_(arena), spline_(spline) {}
+
+  Map operator[](const size_t i) { return Map(arena_->Block(spline_, i)); }
+  const ConstMap operator[](const size_t i) const {
+    return ConstMap(arena_->Block(spline_, i));
+  }
+  const ConstMap back() const { return (*this)[size() - 1]; }
+
+  size_t size() const { return arena_->NumKnots(spline_); }
+  bool empty() const { return size() == 0; }
+
+  void resize(const size_t size) { arena_->Resize(spline_, size); }
+  void resize(const size_t size, const T& value) {
+    const size_t old_size = this->size();
+    resize(size);
+    for (size_t i = old_size; i < size; ++i) (*this)[i] = value;
+  }
+  void assign(const size_t size, const T& value) {
+    resize(size);
+    Fill(value);
+  }
+
+  void Fill(const T& value) {
+    for (size_t i = 0; i < size(); ++i) (*this)[i] = value;
+  }
+
+  void Assign(const aligned_vector<T>& values) {
+    resize(values.size());
+    for (size_t i = 0; i < values.size(); ++i) (*this)[i] = values[i];
+  }
+
+  aligned_vector<T> ToVector() const {
+    aligned_vector<T> values;
+    values.reserve(size());
+    for (size_t i = 0; i < size(); ++i) values.emplace_back((*this)[i]);
+    return values;
+  }
+
+ private:
+  SplineParameterArena* arena_;
+  SplineParameterArena::Spline spline_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
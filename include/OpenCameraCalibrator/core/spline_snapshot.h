@@ -0,0 +1,83 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <Eigen/Core>
+#include <sophus/se3.hpp>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Full state of an optimized SplineTrajectoryEstimator. Used to warm start
+//! the calibration of a new dataset of the same rig, see
+//! ImuCameraCalibrator::SetWarmStart.
+struct SplineSnapshot {
+  //! order of the SO3 and R3 splines
+  int spline_order = 0;
+
+  //! knot grid of the trajectory splines
+  int64_t start_t_ns = 0;
+  int64_t end_t_ns = 0;
+  int64_t dt_so3_ns = 0;
+  int64_t dt_r3_ns = 0;
+  so3_vector so3_knots;
+  vec3_vector r3_knots;
+
+  //! knot grid of the bias splines, same start time as the trajectory
+  int64_t dt_accl_bias_ns = 0;
+  int64_t dt_gyro_bias_ns = 0;
+  vec3_vector accl_bias_knots;
+  vec3_vector gyro_bias_knots;
+
+  Sophus::SE3d T_i_c;
+  Eigen::Vector3d gravity = Eigen::Vector3d::Zero();
+  //! misalignment and scale, same layout as in the estimator
+  Eigen::Matrix<double, 6, 1> accl_intrinsics =
+      Eigen::Matrix<double, 6, 1>::Zero();
+  Eigen::Matrix<double, 9, 1> gyro_intrinsics =
+      Eigen::Matrix<double, 9, 1>::Zero();
+  double line_delay_s = 0.0;
+
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+//! Spline state at one time, see
+//! SplineTrajectoryEstimator::EvaluateTrajectory and SplineTrajectoryQuery
+struct TrajectorySample {
+  //! false if the time is outside of the SO3 or R3 spline, all values are
+  //! then zero / identity
+  bool valid = false;
+  //! T_w_i
+  Sophus::SE3d pose;
+  //! in the world frame
+  Eigen::Vector3d velocity = Eigen::Vector3d::Zero();
+  //! in the body frame, as measured by a gyroscope
+  Eigen::Vector3d angular_velocity = Eigen::Vector3d::Zero();
+  //! specific force in the body frame, as measured by an accelerometer
+  Eigen::Vector3d acceleration = Eigen::Vector3d::Zero();
+  Eigen::Vector3d gyro_bias = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_bias = Eigen::Vector3d::Zero();
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+}  // namespace core
+}  // namespace OpenICC
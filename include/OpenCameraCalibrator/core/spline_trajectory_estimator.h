@@ -3,12 +3,41 @@
 #include "ceres/ceres.h"
 #include "theia/sfm/reconstruction.h"
 
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_analytic_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_corner_residuals.h"
 #include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_fixed_size_cost_function.h"
 #include "OpenCameraCalibrator/basalt_spline/ceres_local_param.h"
+#include "OpenCameraCalibrator/core/banded_spline_solver.h"
+#include "OpenCameraCalibrator/core/reprojection_error_report.h"
+#include "OpenCameraCalibrator/core/residual_profiler.h"
+#include "OpenCameraCalibrator/core/residual_time_index.h"
+#include "OpenCameraCalibrator/core/solver_log.h"
+#include "OpenCameraCalibrator/core/spline_parameter_arena.h"
+#include "OpenCameraCalibrator/core/spline_snapshot.h"
+#include "OpenCameraCalibrator/utils/execution_context.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/monotonic_arena.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+#include "OpenCameraCalibrator/utils/time_series.h"
 #include "OpenCameraCalibrator/utils/types.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
+#include <Eigen/Sparse>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <thread>
 
 namespace OpenICC {
@@ -28,6 +57,88 @@ enum SplineOptimFlags {
 
 const double GRAVITY_MAGN = 9.81;
 
+//! Solver configuration for SplineTrajectoryEstimator::Optimize. The defaults
+//! reproduce the previous hard coded setup.
+struct SplineSolverOptions {
+  ceres::LinearSolverType linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+  ceres::PreconditionerType preconditioner_type = ceres::CLUSTER_TRIDIAGONAL;
+  //! Backend of the dense linear solvers and of the Schur complement
+  //! factorization, e.g. ceres::CUDA if ceres was built with CUDA. Falls back
+  //! to ceres::EIGEN if ceres does not provide it.
+  ceres::DenseLinearAlgebraLibraryType dense_linear_algebra_library_type =
+      ceres::EIGEN;
+  bool use_inner_iterations = true;
+  //! Eliminate the knots in time order and all other parameters last. This
+  //! keeps the fill in of the banded spline normal equations local. Schur
+  //! solvers need an independent elimination group and eliminate the scene
+  //! points first instead.
+  bool use_time_banded_ordering = false;
+  //! Use BandedSplineSolver instead of ceres::Solve. It exploits the block
+  //! banded knot structure and scales linearly with the sequence length. The
+  //! linear solver, preconditioner and inner iteration settings do not apply.
+  bool use_banded_solver = false;
+  int num_threads = OpenICC::utils::ExecutionContext::NumThreads();
+  double function_tolerance = 1e-4;
+  double parameter_tolerance = 1e-7;
+  //! Wall clock limit of one solve, the best solution found so far is kept
+  //! when it is reached, see utils::TimeBudgetScheduler
+  double max_solver_time_s = 1e9;
+  //! Rounds of the knot freezing mode of Optimize, 0 solves all knots in one
+  //! run. Every round solves a share of the iterations, then the knots that
+  //! moved less than the thresholds are set constant and the next round only
+  //! solves the residuals of the remaining free blocks. A final solve of all
+  //! knots polishes the result.
+  int knot_freeze_rounds = 0;
+  double knot_freeze_rotation_rad = 1e-5;
+  double knot_freeze_translation_m = 1e-5;
+  //! Called after every iteration once the parameter blocks hold its
+  //! accepted state, e.g. to write a checkpoint with GetSnapshot. Makes
+  //! ceres update the parameter blocks every iteration
+  std::function<void()> iteration_callback;
+};
+
+//! Size of a SplineTrajectoryEstimator problem. The loss functions and
+//! parameterizations are shared by all blocks, objects_without_sharing is
+//! the number of them a problem with one instance per block would allocate.
+struct SplineProblemMemoryReport {
+  int num_parameter_blocks = 0;
+  int num_parameters = 0;
+  int num_residual_blocks = 0;
+  int num_residuals = 0;
+  int num_robust_residual_blocks = 0;
+  int num_parameterized_blocks = 0;
+  int num_shared_objects = 0;
+  int objects_without_sharing = 0;
+  //! peak resident set size of the process, see utils::PeakRssMB
+  double peak_rss_mb = 0.0;
+};
+
+//! Marginal covariance of the free global parameter blocks of a spline
+//! problem, see SplineTrajectoryEstimator::ComputeGlobalCovariance. Blocks
+//! are in their tangent space, e.g. 6 parameters for T_i_c (rotation
+//! first), and block i covers the rows and columns [offsets[i], offsets[i] +
+//! sizes[i]) of covariance.
+struct SplineGlobalCovariance {
+  std::vector<std::string> names;
+  std::vector<int> offsets;
+  std::vector<int> sizes;
+  Eigen::MatrixXd covariance;
+
+  //! Standard deviations of the parameters of a block, empty if the block
+  //! was not free
+  Eigen::VectorXd StdDev(const std::string& name) const {
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (names[i] == name) {
+        return covariance.diagonal()
+            .segment(offsets[i], sizes[i])
+            .cwiseMax(0.0)
+            .cwiseSqrt();
+      }
+    }
+    return Eigen::VectorXd();
+  }
+};
+
 template <int _N>
 class SplineTrajectoryEstimator {
  public:
@@ -54,24 +165,64 @@ class SplineTrajectoryEstimator {
                        const double max_accl_range = 1.0,
                        const double max_gyro_range = 1e-2);
 
-  void BatchInitSO3R3VisPoses();
+  //! Initializes the knots by interpolating the view poses at the knot
+  //! times. If fit_r3_knots, the R3 knots are then a least squares fit of
+  //! the spline to the view positions
+  void BatchInitSO3R3VisPoses(const bool fit_r3_knots = false);
+
+  //! Appends knots until the spline covers end_time_ns, for online
+  //! calibration. New pose knots are interpolated from the views up to
+  //! end_time_ns, new bias knots repeat the last bias. Resets the problem if
+  //! knots were added, as the residuals point into the knot storage
+  void ExtendKnots(const int64_t end_time_ns);
 
   void InitScenePoints();
 
   void SetFixedParams(const int flags);
 
-  ceres::Solver::Summary Optimize(const int max_iters, const int flags);
-
-  // keep the rest constant and only optimize a window
-  ceres::Solver::Summary Optimize(const int max_iters,
-                                  const int flags,
-                                  const int64_t start_time,
-                                  const int64_t end_time);
-
+  ceres::Solver::Summary Optimize(
+      const int max_iters,
+      const int flags,
+      const SplineSolverOptions& solver_options = SplineSolverOptions());
+
+  // keep the rest constant and only optimize a window. Only knots whose whole
+  // support lies inside [start_time, end_time] are optimized. If nothing but
+  // the spline is free, only the residuals inside the window are solved
+  ceres::Solver::Summary Optimize(
+      const int max_iters,
+      const int flags,
+      const int64_t start_time,
+      const int64_t end_time,
+      const SplineSolverOptions& solver_options = SplineSolverOptions());
+
+  //! Removes all residuals from the problem. Knots, points and global
+  //! parameters (T_i_c, gravity, intrinsics, line delay) keep their values,
+  //! so a new problem can be built on top of the current estimate
+  void ResetProblem();
+
+  //! Changes the SO3 and R3 knot spacing and initializes the new knots from
+  //! the current spline. R3 knots are a least squares fit of the current
+  //! spline (exact if the old spacing is a multiple of the new one), SO3
+  //! knots sample it at the center of their support. Resets the problem, so
+  //! all measurements have to be added again.
+  void ResampleKnots(const int64_t dt_so3_ns, const int64_t dt_r3_ns);
+
+  //! Adds a position residual on the R3 spline. meas is the GPS position in
+  //! the world frame of the spline, e.g. ENU (see utils::ConvertLLEToENU)
   bool AddGPSMeasurement(const Eigen::Vector3d& meas,
                          const int64_t time_ns,
                          const double weight_gps);
 
+  //! Adds position residuals for the sorted GPS samples. All samples inside
+  //! one R3 knot interval are averaged to a single residual with a weight of
+  //! weight_gps * sqrt(count), so the problem grows with the number of knots
+  //! and not with the GPS rate. The cost functions are built on num_threads
+  //! threads. Returns the number of residuals that were added
+  size_t AddGPSMeasurements(const std::vector<int64_t>& times_ns,
+                            const vec3_vector& enu_meas,
+                            const double weight_gps,
+                            const int num_threads = 1);
+
   bool AddAccelerometerMeasurement(const Eigen::Vector3d& meas,
                                    const int64_t time_ns,
                                    const double weight_se3);
@@ -80,22 +231,98 @@ class SplineTrajectoryEstimator {
                                const int64_t time_ns,
                                const double weight_se3);
 
+  //! Adds gyroscope residuals only, e.g. for a rotation only problem. The
+  //! cost functions are built on num_threads threads. Returns the number of
+  //! samples that were added
+  size_t AddGyroscopeMeasurements(const std::vector<int64_t>& times_ns,
+                                  const vec3_vector& gyro_meas,
+                                  const std::vector<double>& weights_so3,
+                                  const int num_threads = 1);
+
+  //! Adds an orientation residual on the SO3 spline at the view time. The
+  //! IMU orientation of the view follows from its camera orientation and
+  //! the current T_i_c of camera, which is not a parameter of the residual
+  bool AddOrientationMeasurement(const theia::View* view,
+                                 const double weight_so3,
+                                 const size_t camera = 0);
+
+  //! Least squares fit of the R3 knots to the IMU positions of the views,
+  //! computed from the camera positions with the current SO3 spline and
+  //! T_i_c. Knots without views nearby keep their value. Returns false if
+  //! the fit failed
+  bool FitR3KnotsToViews();
+
+  //! Adds IMU residuals for all samples, one fused residual per sample or
+  //! an accelerometer and a gyroscope residual, see SetFusedImuResiduals.
+  //! The cost functions are built on num_threads threads, only the insertion
+  //! into the problem is serial. Returns the number of samples that were
+  //! added
+  size_t AddImuMeasurements(const std::vector<int64_t>& times_ns,
+                            const vec3_vector& accl_meas,
+                            const vec3_vector& gyro_meas,
+                            const std::vector<double>& weights_se3,
+                            const std::vector<double>& weights_so3,
+                            const int num_threads = 1);
+
+  //! camera is the rig camera of the view, see SetNumRigCameras
   bool AddGSCameraMeasurement(const theia::View* view,
-                              const double robust_loss_width);
+                              const double robust_loss_width,
+                              const size_t camera = 0);
   bool AddRSCameraMeasurement(const theia::View* view,
-                              const double robust_loss_width = 0.0);
+                              const double robust_loss_width = 0.0,
+                              const size_t camera = 0);
   bool AddGSInvCameraMeasurement(const theia::View* view,
                                  const double robust_loss_width);
   bool AddRSInvCameraMeasurement(const theia::View* view,
                                  const double robust_loss_width);
 
   // setter
-  void SetImageData(const theia::Reconstruction& c);
+  //! The reconstruction is shared, not copied. Views and observations are
+  //! only read, the scene points are copied into the estimator and optimized
+  //! there.
+  void SetImageData(std::shared_ptr<const theia::Reconstruction> image_data);
 
   void SetGravity(const Eigen::Vector3d& g);
 
+  //! One gravity parameter per segment instead of a single one, e.g. for
+  //! recordings with the board placed differently. segment_starts_ns are the
+  //! start times of all segments but the first. Every segment starts at the
+  //! current gravity, SetGravity and GetGravity refer to the first segment.
+  //! Call before adding IMU measurements
+  void SetGravitySegments(const std::vector<int64_t>& segment_starts_ns);
+
+  size_t NumGravitySegments() const { return 1 + segment_gravity_.size(); }
+
+  void SetSegmentGravity(const size_t segment, const Eigen::Vector3d& g);
+
+  Eigen::Vector3d GetSegmentGravity(const size_t segment) const;
+
+  //! Gravity segment of time_ns
+  size_t GravitySegmentAt(const int64_t time_ns) const;
+
   void SetT_i_c(const Sophus::SE3<double>& T);
 
+  //! Several rigidly mounted cameras observing through the one spline, each
+  //! with its own T_i_c and line delay. The intrinsics are the ones of the
+  //! views. Camera 0 is the one of SetT_i_c and SetCameraLineDelay, the
+  //! other cameras start at its values. The camera of a view is its camera
+  //! intrinsics group in the image data. Call before adding camera
+  //! measurements
+  void SetNumRigCameras(const size_t num_cameras);
+
+  size_t NumRigCameras() const { return 1 + rig_T_i_c_.size(); }
+
+  void SetRigCameraT_i_c(const size_t camera, const Sophus::SE3d& T);
+
+  Sophus::SE3d GetRigCameraT_i_c(const size_t camera) const;
+
+  void SetRigCameraLineDelay(const size_t camera, const double line_delay_s);
+
+  double GetRigCameraLineDelay(const size_t camera) const;
+
+  //! Rig camera of a view of the image data, 0 for unknown intrinsics groups
+  size_t RigCameraOf(const theia::ViewId view_id) const;
+
   void SetTelemetryData(const CameraTelemetryData& telemetry_data);
 
   void SetImuToCameraTimeOffset(const double imu_to_camera_time_offset_s);
@@ -106,6 +333,50 @@ class SplineTrajectoryEstimator {
       const ThreeAxisSensorCalibParams<double>& accl_intrinsics,
       const ThreeAxisSensorCalibParams<double>& gyro_intrinsics);
 
+  //! Use the closed form Jacobians for IMU residuals (default). Otherwise the
+  //! compile time sized autodiff cost functions are used
+  void SetAnalyticImuJacobians(const bool analytic) {
+    analytic_imu_jacobians_ = analytic;
+  }
+
+  //! Add one 6 dimensional residual per IMU sample that evaluates the SO3
+  //! spline once for the accelerometer and the gyroscope (default). Only
+  //! affects measurements added afterwards
+  void SetFusedImuResiduals(const bool fused) { fused_imu_residuals_ = fused; }
+
+  //! Solve only the residual blocks connected to a free parameter block if
+  //! few blocks are free, e.g. for a CAM_LINE_DELAY only refinement (default)
+  void SetConnectedSubProblems(const bool connected) {
+    connected_sub_problems_ = connected;
+  }
+
+  //! Add global shutter views as one small residual per corner instead of
+  //! one residual per view. The camera pose of each view is then evaluated
+  //! once per linearization point by an evaluation callback. Resets the
+  //! problem, so call it before adding measurements. Not compatible with
+  //! inner iterations, they are switched off while corner residuals are used
+  void SetCornerReprojectionResiduals(const bool corner_residuals);
+
+  //! Rolling shutter views evaluate the spline pose only every band_rows
+  //! image rows and interpolate in between, see
+  //! RSReprojectionCostFunctorSplit. 0 evaluates it at every corner. Only
+  //! affects measurements added afterwards
+  void SetRollingShutterBandRows(const double band_rows) {
+    rs_band_rows_ = std::max(0.0, band_rows);
+  }
+
+  //! Store the corner observations of the views in single precision, see
+  //! ViewObservations::CompactCorner. The residuals are still evaluated in
+  //! double. Call before SetImageData
+  void SetCompactObservations(const bool compact) {
+    compact_observations_ = compact;
+  }
+
+  //! Wraps the cost functions to count their evaluations and time per
+  //! residual type, which is printed after every solve and stored in the
+  //! solver log. Only affects measurements added afterwards
+  void SetResidualProfiling(const bool profile);
+
   // getter
   Sophus::SE3d GetKnot(int i) const;
 
@@ -119,6 +390,14 @@ class SplineTrajectoryEstimator {
 
   bool GetAcceleration(const int64_t& time_ns, Eigen::Vector3d& acceleration);
 
+  //! Evaluates pose, velocities, acceleration and biases at all times in
+  //! one pass. Consecutive times are split into chunks that are evaluated
+  //! on num_threads threads. Within a chunk the SO3 knot increments of a
+  //! segment are computed once, so sorted times are cheapest.
+  void EvaluateTrajectory(const std::vector<int64_t>& times_ns,
+                          aligned_vector<TrajectorySample>& samples,
+                          const int num_threads = 1) const;
+
   size_t GetNumSO3Knots() const;
 
   size_t GetNumR3Knots() const;
@@ -127,11 +406,19 @@ class SplineTrajectoryEstimator {
 
   int64_t GetMinTimeNs() const;
 
-  Eigen::Vector3d GetGyroBias(const int64_t& time_ns);
+  Eigen::Vector3d GetGyroBias(const int64_t& time_ns) const;
+
+  Eigen::Vector3d GetAcclBias(const int64_t& time_ns) const;
 
-  Eigen::Vector3d GetAcclBias(const int64_t& time_ns);
+  //! Reprojection error of every corner with a histogram per view. The
+  //! views are evaluated on num_threads threads. False if a view has no
+  //! corners or lies outside of the spline
+  bool GetReprojectionErrors(
+      ReprojectionErrorReport& report,
+      const int num_threads = utils::ExecutionContext::NumThreads());
 
-  double GetMeanReprojectionError();
+  //! Mean of GetReprojectionErrors, 0 if it failed. Fills report if given
+  double GetMeanReprojectionError(ReprojectionErrorReport* report = nullptr);
 
   Eigen::Vector3d GetGravity() const;
 
@@ -139,23 +426,231 @@ class SplineTrajectoryEstimator {
 
   double GetRSLineDelay() const;
 
+  //! Block counts and shared objects of the current problem
+  SplineProblemMemoryReport GetProblemMemoryReport() const;
+
+  //! Covariance of the free global parameters (T_i_c and line delay of
+  //! every rig camera, gravity and IMU intrinsics) at the current estimate.
+  //! The knots, bias knots and points are marginalized with a Schur
+  //! complement of the sparse normal equations, which is far cheaper than
+  //! ceres::Covariance of the whole problem. Assumes correctly weighted
+  //! residuals. False if the reduced system is not positive definite
+  bool ComputeGlobalCovariance(SplineGlobalCovariance& covariance,
+                               const int num_threads = 1);
+
+  //! Per iteration cost and timing of every solve since the last
+  //! ClearSolverLog, in call order
+  const std::vector<SolverRunLog>& GetSolverLog() const { return solver_log_; }
+
+  //! Residual blocks of problem_ by sensor and time, e.g. to evaluate the
+  //! residuals of a time range
+  const ResidualTimeIndex& GetResidualTimeIndex() const {
+    return residual_index_;
+  }
+
+  void ClearSolverLog() { solver_log_.clear(); }
+
+  //! Elimination ordering of the last solve that used one, as groups of
+  //! parameter block names together with the shape of the problem, see
+  //! ImportParameterOrdering. null if ceres ordered the last problem itself
+  nlohmann::json ExportParameterOrdering() const;
+
+  //! Uses an exported ordering for every later solve of a problem with the
+  //! same shape instead of computing one, e.g. when recalibrating a rig with
+  //! the same capture protocol. Ceres does not expose its symbolic
+  //! factorization, so only the ordering is reused. Returns false if the
+  //! ordering is malformed
+  bool ImportParameterOrdering(const nlohmann::json& ordering);
+
   ThreeAxisSensorCalibParams<double> GetAcclIntrinsics(const int64_t& time_ns);
 
   ThreeAxisSensorCalibParams<double> GetGyroIntrinsics(const int64_t& time_ns);
 
   void ConvertToTheiaRecon(theia::Reconstruction* recon_out);
 
+  //! Copies knots, bias splines and global parameters into snapshot
+  void GetSnapshot(SplineSnapshot& snapshot) const;
+
+  //! Takes T_i_c, gravity, IMU intrinsics and line delay from snapshot. The
+  //! knots and bias knots are only copied if their grid (order, start time,
+  //! spacing and count) matches the current one. Otherwise the bias knots
+  //! are set to the mean bias of the snapshot. Call after the knots and bias
+  //! splines are initialized. Returns true if the trajectory knots were
+  //! copied.
+  bool InitFromSnapshot(const SplineSnapshot& snapshot);
+
+  //! All knots in one buffer, a copy of it is a cheap snapshot of the knots
+  const SplineParameterArena& KnotArena() const { return knot_arena_; }
+
+  //! Restores the knots from a copy of KnotArena. False if the knot grids
+  //! changed since
+  bool RestoreKnotArena(const SplineParameterArena& arena) {
+    return knot_arena_.CopyValues(arena);
+  }
+
   void ConvertInvDepthPointsToHom();
 
  private:
-  bool CalcSO3Times(const int64_t sensor_time, double& u_so3, int64_t& s_so3);
-  bool CalcR3Times(const int64_t sensor_time, double& u_r3, int64_t& s_r3);
+  static constexpr int kNumAcclBlocks = 2 * N_ + BIAS_SPLINE_N + 2;
+  static constexpr int kNumGyroBlocks = N_ + BIAS_SPLINE_N + 1;
+  static constexpr int kNumImuBlocks = 2 * N_ + 2 * BIAS_SPLINE_N + 3;
+  static constexpr int kNumGPSBlocks = N_;
+  static constexpr int kNumOrientationBlocks = N_;
+
+  //! Cost function and parameter blocks of one IMU or GPS residual, built
+  //! before it is added to the problem. s_r3 stays -1 for gyroscope and s_so3
+  //! for GPS residuals
+  template <int kNumBlocks>
+  struct ImuResidual {
+    ceres::CostFunction* cost_function = nullptr;
+    std::array<double*, kNumBlocks> params;
+    int64_t s_so3 = -1;
+    int64_t s_r3 = -1;
+    int64_t time_ns = 0;
+  };
+
+  bool CreateAccelerometerResidual(const Eigen::Vector3d& meas,
+                                   const int64_t time_ns,
+                                   const double weight_se3,
+                                   ImuResidual<kNumAcclBlocks>& residual) const;
+
+  bool CreateGyroscopeResidual(const Eigen::Vector3d& meas,
+                               const int64_t time_ns,
+                               const double weight_so3,
+                               ImuResidual<kNumGyroBlocks>& residual) const;
+
+  //! Fused accelerometer and gyroscope residual of one sample
+  bool CreateImuResidual(const Eigen::Vector3d& accl_meas,
+                         const Eigen::Vector3d& gyro_meas,
+                         const int64_t time_ns,
+                         const double weight_se3,
+                         const double weight_so3,
+                         ImuResidual<kNumImuBlocks>& residual) const;
+
+  bool CreateGPSResidual(const Eigen::Vector3d& meas,
+                         const int64_t time_ns,
+                         const double weight_gps,
+                         ImuResidual<kNumGPSBlocks>& residual) const;
+
+  //! SO3 spline orientation at time_ns, false if outside of the spline
+  bool GetOrientation(const int64_t time_ns, Sophus::SO3d& R_w_i) const;
+
+  template <int kNumBlocks>
+  void AddImuResidual(const ImuResidual<kNumBlocks>& residual,
+                      const ResidualTimeIndex::Sensor sensor);
+
+  //! cost_function, or an arena allocated ProfiledCostFunction around it if
+  //! residual profiling is on
+  ceres::CostFunction* Profiled(ceres::CostFunction* cost_function,
+                                const ResidualProfiler::Type type);
+
+  std::shared_ptr<const ViewObservations> ViewObservationsFor(
+      const theia::View* view);
+
+  //! Fills errors for one view, see GetReprojectionErrors. Only reads the
+  //! estimator, so views can be evaluated concurrently
+  bool EvaluateViewReprojectionErrors(
+      const theia::ViewId vid,
+      const std::shared_ptr<const ViewObservations>& observations,
+      const ReprojectionHistogramOptions& histogram,
+      ViewReprojectionErrors& errors);
+
+  //! Solves problem_ and prints the timing of the solver configuration. If
+  //! residual_blocks is given, only those blocks of problem_ are solved
+  ceres::Solver::Summary Solve(
+      const int max_iters,
+      const SplineSolverOptions& solver_options,
+      const bool full_report,
+      const std::vector<ceres::ResidualBlockId>* residual_blocks = nullptr);
+
+  //! Adds the residual profile of the last solve to its solver log entry and
+  //! prints it
+  void RecordResidualProfile();
+
+  //! Least squares fit of the R3 knots to positions at times_ns. Every knot
+  //! is pulled towards its current value with prior_weight, which keeps
+  //! knots without samples in their support in place. Returns false if the
+  //! normal equations could not be factorized
+  bool FitR3Knots(const std::vector<int64_t>& times_ns,
+                  const vec3_vector& positions,
+                  const double prior_weight);
+
+  //! Gravity parameter block of a segment and of the segment of time_ns
+  double* GravityBlock(const size_t segment);
+  const double* GravityAt(const int64_t time_ns) const;
+
+  //! T_i_c and line delay parameter blocks of a rig camera
+  double* T_i_cBlock(const size_t camera);
+  double* LineDelayBlock(const size_t camera);
+
+  //! IMU poses of the views up to max_time_ns, sorted by time
+  void CollectViewImuPoses(const int64_t max_time_ns,
+                           OpenICC::quat_series& quat_vis,
+                           OpenICC::vec3_series& translations) const;
+
+  //! Interpolates the knots from so3_begin and r3_begin on from the poses
+  void InitKnotsFromPoses(const OpenICC::quat_series& quat_vis,
+                          const OpenICC::vec3_series& translations,
+                          const int so3_begin,
+                          const int r3_begin);
+
+  //! SO3 and R3 knots in the problem with the time slot they start in
+  std::vector<std::pair<int, double*>> KnotTimeSlots();
+
+  //! Knots of problem grouped by their time index, everything else in the
+  //! last group
+  ceres::ParameterBlockOrdering* CreateTimeBandedOrdering(
+      const ceres::Problem& problem);
+
+  //! Optimize with SplineSolverOptions::knot_freeze_rounds, expects
+  //! SetFixedParams(flags) to be called
+  ceres::Solver::Summary OptimizeFreezingKnots(
+      const int max_iters,
+      const int flags,
+      const SplineSolverOptions& solver_options);
+
+  //! Residual blocks of problem_ with at least one free parameter block
+  void FreeResidualBlocks(std::vector<ceres::ResidualBlockId>* ids) const;
+
+  //! Problem with the residual blocks of problem_ that depend on one of the
+  //! few free parameter blocks. Shares all cost functions, losses and
+  //! parameterizations with problem_. nullptr if too many blocks are free
+  std::unique_ptr<ceres::Problem> CreateConnectedSubProblem();
+
+  //! Problem with the given residual blocks of problem_, their parameter
+  //! blocks keep the constness and bounds of problem_
+  std::unique_ptr<ceres::Problem> CreateSubProblem(
+      const std::vector<ceres::ResidualBlockId>& residual_blocks);
+
+  //! Scene points of problem in the first group, everything else in the
+  //! second. nullptr if no scene point is free
+  ceres::ParameterBlockOrdering* CreatePointSchurOrdering(
+      const ceres::Problem& problem);
+
+  //! Block and residual counts, problems with the same key share their
+  //! sparsity structure
+  std::string ProblemShapeKey() const;
+
+  //! Name of every parameter block problem_ can contain, stable across runs
+  std::unordered_map<const double*, std::string> ParameterBlockNames() const;
+
+  //! imported_ordering_ resolved for problem_. nullptr if none was imported,
+  //! the shape differs or it was made for the other kind of linear solver
+  std::shared_ptr<ceres::ParameterBlockOrdering> ImportedOrdering(
+      const bool schur) const;
+
+  bool CalcSO3Times(const int64_t sensor_time,
+                    double& u_so3,
+                    int64_t& s_so3) const;
+  bool CalcR3Times(const int64_t sensor_time,
+                   double& u_r3,
+                   int64_t& s_r3) const;
   bool CalcTimes(const int64_t sensor_time,
                  double& u,
                  int64_t& s,
                  int64_t dt_ns,
                  size_t nr_knots,
-                 const int N = N_);
+                 const int N = N_) const;
 
   int64_t start_t_ns_;
   int64_t end_t_ns_;
@@ -170,11 +665,20 @@ class SplineTrajectoryEstimator {
   size_t nr_knots_so3_;
   size_t nr_knots_r3_;
 
-  so3_vector so3_knots_;
-  vec3_vector r3_knots_;
-
-  std::vector<bool> so3_knot_in_problem_;
-  std::vector<bool> r3_knot_in_problem_;
+  //! knots of the trajectory and bias splines, each residual block points
+  //! into the arena
+  SplineParameterArena knot_arena_;
+  ArenaKnots<Sophus::SO3d> so3_knots_{&knot_arena_, SplineParameterArena::SO3};
+  ArenaKnots<Eigen::Vector3d> r3_knots_{&knot_arena_, SplineParameterArena::R3};
+
+  //! per knot flag if a residual of problem_ uses the knot
+  std::vector<uint8_t> so3_knot_in_problem_;
+  std::vector<uint8_t> r3_knot_in_problem_;
+  //! indices of the knots used in problem_, every knot once
+  std::vector<int> so3_knot_ids_in_problem_;
+  std::vector<int> r3_knot_ids_in_problem_;
+  //! so3_knot_ids_in_problem_[0, n) already have a local parameterization
+  size_t nr_so3_knots_parameterized_ = 0;
 
   //! bias spline meta data
   size_t nr_knots_accl_bias_;
@@ -186,8 +690,10 @@ class SplineTrajectoryEstimator {
   double inv_accl_bias_dt_;
   double inv_gyro_bias_dt_;
 
-  vec3_vector gyro_bias_spline_;
-  vec3_vector accl_bias_spline_;
+  ArenaKnots<Eigen::Vector3d> gyro_bias_spline_{
+      &knot_arena_, SplineParameterArena::GYRO_BIAS};
+  ArenaKnots<Eigen::Vector3d> accl_bias_spline_{
+      &knot_arena_, SplineParameterArena::ACCL_BIAS};
 
   double max_accl_bias_range_ = 1.0;
   double max_gyro_bias_range_ = 1e-2;
@@ -197,46 +703,123 @@ class SplineTrajectoryEstimator {
 
   bool fix_imu_intrinsics_ = false;
 
+  bool analytic_imu_jacobians_ = true;
+
+  bool fused_imu_residuals_ = true;
+
+  bool connected_sub_problems_ = true;
+
+  bool profile_residuals_ = false;
+
+  bool corner_residuals_ = false;
+
+  double rs_band_rows_ = 0.0;
+
+  bool compact_observations_ = false;
+
   double cam_line_delay_s_ = 0.0;
 
   double imu_to_camera_time_offset_s_ = 0.0;
 
   std::set<theia::TrackId> tracks_in_problem_;
 
+  //! every residual block of problem_ by sensor and measurement time
+  ResidualTimeIndex residual_index_;
+
   Eigen::Vector3d gravity_;
 
+  //! gravity of the segments after the first one, see SetGravitySegments
+  std::vector<int64_t> gravity_segment_starts_ns_;
+  vec3_vector segment_gravity_;
+
   Eigen::Matrix<double, 6, 1> accl_intrinsics_;
   Eigen::Matrix<double, 9, 1> gyro_intrinsics_;
 
-  theia::Reconstruction image_data_;
+  std::shared_ptr<const theia::Reconstruction> image_data_;
+
+  std::vector<SolverRunLog> solver_log_;
+
+  //! see ImportParameterOrdering and ExportParameterOrdering
+  nlohmann::json imported_ordering_;
+  std::shared_ptr<ceres::ParameterBlockOrdering> last_ordering_;
+  bool last_ordering_schur_ = false;
+  std::string last_ordering_shape_;
+
+  //! compact corner observations per view of image_data_, used by the
+  //! reprojection residuals
+  std::unordered_map<const theia::View*,
+                     std::shared_ptr<const ViewObservations>>
+      view_observations_;
+
+  //! homogeneous scene points, the only part of the image data we optimize
+  aligned_unordered_map<theia::TrackId, Eigen::Vector4d> scene_points_;
 
   Sophus::SE3<double> T_i_c_;
 
+  //! T_i_c and line delay of the rig cameras after the first one, see
+  //! SetNumRigCameras
+  aligned_vector<Sophus::SE3d> rig_T_i_c_;
+  std::vector<double> rig_line_delay_s_;
+
+  //! Huber loss of this width shared by all residual blocks that use it
+  ceres::LossFunction* SharedHuberLoss(const double width);
+
+  //! loss functions and parameterizations of problem_, which does not own
+  //! them. Declared before problem_, so they outlive it
+  std::map<double, std::unique_ptr<ceres::LossFunction>> huber_losses_;
+  std::unique_ptr<ceres::LocalParameterization> so3_parameterization_ =
+      std::make_unique<LieLocalParameterization<Sophus::SO3d>>();
+  std::unique_ptr<ceres::LocalParameterization> se3_parameterization_ =
+      std::make_unique<LieLocalParameterization<Sophus::SE3d>>();
+  std::unique_ptr<ceres::LocalParameterization> point_parameterization_ =
+      std::make_unique<ceres::HomogeneousVectorParameterization>(4);
+
+  //! view poses of the corner residuals, evaluation callback of problem_
+  //! if corner_residuals_ is set. Declared before problem_, which refers to it
+  std::unique_ptr<SplineViewPoseCallback<_N>> view_pose_callback_ =
+      std::make_unique<SplineViewPoseCallback<_N>>();
+
+  //! cost functions (and functors) of problem_, freed together on
+  //! ResetProblem. Declared before problem_, so they outlive it
+  std::unique_ptr<OpenICC::utils::MonotonicArena> cost_function_arena_ =
+      std::make_unique<OpenICC::utils::MonotonicArena>();
+
+  //! evaluation counters of the profiled cost functions, nullptr until
+  //! residual profiling is switched on
+  std::unique_ptr<ResidualProfiler> residual_profiler_;
+
   ceres::Problem problem_;
 
   bool spline_initialized_with_gps_ = false;
 };
 
-inline bool KnotInBlock(const std::vector<double*> vec, double* knot_ptr) {
-  for (const auto& v : vec) {
-    if (knot_ptr == v) {
-      return true;
-    }
+//! Marks the knots [s, s + nr_knots) of a segment as used by the problem.
+//! Knots that were not used before are appended to knot_ids.
+inline void MarkKnotsInProblem(const int64_t s,
+                               const int nr_knots,
+                               std::vector<uint8_t>& in_problem,
+                               std::vector<int>& knot_ids) {
+  if (in_problem.size() < static_cast<size_t>(s + nr_knots)) {
+    in_problem.resize(s + nr_knots, 0);
   }
-  return false;
-}
-
-inline int GetPtrOffset(const double* knot_ptr,
-                        const std::vector<double*>& container) {
-  for (size_t i = 0; i < container.size(); ++i) {
-    if (knot_ptr == container[i]) {
-      return i;
+  for (int i = 0; i < nr_knots; ++i) {
+    const int idx = static_cast<int>(s) + i;
+    if (!in_problem[idx]) {
+      in_problem[idx] = 1;
+      knot_ids.push_back(idx);
     }
   }
-  // this should not happen!
-  return 0;
 }
 }  // namespace core
 }  // namespace OpenICC
 
 #include "OpenCameraCalibrator/core/spline_trajectory_estimator.impl.h"
+
+namespace OpenICC {
+namespace core {
+// instantiated in spline_trajectory_estimator.cc
+extern template class SplineTrajectoryEstimator<4>;
+extern template class SplineTrajectoryEstimator<5>;
+extern template class SplineTrajectoryEstimator<6>;
+}  // namespace core
+}  // namespace OpenICC
@@ -16,6 +16,7 @@ SplineTrajectoryEstimator<_T>::SplineTrajectoryEstimator()
 
   accl_intrinsics_ << 0, 0, 0, 1, 1, 1;
   gyro_intrinsics_ << 0, 0, 0, 0, 0, 0, 1, 1, 1;
+  ResetProblem();
 }
 
 template <int _T>
@@ -32,6 +33,7 @@ SplineTrajectoryEstimator<_T>::SplineTrajectoryEstimator(
 
   accl_intrinsics_ << 0, 0, 0, 1, 1, 1;
   gyro_intrinsics_ << 0, 0, 0, 0, 0, 0, 1, 1, 1;
+  ResetProblem();
 }
 
 template <int _T>
@@ -48,6 +50,8 @@ void SplineTrajectoryEstimator<_T>::SetTimes(int64_t time_interval_so3_ns,
   nr_knots_r3_ = duration / dt_r3_ns_ + _T;
   inv_so3_dt_ = S_TO_NS / dt_so3_ns_;
   inv_r3_dt_ = S_TO_NS / dt_r3_ns_;
+  knot_arena_.SetSpacing(SplineParameterArena::SO3, dt_so3_ns_);
+  knot_arena_.SetSpacing(SplineParameterArena::R3, dt_r3_ns_);
 }
 
 template <int _T>
@@ -58,6 +62,9 @@ void SplineTrajectoryEstimator<_T>::InitBiasSplines(
     int64_t dt_gyro_bias_ns,
     const double max_accl_range,
     const double max_gyro_range) {
+  // the knot arena is laid out again, which moves the knots the residuals
+  // point to
+  ResetProblem();
   max_accl_bias_range_ = max_accl_range;
   max_gyro_bias_range_ = max_gyro_range;
 
@@ -66,6 +73,8 @@ void SplineTrajectoryEstimator<_T>::InitBiasSplines(
 
   inv_accl_bias_dt_ = 1. / dt_accl_bias_ns_;
   inv_gyro_bias_dt_ = 1. / dt_gyro_bias_ns_;
+  knot_arena_.SetSpacing(SplineParameterArena::ACCL_BIAS, dt_accl_bias_ns_);
+  knot_arena_.SetSpacing(SplineParameterArena::GYRO_BIAS, dt_gyro_bias_ns_);
 
   const auto duration = end_t_ns_ - start_t_ns_;
   nr_knots_accl_bias_ = duration / dt_accl_bias_ns_ + BIAS_SPLINE_N;
@@ -91,43 +100,47 @@ void SplineTrajectoryEstimator<_T>::InitBiasSplines(
 
 template <int _T>
 void SplineTrajectoryEstimator<_T>::SetFixedParams(const int flags) {
-  // if IMU to Cam trafo should be optimized
-  if (problem_.HasParameterBlock(T_i_c_.data())) {
-    if (!(flags & SplineOptimFlags::T_I_C)) {
-      problem_.SetParameterBlockConstant(T_i_c_.data());
-      LOG(INFO) << "Keeping T_I_C constant.";
-    } else {
-      ceres::LocalParameterization* local_parameterization =
-          new LieLocalParameterization<Sophus::SE3d>();
-      problem_.SetParameterization(T_i_c_.data(), local_parameterization);
-      problem_.SetParameterBlockVariable(T_i_c_.data());
-      LOG(INFO) << "Optimizing T_I_C.";
+  for (size_t camera = 0; camera < NumRigCameras(); ++camera) {
+    // if IMU to Cam trafo should be optimized
+    double* T_i_c = T_i_cBlock(camera);
+    if (problem_.HasParameterBlock(T_i_c)) {
+      if (!(flags & SplineOptimFlags::T_I_C)) {
+        problem_.SetParameterBlockConstant(T_i_c);
+        LOG(INFO) << "Keeping T_I_C of camera " << camera << " constant.";
+      } else {
+        problem_.SetParameterization(T_i_c, se3_parameterization_.get());
+        problem_.SetParameterBlockVariable(T_i_c);
+        LOG(INFO) << "Optimizing T_I_C of camera " << camera << ".";
+      }
     }
-  }
 
-  // if IMU to Cam trafo should be optimized
-  if (problem_.HasParameterBlock(&cam_line_delay_s_) &&
-      cam_line_delay_s_ != 0.0) {
-    if (!(flags & SplineOptimFlags::CAM_LINE_DELAY)) {
-      problem_.SetParameterBlockConstant(&cam_line_delay_s_);
-      LOG(INFO) << "Keeping camera line delay constant at: "
-                << cam_line_delay_s_;
-    } else {
-      problem_.SetParameterBlockVariable(&cam_line_delay_s_);
-      LOG(INFO) << "Optimizing camera line delay.";
+    // if the camera line delay should be optimized
+    double* line_delay = LineDelayBlock(camera);
+    if (problem_.HasParameterBlock(line_delay) && *line_delay != 0.0) {
+      if (!(flags & SplineOptimFlags::CAM_LINE_DELAY)) {
+        problem_.SetParameterBlockConstant(line_delay);
+        LOG(INFO) << "Keeping line delay of camera " << camera
+                  << " constant at: " << *line_delay;
+      } else {
+        problem_.SetParameterBlockVariable(line_delay);
+        LOG(INFO) << "Optimizing line delay of camera " << camera << ".";
+      }
     }
   }
 
   // if IMU to Cam trafo should be optimized
-  if (problem_.HasParameterBlock(gravity_.data())) {
+  for (size_t segment = 0; segment < NumGravitySegments(); ++segment) {
+    double* gravity = GravityBlock(segment);
+    if (!problem_.HasParameterBlock(gravity)) {
+      continue;
+    }
     if (!(flags & SplineOptimFlags::GRAVITY_DIR)) {
       LOG(INFO) << "Keeping gravity direction constant at: "
-                << gravity_.transpose();
+                << Eigen::Map<const Eigen::Vector3d>(gravity).transpose();
 
-      problem_.SetParameterBlockConstant(gravity_.data());
+      problem_.SetParameterBlockConstant(gravity);
     } else {
-      if (problem_.HasParameterBlock(gravity_.data()))
-        problem_.SetParameterBlockVariable(gravity_.data());
+      problem_.SetParameterBlockVariable(gravity);
       LOG(INFO) << "Optimizing gravity direction.";
     }
   }
@@ -136,70 +149,62 @@ void SplineTrajectoryEstimator<_T>::SetFixedParams(const int flags) {
   if (!(flags & SplineOptimFlags::POINTS)) {
     LOG(INFO) << "Keeping object points constant.";
     for (const auto& tid : tracks_in_problem_) {
-      const auto track = image_data_.MutableTrack(tid)->MutablePoint()->data();
+      double* track = scene_points_.at(tid).data();
       if (problem_.HasParameterBlock(track))
         problem_.SetParameterBlockConstant(track);
     }
   } else {
     for (const auto& tid : tracks_in_problem_) {
-      const auto track = image_data_.MutableTrack(tid)->MutablePoint()->data();
+      double* track = scene_points_.at(tid).data();
       if (problem_.HasParameterBlock(track)) {
         problem_.SetParameterBlockVariable(track);
-        ceres::LocalParameterization* local_parameterization =
-            new ceres::HomogeneousVectorParameterization(4);
-        problem_.SetParameterization(track, local_parameterization);
+        problem_.SetParameterization(track, point_parameterization_.get());
       }
     }
     LOG(INFO) << "Optimizing object points.";
   }
 
-  // if imu intrinics should be optimized
-  if (problem_.HasParameterBlock(accl_intrinsics_.data()) &&
-      problem_.HasParameterBlock(gyro_intrinsics_.data())) {
+  // if imu intrinics should be optimized. Rotation only problems have the
+  // gyroscope intrinsics only
+  if (!(flags & SplineOptimFlags::IMU_INTRINSICS)) {
+    LOG(INFO) << "Keeping IMU intrinsics constant.";
+  } else {
+    LOG(INFO) << "Optimizing IMU intrinsics.";
+  }
+  for (double* intrinsics :
+       {accl_intrinsics_.data(), gyro_intrinsics_.data()}) {
+    if (!problem_.HasParameterBlock(intrinsics)) {
+      continue;
+    }
     if (!(flags & SplineOptimFlags::IMU_INTRINSICS)) {
-      LOG(INFO) << "Keeping IMU intrinsics constant.";
-      problem_.SetParameterBlockConstant(accl_intrinsics_.data());
-      problem_.SetParameterBlockConstant(gyro_intrinsics_.data());
+      problem_.SetParameterBlockConstant(intrinsics);
     } else {
-      problem_.SetParameterBlockVariable(accl_intrinsics_.data());
-      problem_.SetParameterBlockVariable(gyro_intrinsics_.data());
-      LOG(INFO) << "Optimizing IMU intrinsics.";
+      problem_.SetParameterBlockVariable(intrinsics);
     }
   }
 
-  // add local parametrization for SO(3)
-  for (size_t i = 0; i < so3_knots_.size(); ++i) {
-    if (problem_.HasParameterBlock(so3_knots_[i].data())) {
-      ceres::LocalParameterization* local_parameterization =
-          new LieLocalParameterization<Sophus::SO3d>();
-
-      problem_.SetParameterization(so3_knots_[i].data(),
-                                   local_parameterization);
-    }
+  // add local parametrization for SO(3) knots that were added since the
+  // last call
+  for (; nr_so3_knots_parameterized_ < so3_knot_ids_in_problem_.size();
+       ++nr_so3_knots_parameterized_) {
+    const int i = so3_knot_ids_in_problem_[nr_so3_knots_parameterized_];
+    problem_.SetParameterization(so3_knots_[i].data(),
+                                 so3_parameterization_.get());
   }
   if (!(flags & SplineOptimFlags::SPLINE)) {
     // set knots constant if asked
-    for (size_t i = 0; i < r3_knots_.size(); ++i) {
-      if (problem_.HasParameterBlock(r3_knots_[i].data())) {
-        problem_.SetParameterBlockConstant(r3_knots_[i].data());
-      }
+    for (const int i : r3_knot_ids_in_problem_) {
+      problem_.SetParameterBlockConstant(r3_knots_[i].data());
     }
-    for (size_t i = 0; i < so3_knots_.size(); ++i) {
-      if (problem_.HasParameterBlock(so3_knots_[i].data())) {
-        problem_.SetParameterBlockConstant(so3_knots_[i].data());
-      }
+    for (const int i : so3_knot_ids_in_problem_) {
+      problem_.SetParameterBlockConstant(so3_knots_[i].data());
     }
   } else {
-    // set knots constant if asked
-    for (size_t i = 0; i < r3_knots_.size(); ++i) {
-      if (problem_.HasParameterBlock(r3_knots_[i].data())) {
-        problem_.SetParameterBlockVariable(r3_knots_[i].data());
-      }
+    for (const int i : r3_knot_ids_in_problem_) {
+      problem_.SetParameterBlockVariable(r3_knots_[i].data());
     }
-    for (size_t i = 0; i < so3_knots_.size(); ++i) {
-      if (problem_.HasParameterBlock(so3_knots_[i].data())) {
-        problem_.SetParameterBlockVariable(so3_knots_[i].data());
-      }
+    for (const int i : so3_knot_ids_in_problem_) {
+      problem_.SetParameterBlockVariable(so3_knots_[i].data());
     }
   }
 
@@ -253,72 +258,1028 @@ void SplineTrajectoryEstimator<_T>::SetFixedParams(const int flags) {
 
 template <int _T>
 ceres::Solver::Summary SplineTrajectoryEstimator<_T>::Optimize(
-    const int max_iters, const int flags) {
+    const int max_iters,
+    const int flags,
+    const SplineSolverOptions& solver_options) {
+  SetFixedParams(flags);
+  if (solver_options.knot_freeze_rounds > 0 &&
+      (flags & SplineOptimFlags::SPLINE)) {
+    return OptimizeFreezingKnots(max_iters, flags, solver_options);
+  }
+  return Solve(max_iters, solver_options, true);
+}
+
+template <int _T>
+ceres::Solver::Summary SplineTrajectoryEstimator<_T>::OptimizeFreezingKnots(
+    const int max_iters,
+    const int flags,
+    const SplineSolverOptions& solver_options) {
+  OPENICC_TRACE_ZONE("spline_knot_freezing");
+  const int rounds = solver_options.knot_freeze_rounds;
+  const int round_iters = std::max(1, max_iters / (rounds + 1));
+  int used_iters = 0;
+  // the rounds and the polish share the time limit of one solve
+  SplineSolverOptions round_options = solver_options;
+  std::vector<Sophus::SO3d> so3_before(so3_knot_ids_in_problem_.size());
+  vec3_vector r3_before(r3_knot_ids_in_problem_.size());
+  std::vector<ceres::ResidualBlockId> free_residuals;
+  ceres::Solver::Summary summary;
+  for (int round = 0; round < rounds && used_iters < max_iters; ++round) {
+    for (size_t k = 0; k < so3_knot_ids_in_problem_.size(); ++k) {
+      so3_before[k] = so3_knots_[so3_knot_ids_in_problem_[k]];
+    }
+    for (size_t k = 0; k < r3_knot_ids_in_problem_.size(); ++k) {
+      r3_before[k] = r3_knots_[r3_knot_ids_in_problem_[k]];
+    }
+    // residuals that only touch constant blocks do not change the solve
+    free_residuals.clear();
+    if (round > 0) {
+      FreeResidualBlocks(&free_residuals);
+      if (free_residuals.empty()) {
+        break;
+      }
+      LOG(INFO) << "Knot freezing round " << round << ": solving "
+                << free_residuals.size() << " of "
+                << problem_.NumResidualBlocks() << " residual blocks.";
+    }
+    summary = Solve(round_iters,
+                    round_options,
+                    false,
+                    round > 0 ? &free_residuals : nullptr);
+    used_iters += static_cast<int>(summary.iterations.size());
+    round_options.max_solver_time_s -= summary.total_time_in_seconds;
+    if (round_options.max_solver_time_s <= 0.0) {
+      break;
+    }
+
+    int nr_free = 0;
+    int nr_frozen = 0;
+    for (size_t k = 0; k < so3_knot_ids_in_problem_.size(); ++k) {
+      double* knot = so3_knots_[so3_knot_ids_in_problem_[k]].data();
+      if (problem_.IsParameterBlockConstant(knot)) {
+        continue;
+      }
+      const double update =
+          (so3_before[k].inverse() * so3_knots_[so3_knot_ids_in_problem_[k]])
+              .log()
+              .norm();
+      if (update < solver_options.knot_freeze_rotation_rad) {
+        problem_.SetParameterBlockConstant(knot);
+        ++nr_frozen;
+      } else {
+        ++nr_free;
+      }
+    }
+    for (size_t k = 0; k < r3_knot_ids_in_problem_.size(); ++k) {
+      double* knot = r3_knots_[r3_knot_ids_in_problem_[k]].data();
+      if (problem_.IsParameterBlockConstant(knot)) {
+        continue;
+      }
+      const double update =
+          (r3_knots_[r3_knot_ids_in_problem_[k]] - r3_before[k]).norm();
+      if (update < solver_options.knot_freeze_translation_m) {
+        problem_.SetParameterBlockConstant(knot);
+        ++nr_frozen;
+      } else {
+        ++nr_free;
+      }
+    }
+    LOG(INFO) << "Knot freezing round " << round << ": froze " << nr_frozen
+              << " knots, " << nr_free << " stay free.";
+    if (nr_free == 0) {
+      break;
+    }
+  }
+
+  // final polish of all knots together, if time is left
+  SetFixedParams(flags);
+  if (round_options.max_solver_time_s <= 0.0) {
+    return summary;
+  }
+  return Solve(
+      std::max(round_iters, max_iters - used_iters), round_options, true);
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::FreeResidualBlocks(
+    std::vector<ceres::ResidualBlockId>* ids) const {
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  problem_.GetResidualBlocks(&residual_blocks);
+  std::vector<double*> blocks;
+  for (const ceres::ResidualBlockId id : residual_blocks) {
+    problem_.GetParameterBlocksForResidualBlock(id, &blocks);
+    for (double* block : blocks) {
+      if (!problem_.IsParameterBlockConstant(block)) {
+        ids->push_back(id);
+        break;
+      }
+    }
+  }
+}
+
+template <int _T>
+ceres::Solver::Summary SplineTrajectoryEstimator<_T>::Optimize(
+    const int max_iters,
+    const int flags,
+    const int64_t start_time,
+    const int64_t end_time,
+    const SplineSolverOptions& solver_options) {
+  SetFixedParams(flags);
+
+  // knot i is used by the segments [i - N + 1, i]
+  auto knot_in_window = [&](const size_t i, const int64_t dt_ns) {
+    const int64_t support_start =
+        start_t_ns_ + (static_cast<int64_t>(i) - N_ + 1) * dt_ns;
+    const int64_t support_end =
+        start_t_ns_ + (static_cast<int64_t>(i) + 1) * dt_ns;
+    return support_start >= start_time && support_end <= end_time;
+  };
+  for (const int i : so3_knot_ids_in_problem_) {
+    if (!knot_in_window(i, dt_so3_ns_)) {
+      problem_.SetParameterBlockConstant(so3_knots_[i].data());
+    }
+  }
+  for (const int i : r3_knot_ids_in_problem_) {
+    if (!knot_in_window(i, dt_r3_ns_)) {
+      problem_.SetParameterBlockConstant(r3_knots_[i].data());
+    }
+  }
+
+  // a free knot is only used by residuals inside the window. If nothing else
+  // is free, the residuals outside the window are constant and can be left
+  // out of the solve
+  if ((flags & ~SplineOptimFlags::SPLINE) == 0) {
+    std::vector<ceres::ResidualBlockId> window_residuals;
+    residual_index_.Select(start_time, end_time, &window_residuals);
+    LOG(INFO) << "Solving " << window_residuals.size() << " of "
+              << problem_.NumResidualBlocks()
+              << " residual blocks inside the window.";
+    return Solve(max_iters, solver_options, false, &window_residuals);
+  }
+  return Solve(max_iters, solver_options, false);
+}
+
+template <int _T>
+ceres::Solver::Summary SplineTrajectoryEstimator<_T>::Solve(
+    const int max_iters,
+    const SplineSolverOptions& solver_options,
+    const bool full_report,
+    const std::vector<ceres::ResidualBlockId>* residual_blocks) {
+  // items are the solver iterations
+  utils::ScopedTimer timer("spline_solve");
+  OPENICC_TRACE_ZONE("spline_solve");
+  SolverIterationRecorder recorder;
+  view_pose_callback_->SetNumThreads(solver_options.num_threads);
+  const int solver_threads =
+      utils::ExecutionContext::SolverThreads(solver_options.num_threads);
+  std::unique_ptr<ceres::Problem> sub_problem =
+      residual_blocks ? CreateSubProblem(*residual_blocks)
+                      : CreateConnectedSubProblem();
+  if (residual_profiler_) {
+    residual_profiler_->Reset();
+  }
+  ceres::Problem* problem = sub_problem ? sub_problem.get() : &problem_;
+  if (solver_options.use_banded_solver) {
+    std::vector<std::pair<int, double*>> knot_slots = KnotTimeSlots();
+    std::stable_sort(knot_slots.begin(),
+                     knot_slots.end(),
+                     [](const std::pair<int, double*>& a,
+                        const std::pair<int, double*>& b) {
+                       return a.first < b.first;
+                     });
+    std::vector<double*> knot_blocks;
+    for (const auto& slot : knot_slots) {
+      knot_blocks.push_back(slot.second);
+    }
+
+    BandedSplineSolver::Options banded_options;
+    banded_options.max_num_iterations = max_iters;
+    banded_options.function_tolerance = solver_options.function_tolerance;
+    banded_options.parameter_tolerance = solver_options.parameter_tolerance;
+    banded_options.max_solver_time_s = solver_options.max_solver_time_s;
+    banded_options.num_threads = solver_threads;
+    banded_options.callbacks.push_back(&recorder);
+    // the banded solver updates the parameter blocks in place
+    FunctionIterationCallback user_callback(solver_options.iteration_callback);
+    if (solver_options.iteration_callback) {
+      banded_options.callbacks.push_back(&user_callback);
+    }
+    BandedSplineSolver solver(problem, knot_blocks);
+    ceres::Solver::Summary summary;
+    solver.Solve(banded_options, &summary);
+    timer.AddItems(summary.iterations.size());
+    solver_log_.push_back(MakeSolverRunLog("BANDED", recorder, summary));
+    std::cout << summary.BriefReport() << std::endl;
+    RecordResidualProfile();
+    std::cout << "Banded spline solver, threads: " << solver_threads
+              << " took "
+              << summary.total_time_in_seconds << "s (linear solver "
+              << summary.linear_solver_time_in_seconds << "s)\n";
+    return summary;
+  }
+
   ceres::Solver::Options options;
-  options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+  options.linear_solver_type = solver_options.linear_solver_type;
   options.max_num_iterations = max_iters;
-  options.num_threads = std::thread::hardware_concurrency();
+  options.num_threads = solver_threads;
   options.minimizer_progress_to_stdout = true;
   options.trust_region_strategy_type = ceres::LEVENBERG_MARQUARDT;
-  options.function_tolerance = 1e-4;
-  options.parameter_tolerance = 1e-7;
-  options.preconditioner_type = ceres::CLUSTER_TRIDIAGONAL;
-  options.use_inner_iterations = true;
+  options.function_tolerance = solver_options.function_tolerance;
+  options.parameter_tolerance = solver_options.parameter_tolerance;
+  options.max_solver_time_in_seconds = solver_options.max_solver_time_s;
+  options.preconditioner_type = solver_options.preconditioner_type;
+  options.dense_linear_algebra_library_type =
+      solver_options.dense_linear_algebra_library_type;
+  if (!ceres::IsDenseLinearAlgebraLibraryTypeAvailable(
+          options.dense_linear_algebra_library_type)) {
+    LOG(WARNING) << "Dense linear algebra library "
+                 << ceres::DenseLinearAlgebraLibraryTypeToString(
+                        options.dense_linear_algebra_library_type)
+                 << " is not available. Using EIGEN.";
+    options.dense_linear_algebra_library_type = ceres::EIGEN;
+  }
+  options.use_inner_iterations = solver_options.use_inner_iterations;
+  options.callbacks.push_back(&recorder);
+  FunctionIterationCallback user_callback(solver_options.iteration_callback);
+  if (solver_options.iteration_callback) {
+    options.update_state_every_iteration = true;
+    options.callbacks.push_back(&user_callback);
+  }
+  if (corner_residuals_ && options.use_inner_iterations) {
+    LOG(WARNING) << "Inner iterations can not be used with corner residuals.";
+    options.use_inner_iterations = false;
+  }
 
-  SetFixedParams(flags);
+  const bool schur = ceres::IsSchurType(options.linear_solver_type);
+  std::shared_ptr<ceres::ParameterBlockOrdering> ordering;
+  std::string ordering_name = "ceres";
+  if (problem == &problem_) {
+    ordering = ImportedOrdering(schur);
+    if (ordering) {
+      ordering_name = "imported";
+    }
+  }
+  if (!ordering && solver_options.use_time_banded_ordering) {
+    ordering.reset(schur ? CreatePointSchurOrdering(*problem)
+                         : CreateTimeBandedOrdering(*problem));
+    if (ordering) {
+      ordering_name = schur ? "points first" : "time banded";
+    }
+  }
+  options.linear_solver_ordering = ordering;
+  if (ordering && problem == &problem_) {
+    last_ordering_ = ordering;
+    last_ordering_schur_ = schur;
+    last_ordering_shape_ = ProblemShapeKey();
+  }
 
   // Solve
   ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem_, &summary);
-  std::cout << summary.FullReport() << std::endl;
+  ceres::Solve(options, problem, &summary);
+  timer.AddItems(summary.iterations.size());
+  solver_log_.push_back(MakeSolverRunLog(
+      ceres::LinearSolverTypeToString(options.linear_solver_type),
+      recorder,
+      summary));
+  if (full_report) {
+    std::cout << summary.FullReport() << std::endl;
+  } else {
+    std::cout << summary.BriefReport() << std::endl;
+  }
+  std::cout << "Solver "
+            << ceres::LinearSolverTypeToString(options.linear_solver_type)
+            << " / "
+            << ceres::PreconditionerTypeToString(options.preconditioner_type)
+            << " / "
+            << ceres::DenseLinearAlgebraLibraryTypeToString(
+                   options.dense_linear_algebra_library_type)
+            << ", inner iterations: " << options.use_inner_iterations
+            << ", ordering: " << ordering_name
+            << ", threads: " << options.num_threads << " took "
+            << summary.total_time_in_seconds << "s (linear solver "
+            << summary.linear_solver_time_in_seconds << "s, inner iterations "
+            << summary.inner_iteration_time_in_seconds << "s)\n";
+  RecordResidualProfile();
 
   return summary;
 }
 
 template <int _T>
-void SplineTrajectoryEstimator<_T>::BatchInitSO3R3VisPoses() {
-  so3_knots_ = OpenICC::so3_vector(nr_knots_so3_);
-  r3_knots_ = vec3_vector(nr_knots_r3_);
-  so3_knot_in_problem_ = std::vector(nr_knots_so3_, false);
-  r3_knot_in_problem_ = std::vector(nr_knots_r3_, false);
-  // first interpolate spline poses for imu update rate
-  // create zero-based maps
-  OpenICC::quat_map quat_vis_map;
-  OpenICC::vec3_map translations_map;
+void SplineTrajectoryEstimator<_T>::RecordResidualProfile() {
+  if (!residual_profiler_ || solver_log_.empty()) {
+    return;
+  }
+  solver_log_.back().residual_profile = residual_profiler_->Merge();
+  PrintResidualProfile(solver_log_.back().residual_profile, std::cout);
+}
+
+template <int _T>
+std::vector<std::pair<int, double*>>
+SplineTrajectoryEstimator<_T>::KnotTimeSlots() {
+  // SO3 and R3 knots covering the same time slot share one slot
+  std::vector<std::pair<int, double*>> slots;
+  const int64_t dt_min_ns = std::min(dt_so3_ns_, dt_r3_ns_);
+  slots.reserve(so3_knot_ids_in_problem_.size() +
+                r3_knot_ids_in_problem_.size());
+  for (const int i : so3_knot_ids_in_problem_) {
+    slots.emplace_back(static_cast<int>(i * dt_so3_ns_ / dt_min_ns),
+                       so3_knots_[i].data());
+  }
+  for (const int i : r3_knot_ids_in_problem_) {
+    slots.emplace_back(static_cast<int>(i * dt_r3_ns_ / dt_min_ns),
+                       r3_knots_[i].data());
+  }
+  return slots;
+}
+
+template <int _T>
+ceres::ParameterBlockOrdering*
+SplineTrajectoryEstimator<_T>::CreateTimeBandedOrdering(
+    const ceres::Problem& problem) {
+  // knots are eliminated front to back along the trajectory
+  ceres::ParameterBlockOrdering* ordering = new ceres::ParameterBlockOrdering;
+  int last_group = 0;
+  for (const auto& slot : KnotTimeSlots()) {
+    if (!problem.HasParameterBlock(slot.second)) {
+      continue;
+    }
+    ordering->AddElementToGroup(slot.second, slot.first);
+    last_group = std::max(last_group, slot.first);
+  }
+
+  // points, bias knots and global parameters couple the whole trajectory
+  std::vector<double*> parameter_blocks;
+  problem.GetParameterBlocks(&parameter_blocks);
+  for (double* block : parameter_blocks) {
+    if (!ordering->IsMember(block)) {
+      ordering->AddElementToGroup(block, last_group + 1);
+    }
+  }
+  return ordering;
+}
+
+template <int _T>
+ceres::ParameterBlockOrdering*
+SplineTrajectoryEstimator<_T>::CreatePointSchurOrdering(
+    const ceres::Problem& problem) {
+  // a residual depends on at most one scene point, so the points are an
+  // independent set
+  bool free_point = false;
+  ceres::ParameterBlockOrdering* ordering = new ceres::ParameterBlockOrdering;
+  for (const theia::TrackId tid : tracks_in_problem_) {
+    double* point = scene_points_.at(tid).data();
+    if (!problem.HasParameterBlock(point)) {
+      continue;
+    }
+    ordering->AddElementToGroup(point, 0);
+    free_point |= !problem.IsParameterBlockConstant(point);
+  }
+  if (!free_point) {
+    delete ordering;
+    return nullptr;
+  }
+
+  std::vector<double*> parameter_blocks;
+  problem.GetParameterBlocks(&parameter_blocks);
+  for (double* block : parameter_blocks) {
+    if (!ordering->IsMember(block)) {
+      ordering->AddElementToGroup(block, 1);
+    }
+  }
+  return ordering;
+}
+
+template <int _T>
+std::string SplineTrajectoryEstimator<_T>::ProblemShapeKey() const {
+  return "N" + std::to_string(N_) + "_so3_" +
+         std::to_string(so3_knot_ids_in_problem_.size()) + "_r3_" +
+         std::to_string(r3_knot_ids_in_problem_.size()) + "_points_" +
+         std::to_string(tracks_in_problem_.size()) + "_blocks_" +
+         std::to_string(problem_.NumParameterBlocks()) + "_residuals_" +
+         std::to_string(problem_.NumResidualBlocks()) + "_" +
+         std::to_string(problem_.NumResiduals());
+}
+
+template <int _T>
+std::unordered_map<const double*, std::string>
+SplineTrajectoryEstimator<_T>::ParameterBlockNames() const {
+  std::unordered_map<const double*, std::string> names;
+  for (const int i : so3_knot_ids_in_problem_) {
+    names[so3_knots_[i].data()] = "so3_" + std::to_string(i);
+  }
+  for (const int i : r3_knot_ids_in_problem_) {
+    names[r3_knots_[i].data()] = "r3_" + std::to_string(i);
+  }
+  for (size_t i = 0; i < accl_bias_spline_.size(); ++i) {
+    names[accl_bias_spline_[i].data()] = "accl_bias_" + std::to_string(i);
+  }
+  for (size_t i = 0; i < gyro_bias_spline_.size(); ++i) {
+    names[gyro_bias_spline_[i].data()] = "gyro_bias_" + std::to_string(i);
+  }
+  for (const theia::TrackId tid : tracks_in_problem_) {
+    names[scene_points_.at(tid).data()] = "point_" + std::to_string(tid);
+  }
+  names[T_i_c_.data()] = "T_i_c";
+  names[gravity_.data()] = "gravity";
+  for (size_t i = 0; i < segment_gravity_.size(); ++i) {
+    names[segment_gravity_[i].data()] = "gravity_" + std::to_string(i + 1);
+  }
+  names[accl_intrinsics_.data()] = "accl_intrinsics";
+  names[gyro_intrinsics_.data()] = "gyro_intrinsics";
+  names[&cam_line_delay_s_] = "line_delay";
+  for (size_t i = 0; i < rig_T_i_c_.size(); ++i) {
+    names[rig_T_i_c_[i].data()] = "T_i_c_" + std::to_string(i + 1);
+    names[&rig_line_delay_s_[i]] = "line_delay_" + std::to_string(i + 1);
+  }
+  return names;
+}
+
+template <int _T>
+nlohmann::json SplineTrajectoryEstimator<_T>::ExportParameterOrdering()
+    const {
+  if (!last_ordering_) {
+    return nlohmann::json();
+  }
+  const std::unordered_map<const double*, std::string> names =
+      ParameterBlockNames();
+  nlohmann::json groups = nlohmann::json::array();
+  for (const auto& group : last_ordering_->group_to_elements()) {
+    nlohmann::json group_names = nlohmann::json::array();
+    for (double* block : group.second) {
+      const auto name = names.find(block);
+      if (name == names.end()) {
+        LOG(WARNING) << "Parameter ordering refers to a block that is not "
+                        "part of the spline anymore, not exporting it.";
+        return nlohmann::json();
+      }
+      group_names.push_back(name->second);
+    }
+    groups.push_back(group_names);
+  }
+  nlohmann::json ordering;
+  ordering["shape"] = last_ordering_shape_;
+  ordering["schur"] = last_ordering_schur_;
+  ordering["groups"] = groups;
+  return ordering;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::ImportParameterOrdering(
+    const nlohmann::json& ordering) {
+  if (!ordering.is_object() || !ordering.contains("shape") ||
+      !ordering.contains("schur") || !ordering.contains("groups") ||
+      !ordering["groups"].is_array()) {
+    LOG(WARNING) << "Malformed parameter ordering, not importing it.";
+    return false;
+  }
+  imported_ordering_ = ordering;
+  return true;
+}
+
+template <int _T>
+std::shared_ptr<ceres::ParameterBlockOrdering>
+SplineTrajectoryEstimator<_T>::ImportedOrdering(const bool schur) const {
+  if (imported_ordering_.is_null() ||
+      imported_ordering_["schur"].get<bool>() != schur ||
+      imported_ordering_["shape"].get<std::string>() != ProblemShapeKey()) {
+    return nullptr;
+  }
+  std::unordered_map<std::string, double*> blocks;
+  for (const auto& name : ParameterBlockNames()) {
+    if (problem_.HasParameterBlock(name.first)) {
+      blocks[name.second] = const_cast<double*>(name.first);
+    }
+  }
+
+  auto ordering = std::make_shared<ceres::ParameterBlockOrdering>();
+  const nlohmann::json& groups = imported_ordering_["groups"];
+  for (size_t g = 0; g < groups.size(); ++g) {
+    for (const auto& name : groups[g]) {
+      const auto block = blocks.find(name.get<std::string>());
+      if (block == blocks.end()) {
+        LOG(WARNING) << "Imported parameter ordering does not match the "
+                        "problem, computing a new one.";
+        return nullptr;
+      }
+      ordering->AddElementToGroup(block->second, static_cast<int>(g));
+    }
+  }
+  if (ordering->NumElements() != problem_.NumParameterBlocks()) {
+    LOG(WARNING) << "Imported parameter ordering does not cover the "
+                    "problem, computing a new one.";
+    return nullptr;
+  }
+  return ordering;
+}
+
+template <int _T>
+std::unique_ptr<ceres::Problem>
+SplineTrajectoryEstimator<_T>::CreateConnectedSubProblem() {
+  // without fast removal every lookup below scans all residual blocks, so
+  // this only pays off for a handful of free blocks
+  constexpr size_t kMaxFreeBlocks = 16;
+  if (!connected_sub_problems_) {
+    return nullptr;
+  }
+  std::vector<double*> parameter_blocks;
+  problem_.GetParameterBlocks(&parameter_blocks);
+  std::vector<double*> free_blocks;
+  for (double* block : parameter_blocks) {
+    if (problem_.IsParameterBlockConstant(block)) {
+      continue;
+    }
+    free_blocks.push_back(block);
+    if (free_blocks.size() > kMaxFreeBlocks) {
+      return nullptr;
+    }
+  }
+
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  std::unordered_set<ceres::ResidualBlockId> seen;
+  for (double* block : free_blocks) {
+    std::vector<ceres::ResidualBlockId> connected;
+    problem_.GetResidualBlocksForParameterBlock(block, &connected);
+    for (const ceres::ResidualBlockId id : connected) {
+      if (seen.insert(id).second) {
+        residual_blocks.push_back(id);
+      }
+    }
+  }
+  std::unique_ptr<ceres::Problem> sub_problem =
+      CreateSubProblem(residual_blocks);
+  if (sub_problem) {
+    LOG(INFO) << "Solving " << residual_blocks.size() << " of "
+              << problem_.NumResidualBlocks()
+              << " residual blocks connected to " << free_blocks.size()
+              << " free parameter blocks.";
+  }
+  return sub_problem;
+}
+
+template <int _T>
+std::unique_ptr<ceres::Problem>
+SplineTrajectoryEstimator<_T>::CreateSubProblem(
+    const std::vector<ceres::ResidualBlockId>& residual_blocks) {
+  if (residual_blocks.empty() ||
+      static_cast<int>(residual_blocks.size()) ==
+          problem_.NumResidualBlocks()) {
+    return nullptr;
+  }
+  ceres::Problem::Options sub_options;
+  sub_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  sub_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  sub_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  if (corner_residuals_) {
+    sub_options.evaluation_callback = view_pose_callback_.get();
+  }
+  std::unique_ptr<ceres::Problem> sub_problem(new ceres::Problem(sub_options));
+
+  std::vector<double*> blocks;
+  for (const ceres::ResidualBlockId id : residual_blocks) {
+    problem_.GetParameterBlocksForResidualBlock(id, &blocks);
+    for (double* block : blocks) {
+      if (sub_problem->HasParameterBlock(block)) {
+        continue;
+      }
+      const int size = problem_.ParameterBlockSize(block);
+      sub_problem->AddParameterBlock(
+          block, size, problem_.GetParameterization(block));
+      if (problem_.IsParameterBlockConstant(block)) {
+        sub_problem->SetParameterBlockConstant(block);
+        continue;
+      }
+      for (int d = 0; d < size; ++d) {
+        sub_problem->SetParameterLowerBound(
+            block, d, problem_.GetParameterLowerBound(block, d));
+        sub_problem->SetParameterUpperBound(
+            block, d, problem_.GetParameterUpperBound(block, d));
+      }
+    }
+    sub_problem->AddResidualBlock(
+        const_cast<ceres::CostFunction*>(
+            problem_.GetCostFunctionForResidualBlock(id)),
+        const_cast<ceres::LossFunction*>(
+            problem_.GetLossFunctionForResidualBlock(id)),
+        blocks);
+  }
+  return sub_problem;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ResetProblem() {
+  ceres::Problem::Options problem_options;
+  // the losses and parameterizations are shared by many blocks, the cost
+  // functions live in cost_function_arena_
+  problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+  problem_options.local_parameterization_ownership =
+      ceres::DO_NOT_TAKE_OWNERSHIP;
+  if (corner_residuals_) {
+    problem_options.evaluation_callback = view_pose_callback_.get();
+  }
+  problem_ = ceres::Problem(problem_options);
+  cost_function_arena_->Clear();
+  view_pose_callback_->Clear();
+  std::fill(so3_knot_in_problem_.begin(), so3_knot_in_problem_.end(), 0);
+  std::fill(r3_knot_in_problem_.begin(), r3_knot_in_problem_.end(), 0);
+  so3_knot_ids_in_problem_.clear();
+  r3_knot_ids_in_problem_.clear();
+  nr_so3_knots_parameterized_ = 0;
+  tracks_in_problem_.clear();
+  residual_index_.Clear();
+  last_ordering_.reset();
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetResidualProfiling(const bool profile) {
+  // profiled cost functions of earlier measurements keep recording until
+  // the problem is reset, so the profiler is never released
+  if (profile && !residual_profiler_) {
+    residual_profiler_ = std::make_unique<ResidualProfiler>();
+  }
+  profile_residuals_ = profile;
+}
+
+template <int _T>
+ceres::CostFunction* SplineTrajectoryEstimator<_T>::Profiled(
+    ceres::CostFunction* cost_function, const ResidualProfiler::Type type) {
+  if (!profile_residuals_) {
+    return cost_function;
+  }
+  return cost_function_arena_->Create<ProfiledCostFunction>(
+      cost_function, residual_profiler_.get(), type);
+}
+
+template <int _T>
+ceres::LossFunction* SplineTrajectoryEstimator<_T>::SharedHuberLoss(
+    const double width) {
+  std::unique_ptr<ceres::LossFunction>& loss = huber_losses_[width];
+  if (!loss) {
+    loss = std::make_unique<ceres::HuberLoss>(width);
+  }
+  return loss.get();
+}
+
+template <int _T>
+SplineProblemMemoryReport
+SplineTrajectoryEstimator<_T>::GetProblemMemoryReport() const {
+  SplineProblemMemoryReport report;
+  report.num_parameter_blocks = problem_.NumParameterBlocks();
+  report.num_parameters = problem_.NumParameters();
+  report.num_residual_blocks = problem_.NumResidualBlocks();
+  report.num_residuals = problem_.NumResiduals();
+
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  problem_.GetResidualBlocks(&residual_blocks);
+  for (const ceres::ResidualBlockId id : residual_blocks) {
+    if (problem_.GetLossFunctionForResidualBlock(id)) {
+      ++report.num_robust_residual_blocks;
+    }
+  }
+  std::vector<double*> parameter_blocks;
+  problem_.GetParameterBlocks(&parameter_blocks);
+  for (const double* block : parameter_blocks) {
+    if (problem_.GetParameterization(block)) {
+      ++report.num_parameterized_blocks;
+    }
+  }
+  report.num_shared_objects = static_cast<int>(huber_losses_.size()) + 3;
+  report.objects_without_sharing =
+      report.num_robust_residual_blocks + report.num_parameterized_blocks;
+  report.peak_rss_mb = utils::PeakRssMB();
+  return report;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::ComputeGlobalCovariance(
+    SplineGlobalCovariance& covariance, const int num_threads) {
+  OPENICC_TRACE_ZONE("spline_covariance");
+  covariance = SplineGlobalCovariance();
+  std::vector<double*> global_blocks;
+  for (size_t camera = 0; camera < NumRigCameras(); ++camera) {
+    global_blocks.push_back(T_i_cBlock(camera));
+    global_blocks.push_back(LineDelayBlock(camera));
+  }
+  for (size_t segment = 0; segment < NumGravitySegments(); ++segment) {
+    global_blocks.push_back(GravityBlock(segment));
+  }
+  global_blocks.push_back(accl_intrinsics_.data());
+  global_blocks.push_back(gyro_intrinsics_.data());
+  auto is_free = [&](double* block) {
+    return problem_.HasParameterBlock(block) &&
+           !problem_.IsParameterBlockConstant(block);
+  };
+  global_blocks.erase(
+      std::remove_if(global_blocks.begin(),
+                     global_blocks.end(),
+                     [&](double* block) { return !is_free(block); }),
+      global_blocks.end());
+  if (global_blocks.empty()) {
+    LOG(WARNING) << "No free global parameter for the covariance.";
+    return false;
+  }
+
+  // the marginalized blocks first, the global blocks in the last columns
+  const std::unordered_set<double*> global_set(global_blocks.begin(),
+                                               global_blocks.end());
+  std::vector<double*> parameter_blocks;
+  problem_.GetParameterBlocks(&parameter_blocks);
+  std::vector<double*> eval_blocks;
+  int num_marginalized = 0;
+  for (double* block : parameter_blocks) {
+    if (!global_set.count(block) && !problem_.IsParameterBlockConstant(block)) {
+      eval_blocks.push_back(block);
+      num_marginalized += problem_.ParameterBlockLocalSize(block);
+    }
+  }
+  const std::unordered_map<const double*, std::string> names =
+      ParameterBlockNames();
+  int num_global = 0;
+  for (double* block : global_blocks) {
+    eval_blocks.push_back(block);
+    const auto name = names.find(block);
+    covariance.names.push_back(name != names.end() ? name->second : "");
+    covariance.offsets.push_back(num_global);
+    covariance.sizes.push_back(problem_.ParameterBlockLocalSize(block));
+    num_global += covariance.sizes.back();
+  }
+
+  ceres::Problem::EvaluateOptions eval_options;
+  eval_options.parameter_blocks = eval_blocks;
+  eval_options.num_threads = num_threads;
+  ceres::CRSMatrix jacobian;
+  if (!problem_.Evaluate(eval_options, nullptr, nullptr, nullptr, &jacobian)) {
+    LOG(ERROR) << "Could not evaluate the spline problem.";
+    return false;
+  }
+
+  // normal equations H = J^T J in the blocks of marginalized (m) and global
+  // (g) parameters
+  std::vector<Eigen::Triplet<double>> h_mm;
+  std::vector<Eigen::Triplet<double>> h_mg;
+  Eigen::MatrixXd H_gg = Eigen::MatrixXd::Zero(num_global, num_global);
+  std::vector<int> cols;
+  std::vector<double> values;
+  for (int r = 0; r < jacobian.num_rows; ++r) {
+    cols.clear();
+    values.clear();
+    for (int idx = jacobian.rows[r]; idx < jacobian.rows[r + 1]; ++idx) {
+      if (jacobian.values[idx] != 0.0) {
+        cols.push_back(jacobian.cols[idx]);
+        values.push_back(jacobian.values[idx]);
+      }
+    }
+    for (size_t a = 0; a < cols.size(); ++a) {
+      for (size_t b = 0; b < cols.size(); ++b) {
+        const double h = values[a] * values[b];
+        if (cols[a] < num_marginalized && cols[b] < num_marginalized) {
+          h_mm.emplace_back(cols[a], cols[b], h);
+        } else if (cols[a] < num_marginalized) {
+          h_mg.emplace_back(cols[a], cols[b] - num_marginalized, h);
+        } else if (cols[b] >= num_marginalized) {
+          H_gg(cols[a] - num_marginalized, cols[b] - num_marginalized) += h;
+        }
+      }
+    }
+  }
+  // unobserved marginalized directions, e.g. knots that only a constant
+  // block constrains, must not make H_mm singular
+  for (int i = 0; i < num_marginalized; ++i) {
+    h_mm.emplace_back(i, i, 1e-9);
+  }
+  Eigen::SparseMatrix<double> H_mm(num_marginalized, num_marginalized);
+  H_mm.setFromTriplets(h_mm.begin(), h_mm.end());
+  Eigen::SparseMatrix<double> H_mg(num_marginalized, num_global);
+  H_mg.setFromTriplets(h_mg.begin(), h_mg.end());
+
+  Eigen::MatrixXd schur = H_gg;
+  if (num_marginalized > 0) {
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt(H_mm);
+    if (ldlt.info() != Eigen::Success) {
+      LOG(ERROR) << "Could not factorize the marginalized normal equations.";
+      return false;
+    }
+    const Eigen::MatrixXd H_mm_inv_H_mg = ldlt.solve(Eigen::MatrixXd(H_mg));
+    schur -= H_mg.transpose() * H_mm_inv_H_mg;
+  }
+  const Eigen::LDLT<Eigen::MatrixXd> schur_ldlt(schur);
+  if (schur_ldlt.info() != Eigen::Success || !schur_ldlt.isPositive() ||
+      schur_ldlt.vectorD().minCoeff() <= 0.0) {
+    LOG(ERROR) << "Global parameters are not observable, no covariance.";
+    return false;
+  }
+  covariance.covariance =
+      schur_ldlt.solve(Eigen::MatrixXd::Identity(num_global, num_global));
+  return true;
+}
 
-  // get sorted poses
-  const auto view_ids = image_data_.ViewIds();
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetCornerReprojectionResiduals(
+    const bool corner_residuals) {
+  corner_residuals_ = corner_residuals;
+  ResetProblem();
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ResampleKnots(const int64_t dt_so3_ns,
+                                                  const int64_t dt_r3_ns) {
+  OPENICC_TRACE_ZONE("spline_resample_knots");
+  ResetProblem();
+
+  const so3_vector old_so3_knots = so3_knots_.ToVector();
+  const vec3_vector old_r3_knots = r3_knots_.ToVector();
+  const int64_t old_dt_so3_ns = dt_so3_ns_;
+  const int64_t old_dt_r3_ns = dt_r3_ns_;
+
+  // segment and normalized time on the old spline, clamped to its range
+  auto old_segment = [&](const int64_t t_ns,
+                         const int64_t dt_ns,
+                         const size_t nr_knots,
+                         int64_t& s,
+                         double& u) {
+    const int64_t st_ns = t_ns - start_t_ns_;
+    const int64_t max_s = static_cast<int64_t>(nr_knots) - N_;
+    s = std::min(std::max<int64_t>(st_ns / dt_ns, 0), max_s);
+    u = std::min(std::max(double(st_ns - s * dt_ns) / double(dt_ns), 0.0),
+                 1.0);
+  };
+  auto old_rotation = [&](const int64_t t_ns) {
+    int64_t s;
+    double u;
+    old_segment(t_ns, old_dt_so3_ns, old_so3_knots.size(), s, u);
+    const double* knots[N_];
+    for (int i = 0; i < N_; ++i) knots[i] = old_so3_knots[s + i].data();
+    Sophus::SO3d R;
+    CeresSplineHelper<double, N_>::template evaluate_lie<Sophus::SO3>(
+        knots, u, 1.0, &R);
+    return R;
+  };
+  auto old_position = [&](const int64_t t_ns) {
+    int64_t s;
+    double u;
+    old_segment(t_ns, old_dt_r3_ns, old_r3_knots.size(), s, u);
+    const double* knots[N_];
+    for (int i = 0; i < N_; ++i) knots[i] = old_r3_knots[s + i].data();
+    Eigen::Vector3d p;
+    CeresSplineHelper<double, N_>::template evaluate<3, 0>(knots, u, 1.0, &p);
+    return p;
+  };
+
+  SetTimes(dt_so3_ns, dt_r3_ns, start_t_ns_, end_t_ns_);
+  so3_knots_.resize(nr_knots_so3_);
+  r3_knots_.resize(nr_knots_r3_);
+  so3_knot_in_problem_.assign(nr_knots_so3_, 0);
+  r3_knot_in_problem_.assign(nr_knots_r3_, 0);
+
+  // knot i is used by the segments [i - N + 1, i]
+  auto support_center_ns = [&](const size_t i, const int64_t dt_ns) {
+    return start_t_ns_ +
+           (2 * static_cast<int64_t>(i) - N_ + 2) * dt_ns / 2;
+  };
+  for (size_t i = 0; i < so3_knots_.size(); ++i) {
+    so3_knots_[i] = old_rotation(support_center_ns(i, dt_so3_ns_));
+  }
+  for (size_t i = 0; i < r3_knots_.size(); ++i) {
+    r3_knots_[i] = old_position(support_center_ns(i, dt_r3_ns_));
+  }
+
+  // least squares fit of the R3 knots to samples of the old spline
+  const int kSamplesPerSegment = 4;
+  std::vector<int64_t> sample_times_ns;
+  vec3_vector sample_positions;
+  for (size_t s = 0; s + N_ <= r3_knots_.size(); ++s) {
+    for (int j = 0; j < kSamplesPerSegment; ++j) {
+      const double u = (j + 0.5) / kSamplesPerSegment;
+      sample_times_ns.push_back(start_t_ns_ +
+                                static_cast<int64_t>((s + u) * dt_r3_ns_));
+      sample_positions.push_back(old_position(sample_times_ns.back()));
+    }
+  }
+  if (!FitR3Knots(sample_times_ns, sample_positions, 1e-9)) {
+    LOG(WARNING) << "R3 knot fit failed, using sampled knots.";
+  }
+
+  std::cout << "Resampled spline to " << so3_knots_.size() << " SO3 and "
+            << r3_knots_.size() << " R3 knots.\n";
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::FitR3Knots(
+    const std::vector<int64_t>& times_ns,
+    const vec3_vector& positions,
+    const double prior_weight) {
+  // the normal equations are banded with N diagonals
+  const int nr_knots = static_cast<int>(r3_knots_.size());
+  std::vector<Eigen::Triplet<double>> triplets;
+  triplets.reserve(nr_knots + times_ns.size() * N_ * N_);
+  Eigen::MatrixXd rhs(nr_knots, 3);
+  for (int i = 0; i < nr_knots; ++i) {
+    triplets.emplace_back(i, i, prior_weight);
+    rhs.row(i) = prior_weight * r3_knots_[i].transpose();
+  }
+  for (size_t k = 0; k < times_ns.size(); ++k) {
+    double u;
+    int64_t s;
+    if (!CalcR3Times(times_ns[k], u, s)) {
+      continue;
+    }
+    const auto coeff =
+        CeresSplineHelper<double, N_>::template coeffs<0, false>(u, 1.0);
+    for (int a = 0; a < N_; ++a) {
+      rhs.row(s + a) += coeff[a] * positions[k].transpose();
+      for (int b = 0; b < N_; ++b) {
+        triplets.emplace_back(s + a, s + b, coeff[a] * coeff[b]);
+      }
+    }
+  }
+  Eigen::SparseMatrix<double> H(nr_knots, nr_knots);
+  H.setFromTriplets(triplets.begin(), triplets.end());
+  Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt(H);
+  if (ldlt.info() != Eigen::Success) {
+    return false;
+  }
+  const Eigen::MatrixXd fitted = ldlt.solve(rhs);
+  for (int i = 0; i < nr_knots; ++i) {
+    r3_knots_[i] = fitted.row(i).transpose();
+  }
+  return true;
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::BatchInitSO3R3VisPoses(
+    const bool fit_r3_knots) {
+  OPENICC_TRACE_ZONE("spline_init_knots");
+  so3_knots_.assign(nr_knots_so3_, Sophus::SO3d());
+  r3_knots_.assign(nr_knots_r3_, Eigen::Vector3d::Zero());
+  so3_knot_in_problem_.assign(nr_knots_so3_, 0);
+  r3_knot_in_problem_.assign(nr_knots_r3_, 0);
+  so3_knot_ids_in_problem_.clear();
+  r3_knot_ids_in_problem_.clear();
+  nr_so3_knots_parameterized_ = 0;
+  OpenICC::quat_series quat_vis;
+  OpenICC::vec3_series translations;
+  CollectViewImuPoses(std::numeric_limits<int64_t>::max(),
+                      quat_vis,
+                      translations);
+  InitKnotsFromPoses(quat_vis, translations, 0, 0);
+  if (!fit_r3_knots) {
+    return;
+  }
+
+  // the interpolated knots are the prior of knots without views nearby
+  std::vector<int64_t> times_ns;
+  times_ns.reserve(translations.size());
+  for (const double t_s : translations.Times()) {
+    times_ns.push_back(static_cast<int64_t>(t_s * S_TO_NS));
+  }
+  if (FitR3Knots(times_ns, translations.Values(), 1e-3)) {
+    LOG(INFO) << "Fitted " << nr_knots_r3_ << " R3 knots to "
+              << times_ns.size() << " view positions.";
+  } else {
+    LOG(WARNING) << "R3 knot fit failed, using interpolated knots.";
+  }
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::CollectViewImuPoses(
+    const int64_t max_time_ns,
+    OpenICC::quat_series& quat_vis,
+    OpenICC::vec3_series& translations) const {
+  const auto view_ids = image_data_->ViewIds();
+  quat_vis.reserve(view_ids.size());
+  translations.reserve(view_ids.size());
   for (const auto& vid : view_ids) {
-    const auto* v = image_data_.View(vid);
+    const auto* v = image_data_->View(vid);
     const double t_s = v->GetTimestamp();
+    if (t_s * S_TO_NS > max_time_ns) {
+      continue;
+    }
     const auto q_w_c = Eigen::Quaterniond(
         v->Camera().GetOrientationAsRotationMatrix().transpose());
     const Sophus::SE3d T_w_c(q_w_c, v->Camera().GetPosition());
-    const Sophus::SE3d T_w_i = T_w_c * T_i_c_.inverse();
-    quat_vis_map[t_s] = T_w_i.so3().unit_quaternion();
-    translations_map[t_s] = T_w_i.translation();
-  }
-
-  OpenICC::quat_vector quat_vis;
-  OpenICC::vec3_vector translations;
-  std::vector<double> t_vis;
-  for (auto const& q : quat_vis_map) {
-    quat_vis.push_back(q.second);
-    t_vis.push_back(q.first);
-  }
-
-  for (auto const& t : translations_map) {
-    translations.push_back(t.second);
+    const Sophus::SE3d T_w_i =
+        T_w_c * GetRigCameraT_i_c(RigCameraOf(vid)).inverse();
+    quat_vis.PushBack(t_s, T_w_i.so3().unit_quaternion());
+    translations.PushBack(t_s, T_w_i.translation());
   }
+  quat_vis.Sort();
+  translations.Sort();
+}
 
+template <int _T>
+void SplineTrajectoryEstimator<_T>::InitKnotsFromPoses(
+    const OpenICC::quat_series& quat_vis,
+    const OpenICC::vec3_series& translations,
+    const int so3_begin,
+    const int r3_begin) {
   // get time at which we want to interpolate
   std::vector<double> t_so3_spline, t_r3_spline;
-  for (int i = 0; i < nr_knots_so3_; ++i) {
+  for (int i = so3_begin; i < nr_knots_so3_; ++i) {
     const double t = i * dt_so3_ns_ * NS_TO_S;
     t_so3_spline.push_back(t);
   }
 
-  for (int i = 0; i < nr_knots_r3_; ++i) {
+  for (int i = r3_begin; i < nr_knots_r3_; ++i) {
     const double t = i * dt_r3_ns_ * NS_TO_S;
     t_r3_spline.push_back(t);
   }
@@ -326,23 +1287,88 @@ void SplineTrajectoryEstimator<_T>::BatchInitSO3R3VisPoses() {
   OpenICC::quat_vector interp_spline_quats;
   OpenICC::vec3_vector interpo_spline_trans;
   OpenICC::utils::InterpolateQuaternions(
-      t_vis, t_so3_spline, quat_vis, interp_spline_quats);
-  OpenICC::utils::InterpolateVector3d(
-      t_vis, t_r3_spline, translations, interpo_spline_trans);
+      quat_vis.Times(), t_so3_spline, quat_vis.Values(), interp_spline_quats);
+  OpenICC::utils::InterpolateVector3d(translations.Times(),
+                                      t_r3_spline,
+                                      translations.Values(),
+                                      interpo_spline_trans);
+
+  for (int i = so3_begin; i < nr_knots_so3_; ++i) {
+    so3_knots_[i] = Sophus::SO3d(interp_spline_quats[i - so3_begin]);
+  }
+  for (int i = r3_begin; i < nr_knots_r3_; ++i) {
+    r3_knots_[i] = interpo_spline_trans[i - r3_begin];
+  }
+}
 
-  for (int i = 0; i < nr_knots_so3_; ++i) {
-    so3_knots_[i] = Sophus::SO3d(interp_spline_quats[i]);
+template <int _T>
+void SplineTrajectoryEstimator<_T>::ExtendKnots(const int64_t end_time_ns) {
+  end_t_ns_ = std::max(end_t_ns_, end_time_ns);
+  const int64_t duration = end_t_ns_ - start_t_ns_;
+  nr_knots_so3_ = duration / dt_so3_ns_ + _T;
+  nr_knots_r3_ = duration / dt_r3_ns_ + _T;
+  const size_t old_so3 = so3_knots_.size();
+  const size_t old_r3 = r3_knots_.size();
+  // bias splines only exist after InitBiasSplines
+  const size_t nr_accl_bias =
+      accl_bias_spline_.empty()
+          ? 0
+          : static_cast<size_t>(duration / dt_accl_bias_ns_ + BIAS_SPLINE_N);
+  const size_t nr_gyro_bias =
+      gyro_bias_spline_.empty()
+          ? 0
+          : static_cast<size_t>(duration / dt_gyro_bias_ns_ + BIAS_SPLINE_N);
+  const bool grow_bias = nr_accl_bias > accl_bias_spline_.size() ||
+                         nr_gyro_bias > gyro_bias_spline_.size();
+  if (old_so3 >= nr_knots_so3_ && old_r3 >= nr_knots_r3_ && !grow_bias) {
+    return;
   }
-  for (int i = 0; i < nr_knots_r3_; ++i) {
-    r3_knots_[i] = interpo_spline_trans[i];
+  // the residuals point into the knot vectors, which may be reallocated
+  ResetProblem();
+
+  nr_knots_so3_ = std::max(old_so3, nr_knots_so3_);
+  nr_knots_r3_ = std::max(old_r3, nr_knots_r3_);
+  so3_knots_.resize(nr_knots_so3_);
+  r3_knots_.resize(nr_knots_r3_);
+  so3_knot_in_problem_.resize(nr_knots_so3_, 0);
+  r3_knot_in_problem_.resize(nr_knots_r3_, 0);
+
+  OpenICC::quat_series quat_vis;
+  OpenICC::vec3_series translations;
+  CollectViewImuPoses(end_time_ns, quat_vis, translations);
+  if (!quat_vis.empty()) {
+    InitKnotsFromPoses(quat_vis,
+                       translations,
+                       static_cast<int>(old_so3),
+                       static_cast<int>(old_r3));
+  } else {
+    // nothing observed yet, continue the spline at rest
+    // the arena starts the first knot at identity / zero
+    for (size_t i = std::max<size_t>(old_so3, 1); i < nr_knots_so3_; ++i) {
+      so3_knots_[i] = Sophus::SO3d(so3_knots_[i - 1]);
+    }
+    for (size_t i = std::max<size_t>(old_r3, 1); i < nr_knots_r3_; ++i) {
+      r3_knots_[i] = Eigen::Vector3d(r3_knots_[i - 1]);
+    }
+  }
+  if (!grow_bias) {
+    return;
   }
+
+  nr_knots_accl_bias_ = std::max(accl_bias_spline_.size(), nr_accl_bias);
+  nr_knots_gyro_bias_ = std::max(gyro_bias_spline_.size(), nr_gyro_bias);
+  const Eigen::Vector3d accl_bias = accl_bias_spline_.back();
+  const Eigen::Vector3d gyro_bias = gyro_bias_spline_.back();
+  accl_bias_spline_.resize(nr_knots_accl_bias_, accl_bias);
+  gyro_bias_spline_.resize(nr_knots_gyro_bias_, gyro_bias);
 }
 
 template <int _T>
-bool SplineTrajectoryEstimator<_T>::AddAccelerometerMeasurement(
+bool SplineTrajectoryEstimator<_T>::CreateAccelerometerResidual(
     const Eigen::Vector3d& meas,
     const int64_t time_ns,
-    const double weight_se3) {
+    const double weight_se3,
+    ImuResidual<kNumAcclBlocks>& residual) const {
   double u_r3, u_so3, u_bias;
   int64_t s_r3, s_so3, s_bias;
   if (!CalcR3Times(time_ns, u_r3, s_r3)) {
@@ -351,135 +1377,561 @@ bool SplineTrajectoryEstimator<_T>::AddAccelerometerMeasurement(
     return false;
   }
   if (!CalcSO3Times(time_ns, u_so3, s_so3)) {
-    LOG(INFO) << "Wrong time adding so3 accelerometer measurements. time_ns: "
-              << time_ns << " u_r3: " << u_r3 << " s_r3:" << s_r3;
+    LOG(INFO) << "Wrong time adding so3 accelerometer measurements. time_ns: "
+              << time_ns << " u_r3: " << u_r3 << " s_r3:" << s_r3;
+    return false;
+  }
+  if (!CalcTimes(time_ns,
+                 u_bias,
+                 s_bias,
+                 dt_accl_bias_ns_,
+                 nr_knots_accl_bias_,
+                 BIAS_SPLINE_N)) {
+    LOG(INFO) << "Wrong time adding accelerometer bias measurements. time_ns: "
+              << time_ns << " u_r3: " << u_bias << " s_r3:" << s_bias;
+    return false;
+  }
+
+  if (analytic_imu_jacobians_) {
+    residual.cost_function =
+        cost_function_arena_
+            ->Create<AccelerationCostFunctionSplitAnalytic<N_>>(
+                meas,
+                u_r3,
+                inv_r3_dt_,
+                u_so3,
+                inv_so3_dt_,
+                weight_se3,
+                u_bias,
+                inv_accl_bias_dt_);
+  } else {
+    residual.cost_function =
+        CreateFixedSizeCostFunction<3,
+                                    AccelerationBlockSizes<N_>,
+                                    AccelerationCostFunctorSplit<N_>>(
+            *cost_function_arena_,
+            meas,
+            u_r3,
+            inv_r3_dt_,
+            u_so3,
+            inv_so3_dt_,
+            weight_se3,
+            u_bias,
+            inv_accl_bias_dt_);
+  }
+  residual.s_so3 = s_so3;
+  residual.s_r3 = s_r3;
+  residual.time_ns = time_ns;
+
+  // the parameter blocks are only read here, the problem is not touched
+  double** params = residual.params.data();
+  // so3 spline
+  for (int i = 0; i < N_; i++) {
+    *params++ = const_cast<double*>(so3_knots_[s_so3 + i].data());
+  }
+  // R3 spline
+  for (int i = 0; i < N_; i++) {
+    *params++ = const_cast<double*>(r3_knots_[s_r3 + i].data());
+  }
+  // bias spline
+  for (int i = 0; i < BIAS_SPLINE_N; i++) {
+    *params++ = const_cast<double*>(accl_bias_spline_[s_bias + i].data());
+  }
+  // gravity
+  *params++ = const_cast<double*>(GravityAt(time_ns));
+  // imu intrinsics and bias
+  *params++ = const_cast<double*>(accl_intrinsics_.data());
+
+  return true;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::CreateGyroscopeResidual(
+    const Eigen::Vector3d& meas,
+    const int64_t time_ns,
+    const double weight_so3,
+    ImuResidual<kNumGyroBlocks>& residual) const {
+  double u_so3, u_bias;
+  int64_t s_so3, s_bias;
+  if (!CalcSO3Times(time_ns, u_so3, s_so3)) {
+    LOG(INFO) << "Wrong time adding so3 gyroscope measurements. time_ns: "
+              << time_ns << " u_r3: " << u_so3 << " s_r3:" << s_so3;
+    return false;
+  }
+
+  if (!CalcTimes(time_ns,
+                 u_bias,
+                 s_bias,
+                 dt_gyro_bias_ns_,
+                 nr_knots_gyro_bias_,
+                 BIAS_SPLINE_N)) {
+    LOG(INFO) << "Wrong time adding so3 gyroscope bias measurements. time_ns: "
+              << time_ns << " u_r3: " << u_bias << " s_r3:" << s_bias;
+    return false;
+  }
+
+  if (analytic_imu_jacobians_) {
+    residual.cost_function =
+        cost_function_arena_->Create<GyroCostFunctionSplitAnalytic<N_>>(
+            meas, u_so3, inv_so3_dt_, weight_so3, u_bias, inv_gyro_bias_dt_);
+  } else {
+    using FunctorT = GyroCostFunctorSplit<N_, Sophus::SO3, false>;
+    residual.cost_function =
+        CreateFixedSizeCostFunction<3, GyroBlockSizes<N_>, FunctorT>(
+            *cost_function_arena_,
+            meas,
+            u_so3,
+            inv_so3_dt_,
+            weight_so3,
+            u_bias,
+            inv_gyro_bias_dt_);
+  }
+  residual.s_so3 = s_so3;
+  residual.time_ns = time_ns;
+
+  double** params = residual.params.data();
+  // SO3 spline
+  for (int i = 0; i < N_; i++) {
+    *params++ = const_cast<double*>(so3_knots_[s_so3 + i].data());
+  }
+  // bias spline
+  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
+    *params++ = const_cast<double*>(gyro_bias_spline_[s_bias + i].data());
+  }
+  // intrinsics
+  *params++ = const_cast<double*>(gyro_intrinsics_.data());
+
+  return true;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::CreateImuResidual(
+    const Eigen::Vector3d& accl_meas,
+    const Eigen::Vector3d& gyro_meas,
+    const int64_t time_ns,
+    const double weight_se3,
+    const double weight_so3,
+    ImuResidual<kNumImuBlocks>& residual) const {
+  double u_r3, u_so3, u_accl_bias, u_gyro_bias;
+  int64_t s_r3, s_so3, s_accl_bias, s_gyro_bias;
+  if (!CalcR3Times(time_ns, u_r3, s_r3)) {
+    LOG(INFO) << "Wrong time adding r3 imu measurements. time_ns: " << time_ns
+              << " u_r3: " << u_r3 << " s_r3:" << s_r3;
+    return false;
+  }
+  if (!CalcSO3Times(time_ns, u_so3, s_so3)) {
+    LOG(INFO) << "Wrong time adding so3 imu measurements. time_ns: "
+              << time_ns << " u_so3: " << u_so3 << " s_so3:" << s_so3;
     return false;
   }
   if (!CalcTimes(time_ns,
-                 u_bias,
-                 s_bias,
+                 u_accl_bias,
+                 s_accl_bias,
                  dt_accl_bias_ns_,
                  nr_knots_accl_bias_,
+                 BIAS_SPLINE_N) ||
+      !CalcTimes(time_ns,
+                 u_gyro_bias,
+                 s_gyro_bias,
+                 dt_gyro_bias_ns_,
+                 nr_knots_gyro_bias_,
                  BIAS_SPLINE_N)) {
-    LOG(INFO) << "Wrong time adding accelerometer bias measurements. time_ns: "
-              << time_ns << " u_r3: " << u_bias << " s_r3:" << s_bias;
+    LOG(INFO) << "Wrong time adding imu bias measurements. time_ns: "
+              << time_ns;
     return false;
   }
 
-  using FunctorT = AccelerationCostFunctorSplit<N_>;
-  FunctorT* functor = new FunctorT(meas,
-                                   u_r3,
-                                   inv_r3_dt_,
-                                   u_so3,
-                                   inv_so3_dt_,
-                                   weight_se3,
-                                   u_bias,
-                                   inv_accl_bias_dt_);
-
-  ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-      new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+  if (analytic_imu_jacobians_) {
+    residual.cost_function =
+        cost_function_arena_->Create<ImuCostFunctionSplitAnalytic<N_>>(
+            accl_meas,
+            gyro_meas,
+            u_r3,
+            inv_r3_dt_,
+            u_so3,
+            inv_so3_dt_,
+            weight_se3,
+            weight_so3,
+            u_accl_bias,
+            inv_accl_bias_dt_,
+            u_gyro_bias,
+            inv_gyro_bias_dt_);
+  } else {
+    residual.cost_function =
+        CreateFixedSizeCostFunction<6,
+                                    ImuBlockSizes<N_>,
+                                    ImuCostFunctorSplit<N_>>(
+            *cost_function_arena_,
+            accl_meas,
+            gyro_meas,
+            u_r3,
+            inv_r3_dt_,
+            u_so3,
+            inv_so3_dt_,
+            weight_se3,
+            weight_so3,
+            u_accl_bias,
+            inv_accl_bias_dt_,
+            u_gyro_bias,
+            inv_gyro_bias_dt_);
+  }
+  residual.s_so3 = s_so3;
+  residual.s_r3 = s_r3;
+  residual.time_ns = time_ns;
 
-  std::vector<double*> vec;
-  // so3 spline
+  double** params = residual.params.data();
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(4);
-    const int t = s_so3 + i;
-    vec.emplace_back(so3_knots_[t].data());
-    so3_knot_in_problem_[t] = true;
+    *params++ = const_cast<double*>(so3_knots_[s_so3 + i].data());
   }
-
-  // R3 spline
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_r3 + i;
-    vec.emplace_back(r3_knots_[t].data());
-    r3_knot_in_problem_[t] = true;
+    *params++ = const_cast<double*>(r3_knots_[s_r3 + i].data());
+  }
+  for (int i = 0; i < BIAS_SPLINE_N; i++) {
+    *params++ =
+        const_cast<double*>(accl_bias_spline_[s_accl_bias + i].data());
   }
-
-  // bias spline
   for (int i = 0; i < BIAS_SPLINE_N; i++) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_bias + i;
-    vec.emplace_back(accl_bias_spline_[t].data());
+    *params++ =
+        const_cast<double*>(gyro_bias_spline_[s_gyro_bias + i].data());
   }
+  *params++ = const_cast<double*>(GravityAt(time_ns));
+  *params++ = const_cast<double*>(accl_intrinsics_.data());
+  *params++ = const_cast<double*>(gyro_intrinsics_.data());
 
-  // gravity
-  cost_function->AddParameterBlock(3);
-  vec.emplace_back(gravity_.data());
+  return true;
+}
 
-  // imu intrinsics and bias
-  cost_function->AddParameterBlock(6);
-  vec.emplace_back(accl_intrinsics_.data());
+template <int _T>
+template <int kNumBlocks>
+void SplineTrajectoryEstimator<_T>::AddImuResidual(
+    const ImuResidual<kNumBlocks>& residual,
+    const ResidualTimeIndex::Sensor sensor) {
+  if (residual.s_so3 >= 0) {
+    MarkKnotsInProblem(
+        residual.s_so3, N_, so3_knot_in_problem_, so3_knot_ids_in_problem_);
+  }
+  if (residual.s_r3 >= 0) {
+    MarkKnotsInProblem(
+        residual.s_r3, N_, r3_knot_in_problem_, r3_knot_ids_in_problem_);
+  }
+  ResidualProfiler::Type type = ResidualProfiler::IMU;
+  switch (sensor) {
+    case ResidualTimeIndex::ACCELEROMETER:
+      type = ResidualProfiler::ACCELEROMETER;
+      break;
+    case ResidualTimeIndex::GYROSCOPE:
+      type = ResidualProfiler::GYROSCOPE;
+      break;
+    case ResidualTimeIndex::GPS:
+      type = ResidualProfiler::GPS;
+      break;
+    case ResidualTimeIndex::ORIENTATION:
+      type = ResidualProfiler::ORIENTATION;
+      break;
+    default:
+      break;
+  }
+  const ceres::ResidualBlockId id =
+      problem_.AddResidualBlock(Profiled(residual.cost_function, type),
+                                NULL,
+                                residual.params.data(),
+                                kNumBlocks);
+  residual_index_.Add(
+      sensor, residual.time_ns, id, residual.s_so3, residual.s_r3);
+}
 
-  // number of residuals
-  cost_function->SetNumResiduals(3);
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::CreateGPSResidual(
+    const Eigen::Vector3d& meas,
+    const int64_t time_ns,
+    const double weight_gps,
+    ImuResidual<kNumGPSBlocks>& residual) const {
+  double u_r3;
+  int64_t s_r3;
+  if (!CalcR3Times(time_ns, u_r3, s_r3)) {
+    LOG(INFO) << "Wrong time adding r3 gps measurements. time_ns: " << time_ns
+              << " u_r3: " << u_r3 << " s_r3:" << s_r3;
+    return false;
+  }
 
-  problem_.AddResidualBlock(cost_function, NULL, vec);
+  residual.cost_function =
+      CreateFixedSizeCostFunction<3,
+                                  PositionBlockSizes<N_>,
+                                  PositionCostFunctorSplit<N_>>(
+          *cost_function_arena_, meas, u_r3, inv_r3_dt_, weight_gps);
+  residual.s_r3 = s_r3;
+  residual.time_ns = time_ns;
 
+  double** params = residual.params.data();
+  // R3 spline
+  for (int i = 0; i < N_; i++) {
+    *params++ = const_cast<double*>(r3_knots_[s_r3 + i].data());
+  }
   return true;
 }
 
 template <int _T>
-bool SplineTrajectoryEstimator<_T>::AddGyroscopeMeasurement(
+bool SplineTrajectoryEstimator<_T>::AddGPSMeasurement(
     const Eigen::Vector3d& meas,
     const int64_t time_ns,
-    const double weight_so3) {
-  double u_so3, u_bias;
-  int64_t s_so3, s_bias;
-  if (!CalcSO3Times(time_ns, u_so3, s_so3)) {
-    LOG(INFO) << "Wrong time adding so3 gyroscope measurements. time_ns: "
-              << time_ns << " u_r3: " << u_so3 << " s_r3:" << s_so3;
+    const double weight_gps) {
+  ImuResidual<kNumGPSBlocks> residual;
+  if (!CreateGPSResidual(meas, time_ns, weight_gps, residual)) {
     return false;
   }
+  AddImuResidual(residual, ResidualTimeIndex::GPS);
+  return true;
+}
+
+template <int _T>
+size_t SplineTrajectoryEstimator<_T>::AddGPSMeasurements(
+    const std::vector<int64_t>& times_ns,
+    const vec3_vector& enu_meas,
+    const double weight_gps,
+    const int num_threads) {
+  OPENICC_TRACE_ZONE("spline_gps_residuals");
+  // average all samples that fall into the same R3 knot interval
+  std::vector<int64_t> bin_times_ns;
+  vec3_vector bin_meas;
+  std::vector<double> bin_weights;
+  size_t i = 0;
+  while (i < times_ns.size()) {
+    const int64_t bin = (times_ns[i] - start_t_ns_) / dt_r3_ns_;
+    double t_sum = 0.0;
+    Eigen::Vector3d meas_sum = Eigen::Vector3d::Zero();
+    size_t count = 0;
+    for (; i < times_ns.size() &&
+           (times_ns[i] - start_t_ns_) / dt_r3_ns_ == bin;
+         ++i, ++count) {
+      t_sum += static_cast<double>(times_ns[i] - start_t_ns_);
+      meas_sum += enu_meas[i];
+    }
+    bin_times_ns.push_back(start_t_ns_ + static_cast<int64_t>(t_sum / count));
+    bin_meas.push_back(meas_sum / static_cast<double>(count));
+    bin_weights.push_back(weight_gps * std::sqrt(static_cast<double>(count)));
+  }
 
-  if (!CalcTimes(time_ns,
-                 u_bias,
-                 s_bias,
-                 dt_gyro_bias_ns_,
-                 nr_knots_gyro_bias_,
-                 BIAS_SPLINE_N)) {
-    LOG(INFO) << "Wrong time adding so3 gyroscope bias measurements. time_ns: "
-              << time_ns << " u_r3: " << u_bias << " s_r3:" << s_bias;
+  const int nr_meas = static_cast<int>(bin_times_ns.size());
+  std::vector<ImuResidual<kNumGPSBlocks>> residuals(nr_meas);
+  OpenICC::utils::ParallelFor(0, nr_meas, num_threads, [&](const int j) {
+    CreateGPSResidual(
+        bin_meas[j], bin_times_ns[j], bin_weights[j], residuals[j]);
+  });
+
+  // ceres::Problem is not thread safe
+  size_t nr_added = 0;
+  for (int j = 0; j < nr_meas; ++j) {
+    if (residuals[j].cost_function) {
+      AddImuResidual(residuals[j], ResidualTimeIndex::GPS);
+      ++nr_added;
+    }
+  }
+  LOG(INFO) << "Added " << nr_added << " gps residuals from "
+            << times_ns.size() << " samples.";
+  return nr_added;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddAccelerometerMeasurement(
+    const Eigen::Vector3d& meas,
+    const int64_t time_ns,
+    const double weight_se3) {
+  ImuResidual<kNumAcclBlocks> residual;
+  if (!CreateAccelerometerResidual(meas, time_ns, weight_se3, residual)) {
     return false;
   }
+  AddImuResidual(residual, ResidualTimeIndex::ACCELEROMETER);
+  return true;
+}
 
-  using FunctorT = GyroCostFunctorSplit<N_, Sophus::SO3, false>;
-  FunctorT* functor = new FunctorT(
-      meas, u_so3, inv_so3_dt_, weight_so3, u_bias, inv_gyro_bias_dt_);
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddGyroscopeMeasurement(
+    const Eigen::Vector3d& meas,
+    const int64_t time_ns,
+    const double weight_so3) {
+  ImuResidual<kNumGyroBlocks> residual;
+  if (!CreateGyroscopeResidual(meas, time_ns, weight_so3, residual)) {
+    return false;
+  }
+  AddImuResidual(residual, ResidualTimeIndex::GYROSCOPE);
+  return true;
+}
 
-  ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-      new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+template <int _T>
+size_t SplineTrajectoryEstimator<_T>::AddGyroscopeMeasurements(
+    const std::vector<int64_t>& times_ns,
+    const vec3_vector& gyro_meas,
+    const std::vector<double>& weights_so3,
+    const int num_threads) {
+  const int nr_meas = static_cast<int>(times_ns.size());
+  std::vector<ImuResidual<kNumGyroBlocks>> residuals(nr_meas);
+  OpenICC::utils::ParallelFor(0, nr_meas, num_threads, [&](const int i) {
+    CreateGyroscopeResidual(
+        gyro_meas[i], times_ns[i], weights_so3[i], residuals[i]);
+  });
+
+  // ceres::Problem is not thread safe
+  size_t nr_added = 0;
+  for (int i = 0; i < nr_meas; ++i) {
+    if (residuals[i].cost_function) {
+      AddImuResidual(residuals[i], ResidualTimeIndex::GYROSCOPE);
+      ++nr_added;
+    } else {
+      std::cerr << "Failed to add gyroscope measurement at time: "
+                << times_ns[i] * NS_TO_S << "\n";
+    }
+  }
+  return nr_added;
+}
 
-  // SO3 spline
-  std::vector<double*> vec;
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::AddOrientationMeasurement(
+    const theia::View* view,
+    const double weight_so3,
+    const size_t camera) {
+  const int64_t time_ns = view->GetTimestamp() * S_TO_NS;
+  double u_so3;
+  int64_t s_so3;
+  if (!CalcSO3Times(time_ns, u_so3, s_so3)) {
+    LOG(INFO) << "Wrong time adding so3 orientation measurement. time_ns: "
+              << time_ns << " u_so3: " << u_so3 << " s_so3:" << s_so3;
+    return false;
+  }
+  const Sophus::SO3d R_w_c(Eigen::Quaterniond(
+      view->Camera().GetOrientationAsRotationMatrix().transpose()));
+  const Sophus::SO3d R_w_i = R_w_c * GetRigCameraT_i_c(camera).so3().inverse();
+
+  ImuResidual<kNumOrientationBlocks> residual;
+  residual.cost_function =
+      CreateFixedSizeCostFunction<3,
+                                  OrientationBlockSizes<N_>,
+                                  OrientationCostFunctorSplit<N_>>(
+          *cost_function_arena_, R_w_i, u_so3, inv_so3_dt_, weight_so3);
+  residual.s_so3 = s_so3;
+  residual.time_ns = time_ns;
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(4);
-    const int t = s_so3 + i;
-    vec.emplace_back(so3_knots_[t].data());
-    so3_knot_in_problem_[t] = true;
+    residual.params[i] = so3_knots_[s_so3 + i].data();
   }
-  // bias spline
-  for (int i = 0; i < BIAS_SPLINE_N; ++i) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_bias + i;
-    vec.emplace_back(gyro_bias_spline_[t].data());
+  AddImuResidual(residual, ResidualTimeIndex::ORIENTATION);
+  return true;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::GetOrientation(const int64_t time_ns,
+                                                   Sophus::SO3d& R_w_i) const {
+  double u_so3;
+  int64_t s_so3;
+  if (!CalcSO3Times(time_ns, u_so3, s_so3)) {
+    return false;
   }
-  // intrinsics
-  cost_function->AddParameterBlock(9);
-  vec.emplace_back(gyro_intrinsics_.data());
+  const double* knots[N_];
+  for (int i = 0; i < N_; ++i) {
+    knots[i] = so3_knots_[s_so3 + i].data();
+  }
+  CeresSplineHelper<double, N_>::template evaluate_lie<Sophus::SO3>(
+      knots, u_so3, inv_so3_dt_, &R_w_i);
+  return true;
+}
 
-  cost_function->SetNumResiduals(3);
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::FitR3KnotsToViews() {
+  OPENICC_TRACE_ZONE("spline_fit_r3_knots");
+  std::vector<int64_t> times_ns;
+  vec3_vector positions;
+  for (const auto& vid : image_data_->ViewIds()) {
+    const theia::View* view = image_data_->View(vid);
+    const int64_t time_ns = view->GetTimestamp() * S_TO_NS;
+    Sophus::SO3d R_w_i;
+    if (!GetOrientation(time_ns, R_w_i)) {
+      continue;
+    }
+    // p_w_c = p_w_i + R_w_i * t_i_c
+    const Sophus::SE3d T_i_c = GetRigCameraT_i_c(RigCameraOf(vid));
+    times_ns.push_back(time_ns);
+    positions.push_back(view->Camera().GetPosition() -
+                        R_w_i * T_i_c.translation());
+  }
+  if (!FitR3Knots(times_ns, positions, 1e-3)) {
+    return false;
+  }
+  LOG(INFO) << "Fitted " << nr_knots_r3_ << " R3 knots to " << times_ns.size()
+            << " view positions.";
+  return true;
+}
 
-  problem_.AddResidualBlock(cost_function, NULL, vec);
+template <int _T>
+size_t SplineTrajectoryEstimator<_T>::AddImuMeasurements(
+    const std::vector<int64_t>& times_ns,
+    const vec3_vector& accl_meas,
+    const vec3_vector& gyro_meas,
+    const std::vector<double>& weights_se3,
+    const std::vector<double>& weights_so3,
+    const int num_threads) {
+  OPENICC_TRACE_ZONE("spline_add_imu_measurements");
+  const int nr_meas = static_cast<int>(times_ns.size());
+  if (fused_imu_residuals_) {
+    std::vector<ImuResidual<kNumImuBlocks>> residuals(nr_meas);
+    OpenICC::utils::ParallelFor(0, nr_meas, num_threads, [&](const int i) {
+      CreateImuResidual(accl_meas[i],
+                        gyro_meas[i],
+                        times_ns[i],
+                        weights_se3[i],
+                        weights_so3[i],
+                        residuals[i]);
+    });
+    size_t nr_added = 0;
+    for (int i = 0; i < nr_meas; ++i) {
+      if (residuals[i].cost_function) {
+        AddImuResidual(residuals[i], ResidualTimeIndex::IMU);
+        ++nr_added;
+      } else {
+        std::cerr << "Failed to add imu measurement at time: "
+                  << times_ns[i] * NS_TO_S << "\n";
+      }
+    }
+    return nr_added;
+  }
 
-  return true;
+  std::vector<ImuResidual<kNumAcclBlocks>> accl_residuals(nr_meas);
+  std::vector<ImuResidual<kNumGyroBlocks>> gyro_residuals(nr_meas);
+
+  // building the cost functions only reads the spline, so it runs in parallel
+  OpenICC::utils::ParallelFor(0, nr_meas, num_threads, [&](const int i) {
+    CreateAccelerometerResidual(
+        accl_meas[i], times_ns[i], weights_se3[i], accl_residuals[i]);
+    CreateGyroscopeResidual(
+        gyro_meas[i], times_ns[i], weights_so3[i], gyro_residuals[i]);
+  });
+
+  // ceres::Problem is not thread safe
+  size_t nr_added = 0;
+  for (int i = 0; i < nr_meas; ++i) {
+    if (accl_residuals[i].cost_function) {
+      AddImuResidual(accl_residuals[i], ResidualTimeIndex::ACCELEROMETER);
+    } else {
+      std::cerr << "Failed to add accelerometer measurement at time: "
+                << times_ns[i] * NS_TO_S << "\n";
+    }
+    if (gyro_residuals[i].cost_function) {
+      AddImuResidual(gyro_residuals[i], ResidualTimeIndex::GYROSCOPE);
+    } else {
+      std::cerr << "Failed to add gyroscope measurement at time: "
+                << times_ns[i] * NS_TO_S << "\n";
+    }
+    if (accl_residuals[i].cost_function && gyro_residuals[i].cost_function) {
+      ++nr_added;
+    }
+  }
+  return nr_added;
 }
 
 template <int _T>
 bool SplineTrajectoryEstimator<_T>::AddGSCameraMeasurement(
-    const theia::View* view, const double robust_loss_width) {
+    const theia::View* view,
+    const double robust_loss_width,
+    const size_t camera) {
+  OPENICC_TRACE_ZONE("spline_gs_camera_residuals");
   const int64_t image_obs_time_ns = view->GetTimestamp() * S_TO_NS;
-  const auto track_ids = view->TrackIds();
 
   double u_r3 = 0.0, u_so3 = 0.0;
   int64_t s_r3 = 0, s_so3 = 0;
@@ -494,52 +1946,106 @@ bool SplineTrajectoryEstimator<_T>::AddGSCameraMeasurement(
     return false;
   }
 
-  using FunctorT = GSReprojectionCostFunctorSplit<N_>;
-  FunctorT* functor = new FunctorT(
-      view, &image_data_, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_, track_ids);
+  // the functor and the parameter blocks use the same corner order
+  const std::shared_ptr<const ViewObservations> observations =
+      ViewObservationsFor(view);
+  const std::vector<theia::TrackId>& track_ids = observations->track_ids;
 
-  ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-      new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+  if (corner_residuals_) {
+    if (!DispatchCameraModel(observations->camera_model, [](auto) {})) {
+      LOG(ERROR) << "Unsupported camera model of view " << view->Name();
+      return false;
+    }
+    std::array<const double*, N_> so3_ptrs, r3_ptrs;
+    std::vector<double*> vec;
+    for (int i = 0; i < N_; i++) {
+      so3_ptrs[i] = so3_knots_[s_so3 + i].data();
+      vec.emplace_back(so3_knots_[s_so3 + i].data());
+    }
+    for (int i = 0; i < N_; i++) {
+      r3_ptrs[i] = r3_knots_[s_r3 + i].data();
+      vec.emplace_back(r3_knots_[s_r3 + i].data());
+    }
+    vec.emplace_back(T_i_cBlock(camera));
+    // object point, replaced for every corner
+    vec.emplace_back(nullptr);
+    const SplineViewPose<N_>* pose = view_pose_callback_->AddView(
+        so3_ptrs,
+        r3_ptrs,
+        T_i_cBlock(camera),
+        CeresSplineHelper<double, N_>::template coeffs<0, true>(u_so3,
+                                                                inv_so3_dt_),
+        CeresSplineHelper<double, N_>::template coeffs<0, false>(u_r3,
+                                                                 inv_r3_dt_));
+    ceres::LossFunction* loss_function = SharedHuberLoss(robust_loss_width);
+    DispatchCameraModel(observations->camera_model, [&](auto tag) {
+      using CostFunctionT =
+          GSCornerReprojectionCostFunction<N_, typename decltype(tag)::type>;
+      for (size_t i = 0; i < track_ids.size(); ++i) {
+        vec.back() = scene_points_.at(track_ids[i]).data();
+        tracks_in_problem_.insert(track_ids[i]);
+        const ceres::ResidualBlockId id = problem_.AddResidualBlock(
+            Profiled(cost_function_arena_->Create<CostFunctionT>(
+                         pose, observations, i),
+                     ResidualProfiler::GS_REPROJECTION),
+            loss_function,
+            vec);
+        residual_index_.Add(
+            ResidualTimeIndex::CAMERA, image_obs_time_ns, id, s_so3, s_r3);
+      }
+    });
+    MarkKnotsInProblem(
+        s_so3, N_, so3_knot_in_problem_, so3_knot_ids_in_problem_);
+    MarkKnotsInProblem(s_r3, N_, r3_knot_in_problem_, r3_knot_ids_in_problem_);
+    return true;
+  }
+
+  // the dynamic cost functions allocate their block sizes anyway, they are
+  // only handed to the arena so that ResetProblem frees them
+  ceres::CostFunction* cost_function = cost_function_arena_->Adopt(
+      CreateReprojectionCostFunction<GSReprojectionCostFunctorSplit, N_>(
+          observations, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_));
+  if (!cost_function) {
+    LOG(ERROR) << "Unsupported camera model of view " << view->Name();
+    return false;
+  }
 
   std::vector<double*> vec;
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(4);
-    const int t = s_so3 + i;
-    vec.emplace_back(so3_knots_[t].data());
-    so3_knot_in_problem_[t] = true;
+    vec.emplace_back(so3_knots_[s_so3 + i].data());
   }
+  MarkKnotsInProblem(s_so3, N_, so3_knot_in_problem_, so3_knot_ids_in_problem_);
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_r3 + i;
-    vec.emplace_back(r3_knots_[t].data());
-    r3_knot_in_problem_[t] = true;
+    vec.emplace_back(r3_knots_[s_r3 + i].data());
   }
+  MarkKnotsInProblem(s_r3, N_, r3_knot_in_problem_, r3_knot_ids_in_problem_);
 
   // camera to imu transformation
-  cost_function->AddParameterBlock(7);
-  vec.emplace_back(T_i_c_.data());
+  vec.emplace_back(T_i_cBlock(camera));
 
   // object point
   for (size_t i = 0; i < track_ids.size(); ++i) {
-    cost_function->AddParameterBlock(4);
-    vec.emplace_back(
-        image_data_.MutableTrack(track_ids[i])->MutablePoint()->data());
+    vec.emplace_back(scene_points_.at(track_ids[i]).data());
     tracks_in_problem_.insert(track_ids[i]);
   }
 
-  cost_function->SetNumResiduals(track_ids.size() * 2);
-
-  ceres::LossFunction* loss_function = new ceres::HuberLoss(robust_loss_width);
-  problem_.AddResidualBlock(cost_function, loss_function, vec);
+  const ceres::ResidualBlockId id = problem_.AddResidualBlock(
+      Profiled(cost_function, ResidualProfiler::GS_REPROJECTION),
+      SharedHuberLoss(robust_loss_width),
+      vec);
+  residual_index_.Add(
+      ResidualTimeIndex::CAMERA, image_obs_time_ns, id, s_so3, s_r3);
 
   return true;
 }
 
 template <int _T>
 bool SplineTrajectoryEstimator<_T>::AddRSCameraMeasurement(
-    const theia::View* view, const double robust_loss_width) {
+    const theia::View* view,
+    const double robust_loss_width,
+    const size_t camera) {
+  OPENICC_TRACE_ZONE("spline_rs_camera_residuals");
   const int64_t image_obs_time_ns = view->GetTimestamp() * S_TO_NS;
-  const auto track_ids = view->TrackIds();
 
   double u_r3 = 0.0, u_so3 = 0.0;
   int64_t s_r3 = 0, s_so3 = 0;
@@ -554,52 +2060,47 @@ bool SplineTrajectoryEstimator<_T>::AddRSCameraMeasurement(
     return false;
   }
 
-  using FunctorT = RSReprojectionCostFunctorSplit<N_>;
-  FunctorT* functor = new FunctorT(
-      view, &image_data_, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_, track_ids);
+  // the functor and the parameter blocks use the same corner order
+  const std::shared_ptr<const ViewObservations> observations =
+      ViewObservationsFor(view);
+  const std::vector<theia::TrackId>& track_ids = observations->track_ids;
 
-  ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-      new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+  ceres::CostFunction* cost_function = cost_function_arena_->Adopt(
+      CreateReprojectionCostFunction<RSReprojectionCostFunctorSplit, N_>(
+          observations, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_, rs_band_rows_));
+  if (!cost_function) {
+    LOG(ERROR) << "Unsupported camera model of view " << view->Name();
+    return false;
+  }
 
   std::vector<double*> vec;
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(4);
-    const int t = s_so3 + i;
-    vec.emplace_back(so3_knots_[t].data());
-    so3_knot_in_problem_[t] = true;
+    vec.emplace_back(so3_knots_[s_so3 + i].data());
   }
+  MarkKnotsInProblem(s_so3, N_, so3_knot_in_problem_, so3_knot_ids_in_problem_);
   for (int i = 0; i < N_; i++) {
-    cost_function->AddParameterBlock(3);
-    const int t = s_r3 + i;
-    vec.emplace_back(r3_knots_[t].data());
-    r3_knot_in_problem_[t] = true;
+    vec.emplace_back(r3_knots_[s_r3 + i].data());
   }
+  MarkKnotsInProblem(s_r3, N_, r3_knot_in_problem_, r3_knot_ids_in_problem_);
 
   // camera to imu transformation
-  cost_function->AddParameterBlock(7);
-  vec.emplace_back(T_i_c_.data());
+  vec.emplace_back(T_i_cBlock(camera));
 
   // line delay for rolling shutter cameras
-  cost_function->AddParameterBlock(1);
-  vec.emplace_back(&cam_line_delay_s_);
+  vec.emplace_back(LineDelayBlock(camera));
 
   // object point
   for (size_t i = 0; i < track_ids.size(); ++i) {
-    cost_function->AddParameterBlock(4);
-    vec.emplace_back(
-        image_data_.MutableTrack(track_ids[i])->MutablePoint()->data());
+    vec.emplace_back(scene_points_.at(track_ids[i]).data());
     tracks_in_problem_.insert(track_ids[i]);
   }
 
-  cost_function->SetNumResiduals(track_ids.size() * 2);
-
-  if (robust_loss_width == 0.0) {
-    problem_.AddResidualBlock(cost_function, NULL, vec);
-  } else {
-    ceres::LossFunction* loss_function =
-        new ceres::HuberLoss(robust_loss_width);
-    problem_.AddResidualBlock(cost_function, loss_function, vec);
-  }
+  const ceres::ResidualBlockId id = problem_.AddResidualBlock(
+      Profiled(cost_function, ResidualProfiler::RS_REPROJECTION),
+      robust_loss_width == 0.0 ? NULL : SharedHuberLoss(robust_loss_width),
+      vec);
+  residual_index_.Add(
+      ResidualTimeIndex::CAMERA, image_obs_time_ns, id, s_so3, s_r3);
 
   // bound translation
   //  problem_.SetParameterLowerBound(T_i_c_.data(), 4, -1e-2);
@@ -766,7 +2267,7 @@ bool SplineTrajectoryEstimator<_T>::CalcTimes(const int64_t sensor_time,
                                               int64_t& s,
                                               int64_t dt_ns,
                                               size_t nr_knots,
-                                              const int N) {
+                                              const int N) const {
   const int64_t st_ns = (sensor_time - start_t_ns_);
 
   if (st_ns < 0.0) {
@@ -790,14 +2291,14 @@ bool SplineTrajectoryEstimator<_T>::CalcTimes(const int64_t sensor_time,
 template <int _T>
 bool SplineTrajectoryEstimator<_T>::CalcSO3Times(const int64_t sensor_time,
                                                  double& u_so3,
-                                                 int64_t& s_so3) {
+                                                 int64_t& s_so3) const {
   return CalcTimes(sensor_time, u_so3, s_so3, dt_so3_ns_, so3_knots_.size());
 }
 
 template <int _T>
 bool SplineTrajectoryEstimator<_T>::CalcR3Times(const int64_t sensor_time,
                                                 double& u_r3,
-                                                int64_t& s_r3) {
+                                                int64_t& s_r3) const {
   return CalcTimes(sensor_time, u_r3, s_r3, dt_r3_ns_, r3_knots_.size());
 }
 
@@ -828,8 +2329,20 @@ int64_t SplineTrajectoryEstimator<_T>::GetMinTimeNs() const {
 
 template <int _T>
 void SplineTrajectoryEstimator<_T>::SetImageData(
-    const theia::Reconstruction& c) {
-  image_data_ = c;
+    std::shared_ptr<const theia::Reconstruction> image_data) {
+  image_data_ = std::move(image_data);
+
+  view_observations_.clear();
+  for (const auto vid : image_data_->ViewIds()) {
+    const theia::View* view = image_data_->View(vid);
+    view_observations_[view] =
+        ViewObservations::FromView(*view, compact_observations_);
+  }
+
+  scene_points_.clear();
+  for (const auto tid : image_data_->TrackIds()) {
+    scene_points_[tid] = image_data_->Track(tid)->Point();
+  }
   // calculate all reference bearings
   //  const auto track_ids = image_data_.TrackIds();
   //  for (auto t = 0; t < track_ids.size(); ++t) {
@@ -853,16 +2366,128 @@ void SplineTrajectoryEstimator<_T>::SetImageData(
   //  }
 }
 
+template <int _T>
+std::shared_ptr<const ViewObservations>
+SplineTrajectoryEstimator<_T>::ViewObservationsFor(const theia::View* view) {
+  auto it = view_observations_.find(view);
+  if (it == view_observations_.end()) {
+    // view does not belong to image_data_
+    it = view_observations_
+             .emplace(view,
+                      ViewObservations::FromView(*view, compact_observations_))
+             .first;
+  }
+  return it->second;
+}
+
 template <int _T>
 void SplineTrajectoryEstimator<_T>::SetGravity(const Eigen::Vector3d& g) {
   gravity_ = g;
 }
 
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetGravitySegments(
+    const std::vector<int64_t>& segment_starts_ns) {
+  gravity_segment_starts_ns_ = segment_starts_ns;
+  std::sort(gravity_segment_starts_ns_.begin(),
+            gravity_segment_starts_ns_.end());
+  segment_gravity_.assign(gravity_segment_starts_ns_.size(), gravity_);
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetSegmentGravity(
+    const size_t segment, const Eigen::Vector3d& g) {
+  CHECK_LT(segment, NumGravitySegments());
+  Eigen::Map<Eigen::Vector3d>(GravityBlock(segment)) = g;
+}
+
+template <int _T>
+Eigen::Vector3d SplineTrajectoryEstimator<_T>::GetSegmentGravity(
+    const size_t segment) const {
+  CHECK_LT(segment, NumGravitySegments());
+  return segment == 0 ? gravity_ : segment_gravity_[segment - 1];
+}
+
+template <int _T>
+size_t SplineTrajectoryEstimator<_T>::GravitySegmentAt(
+    const int64_t time_ns) const {
+  return std::upper_bound(gravity_segment_starts_ns_.begin(),
+                          gravity_segment_starts_ns_.end(),
+                          time_ns) -
+         gravity_segment_starts_ns_.begin();
+}
+
+template <int _T>
+double* SplineTrajectoryEstimator<_T>::GravityBlock(const size_t segment) {
+  return segment == 0 ? gravity_.data() : segment_gravity_[segment - 1].data();
+}
+
+template <int _T>
+const double* SplineTrajectoryEstimator<_T>::GravityAt(
+    const int64_t time_ns) const {
+  const size_t segment = GravitySegmentAt(time_ns);
+  return segment == 0 ? gravity_.data() : segment_gravity_[segment - 1].data();
+}
+
 template <int _T>
 void SplineTrajectoryEstimator<_T>::SetT_i_c(const Sophus::SE3<double>& T) {
   T_i_c_ = T;
 }
 
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetNumRigCameras(
+    const size_t num_cameras) {
+  const size_t num_new = std::max<size_t>(num_cameras, 1) - 1;
+  rig_T_i_c_.resize(num_new, T_i_c_);
+  rig_line_delay_s_.resize(num_new, cam_line_delay_s_);
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetRigCameraT_i_c(const size_t camera,
+                                                      const Sophus::SE3d& T) {
+  CHECK_LT(camera, NumRigCameras());
+  Eigen::Map<Sophus::SE3d>(T_i_cBlock(camera)) = T;
+}
+
+template <int _T>
+Sophus::SE3d SplineTrajectoryEstimator<_T>::GetRigCameraT_i_c(
+    const size_t camera) const {
+  CHECK_LT(camera, NumRigCameras());
+  return camera == 0 ? T_i_c_ : rig_T_i_c_[camera - 1];
+}
+
+template <int _T>
+void SplineTrajectoryEstimator<_T>::SetRigCameraLineDelay(
+    const size_t camera, const double line_delay_s) {
+  CHECK_LT(camera, NumRigCameras());
+  *LineDelayBlock(camera) = line_delay_s;
+}
+
+template <int _T>
+double SplineTrajectoryEstimator<_T>::GetRigCameraLineDelay(
+    const size_t camera) const {
+  CHECK_LT(camera, NumRigCameras());
+  return camera == 0 ? cam_line_delay_s_ : rig_line_delay_s_[camera - 1];
+}
+
+template <int _T>
+double* SplineTrajectoryEstimator<_T>::T_i_cBlock(const size_t camera) {
+  return camera == 0 ? T_i_c_.data() : rig_T_i_c_[camera - 1].data();
+}
+
+template <int _T>
+double* SplineTrajectoryEstimator<_T>::LineDelayBlock(const size_t camera) {
+  return camera == 0 ? &cam_line_delay_s_ : &rig_line_delay_s_[camera - 1];
+}
+
+template <int _T>
+size_t SplineTrajectoryEstimator<_T>::RigCameraOf(
+    const theia::ViewId view_id) const {
+  const theia::CameraIntrinsicsGroupId group =
+      image_data_->CameraIntrinsicsGroupIdFromViewId(view_id);
+  return group < NumRigCameras() ? group : 0;
+}
+
 template <int _T>
 void SplineTrajectoryEstimator<_T>::SetImuToCameraTimeOffset(
     const double imu_to_camera_time_offset_s) {
@@ -985,98 +2610,207 @@ bool SplineTrajectoryEstimator<_T>::GetAcceleration(
     CeresSplineHelper<double, N_>::template evaluate<3, 2>(
         &vec[0], u_r3, inv_r3_dt_, &trans_accel_world);
   }
-  acceleration = rot.inverse() * (trans_accel_world + gravity_);
+  const Eigen::Map<const Eigen::Vector3d> gravity(GravityAt(time_ns));
+  acceleration = rot.inverse() * (trans_accel_world + gravity);
 
   return true;
 }
 
 template <int _T>
-double SplineTrajectoryEstimator<_T>::GetMeanReprojectionError() {
-  // ConvertInvDepthPointsToHom();
-  double sum_error = 0.0;
-  int num_points = 0;
-  for (const auto vid : image_data_.ViewIds()) {
-    const auto* view = image_data_.View(vid);
-    std::vector<theia::TrackId> tracks = view->TrackIds();
-    const size_t nr_obs = tracks.size();
-    if (nr_obs <= 0) {
-      return false;
+void SplineTrajectoryEstimator<_T>::EvaluateTrajectory(
+    const std::vector<int64_t>& times_ns,
+    aligned_vector<TrajectorySample>& samples,
+    const int num_threads) const {
+  using Helper = CeresSplineHelper<double, N_>;
+  samples.resize(times_ns.size());
+
+  const int kChunkSize = 1024;
+  const int nr_chunks = (times_ns.size() + kChunkSize - 1) / kChunkSize;
+  utils::ParallelFor(0, nr_chunks, num_threads, [&](const int chunk) {
+    // increments of the last SO3 segment
+    int64_t cached_s_so3 = -1;
+    Sophus::SO3d so3_p00;
+    std::array<Eigen::Vector3d, DEG_> so3_deltas;
+
+    const size_t end =
+        std::min(times_ns.size(), static_cast<size_t>(chunk + 1) * kChunkSize);
+    for (size_t i = static_cast<size_t>(chunk) * kChunkSize; i < end; ++i) {
+      TrajectorySample& sample = samples[i];
+      sample = TrajectorySample();
+      double u_so3, u_r3;
+      int64_t s_so3, s_r3;
+      if (!CalcSO3Times(times_ns[i], u_so3, s_so3) ||
+          !CalcR3Times(times_ns[i], u_r3, s_r3)) {
+        continue;
+      }
+      sample.valid = true;
+
+      if (s_so3 != cached_s_so3) {
+        so3_p00 = so3_knots_[s_so3];
+        for (int k = 0; k < DEG_; ++k) {
+          so3_deltas[k] =
+              (so3_knots_[s_so3 + k].inverse() * so3_knots_[s_so3 + k + 1])
+                  .log();
+        }
+        cached_s_so3 = s_so3;
+      }
+      const typename Helper::VecN so3_coeff =
+          Helper::template coeffs<0, true>(u_so3, inv_so3_dt_);
+      const typename Helper::VecN so3_dcoeff =
+          Helper::template coeffs<1, true>(u_so3, inv_so3_dt_);
+      Sophus::SO3d rot;
+      Helper::template evaluate_lie_deltas<Sophus::SO3>(
+          so3_p00,
+          so3_deltas.data(),
+          so3_coeff,
+          &so3_dcoeff,
+          nullptr,
+          nullptr,
+          &rot,
+          &sample.angular_velocity);
+
+      std::array<const double*, N_> r3_ptrs;
+      for (int k = 0; k < N_; ++k) {
+        r3_ptrs[k] = r3_knots_[s_r3 + k].data();
+      }
+      Eigen::Vector3d position, accel_world;
+      Helper::template evaluate_coeffs<3>(
+          r3_ptrs.data(),
+          Helper::template coeffs<0, false>(u_r3, inv_r3_dt_),
+          &position);
+      Helper::template evaluate_coeffs<3>(
+          r3_ptrs.data(),
+          Helper::template coeffs<1, false>(u_r3, inv_r3_dt_),
+          &sample.velocity);
+      Helper::template evaluate_coeffs<3>(
+          r3_ptrs.data(),
+          Helper::template coeffs<2, false>(u_r3, inv_r3_dt_),
+          &accel_world);
+
+      sample.pose = Sophus::SE3d(rot, position);
+      const Eigen::Map<const Eigen::Vector3d> gravity(GravityAt(times_ns[i]));
+      sample.acceleration = rot.inverse() * (accel_world + gravity);
+      sample.gyro_bias = GetGyroBias(times_ns[i]);
+      sample.accl_bias = GetAcclBias(times_ns[i]);
     }
+  });
+}
 
-    const int64_t image_time_ns = view->GetTimestamp() * S_TO_NS;
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::GetReprojectionErrors(
+    ReprojectionErrorReport& report, const int num_threads) {
+  const std::vector<theia::ViewId> view_ids = image_data_->ViewIds();
+  // the observation cache is filled here, the concurrent evaluation below
+  // only reads the knots, T_i_c and the scene points
+  std::vector<std::shared_ptr<const ViewObservations>> observations;
+  observations.reserve(view_ids.size());
+  for (const theia::ViewId vid : view_ids) {
+    observations.push_back(ViewObservationsFor(image_data_->View(vid)));
+  }
 
-    double u_r3, u_so3;
-    int64_t s_r3, s_so3;
-    if (!CalcR3Times(image_time_ns, u_r3, s_r3)) {
-      return 0.0;
-    }
-    if (!CalcSO3Times(image_time_ns, u_so3, s_so3)) {
-      return 0.0;
-    }
+  const ReprojectionHistogramOptions histogram = report.histogram_options;
+  report.views.assign(view_ids.size(), ViewReprojectionErrors());
+  std::vector<char> view_valid(view_ids.size(), 0);
+  utils::ParallelFor(
+      0, static_cast<int>(view_ids.size()), num_threads, [&](const int v) {
+        view_valid[v] = EvaluateViewReprojectionErrors(
+            view_ids[v], observations[v], histogram, report.views[v]);
+      });
+  return std::all_of(
+      view_valid.begin(), view_valid.end(), [](const char v) { return v; });
+}
 
-    using FunctorT = RSReprojectionCostFunctorSplit<N_>;
-    FunctorT* functor = new FunctorT(
-        view, &image_data_, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_, tracks);
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::EvaluateViewReprojectionErrors(
+    const theia::ViewId vid,
+    const std::shared_ptr<const ViewObservations>& observations,
+    const ReprojectionHistogramOptions& histogram,
+    ViewReprojectionErrors& errors) {
+  const theia::View* view = image_data_->View(vid);
+  errors.view_id = vid;
+  errors.timestamp_s = view->GetTimestamp();
+  errors.histogram.assign(histogram.nr_bins, 0);
+
+  const std::vector<theia::TrackId>& tracks = observations->track_ids;
+  const size_t nr_obs = tracks.size();
+  if (nr_obs <= 0) {
+    return false;
+  }
 
-    ceres::DynamicAutoDiffCostFunction<FunctorT>* cost_function =
-        new ceres::DynamicAutoDiffCostFunction<FunctorT>(functor);
+  const int64_t image_time_ns = view->GetTimestamp() * S_TO_NS;
 
-    std::vector<double*> vec;
-    for (int i = 0; i < N_; i++) {
-      cost_function->AddParameterBlock(4);
-      const int t = s_so3 + i;
-      vec.emplace_back(so3_knots_[t].data());
-    }
-    for (int i = 0; i < N_; i++) {
-      cost_function->AddParameterBlock(3);
-      const int t = s_r3 + i;
-      vec.emplace_back(r3_knots_[t].data());
-    }
+  double u_r3, u_so3;
+  int64_t s_r3, s_so3;
+  if (!CalcR3Times(image_time_ns, u_r3, s_r3)) {
+    return false;
+  }
+  if (!CalcSO3Times(image_time_ns, u_so3, s_so3)) {
+    return false;
+  }
+
+  // exact per corner poses, independent of the row banding
+  const std::unique_ptr<ceres::CostFunction> cost_function(
+      CreateReprojectionCostFunction<RSReprojectionCostFunctorSplit, N_>(
+          observations, u_so3, u_r3, inv_so3_dt_, inv_r3_dt_));
+  if (!cost_function) {
+    return false;
+  }
 
-    // camera to imu transformation
-    cost_function->AddParameterBlock(7);
-    vec.emplace_back(T_i_c_.data());
+  std::vector<const double*> vec;
+  vec.reserve(2 * N_ + 2 + nr_obs);
+  for (int i = 0; i < N_; i++) {
+    vec.emplace_back(so3_knots_[s_so3 + i].data());
+  }
+  for (int i = 0; i < N_; i++) {
+    vec.emplace_back(r3_knots_[s_r3 + i].data());
+  }
 
-    // line delay for rolling shutter cameras
-    cost_function->AddParameterBlock(1);
-    vec.emplace_back(&cam_line_delay_s_);
+  // camera to imu transformation
+  const size_t camera = RigCameraOf(vid);
+  vec.emplace_back(T_i_cBlock(camera));
 
-    // all object points
-    for (size_t i = 0; i < nr_obs; ++i) {
-      cost_function->AddParameterBlock(4);
-      vec.emplace_back(
-          image_data_.MutableTrack(tracks[i])->MutablePoint()->data());
-    }
+  // line delay for rolling shutter cameras
+  vec.emplace_back(LineDelayBlock(camera));
 
-    cost_function->SetNumResiduals(2 * nr_obs);
-    {
-      Eigen::VectorXd residual;
-      residual.setZero(nr_obs * 2);
+  // all object points
+  for (size_t i = 0; i < nr_obs; ++i) {
+    vec.emplace_back(scene_points_.at(tracks[i]).data());
+  }
 
-      cost_function->Evaluate(&vec[0], residual.data(), NULL);
+  Eigen::VectorXd residual;
+  residual.setZero(nr_obs * 2);
+  cost_function->Evaluate(vec.data(), residual.data(), NULL);
 
-      for (size_t i = 0; i < nr_obs; i++) {
-        Eigen::Vector2d res_point = residual.segment<2>(2 * i);
-        if (res_point[0] != 0.0 && res_point[1] != 0.0) {
-          sum_error += res_point.norm();
-          num_points += 1;
-        }
-      }
+  for (size_t i = 0; i < nr_obs; i++) {
+    const Eigen::Vector2d res_point = residual.segment<2>(2 * i);
+    if (res_point[0] != 0.0 && res_point[1] != 0.0) {
+      errors.Add(res_point.norm(), histogram);
     }
   }
+  return true;
+}
+
+template <int _T>
+double SplineTrajectoryEstimator<_T>::GetMeanReprojectionError(
+    ReprojectionErrorReport* report) {
+  ReprojectionErrorReport local_report;
+  ReprojectionErrorReport& errors = report ? *report : local_report;
+  if (!GetReprojectionErrors(errors)) {
+    return 0.0;
+  }
 
-  std::cout << "Mean reprojection error " << sum_error / num_points
-            << " number residuals: " << num_points << std::endl;
+  std::cout << "Mean reprojection error " << errors.MeanError()
+            << " number residuals: " << errors.NumPoints() << std::endl;
 
-  return sum_error / num_points;
+  return errors.MeanError();
 }
 
 template <int _T>
 void SplineTrajectoryEstimator<_T>::ConvertInvDepthPointsToHom() {
-  const auto track_ids = image_data_.TrackIds();
+  const auto track_ids = image_data_->TrackIds();
   for (size_t p = 0; p < track_ids.size(); ++p) {
-    theia::Track* mutable_track = image_data_.MutableTrack(track_ids[p]);
-    const theia::View* v = image_data_.View(mutable_track->ReferenceViewId());
+    const theia::Track* track = image_data_->Track(track_ids[p]);
+    const theia::View* v = image_data_->View(track->ReferenceViewId());
     Eigen::Vector3d bearing =
         v->Camera().PixelToUnitDepthRay((*v->GetFeature(track_ids[p])).point_);
 
@@ -1084,13 +2818,11 @@ void SplineTrajectoryEstimator<_T>::ConvertInvDepthPointsToHom() {
     Sophus::SE3d T_w_i;
     GetPose(ts, T_w_i);
     Eigen::Vector3d X_ref =
-        T_i_c_.so3() *
-        (bearing - mutable_track->InverseDepth() * T_i_c_.translation());
+        T_i_c_.so3() * (bearing - track->InverseDepth() * T_i_c_.translation());
     // 2. Transform point from IMU to world frame
-    Eigen::Vector3d X = T_w_i.so3() * X_ref +
-                        T_w_i.translation() * mutable_track->InverseDepth();
-    *mutable_track->MutablePoint() = X.homogeneous();
-    mutable_track->SetEstimated(true);
+    Eigen::Vector3d X =
+        T_w_i.so3() * X_ref + T_w_i.translation() * track->InverseDepth();
+    scene_points_[track_ids[p]] = X.homogeneous();
   }
 }
 
@@ -1098,13 +2830,13 @@ template <int _T>
 void SplineTrajectoryEstimator<_T>::ConvertToTheiaRecon(
     theia::Reconstruction* recon_out) {
   // read camera calibration
-  std::vector<theia::ViewId> view_ids = image_data_.ViewIds();
+  std::vector<theia::ViewId> view_ids = image_data_->ViewIds();
   for (size_t i = 0; i < view_ids.size(); ++i) {
     const int64_t t_ns =
-        image_data_.View(view_ids[i])->GetTimestamp() * S_TO_NS;
+        image_data_->View(view_ids[i])->GetTimestamp() * S_TO_NS;
     Sophus::SE3d T_w_i;
     GetPose(t_ns, T_w_i);
-    Sophus::SE3d T_w_c = T_w_i * T_i_c_;
+    Sophus::SE3d T_w_c = T_w_i * GetRigCameraT_i_c(RigCameraOf(view_ids[i]));
     theia::ViewId v_id_theia =
         recon_out->AddView(std::to_string(t_ns), 0, t_ns);
     theia::View* view = recon_out->MutableView(v_id_theia);
@@ -1115,11 +2847,11 @@ void SplineTrajectoryEstimator<_T>::ConvertToTheiaRecon(
     camera_ptr->SetPosition(T_w_c.translation());
   }
   // ConvertInvDepthPointsToHom();
-  const auto track_ids = image_data_.TrackIds();
+  const auto track_ids = image_data_->TrackIds();
   for (size_t p = 0; p < track_ids.size(); ++p) {
     TrackId tid = recon_out->AddTrack();
     *recon_out->MutableTrack(tid)->MutablePoint() =
-        image_data_.Track(track_ids[p])->Point();
+        scene_points_.at(track_ids[p]);
     recon_out->MutableTrack(tid)->SetEstimated(true);
   }
 }
@@ -1179,7 +2911,7 @@ SplineTrajectoryEstimator<_T>::GetGyroIntrinsics(const int64_t& time_ns) {
 
 template <int _T>
 Eigen::Vector3d SplineTrajectoryEstimator<_T>::GetGyroBias(
-    const int64_t& time_ns) {
+    const int64_t& time_ns) const {
   double u;
   int64_t s;
   Eigen::Vector3d gyro_bias;
@@ -1207,7 +2939,7 @@ Eigen::Vector3d SplineTrajectoryEstimator<_T>::GetGyroBias(
 
 template <int _T>
 Eigen::Vector3d SplineTrajectoryEstimator<_T>::GetAcclBias(
-    const int64_t& time_ns) {
+    const int64_t& time_ns) const {
   double u;
   int64_t s;
   Eigen::Vector3d accl_bias;
@@ -1233,6 +2965,70 @@ Eigen::Vector3d SplineTrajectoryEstimator<_T>::GetAcclBias(
   return accl_bias;
 }
 
+template <int _T>
+void SplineTrajectoryEstimator<_T>::GetSnapshot(
+    SplineSnapshot& snapshot) const {
+  snapshot.spline_order = N_;
+  snapshot.start_t_ns = start_t_ns_;
+  snapshot.end_t_ns = end_t_ns_;
+  snapshot.dt_so3_ns = dt_so3_ns_;
+  snapshot.dt_r3_ns = dt_r3_ns_;
+  snapshot.so3_knots = so3_knots_.ToVector();
+  snapshot.r3_knots = r3_knots_.ToVector();
+  snapshot.dt_accl_bias_ns = dt_accl_bias_ns_;
+  snapshot.dt_gyro_bias_ns = dt_gyro_bias_ns_;
+  snapshot.accl_bias_knots = accl_bias_spline_.ToVector();
+  snapshot.gyro_bias_knots = gyro_bias_spline_.ToVector();
+  snapshot.T_i_c = T_i_c_;
+  snapshot.gravity = gravity_;
+  snapshot.accl_intrinsics = accl_intrinsics_;
+  snapshot.gyro_intrinsics = gyro_intrinsics_;
+  snapshot.line_delay_s = cam_line_delay_s_;
+}
+
+template <int _T>
+bool SplineTrajectoryEstimator<_T>::InitFromSnapshot(
+    const SplineSnapshot& snapshot) {
+  T_i_c_ = snapshot.T_i_c;
+  gravity_ = snapshot.gravity;
+  accl_intrinsics_ = snapshot.accl_intrinsics;
+  gyro_intrinsics_ = snapshot.gyro_intrinsics;
+  cam_line_delay_s_ = snapshot.line_delay_s;
+
+  auto init_bias_knots = [](const vec3_vector& snapshot_knots,
+                            const bool same_grid,
+                            ArenaKnots<Eigen::Vector3d>& knots) {
+    if (snapshot_knots.empty()) return;
+    if (same_grid) {
+      knots.Assign(snapshot_knots);
+      return;
+    }
+    Eigen::Vector3d mean_bias(0.0, 0.0, 0.0);
+    for (const Eigen::Vector3d& b : snapshot_knots) mean_bias += b;
+    mean_bias /= static_cast<double>(snapshot_knots.size());
+    knots.Fill(mean_bias);
+  };
+  const bool same_start = snapshot.start_t_ns == start_t_ns_;
+  init_bias_knots(snapshot.accl_bias_knots,
+                  same_start && snapshot.dt_accl_bias_ns == dt_accl_bias_ns_ &&
+                      snapshot.accl_bias_knots.size() == nr_knots_accl_bias_,
+                  accl_bias_spline_);
+  init_bias_knots(snapshot.gyro_bias_knots,
+                  same_start && snapshot.dt_gyro_bias_ns == dt_gyro_bias_ns_ &&
+                      snapshot.gyro_bias_knots.size() == nr_knots_gyro_bias_,
+                  gyro_bias_spline_);
+
+  const bool same_grid = snapshot.spline_order == N_ && same_start &&
+                         snapshot.dt_so3_ns == dt_so3_ns_ &&
+                         snapshot.dt_r3_ns == dt_r3_ns_ &&
+                         snapshot.so3_knots.size() == nr_knots_so3_ &&
+                         snapshot.r3_knots.size() == nr_knots_r3_;
+  if (!same_grid) return false;
+  so3_knots_.Assign(snapshot.so3_knots);
+  r3_knots_.Assign(snapshot.r3_knots);
+  return true;
+}
+
 template <int _T>
 void SplineTrajectoryEstimator<_T>::SetIMUIntrinsics(
     const ThreeAxisSensorCalibParams<double>& accl_intrinsics,
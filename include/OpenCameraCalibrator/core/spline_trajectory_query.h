@@ -0,0 +1,77 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/core/spline_snapshot.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+//! Evaluates the trajectory of a SplineSnapshot at arbitrary times without
+//! the estimator, its ceres problem or the measurements. Meant for consumers
+//! of an exported calibration that only need the poses and derivatives at
+//! their own timestamps, instead of a full rate dump of the spline.
+class SplineTrajectoryQuery {
+ public:
+  SplineTrajectoryQuery() = default;
+
+  //! false if the spline order is not supported or the snapshot has no knots
+  bool Init(const SplineSnapshot& snapshot);
+
+  //! Reads a snapshot written by io::WriteSplineSnapshot and calls Init
+  bool Load(const std::string& path_to_snapshot);
+
+  //! Evaluates the spline at time_ns, false if it is outside of the spline
+  bool Evaluate(const int64_t time_ns, TrajectorySample& sample) const;
+
+  //! Evaluates many times in parallel. Sorted times are fastest, since the
+  //! SO3 knot increments are reused inside a segment.
+  void Evaluate(const std::vector<int64_t>& times_ns,
+                aligned_vector<TrajectorySample>& samples,
+                const int num_threads = 1) const;
+
+  //! T_w_c of the camera at time_ns, false if it is outside of the spline
+  bool CameraPose(const int64_t time_ns, Sophus::SE3d& T_w_c) const;
+
+  //! first and last time at which the spline can be evaluated
+  int64_t StartTimeNs() const { return snapshot_.start_t_ns; }
+  int64_t EndTimeNs() const { return snapshot_.end_t_ns; }
+
+  const SplineSnapshot& Snapshot() const { return snapshot_; }
+
+ private:
+  template <int _N>
+  void EvaluateRange(const int64_t* times_ns,
+                     const size_t nr_times,
+                     TrajectorySample* samples) const;
+
+  bool CalcTimes(const int64_t time_ns,
+                 const int64_t dt_ns,
+                 const size_t nr_knots,
+                 const int N,
+                 double& u,
+                 int64_t& s) const;
+
+  SplineSnapshot snapshot_;
+};
+
+}  // namespace core
+}  // namespace OpenICC
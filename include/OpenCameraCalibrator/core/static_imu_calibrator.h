@@ -7,6 +7,11 @@
 #include "OpenCameraCalibrator/utils/imu_data_interval.h"
 
 #include <ceres/ceres.h>
+#include <ceres/rotation.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
 
 using namespace OpenICC::utils;
 
@@ -25,20 +30,9 @@ struct MultiPosAccResidual {
         T(sample_(0)), T(sample_(1)), T(sample_(2)));
     /* Assume body frame same as accelerometer frame,
      * so bottom left params in the misalignment matris are set to zero */
-    ThreeAxisSensorCalibParams<T> calib_triad(params[0],
-                                              params[1],
-                                              params[2],
-                                              T(0),
-                                              T(0),
-                                              T(0),
-                                              params[3],
-                                              params[4],
-                                              params[5],
-                                              params[6],
-                                              params[7],
-                                              params[8]);
-
-    Eigen::Matrix<T, 3, 1> calib_samp = calib_triad.UnbiasNormalize(raw_samp);
+    Eigen::Matrix<T, 3, 1> calib_samp =
+        ThreeAxisSensorCalibParams<T>::ApplyUnbiasNormalizeBodyFrame(
+            params, params + 3, params + 6, raw_samp);
     residuals[0] = T(g_mag_) - calib_samp.norm();
     return true;
   }
@@ -85,20 +79,13 @@ struct MultiPosGyroResidual {
         optimize_bias_ ? params[10] : T(0),
         optimize_bias_ ? params[11] : T(0));
 
-    std::vector<ImuReading<T>> calib_gyro_samples;
-    calib_gyro_samples.reserve(interval_pos01_.end_idx -
-                               interval_pos01_.start_idx + 1);
-
-    for (int i = interval_pos01_.start_idx; i <= interval_pos01_.end_idx; i++) {
-      Eigen::Matrix<T, 3, 1> gyro(T(gyro_samples_[i].x()),
-                                  T(gyro_samples_[i].y()),
-                                  T(gyro_samples_[i].z()));
-      calib_gyro_samples.push_back(
-          ImuReading<T>(T(gyro_samples_[i].timestamp_s()),
-                        calib_triad.UnbiasNormalize(gyro)));
-    }
+    Eigen::Matrix<T, 4, 1> quat;
+    IntegrateCalibratedGyroIntervalClosedForm(
+        gyro_samples_, calib_triad, interval_pos01_, dt_, quat);
     Eigen::Matrix<T, 3, 3> rot_mat;
-    IntegrateGyroInterval(calib_gyro_samples, rot_mat, T(dt_));
+    ceres::MatrixAdapter<T, 1, 3> rot_mat_adapter =
+        ceres::ColumnMajorAdapter3x3(rot_mat.data());
+    ceres::QuaternionToRotation(quat.data(), rot_mat_adapter);
 
     Eigen::Matrix<T, 3, 1> diff =
         rot_mat.transpose() * g_versor_pos0_.template cast<T>() -
@@ -136,12 +123,105 @@ struct MultiPosGyroResidual {
   }
 
   const Vector3d g_versor_pos0_, g_versor_pos1_;
-  const ImuReadings gyro_samples_;
+  //! not copied, has to outlive the residual
+  const ImuReadings& gyro_samples_;
   const DataInterval interval_pos01_;
   const double dt_;
   const bool optimize_bias_;
 };
 
+//! MultiPosGyroResidual with closed form Jacobians. The derivative of the
+//! integrated quaternion is propagated through the RK4 steps in doubles, which
+//! avoids integrating the whole interval on 9 or 12 dimensional jets.
+template <int kNumParams>
+class MultiPosGyroAnalyticResidual
+    : public ceres::SizedCostFunction<3, kNumParams> {
+ public:
+  static_assert(kNumParams == 9 || kNumParams == 12,
+                "Either 9 or 12 gyroscope parameters");
+
+  MultiPosGyroAnalyticResidual(const Vector3d& g_versor_pos0,
+                               const Vector3d& g_versor_pos1,
+                               const ImuReadings& gyro_samples,
+                               const DataInterval& gyro_interval_pos01,
+                               double dt)
+      : g_versor_pos0_(g_versor_pos0),
+        g_versor_pos1_(g_versor_pos1),
+        gyro_samples_(gyro_samples),
+        interval_pos01_(gyro_interval_pos01),
+        dt_(dt) {}
+
+  bool Evaluate(double const* const* parameters,
+                double* residuals,
+                double** jacobians) const override {
+    const double* params = parameters[0];
+    const bool optimize_bias = kNumParams == 12;
+    ThreeAxisSensorCalibParams<double> calib_triad(
+        params[0],
+        params[1],
+        params[2],
+        params[3],
+        params[4],
+        params[5],
+        params[6],
+        params[7],
+        params[8],
+        optimize_bias ? params[9] : 0.0,
+        optimize_bias ? params[10] : 0.0,
+        optimize_bias ? params[11] : 0.0);
+
+    const bool need_jacobian = jacobians && jacobians[0];
+    Eigen::Vector4d quat;
+    Eigen::Matrix<double, 4, 12> quat_jac;
+    if (need_jacobian) {
+      IntegrateCalibratedGyroInterval(
+          gyro_samples_, calib_triad, interval_pos01_, dt_, quat, quat_jac);
+    } else {
+      IntegrateCalibratedGyroInterval(
+          gyro_samples_, calib_triad, interval_pos01_, dt_, quat);
+    }
+
+    // R(q)^T * g = g - 2 w (u x g) + 2 u x (u x g), q = [w, u]
+    const double w = quat(0);
+    const Vector3d u = quat.tail<3>();
+    const Vector3d& g = g_versor_pos0_;
+    const Vector3d u_x_g = u.cross(g);
+    Eigen::Map<Vector3d> res(residuals);
+    res = g - 2.0 * w * u_x_g + 2.0 * u.cross(u_x_g) - g_versor_pos1_;
+
+    if (need_jacobian) {
+      Eigen::Matrix3d g_skew;
+      g_skew << 0.0, -g(2), g(1), g(2), 0.0, -g(0), -g(1), g(0), 0.0;
+      Eigen::Matrix<double, 3, 4> res_quat_jac;
+      res_quat_jac.col(0) = -2.0 * u_x_g;
+      res_quat_jac.rightCols<3>() =
+          2.0 * w * g_skew +
+          2.0 * (u.dot(g) * Eigen::Matrix3d::Identity() + u * g.transpose() -
+                 2.0 * g * u.transpose());
+      Eigen::Map<Eigen::Matrix<double, 3, kNumParams, Eigen::RowMajor>> jac(
+          jacobians[0]);
+      jac = res_quat_jac * quat_jac.template leftCols<kNumParams>();
+    }
+    return true;
+  }
+
+  static ceres::CostFunction* Create(const Vector3d& g_versor_pos0,
+                                     const Vector3d& g_versor_pos1,
+                                     const ImuReadings& gyro_samples,
+                                     const DataInterval& gyro_interval_pos01,
+                                     double dt) {
+    return new MultiPosGyroAnalyticResidual<kNumParams>(
+        g_versor_pos0, g_versor_pos1, gyro_samples, gyro_interval_pos01, dt);
+  }
+
+ private:
+  const Vector3d g_versor_pos0_, g_versor_pos1_;
+  //! not copied, has to outlive the residual
+  const ImuReadings& gyro_samples_;
+  const DataInterval interval_pos01_;
+  const double dt_;
+};
+
 /** @brief This object enables to calibrate an accelerometers triad and
  * eventually a related gyroscopes triad (i.e., to estimate theirs misalignment
  * matrix, scale factors and biases) using the multi-position calibration
@@ -188,6 +268,11 @@ class StaticImuCalibrator {
    *         accelerations of each static interval instead of all samples */
   bool AccUseMeans() const { return acc_use_means_; }
 
+  /** @brief Provides the number of static samples above which the
+   *         accelerometers calibration uses the interval means, 0 if
+   *         disabled */
+  size_t AccMeansSampleLimit() const { return acc_means_sample_limit_; }
+
   /** @brief Provides the (fixed) data period used in the gyroscopes
    * integration. If this period is less than 0, the gyroscopes timestamps are
    * used in place of this period. */
@@ -236,6 +321,12 @@ class StaticImuCalibrator {
    */
   void EnableAccUseMeans(bool enabled) { acc_use_means_ = enabled; }
 
+  /** @brief Use the mean accelerations of each static interval if more than
+   * limit static samples would enter the accelerometers calibration of a
+   * threshold. 0 disables the limit. Default is 0.
+   */
+  void SetAccMeansSampleLimit(size_t limit) { acc_means_sample_limit_ = limit; }
+
   /** @brief Set the (fixed) data period used in the gyroscopes integration.
    *         If this period is less than 0, the gyroscopes timestamps are used
    *         in place of this period. Default is -1.
@@ -252,6 +343,15 @@ class StaticImuCalibrator {
   /** @brief If the parameter enabled is true, verbose output is activeted  */
   void EnableVerboseOutput(bool enabled) { verbose_output_ = enabled; }
 
+  /** @brief Set the number of threads used to run the accelerometer
+   * calibrations for the different static detector thresholds and to
+   * evaluate the gyroscope intervals. Threads beyond the number of
+   * thresholds are handed to the ceres solver of each threshold. Default is 1.
+   */
+  void SetNumThreads(int num_threads) {
+    num_threads_ = std::max(1, num_threads);
+  }
+
   /** @brief Estimate the calibration parameters for the acceleremoters triad
    *         (see CalibratedTriad_) using the multi-position calibration method
    *
@@ -295,20 +395,44 @@ class StaticImuCalibrator {
   }
 
  private:
+  /** @brief Number of static detector thresholds tried by CalibrateAcc */
+  static constexpr int kNumThresholdMultipliers = 10;
+
+  /** @brief Accelerometer calibration for a single static detector threshold
+   */
+  struct ThresholdCalibration {
+    bool valid = false;
+    int nr_extracted_intervals = 0;
+    double cost = std::numeric_limits<double>::max();
+    std::vector<utils::DataInterval> static_intervals;
+    std::vector<double> calib_params;
+  };
+
+  /** @brief Detects the static intervals with the given threshold and solves
+   * the accelerometer calibration on them. Only reads members, so it can be
+   * called concurrently. */
+  void CalibrateAccThreshold(const ImuReadings& acc_samples,
+                             const double threshold,
+                             ThresholdCalibration* calibration) const;
+
   double g_mag_;
   const int min_num_intervals_;
   double init_interval_duration_;
   int interval_n_samples_;
   bool acc_use_means_;
+  size_t acc_means_sample_limit_;
   double gyro_dt_;
   bool optimize_gyro_bias_;
   std::vector<utils::DataInterval> min_cost_static_intervals_;
+  /** @brief Local variance magnitude of the accelerometer samples */
+  std::vector<double> acc_variance_norms_;
   ThreeAxisSensorCalibParams<double> init_acc_calib_, init_gyro_calib_;
   ThreeAxisSensorCalibParams<double> acc_calib_, gyro_calib_;
   CameraAccData calib_acc_samples_;
   CameraGyroData calib_gyro_samples_;
 
   bool verbose_output_;
+  int num_threads_;
 };
 
 }  // namespace core
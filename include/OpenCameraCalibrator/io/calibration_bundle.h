@@ -0,0 +1,141 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+#include "OpenCameraCalibrator/utils/types.h"
+#include "theia/sfm/camera/camera.h"
+
+namespace OpenICC {
+namespace io {
+
+//! Calibration bundle: the calibrations of many devices in one file that
+//! is memory mapped and used without parsing. The json files stay the
+//! human readable default. All fields are little endian:
+//! CalibrationBundleHeader
+//! CalibrationRecord[num_records], sorted by device_name
+const char CALIBRATION_BUNDLE_MAGIC[8] = {
+    'O', 'I', 'C', 'C', 'C', 'A', 'L', '\0'};
+const uint32_t CALIBRATION_BUNDLE_VERSION = 1;
+const int CALIBRATION_MAX_DEVICE_NAME = 64;
+const int CALIBRATION_MAX_CAMERA_INTRINSICS = 16;
+
+struct CalibrationBundleHeader {
+  char magic[8];
+  uint32_t version;
+  //! sizeof(CalibrationRecord) of the writer
+  uint32_t record_size;
+  uint64_t num_records;
+};
+
+//! Complete IMU and camera calibration of one device
+struct CalibrationRecord {
+  //! zero terminated
+  char device_name[CALIBRATION_MAX_DEVICE_NAME];
+
+  //! theia::CameraIntrinsicsModelType
+  int32_t camera_model;
+  int32_t image_width;
+  int32_t image_height;
+  int32_t num_camera_intrinsics;
+  double fps;
+  //! parameters of the theia camera intrinsics model, in its order
+  double camera_intrinsics[CALIBRATION_MAX_CAMERA_INTRINSICS];
+
+  //! column major 3x3 misalignment matrix, scale and bias
+  double accl_misalignment[9];
+  double accl_scale[3];
+  double accl_bias[3];
+  double gyro_misalignment[9];
+  double gyro_scale[3];
+  double gyro_bias[3];
+
+  //! Sophus::SE3d parameters of T_i_c (quaternion x, y, z, w, translation)
+  double T_i_c[7];
+  double time_offset_imu_to_cam_s;
+  double line_delay_s;
+};
+
+//! Writes records sorted by device name, so MappedCalibrationBundle::Find
+//! can bisect. Device names have to be unique.
+bool WriteCalibrationBundle(const std::string& output_path,
+                            std::vector<CalibrationRecord> records);
+
+//! Read-only, memory mapped calibration bundle
+class MappedCalibrationBundle {
+ public:
+  MappedCalibrationBundle() {}
+  ~MappedCalibrationBundle();
+
+  MappedCalibrationBundle(const MappedCalibrationBundle&) = delete;
+  MappedCalibrationBundle& operator=(const MappedCalibrationBundle&) = delete;
+
+  bool Open(const std::string& path);
+
+  void Close();
+
+  size_t NumRecords() const { return header_ ? header_->num_records : 0; }
+
+  const CalibrationRecord& Record(const size_t i) const { return records_[i]; }
+
+  //! Record of device_name or nullptr, O(log n)
+  const CalibrationRecord* Find(const std::string& device_name) const;
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+
+  const CalibrationBundleHeader* header_ = nullptr;
+  const CalibrationRecord* records_ = nullptr;
+};
+
+//! Identity IMU intrinsics, zero time offset and line delay and an empty
+//! camera
+void InitCalibrationRecord(const std::string& device_name,
+                           CalibrationRecord& record);
+
+void SetRecordCamera(const theia::Camera& camera,
+                     const double fps,
+                     CalibrationRecord& record);
+
+void RecordToCamera(const CalibrationRecord& record, theia::Camera& camera);
+
+void SetRecordImuIntrinsics(const ThreeAxisSensorCalibParamsd& acc_params,
+                            const ThreeAxisSensorCalibParamsd& gyro_params,
+                            CalibrationRecord& record);
+
+void RecordToImuIntrinsics(const CalibrationRecord& record,
+                           ThreeAxisSensorCalibParamsd& acc_params,
+                           ThreeAxisSensorCalibParamsd& gyro_params);
+
+//! Fills a record from the json outputs of the pipeline. Empty paths keep
+//! the defaults of InitCalibrationRecord. imu_to_camera_result is the
+//! result json of the IMU to camera calibration (q_i_c, t_i_c,
+//! time_offset_imu_to_cam_s, calib_line_delay_us).
+bool CalibrationRecordFromJson(const std::string& device_name,
+                               const std::string& camera_calibration,
+                               const std::string& imu_intrinsics,
+                               const std::string& imu_bias,
+                               const std::string& imu_to_camera_result,
+                               CalibrationRecord& record);
+
+}  // namespace io
+}  // namespace OpenICC
@@ -0,0 +1,36 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace io {
+
+//! Reads the ACCL, GYRO, GPS5 and CORI streams of the GPMF metadata track
+//! straight from a GoPro MP4, without the python extraction and the
+//! intermediate json. The samples of a GPMF payload are spread evenly over
+//! the duration of its MP4 sample. Axes, units and time stamps are the same
+//! as for ReadGoProTelemetry, the CORI times are the image time stamps.
+bool ReadGoProMP4Telemetry(const std::string& path_to_mp4,
+                           CameraTelemetryData& telemetry);
+
+//! Returns true if the file is an ISO base media (MP4, MOV) file
+bool IsMP4File(const std::string& path);
+
+}  // namespace io
+}  // namespace OpenICC
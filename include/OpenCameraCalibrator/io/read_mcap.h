@@ -0,0 +1,139 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace io {
+
+struct McapChannel {
+  uint16_t id = 0;
+  std::string topic;
+  std::string message_encoding;
+  //! e.g. sensor_msgs/msg/Imu
+  std::string schema_name;
+};
+
+//! Message of a McapReader, data points into the reader and is valid until
+//! the next call of NextMessage
+struct McapMessage {
+  uint16_t channel_id = 0;
+  uint64_t log_time_ns = 0;
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+//! Streams the messages of an MCAP file (ROS 2 bags) in file order. Only one
+//! record or chunk is in memory at a time. Chunks have to be uncompressed or
+//! zstd compressed, the latter needs BUILD_WITH_ZSTD.
+class McapReader {
+ public:
+  bool Open(const std::string& path);
+
+  //! Next message of the data section. False at its end or on an error, see
+  //! Failed
+  bool NextMessage(McapMessage& message);
+
+  bool Failed() const { return failed_; }
+
+  //! Channel of a message that was returned, nullptr if it is unknown
+  const McapChannel* Channel(const uint16_t channel_id) const;
+
+  //! Log time of the first message, the time origin of ToRelativeTimeS
+  uint64_t FirstLogTimeNs() const { return first_log_time_ns_; }
+
+  //! Seconds since the first log time of the file, so that the images and
+  //! the IMU samples of one file share a time axis that doubles resolve to
+  //! nanoseconds
+  double ToRelativeTimeS(const int64_t time_ns) const {
+    return static_cast<double>(time_ns -
+                               static_cast<int64_t>(first_log_time_ns_)) *
+           NS_TO_S;
+  }
+
+ private:
+  //! Handles a record, true if it is a message
+  bool HandleRecord(const uint8_t opcode,
+                    const uint8_t* data,
+                    const uint64_t size,
+                    McapMessage& message);
+
+  bool LoadChunk(const uint8_t* data, const uint64_t size);
+
+  std::ifstream file_;
+  bool failed_ = false;
+  bool data_end_ = false;
+  std::vector<uint8_t> record_;
+  std::vector<uint8_t> chunk_buffer_;
+  //! records of the current chunk
+  const uint8_t* chunk_ = nullptr;
+  uint64_t chunk_size_ = 0;
+  uint64_t chunk_pos_ = 0;
+  uint64_t first_log_time_ns_ = 0;
+  bool has_first_log_time_ = false;
+  std::map<uint16_t, std::string> schema_names_;
+  std::map<uint16_t, McapChannel> channels_;
+};
+
+//! sensor_msgs/msg/Image or sensor_msgs/msg/CompressedImage decoded from
+//! CDR. Data points into the message
+struct RosImageMessage {
+  int64_t stamp_ns = 0;
+  bool compressed = false;
+  //! encoding of raw images, format of compressed ones
+  std::string encoding;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t step = 0;
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+//! True for the schemas that DecodeRosImage reads
+bool IsRosImageSchema(const std::string& schema_name);
+
+//! Decodes a CDR image message of the given schema
+bool DecodeRosImage(const std::string& schema_name,
+                    const uint8_t* data,
+                    const size_t size,
+                    RosImageMessage& image);
+
+//! Decodes the stamp, angular velocity and linear acceleration of a CDR
+//! sensor_msgs/msg/Imu message
+bool DecodeRosImu(const uint8_t* data,
+                  const size_t size,
+                  int64_t& stamp_ns,
+                  Eigen::Vector3d& gyro,
+                  Eigen::Vector3d& accl);
+
+//! Returns true if the file starts with the MCAP magic
+bool IsMcapFile(const std::string& path);
+
+//! Reads the sensor_msgs/msg/Imu messages of imu_topic, or of the first IMU
+//! channel if it is empty. Times are relative to the first log time of the
+//! file, see McapReader::ToRelativeTimeS
+bool ReadMcapTelemetry(const std::string& path_to_mcap,
+                       const std::string& imu_topic,
+                       CameraTelemetryData& telemetry);
+
+}  // namespace io
+}  // namespace OpenICC
@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #include "theia/sfm/reconstruction.h"
@@ -24,10 +25,140 @@
 namespace OpenICC {
 namespace io {
 
+//! Binary scene format. All arrays start 8 byte aligned:
+//! SceneBinaryHeader
+//! SceneBinaryFrame[num_frames]
+//! int32 ids[num_observations]
+//! double xy[2 * num_observations]
+//! int32 scene_pt_ids[num_scene_pts]
+//! double scene_pts_xyz[3 * num_scene_pts]
+const char SCENE_BINARY_MAGIC[8] = {'O', 'I', 'C', 'C', 'S', 'C', 'N', '\0'};
+const uint32_t SCENE_BINARY_VERSION = 1;
+
+//! Compact scene format for transfers, little endian:
+//! SceneBinaryHeader with SCENE_COMPACT_MAGIC, num_observations is the
+//! total corner count
+//! per scene point, sorted by id: varint id delta, double xyz[3]
+//! per frame: double timestamp_us, varint num_obs, uint8 id coding, ids,
+//! corners
+//! The ids of a frame are sorted. Id coding 0 stores them as varint deltas
+//! (the first one to -1), 1 as bitmask over the ids 0..max scene point id.
+//! Corners are quantized to 1 / SCENE_COMPACT_SUBPIXEL px and stored as
+//! zigzag varints of x and y minus a prediction: the previous corner, or
+//! its linear extrapolation if the previous two id steps are equal.
+const char SCENE_COMPACT_MAGIC[8] = {'O', 'I', 'C', 'C', 'S', 'C', 'Z', '\0'};
+const uint32_t SCENE_COMPACT_VERSION = 1;
+const double SCENE_COMPACT_SUBPIXEL = 256.0;
+
+struct SceneBinaryHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t image_width;
+  int32_t image_height;
+  int32_t board_type;
+  double camera_fps;
+  double square_size_meter;
+  uint64_t num_frames;
+  uint64_t num_observations;
+  uint64_t num_scene_pts;
+};
+
+struct SceneBinaryFrame {
+  double timestamp_us;
+  uint64_t first_obs;
+  uint64_t num_obs;
+};
+
+//! Byte offsets of the arrays behind the header
+struct SceneBinaryLayout {
+  explicit SceneBinaryLayout(const SceneBinaryHeader& header);
+
+  size_t frames;
+  size_t ids;
+  size_t xy;
+  size_t scene_pt_ids;
+  size_t scene_pts_xyz;
+  size_t total_size;
+};
+
+//! Read-only, memory mapped binary scene. Frames and observations are
+//! accessed in place without copying or parsing.
+class MappedScene {
+ public:
+  MappedScene() {}
+
+  ~MappedScene();
+
+  MappedScene(const MappedScene&) = delete;
+  MappedScene& operator=(const MappedScene&) = delete;
+
+  bool Open(const std::string& path);
+
+  void Close();
+
+  const SceneBinaryHeader& Header() const { return *header_; }
+
+  size_t NumFrames() const { return header_->num_frames; }
+
+  const SceneBinaryFrame& Frame(const size_t i) const { return frames_[i]; }
+
+  //! Board point ids of a frame, Frame(i).num_obs entries
+  const int32_t* FrameIds(const size_t i) const {
+    return ids_ + frames_[i].first_obs;
+  }
+
+  //! Interleaved corners of a frame, 2 * Frame(i).num_obs entries
+  const double* FrameXY(const size_t i) const {
+    return xy_ + 2 * frames_[i].first_obs;
+  }
+
+  size_t NumScenePoints() const { return header_->num_scene_pts; }
+
+  const int32_t* ScenePointIds() const { return scene_pt_ids_; }
+
+  const double* ScenePointsXYZ() const { return scene_pts_xyz_; }
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+
+  const SceneBinaryHeader* header_ = nullptr;
+  const SceneBinaryFrame* frames_ = nullptr;
+  const int32_t* ids_ = nullptr;
+  const double* xy_ = nullptr;
+  const int32_t* scene_pt_ids_ = nullptr;
+  const double* scene_pts_xyz_ = nullptr;
+};
+
+//! Reads a scene file. Binary scene files are detected and converted to
+//! the same json layout as the UBJSON files.
 bool read_scene_bson(const std::string& input_bson, nlohmann::json& scene_json);
 
+//! Returns true if the file starts with the binary scene magic
+bool is_binary_scene(const std::string& input_path);
+
+bool read_scene_binary(const std::string& input_path,
+                       nlohmann::json& scene_json);
+
+//! Returns true if the file starts with the compact scene magic
+bool is_compact_scene(const std::string& input_path);
+
+bool read_scene_compact(const std::string& input_path,
+                        nlohmann::json& scene_json);
+
 void scene_points_to_calib_dataset(const nlohmann::json& json,
                                    theia::Reconstruction& reconstruction);
 
+//! Adds the board points of a binary scene as tracks
+void scene_points_to_calib_dataset(const MappedScene& scene,
+                                   theia::Reconstruction& reconstruction);
+
+//! Adds the board points as tracks and all views with their corners, see
+//! ReconstructionBuilder. The views have default cameras.
+void scene_to_calib_dataset(const nlohmann::json& json,
+                            theia::Reconstruction& reconstruction);
+void scene_to_calib_dataset(const MappedScene& scene,
+                            theia::Reconstruction& reconstruction);
+
 }  // namespace io
 }  // namespace OpenICC
@@ -15,14 +15,112 @@
 #pragma once
 
 #include <Eigen/Geometry>
+#include <cstdint>
+#include <fstream>
 #include <string>
+#include <vector>
 
 #include "OpenCameraCalibrator/utils/types.h"
 
 namespace OpenICC {
 namespace io {
 
+//! Streams the telemetry json (SAX) into telemetry without building a DOM
 bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
                        CameraTelemetryData& telemetry);
+
+//! Reference implementation that parses the whole file into a json DOM
+bool ReadTelemetryJSONDom(const std::string& path_to_telemetry_file,
+                          CameraTelemetryData& telemetry);
+
+//! Streams a ZED recorder jsonl file line by line. The IMU samples during
+//! the video are kept, with the first one at time zero
+bool ReadZedTelemetryJSONL(const std::string& path_to_telemetry_file,
+                           CameraTelemetryData& telemetry);
+
+//! Streams a csv IMU log with rows t_ns, gyro x, y, z, accl x, y, z. Lines
+//! that do not start with a number, e.g. a header, are skipped
+bool ReadTelemetryCSV(const std::string& path_to_telemetry_file,
+                      CameraTelemetryData& telemetry);
+
+//! Chunked binary telemetry format:
+//! TelemetryBinaryHeader
+//! double img_timestamps_s[num_img_timestamps]
+//! TelemetryBinaryBlock index[num_blocks]
+//! per block: double t_s[n], double accl[3 * n], double gyro[3 * n]
+const char TELEMETRY_BINARY_MAGIC[8] = {'O', 'I', 'C', 'C', 'I', 'M', 'U', '\0'};
+const uint32_t TELEMETRY_BINARY_VERSION = 1;
+
+struct TelemetryBinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t samples_per_block;
+  uint64_t num_samples;
+  uint64_t num_blocks;
+  uint64_t num_img_timestamps;
+};
+
+struct TelemetryBinaryBlock {
+  double t_start_s;
+  double t_end_s;
+  uint64_t offset;
+  uint64_t num_samples;
+};
+
+//! Reads the binary telemetry block by block. Only the block index is kept in
+//! memory, so arbitrary long recordings can be streamed or cut to a window.
+class TelemetryBinaryReader {
+ public:
+  bool Open(const std::string& path);
+
+  size_t NumBlocks() const { return blocks_.size(); }
+
+  size_t NumSamples() const { return header_.num_samples; }
+
+  const TelemetryBinaryBlock& Block(const size_t i) const { return blocks_[i]; }
+
+  const std::vector<double>& ImageTimestamps() const {
+    return img_timestamps_s_;
+  }
+
+  //! Appends all samples of block i
+  bool ReadBlock(const size_t i, CameraTelemetryData& telemetry);
+
+  //! Appends all samples with t_start_s <= t < t_end_s. Only the blocks
+  //! overlapping the window are read from disk.
+  bool ReadTimeWindow(const double t_start_s,
+                      const double t_end_s,
+                      CameraTelemetryData& telemetry);
+
+ private:
+  bool ReadBlockSamples(const size_t i,
+                        std::vector<double>& t_s,
+                        std::vector<double>& accl,
+                        std::vector<double>& gyro);
+
+  std::ifstream file_;
+  TelemetryBinaryHeader header_;
+  std::vector<TelemetryBinaryBlock> blocks_;
+  std::vector<double> img_timestamps_s_;
+};
+
+//! Returns true if the file starts with the binary telemetry magic
+bool IsBinaryTelemetry(const std::string& path_to_telemetry_file);
+
+//! Reads a complete binary telemetry file
+bool ReadTelemetryBinary(const std::string& path_to_telemetry_file,
+                         CameraTelemetryData& telemetry);
+
+//! Reads binary, GoPro MP4 or MCAP telemetry depending on the file content,
+//! ZED jsonl and csv depending on the extension and json otherwise
+bool ReadTelemetry(const std::string& path_to_telemetry_file,
+                   CameraTelemetryData& telemetry);
+
+//! Reads per frame timestamps of a video, from a .txt file with one
+//! timestamp in ns per line or from the image timestamps of any telemetry
+//! format ReadTelemetry reads (e.g. img_timestamps_ns of the json)
+bool ReadFrameTimestamps(const std::string& path_to_timestamps,
+                         std::vector<double>& timestamps_s);
+
 }  // namespace io
 }  // namespace OpenICC
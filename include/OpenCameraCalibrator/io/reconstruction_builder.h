@@ -0,0 +1,93 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "theia/sfm/reconstruction.h"
+
+#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace io {
+
+//! Builds a theia::Reconstruction from scene data in one pass. Board points,
+//! views and corners are first staged in flat arrays that are reserved up
+//! front. Build then adds all tracks and afterwards every view with its
+//! corners, so no json values or strings are created per corner and no
+//! observation refers to a track that is not there yet.
+class ReconstructionBuilder {
+ public:
+  void Reserve(const size_t num_tracks,
+               const size_t num_views,
+               const size_t num_observations);
+
+  //! Homogeneous board point
+  void AddTrack(const theia::TrackId track_id, const Eigen::Vector4d& point);
+
+  //! Starts a view, the following AddObservation calls add its corners.
+  //! Returns the index of the view, see Build
+  size_t AddView(const std::string& name,
+                 const double timestamp_s,
+                 const theia::CameraIntrinsicsGroupId group_id = 0);
+
+  //! Adds a corner with identity covariance to the last view
+  void AddObservation(const theia::TrackId track_id,
+                      const double x,
+                      const double y);
+
+  //! Board points of a scene
+  void AddScenePoints(const nlohmann::json& scene_json);
+  void AddScenePoints(const MappedScene& scene);
+
+  //! All views of a scene with their corners. The views are named by their
+  //! timestamp in us, their timestamps are shifted by t_offset_s
+  void AddSceneViews(const nlohmann::json& scene_json,
+                     const double t_offset_s = 0.0);
+  void AddSceneViews(const MappedScene& scene, const double t_offset_s = 0.0);
+
+  size_t NumViews() const { return views_.size(); }
+
+  //! Adds the staged tracks, views and corners to reconstruction and clears
+  //! the builder. (*view_ids)[i] is the id of view i, kInvalidViewId if a
+  //! view with that name existed already.
+  void Build(theia::Reconstruction& reconstruction,
+             std::vector<theia::ViewId>* view_ids = nullptr);
+
+ private:
+  struct StagedView {
+    std::string name;
+    double timestamp_s;
+    theia::CameraIntrinsicsGroupId group_id;
+    //! first corner of the view in obs_track_ids_
+    size_t first_obs;
+  };
+
+  std::vector<theia::TrackId> track_ids_;
+  //! 4 coordinates per track
+  std::vector<double> track_points_;
+
+  std::vector<StagedView> views_;
+  std::vector<theia::TrackId> obs_track_ids_;
+  //! x and y per corner
+  std::vector<double> obs_xy_;
+};
+
+}  // namespace io
+}  // namespace OpenICC
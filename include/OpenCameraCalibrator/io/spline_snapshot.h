@@ -0,0 +1,64 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "OpenCameraCalibrator/core/spline_snapshot.h"
+
+namespace OpenICC {
+namespace io {
+
+//! Binary spline snapshot format:
+//! SplineSnapshotHeader
+//! double so3_knots[4 * num_so3_knots] (quaternion x, y, z, w)
+//! double r3_knots[3 * num_r3_knots]
+//! double accl_bias_knots[3 * num_accl_bias_knots]
+//! double gyro_bias_knots[3 * num_gyro_bias_knots]
+const char SPLINE_SNAPSHOT_MAGIC[8] = {'O', 'I', 'C', 'C', 'S', 'P', 'L', '\0'};
+const uint32_t SPLINE_SNAPSHOT_VERSION = 1;
+
+struct SplineSnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t spline_order;
+  int64_t start_t_ns;
+  int64_t end_t_ns;
+  int64_t dt_so3_ns;
+  int64_t dt_r3_ns;
+  int64_t dt_accl_bias_ns;
+  int64_t dt_gyro_bias_ns;
+  uint64_t num_so3_knots;
+  uint64_t num_r3_knots;
+  uint64_t num_accl_bias_knots;
+  uint64_t num_gyro_bias_knots;
+  //! Sophus::SE3d parameters (quaternion x, y, z, w, translation)
+  double T_i_c[7];
+  double gravity[3];
+  double accl_intrinsics[6];
+  double gyro_intrinsics[9];
+  double line_delay_s;
+};
+
+bool WriteSplineSnapshot(const std::string& output_file,
+                         const core::SplineSnapshot& snapshot);
+
+bool ReadSplineSnapshot(const std::string& path_to_snapshot,
+                        core::SplineSnapshot& snapshot);
+
+}  // namespace io
+}  // namespace OpenICC
@@ -0,0 +1,152 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <OpenCameraCalibrator/utils/json.h>
+#include <OpenCameraCalibrator/utils/types.h>
+
+namespace OpenICC {
+namespace io {
+
+//! Extension that selects the binary scene format in CreateSceneWriter
+const std::string SCENE_BINARY_EXTENSION = ".scene";
+//! Extension that selects the compact scene format in CreateSceneWriter
+const std::string SCENE_COMPACT_EXTENSION = ".cscene";
+
+//! Interface for writing extracted corners view by view
+class SceneWriter {
+ public:
+  virtual ~SceneWriter() {}
+
+  //! Opens the output file
+  virtual bool Open(const std::string& save_path) = 0;
+
+  //! Appends the corners of one view. Views without corners are skipped.
+  virtual void AddView(const double timestamp_us,
+                       const aligned_vector<Eigen::Vector2d>& corners,
+                       const std::vector<int>& ids) = 0;
+
+  //! Writes the header fields (image size, fps, board points) and closes
+  //! the file
+  virtual bool Close(const nlohmann::json& header) = 0;
+
+  size_t NumViews() const { return num_views_; }
+
+ protected:
+  size_t num_views_ = 0;
+};
+
+//! Writes a scene UBJSON file incrementally. Every view is serialized as soon
+//! as it is added, the remaining fields (image size, fps, board points) are
+//! written as trailer on Close(). The file can be read with read_scene_bson.
+class SceneBsonWriter : public SceneWriter {
+ public:
+  SceneBsonWriter() {}
+
+  ~SceneBsonWriter();
+
+  bool Open(const std::string& save_path) override;
+
+  void AddView(const double timestamp_us,
+               const aligned_vector<Eigen::Vector2d>& corners,
+               const std::vector<int>& ids) override;
+
+  bool Close(const nlohmann::json& header) override;
+
+ private:
+  void WriteKey(const std::string& key);
+
+  std::ofstream out_;
+};
+
+//! Writes the columnar binary scene format (see io::MappedScene). The
+//! observations are kept in flat arrays and written on Close().
+class SceneBinaryWriter : public SceneWriter {
+ public:
+  SceneBinaryWriter() {}
+
+  bool Open(const std::string& save_path) override;
+
+  void AddView(const double timestamp_us,
+               const aligned_vector<Eigen::Vector2d>& corners,
+               const std::vector<int>& ids) override;
+
+  bool Close(const nlohmann::json& header) override;
+
+ protected:
+  std::string save_path_;
+
+  std::vector<double> timestamps_us_;
+  std::vector<uint64_t> first_obs_;
+  std::vector<int32_t> ids_;
+  std::vector<double> xy_;
+};
+
+//! Writes the compact scene format (see SCENE_COMPACT_MAGIC in
+//! read_scene.h). The corners are quantized to 1 / SCENE_COMPACT_SUBPIXEL px
+//! and the ids of a view are written in sorted order.
+class SceneCompactWriter : public SceneBinaryWriter {
+ public:
+  SceneCompactWriter() {}
+
+  bool Close(const nlohmann::json& header) override;
+};
+
+//! Collects the scene in memory as the json read_scene_bson returns, so
+//! the next stage can use it without a file round trip. If save_path is not
+//! empty, the scene is also written to it as checkpoint, in the format
+//! CreateSceneWriter selects.
+class SceneMemoryWriter : public SceneWriter {
+ public:
+  SceneMemoryWriter() {}
+
+  bool Open(const std::string& save_path) override;
+
+  void AddView(const double timestamp_us,
+               const aligned_vector<Eigen::Vector2d>& corners,
+               const std::vector<int>& ids) override;
+
+  bool Close(const nlohmann::json& header) override;
+
+  //! Scene json, complete after Close
+  const nlohmann::json& Scene() const { return scene_; }
+
+ private:
+  nlohmann::json scene_;
+
+  //! checkpoint writer, can be empty
+  std::unique_ptr<SceneWriter> file_writer_;
+};
+
+//! Binary writer if save_path ends with SCENE_BINARY_EXTENSION, compact
+//! writer for SCENE_COMPACT_EXTENSION, UBJSON otherwise
+std::unique_ptr<SceneWriter> CreateSceneWriter(const std::string& save_path);
+
+//! Merges scenes of one input that were extracted in disjoint time ranges
+//! (see core::BoardExtractor::SetTimeRange) into save_path. The views are
+//! written in time order, so the result is the same as a single extraction.
+//! The header fields have to agree, shards without views may miss the
+//! image size.
+bool MergeSceneFiles(const std::vector<std::string>& input_paths,
+                     const std::string& save_path);
+
+}  // namespace io
+}  // namespace OpenICC
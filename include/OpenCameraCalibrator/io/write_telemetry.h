@@ -0,0 +1,38 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace io {
+
+//! Writes telemetry in the chunked binary format (see read_telemetry.h).
+//! Accelerometer and gyroscope have to share the same timestamps.
+bool WriteTelemetryBinary(const std::string& output_file,
+                          const CameraTelemetryData& telemetry,
+                          const uint32_t samples_per_block = 4096);
+
+//! Writes telemetry as json that can be read with ReadTelemetryJSON. The
+//! samples are streamed to the file, so no json DOM is built. Accelerometer
+//! and gyroscope have to share the same timestamps.
+bool WriteTelemetryJSON(const std::string& output_file,
+                        const CameraTelemetryData& telemetry);
+
+}  // namespace io
+}  // namespace OpenICC
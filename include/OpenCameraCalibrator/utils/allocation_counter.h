@@ -0,0 +1,82 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+// Heap allocation counts of the calling thread, for checking that hot paths
+// do not allocate in steady state (cmake -DBUILD_WITH_ALLOCATION_COUNTING=ON).
+// With OPENICC_COUNT_ALLOCATIONS the library replaces the global operator new
+// and delete by versions that count calls and requested bytes in thread local
+// counters before forwarding to malloc. Memory that is allocated with malloc
+// directly, e.g. cv::Mat buffers or dynamic Eigen matrices, is not counted.
+// Without the define the counts stay zero.
+
+#include <cstddef>
+
+namespace OpenICC {
+namespace utils {
+
+//! Number of operator new calls and the bytes they requested
+struct AllocationCount {
+  size_t allocations = 0;
+  size_t bytes = 0;
+};
+
+//! True if the build counts allocations
+constexpr bool AllocationCountingEnabled() {
+#ifdef OPENICC_COUNT_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+
+//! Allocations of the calling thread since it started
+AllocationCount ThreadAllocations();
+
+//! Allocations of the calling thread since construction. Allocations of
+//! worker threads started inside the scope are not included.
+class ScopedAllocationCounter {
+ public:
+  ScopedAllocationCounter() : start_(ThreadAllocations()) {}
+
+  AllocationCount Count() const {
+    const AllocationCount now = ThreadAllocations();
+    AllocationCount count;
+    count.allocations = now.allocations - start_.allocations;
+    count.bytes = now.bytes - start_.bytes;
+    return count;
+  }
+
+ private:
+  AllocationCount start_;
+};
+
+//! Allocations of the calling thread are not counted within the scope, e.g.
+//! the bookkeeping of the profiler inside of an outer stage
+class ScopedUncountedAllocations {
+ public:
+  ScopedUncountedAllocations();
+  ~ScopedUncountedAllocations();
+
+  ScopedUncountedAllocations(const ScopedUncountedAllocations&) = delete;
+  ScopedUncountedAllocations& operator=(const ScopedUncountedAllocations&) =
+      delete;
+
+ private:
+  bool was_counting_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
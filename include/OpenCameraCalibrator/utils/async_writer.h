@@ -0,0 +1,75 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/bounded_queue.h"
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Writes outputs on background threads, so that an application can go on
+//! while large results are serialized. Every write goes to path + ".tmp"
+//! first and is renamed on success, so readers never see partial files.
+//! Wait joins all writers, the destructor waits as well.
+class AsyncWriter {
+ public:
+  //! Writes the output to the given path, returns false on failure
+  using WriteFunction = std::function<bool(const std::string& path)>;
+
+  //! num_threads writers run concurrently, 0 writes on the calling thread
+  explicit AsyncWriter(const int num_threads = 1);
+
+  ~AsyncWriter();
+
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  //! Queues a write to path. Everything write uses has to outlive Wait, so
+  //! move large data into the function. Blocks while too many writes are
+  //! pending and writes on the calling thread after Wait.
+  void Submit(const std::string& path, WriteFunction write);
+
+  //! Streams json to path with the given indentation
+  void SubmitJson(const std::string& path,
+                  nlohmann::json json,
+                  const int indent = 4);
+
+  //! Waits for all queued writes, returns false if any of them failed
+  bool Wait();
+
+ private:
+  struct Job {
+    std::string path;
+    WriteFunction write;
+  };
+
+  void Run(Job& job);
+
+  BoundedQueue<Job> jobs_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> success_{true};
+  std::mutex mutex_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
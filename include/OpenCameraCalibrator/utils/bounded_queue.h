@@ -0,0 +1,99 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Blocking multi producer / multi consumer queue with a fixed capacity.
+//! Push blocks while the queue is full, Pop blocks while it is empty.
+//! After Close() all pending items can still be popped.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(const size_t capacity)
+      : capacity_(capacity > 0 ? capacity : 1) {}
+
+  //! Returns false if the queue was closed before the item could be pushed
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_ && queue_.size() >= capacity_) {
+      OPENICC_TRACE_ZONE("queue_wait_full");
+      not_full_.wait(lock,
+                     [this] { return closed_ || queue_.size() < capacity_; });
+    }
+    if (closed_) return false;
+    queue_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  //! Returns false if the queue is closed and empty
+  bool Pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_ && queue_.empty()) {
+      OPENICC_TRACE_ZONE("queue_wait_empty");
+      not_empty_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+    }
+    if (queue_.empty()) return false;
+    item = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  //! Like Push, but returns false instead of blocking if the queue is full
+  bool TryPush(T item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_ || queue_.size() >= capacity_) return false;
+    queue_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  //! Like Pop, but returns false instead of blocking if the queue is empty
+  bool TryPop(T& item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queue_.empty()) return false;
+    item = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+  bool closed_ = false;
+  std::deque<T> queue_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,62 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+namespace OpenICC {
+namespace utils {
+
+//! Periodic checkpoints of a long running job, e.g. so that a preempted job
+//! resumes instead of starting over. Write goes through a temporary file
+//! that is renamed into place, so an interrupted write keeps the previous
+//! checkpoint intact.
+class Checkpointer {
+ public:
+  //! An empty path disables the checkpoints
+  explicit Checkpointer(const std::string& path = "",
+                        const double interval_s = 300.0);
+
+  bool Enabled() const { return !path_.empty(); }
+
+  const std::string& Path() const { return path_; }
+
+  //! True if a checkpoint exists at Path()
+  bool Exists() const;
+
+  //! True if enabled and interval_s passed since the construction or the
+  //! last Write
+  bool Due() const;
+
+  //! Calls write with a temporary path and renames the file to Path().
+  //! Restarts the interval. False if disabled or writing failed, the
+  //! previous checkpoint is then kept.
+  bool Write(const std::function<bool(const std::string&)>& write);
+
+  //! Removes the checkpoint, e.g. once the job finished
+  void Remove() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  std::string path_;
+  double interval_s_;
+  Clock::time_point last_write_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
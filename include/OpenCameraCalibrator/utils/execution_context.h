@@ -0,0 +1,82 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Process wide execution settings, see ExecutionContext::Configure
+struct ExecutionContextOptions {
+  //! threads of all parallel stages, 0 uses every CPU the process may run on
+  int num_threads = 0;
+  //! CPUs the process is pinned to, e.g. from ParseCpuList. Empty keeps the
+  //! inherited affinity
+  std::vector<int> cpus;
+  //! NUMA node whose CPUs the process is pinned to, -1 for none. Combined
+  //! with cpus the process runs on the CPUs of both. Memory is not bound,
+  //! but first touch allocation on the pinned CPUs keeps it on the node
+  int numa_node = -1;
+  //! Reproduce a run bit for bit, independent of the thread count. The
+  //! parallel stages merge and reduce in a fixed order, the board ROI
+  //! tracking is disabled and the Ceres solves evaluate on one thread
+  bool deterministic = false;
+};
+
+//! Thread budget and CPU affinity shared by OpenCV, Ceres, Theia and our
+//! own parallel stages. Configure it once at the start of main, before any
+//! thread is started, so all threads inherit the affinity. Several
+//! calibrations on one machine then stay on their own CPUs instead of each
+//! using every hardware thread.
+class ExecutionContext {
+ public:
+  //! Pins the process, sets the OpenCV thread pool and the thread count
+  //! returned by NumThreads. False if the affinity could not be set, the
+  //! thread count is configured anyway
+  static bool Configure(const ExecutionContextOptions& options);
+
+  //! Configured thread count, or all hardware threads if Configure was not
+  //! called. Default of the Ceres and Theia solver threads and upper bound
+  //! of ParallelFor
+  static int NumThreads();
+
+  //! True if the options requested a deterministic run
+  static bool Deterministic();
+
+  //! Threads of a Ceres solve that requested num_threads. Ceres sums the
+  //! cost and gradient per thread in a scheduling dependent order, so a
+  //! deterministic run solves on one thread
+  static int SolverThreads(const int num_threads);
+
+  //! CPUs of the configured affinity, empty if Configure did not pin the
+  //! process
+  static std::vector<int> Cpus();
+};
+
+//! Parses a CPU list like "0-3,8,10-11", the format of
+//! /sys/devices/system/node/node*/cpulist. False if it is malformed
+bool ParseCpuList(const std::string& cpu_list, std::vector<int>& cpus);
+
+//! Configure from the command line settings of the applications. An empty
+//! cpu_list keeps the inherited affinity
+bool ConfigureExecutionContext(const int num_threads,
+                               const std::string& cpu_list,
+                               const int numa_node,
+                               const bool deterministic = false);
+
+}  // namespace utils
+}  // namespace OpenICC
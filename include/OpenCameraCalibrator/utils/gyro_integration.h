@@ -34,9 +34,12 @@
 #include <ceres/rotation.h>
 
 #include "OpenCameraCalibrator/utils/imu_data_interval.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
+#include <cmath>
 #include <iostream>
+#include <vector>
 
 namespace OpenICC {
 namespace utils {
@@ -139,6 +142,53 @@ inline void QuatIntegrationStepRK4(const _T quat[4],
   quat_res[3] = m_quat_res(3);
 }
 
+/** @brief Closed form integration step for a rotational velocity that changes
+ *         linearly from omega0 to omega1, without building skew matrices.
+ *
+ * The rotation vector of the step is the mean velocity times dt plus the
+ * coning term dt^2 / 12 * omega0 x omega1, which agrees with
+ * QuatIntegrationStepRK4() up to higher order terms in dt. The increment is
+ * applied as quat * exp(theta / 2), like skew(omega) * quat in
+ * ComputeOmegaSkew(). The result is not normalized: it only drifts by
+ * rounding errors, so normalize once after a sequence of steps.
+ *
+ * @param quat The input Eigen 4D vector representing the initial rotation
+ * @param omega0 Initial rotational velocity at time t0
+ * @param omega1 Final rotational velocity at time t1
+ * @param dt Time step (t1 - t0).
+ * @param[out] quat_res Resulting final rotation, may alias quat
+ */
+template <typename _T>
+inline void QuatIntegrationStepClosedForm(const Eigen::Matrix<_T, 4, 1>& quat,
+                                          const Eigen::Matrix<_T, 3, 1>& omega0,
+                                          const Eigen::Matrix<_T, 3, 1>& omega1,
+                                          const _T& dt,
+                                          Eigen::Matrix<_T, 4, 1>& quat_res) {
+  using std::cos;
+  using std::sin;
+  using std::sqrt;
+  const Eigen::Matrix<_T, 3, 1> theta =
+      _T(0.5) * dt * (omega0 + omega1) +
+      (dt * dt / _T(12.0)) * omega0.cross(omega1);
+  const _T theta2 = theta.squaredNorm();
+  // dq = [cos(|theta| / 2), sin(|theta| / 2) / |theta| * theta]
+  _T c, s;
+  if (theta2 > _T(1e-12)) {
+    const _T norm = sqrt(theta2);
+    c = cos(_T(0.5) * norm);
+    s = sin(_T(0.5) * norm) / norm;
+  } else {
+    c = _T(1.0) - theta2 / _T(8.0);
+    s = _T(0.5) - theta2 / _T(48.0);
+  }
+  const Eigen::Matrix<_T, 3, 1> v = s * theta;
+  const _T w0 = quat(0), x0 = quat(1), y0 = quat(2), z0 = quat(3);
+  quat_res(0) = w0 * c - x0 * v(0) - y0 * v(1) - z0 * v(2);
+  quat_res(1) = w0 * v(0) + x0 * c + y0 * v(2) - z0 * v(1);
+  quat_res(2) = w0 * v(1) - x0 * v(2) + y0 * c + z0 * v(0);
+  quat_res(3) = w0 * v(2) + x0 * v(1) - y0 * v(0) + z0 * c;
+}
+
 /** @brief Integrate a sequence of rotational velocities using the RK4
  *         Runge-Kutta discrete integration method. The initial rotation is
  * assumed to be the identity quaternion.
@@ -202,5 +252,228 @@ void IntegrateGyroInterval(const std::vector<ImuReading<_T>>& gyro_samples,
   ceres::QuaternionToRotation(quat_res.data(), rot_mat);
 }
 
+/** @brief Calibrate a sequence of raw rotational velocities and integrate it
+ *         like IntegrateGyroInterval(), fused in a single loop that does not
+ *         store the calibrated signal. The initial rotation is assumed to be
+ *         the identity quaternion.
+ *
+ * @param gyro_samples Input raw gyroscope signal
+ * @param calib Calibration applied to every sample, i.e. T*K*(X - B)
+ * @param interval Data interval where to compute the integration. If this
+ * interval is not valid, i.e., one of the two indices is -1, the integration is
+ * computed for the whole data sequence.
+ * @param data_dt Fixed time step (t1 - t0) between samples. If less or equal
+ * than 0, the sample timestamps are used instead.
+ * @param[out] quat_res Resulting final rotation quaternion
+ */
+template <typename _T>
+void IntegrateCalibratedGyroInterval(
+    const ImuReadings& gyro_samples,
+    const ThreeAxisSensorCalibParams<_T>& calib,
+    const DataInterval& interval,
+    const double data_dt,
+    Eigen::Matrix<_T, 4, 1>& quat_res) {
+  const DataInterval rev_interval = CheckInterval(gyro_samples, interval);
+
+  quat_res = Eigen::Matrix<_T, 4, 1>(_T(1.0),
+                                     _T(0),
+                                     _T(0),
+                                     _T(0));  // Identity quaternion
+  if (rev_interval.start_idx >= rev_interval.end_idx) return;
+
+  Eigen::Matrix<_T, 3, 1> omega0 = calib.UnbiasNormalize(
+      gyro_samples[rev_interval.start_idx].data().template cast<_T>());
+  for (int i = rev_interval.start_idx; i < rev_interval.end_idx; i++) {
+    const Eigen::Matrix<_T, 3, 1> omega1 = calib.UnbiasNormalize(
+        gyro_samples[i + 1].data().template cast<_T>());
+    const double dt = (data_dt > 0.0) ? data_dt
+                                      : gyro_samples[i + 1].timestamp_s() -
+                                            gyro_samples[i].timestamp_s();
+    QuatIntegrationStepRK4(quat_res, omega0, omega1, _T(dt), quat_res);
+    omega0 = omega1;
+  }
+}
+
+/** @brief IntegrateCalibratedGyroInterval() with the closed form step of
+ *         QuatIntegrationStepClosedForm(). The samples are calibrated into a
+ *         contiguous buffer first, so both loops are tight and work with
+ *         ceres jets as well.
+ */
+template <typename _T>
+void IntegrateCalibratedGyroIntervalClosedForm(
+    const ImuReadings& gyro_samples,
+    const ThreeAxisSensorCalibParams<_T>& calib,
+    const DataInterval& interval,
+    const double data_dt,
+    Eigen::Matrix<_T, 4, 1>& quat_res) {
+  const DataInterval rev_interval = CheckInterval(gyro_samples, interval);
+
+  quat_res = Eigen::Matrix<_T, 4, 1>(_T(1.0),
+                                     _T(0),
+                                     _T(0),
+                                     _T(0));  // Identity quaternion
+  if (rev_interval.start_idx >= rev_interval.end_idx) return;
+
+  const int start = rev_interval.start_idx;
+  const int nr_samples = rev_interval.end_idx - start + 1;
+  std::vector<Eigen::Matrix<_T, 3, 1>,
+              Eigen::aligned_allocator<Eigen::Matrix<_T, 3, 1>>>
+      omega(nr_samples);
+  for (int i = 0; i < nr_samples; ++i) {
+    omega[i] = calib.UnbiasNormalize(
+        gyro_samples[start + i].data().template cast<_T>());
+  }
+  for (int i = 0; i + 1 < nr_samples; ++i) {
+    const double dt = (data_dt > 0.0)
+                          ? data_dt
+                          : gyro_samples[start + i + 1].timestamp_s() -
+                                gyro_samples[start + i].timestamp_s();
+    QuatIntegrationStepClosedForm(
+        quat_res, omega[i], omega[i + 1], _T(dt), quat_res);
+  }
+  NormalizeQuaternion(quat_res);
+}
+
+/** @brief Integrates several intervals of the same gyroscope signal with
+ *         IntegrateCalibratedGyroIntervalClosedForm(), num_threads intervals
+ *         at a time.
+ *
+ * @param[out] quats Resulting rotation of every interval, in order
+ */
+template <typename _T>
+void IntegrateCalibratedGyroIntervals(
+    const ImuReadings& gyro_samples,
+    const ThreeAxisSensorCalibParams<_T>& calib,
+    const std::vector<DataInterval>& intervals,
+    const double data_dt,
+    const int num_threads,
+    std::vector<Eigen::Matrix<_T, 4, 1>,
+                Eigen::aligned_allocator<Eigen::Matrix<_T, 4, 1>>>& quats) {
+  quats.resize(intervals.size());
+  ParallelFor(
+      0, static_cast<int>(intervals.size()), num_threads, [&](const int i) {
+        IntegrateCalibratedGyroIntervalClosedForm(
+            gyro_samples, calib, intervals[i], data_dt, quats[i]);
+      });
+}
+
+/** @brief Derivative of skew(omega) * quat with respect to omega (see
+ * ComputeOmegaSkew()) */
+static inline void ComputeOmegaSkewJacobian(const Eigen::Vector4d& quat,
+                                            Eigen::Matrix<double, 4, 3>& jac) {
+  jac << -quat(1), -quat(2), -quat(3), quat(0), -quat(3), quat(2), quat(3),
+      quat(0), -quat(1), -quat(2), quat(1), quat(0);
+}
+
+/** @brief Calibrate a raw rotational velocity as T*K*(X - B) and compute its
+ * derivative with respect to the 12 calibration parameters, ordered as in the
+ * ThreeAxisSensorCalibParams constructor */
+static inline void CalibrateGyroSample(
+    const ThreeAxisSensorCalibParams<double>& calib,
+    const Eigen::Vector3d& raw,
+    Eigen::Vector3d& omega,
+    Eigen::Matrix<double, 3, 12>& jac) {
+  const Eigen::Matrix3d& mis_mat = calib.GetMisalignmentMatrix();
+  const Eigen::Vector3d unbiased = raw - calib.GetBiasVector();
+  const Eigen::Vector3d scaled =
+      calib.GetScaleMatrix().diagonal().cwiseProduct(unbiased);
+  omega = mis_mat * scaled;
+
+  jac.setZero();
+  // misalignment yz, zy, zx, xz, xy, yx
+  jac(0, 0) = -scaled(1);
+  jac(0, 1) = scaled(2);
+  jac(1, 2) = -scaled(2);
+  jac(1, 3) = scaled(0);
+  jac(2, 4) = -scaled(0);
+  jac(2, 5) = scaled(1);
+  // scale and bias
+  jac.block<3, 3>(0, 6) = mis_mat * unbiased.asDiagonal();
+  jac.block<3, 3>(0, 9) = -mis_mat * calib.GetScaleMatrix();
+}
+
+/** @brief Same as IntegrateCalibratedGyroInterval() above, but additionally
+ *         propagates the derivative of the quaternion through every RK4 step.
+ *
+ * @param[out] quat_jac Derivative of quat_res with respect to the 12
+ * calibration parameters, ordered as in the ThreeAxisSensorCalibParams
+ * constructor
+ */
+inline void IntegrateCalibratedGyroInterval(
+    const ImuReadings& gyro_samples,
+    const ThreeAxisSensorCalibParams<double>& calib,
+    const DataInterval& interval,
+    const double data_dt,
+    Eigen::Vector4d& quat_res,
+    Eigen::Matrix<double, 4, 12>& quat_jac) {
+  using Mat4x12 = Eigen::Matrix<double, 4, 12>;
+  using Mat3x12 = Eigen::Matrix<double, 3, 12>;
+  const DataInterval rev_interval = CheckInterval(gyro_samples, interval);
+
+  quat_res = Eigen::Vector4d(1.0, 0.0, 0.0, 0.0);  // Identity quaternion
+  quat_jac.setZero();
+  if (rev_interval.start_idx >= rev_interval.end_idx) return;
+
+  Eigen::Vector3d omega0, omega1;
+  Mat3x12 omega0_jac, omega1_jac;
+  CalibrateGyroSample(calib,
+                      gyro_samples[rev_interval.start_idx].data(),
+                      omega0,
+                      omega0_jac);
+
+  Eigen::Matrix4d omega_skew;
+  Eigen::Matrix<double, 4, 3> skew_jac;
+  // k = 0.5 * skew(omega) * q, dk = 0.5 * (skew(omega) * dq + d(skew) * domega)
+  auto rk_coefficient = [&](const Eigen::Vector3d& omega,
+                            const Mat3x12& omega_jac,
+                            const Eigen::Vector4d& q,
+                            const Mat4x12& q_jac,
+                            Eigen::Vector4d& k,
+                            Mat4x12& k_jac) {
+    ComputeOmegaSkew(omega, omega_skew);
+    ComputeOmegaSkewJacobian(q, skew_jac);
+    k = 0.5 * omega_skew * q;
+    k_jac.noalias() = 0.5 * omega_skew * q_jac;
+    k_jac.noalias() += 0.5 * skew_jac * omega_jac;
+  };
+
+  Eigen::Vector4d k1, k2, k3, k4, tmp_q;
+  Mat4x12 k1_jac, k2_jac, k3_jac, k4_jac, tmp_q_jac;
+  for (int i = rev_interval.start_idx; i < rev_interval.end_idx; i++) {
+    CalibrateGyroSample(calib, gyro_samples[i + 1].data(), omega1, omega1_jac);
+    const double dt = (data_dt > 0.0) ? data_dt
+                                      : gyro_samples[i + 1].timestamp_s() -
+                                            gyro_samples[i].timestamp_s();
+    const Eigen::Vector3d omega01 = 0.5 * (omega0 + omega1);
+    const Mat3x12 omega01_jac = 0.5 * (omega0_jac + omega1_jac);
+
+    // Same steps as QuatIntegrationStepRK4()
+    rk_coefficient(omega0, omega0_jac, quat_res, quat_jac, k1, k1_jac);
+    tmp_q = quat_res + 0.5 * dt * k1;
+    tmp_q_jac = quat_jac + 0.5 * dt * k1_jac;
+    rk_coefficient(omega01, omega01_jac, tmp_q, tmp_q_jac, k2, k2_jac);
+    tmp_q = quat_res + 0.5 * dt * k2;
+    tmp_q_jac = quat_jac + 0.5 * dt * k2_jac;
+    rk_coefficient(omega01, omega01_jac, tmp_q, tmp_q_jac, k3, k3_jac);
+    tmp_q = quat_res + dt * k3;
+    tmp_q_jac = quat_jac + dt * k3_jac;
+    rk_coefficient(omega1, omega1_jac, tmp_q, tmp_q_jac, k4, k4_jac);
+
+    const double mult1 = dt / 6.0, mult2 = dt / 3.0;
+    tmp_q = quat_res + mult1 * (k1 + k4) + mult2 * (k2 + k3);
+    tmp_q_jac =
+        quat_jac + mult1 * (k1_jac + k4_jac) + mult2 * (k2_jac + k3_jac);
+
+    // normalization
+    const double inv_norm = 1.0 / tmp_q.norm();
+    quat_res = inv_norm * tmp_q;
+    quat_jac.noalias() =
+        inv_norm * (tmp_q_jac - quat_res * (quat_res.transpose() * tmp_q_jac));
+
+    omega0 = omega1;
+    omega0_jac = omega1_jac;
+  }
+}
+
 }  // namespace utils
 }  // namespace OpenICC
@@ -265,5 +265,31 @@ void StaticIntervalsDetector(const ImuReadings& samples,
                              std::vector<DataInterval>& intervals,
                              int win_size = 101);
 
+/**
+ * @brief Compute the local variance magnitude \f$\varsigma(t)\f$ (see
+ * StaticIntervalsDetector()) for each sample of the input signal. Samples
+ * closer than win_size / 2 to the signal borders get infinity.
+ *
+ * @param samples Input 3D signal (e.g, the acceleremeter readings)
+ * @param[out] variance_norms Output variance magnitude per sample
+ * @param win_size Size of the sliding window, at least 11
+ */
+void LocalVarianceMagnitudes(const ImuReadings& samples,
+                             std::vector<double>& variance_norms,
+                             int win_size = 101);
+
+/**
+ * @brief Same as StaticIntervalsDetector() above, but classifies precomputed
+ * variance magnitudes (see LocalVarianceMagnitudes()). Detecting with several
+ * thresholds on the same signal then only costs one pass each.
+ *
+ * @param variance_norms Local variance magnitude per sample
+ * @param threshold Threshold used in the classification
+ * @param[out] intervals  Ouput detected static intervals
+ */
+void StaticIntervalsDetector(const std::vector<double>& variance_norms,
+                             double threshold,
+                             std::vector<DataInterval>& intervals);
+
 }  // namespace utils
 }  // namespace OpenICC
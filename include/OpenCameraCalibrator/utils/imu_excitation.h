@@ -0,0 +1,51 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Thresholds of SelectExcitedSegments
+struct ExcitationOptions {
+  //! length of the scored windows in seconds
+  double window_s = 1.0;
+  //! a window is excited if the RMS of the angular rate or the standard
+  //! deviation of the specific force reaches these values
+  double min_gyro_rms_rad_s = 0.3;
+  double min_accl_std_m_s2 = 0.5;
+  //! shorter excited segments are dropped
+  double min_segment_s = 2.0;
+  //! excited segments are extended by this much on both sides, so the
+  //! motion onset is kept
+  double padding_s = 0.5;
+};
+
+//! Scores windows of the IMU signal by rotational (gyro RMS) and
+//! translational (accelerometer standard deviation) excitation and returns
+//! the merged [start, end] times of the excited ones. timestamps_s has to
+//! be sorted, gyro and accl are sampled at these times.
+std::vector<std::pair<double, double>> SelectExcitedSegments(
+    const std::vector<double>& timestamps_s,
+    const vec3_vector& gyro,
+    const vec3_vector& accl,
+    const ExcitationOptions& options = ExcitationOptions());
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,86 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Options of SanitizeImuTimestamps and SanitizeImuTelemetry
+struct ImuTimingOptions {
+  //! sample intervals longer than gap_factor times the nominal period are
+  //! gaps, de-jittering fits every segment between two gaps separately
+  double gap_factor = 3.0;
+  //! replace the timestamps of every gap free segment by the least squares
+  //! fit of a constant rate clock
+  bool dejitter = true;
+  //! segments whose fit would move a timestamp by more than this fraction of
+  //! the nominal period keep their timestamps, e.g. if the rate changes
+  double max_correction_factor = 0.5;
+  //! resample the streams onto a uniform grid (SanitizeImuTelemetry)
+  bool resample = false;
+  //! spacing of the grid, <= 0 uses the nominal gyroscope period
+  double resample_period_s = 0.0;
+};
+
+//! Timing statistics of one IMU stream
+struct ImuTimingReport {
+  //! median sample interval
+  double nominal_period_s = 0.0;
+  double max_interval_s = 0.0;
+  //! RMS of the timestamp corrections applied by the de-jittering
+  double jitter_rms_s = 0.0;
+  //! samples dropped because their timestamp was out of order or repeated
+  size_t num_dropped = 0;
+  //! gap free segments that kept their timestamps, see max_correction_factor
+  size_t num_segments_not_dejittered = 0;
+  //! [start, end] timestamps of the gaps
+  std::vector<std::pair<double, double>> gaps;
+};
+
+//! Median interval between consecutive samples, 0 for less than 2 samples
+double NominalSamplePeriod(const ImuReadings& samples);
+
+//! Sorts the samples by time, drops repeated timestamps, detects gaps and
+//! de-jitters the timestamps in place. Returns false for less than 2
+//! samples.
+bool SanitizeImuTimestamps(const ImuTimingOptions& options,
+                           ImuReadings& samples,
+                           ImuTimingReport& report);
+
+//! Linearly interpolates the sorted samples at t_start_s + i * period_s for
+//! all grid times up to t_end_s. Intervals are interpolated across gaps, so
+//! check the report of the stream first.
+void ResampleImuUniform(const ImuReadings& samples,
+                        const double t_start_s,
+                        const double t_end_s,
+                        const double period_s,
+                        ImuReadings& resampled);
+
+//! Sanitizes the gyroscope and accelerometer of the telemetry. With
+//! options.resample both are resampled onto the same grid over their common
+//! time range and period_s is its spacing, otherwise the nominal gyroscope
+//! period. The reports are logged. Returns false if a stream has less than 2
+//! samples or the streams do not overlap.
+bool SanitizeImuTelemetry(const ImuTimingOptions& options,
+                          CameraTelemetryData& telemetry,
+                          double& period_s);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -40,6 +40,18 @@ bool initialize_pinhole_camera(
     double& focal_length,
     const bool verbose = false);
 
+//! Focal length and pose of a planar board (z = 0) from its homography,
+//! without RANSAC. The features have to be centered on the principal point.
+//! Fails if the board is seen fronto-parallel or if the pose does not
+//! explain the correspondences within error_thresh pixels.
+bool initialize_pinhole_camera_planar(
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences,
+    const double error_thresh,
+    Eigen::Matrix3d& rotation,
+    Eigen::Vector3d& position,
+    double& focal_length,
+    const bool verbose = false);
+
 bool initialize_radial_undistortion_camera(
     const std::vector<theia::FeatureCorrespondence2D3D>& correspondences,
     const theia::RansacParameters& ransac_params,
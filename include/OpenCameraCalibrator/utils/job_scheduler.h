@@ -0,0 +1,78 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Runs a DAG of jobs on a shared thread budget. Every job requests a number
+//! of threads and is started as soon as its dependencies finished
+//! successfully and enough of the budget is free, so independent jobs run
+//! concurrently. Jobs of failed dependencies are not run and fail as well.
+class JobScheduler {
+ public:
+  //! Work of a job. Gets the number of threads granted to it and returns
+  //! false on failure
+  using JobFunction = std::function<bool(const int num_threads)>;
+
+  //! Adds a job and returns its id. dependencies are ids of jobs that were
+  //! added before. Requests above the budget of Run are clamped to it.
+  int AddJob(const std::string& name,
+             const int num_threads,
+             const JobFunction& fn,
+             const std::vector<int>& dependencies = {});
+
+  //! Runs all jobs with at most thread_budget threads in use. Jobs are
+  //! started in the order they were added, later jobs that fit into the
+  //! remaining budget are started ahead of a job that does not. Returns
+  //! true if all jobs succeeded.
+  bool Run(const int thread_budget);
+
+  size_t NumJobs() const { return jobs_.size(); }
+
+  //! True if the job ran and succeeded
+  bool Succeeded(const int job_id) const {
+    return jobs_[job_id].state == JobState::SUCCEEDED;
+  }
+
+  //! Wall time of a finished job in seconds
+  double JobTime(const int job_id) const { return jobs_[job_id].time_s; }
+
+  const std::string& JobName(const int job_id) const {
+    return jobs_[job_id].name;
+  }
+
+ private:
+  enum class JobState { WAITING, RUNNING, SUCCEEDED, FAILED, SKIPPED };
+
+  struct Job {
+    std::string name;
+    int num_threads = 1;
+    JobFunction fn;
+    std::vector<int> dependencies;
+    JobState state = JobState::WAITING;
+    double time_s = 0.0;
+  };
+
+  std::vector<Job> jobs_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
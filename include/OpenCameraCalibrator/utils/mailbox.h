@@ -0,0 +1,71 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Single slot mailbox that only keeps the latest value. Post never blocks
+//! and replaces a value that was not taken yet, Take blocks until a new value
+//! was posted. Both swap the value with the slot, so the caller gets back an
+//! old value whose buffers can be reused.
+template <typename T>
+class Mailbox {
+ public:
+  //! Swaps item into the slot, dropping a value that was not taken
+  void Post(T& item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    using std::swap;
+    swap(slot_, item);
+    has_value_ = true;
+    not_empty_.notify_one();
+  }
+
+  //! Returns false if the mailbox is closed and holds no new value
+  bool Take(T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_ && !has_value_) {
+      OPENICC_TRACE_ZONE("mailbox_wait");
+      not_empty_.wait(lock, [this] { return closed_ || has_value_; });
+    }
+    if (!has_value_) return false;
+    using std::swap;
+    swap(slot_, item);
+    has_value_ = false;
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  T slot_;
+  bool has_value_ = false;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,129 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Bump allocator for many small objects that die together, e.g. the cost
+//! functions of a ceres::Problem. Objects are placed back to back in large
+//! chunks and destroyed in reverse order by Clear, which keeps the chunks for
+//! the next batch. Create and Adopt are thread safe.
+class MonotonicArena {
+ public:
+  explicit MonotonicArena(const size_t chunk_bytes = size_t(1) << 20)
+      : chunk_bytes_(chunk_bytes) {}
+  ~MonotonicArena() { Clear(); }
+
+  MonotonicArena(const MonotonicArena&) = delete;
+  MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+  //! Constructs a T in the arena, it lives until the next Clear
+  template <class T, class... Args>
+  T* Create(Args&&... args) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    T* object = new (Allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      destructors_.emplace_back(object,
+                                [](void* p) { static_cast<T*>(p)->~T(); });
+    }
+    return object;
+  }
+
+  //! Takes ownership of a heap allocated object, deleted by the next Clear
+  template <class T>
+  T* Adopt(T* object) {
+    if (!object) return object;
+    std::lock_guard<std::mutex> lock(mutex_);
+    destructors_.emplace_back(object,
+                              [](void* p) { delete static_cast<T*>(p); });
+    return object;
+  }
+
+  //! Destroys all objects, the memory is reused by the following allocations
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = destructors_.rbegin(); it != destructors_.rend(); ++it) {
+      it->second(it->first);
+    }
+    destructors_.clear();
+    current_ = 0;
+    offset_ = 0;
+    bytes_used_ = 0;
+  }
+
+  size_t BytesUsed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_used_;
+  }
+
+  size_t BytesReserved() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t bytes = 0;
+    for (const Chunk& chunk : chunks_) bytes += chunk.size;
+    return bytes;
+  }
+
+ private:
+  struct Chunk {
+    std::unique_ptr<unsigned char[]> data;
+    size_t size;
+  };
+
+  void* Allocate(const size_t size, const size_t alignment) {
+    while (current_ < chunks_.size()) {
+      Chunk& chunk = chunks_[current_];
+      void* p = chunk.data.get() + offset_;
+      size_t space = chunk.size - offset_;
+      if (std::align(alignment, size, p, space)) {
+        offset_ = chunk.size - space + size;
+        bytes_used_ += size;
+        return p;
+      }
+      ++current_;
+      offset_ = 0;
+    }
+    // objects larger than a chunk get a chunk of their own
+    const size_t chunk_size = std::max(chunk_bytes_, size + alignment);
+    chunks_.push_back(
+        Chunk{std::unique_ptr<unsigned char[]>(new unsigned char[chunk_size]),
+              chunk_size});
+    current_ = chunks_.size() - 1;
+    offset_ = 0;
+    return Allocate(size, alignment);
+  }
+
+  size_t chunk_bytes_;
+  std::vector<Chunk> chunks_;
+  //! bump position, chunks_[current_] is filled up to offset_
+  size_t current_ = 0;
+  size_t offset_ = 0;
+  size_t bytes_used_ = 0;
+  std::vector<std::pair<void*, void (*)(void*)>> destructors_;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,59 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Calls fn(i) for all i in [begin, end) on num_threads threads. Indices are
+//! handed out one by one, so iterations with very different run times are
+//! balanced. With num_threads <= 1 the loop runs on the calling thread.
+template <typename Function>
+void ParallelFor(const int begin,
+                 const int end,
+                 const int num_threads,
+                 const Function& fn) {
+  const int nr_threads = std::min(num_threads, end - begin);
+  if (nr_threads <= 1) {
+    for (int i = begin; i < end; ++i) {
+      fn(i);
+    }
+    return;
+  }
+  std::atomic<int> next(begin);
+  std::vector<std::thread> threads;
+  threads.reserve(nr_threads);
+  for (int t = 0; t < nr_threads; ++t) {
+    threads.emplace_back([&]() {
+      OPENICC_TRACE_THREAD("parallel_for");
+      for (int i = next++; i < end; i = next++) {
+        fn(i);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,49 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Eigen/Core>
+
+#include <theia/sfm/estimators/feature_correspondence_2d_3d.h>
+
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Direct linear transform with Hartley normalization of the homography
+//! that maps board points (x, y, 1) to the features. Fails if the board
+//! points are not planar in z = 0 or are degenerate.
+bool EstimateBoardHomography(
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences,
+    Eigen::Matrix3d* homography);
+
+//! Focal length from the homography of a board observed with features
+//! centered on the principal point, square pixels and no skew (Zhang).
+//! Fails if the board is seen fronto-parallel.
+bool FocalLengthFromBoardHomography(const Eigen::Matrix3d& homography,
+                                    double* focal_length);
+
+//! Rotation world to camera and camera position from the homography of a
+//! board observed in normalized image coordinates. The rotation is the
+//! closest one to [h1 h2 h1 x h2] and the board is put in front of the
+//! camera.
+bool PoseFromBoardHomography(const Eigen::Matrix3d& homography,
+                             Eigen::Matrix3d* rotation,
+                             Eigen::Vector3d* position);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,111 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "OpenCameraCalibrator/utils/allocation_counter.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Accumulated measurements of one pipeline stage
+struct ProfileStage {
+  size_t calls = 0;
+  size_t items = 0;
+  double wall_s = 0.0;
+  //! cpu time of the threads that ran the stage scopes. Worker threads
+  //! spawned inside a scope (e.g. by Ceres) are not included.
+  double cpu_s = 0.0;
+  //! peak resident set size of the process at the end of the stage
+  double peak_rss_mb = 0.0;
+  //! operator new calls and bytes of the stage scopes, only counted in
+  //! builds with OPENICC_COUNT_ALLOCATIONS, see utils/allocation_counter.h
+  size_t allocations = 0;
+  size_t allocated_bytes = 0;
+};
+
+//! Process wide collection of stage timings. Disabled by default, so the
+//! scoped timers in the hot paths cost one atomic load unless an application
+//! asks for a report.
+class Profiler {
+ public:
+  static Profiler& Instance();
+
+  void SetEnabled(const bool enabled) { enabled_ = enabled; }
+  bool Enabled() const { return enabled_; }
+
+  void Record(const std::string& stage,
+              const double wall_s,
+              const double cpu_s,
+              const size_t items,
+              const AllocationCount& allocations = AllocationCount());
+
+  void Reset();
+
+  ProfileStage Stage(const std::string& stage) const;
+
+  //! Writes wall time, cpu time, peak RSS, calls and item counts per stage
+  //! and for the whole process as json. Builds that count allocations add
+  //! the allocations and allocated bytes per stage.
+  bool WriteReport(const std::string& path) const;
+
+ private:
+  Profiler();
+
+  std::atomic<bool> enabled_{false};
+  mutable std::mutex mutex_;
+  std::map<std::string, ProfileStage> stages_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+//! Records the wall and cpu time, and if counted the allocations of the
+//! thread, between construction and destruction as one call of stage. Items
+//! are an arbitrary count, e.g. frames or residuals, used to normalize the
+//! timings.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(const char* stage, const size_t items = 0);
+  ~ScopedTimer();
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  void AddItems(const size_t items) { items_ += items; }
+
+ private:
+  const char* stage_;
+  size_t items_;
+  bool enabled_;
+  std::chrono::steady_clock::time_point wall_start_;
+  double cpu_start_s_ = 0.0;
+  ScopedAllocationCounter allocation_counter_;
+};
+
+//! cpu time of the calling thread in seconds
+double ThreadCpuTimeS();
+
+//! cpu time of the process in seconds
+double ProcessCpuTimeS();
+
+//! peak resident set size of the process in MB, 0 if not available
+double PeakRssMB();
+
+}  // namespace utils
+}  // namespace OpenICC
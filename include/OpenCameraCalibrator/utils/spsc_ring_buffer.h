@@ -0,0 +1,80 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace OpenICC {
+namespace utils {
+
+//! Lock free ring buffer for exactly one producer and one consumer thread.
+//! The capacity is rounded up to a power of two. Neither side ever blocks,
+//! TryPush fails if the buffer is full, so the producer decides whether to
+//! drop the item.
+template <typename T>
+class SpscRingBuffer {
+ public:
+  explicit SpscRingBuffer(const size_t capacity)
+      : buffer_(RoundUpToPowerOfTwo(capacity)), mask_(buffer_.size() - 1) {}
+
+  //! Producer side. Returns false and leaves item untouched if full
+  bool TryPush(T& item) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == buffer_.size()) {
+      return false;
+    }
+    buffer_[head & mask_] = std::move(item);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  //! Consumer side. Returns false if empty
+  bool TryPop(T& item) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = std::move(buffer_[tail & mask_]);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  //! Approximate number of items, exact if neither side is running
+  size_t Size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+  }
+
+  size_t Capacity() const { return buffer_.size(); }
+
+ private:
+  static size_t RoundUpToPowerOfTwo(const size_t n) {
+    size_t capacity = 1;
+    while (capacity < n) capacity <<= 1;
+    return capacity;
+  }
+
+  std::vector<T> buffer_;
+  const size_t mask_;
+  //! head_ is only written by the producer, tail_ only by the consumer. They
+  //! live on separate cache lines to avoid false sharing
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,89 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace OpenICC {
+namespace utils {
+
+//! Hash of everything a stage output depends on. Downstream stages add the
+//! key of their input stage, so a changed input invalidates all stages
+//! after it.
+class StageKey {
+ public:
+  StageKey& Add(const std::string& value);
+  StageKey& Add(const char* value) { return Add(std::string(value)); }
+  StageKey& Add(const double value);
+  StageKey& Add(const int value);
+  StageKey& Add(const bool value);
+  StageKey& Add(const StageKey& upstream);
+
+  //! Adds size and modification time and the first and last MiB of a file.
+  //! For a folder, this is done for all files in it. Hashing the complete
+  //! videos would take about as long as reading them for the extraction.
+  StageKey& AddFile(const std::string& path);
+
+  //! 16 hex digits
+  std::string Hex() const;
+
+ private:
+  void Update(const void* data, const size_t size);
+
+  // 64 bit FNV-1a
+  uint64_t hash_ = 14695981039346656037ULL;
+};
+
+//! Stage outputs stored in a folder under the key of their inputs
+class StageCache {
+ public:
+  //! An empty cache_dir disables the cache
+  explicit StageCache(const std::string& cache_dir = "")
+      : cache_dir_(cache_dir) {}
+
+  bool Enabled() const { return !cache_dir_.empty(); }
+
+  //! cache_dir/<stage>_<key><extension>, empty if disabled
+  std::string EntryPath(const std::string& stage,
+                        const StageKey& key,
+                        const std::string& extension) const;
+
+  //! True if the entry of the stage exists
+  bool Contains(const std::string& stage,
+                const StageKey& key,
+                const std::string& extension) const;
+
+  //! Copies a stage output file into the cache. The entry is renamed into
+  //! place after the copy, so an interrupted run leaves no partial entry.
+  bool Store(const std::string& stage,
+             const StageKey& key,
+             const std::string& extension,
+             const std::string& output_path) const;
+
+  //! Copies the entry of the stage to output_path, false on a cache miss
+  bool Restore(const std::string& stage,
+               const StageKey& key,
+               const std::string& extension,
+               const std::string& output_path) const;
+
+ private:
+  std::string cache_dir_;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,127 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <theia/sfm/camera/camera.h>
+
+#include <vector>
+
+#include "OpenCameraCalibrator/basalt_spline/se3_spline.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Order of the ground truth spline
+const int SYNTHETIC_SPLINE_N = 4;
+
+//! Random camera motion in front of the board
+struct SyntheticMotionOptions {
+  double duration_s = 60.0;
+  //! knot spacing of the ground truth spline
+  double knot_dt_s = 0.5;
+  //! mean distance of the camera to the board plane
+  double distance_m = 0.5;
+  //! std of the camera position around its mean
+  double position_std_m = 0.15;
+  //! std of the camera rotation around looking at the board center
+  double rotation_std_rad = 0.2;
+  unsigned int seed = 0;
+};
+
+//! IMU rate, noise and biases of the simulated telemetry. Noise densities are
+//! given in unit / sqrt(Hz), bias random walks in unit * sqrt(Hz).
+struct SyntheticImuOptions {
+  double imu_rate_hz = 200.0;
+  double gyro_noise_density = 1e-3;
+  double accl_noise_density = 1e-2;
+  double gyro_bias_random_walk = 1e-5;
+  double accl_bias_random_walk = 1e-4;
+  Eigen::Vector3d gyro_bias = Eigen::Vector3d::Zero();
+  Eigen::Vector3d accl_bias = Eigen::Vector3d::Zero();
+  //! gravity in the board frame, same convention as the spline estimator
+  Eigen::Vector3d gravity = Eigen::Vector3d(0.0, 0.0, 9.81);
+  unsigned int seed = 0;
+};
+
+//! Ground truth IMU trajectory in the board frame. The board lies in the
+//! z = 0 plane and is seen by the camera from z < 0.
+class SyntheticTrajectory {
+ public:
+  //! Smooth random motion of the camera looking at board_center. T_i_c
+  //! transforms from the camera to the imu frame.
+  SyntheticTrajectory(const SyntheticMotionOptions& options,
+                      const Eigen::Vector3d& board_center,
+                      const Sophus::SE3d& T_i_c);
+
+  double Duration() const { return duration_s_; }
+
+  const Sophus::SE3d& T_i_c() const { return T_i_c_; }
+
+  //! T_w_i at t_s
+  Sophus::SE3d ImuPose(const double t_s) const;
+
+  //! T_w_c at t_s
+  Sophus::SE3d CameraPose(const double t_s) const;
+
+  //! angular velocity in the imu frame
+  Eigen::Vector3d AngularVelocity(const double t_s) const;
+
+  //! acceleration of the imu in the board frame
+  Eigen::Vector3d Acceleration(const double t_s) const;
+
+ private:
+  //! spline time of t_s, clamped to the time the spline covers
+  int64_t SplineTimeNs(const double t_s) const;
+
+  Se3Spline<SYNTHETIC_SPLINE_N> spline_;
+  Sophus::SE3d T_i_c_;
+  double duration_s_;
+};
+
+//! Samples accelerometer and gyroscope at imu_rate_hz and the image
+//! timestamps at camera_fps over the duration of the trajectory
+void SimulateTelemetry(const SyntheticTrajectory& trajectory,
+                       const SyntheticImuOptions& options,
+                       const double camera_fps,
+                       CameraTelemetryData* telemetry);
+
+//! Projects the board points into the camera at every timestamp and adds
+//! each view that sees at least min_corners points to scene_writer. Corners
+//! get Gaussian noise with pixel_noise_std. Returns the number of views.
+size_t SimulateScene(const SyntheticTrajectory& trajectory,
+                     const theia::Camera& camera,
+                     const std::vector<cv::Point3f>& board_pts,
+                     const std::vector<int>& board_pt_ids,
+                     const std::vector<double>& timestamps_s,
+                     const double pixel_noise_std,
+                     const unsigned int seed,
+                     io::SceneWriter* scene_writer,
+                     const size_t min_corners = 10);
+
+//! Header fields of a scene file (see io::SceneWriter::Close), as written by
+//! the board extraction
+nlohmann::json SyntheticSceneHeader(const theia::Camera& camera,
+                                    const double camera_fps,
+                                    const int board_type,
+                                    const double square_length_m,
+                                    const std::vector<cv::Point3f>& board_pts,
+                                    const std::vector<int>& board_pt_ids);
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,88 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Splits a wall clock budget between the stages of a staged optimization.
+//! Every stage gets a share of the remaining budget proportional to its
+//! weight, scaled by the measured convergence rate (relative cost reduction
+//! per second) of the last finished stage of the same name relative to the
+//! mean rate, so stages that still pay off get more time. Time a stage does
+//! not use goes to the later stages. An unlimited scheduler never limits a
+//! stage.
+class TimeBudgetScheduler {
+ public:
+  //! Solver time limit of a stage of an unlimited scheduler, the ceres
+  //! default
+  static constexpr double kUnlimitedS = 1e9;
+
+  //! budget_s <= 0 is unlimited. The budget starts with the construction
+  explicit TimeBudgetScheduler(const double budget_s = 0.0);
+
+  bool IsLimited() const { return budget_s_ > 0.0; }
+
+  //! Appends a stage. Stages can share a name, e.g. repeated levels
+  void AddStage(const std::string& name, const double weight = 1.0);
+
+  //! Starts the first pending stage of this name and returns its time limit
+  //! in seconds, 0 if the budget is exhausted. The stage is then skipped
+  double BeginStage(const std::string& name);
+
+  //! Finishes the running stage with the cost before and after it
+  void EndStage(const double initial_cost, const double final_cost);
+
+  double ElapsedS() const;
+
+  double RemainingS() const;
+
+  bool Exhausted() const { return IsLimited() && RemainingS() <= 0.0; }
+
+  //! Allocated and used time, cost reduction and state of every stage
+  nlohmann::json Report() const;
+
+ private:
+  struct Stage {
+    std::string name;
+    double weight = 1.0;
+    bool started = false;
+    bool skipped = false;
+    double allocated_s = 0.0;
+    double used_s = 0.0;
+    double initial_cost = 0.0;
+    double final_cost = 0.0;
+    //! relative cost reduction per second, < 0 until finished
+    double rate = -1.0;
+  };
+
+  //! weight times the convergence rate factor of stage
+  double Priority(const Stage& stage, const double mean_rate) const;
+
+  double budget_s_;
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point stage_start_;
+  std::vector<Stage> stages_;
+  int running_ = -1;
+};
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,110 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+
+//! Time sorted samples stored as one timestamp array and one value array.
+//! Replaces aligned_map<double, T> for measurement streams: it needs a
+//! fraction of the memory, iterates linearly and the timestamp array can be
+//! passed to the interpolation functions in utils.h without a copy.
+template <typename T>
+class TimeSeries {
+ public:
+  void clear() {
+    times_.clear();
+    values_.clear();
+    sorted_ = true;
+  }
+
+  void reserve(const size_t n) {
+    times_.reserve(n);
+    values_.reserve(n);
+  }
+
+  size_t size() const { return times_.size(); }
+
+  bool empty() const { return times_.empty(); }
+
+  //! Appends a sample. Call Sort afterwards if the times are not appended in
+  //! increasing order.
+  void PushBack(const double t, const T& value) {
+    if (!times_.empty() && t <= times_.back()) {
+      sorted_ = false;
+    }
+    times_.push_back(t);
+    values_.push_back(value);
+  }
+
+  //! Sorts the samples by time. Of samples with equal times only the last
+  //! appended one is kept, like repeated assignments to a map.
+  void Sort() {
+    if (sorted_) {
+      return;
+    }
+    std::vector<size_t> order(times_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return times_[a] < times_[b];
+    });
+    std::vector<double> times;
+    aligned_vector<T> values;
+    times.reserve(order.size());
+    values.reserve(order.size());
+    for (const size_t i : order) {
+      if (!times.empty() && times.back() == times_[i]) {
+        values.back() = values_[i];
+        continue;
+      }
+      times.push_back(times_[i]);
+      values.push_back(values_[i]);
+    }
+    times_.swap(times);
+    values_.swap(values);
+    sorted_ = true;
+  }
+
+  //! sorted once all samples were appended in order or after Sort
+  const std::vector<double>& Times() const { return times_; }
+  const aligned_vector<T>& Values() const { return values_; }
+
+  double Time(const size_t i) const { return times_[i]; }
+  const T& Value(const size_t i) const { return values_[i]; }
+
+  double FrontTime() const { return times_.front(); }
+  double BackTime() const { return times_.back(); }
+
+  //! Index of the first sample with a time >= t, size() if there is none
+  size_t LowerBound(const double t) const {
+    return std::lower_bound(times_.begin(), times_.end(), t) - times_.begin();
+  }
+
+ private:
+  std::vector<double> times_;
+  aligned_vector<T> values_;
+  bool sorted_ = true;
+};
+
+using quat_series = TimeSeries<Eigen::Quaterniond>;
+using vec3_series = TimeSeries<Eigen::Vector3d>;
+
+}  // namespace OpenICC
@@ -0,0 +1,37 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+// Zones and thread names for a timeline of the pipeline in the Tracy
+// profiler (cmake -DBUILD_WITH_TRACY=ON). Without OPENICC_TRACY the macros
+// expand to nothing. Unlike utils::ScopedTimer, which accumulates per stage
+// totals, zones keep every call with its thread, so decoding, detection,
+// solving and waiting can be followed over time.
+
+#ifdef OPENICC_TRACY
+#include <tracy/Tracy.hpp>
+
+//! Zone from here to the end of the scope, name must be a string literal
+#define OPENICC_TRACE_ZONE(name) ZoneScopedN(name)
+//! Name of the calling thread in the timeline, the name is copied
+#define OPENICC_TRACE_THREAD(name) tracy::SetThreadName(name)
+//! Marks the end of one frame of a named frame set, e.g. a processed video
+//! frame
+#define OPENICC_TRACE_FRAME(name) FrameMarkNamed(name)
+#else
+#define OPENICC_TRACE_ZONE(name)
+#define OPENICC_TRACE_THREAD(name)
+#define OPENICC_TRACE_FRAME(name)
+#endif
@@ -312,6 +312,40 @@ class ThreeAxisSensorCalibParams {
     return raw_data - bias_vec_;
   }
 
+  /** @brief X' = T*K*(X - B) computed directly from the parameters, without
+   *         building the matrices of a ThreeAxisSensorCalibParams. Meant for
+   *         residuals that are evaluated with jets for every sample.
+   *         mis holds mis_yz, mis_zy, mis_zx, mis_xz, mis_xy, mis_yx, scale
+   *         s_x, s_y, s_z and bias b_x, b_y, b_z
+   */
+  static inline Eigen::Matrix<_T, 3, 1> ApplyUnbiasNormalize(
+      const _T* mis,
+      const _T* scale,
+      const _T* bias,
+      const Eigen::Matrix<_T, 3, 1>& raw_data) {
+    const _T e0 = scale[0] * (raw_data[0] - bias[0]);
+    const _T e1 = scale[1] * (raw_data[1] - bias[1]);
+    const _T e2 = scale[2] * (raw_data[2] - bias[2]);
+    return Eigen::Matrix<_T, 3, 1>(e0 - mis[0] * e1 + mis[1] * e2,
+                                   mis[3] * e0 + e1 - mis[2] * e2,
+                                   -mis[4] * e0 + mis[5] * e1 + e2);
+  }
+
+  /** @brief ApplyUnbiasNormalize for the "body" frame special case, mis only
+   *         holds mis_yz, mis_zy, mis_zx. T*K is upper triangular.
+   */
+  static inline Eigen::Matrix<_T, 3, 1> ApplyUnbiasNormalizeBodyFrame(
+      const _T* mis,
+      const _T* scale,
+      const _T* bias,
+      const Eigen::Matrix<_T, 3, 1>& raw_data) {
+    const _T e0 = scale[0] * (raw_data[0] - bias[0]);
+    const _T e1 = scale[1] * (raw_data[1] - bias[1]);
+    const _T e2 = scale[2] * (raw_data[2] - bias[2]);
+    return Eigen::Matrix<_T, 3, 1>(
+        e0 - mis[0] * e1 + mis[1] * e2, e1 - mis[2] * e2, e2);
+  }
+
  private:
   /** @brief Update internal data (e.g., compute Misalignment * scale matrix)
    *         after a parameter is changed */
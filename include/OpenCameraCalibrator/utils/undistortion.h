@@ -0,0 +1,43 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <theia/sfm/camera/camera.h>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+class UndistortionLut;
+
+//! Normalized image coordinates (z = 1) of all pixels of one view. The camera
+//! model is resolved once per call and every point goes through the static
+//! inverse projection of the model on the raw intrinsics, instead of the
+//! virtual Camera::PixelToNormalizedCoordinates per point. Other camera models
+//! fall back to the latter.
+void PixelsToNormalizedCoordinates(const theia::Camera& camera,
+                                   const vec2_vector& pixels,
+                                   vec2_vector* normalized);
+
+//! Looks the pixels up in lut and only solves for pixels the table does not
+//! cover. lut may be null.
+void PixelsToNormalizedCoordinates(const theia::Camera& camera,
+                                   const UndistortionLut* lut,
+                                   const vec2_vector& pixels,
+                                   vec2_vector* normalized);
+
+}  // namespace utils
+}  // namespace OpenICC
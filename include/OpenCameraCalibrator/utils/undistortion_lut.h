@@ -0,0 +1,89 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <theia/sfm/camera/camera.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace utils {
+
+//! Table of normalized image coordinates sampled every step pixels over the
+//! image. Corners are undistorted by a bilinear lookup instead of the
+//! iterative inverse projection of the camera model. Tables are cached on
+//! disk and memory mapped when loaded.
+class UndistortionLut {
+ public:
+  UndistortionLut() {}
+  ~UndistortionLut();
+  UndistortionLut(const UndistortionLut&) = delete;
+  UndistortionLut& operator=(const UndistortionLut&) = delete;
+
+  //! Samples the camera every step pixels on num_threads threads
+  void Build(const theia::Camera& camera,
+             const int step = 1,
+             const int num_threads = 1);
+
+  //! Maps a table written by Write. Fails if the file does not exist or was
+  //! written for another key.
+  bool Load(const std::string& path, const uint64_t key);
+
+  bool Write(const std::string& path, const uint64_t key) const;
+
+  //! Bilinear lookup. Returns false outside of the image or next to pixels
+  //! the camera model could not undistort.
+  bool Undistort(const Eigen::Vector2d& pixel,
+                 Eigen::Vector2d* normalized) const;
+
+  int Step() const { return step_; }
+
+ private:
+  void Unmap();
+
+  int width_ = 0;
+  int height_ = 0;
+  int step_ = 1;
+  int cols_ = 0;
+  int rows_ = 0;
+
+  //! interleaved x, y per grid node, row major. Points either into
+  //! built_table_ or into the mapped file.
+  const float* table_ = nullptr;
+  std::vector<float> built_table_;
+  void* mapped_ = nullptr;
+  size_t mapped_size_ = 0;
+};
+
+//! 64 bit FNV-1a hash of the file content, 0 if it can not be read
+uint64_t HashFileContent(const std::string& path);
+
+//! Loads the table cached next to calibration_json (calibration_json +
+//! ".lut") if it was built from the same calibration file, i.e. the output of
+//! io::write_camera_calibration, with the same step. Otherwise the table is
+//! built for camera and written to the cache.
+std::shared_ptr<const UndistortionLut> LoadOrBuildUndistortionLut(
+    const std::string& calibration_json,
+    const theia::Camera& camera,
+    const int step = 1,
+    const int num_threads = 1);
+
+}  // namespace utils
+}  // namespace OpenICC
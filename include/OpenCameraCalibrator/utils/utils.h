@@ -50,24 +50,55 @@ double GetReprojErrorOfView(const theia::Reconstruction& recon_dataset,
 
 std::vector<std::string> load_images(const std::string& img_dir_path);
 
+//! Index of the timestamp in the sorted vis_timestamps that is closest to
+//! t_imu. Binary search, O(log n)
 size_t FindClosestTimestamp(const double t_imu,
-                         const std::vector<double>& vis_timestamps,
-                         double& distance_to_nearest_timestamp);
+                            const std::vector<double>& vis_timestamps,
+                            double& distance_to_nearest_timestamp);
+
+//! Index i of the interval [timestamps[i], timestamps[i+1]) that contains t in
+//! the sorted timestamps, clamped to [0, size-2]. hint is the result of the
+//! previous query: for monotone queries the search only walks forward from it,
+//! so a batch of sorted queries costs O(n + m) in total
+size_t FindTimestampInterval(const double t,
+                             const std::vector<double>& timestamps,
+                             const size_t hint = 0);
 
 Eigen::Vector3d lerp3d(const Eigen::Vector3d& v0,
                        const Eigen::Vector3d& v1,
                        double fraction);
 
-void InterpolateQuaternions(std::vector<double> t_old,
-                            std::vector<double> t_new,
+//! Interpolates input_q given at the sorted t_old to the sorted t_new.
+//! Samples outside of t_old are set to the nearest boundary value
+void InterpolateQuaternions(const std::vector<double>& t_old,
+                            const std::vector<double>& t_new,
                             const quat_vector& input_q,
                             quat_vector& interpolated_q);
 
-void InterpolateVector3d(std::vector<double> t_old,
-                         std::vector<double> t_new,
+//! Interpolates input_vec given at the sorted t_old to the sorted t_new.
+//! Samples outside of t_old are set to the nearest boundary value
+void InterpolateVector3d(const std::vector<double>& t_old,
+                         const std::vector<double>& t_new,
                          const vec3_vector& input_vec,
                          vec3_vector& interpolated_vec);
 
+//! Moving average of width window over the three axes of signal, computed
+//! from prefix sums in one pass. Without zero_phase each sample is the mean
+//! of the last window samples like a causal moving average, with zero_phase
+//! the window is centered on the sample (use an odd window). The window
+//! shrinks at the borders.
+void BoxFilter3d(const vec3_vector& signal,
+                 const int window,
+                 const bool zero_phase,
+                 vec3_vector& filtered);
+
+//! Converts WGS84 latitude [deg], longitude [deg] and ellipsoidal height [m]
+//! to the local east-north-up frame of lle_ref. The reference rotation and
+//! ECEF position are computed once, so converting long drives stays cheap
+void ConvertLLEToENU(const vec3_vector& lle,
+                     const Eigen::Vector3d& lle_ref,
+                     vec3_vector& enu);
+
 // average calculation
 template <class T>
 T average(const std::vector<T> datas) {
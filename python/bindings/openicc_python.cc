@@ -0,0 +1,683 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Python module openicc. Runs the calibration stages in-process, so the
+// drivers in python/ can chain them without writing every intermediate
+// result to disk. Telemetry and camera frames are shared with numpy
+// without copies, scenes and pose datasets are opaque handles.
+
+#include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <sophus/se3.hpp>
+
+#include "theia/io/reconstruction_reader.h"
+#include "theia/io/reconstruction_writer.h"
+#include "theia/sfm/reconstruction.h"
+
+#include "OpenCameraCalibrator/core/allan_variance_fitter.h"
+#include "OpenCameraCalibrator/core/board_extractor.h"
+#include "OpenCameraCalibrator/core/camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
+#include "OpenCameraCalibrator/core/imu_to_camera_rotation_estimator.h"
+#include "OpenCameraCalibrator/core/pose_estimator.h"
+#include "OpenCameraCalibrator/core/spline_error_weighting.h"
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace py = pybind11;
+
+using namespace OpenICC;
+using namespace OpenICC::core;
+
+namespace {
+
+//! Holders shared between the python objects, a numpy view keeps its
+//! owner alive through its base object
+struct Telemetry {
+  CameraTelemetryData data;
+};
+
+struct Scene {
+  nlohmann::json json;
+};
+
+struct PoseDataset {
+  std::shared_ptr<theia::Reconstruction> recon =
+      std::make_shared<theia::Reconstruction>();
+};
+
+struct Camera {
+  theia::Camera camera;
+  double fps = 0.0;
+};
+
+//! Read-only (n, 3) view of the measurements or (n,) view of the
+//! timestamps of readings, without a copy
+py::array ImuReadingsView(const ImuReadings& readings,
+                          const bool timestamps,
+                          py::handle owner) {
+  const ssize_t n = static_cast<ssize_t>(readings.size());
+  const ssize_t stride = sizeof(ImuReading<double>);
+  const double* first = nullptr;
+  if (n > 0) {
+    first = timestamps ? &readings[0].timestamp_s() : readings[0].data_ptr();
+  }
+  py::array view;
+  if (timestamps) {
+    view = py::array_t<double>({n}, {stride}, first, owner);
+  } else {
+    view = py::array_t<double>(
+        {n, ssize_t(3)}, {stride, ssize_t(sizeof(double))}, first, owner);
+  }
+  view.attr("setflags")(py::arg("write") = false);
+  return view;
+}
+
+//! Copies (n,) timestamps and (n, 3) measurements into readings
+bool ArraysToImuReadings(const py::array_t<double>& timestamps_s,
+                         const py::array_t<double>& xyz,
+                         ImuReadings& readings) {
+  if (timestamps_s.ndim() != 1 || xyz.ndim() != 2 || xyz.shape(1) != 3 ||
+      xyz.shape(0) != timestamps_s.shape(0)) {
+    return false;
+  }
+  const auto t = timestamps_s.unchecked<1>();
+  const auto v = xyz.unchecked<2>();
+  readings.clear();
+  readings.reserve(t.shape(0));
+  for (ssize_t i = 0; i < t.shape(0); ++i) {
+    readings.emplace_back(t(i), v(i, 0), v(i, 1), v(i, 2));
+  }
+  return true;
+}
+
+//! Header on a contiguous uint8 gray (h, w) or BGR (h, w, 3) numpy image
+cv::Mat ArrayToMat(const py::array_t<uint8_t, py::array::c_style>& image) {
+  if (image.ndim() == 2) {
+    return cv::Mat(image.shape(0),
+                   image.shape(1),
+                   CV_8UC1,
+                   const_cast<uint8_t*>(image.data()));
+  }
+  if (image.ndim() == 3 && (image.shape(2) == 3 || image.shape(2) == 4)) {
+    return cv::Mat(image.shape(0),
+                   image.shape(1),
+                   CV_8UC(static_cast<int>(image.shape(2))),
+                   const_cast<uint8_t*>(image.data()));
+  }
+  throw py::value_error("expected a uint8 image of shape (h, w) or (h, w, c)");
+}
+
+py::array_t<double> CornersToArray(
+    const aligned_vector<Eigen::Vector2d>& corners) {
+  py::array_t<double> array({ssize_t(corners.size()), ssize_t(2)});
+  auto a = array.mutable_unchecked<2>();
+  for (size_t i = 0; i < corners.size(); ++i) {
+    a(i, 0) = corners[i][0];
+    a(i, 1) = corners[i][1];
+  }
+  return array;
+}
+
+bool InitializeBoard(BoardExtractor& extractor,
+                     const std::string& board_type,
+                     const double square_length_m,
+                     const int num_squares_x,
+                     const int num_squares_y,
+                     const std::string& aruco_detector_params,
+                     const double marker_length_m,
+                     const int aruco_dictionary) {
+  switch (StringToBoardType(board_type)) {
+    case BoardType::RADON:
+      return extractor.InitializeRadonBoard(
+          square_length_m, num_squares_x, num_squares_y);
+    case BoardType::APRILTAG:
+      return extractor.InitializeAprilBoard(
+          square_length_m, 0.3, num_squares_x, num_squares_y);
+    default:
+      return extractor.InitializeCharucoBoard(aruco_detector_params,
+                                              marker_length_m,
+                                              square_length_m,
+                                              num_squares_x,
+                                              num_squares_y,
+                                              aruco_dictionary);
+  }
+}
+
+}  // namespace
+
+PYBIND11_MODULE(openicc, m) {
+  m.doc() = "In-process access to the OpenImuCameraCalibrator stages";
+
+  py::enum_<SplineOptimFlags>(m, "SplineOptimFlags", py::arithmetic())
+      .value("POINTS", SplineOptimFlags::POINTS)
+      .value("T_I_C", SplineOptimFlags::T_I_C)
+      .value("IMU_BIASES", SplineOptimFlags::IMU_BIASES)
+      .value("IMU_INTRINSICS", SplineOptimFlags::IMU_INTRINSICS)
+      .value("GRAVITY_DIR", SplineOptimFlags::GRAVITY_DIR)
+      .value("CAM_LINE_DELAY", SplineOptimFlags::CAM_LINE_DELAY)
+      .value("SPLINE", SplineOptimFlags::SPLINE)
+      .value("ACC_BIAS", SplineOptimFlags::ACC_BIAS)
+      .value("GYR_BIAS", SplineOptimFlags::GYR_BIAS);
+
+  py::class_<Telemetry, std::shared_ptr<Telemetry>>(m, "Telemetry")
+      .def(py::init<>())
+      .def_static(
+          "read",
+          [](const std::string& path) {
+            auto telemetry = std::make_shared<Telemetry>();
+            if (!io::ReadTelemetry(path, telemetry->data)) {
+              throw std::runtime_error("Could not read telemetry " + path);
+            }
+            return telemetry;
+          },
+          py::arg("path"),
+          py::call_guard<py::gil_scoped_release>())
+      .def_static(
+          "from_arrays",
+          [](const py::array_t<double>& accl_t_s,
+             const py::array_t<double>& accl,
+             const py::array_t<double>& gyro_t_s,
+             const py::array_t<double>& gyro,
+             const std::vector<double>& img_timestamps_s) {
+            auto telemetry = std::make_shared<Telemetry>();
+            if (!ArraysToImuReadings(
+                    accl_t_s, accl, telemetry->data.accelerometer) ||
+                !ArraysToImuReadings(
+                    gyro_t_s, gyro, telemetry->data.gyroscope)) {
+              throw py::value_error(
+                  "expected (n,) timestamps and (n, 3) measurements");
+            }
+            telemetry->data.img_timestamps_s = img_timestamps_s;
+            return telemetry;
+          },
+          py::arg("accl_timestamps_s"),
+          py::arg("accl"),
+          py::arg("gyro_timestamps_s"),
+          py::arg("gyro"),
+          py::arg("img_timestamps_s") = std::vector<double>())
+      .def_property_readonly(
+          "accl",
+          [](py::object self) {
+            return ImuReadingsView(
+                self.cast<Telemetry&>().data.accelerometer, false, self);
+          })
+      .def_property_readonly(
+          "accl_timestamps_s",
+          [](py::object self) {
+            return ImuReadingsView(
+                self.cast<Telemetry&>().data.accelerometer, true, self);
+          })
+      .def_property_readonly(
+          "gyro",
+          [](py::object self) {
+            return ImuReadingsView(
+                self.cast<Telemetry&>().data.gyroscope, false, self);
+          })
+      .def_property_readonly(
+          "gyro_timestamps_s",
+          [](py::object self) {
+            return ImuReadingsView(
+                self.cast<Telemetry&>().data.gyroscope, true, self);
+          })
+      .def_property_readonly("img_timestamps_s", [](const Telemetry& t) {
+        return t.data.img_timestamps_s;
+      });
+
+  py::class_<Scene, std::shared_ptr<Scene>>(m, "Scene")
+      .def_static(
+          "read",
+          [](const std::string& path) {
+            auto scene = std::make_shared<Scene>();
+            if (!io::read_scene_bson(path, scene->json)) {
+              throw std::runtime_error("Could not read scene " + path);
+            }
+            return scene;
+          },
+          py::arg("path"),
+          py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("num_views",
+                             [](const Scene& s) {
+                               return s.json.contains("views")
+                                          ? s.json["views"].size()
+                                          : size_t(0);
+                             })
+      .def_property_readonly("timestamps_us",
+                             [](const Scene& s) {
+                               std::vector<double> timestamps_us;
+                               if (!s.json.contains("views")) {
+                                 return timestamps_us;
+                               }
+                               for (const auto& v : s.json["views"].items()) {
+                                 timestamps_us.push_back(std::stod(v.key()));
+                               }
+                               return timestamps_us;
+                             })
+      .def(
+          "view",
+          [](const Scene& s, const std::string& timestamp_us) {
+            const auto& points =
+                s.json.at("views").at(timestamp_us).at("image_points");
+            aligned_vector<Eigen::Vector2d> corners;
+            std::vector<int> ids;
+            for (const auto& p : points.items()) {
+              ids.push_back(std::stoi(p.key()));
+              corners.emplace_back(p.value()[0].get<double>(),
+                                   p.value()[1].get<double>());
+            }
+            return py::make_tuple(CornersToArray(corners), ids);
+          },
+          "(corners (n, 2), board point ids) of the view at the "
+          "timestamp key, copied out of the scene",
+          py::arg("timestamp_us"));
+
+  py::class_<Camera, std::shared_ptr<Camera>>(m, "Camera")
+      .def_static(
+          "read",
+          [](const std::string& path) {
+            auto camera = std::make_shared<Camera>();
+            if (!io::read_camera_calibration(
+                    path, camera->camera, camera->fps)) {
+              throw std::runtime_error("Could not read camera " + path);
+            }
+            return camera;
+          },
+          py::arg("path"))
+      .def_readonly("fps", &Camera::fps)
+      .def_property_readonly(
+          "image_width",
+          [](const Camera& c) { return c.camera.ImageWidth(); })
+      .def_property_readonly(
+          "image_height",
+          [](const Camera& c) { return c.camera.ImageHeight(); })
+      .def_property_readonly(
+          "focal_length",
+          [](const Camera& c) { return c.camera.FocalLength(); })
+      .def_property_readonly("principal_point", [](const Camera& c) {
+        return Eigen::Vector2d(c.camera.PrincipalPointX(),
+                               c.camera.PrincipalPointY());
+      });
+
+  py::class_<PoseDataset, std::shared_ptr<PoseDataset>>(m, "PoseDataset")
+      .def_static(
+          "read",
+          [](const std::string& path) {
+            auto dataset = std::make_shared<PoseDataset>();
+            if (!theia::ReadReconstruction(path, dataset->recon.get())) {
+              throw std::runtime_error("Could not read pose dataset " + path);
+            }
+            return dataset;
+          },
+          py::arg("path"))
+      .def(
+          "write",
+          [](const PoseDataset& d, const std::string& path) {
+            return theia::WriteReconstruction(*d.recon, path);
+          },
+          py::arg("path"))
+      .def_property_readonly("num_views", [](const PoseDataset& d) {
+        return d.recon->NumViews();
+      });
+
+  py::class_<BoardExtractor>(m, "BoardExtractor")
+      .def(py::init<>())
+      .def(
+          "initialize_board",
+          [](BoardExtractor& e,
+             const std::string& board_type,
+             const double square_length_m,
+             const int num_squares_x,
+             const int num_squares_y,
+             const std::string& aruco_detector_params,
+             const double marker_length_m,
+             const int aruco_dictionary) {
+            return InitializeBoard(e,
+                                   board_type,
+                                   square_length_m,
+                                   num_squares_x,
+                                   num_squares_y,
+                                   aruco_detector_params,
+                                   marker_length_m,
+                                   aruco_dictionary);
+          },
+          "board_type is charuco, radon or apriltag",
+          py::arg("board_type"),
+          py::arg("square_length_m"),
+          py::arg("num_squares_x"),
+          py::arg("num_squares_y"),
+          py::arg("aruco_detector_params") = "",
+          py::arg("marker_length_m") = 0.0,
+          py::arg("aruco_dictionary") = 0)
+      .def("set_num_threads",
+           &BoardExtractor::SetNumThreads,
+           py::arg("num_threads"))
+      .def("set_frame_stride",
+           &BoardExtractor::SetFrameStride,
+           py::arg("stride"))
+      .def("set_sparse_sampling",
+           &BoardExtractor::SetSparseSampling,
+           py::arg("num_frames"))
+      .def("set_time_range",
+           &BoardExtractor::SetTimeRange,
+           py::arg("t_start_s"),
+           py::arg("t_end_s"))
+      .def("set_video_frame_timestamps",
+           &BoardExtractor::SetVideoFrameTimestamps,
+           py::arg("timestamps_s"))
+      .def("set_mcap_image_topic",
+           &BoardExtractor::SetMcapImageTopic,
+           py::arg("topic"))
+      .def(
+          "extract",
+          [](BoardExtractor& e,
+             const std::string& path,
+             const double img_downsample_factor,
+             const std::string& save_path) {
+            io::SceneMemoryWriter writer;
+            if (!writer.Open(save_path) ||
+                !e.ExtractBatch({path}, img_downsample_factor, {&writer})) {
+              throw std::runtime_error("Could not extract the board from " +
+                                       path);
+            }
+            auto scene = std::make_shared<Scene>();
+            scene->json = writer.Scene();
+            return scene;
+          },
+          "Extracts a video, image folder or MCAP recording into a Scene, "
+          "also written to save_path if it is not empty",
+          py::arg("path"),
+          py::arg("img_downsample_factor") = 1.0,
+          py::arg("save_path") = "",
+          py::call_guard<py::gil_scoped_release>())
+      .def(
+          "extract_frame",
+          [](BoardExtractor& e,
+             const py::array_t<uint8_t, py::array::c_style>& image,
+             const double img_downsample_factor) {
+            const cv::Mat frame = ArrayToMat(image);
+            aligned_vector<Eigen::Vector2d> corners;
+            std::vector<int> ids;
+            {
+              py::gil_scoped_release release;
+              e.ExtractFrame(frame, img_downsample_factor, corners, ids);
+            }
+            return py::make_tuple(CornersToArray(corners), ids);
+          },
+          "Detects the board in a numpy image, which is not copied",
+          py::arg("image"),
+          py::arg("img_downsample_factor") = 1.0);
+
+  py::class_<CameraCalibrator>(m, "CameraCalibrator")
+      .def(py::init<const std::string&, const bool>(),
+           py::arg("camera_model"),
+           py::arg("optimize_board_points") = false)
+      .def("set_num_threads",
+           &CameraCalibrator::SetNumThreads,
+           py::arg("num_threads"))
+      .def(
+          "calibrate",
+          [](CameraCalibrator& c,
+             const Scene& scene,
+             const std::string& output_path) {
+            return c.CalibrateCameraFromJson(scene.json, output_path);
+          },
+          py::arg("scene"),
+          py::arg("output_path"),
+          py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("reprojection_error",
+                             &CameraCalibrator::GetReprojectionError)
+      .def_property_readonly("num_calibration_views",
+                             &CameraCalibrator::GetNumCalibrationViews)
+      .def(
+          "camera",
+          [](const CameraCalibrator& c, const double fps) {
+            auto camera = std::make_shared<Camera>();
+            if (!c.GetCalibratedCamera(camera->camera)) {
+              throw std::runtime_error("The camera is not calibrated");
+            }
+            camera->fps = fps;
+            return camera;
+          },
+          py::arg("fps"));
+
+  py::class_<PoseEstimator>(m, "PoseEstimator")
+      .def(py::init<>())
+      .def("set_num_threads",
+           &PoseEstimator::SetNumThreads,
+           py::arg("num_threads"))
+      .def(
+          "estimate_poses",
+          [](PoseEstimator& p, const Scene& scene, const Camera& camera) {
+            return p.EstimatePosesFromJson(scene.json, camera.camera);
+          },
+          py::arg("scene"),
+          py::arg("camera"),
+          py::call_guard<py::gil_scoped_release>())
+      .def("optimize_board_points",
+           &PoseEstimator::OptimizeBoardPoints,
+           py::arg("compute_covariance") = false,
+           py::call_guard<py::gil_scoped_release>())
+      .def("optimize_all_poses",
+           &PoseEstimator::OptimizeAllPoses,
+           py::call_guard<py::gil_scoped_release>())
+      .def("filter_bad_poses", &PoseEstimator::FilterBadPoses)
+      .def("pose_dataset", [](PoseEstimator& p) {
+        auto dataset = std::make_shared<PoseDataset>();
+        p.GetPoseDataset(*dataset->recon);
+        return dataset;
+      });
+
+  py::class_<ImuToCameraRotationEstimator>(m, "ImuToCameraRotationEstimator")
+      .def(py::init<>())
+      .def("enable_gyro_bias_estimation",
+           &ImuToCameraRotationEstimator::EnableGyroBiasEstimation)
+      .def(
+          "estimate",
+          [](ImuToCameraRotationEstimator& r,
+             const PoseDataset& pose_dataset,
+             const Telemetry& telemetry,
+             Eigen::Vector3d gyro_bias) {
+            Eigen::Matrix3d R_imu_to_camera;
+            double time_offset_imu_to_cam = 0.0;
+            vec3_vector smoothed_ang_imu, smoothed_vis_vel;
+            bool success;
+            {
+              py::gil_scoped_release release;
+              const double dt_imu = r.SetMeasurementsFromPoseDataset(
+                  *pose_dataset.recon, telemetry.data, gyro_bias);
+              success = r.EstimateCameraImuRotation(dt_imu,
+                                                    R_imu_to_camera,
+                                                    time_offset_imu_to_cam,
+                                                    gyro_bias,
+                                                    smoothed_ang_imu,
+                                                    smoothed_vis_vel);
+            }
+            if (!success) {
+              throw std::runtime_error("IMU to camera rotation failed");
+            }
+            return py::make_tuple(
+                R_imu_to_camera, time_offset_imu_to_cam, gyro_bias);
+          },
+          "(R_imu_to_camera, time_offset_imu_to_cam, gyro_bias)",
+          py::arg("pose_dataset"),
+          py::arg("telemetry"),
+          py::arg("gyro_bias") = Eigen::Vector3d::Zero().eval());
+
+  py::class_<SplineWeightingData>(m, "SplineWeightingData")
+      .def(py::init<>())
+      .def_readwrite("dt_r3", &SplineWeightingData::dt_r3)
+      .def_readwrite("dt_so3", &SplineWeightingData::dt_so3)
+      .def_readwrite("std_r3", &SplineWeightingData::std_r3)
+      .def_readwrite("std_so3", &SplineWeightingData::std_so3)
+      .def_readwrite("cam_fps", &SplineWeightingData::cam_fps);
+
+  m.def(
+      "compute_spline_error_weighting",
+      [](const Telemetry& telemetry,
+         const double camera_fps,
+         const double quality_so3,
+         const double quality_r3) {
+        SplineErrorWeightingOptions options;
+        options.camera_fps = camera_fps;
+        options.quality_so3 = quality_so3;
+        options.quality_r3 = quality_r3;
+        SplineWeightingData weighting;
+        if (!ComputeSplineErrorWeighting(telemetry.data, options, weighting)) {
+          throw std::runtime_error("Spline error weighting failed");
+        }
+        return weighting;
+      },
+      py::arg("telemetry"),
+      py::arg("camera_fps"),
+      py::arg("quality_so3") = 0.98,
+      py::arg("quality_r3") = 0.96,
+      py::call_guard<py::gil_scoped_release>());
+
+  py::class_<ImuCameraCalibrator>(m, "ImuCameraCalibrator")
+      .def(py::init<>())
+      .def("set_num_threads",
+           &ImuCameraCalibrator::SetNumThreads,
+           py::arg("num_threads"))
+      .def("set_known_gravity_dir",
+           &ImuCameraCalibrator::SetKnownGravityDir,
+           py::arg("gravity"))
+      .def(
+          "init_spline",
+          [](ImuCameraCalibrator& c,
+             const PoseDataset& pose_dataset,
+             const Scene& scene,
+             const Camera& camera,
+             const Telemetry& telemetry,
+             const Eigen::Matrix3d& R_imu_to_camera,
+             const double time_offset_imu_to_cam,
+             const SplineWeightingData& weighting,
+             const bool global_shutter,
+             const std::string& imu_intrinsics,
+             const std::string& imu_bias) {
+            ThreeAxisSensorCalibParams<double> accl_intrinsics,
+                gyro_intrinsics;
+            if (!imu_intrinsics.empty() &&
+                !io::ReadIMUIntrinsics(imu_intrinsics,
+                                       imu_bias,
+                                       accl_intrinsics,
+                                       gyro_intrinsics)) {
+              throw std::runtime_error("Could not read " + imu_intrinsics);
+            }
+            py::gil_scoped_release release;
+            double t_offset_cam_s = 0.0;
+            if (!telemetry.data.img_timestamps_s.empty()) {
+              t_offset_cam_s = telemetry.data.img_timestamps_s[0];
+            }
+            auto recon = std::make_shared<theia::Reconstruction>();
+            BuildSplineCalibrationDataset(*pose_dataset.recon,
+                                          scene.json,
+                                          camera.camera,
+                                          t_offset_cam_s,
+                                          *recon);
+            const Sophus::SE3<double> T_i_c_init(
+                Eigen::Quaterniond(R_imu_to_camera).conjugate(),
+                Eigen::Vector3d::Zero());
+            const double line_delay_s =
+                global_shutter
+                    ? 0.0
+                    : 1. / camera.fps / camera.camera.ImageHeight();
+            c.BatchInitSpline(recon,
+                              T_i_c_init,
+                              weighting,
+                              time_offset_imu_to_cam,
+                              telemetry.data,
+                              line_delay_s,
+                              accl_intrinsics,
+                              gyro_intrinsics);
+          },
+          py::arg("pose_dataset"),
+          py::arg("scene"),
+          py::arg("camera"),
+          py::arg("telemetry"),
+          py::arg("R_imu_to_camera"),
+          py::arg("time_offset_imu_to_cam"),
+          py::arg("weighting"),
+          py::arg("global_shutter") = false,
+          py::arg("imu_intrinsics") = "",
+          py::arg("imu_bias") = "")
+      .def(
+          "optimize",
+          [](ImuCameraCalibrator& c, const int iterations, const int flags) {
+            return c.Optimize(iterations, flags);
+          },
+          "Returns the mean reprojection error",
+          py::arg("iterations"),
+          py::arg("flags"),
+          py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("T_i_c",
+                             [](const ImuCameraCalibrator& c) {
+                               return c.trajectory_.GetT_i_c().matrix();
+                             })
+      .def_property_readonly(
+          "gravity",
+          [](const ImuCameraCalibrator& c) {
+            return c.trajectory_.GetGravity();
+          })
+      .def_property_readonly(
+          "accl_bias",
+          [](const ImuCameraCalibrator& c) {
+            return c.trajectory_.GetAcclBias(0);
+          })
+      .def_property_readonly(
+          "gyro_bias",
+          [](const ImuCameraCalibrator& c) {
+            return c.trajectory_.GetGyroBias(0);
+          })
+      .def_property_readonly("line_delay_s",
+                             &ImuCameraCalibrator::GetCalibratedRSLineDelay);
+
+  py::class_<AllanVarianceFitter>(m, "AllanVarianceFitter")
+      .def(py::init([](const Telemetry& telemetry,
+                       const int nr_clusters,
+                       const bool streaming,
+                       const int num_threads) {
+             return new AllanVarianceFitter(
+                 telemetry.data, nr_clusters, streaming, num_threads);
+           }),
+           py::arg("telemetry"),
+           py::arg("nr_clusters"),
+           py::arg("streaming") = false,
+           py::arg("num_threads") = 1)
+      .def("run_fit",
+           &AllanVarianceFitter::RunFit,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("accl_bias_instability",
+                             &AllanVarianceFitter::GetAcclBiasInstability)
+      .def_property_readonly("gyro_bias_instability",
+                             &AllanVarianceFitter::GetGyroBiasInstability)
+      .def_property_readonly(
+          "accl_bias_instability_time_s",
+          &AllanVarianceFitter::GetAcclBiasInstabilityTime)
+      .def_property_readonly(
+          "gyro_bias_instability_time_s",
+          &AllanVarianceFitter::GetGyroBiasInstabilityTime);
+}
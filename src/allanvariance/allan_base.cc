@@ -0,0 +1,145 @@
+#include "OpenCameraCalibrator/allanvariance/allan_base.h"
+
+#include <algorithm>
+
+#include <Eigen/Core>
+
+#include "OpenCameraCalibrator/allanvariance/allan_streaming.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace allanvar {
+
+void BlockedPrefixSums::push(double value) {
+  if (m_bases.empty()) {
+    m_head.push_back(value);
+    if ((int)m_head.size() == kBlockSize) finish();
+    return;
+  }
+  append(value - m_ref);
+}
+
+void BlockedPrefixSums::finish() {
+  if (m_head.empty()) return;
+  double sum = 0.0;
+  for (const double value : m_head) sum += value;
+  m_ref = sum / m_head.size();
+  for (const double value : m_head) append(value - m_ref);
+  m_head.clear();
+  m_head.shrink_to_fit();
+}
+
+void BlockedPrefixSums::append(double centered) {
+  if (numData % kBlockSize == 0) m_bases.push_back(m_sum);
+  m_sum += centered;
+  m_offsets.push_back((float)(m_sum - m_bases.back()));
+  ++numData;
+}
+
+double BlockedPrefixSums::secondDifferenceSquaredNorm(int factor) const {
+  const int max = numData - 2 * factor;
+  const Eigen::Map<const Eigen::VectorXf> offsets(m_offsets.data(),
+                                                  m_offsets.size());
+  double sum = 0.0;
+  int i = 0;
+  while (i < max) {
+    // chunk in which none of the three indices crosses a block border
+    int len = max - i;
+    for (int k = 0; k < 3; ++k) {
+      len = std::min(len, kBlockSize - (i + k * factor) % kBlockSize);
+    }
+    const double bases = m_bases[(i + 2 * factor) / kBlockSize] -
+                         2 * m_bases[(i + factor) / kBlockSize] +
+                         m_bases[i / kBlockSize];
+    sum += ((offsets.segment(i + 2 * factor, len) -
+             2 * offsets.segment(i + factor, len) + offsets.segment(i, len))
+                .array() +
+            (float)bases)
+               .square()
+               .sum();
+    i += len;
+  }
+  return sum;
+}
+
+AllanBase::AllanBase(std::string name, int maxCluster)
+    : m_name(name), numCluster(maxCluster) {
+  std::cout << m_name << " "
+            << " num of Cluster " << numCluster << std::endl;
+}
+
+void AllanBase::push(double data, double time) {
+  if (m_sums.size() == 0) m_firstT = time;
+  m_lastT = time;
+  m_sums.push(data);
+}
+
+void AllanBase::calc() {
+  OPENICC_TRACE_ZONE("allan_variance");
+  m_sums.finish();
+  const int numData = m_sums.size();
+  std::cout << m_name << " "
+            << " numData " << numData << std::endl;
+  if (numData < 10000)
+    std::cout << m_name << " "
+              << " Too few number" << std::endl;
+  if (numData < 2) {
+    std::cout << m_name << " "
+              << " Not enough data" << std::endl;
+    return;
+  }
+
+  std::cout << m_name << " "
+            << " start_t " << m_firstT << std::endl;
+  std::cout << m_name << " "
+            << " end_t " << m_lastT << std::endl;
+  std::cout << m_name << " "
+            << "dt " << std::endl  //
+            << "-------------" << (m_lastT - m_firstT) << " s" << std::endl
+            << "-------------" << (m_lastT - m_firstT) / 60 << " min"
+            << std::endl
+            << "-------------" << (m_lastT - m_firstT) / 3600 << " h"
+            << std::endl;
+
+  if ((m_lastT - m_firstT) / 60 < 10)
+    std::cout << m_name << " "
+              << " Too short time!!!!" << std::endl;
+
+  // the sample intervals telescope to the covered time span
+  m_avgDt = (m_lastT - m_firstT) / (numData - 1);
+  m_freq = 1.0 / m_avgDt;
+  const double period = m_avgDt;
+  std::cout << m_name << " "
+            << " freq " << m_freq << std::endl;
+  std::cout << m_name << " "
+            << " period " << period << std::endl;
+
+  m_avgValue = m_sums.valueSum() / numData;
+
+  mFactors = allanFactors(numData, numCluster);
+  const int numFactors = mFactors.size();
+  mVariance.assign(numFactors, 0.0);
+  mDeviation.resize(numFactors);
+  mTimes.resize(numFactors);
+
+  // factors are independent, the second differences of the thetas (prefix
+  // sums / freq) are evaluated blockwise on the centered prefix sums
+  utils::ParallelFor(0, numFactors, m_numThreads, [&](const int i) {
+    int factor = mFactors[i];
+    double clusterPeriod2 = (period * factor) * (period * factor);
+    double divided = 2 * clusterPeriod2 * (numData - 2 * factor);
+    int max = numData - 2 * factor;
+
+    if (max > 0) {
+      mVariance[i] =
+          m_sums.secondDifferenceSquaredNorm(factor) / (m_freq * m_freq);
+    }
+    mVariance[i] = mVariance[i] / divided;
+    mDeviation[i] = sqrt(mVariance[i]);
+    mTimes[i] = period * factor;
+  });
+}
+
+}  // namespace allanvar
+}  // namespace OpenICC
@@ -0,0 +1,208 @@
+#include "OpenCameraCalibrator/allanvariance/allan_streaming.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace allanvar {
+
+std::vector<int> allanFactors(int numData, int maxCluster) {
+  int mode = numData / 2;
+  unsigned int maxStride = 1;
+  int shft = 0;
+  while (mode) {
+    mode = mode >> 1;
+    maxStride = 1 << shft;
+    shft++;
+  }
+
+  // log space between 10^0 and maxStride
+  std::vector<double> avgFactors;
+  // same float exponent as getLogSpace in AllanAcc / AllanGyr
+  const float logMaxStride = log10(maxStride);
+  const double start = pow(10, 0.0f);
+  const double end = pow(10, logMaxStride);
+  const double progression = pow(end / start, (float)1 / (maxCluster - 1));
+  avgFactors.push_back(start);
+  for (int i = 1; i < maxCluster; i++) {
+    avgFactors.push_back(avgFactors[i - 1] * progression);
+  }
+  for (int i = 0; i < maxCluster; i++) {
+    avgFactors[i] = ceil(avgFactors[i]);
+  }
+
+  std::vector<int> factors;
+  factors.push_back((int)avgFactors[0]);
+  for (int i = 1; i < maxCluster; i++) {
+    if (avgFactors[i] != avgFactors[i - 1]) {
+      factors.push_back((int)avgFactors[i]);
+    }
+  }
+  return factors;
+}
+
+AllanStreaming::AllanStreaming(std::string name,
+                               int expectedNumData,
+                               int maxCluster,
+                               double unitScale,
+                               double maxClusterTime,
+                               double expectedFreq)
+    : m_name(name),
+      m_unitScale(unitScale),
+      m_freq(0.0),
+      numData(0),
+      m_sum(0.0),
+      m_sumDt(0.0),
+      m_firstT(0.0),
+      m_lastT(0.0) {
+  mFactors = allanFactors(expectedNumData, maxCluster);
+  if (maxClusterTime > 0.0 && expectedFreq > 0.0) {
+    const int maxFactor = std::max(1, (int)(maxClusterTime * expectedFreq));
+    while (mFactors.size() > 1 && mFactors.back() > maxFactor) {
+      mFactors.pop_back();
+    }
+  }
+  mAccum.assign(mFactors.size(), 0.0);
+  m_ringSize = 2 * mFactors.back() + 1;
+  m_ring.assign(m_ringSize, 0.0);
+  std::cout << m_name << " "
+            << " num of Cluster " << maxCluster << " num of factors "
+            << mFactors.size() << std::endl;
+}
+
+void AllanStreaming::push(double data, double time) {
+  const double value = data * m_unitScale;
+  if (numData == 0) {
+    m_firstT = time;
+  } else {
+    m_sumDt += (time - m_lastT);
+  }
+  m_lastT = time;
+
+  m_sum += value;
+  const int n = numData;
+  m_ring[n % m_ringSize] = m_sum;
+  for (size_t i = 0; i < mFactors.size(); ++i) {
+    const int factor = mFactors[i];
+    // factors are sorted
+    if (n < 2 * factor) break;
+    const double temp = m_sum - 2 * m_ring[(n - factor) % m_ringSize] +
+                        m_ring[(n - 2 * factor) % m_ringSize];
+    mAccum[i] += temp * temp;
+  }
+  ++numData;
+}
+
+void AllanStreaming::calc() {
+  OPENICC_TRACE_ZONE("allan_variance_streaming");
+  std::cout << m_name << " "
+            << " numData " << numData << std::endl;
+  if (numData < 10000)
+    std::cout << m_name << " "
+              << " Too few number" << std::endl;
+  std::cout << m_name << " "
+            << "dt " << std::endl  //
+            << "-------------" << (m_lastT - m_firstT) << " s" << std::endl
+            << "-------------" << (m_lastT - m_firstT) / 60 << " min"
+            << std::endl
+            << "-------------" << (m_lastT - m_firstT) / 3600 << " h"
+            << std::endl;
+
+  const double period = m_sumDt / (numData - 1);
+  m_freq = 1.0 / period;
+  std::cout << m_name << " "
+            << " freq " << m_freq << std::endl;
+
+  mVariance.clear();
+  mDeviation.clear();
+  mTimes.clear();
+  for (size_t i = 0; i < mFactors.size(); ++i) {
+    const int factor = mFactors[i];
+    if (numData - 2 * factor <= 0) {
+      std::cout << m_name << " "
+                << " less samples than expected, dropping factors from "
+                << factor << std::endl;
+      mFactors.resize(i);
+      break;
+    }
+    const double clusterPeriod2 = (period * factor) * (period * factor);
+    const double divided = 2 * clusterPeriod2 * (numData - 2 * factor);
+    // the accumulated sums are not yet divided by the frequency
+    mVariance.push_back(mAccum[i] / (m_freq * m_freq) / divided);
+    mDeviation.push_back(sqrt(mVariance.back()));
+    mTimes.push_back(period * factor);
+  }
+}
+
+namespace {
+
+template <typename T>
+void writeValue(std::ostream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void writeVector(std::ostream& out, const std::vector<T>& values) {
+  writeValue(out, static_cast<uint64_t>(values.size()));
+  out.write(reinterpret_cast<const char*>(values.data()),
+            values.size() * sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::istream& in, T& value) {
+  return static_cast<bool>(
+      in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+template <typename T>
+bool readVector(std::istream& in, std::vector<T>& values) {
+  uint64_t size = 0;
+  if (!readValue(in, size) || size != values.size()) return false;
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(values.data()),
+                                   values.size() * sizeof(T)));
+}
+
+}  // namespace
+
+bool AllanStreaming::writeState(std::ostream& out) const {
+  writeValue(out, numData);
+  writeValue(out, m_sum);
+  writeValue(out, m_sumDt);
+  writeValue(out, m_firstT);
+  writeValue(out, m_lastT);
+  writeVector(out, mFactors);
+  writeVector(out, mAccum);
+  writeVector(out, m_ring);
+  return static_cast<bool>(out);
+}
+
+bool AllanStreaming::readState(std::istream& in) {
+  std::vector<int> factors(mFactors.size());
+  std::vector<double> accum(mAccum.size());
+  std::vector<double> ring(m_ring.size());
+  int n = 0;
+  double sum = 0.0, sumDt = 0.0, firstT = 0.0, lastT = 0.0;
+  if (!readValue(in, n) || !readValue(in, sum) || !readValue(in, sumDt) ||
+      !readValue(in, firstT) || !readValue(in, lastT) ||
+      !readVector(in, factors) || factors != mFactors ||
+      !readVector(in, accum) || !readVector(in, ring)) {
+    return false;
+  }
+  numData = n;
+  m_sum = sum;
+  m_sumDt = sumDt;
+  m_firstT = firstT;
+  m_lastT = lastT;
+  mAccum.swap(accum);
+  m_ring.swap(ring);
+  return true;
+}
+
+double AllanStreaming::getAvgValue() const { return m_sum / numData; }
+
+double AllanStreaming::getFreq() const { return m_freq; }
+
+}  // namespace allanvar
+}  // namespace OpenICC
@@ -1,5 +1,7 @@
 #include "OpenCameraCalibrator/allanvariance/fitallan_gyr.h"
 
+#include "OpenCameraCalibrator/utils/trace.h"
+
 namespace OpenICC {
 namespace allanvar {
 
@@ -7,6 +9,7 @@ FitAllanGyr::FitAllanGyr(std::vector<double> sigma2s,
                          std::vector<double> taus,
                          double _freq)
     : Q(0.0), N(0.0), B(0.0), K(0.0), R(0.0), freq(_freq) {
+  OPENICC_TRACE_ZONE("allan_fit_gyroscope");
   if (sigma2s.size() != taus.size())
     std::cerr << "Error of point size" << std::endl;
 
@@ -14,53 +17,15 @@ FitAllanGyr::FitAllanGyr(std::vector<double> sigma2s,
 
   std::vector<double> init = initValue(sigma2s, taus);
 
-  int num_samples = sigma2s.size();
-  //    double param[]  = { Q, N, B, K, R };
   double param[] = {init[0], init[1], init[2], init[3], init[4]};
 
-  ceres::Problem problem;
-
-  for (int i = 0; i < num_samples; ++i) {
-    // std::cout << "sigma " << i << " " << taus[i] << " " << sigma2s[i] <<
-    // std::endl;
-
-    ceres::CostFunction* f =
-        new ceres::AutoDiffCostFunction<AllanSigmaError, 1, 5>(
-            new AllanSigmaError(sigma2s[i], taus[i]));
-
-    problem.AddResidualBlock(f, NULL /* squared loss */, param);
-  }
-  ceres::Solver::Options options;
-  options.minimizer_progress_to_stdout = true;
-  options.logging_type = ceres::SILENT;
-  options.trust_region_strategy_type = ceres::DOGLEG;
-  //    options.max_num_iterations         = 5;
-
-  ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
-  //        std::cout << summary.FullReport( ) << "\n";
-  //    std::cout << "num_parameters " << summary.num_parameters << std::endl;
+  solveAllanModel(sigma2s, m_taus, param);
 
   Q = param[0];
   N = param[1];
   B = param[2];
   K = param[3];
   R = param[4];
-
-  // std::cout << "Q " << Q //
-  //           << " " << N  //
-  //           << " " << B  //
-  //           << " " << K  //
-  //           << " " << R << std::endl;
-
-  std::cout << " Bias Instability " << getB() / (57.3 * 3600) << " rad/s"
-            << std::endl;
-  std::cout << " Bias Instability " << getBiasInstability() << " rad/s, at "
-            << taus[findMinIndex(calcSimDeviation(taus))] << " s" << std::endl;
-
-  std::cout << " White Noise " << sqrt(freq) * getN() * 60 / 57.3 << " rad/s"
-            << std::endl;
-  std::cout << " White Noise " << getWhiteNoise() << " rad/s" << std::endl;
 }
 
 std::vector<double> FitAllanGyr::initValue(std::vector<double> sigma2s,
@@ -96,7 +61,6 @@ std::vector<double> FitAllanGyr::initValue(std::vector<double> sigma2s,
   //        std::cout << "A " << A << std::endl;
 
   Eigen::MatrixXd C = A.inverse() * B;
-  std::cout << "C " << C.transpose() << std::endl;
 
   std::vector<double> init;
   for (int index = 0; index < 2 * m_order + 1; ++index)
@@ -116,10 +80,30 @@ double FitAllanGyr::getBiasInstability() const {
   return findMinNum(calcSimDeviation(m_taus)) / (57.3 * 3600);
 }
 
+double FitAllanGyr::getBiasInstabilityTime() const {
+  if (m_taus.empty()) {
+    return 0.0;
+  }
+  return m_taus[findMinIndex(calcSimDeviation(m_taus))];
+}
+
 double FitAllanGyr::getWhiteNoise() const {
   return sqrt(freq) * sqrt(calcSigma2(Q, N, B, K, R, 1)) / (57.3 * 3600);
 }
 
+AllanFitResult FitAllanGyr::getResult() const {
+  AllanFitResult result;
+  result.Q = Q;
+  result.N = N;
+  result.B = B;
+  result.K = K;
+  result.R = R;
+  result.biasInstability = getBiasInstability();
+  result.biasInstabilityTime = getBiasInstabilityTime();
+  result.whiteNoise = getWhiteNoise();
+  return result;
+}
+
 double FitAllanGyr::findMinNum(const std::vector<double> num) const {
   double min = 1000.0;
   for (unsigned int index = 0; index < num.size(); ++index)
@@ -127,7 +111,7 @@ double FitAllanGyr::findMinNum(const std::vector<double> num) const {
   return min;
 }
 
-int FitAllanGyr::findMinIndex(std::vector<double> num) {
+int FitAllanGyr::findMinIndex(std::vector<double> num) const {
   double min = 1000.0;
   int min_index = 0;
   for (unsigned int index = 0; index < num.size(); ++index) {
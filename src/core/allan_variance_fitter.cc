@@ -5,14 +5,128 @@
 
 #include "OpenCameraCalibrator/allanvariance/fitallan_acc.h"
 #include "OpenCameraCalibrator/allanvariance/fitallan_gyr.h"
+#include "OpenCameraCalibrator/utils/checkpoint.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
 
 namespace OpenICC {
 namespace core {
 
+namespace {
+
+//! Binary Allan checkpoint format:
+//! magic, version, number of samples, first and last accelerometer
+//! timestamp, next sample, then the states of the gyro x, y, z and acc x, y,
+//! z estimators, see AllanStreaming::writeState
+const char ALLAN_CHECKPOINT_MAGIC[8] = {
+    'O', 'I', 'C', 'C', 'A', 'L', 'N', '\0'};
+const uint32_t ALLAN_CHECKPOINT_VERSION = 1;
+
+struct AllanCheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint64_t num_samples;
+  double first_t_s;
+  double last_t_s;
+  uint64_t next_sample;
+};
+
+//! Samples pushed between two checkpoint checks. The six estimators are at
+//! the same sample after every chunk.
+const size_t ALLAN_CHUNK_SIZE = 1 << 16;
+
+AllanCheckpointHeader MakeCheckpointHeader(
+    const CameraTelemetryData& telemetry_data, const size_t next_sample) {
+  AllanCheckpointHeader header;
+  std::copy(ALLAN_CHECKPOINT_MAGIC, ALLAN_CHECKPOINT_MAGIC + 8, header.magic);
+  header.version = ALLAN_CHECKPOINT_VERSION;
+  header.num_samples = telemetry_data.accelerometer.size();
+  header.first_t_s = telemetry_data.accelerometer.empty()
+                         ? 0.0
+                         : telemetry_data.accelerometer.front().timestamp_s();
+  header.last_t_s = telemetry_data.accelerometer.empty()
+                        ? 0.0
+                        : telemetry_data.accelerometer.back().timestamp_s();
+  header.next_sample = next_sample;
+  return header;
+}
+
+}  // namespace
+
 AllanVarianceFitter::AllanVarianceFitter(
-    const CameraTelemetryData& telemetry_data, const int nr_clusters)
-    : telemetry_data_(telemetry_data) {
+    const CameraTelemetryData& telemetry_data,
+    const int nr_clusters,
+    const bool streaming,
+    const int num_threads,
+    const AllanCheckpointOptions& checkpoint)
+    : streaming_(streaming), num_threads_(num_threads) {
   std::cout << "Loading datastructes\n";
+  if (streaming_) {
+    const int nr_samples = telemetry_data.accelerometer.size();
+    auto create_estimators = [&]() {
+      streaming_acc_.clear();
+      streaming_gyr_.clear();
+      const std::string axis[3] = {"x", "y", "z"};
+      for (int a = 0; a < 3; ++a) {
+        streaming_acc_.emplace_back(new allanvar::AllanStreaming(
+            "acc_" + axis[a], nr_samples, nr_clusters));
+        // rad/s to degree/h as in AllanGyr::pushRadPerSec
+        streaming_gyr_.emplace_back(new allanvar::AllanStreaming(
+            "gyr_" + axis[a], nr_samples, nr_clusters, 57.3 * 3600));
+      }
+    };
+    create_estimators();
+
+    utils::Checkpointer checkpointer(checkpoint.path, checkpoint.interval_s);
+    size_t next_sample = 0;
+    if (checkpoint.resume && checkpointer.Exists()) {
+      if (ReadCheckpoint(checkpointer.Path(), telemetry_data, next_sample)) {
+        LOG(INFO) << "Resuming the Allan variance at sample " << next_sample
+                  << " of " << nr_samples << ".";
+      } else {
+        LOG(WARNING) << "Checkpoint " << checkpointer.Path()
+                     << " was written for other data, starting over.";
+        next_sample = 0;
+        create_estimators();
+      }
+    }
+
+    const size_t num_samples = telemetry_data.accelerometer.size();
+    for (size_t begin = next_sample; begin < num_samples;
+         begin += ALLAN_CHUNK_SIZE) {
+      const size_t end = std::min(num_samples, begin + ALLAN_CHUNK_SIZE);
+      // one estimator per task, every task streams over all samples
+      utils::ParallelFor(0, 6, num_threads_, [&](const int task) {
+        const int a = task % 3;
+        const bool is_gyr = task >= 3;
+        const auto& readings =
+            is_gyr ? telemetry_data.gyroscope : telemetry_data.accelerometer;
+        allanvar::AllanStreaming& allan =
+            is_gyr ? *streaming_gyr_[a] : *streaming_acc_[a];
+        for (size_t i = begin; i < std::min(end, readings.size()); ++i) {
+          allan.push(readings[i](a),
+                     telemetry_data.accelerometer[i].timestamp_s());
+        }
+      });
+      if (end < num_samples && checkpointer.Due()) {
+        checkpointer.Write([&](const std::string& path) {
+          return WriteCheckpoint(path, telemetry_data, end);
+        });
+      }
+    }
+    checkpointer.Remove();
+    return;
+  }
+  if (!checkpoint.path.empty()) {
+    LOG(WARNING) << "Only the streaming Allan variance writes checkpoints.";
+  }
+  telemetry_data_ = telemetry_data;
 
   data_acc_x_ = new allanvar::AllanAcc("acc_x", nr_clusters);
   data_acc_y_ = new allanvar::AllanAcc("acc_y", nr_clusters);
@@ -22,6 +136,15 @@ AllanVarianceFitter::AllanVarianceFitter(
   data_gyr_y_ = new allanvar::AllanGyr("gyr_y", nr_clusters);
   data_gyr_z_ = new allanvar::AllanGyr("gyr_z", nr_clusters);
 
+  // threads left after running the six sensors concurrently
+  const int factor_threads = std::max(1, num_threads_ / 6);
+  data_acc_x_->setNumThreads(factor_threads);
+  data_acc_y_->setNumThreads(factor_threads);
+  data_acc_z_->setNumThreads(factor_threads);
+  data_gyr_x_->setNumThreads(factor_threads);
+  data_gyr_y_->setNumThreads(factor_threads);
+  data_gyr_z_->setNumThreads(factor_threads);
+
   for (size_t i = 0; i < telemetry_data_.accelerometer.size(); ++i) {
     const double t_s = telemetry_data_.accelerometer[i].timestamp_s();
     data_acc_x_->pushMPerSec2(telemetry_data_.accelerometer[i].x(), t_s);
@@ -34,78 +157,166 @@ AllanVarianceFitter::AllanVarianceFitter(
   }
 }
 
-bool AllanVarianceFitter::RunFit() {
-  data_gyr_x_->calc();
-  std::vector<double> gyro_v_x = data_gyr_x_->getVariance();
-  std::vector<double> gyro_d_x = data_gyr_x_->getDeviation();
-  std::vector<double> gyro_ts_x = data_gyr_x_->getTimes();
-
-  data_gyr_y_->calc();
-  std::vector<double> gyro_v_y = data_gyr_y_->getVariance();
-  std::vector<double> gyro_d_y = data_gyr_y_->getDeviation();
-  std::vector<double> gyro_ts_y = data_gyr_y_->getTimes();
-
-  data_gyr_z_->calc();
-  std::vector<double> gyro_v_z = data_gyr_z_->getVariance();
-  std::vector<double> gyro_d_z = data_gyr_z_->getDeviation();
-  std::vector<double> gyro_ts_z = data_gyr_z_->getTimes();
-
-  std::cout << "Gyro X " << std::endl;
-  allanvar::FitAllanGyr fit_gyr_x(gyro_v_x, gyro_ts_x, data_gyr_x_->getFreq());
-  std::cout << "  bias " << data_gyr_x_->getAvgValue() / 3600 << " degree/s"
-            << std::endl;
-  std::cout << "-------------------" << std::endl;
-
-  std::cout << "Gyro y " << std::endl;
-  allanvar::FitAllanGyr fit_gyr_y(gyro_v_y, gyro_ts_y, data_gyr_y_->getFreq());
-  std::cout << "  bias " << data_gyr_y_->getAvgValue() / 3600 << " degree/s"
-            << std::endl;
-  std::cout << "-------------------" << std::endl;
-
-  std::cout << "Gyro z " << std::endl;
-  allanvar::FitAllanGyr fit_gyr_z(gyro_v_z, gyro_ts_z, data_gyr_z_->getFreq());
-  std::cout << "  bias " << data_gyr_z_->getAvgValue() / 3600 << " degree/s"
-            << std::endl;
-  std::cout << "-------------------" << std::endl;
-
-  std::vector<double> gyro_sim_d_x = fit_gyr_x.calcSimDeviation(gyro_ts_x);
-  std::vector<double> gyro_sim_d_y = fit_gyr_y.calcSimDeviation(gyro_ts_y);
-  std::vector<double> gyro_sim_d_z = fit_gyr_z.calcSimDeviation(gyro_ts_z);
-
-  std::cout << "==============================================" << std::endl;
-  std::cout << "==============================================" << std::endl;
+AllanVarianceFitter::~AllanVarianceFitter() {
+  delete data_acc_x_;
+  delete data_acc_y_;
+  delete data_acc_z_;
+  delete data_gyr_x_;
+  delete data_gyr_y_;
+  delete data_gyr_z_;
+}
 
-  data_acc_x_->calc();
-  std::vector<double> acc_v_x = data_acc_x_->getVariance();
-  std::vector<double> acc_d_x = data_acc_x_->getDeviation();
-  std::vector<double> acc_ts_x = data_acc_x_->getTimes();
+bool AllanVarianceFitter::RunFit() {
+  OPENICC_TRACE_ZONE("allan_fit");
+  if (streaming_) {
+    return RunStreamingFit();
+  }
+  // the six sensors are independent
+  utils::ParallelFor(0, 6, num_threads_, [&](const int task) {
+    switch (task) {
+      case 0: data_gyr_x_->calc(); break;
+      case 1: data_gyr_y_->calc(); break;
+      case 2: data_gyr_z_->calc(); break;
+      case 3: data_acc_x_->calc(); break;
+      case 4: data_acc_y_->calc(); break;
+      case 5: data_acc_z_->calc(); break;
+    }
+  });
+  const allanvar::AllanGyr* gyr[3] = {data_gyr_x_, data_gyr_y_, data_gyr_z_};
+  const allanvar::AllanAcc* acc[3] = {data_acc_x_, data_acc_y_, data_acc_z_};
+  AllanCurve curves[6];
+  for (int a = 0; a < 3; ++a) {
+    curves[a] = {&gyr[a]->getVariance(),
+                 &gyr[a]->getTimes(),
+                 gyr[a]->getFreq(),
+                 gyr[a]->getAvgValue()};
+    curves[3 + a] = {&acc[a]->getVariance(),
+                     &acc[a]->getTimes(),
+                     acc[a]->getFreq(),
+                     acc[a]->getAvgValue()};
+  }
+  return FitCurves(curves);
+}
 
-  data_acc_y_->calc();
-  std::vector<double> acc_v_y = data_acc_y_->getVariance();
-  std::vector<double> acc_d_y = data_acc_y_->getDeviation();
-  std::vector<double> acc_ts_y = data_acc_y_->getTimes();
+bool AllanVarianceFitter::RunStreamingFit() {
+  OPENICC_TRACE_ZONE("allan_streaming_fit");
+  utils::ParallelFor(0, 6, num_threads_, [&](const int task) {
+    if (task < 3) {
+      streaming_gyr_[task]->calc();
+    } else {
+      streaming_acc_[task - 3]->calc();
+    }
+  });
+  AllanCurve curves[6];
+  for (int a = 0; a < 3; ++a) {
+    const allanvar::AllanStreaming& gyr = *streaming_gyr_[a];
+    const allanvar::AllanStreaming& acc = *streaming_acc_[a];
+    curves[a] = {&gyr.getVariance(),
+                 &gyr.getTimes(),
+                 gyr.getFreq(),
+                 gyr.getAvgValue()};
+    curves[3 + a] = {&acc.getVariance(),
+                     &acc.getTimes(),
+                     acc.getFreq(),
+                     acc.getAvgValue()};
+  }
+  return FitCurves(curves);
+}
 
-  data_acc_z_->calc();
-  std::vector<double> acc_v_z = data_acc_z_->getVariance();
-  std::vector<double> acc_d_z = data_acc_z_->getDeviation();
-  std::vector<double> acc_ts_z = data_acc_z_->getTimes();
+bool AllanVarianceFitter::WriteCheckpoint(
+    const std::string& path,
+    const CameraTelemetryData& telemetry_data,
+    const size_t next_sample) const {
+  std::ofstream out(path, std::ios::binary);
+  if (!out.is_open()) {
+    return false;
+  }
+  const AllanCheckpointHeader header =
+      MakeCheckpointHeader(telemetry_data, next_sample);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const auto& allan : streaming_gyr_) {
+    if (!allan->writeState(out)) return false;
+  }
+  for (const auto& allan : streaming_acc_) {
+    if (!allan->writeState(out)) return false;
+  }
+  return static_cast<bool>(out);
+}
 
-  std::cout << "acc X " << std::endl;
-  allanvar::FitAllanAcc fit_acc_x(acc_v_x, acc_ts_x, data_acc_x_->getFreq());
-  std::cout << "-------------------" << std::endl;
+bool AllanVarianceFitter::ReadCheckpoint(
+    const std::string& path,
+    const CameraTelemetryData& telemetry_data,
+    size_t& next_sample) {
+  std::ifstream in(path, std::ios::binary);
+  AllanCheckpointHeader header;
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    return false;
+  }
+  const AllanCheckpointHeader expected =
+      MakeCheckpointHeader(telemetry_data, header.next_sample);
+  if (!std::equal(header.magic, header.magic + 8, expected.magic) ||
+      header.version != expected.version ||
+      header.num_samples != expected.num_samples ||
+      header.first_t_s != expected.first_t_s ||
+      header.last_t_s != expected.last_t_s ||
+      header.next_sample > header.num_samples) {
+    return false;
+  }
+  for (const auto& allan : streaming_gyr_) {
+    if (!allan->readState(in)) return false;
+  }
+  for (const auto& allan : streaming_acc_) {
+    if (!allan->readState(in)) return false;
+  }
+  next_sample = header.next_sample;
+  return true;
+}
 
-  std::cout << "acc y " << std::endl;
-  allanvar::FitAllanAcc fit_acc_y(acc_v_y, acc_ts_y, data_acc_y_->getFreq());
-  std::cout << "-------------------" << std::endl;
+bool AllanVarianceFitter::FitCurves(const AllanCurve (&curves)[6]) {
+  // the six model fits are independent, gyro x, y, z then acc x, y, z
+  allanvar::AllanFitResult fits[6];
+  utils::ParallelFor(0, 6, num_threads_, [&](const int task) {
+    const AllanCurve& curve = curves[task];
+    if (task < 3) {
+      fits[task] =
+          allanvar::FitAllanGyr(*curve.variance, *curve.times, curve.freq)
+              .getResult();
+    } else {
+      fits[task] =
+          allanvar::FitAllanAcc(*curve.variance, *curve.times, curve.freq)
+              .getResult();
+    }
+  });
 
-  std::cout << "acc z " << std::endl;
-  allanvar::FitAllanAcc fit_acc_z(acc_v_z, acc_ts_z, data_acc_z_->getFreq());
-  std::cout << "-------------------" << std::endl;
+  const std::string axis[3] = {"x", "y", "z"};
+  for (int a = 0; a < 3; ++a) {
+    const allanvar::AllanFitResult& fit = fits[a];
+    std::cout << "Gyro " << axis[a] << " " << std::endl;
+    std::cout << "  bias " << curves[a].avg_value / 3600 << " degree/s"
+              << std::endl;
+    std::cout << " Bias Instability " << fit.biasInstability << " rad/s, at "
+              << fit.biasInstabilityTime << " s" << std::endl;
+    std::cout << " White Noise " << fit.whiteNoise << " rad/s" << std::endl;
+    std::cout << "-------------------" << std::endl;
+    gyro_bias_instability_[a] = fit.biasInstability;
+    gyro_bias_instability_time_s_[a] = fit.biasInstabilityTime;
+    gyro_white_noise_[a] = fit.whiteNoise;
+  }
 
-  std::vector<double> acc_sim_d_x = fit_acc_x.calcSimDeviation(acc_ts_x);
-  std::vector<double> acc_sim_d_y = fit_acc_y.calcSimDeviation(acc_ts_x);
-  std::vector<double> acc_sim_d_z = fit_acc_z.calcSimDeviation(acc_ts_x);
+  std::cout << "==============================================" << std::endl;
+  std::cout << "==============================================" << std::endl;
 
+  for (int a = 0; a < 3; ++a) {
+    const allanvar::AllanFitResult& fit = fits[3 + a];
+    std::cout << "acc " << axis[a] << " " << std::endl;
+    std::cout << " Bias Instability " << fit.biasInstability << " m/s^2"
+              << std::endl;
+    std::cout << " White Noise " << fit.whiteNoise << " m/s^2" << std::endl;
+    std::cout << "-------------------" << std::endl;
+    accl_bias_instability_[a] = fit.biasInstability;
+    accl_bias_instability_time_s_[a] = fit.biasInstabilityTime;
+    accl_white_noise_[a] = fit.whiteNoise;
+  }
   return true;
 }
 
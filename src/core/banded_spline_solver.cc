@@ -0,0 +1,505 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/banded_spline_solver.h"
+
+#include <Eigen/Cholesky>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <unordered_set>
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+using RowMajorMatrix =
+    Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+// same diagonal clamping as the ceres LM strategy
+const double kMinDiagonal = 1e-6;
+const double kMaxDiagonal = 1e32;
+
+// Cholesky factorization A = L * L^T of a symmetric positive definite band
+// matrix. The lower band is stored as band(i, d) = A(i, i - d).
+class BandedCholesky {
+ public:
+  bool Factorize(const Eigen::MatrixXd& band) {
+    L_ = band;
+    bw_ = static_cast<int>(band.cols()) - 1;
+    const int n = static_cast<int>(band.rows());
+    for (int j = 0; j < n; ++j) {
+      double diag = L_(j, 0);
+      for (int k = std::max(0, j - bw_); k < j; ++k) {
+        diag -= L(j, k) * L(j, k);
+      }
+      if (!(diag > 0.0)) {
+        return false;
+      }
+      const double l_jj = std::sqrt(diag);
+      L_(j, 0) = l_jj;
+      const int i_end = std::min(n - 1, j + bw_);
+      for (int i = j + 1; i <= i_end; ++i) {
+        double value = L_(i, i - j);
+        for (int k = std::max(0, i - bw_); k < j; ++k) {
+          value -= L(i, k) * L(j, k);
+        }
+        L_(i, i - j) = value / l_jj;
+      }
+    }
+    return true;
+  }
+
+  // X <- A^-1 X
+  template <typename Matrix>
+  void SolveInPlace(Matrix* X) const {
+    const int n = static_cast<int>(L_.rows());
+    for (int i = 0; i < n; ++i) {
+      for (int k = std::max(0, i - bw_); k < i; ++k) {
+        X->row(i) -= L(i, k) * X->row(k);
+      }
+      X->row(i) /= L(i, i);
+    }
+    for (int i = n - 1; i >= 0; --i) {
+      const int k_end = std::min(n - 1, i + bw_);
+      for (int k = i + 1; k <= k_end; ++k) {
+        X->row(i) -= L(k, i) * X->row(k);
+      }
+      X->row(i) /= L(i, i);
+    }
+  }
+
+ private:
+  double L(const int i, const int k) const { return L_(i, i - k); }
+
+  Eigen::MatrixXd L_;
+  int bw_ = 0;
+};
+
+Eigen::VectorXd Multiply(const ceres::CRSMatrix& A, const Eigen::VectorXd& x) {
+  Eigen::VectorXd y = Eigen::VectorXd::Zero(A.num_rows);
+  for (int r = 0; r < A.num_rows; ++r) {
+    for (int idx = A.rows[r]; idx < A.rows[r + 1]; ++idx) {
+      y[r] += A.values[idx] * x[A.cols[idx]];
+    }
+  }
+  return y;
+}
+
+}  // namespace
+
+BandedSplineSolver::BandedSplineSolver(
+    ceres::Problem* problem, const std::vector<double*>& banded_blocks)
+    : problem_(problem) {
+  std::unordered_set<double*> in_band;
+  for (double* block : banded_blocks) {
+    if (!problem_->HasParameterBlock(block) ||
+        problem_->IsParameterBlockConstant(block)) {
+      continue;
+    }
+    blocks_.push_back(block);
+    in_band.insert(block);
+  }
+  num_banded_blocks_ = static_cast<int>(blocks_.size());
+
+  std::vector<double*> all_blocks;
+  problem_->GetParameterBlocks(&all_blocks);
+  for (double* block : all_blocks) {
+    if (in_band.count(block) == 0 &&
+        !problem_->IsParameterBlockConstant(block)) {
+      blocks_.push_back(block);
+    }
+  }
+
+  int offset = 0;
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    if (static_cast<int>(i) == num_banded_blocks_) {
+      num_banded_cols_ = offset;
+    }
+    local_offsets_.push_back(offset);
+    offset += problem_->ParameterBlockLocalSize(blocks_[i]);
+  }
+  if (num_banded_blocks_ == static_cast<int>(blocks_.size())) {
+    num_banded_cols_ = offset;
+  }
+  num_cols_ = offset;
+}
+
+bool BandedSplineSolver::Evaluate(const int num_threads,
+                                  double* cost,
+                                  ceres::CRSMatrix* jacobian,
+                                  Eigen::VectorXd* residuals) {
+  ceres::Problem::EvaluateOptions eval_options;
+  eval_options.parameter_blocks = blocks_;
+  eval_options.num_threads = num_threads;
+  std::vector<double> residual_values;
+  if (!problem_->Evaluate(eval_options,
+                          cost,
+                          residuals ? &residual_values : nullptr,
+                          nullptr,
+                          jacobian)) {
+    return false;
+  }
+  if (residuals) {
+    *residuals = Eigen::Map<const Eigen::VectorXd>(residual_values.data(),
+                                                   residual_values.size());
+  }
+  return true;
+}
+
+int BandedSplineSolver::ComputeBandwidth(
+    const ceres::CRSMatrix& jacobian) const {
+  int bandwidth = 0;
+  for (int r = 0; r < jacobian.num_rows; ++r) {
+    int min_col = num_banded_cols_;
+    int max_col = -1;
+    for (int idx = jacobian.rows[r]; idx < jacobian.rows[r + 1]; ++idx) {
+      const int col = jacobian.cols[idx];
+      if (col < num_banded_cols_) {
+        min_col = std::min(min_col, col);
+        max_col = std::max(max_col, col);
+      }
+    }
+    bandwidth = std::max(bandwidth, max_col - min_col);
+  }
+  return bandwidth;
+}
+
+void BandedSplineSolver::BuildNormalEquations(
+    const ceres::CRSMatrix& jacobian,
+    const Eigen::VectorXd& residuals,
+    NormalEquations* normal_equations) const {
+  const int num_border_cols = num_cols_ - num_banded_cols_;
+  normal_equations->band.setZero(num_banded_cols_, bandwidth_ + 1);
+  normal_equations->border_knots.setZero(num_border_cols, num_banded_cols_);
+  normal_equations->border.setZero(num_border_cols, num_border_cols);
+  normal_equations->gradient.setZero(num_cols_);
+
+  // residual blocks store dense Jacobian blocks, e.g. a reprojection row has
+  // explicit zeros for all other points of the view. Skip them.
+  std::vector<int> cols;
+  std::vector<double> values;
+  for (int r = 0; r < jacobian.num_rows; ++r) {
+    cols.clear();
+    values.clear();
+    for (int idx = jacobian.rows[r]; idx < jacobian.rows[r + 1]; ++idx) {
+      if (jacobian.values[idx] != 0.0) {
+        cols.push_back(jacobian.cols[idx]);
+        values.push_back(jacobian.values[idx]);
+      }
+    }
+    const double residual = residuals[r];
+    for (size_t a = 0; a < cols.size(); ++a) {
+      const int col_a = cols[a];
+      const double value_a = values[a];
+      normal_equations->gradient[col_a] += value_a * residual;
+      for (size_t b = 0; b < cols.size(); ++b) {
+        const int col_b = cols[b];
+        if (col_b > col_a) continue;
+        const double h = value_a * values[b];
+        if (col_a < num_banded_cols_) {
+          normal_equations->band(col_a, col_a - col_b) += h;
+        } else if (col_b < num_banded_cols_) {
+          normal_equations->border_knots(col_a - num_banded_cols_, col_b) += h;
+        } else {
+          normal_equations->border(col_a - num_banded_cols_,
+                                   col_b - num_banded_cols_) += h;
+        }
+      }
+    }
+  }
+}
+
+bool BandedSplineSolver::SolveDampedSystem(
+    const NormalEquations& normal_equations,
+    const double lambda,
+    Eigen::VectorXd* delta) const {
+  const int num_border_cols = num_cols_ - num_banded_cols_;
+  auto damping = [&](const double h_ii) {
+    return lambda * std::min(std::max(h_ii, kMinDiagonal), kMaxDiagonal);
+  };
+
+  Eigen::MatrixXd band = normal_equations.band;
+  for (int i = 0; i < num_banded_cols_; ++i) {
+    band(i, 0) += damping(band(i, 0));
+  }
+  BandedCholesky cholesky;
+  if (!cholesky.Factorize(band)) {
+    return false;
+  }
+
+  // [A B; B^T C] [d_k; d_b] = -[g_k; g_b], A is banded
+  RowMajorMatrix A_inv_B = normal_equations.border_knots.transpose();
+  cholesky.SolveInPlace(&A_inv_B);
+  Eigen::VectorXd d_k = -normal_equations.gradient.head(num_banded_cols_);
+  cholesky.SolveInPlace(&d_k);
+
+  Eigen::MatrixXd schur =
+      normal_equations.border.selfadjointView<Eigen::Lower>();
+  for (int i = 0; i < num_border_cols; ++i) {
+    schur(i, i) += damping(schur(i, i));
+  }
+  schur.noalias() -= normal_equations.border_knots * A_inv_B;
+  const Eigen::VectorXd rhs =
+      -normal_equations.gradient.tail(num_border_cols) -
+      normal_equations.border_knots * d_k;
+
+  Eigen::LLT<Eigen::MatrixXd> llt(schur);
+  if (llt.info() != Eigen::Success) {
+    return false;
+  }
+  const Eigen::VectorXd d_b = llt.solve(rhs);
+
+  delta->resize(num_cols_);
+  delta->head(num_banded_cols_) = d_k - A_inv_B * d_b;
+  delta->tail(num_border_cols) = d_b;
+  return delta->allFinite();
+}
+
+void BandedSplineSolver::ApplyStep(const Eigen::VectorXd& delta) {
+  std::vector<double> x_plus;
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    double* block = blocks_[i];
+    const double* block_delta = delta.data() + local_offsets_[i];
+    const int size = problem_->ParameterBlockSize(block);
+    const ceres::LocalParameterization* parameterization =
+        problem_->GetParameterization(block);
+    if (parameterization) {
+      x_plus.resize(size);
+      parameterization->Plus(block, block_delta, x_plus.data());
+      std::copy(x_plus.begin(), x_plus.end(), block);
+    } else {
+      for (int j = 0; j < size; ++j) {
+        block[j] += block_delta[j];
+      }
+    }
+  }
+}
+
+void BandedSplineSolver::StoreParameters() {
+  stored_parameters_.resize(blocks_.size());
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    const int size = problem_->ParameterBlockSize(blocks_[i]);
+    stored_parameters_[i].assign(blocks_[i], blocks_[i] + size);
+  }
+}
+
+void BandedSplineSolver::RestoreParameters() {
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    std::copy(stored_parameters_[i].begin(),
+              stored_parameters_[i].end(),
+              blocks_[i]);
+  }
+}
+
+void BandedSplineSolver::Solve(const Options& options,
+                               ceres::Solver::Summary* summary) {
+  using Clock = std::chrono::steady_clock;
+  const auto start = Clock::now();
+  double linear_solver_time_s = 0.0;
+  double residual_evaluation_time_s = 0.0;
+  double jacobian_evaluation_time_s = 0.0;
+  auto evaluate = [&](double* cost,
+                      ceres::CRSMatrix* jacobian,
+                      Eigen::VectorXd* residuals) {
+    const auto evaluate_start = Clock::now();
+    const bool success =
+        Evaluate(options.num_threads, cost, jacobian, residuals);
+    (jacobian ? jacobian_evaluation_time_s : residual_evaluation_time_s) +=
+        std::chrono::duration<double>(Clock::now() - evaluate_start).count();
+    return success;
+  };
+
+  summary->termination_type = ceres::NO_CONVERGENCE;
+  summary->num_successful_steps = 0;
+  summary->num_unsuccessful_steps = 0;
+
+  double cost = 0.0;
+  ceres::CRSMatrix jacobian;
+  Eigen::VectorXd residuals;
+  if (!evaluate(&cost, &jacobian, &residuals)) {
+    summary->termination_type = ceres::FAILURE;
+    summary->message = "Residual and Jacobian evaluation failed.";
+    return;
+  }
+  bandwidth_ = ComputeBandwidth(jacobian);
+  summary->initial_cost = cost;
+  summary->final_cost = cost;
+  if (options.minimizer_progress_to_stdout) {
+    std::cout << "Banded spline solver: " << num_banded_cols_
+              << " knot parameters (half bandwidth " << bandwidth_ << "), "
+              << num_cols_ - num_banded_cols_ << " border parameters\n";
+  }
+
+  NormalEquations normal_equations;
+  BuildNormalEquations(jacobian, residuals, &normal_equations);
+
+  // an iteration lasts until the next one starts, so it includes the
+  // Jacobian evaluation at its accepted step
+  auto iteration_start = Clock::now();
+  auto finish_iteration = [&](ceres::IterationSummary& iteration) {
+    const auto now = Clock::now();
+    iteration.gradient_norm = normal_equations.gradient.norm();
+    iteration.gradient_max_norm =
+        normal_equations.gradient.lpNorm<Eigen::Infinity>();
+    iteration.iteration_time_in_seconds =
+        std::chrono::duration<double>(now - iteration_start).count();
+    iteration.cumulative_time_in_seconds =
+        std::chrono::duration<double>(now - start).count();
+    iteration_start = now;
+    summary->iterations.push_back(iteration);
+    for (ceres::IterationCallback* callback : options.callbacks) {
+      const ceres::CallbackReturnType result = (*callback)(iteration);
+      if (summary->termination_type != ceres::NO_CONVERGENCE) {
+        continue;
+      }
+      if (result == ceres::SOLVER_ABORT) {
+        summary->termination_type = ceres::USER_FAILURE;
+        summary->message = "User callback returned SOLVER_ABORT.";
+        return false;
+      } else if (result == ceres::SOLVER_TERMINATE_SUCCESSFULLY) {
+        summary->termination_type = ceres::USER_SUCCESS;
+        summary->message =
+            "User callback returned SOLVER_TERMINATE_SUCCESSFULLY.";
+        return false;
+      }
+    }
+    return true;
+  };
+
+  double lambda = options.initial_lambda;
+  double nu = 2.0;
+  bool out_of_time = false;
+  for (int iter = 0; iter < options.max_num_iterations; ++iter) {
+    if (std::chrono::duration<double>(Clock::now() - start).count() >
+        options.max_solver_time_s) {
+      out_of_time = true;
+      break;
+    }
+    ceres::IterationSummary iteration;
+    iteration.iteration = iter;
+    iteration.cost = cost;
+
+    Eigen::VectorXd delta;
+    const auto solve_start = Clock::now();
+    const bool solved = SolveDampedSystem(normal_equations, lambda, &delta);
+    iteration.step_solver_time_in_seconds =
+        std::chrono::duration<double>(Clock::now() - solve_start).count();
+    linear_solver_time_s += iteration.step_solver_time_in_seconds;
+
+    double new_cost = cost;
+    double model_reduction = 0.0;
+    bool step_evaluated = false;
+    if (solved) {
+      model_reduction = -(normal_equations.gradient.dot(delta) +
+                          0.5 * Multiply(jacobian, delta).squaredNorm());
+      StoreParameters();
+      ApplyStep(delta);
+      step_evaluated = evaluate(&new_cost, nullptr, nullptr);
+    }
+
+    const double relative_decrease =
+        model_reduction > 0.0 ? (cost - new_cost) / model_reduction : -1.0;
+    iteration.step_norm = solved ? delta.norm() : 0.0;
+    iteration.trust_region_radius = 1.0 / lambda;
+    iteration.relative_decrease = relative_decrease;
+
+    if (!step_evaluated || relative_decrease < 1e-3) {
+      if (solved) {
+        RestoreParameters();
+      }
+      lambda *= nu;
+      nu *= 2.0;
+      ++summary->num_unsuccessful_steps;
+      iteration.step_is_successful = false;
+      if (!finish_iteration(iteration)) {
+        break;
+      }
+      continue;
+    }
+
+    const double cost_change = cost - new_cost;
+    const double old_cost = cost;
+    cost = new_cost;
+    lambda *= std::max(1.0 / 3.0,
+                       1.0 - std::pow(2.0 * relative_decrease - 1.0, 3));
+    nu = 2.0;
+    ++summary->num_successful_steps;
+    iteration.step_is_successful = true;
+    iteration.cost = cost;
+    iteration.cost_change = cost_change;
+
+    if (options.minimizer_progress_to_stdout) {
+      std::printf("%4d: cost %e, cost change %e, |step| %e, lambda %e\n",
+                  iter,
+                  cost,
+                  cost_change,
+                  iteration.step_norm,
+                  lambda);
+    }
+
+    if (cost_change <= options.function_tolerance * old_cost) {
+      summary->termination_type = ceres::CONVERGENCE;
+      summary->message = "Function tolerance reached.";
+      finish_iteration(iteration);
+      break;
+    }
+    double x_norm = 0.0;
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+      const int size = problem_->ParameterBlockSize(blocks_[i]);
+      for (int j = 0; j < size; ++j) {
+        x_norm += blocks_[i][j] * blocks_[i][j];
+      }
+    }
+    x_norm = std::sqrt(x_norm);
+    if (iteration.step_norm <=
+        options.parameter_tolerance * (x_norm + options.parameter_tolerance)) {
+      summary->termination_type = ceres::CONVERGENCE;
+      summary->message = "Parameter tolerance reached.";
+      finish_iteration(iteration);
+      break;
+    }
+
+    if (!evaluate(&cost, &jacobian, &residuals)) {
+      summary->termination_type = ceres::FAILURE;
+      summary->message = "Residual and Jacobian evaluation failed.";
+      finish_iteration(iteration);
+      break;
+    }
+    BuildNormalEquations(jacobian, residuals, &normal_equations);
+    if (!finish_iteration(iteration)) {
+      break;
+    }
+  }
+
+  summary->final_cost = cost;
+  summary->linear_solver_time_in_seconds = linear_solver_time_s;
+  summary->residual_evaluation_time_in_seconds = residual_evaluation_time_s;
+  summary->jacobian_evaluation_time_in_seconds = jacobian_evaluation_time_s;
+  summary->total_time_in_seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  if (summary->termination_type == ceres::NO_CONVERGENCE) {
+    summary->message = out_of_time ? "Maximum solver time reached."
+                                   : "Maximum number of iterations reached.";
+  }
+}
+
+}  // namespace core
+}  // namespace OpenICC
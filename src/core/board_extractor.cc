@@ -19,6 +19,11 @@
 #include <opencv2/calib3d.hpp>
 #include <opencv2/opencv.hpp>
 
+#ifdef OPENICC_CUDA
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/cudawarping.hpp>
+#endif
+
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
 #include <theia/sfm/camera/double_sphere_camera_model.h>
 #include <theia/sfm/camera/pinhole_camera_model.h>
@@ -26,17 +31,110 @@
 #include <third_party/apriltag/ethz_apriltag2/include/apriltags/TagDetection.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
 #include <fstream>
 #include <ios>
+#include <map>
+#include <memory>
+#include <thread>
 #include <vector>
 
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/bounded_queue.h"
+#include "OpenCameraCalibrator/utils/execution_context.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
 using namespace cv;
 
+// cv::CAP_PROP_HW_ACCELERATION was added in OpenCV 4.5.2
+#define OPENICC_CV_VERSION \
+  (CV_VERSION_MAJOR * 10000 + CV_VERSION_MINOR * 100 + CV_VERSION_REVISION)
+
 namespace OpenICC {
 namespace core {
 
+namespace {
+
+//! Converts the pixels of a ROS image message to a gray image that owns
+//! its data
+bool RosImageToGray(const io::RosImageMessage& image, cv::Mat& gray) {
+  if (image.compressed) {
+    const cv::Mat buffer(1,
+                         static_cast<int>(image.size),
+                         CV_8UC1,
+                         const_cast<uint8_t*>(image.data));
+    gray = cv::imdecode(buffer, cv::IMREAD_GRAYSCALE);
+    return !gray.empty();
+  }
+
+  struct RosEncoding {
+    int type;
+    //! cv::cvtColor code to gray, -1 if the image is gray already
+    int code;
+  };
+  static const std::map<std::string, RosEncoding> encodings = {
+      {"mono8", {CV_8UC1, -1}},
+      {"8UC1", {CV_8UC1, -1}},
+      {"mono16", {CV_16UC1, -1}},
+      {"16UC1", {CV_16UC1, -1}},
+      {"rgb8", {CV_8UC3, cv::COLOR_RGB2GRAY}},
+      {"bgr8", {CV_8UC3, cv::COLOR_BGR2GRAY}},
+      {"rgba8", {CV_8UC4, cv::COLOR_RGBA2GRAY}},
+      {"bgra8", {CV_8UC4, cv::COLOR_BGRA2GRAY}},
+      // OpenCV names bayer patterns by the second row
+      {"bayer_rggb8", {CV_8UC1, cv::COLOR_BayerBG2GRAY}},
+      {"bayer_bggr8", {CV_8UC1, cv::COLOR_BayerRG2GRAY}},
+      {"bayer_gbrg8", {CV_8UC1, cv::COLOR_BayerGR2GRAY}},
+      {"bayer_grbg8", {CV_8UC1, cv::COLOR_BayerGB2GRAY}},
+      {"uyvy", {CV_8UC2, cv::COLOR_YUV2GRAY_UYVY}},
+      {"yuv422", {CV_8UC2, cv::COLOR_YUV2GRAY_UYVY}},
+      {"yuyv", {CV_8UC2, cv::COLOR_YUV2GRAY_YUY2}},
+      {"yuv422_yuy2", {CV_8UC2, cv::COLOR_YUV2GRAY_YUY2}}};
+  const auto encoding = encodings.find(image.encoding);
+  if (encoding == encodings.end()) {
+    return false;
+  }
+  const RosEncoding& ros_encoding = encoding->second;
+  const cv::Mat pixels(static_cast<int>(image.height),
+                       static_cast<int>(image.width),
+                       ros_encoding.type,
+                       const_cast<uint8_t*>(image.data),
+                       image.step);
+  if (ros_encoding.type == CV_16UC1) {
+    pixels.convertTo(gray, CV_8UC1, 1. / 256.);
+  } else if (ros_encoding.code >= 0) {
+    cv::cvtColor(pixels, gray, ros_encoding.code);
+  } else {
+    gray = pixels.clone();
+  }
+  return true;
+}
+
+//! Lucas-Kanade window and pyramid levels of the corner tracking
+const int kTrackWindow = 21;
+const int kTrackLevels = 3;
+//! half window of the subpixel refinement of the tracked corners
+const int kTrackSubPixWindow = 3;
+//! fraction of the detected corners the tracking has to keep
+const double kMinTrackedCornerFraction = 0.8;
+
+bool IsJpegPath(const std::string& path) {
+  const size_t dot = path.find_last_of('.');
+  if (dot == std::string::npos) {
+    return false;
+  }
+  std::string extension = path.substr(dot + 1);
+  std::transform(
+      extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return extension == "jpg" || extension == "jpeg";
+}
+
+}  // namespace
+
 BoardExtractor::BoardExtractor() {}
 
 bool BoardExtractor::InitializeCharucoBoard(std::string path_to_detector_params,
@@ -46,7 +144,11 @@ bool BoardExtractor::InitializeCharucoBoard(std::string path_to_detector_params,
                                             int squaresY,
                                             int dictionaryId) {
   // load images from folder
+#ifdef OPENICC_ARUCO_DETECTOR
+  detector_params_ = cv::makePtr<aruco::DetectorParameters>();
+#else
   detector_params_ = aruco::DetectorParameters::create();
+#endif
 
   if (!OpenICC::utils::ReadDetectorParameters(path_to_detector_params,
                                               detector_params_)) {
@@ -54,6 +156,17 @@ bool BoardExtractor::InitializeCharucoBoard(std::string path_to_detector_params,
     return 0;
   }
 
+#ifdef OPENICC_ARUCO_DETECTOR
+  dictionary_ = cv::makePtr<aruco::Dictionary>(
+      aruco::getPredefinedDictionary(dictionaryId));
+  // create charuco board object
+  charucoboard_ = cv::makePtr<aruco::CharucoBoard>(
+      cv::Size(squaresX, squaresY), square_length, marker_length, *dictionary_);
+  board_ = charucoboard_.staticCast<aruco::Board>();
+
+  board_pts3d_.push_back(charucoboard_->getChessboardCorners());
+  CreateCharucoDetectors();
+#else
   dictionary_ = aruco::getPredefinedDictionary(
       aruco::PREDEFINED_DICTIONARY_NAME(dictionaryId));
   // create charuco board object
@@ -62,6 +175,7 @@ bool BoardExtractor::InitializeCharucoBoard(std::string path_to_detector_params,
   board_ = charucoboard_.staticCast<aruco::Board>();
 
   board_pts3d_.push_back(charucoboard_->chessboardCorners);
+#endif
   board_type_ = BoardType::CHARUCO;
 
   square_length_m_ = square_length;
@@ -127,42 +241,380 @@ bool BoardExtractor::InitializeAprilBoard(double marker_length,
 bool BoardExtractor::ExtractBoard(const Mat& image,
                                   aligned_vector<Eigen::Vector2d>& corners,
                                   std::vector<int>& object_pt_ids) {
+  // the tracks of a pooled detector depend on the frames its worker got, so
+  // a deterministic run always detects
+  if (!corner_tracking_ || utils::ExecutionContext::Deterministic()) {
+    return DetectBoard(image, corners, object_pt_ids);
+  }
+
+  {
+    utils::ScopedTimer timer("board_tracking_pyramid", 1);
+    OPENICC_TRACE_ZONE("board_tracking_pyramid");
+    cv::buildOpticalFlowPyramid(image,
+                                next_pyramid_,
+                                cv::Size(kTrackWindow, kTrackWindow),
+                                kTrackLevels);
+  }
+  bool success = TrackCorners(image, corners, object_pt_ids);
+  if (success) {
+    ++frames_since_detection_;
+    UpdateBoardRoi(corners, image.size());
+  } else {
+    corners.clear();
+    object_pt_ids.clear();
+    success = DetectBoard(image, corners, object_pt_ids);
+    frames_since_detection_ = 0;
+    detected_nr_corners_ = corners.size();
+    track_points_.clear();
+    for (const auto& c : corners) {
+      track_points_.emplace_back(c[0], c[1]);
+    }
+    track_ids_ = object_pt_ids;
+    if (!BoardHomographyResiduals(track_points_, track_ids_,
+                                  track_residuals_)) {
+      track_points_.clear();
+    }
+  }
+  std::swap(track_pyramid_, next_pyramid_);
+  track_image_size_ = image.size();
+  return success;
+}
+
+void BoardExtractor::ContinueCornerTracks(const size_t source_idx,
+                                          const int frame_idx) {
+  // runs of redetect_interval_ frames start with a detection, the same runs
+  // the pipelined extraction hands to one worker
+  if (source_idx != track_source_idx_ || frame_idx != track_frame_idx_ + 1 ||
+      frame_idx % redetect_interval_ == 0) {
+    track_points_.clear();
+  }
+  track_source_idx_ = source_idx;
+  track_frame_idx_ = frame_idx;
+}
+
+bool BoardExtractor::TrackCorners(const cv::Mat& image,
+                                  aligned_vector<Eigen::Vector2d>& corners,
+                                  std::vector<int>& object_pt_ids) {
+  if (track_points_.empty() || image.size() != track_image_size_ ||
+      frames_since_detection_ + 1 >= redetect_interval_) {
+    return false;
+  }
+  utils::ScopedTimer timer("board_corner_tracking", 1);
+  OPENICC_TRACE_ZONE("board_corner_tracking");
+  const cv::Size window(kTrackWindow, kTrackWindow);
+  const cv::TermCriteria criteria(
+      cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 20, 0.01);
+  cv::calcOpticalFlowPyrLK(track_pyramid_,
+                           next_pyramid_,
+                           track_points_,
+                           tracked_points_,
+                           track_status_,
+                           track_errors_,
+                           window,
+                           kTrackLevels,
+                           criteria);
+  // tracking back to the last frame rejects corners that drifted, e.g. onto
+  // a neighbouring corner or into motion blur
+  cv::calcOpticalFlowPyrLK(next_pyramid_,
+                           track_pyramid_,
+                           tracked_points_,
+                           back_tracked_points_,
+                           back_track_status_,
+                           track_errors_,
+                           window,
+                           kTrackLevels,
+                           criteria);
+
+  const double kMaxForwardBackwardError = 0.5;
+  const cv::Rect2f image_rect(0.f, 0.f, image.cols, image.rows);
+  size_t nr_kept = 0;
+  for (size_t i = 0; i < track_points_.size(); ++i) {
+    const cv::Point2f back_error = back_tracked_points_[i] - track_points_[i];
+    if (!track_status_[i] || !back_track_status_[i] ||
+        back_error.dot(back_error) >
+            kMaxForwardBackwardError * kMaxForwardBackwardError ||
+        !image_rect.contains(tracked_points_[i])) {
+      continue;
+    }
+    tracked_points_[nr_kept] = tracked_points_[i];
+    track_ids_[nr_kept] = track_ids_[i];
+    track_residuals_[nr_kept] = track_residuals_[i];
+    ++nr_kept;
+  }
+  tracked_points_.resize(nr_kept);
+  track_ids_.resize(nr_kept);
+  track_residuals_.resize(nr_kept);
+  if (nr_kept < kMinTrackedCornerFraction * detected_nr_corners_) {
+    return false;
+  }
+
+  // removes the drift that accumulates over the tracked frames
+  cv::cornerSubPix(image,
+                   tracked_points_,
+                   cv::Size(kTrackSubPixWindow, kTrackSubPixWindow),
+                   cv::Size(-1, -1),
+                   criteria);
+
+  // the lens distortion changes the offsets from the board homography only
+  // slowly, a changed offset is a corner that jumped
+  std::vector<cv::Point2f> residuals;
+  if (!BoardHomographyResiduals(tracked_points_, track_ids_, residuals)) {
+    return false;
+  }
+  nr_kept = 0;
+  for (size_t i = 0; i < tracked_points_.size(); ++i) {
+    const cv::Point2f change = residuals[i] - track_residuals_[i];
+    if (change.dot(change) >
+        max_homography_change_px_ * max_homography_change_px_) {
+      continue;
+    }
+    tracked_points_[nr_kept] = tracked_points_[i];
+    track_ids_[nr_kept] = track_ids_[i];
+    residuals[nr_kept] = residuals[i];
+    ++nr_kept;
+  }
+  tracked_points_.resize(nr_kept);
+  track_ids_.resize(nr_kept);
+  residuals.resize(nr_kept);
+  if (nr_kept < kMinTrackedCornerFraction * detected_nr_corners_) {
+    return false;
+  }
+
+  std::swap(track_points_, tracked_points_);
+  track_residuals_ = residuals;
+  for (const auto& p : track_points_) {
+    corners.push_back(Eigen::Vector2d(p.x, p.y));
+  }
+  object_pt_ids.insert(
+      object_pt_ids.end(), track_ids_.begin(), track_ids_.end());
+  return true;
+}
+
+bool BoardExtractor::BoardHomographyResiduals(
+    const std::vector<cv::Point2f>& corners,
+    const std::vector<int>& ids,
+    std::vector<cv::Point2f>& residuals) const {
+  // the homography of 4 corners fits them exactly
+  const size_t kMinCorners = 8;
+  if (corners.size() < kMinCorners || board_pts3d_.empty()) {
+    return false;
+  }
+  // all boards are planar with z = 0
+  std::vector<cv::Point2f> board_xy;
+  board_xy.reserve(ids.size());
+  for (const int id : ids) {
+    if (id < 0 || id >= static_cast<int>(board_pts3d_[0].size())) {
+      return false;
+    }
+    const cv::Point3f& p = board_pts3d_[0][id];
+    board_xy.emplace_back(p.x, p.y);
+  }
+  const cv::Mat H = cv::findHomography(board_xy, corners, cv::LMEDS);
+  if (H.empty()) {
+    return false;
+  }
+  std::vector<cv::Point2f> projected;
+  cv::perspectiveTransform(board_xy, projected, H);
+  residuals.resize(corners.size());
+  for (size_t i = 0; i < corners.size(); ++i) {
+    residuals[i] = corners[i] - projected[i];
+  }
+  return true;
+}
+
+bool BoardExtractor::DetectBoard(const Mat& image,
+                                 aligned_vector<Eigen::Vector2d>& corners,
+                                 std::vector<int>& object_pt_ids) {
+  utils::ScopedTimer timer("board_detection", 1);
+  OPENICC_TRACE_ZONE("board_detection");
+  // the ROI of a pooled detector depends on the frames its worker got, so a
+  // deterministic run always detects on the full image
+  if (!track_roi_ || utils::ExecutionContext::Deterministic()) {
+    return ExtractBoardInImage(image, corners, object_pt_ids);
+  }
+
+  // accept the ROI detection unless it lost a good part of the board, e.g.
+  // because the board moved out of the ROI
+  const double kMinRoiCornerFraction = 0.8;
+  const cv::Rect roi = board_roi_ & cv::Rect(0, 0, image.cols, image.rows);
+  if (roi.area() > 0 && roi.area() < image.cols * image.rows) {
+    aligned_vector<Eigen::Vector2d> roi_corners;
+    std::vector<int> roi_ids;
+    ExtractBoardInImage(image(roi), roi_corners, roi_ids);
+    if (!roi_corners.empty() &&
+        roi_corners.size() >= kMinRoiCornerFraction * last_nr_corners_) {
+      const Eigen::Vector2d offset(roi.x, roi.y);
+      for (const auto& c : roi_corners) {
+        corners.push_back(c + offset);
+      }
+      object_pt_ids.insert(object_pt_ids.end(), roi_ids.begin(), roi_ids.end());
+      UpdateBoardRoi(corners, image.size());
+      return true;
+    }
+  }
+
+  const bool success = ExtractBoardInImage(image, corners, object_pt_ids);
+  UpdateBoardRoi(corners, image.size());
+  return success;
+}
+
+bool BoardExtractor::DetectRadonOnProxy(const cv::Mat& image,
+                                        std::vector<cv::Point2d>& corners,
+                                        cv::Mat& meta) {
+  const double scale =
+      radon_proxy_size_ / static_cast<double>(std::max(image.cols, image.rows));
+  {
+    utils::ScopedTimer timer("radon_proxy_detection", 1);
+    OPENICC_TRACE_ZONE("radon_proxy_detection");
+    cv::resize(image,
+               radon_proxy_buffer_,
+               cv::Size(),
+               scale,
+               scale,
+               cv::INTER_AREA);
+    if (!cv::findChessboardCornersSB(radon_proxy_buffer_,
+                                     radon_pattern_size_,
+                                     corners,
+                                     radon_flags_ & ~cv::CALIB_CB_EXHAUSTIVE,
+                                     meta)) {
+      return false;
+    }
+  }
+
+  utils::ScopedTimer timer("radon_proxy_refinement", 1);
+  OPENICC_TRACE_ZONE("radon_proxy_refinement");
+  radon_subpix_corners_.resize(corners.size());
+  for (size_t i = 0; i < corners.size(); ++i) {
+    // pixel centers of the proxy and the full image are offset by half a
+    // proxy pixel
+    radon_subpix_corners_[i] =
+        cv::Point2f((corners[i].x + 0.5) / scale - 0.5,
+                    (corners[i].y + 0.5) / scale - 0.5);
+  }
+  // the search window has to cover the error of the proxy detection
+  const int win_size = std::max(3, static_cast<int>(std::ceil(2.0 / scale)));
+  cv::cornerSubPix(
+      image,
+      radon_subpix_corners_,
+      cv::Size(win_size, win_size),
+      cv::Size(-1, -1),
+      cv::TermCriteria(
+          cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 20, 0.01));
+  for (size_t i = 0; i < corners.size(); ++i) {
+    corners[i] = cv::Point2d(radon_subpix_corners_[i].x,
+                             radon_subpix_corners_[i].y);
+  }
+  return true;
+}
+
+void BoardExtractor::UpdateBoardRoi(
+    const aligned_vector<Eigen::Vector2d>& corners,
+    const cv::Size& image_size) {
+  last_nr_corners_ = corners.size();
+  if (corners.empty()) {
+    board_roi_ = cv::Rect();
+    return;
+  }
+  Eigen::Vector2d min_pt = corners[0], max_pt = corners[0];
+  for (const auto& c : corners) {
+    min_pt = min_pt.cwiseMin(c);
+    max_pt = max_pt.cwiseMax(c);
+  }
+  const Eigen::Vector2d border = roi_margin_ * (max_pt - min_pt);
+  min_pt -= border;
+  max_pt += border;
+  board_roi_ = cv::Rect(cv::Point(std::floor(min_pt[0]), std::floor(min_pt[1])),
+                        cv::Point(std::ceil(max_pt[0]), std::ceil(max_pt[1]))) &
+               cv::Rect(0, 0, image_size.width, image_size.height);
+}
+
+bool BoardExtractor::ExtractBoardInImage(
+    const Mat& image,
+    aligned_vector<Eigen::Vector2d>& corners,
+    std::vector<int>& object_pt_ids) {
   if (board_type_ == BoardType::CHARUCO) {
-    std::vector<int> marker_ids, charuco_ids;
-    std::vector<std::vector<Point2f>> marker_corners, rejected_markers;
-    std::vector<Point2f> charuco_corners;
-
-    aruco::detectMarkers(image,
-                         dictionary_,
-                         marker_corners,
-                         marker_ids,
-                         detector_params_,
-                         rejected_markers);
-
-    // refind strategy to detect more markers
-    aruco::refineDetectedMarkers(image,
-                                 board_,
-                                 marker_corners,
-                                 marker_ids,
-                                 rejected_markers,
-                                 cv::noArray(),
-                                 cv::noArray(),
-                                 5, -1.);
+    std::vector<int>& marker_ids = charuco_marker_ids_;
+    std::vector<int>& charuco_ids = charuco_ids_;
+    std::vector<std::vector<Point2f>>& marker_corners = charuco_marker_corners_;
+    std::vector<std::vector<Point2f>>& rejected_markers =
+        charuco_rejected_markers_;
+    std::vector<Point2f>& charuco_corners = charuco_corners_;
+    charuco_ids.clear();
+    charuco_corners.clear();
+
+    {
+      utils::ScopedTimer timer("charuco_detect_markers", 1);
+      OPENICC_TRACE_ZONE("charuco_detect_markers");
+#ifdef OPENICC_ARUCO_DETECTOR
+      aruco_detector_->detectMarkers(
+          image, marker_corners, marker_ids, rejected_markers);
+#else
+      aruco::detectMarkers(image,
+                           dictionary_,
+                           marker_corners,
+                           marker_ids,
+                           detector_params_,
+                           rejected_markers);
+#endif
+    }
+
+    // refind strategy to detect more markers. It can only recover markers of
+    // the board that were not detected and no candidate was rejected.
+#ifdef OPENICC_ARUCO_DETECTOR
+    const size_t nr_board_markers = charucoboard_->getIds().size();
+#else
+    const size_t nr_board_markers = charucoboard_->ids.size();
+#endif
+    const bool refine =
+        !adaptive_marker_refinement_ ||
+        (marker_ids.size() < nr_board_markers && !rejected_markers.empty());
+    if (refine) {
+      utils::ScopedTimer timer("charuco_refine_markers", 1);
+      OPENICC_TRACE_ZONE("charuco_refine_markers");
+#ifdef OPENICC_ARUCO_DETECTOR
+      aruco_detector_->refineDetectedMarkers(
+          image, *board_, marker_corners, marker_ids, rejected_markers);
+#else
+      aruco::refineDetectedMarkers(image,
+                                   board_,
+                                   marker_corners,
+                                   marker_ids,
+                                   rejected_markers,
+                                   cv::noArray(),
+                                   cv::noArray(),
+                                   5, -1.);
+#endif
+    } else {
+      // only counts the frames without refinement
+      utils::ScopedTimer timer("charuco_refine_markers_skipped", 1);
+      OPENICC_TRACE_ZONE("charuco_refine_markers_skipped");
+    }
 
     // interpolate charuco corners
-    int interpolatedCorners = 0;
     if (marker_ids.size() > 0) {
-      interpolatedCorners = aruco::interpolateCornersCharuco(marker_corners,
-                                                             marker_ids,
-                                                             image,
-                                                             charucoboard_,
-                                                             charuco_corners,
-                                                             charuco_ids,
-                                                             cv::noArray(),
-                                                             cv::noArray(),
-                                                             1);
+      {
+        utils::ScopedTimer timer("charuco_interpolate_corners", 1);
+        OPENICC_TRACE_ZONE("charuco_interpolate_corners");
+#ifdef OPENICC_ARUCO_DETECTOR
+        // with the markers given, detectBoard only interpolates the corners
+        charuco_detector_->detectBoard(
+            image, charuco_corners, charuco_ids, marker_corners, marker_ids);
+#else
+        aruco::interpolateCornersCharuco(marker_corners,
+                                         marker_ids,
+                                         image,
+                                         charucoboard_,
+                                         charuco_corners,
+                                         charuco_ids,
+                                         cv::noArray(),
+                                         cv::noArray(),
+                                         1);
+#endif
+      }
 
       if (charuco_corners.size() > 0) {
+        utils::ScopedTimer timer("charuco_corner_subpix", 1);
+        OPENICC_TRACE_ZONE("charuco_corner_subpix");
         cv::cornerSubPix(
             image,
             charuco_corners,
@@ -202,8 +654,17 @@ bool BoardExtractor::ExtractBoard(const Mat& image,
   } else if (board_type_ == BoardType::RADON) {
     std::vector<Point2d> radon_corners;
     cv::Mat meta;
-    bool success = cv::findChessboardCornersSB(
-        image, radon_pattern_size_, radon_corners, radon_flags_, meta);
+    bool success = false;
+    const int max_side = std::max(image.cols, image.rows);
+    if (radon_proxy_size_ > 0 && max_side > radon_proxy_size_) {
+      success = DetectRadonOnProxy(image, radon_corners, meta);
+    }
+    if (!success) {
+      utils::ScopedTimer timer("radon_detection", 1);
+      OPENICC_TRACE_ZONE("radon_detection");
+      success = cv::findChessboardCornersSB(
+          image, radon_pattern_size_, radon_corners, radon_flags_, meta);
+    }
     if (!success) {
       return false;
     }
@@ -220,18 +681,9 @@ bool BoardExtractor::ExtractBoard(const Mat& image,
       corners.push_back(Eigen::Vector2d(c.x, c.y));
     }
   } else if (board_type_ == BoardType::APRILTAG) {
-    std::vector<int> marker_ids, rejected_ids;
-    std::vector<double> radii, rejected_radii;
-    std::vector<Point2f> marker_corners, rejected_markers;
-    april_detector_.detectTags(image,
-                               marker_corners,
-                               marker_ids,
-                               radii,
-                               rejected_markers,
-                               rejected_ids,
-                               rejected_radii);
-    object_pt_ids = marker_ids;
-    for (const auto& c : marker_corners) {
+    DetectAprilBoard(image);
+    object_pt_ids = april_ids_;
+    for (const auto& c : april_corners_) {
       corners.push_back(Eigen::Vector2d(c.x, c.y));
     }
   } else {
@@ -242,6 +694,43 @@ bool BoardExtractor::ExtractBoard(const Mat& image,
   return true;
 }
 
+bool BoardExtractor::DetectAprilBoard(const cv::Mat& image) {
+  april_detector_.detectTags(image,
+                             april_corners_,
+                             april_ids_,
+                             april_radii_,
+                             april_rejected_corners_,
+                             april_rejected_ids_,
+                             april_rejected_radii_);
+  return !april_ids_.empty();
+}
+
+void BoardExtractor::ReserveDetectorPool(const int num_workers) {
+  while (detector_pool_.size() < static_cast<size_t>(num_workers)) {
+    detector_pool_.emplace_back(new BoardExtractor());
+  }
+  // the configuration may have changed since the pool was created, the
+  // detector scratch memory is kept
+  for (auto& detector : detector_pool_) {
+    detector->CopyBoardConfig(*this);
+    detector->board_roi_ = cv::Rect();
+    detector->last_nr_corners_ = 0;
+  }
+}
+
+BoardExtractor& BoardExtractor::PooledDetector(const int worker) {
+  CHECK_LT(worker, static_cast<int>(detector_pool_.size()))
+      << "Call ReserveDetectorPool first.";
+  return *detector_pool_[worker];
+}
+
+void BoardExtractor::GetSceneHeader(const double fps, nlohmann::json& header) {
+  header["camera_fps"] = fps;
+  header["calibration_board_type"] = board_type_;
+  header["square_size_meter"] = square_length_m_;
+  BoardToJson(header);
+}
+
 void BoardExtractor::BoardToJson(nlohmann::json& output_json) {
   std::vector<cv::Point3f> board_pts = GetBoardPts()[0];
   if (board_type_ == BoardType::CHARUCO) {
@@ -265,10 +754,363 @@ void BoardExtractor::BoardToJson(nlohmann::json& output_json) {
   }
 }
 
+void BoardExtractor::CopyBoardConfig(const BoardExtractor& other) {
+  board_type_ = other.board_type_;
+  board_pts3d_ = other.board_pts3d_;
+  if (other.detector_params_) {
+#ifdef OPENICC_ARUCO_DETECTOR
+    detector_params_ = cv::makePtr<aruco::DetectorParameters>();
+#else
+    detector_params_ = aruco::DetectorParameters::create();
+#endif
+    *detector_params_ = *other.detector_params_;
+  }
+  dictionary_ = other.dictionary_;
+  charucoboard_ = other.charucoboard_;
+  board_ = other.board_;
+#ifdef OPENICC_ARUCO_DETECTOR
+  if (charucoboard_) {
+    CreateCharucoDetectors();
+  }
+#endif
+  radon_flags_ = other.radon_flags_;
+  radon_pattern_size_ = other.radon_pattern_size_;
+  continuous_board_indices_ = other.continuous_board_indices_;
+  square_length_m_ = other.square_length_m_;
+  board_initialized_ = other.board_initialized_;
+  refine_full_resolution_ = other.refine_full_resolution_;
+  gpu_preprocessing_ = other.gpu_preprocessing_;
+  track_roi_ = other.track_roi_;
+  roi_margin_ = other.roi_margin_;
+  adaptive_marker_refinement_ = other.adaptive_marker_refinement_;
+  radon_proxy_size_ = other.radon_proxy_size_;
+  corner_tracking_ = other.corner_tracking_;
+  redetect_interval_ = other.redetect_interval_;
+  max_homography_change_px_ = other.max_homography_change_px_;
+  SetApriltagOptions(other.april_quad_decimate_, other.april_num_threads_);
+}
+
+#ifdef OPENICC_ARUCO_DETECTOR
+void BoardExtractor::CreateCharucoDetectors() {
+  // the same refinement as refineDetectedMarkers(..., 5, -1.) of the legacy
+  // functions, and corners are interpolated from a single marker on
+  const aruco::RefineParameters refine_params(5.f, -1.f, true);
+  aruco_detector_.reset(
+      new aruco::ArucoDetector(*dictionary_, *detector_params_, refine_params));
+  aruco::CharucoParameters charuco_params;
+  charuco_params.minMarkers = 1;
+  charuco_detector_.reset(new aruco::CharucoDetector(
+      *charucoboard_, charuco_params, *detector_params_, refine_params));
+}
+#endif
+
+const cv::Mat& BoardExtractor::PreprocessAndExtract(
+    const cv::Mat& image,
+    const double img_downsample_factor,
+    aligned_vector<Eigen::Vector2d>& corners,
+    std::vector<int>& object_pt_ids) {
+#ifdef OPENICC_CUDA
+  if (gpu_preprocessing_) {
+    return PreprocessAndExtractGpu(
+        image, img_downsample_factor, corners, object_pt_ids);
+  }
+#endif
+  OPENICC_TRACE_ZONE("board_extraction");
+  const cv::Mat* gray = &image;
+  if (image.channels() == 3) {
+    cv::cvtColor(image, gray_buffer_, cv::COLOR_BGR2GRAY);
+    gray = &gray_buffer_;
+  }
+  if (img_downsample_factor == 1.0) {
+    ExtractBoard(*gray, corners, object_pt_ids);
+    return *gray;
+  }
+
+  const double fxfy = 1. / img_downsample_factor;
+  const bool refine = refine_full_resolution_ && img_downsample_factor > 1.0;
+  cv::resize(*gray,
+             downsampled_buffer_,
+             cv::Size(),
+             fxfy,
+             fxfy,
+             refine ? cv::INTER_AREA : cv::INTER_LINEAR);
+  ExtractBoard(downsampled_buffer_, corners, object_pt_ids);
+  if (refine) {
+    RefineCornersFullResolution(*gray, img_downsample_factor, corners);
+    return *gray;
+  }
+  return downsampled_buffer_;
+}
+
+bool BoardExtractor::SetGpuPreprocessing(const bool use_gpu) {
+  gpu_preprocessing_ = false;
+  if (!use_gpu) {
+    return true;
+  }
+#ifdef OPENICC_CUDA
+  if (cv::cuda::getCudaEnabledDeviceCount() > 0) {
+    gpu_preprocessing_ = true;
+    return true;
+  }
+  LOG(WARNING) << "No CUDA device, preprocessing the frames on the CPU.";
+#else
+  LOG(WARNING) << "Built without BUILD_WITH_CUDA, preprocessing the frames "
+                  "on the CPU.";
+#endif
+  return false;
+}
+
+#ifdef OPENICC_CUDA
+const cv::Mat& BoardExtractor::PreprocessAndExtractGpu(
+    const cv::Mat& image,
+    const double img_downsample_factor,
+    aligned_vector<Eigen::Vector2d>& corners,
+    std::vector<int>& object_pt_ids) {
+  OPENICC_TRACE_ZONE("board_extraction_gpu");
+  const bool color = image.channels() == 3;
+  const bool downsample = img_downsample_factor != 1.0;
+  const bool refine = refine_full_resolution_ && img_downsample_factor > 1.0;
+  const cv::Mat* gray = &image;
+  if (color || downsample) {
+    OPENICC_TRACE_ZONE("gpu_preprocess");
+    gpu_image_.upload(image, gpu_stream_);
+    const cv::cuda::GpuMat* gpu_gray = &gpu_image_;
+    if (color) {
+      cv::cuda::cvtColor(
+          gpu_image_, gpu_gray_, cv::COLOR_BGR2GRAY, 0, gpu_stream_);
+      gpu_gray = &gpu_gray_;
+      // the full resolution gray image is only needed if the corners refer
+      // to it
+      if (!downsample || refine) {
+        gpu_gray_.download(gray_buffer_, gpu_stream_);
+        gray = &gray_buffer_;
+      }
+    }
+    if (downsample) {
+      const double fxfy = 1. / img_downsample_factor;
+      cv::cuda::resize(*gpu_gray,
+                       gpu_downsampled_,
+                       cv::Size(),
+                       fxfy,
+                       fxfy,
+                       refine ? cv::INTER_AREA : cv::INTER_LINEAR,
+                       gpu_stream_);
+      gpu_downsampled_.download(downsampled_buffer_, gpu_stream_);
+    }
+    gpu_stream_.waitForCompletion();
+  }
+
+  if (!downsample) {
+    ExtractBoard(*gray, corners, object_pt_ids);
+    return *gray;
+  }
+  ExtractBoard(downsampled_buffer_, corners, object_pt_ids);
+  if (refine) {
+    RefineCornersFullResolution(*gray, img_downsample_factor, corners);
+    return *gray;
+  }
+  return downsampled_buffer_;
+}
+#endif
+
+void BoardExtractor::RefineCornersFullResolution(
+    const cv::Mat& gray_image,
+    const double downsample_factor,
+    aligned_vector<Eigen::Vector2d>& corners) {
+  if (corners.empty()) {
+    return;
+  }
+  OPENICC_TRACE_ZONE("board_full_resolution_refinement");
+  // pixel centers of the downsampled image lie at (x + 0.5) * factor - 0.5.
+  // The search window covers the uncertainty of one downsampled pixel.
+  std::vector<cv::Point2f> full_res_corners;
+  full_res_corners.reserve(corners.size());
+  for (const auto& c : corners) {
+    full_res_corners.emplace_back((c[0] + 0.5) * downsample_factor - 0.5,
+                                  (c[1] + 0.5) * downsample_factor - 0.5);
+  }
+  const int half_window = std::max(3, static_cast<int>(
+                                          std::ceil(2.0 * downsample_factor)));
+  cv::cornerSubPix(
+      gray_image,
+      full_res_corners,
+      cv::Size(half_window, half_window),
+      cv::Size(-1, -1),
+      cv::TermCriteria(
+          cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 20, 0.01));
+  for (size_t i = 0; i < corners.size(); ++i) {
+    corners[i] = Eigen::Vector2d(full_res_corners[i].x, full_res_corners[i].y);
+  }
+}
+
+void BoardExtractor::PlotCorners(
+    const cv::Mat& gray_image,
+    const aligned_vector<Eigen::Vector2d>& corners,
+    const std::vector<int>& object_pt_ids) {
+  cv::Mat& image = plot_buffer_;
+  if (gray_image.channels() == 1) {
+    cv::cvtColor(gray_image, image, cv::COLOR_GRAY2BGR);
+  } else {
+    gray_image.copyTo(image);
+  }
+  for (size_t i = 0; i < corners.size(); ++i) {
+    cv::drawMarker(image,
+                   cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
+                   cv::Scalar(0, 0, 255),
+                   cv::MARKER_CROSS,
+                   10,
+                   3);
+
+    cv::putText(image,
+                std::to_string(object_pt_ids[i]),
+                cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
+                cv::FONT_HERSHEY_PLAIN,
+                1,
+                cv::Scalar(0, 0, 255));
+  }
+  cv::putText(image,
+              "Number corners: " + std::to_string(corners.size()),
+              cv::Point(10, 20),
+              cv::FONT_HERSHEY_COMPLEX_SMALL,
+              2,
+              cv::Scalar(0, 0, 255));
+  cv::imshow("corners", image);
+  cv::waitKey(1);
+}
+
+void BoardExtractor::StartPreview() {
+  if (!verbose_plot_ || preview_mailbox_) {
+    return;
+  }
+  preview_mailbox_.reset(new utils::Mailbox<PreviewFrame>());
+  // the window is created and drawn by this thread only
+  preview_thread_ = std::thread([this]() {
+    OPENICC_TRACE_THREAD("extraction_preview");
+    PreviewFrame frame;
+    while (preview_mailbox_->Take(frame)) {
+      PlotCorners(frame.image, frame.corners, frame.ids);
+    }
+  });
+}
+
+void BoardExtractor::StopPreview() {
+  if (!preview_mailbox_) {
+    return;
+  }
+  preview_mailbox_->Close();
+  preview_thread_.join();
+  preview_mailbox_.reset();
+}
+
+void BoardExtractor::PostPreview(
+    const cv::Mat& image,
+    const aligned_vector<Eigen::Vector2d>& corners,
+    const std::vector<int>& object_pt_ids) {
+  if (!preview_mailbox_) {
+    return;
+  }
+  // copies into the buffers of a frame the preview handed back
+  image.copyTo(preview_frame_.image);
+  preview_frame_.corners = corners;
+  preview_frame_.ids = object_pt_ids;
+  preview_mailbox_->Post(preview_frame_);
+}
+
 bool BoardExtractor::ExtractImageFolderToJson(
     const std::string& image_folder,
     const std::string& save_path,
     const double img_downsample_factor) {
+  std::unique_ptr<io::SceneWriter> scene_writer =
+      io::CreateSceneWriter(save_path);
+  if (!scene_writer->Open(save_path)) {
+    return false;
+  }
+  if (!ExtractImageFolder(
+          image_folder, img_downsample_factor, *scene_writer)) {
+    LOG(ERROR) << "Could not extract " << image_folder << " to " << save_path
+               << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool BoardExtractor::ExtractImageFolder(const std::string& image_folder,
+                                        const double img_downsample_factor,
+                                        io::SceneWriter& scene_writer) {
+  FrameSource source;
+  if (!OpenImageFolderSource(image_folder, source)) {
+    return false;
+  }
+  return ExtractFromSource(source, img_downsample_factor, scene_writer);
+}
+
+bool BoardExtractor::ExtractVideoToJson(const std::string& video_path,
+                                        const std::string& save_path,
+                                        const double img_downsample_factor) {
+  std::unique_ptr<io::SceneWriter> scene_writer =
+      io::CreateSceneWriter(save_path);
+  if (!scene_writer->Open(save_path)) {
+    return false;
+  }
+  if (!ExtractVideo(video_path, img_downsample_factor, *scene_writer)) {
+    LOG(ERROR) << "Could not extract " << video_path << " to " << save_path
+               << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool BoardExtractor::ExtractVideo(const std::string& video_path,
+                                  const double img_downsample_factor,
+                                  io::SceneWriter& scene_writer) {
+  FrameSource source;
+  if (!OpenFileSource(video_path, source)) {
+    return false;
+  }
+  return ExtractFromSource(source, img_downsample_factor, scene_writer);
+}
+
+bool BoardExtractor::ExtractBatch(
+    const std::vector<std::string>& input_paths,
+    const double img_downsample_factor,
+    const std::vector<io::SceneWriter*>& scene_writers) {
+  if (input_paths.size() != scene_writers.size()) {
+    LOG(ERROR) << "Need one scene writer per input.\n";
+    return false;
+  }
+  if (input_paths.empty()) {
+    return true;
+  }
+  std::vector<std::unique_ptr<FrameSource>> sources;
+  for (const std::string& input_path : input_paths) {
+    sources.emplace_back(new FrameSource);
+    const bool opened = utils::IsPathAFile(input_path)
+                            ? OpenFileSource(input_path, *sources.back())
+                            : OpenImageFolderSource(input_path,
+                                                    *sources.back());
+    if (!opened) {
+      return false;
+    }
+  }
+
+  std::vector<FrameSource*> source_ptrs;
+  for (auto& source : sources) {
+    source_ptrs.push_back(source.get());
+  }
+  ExtractFramesPipelined(source_ptrs, img_downsample_factor, scene_writers);
+
+  bool success = true;
+  for (size_t s = 0; s < sources.size(); ++s) {
+    if (!FinishSource(*sources[s], *scene_writers[s])) {
+      LOG(ERROR) << "Could not write the scene of " << input_paths[s] << "\n";
+      success = false;
+    }
+  }
+  return success;
+}
+
+bool BoardExtractor::OpenImageFolderSource(const std::string& image_folder,
+                                           FrameSource& source) {
   if (!board_initialized_) {
     LOG(ERROR) << "No board initialized.\n";
     return false;
@@ -279,91 +1121,43 @@ bool BoardExtractor::ExtractImageFolderToJson(
   }
 
   // get filenames
-  std::vector<std::string> filenames;
-  cv::glob(image_folder + "/*.png", filenames, false);
-  std::sort(filenames.begin(), filenames.end());
+  for (const std::string& extension : {"png", "jpg", "jpeg", "JPG", "JPEG"}) {
+    std::vector<std::string> filenames;
+    cv::glob(image_folder + "/*." + extension, filenames, false);
+    source.filenames.insert(
+        source.filenames.end(), filenames.begin(), filenames.end());
+  }
+  std::sort(source.filenames.begin(), source.filenames.end());
+  source.filenames.erase(
+      std::unique(source.filenames.begin(), source.filenames.end()),
+      source.filenames.end());
 
-  if (filenames.size() <= 0) {
-    LOG(ERROR)
-        << "No image files found in folder. Must be timestamp_in_ns.png!";
+  if (source.filenames.size() <= 0) {
+    LOG(ERROR) << "No image files found in folder. Must be "
+                  "timestamp_in_ns.png or timestamp_in_ns.jpg!";
     return false;
   }
 
-  nlohmann::json output_json;
-
-  output_json["calibration_board_type"] = board_type_;
-  output_json["square_size_meter"] = square_length_m_;
-  BoardToJson(output_json);
+  source.header["calibration_board_type"] = board_type_;
+  source.header["square_size_meter"] = square_length_m_;
+  BoardToJson(source.header);
 
-  const size_t total_nr_frames = filenames.size();
+  const size_t total_nr_frames = source.filenames.size();
+  source.total_nr_frames = total_nr_frames;
   std::cout << "Total number of frames: " << total_nr_frames << "\n";
-  int frame_cnt = 0;
-  bool set_img_size = false;
+  // get timestamps in nanoseconds
+  source.timestamps_s.resize(total_nr_frames);
   std::set<double> timestamps_s;
   for (size_t i = 0; i < total_nr_frames; ++i) {
-    const std::string image_path = filenames[i];
-
-    // get timestamp in nanoseconds
+    const std::string& image_path = source.filenames[i];
     std::size_t slash = image_path.find_last_of("/\\");
     std::size_t ending = image_path.find_last_of(".");
 
     int64_t timestamp_ns = std::stoul(image_path.substr(slash + 1, ending));
-    Mat image = cv::imread(image_path);
-    const double timestamp_s = timestamp_ns * NS_TO_S;
-    timestamps_s.insert(timestamp_s);
-    const std::string view_us = std::to_string(timestamp_s * S_TO_US);
-    ++frame_cnt;
-
-    const double fxfy = 1. / img_downsample_factor;
-    cv::resize(image, image, cv::Size(), fxfy, fxfy);
-
-    aligned_vector<Eigen::Vector2d> corners;
-    std::vector<int> ids;
-    cv::cvtColor(image, image, cv::COLOR_BGR2GRAY);
-    ExtractBoard(image, corners, ids);
-
-    for (size_t c = 0; c < ids.size(); ++c) {
-      output_json["views"][view_us]["image_points"][std::to_string(ids[c])] = {
-          corners[c][0], corners[c][1]};
-    }
-    if (!set_img_size) {
-      output_json["image_width"] = image.cols;
-      output_json["image_height"] = image.rows;
-      set_img_size = true;
-    }
-
-    LOG_IF(INFO, frame_cnt % 60 == 0)
-        << "Extracting corners from frame " << frame_cnt << " / "
-        << total_nr_frames << "\n";
-
-    if (verbose_plot_) {
-      cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
-      for (size_t i = 0; i < corners.size(); ++i) {
-        cv::drawMarker(
-            image,
-            cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
-            cv::Scalar(0, 0, 255),
-            cv::MARKER_CROSS,
-            10,
-            3);
-
-        cv::putText(image,
-                    std::to_string(ids[i]),
-                    cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
-                    cv::FONT_HERSHEY_PLAIN,
-                    1,
-                    cv::Scalar(0, 0, 255));
-      }
-      cv::putText(image,
-                  "Number corners: " + std::to_string(corners.size()),
-                  cv::Point(10, 20),
-                  cv::FONT_HERSHEY_COMPLEX_SMALL,
-                  2,
-                  cv::Scalar(0, 0, 255));
-      cv::imshow("corners", image);
-      cv::waitKey(1);
-    }
+    source.timestamps_s[i] = timestamp_ns * NS_TO_S;
+    timestamps_s.insert(source.timestamps_s[i]);
   }
+
   std::vector<double> times, delta_ts;
   for (const auto& t : timestamps_s) {
     times.push_back(t);
@@ -371,20 +1165,25 @@ bool BoardExtractor::ExtractImageFolderToJson(
   for (size_t i = 0; i < times.size() - 2; ++i) {
     delta_ts.push_back(times[i + 1] - times[i]);
   }
+  source.header["camera_fps"] = 1. / utils::MedianOfDoubleVec(delta_ts);
 
-  output_json["camera_fps"] = 1. / utils::MedianOfDoubleVec(delta_ts);
-
-  std::vector<std::uint8_t> v_bson = nlohmann::json::to_ubjson(output_json);
-  std::ofstream calib_txt_output(save_path, std::ios::out | std::ios::binary);
-  calib_txt_output.write(reinterpret_cast<const char*>(&v_bson[0]),
-                         v_bson.size() * sizeof(std::uint8_t));
-
+  // the frame rate is the same as for the whole folder
+  size_t nr_kept = 0;
+  for (size_t i = 0; i < total_nr_frames; ++i) {
+    if (InTimeRange(source.timestamps_s[i])) {
+      source.filenames[nr_kept] = source.filenames[i];
+      source.timestamps_s[nr_kept] = source.timestamps_s[i];
+      ++nr_kept;
+    }
+  }
+  source.filenames.resize(nr_kept);
+  source.timestamps_s.resize(nr_kept);
+  source.total_nr_frames = nr_kept;
   return true;
 }
 
-bool BoardExtractor::ExtractVideoToJson(const std::string& video_path,
-                                        const std::string& save_path,
-                                        const double img_downsample_factor) {
+bool BoardExtractor::OpenVideoSource(const std::string& video_path,
+                                     FrameSource& source) {
   if (!board_initialized_) {
     LOG(ERROR) << "No board initialized.\n";
     return false;
@@ -394,91 +1193,626 @@ bool BoardExtractor::ExtractVideoToJson(const std::string& video_path,
     return false;
   }
 
-  nlohmann::json output_json;
-  VideoCapture input_video;
-  input_video.open(video_path);
-  int cnt_wrong = 0;
-  const double fps = input_video.get(cv::CAP_PROP_FPS);
+  source.video.reset(new VideoCapture);
+  if (!OpenVideo(video_path, *source.video)) {
+    LOG(ERROR) << "Could not open video " << video_path << "\n";
+    return false;
+  }
+  GetSceneHeader(source.video->get(cv::CAP_PROP_FPS), source.header);
 
-  output_json["camera_fps"] = fps;
-  output_json["calibration_board_type"] = board_type_;
-  output_json["square_size_meter"] = square_length_m_;
+  source.total_nr_frames = source.video->get(cv::CAP_PROP_FRAME_COUNT);
+  std::cout << "Total number of frames: " << source.total_nr_frames << "\n";
 
-  BoardToJson(output_json);
+  if (!video_frame_timestamps_s_.empty()) {
+    source.timestamps_s = video_frame_timestamps_s_;
+    LOG_IF(WARNING,
+           source.timestamps_s.size() !=
+               static_cast<size_t>(source.total_nr_frames))
+        << "The video has " << source.total_nr_frames << " frames, but "
+        << source.timestamps_s.size() << " frame timestamps were given.";
+    std::vector<double> delta_ts;
+    for (size_t i = 1; i < source.timestamps_s.size(); ++i) {
+      delta_ts.push_back(source.timestamps_s[i] - source.timestamps_s[i - 1]);
+    }
+    if (!delta_ts.empty()) {
+      source.header["camera_fps"] = 1. / utils::MedianOfDoubleVec(delta_ts);
+    }
+  }
 
-  const int total_nr_frames = input_video.get(cv::CAP_PROP_FRAME_COUNT);
-  std::cout << "Total number of frames: " << total_nr_frames << "\n";
-  int frame_cnt = 0;
-  bool set_img_size = false;
+  // seek to the start of the time range. The backend may land a bit off,
+  // so seek earlier and let NextFrame skip the frames before the range
+  if (std::isfinite(t_start_s_) && sparse_num_frames_ == 0) {
+    if (source.timestamps_s.empty()) {
+      const double kSeekMargin_s = 1.0;
+      source.video->set(cv::CAP_PROP_POS_MSEC,
+                        std::max(0.0, t_start_s_ - kSeekMargin_s) * 1e3);
+    } else {
+      const auto first = std::lower_bound(
+          source.timestamps_s.begin(), source.timestamps_s.end(), t_start_s_);
+      source.video->set(cv::CAP_PROP_POS_FRAMES,
+                        first - source.timestamps_s.begin());
+    }
+    source.video_frame_idx =
+        static_cast<int>(source.video->get(cv::CAP_PROP_POS_FRAMES));
+  }
+
+  if (sparse_num_frames_ > 0 && source.total_nr_frames > 0) {
+    const int nr_samples = std::min(sparse_num_frames_, source.total_nr_frames);
+    for (int i = 0; i < nr_samples; ++i) {
+      source.sample_frames.push_back(static_cast<int>(
+          static_cast<int64_t>(i) * source.total_nr_frames / nr_samples));
+    }
+    source.total_nr_frames = nr_samples;
+    LOG(INFO) << "Sampling " << nr_samples << " frames of " << video_path;
+
+    // each decoder seeks within its own part of the video
+    const int nr_segments =
+        num_threads_ > 1 ? std::min(num_threads_, nr_samples) : 0;
+    for (int k = 0; k < nr_segments; ++k) {
+      const int begin = k * nr_samples / nr_segments;
+      const int end = (k + 1) * nr_samples / nr_segments;
+      std::unique_ptr<FrameSource> segment(new FrameSource);
+      segment->video.reset(new VideoCapture);
+      if (!OpenVideo(video_path, *segment->video)) {
+        LOG(ERROR) << "Could not open video " << video_path << "\n";
+        return false;
+      }
+      segment->sample_frames.assign(source.sample_frames.begin() + begin,
+                                    source.sample_frames.begin() + end);
+      segment->sample_offset = begin;
+      segment->timestamps_s = source.timestamps_s;
+      source.segments.push_back(std::move(segment));
+    }
+  }
+  return true;
+}
+
+bool BoardExtractor::OpenMcapSource(const std::string& mcap_path,
+                                    FrameSource& source) {
+  if (!board_initialized_) {
+    LOG(ERROR) << "No board initialized.\n";
+    return false;
+  }
+  source.mcap.reset(new io::McapReader);
+  if (!source.mcap->Open(mcap_path)) {
+    return false;
+  }
+  // the frame rate is only known after all frames were read, see
+  // FinishSource
+  GetSceneHeader(0.0, source.header);
+  return true;
+}
+
+bool BoardExtractor::OpenFileSource(const std::string& path,
+                                    FrameSource& source) {
+  if (io::IsMcapFile(path)) {
+    return OpenMcapSource(path, source);
+  }
+  return OpenVideoSource(path, source);
+}
+
+bool BoardExtractor::NextMcapFrame(FrameSource& source, FrameJob& job) const {
+  io::McapReader& reader = *source.mcap;
+  io::McapMessage message;
+  while (reader.NextMessage(message)) {
+    const io::McapChannel* channel = reader.Channel(message.channel_id);
+    if (source.mcap_channel < 0) {
+      if (!channel || !io::IsRosImageSchema(channel->schema_name) ||
+          channel->message_encoding != "cdr" ||
+          (!mcap_image_topic_.empty() && channel->topic != mcap_image_topic_)) {
+        continue;
+      }
+      source.mcap_channel = channel->id;
+      LOG(INFO) << "Extracting the board from image topic " << channel->topic;
+    }
+    if (message.channel_id != source.mcap_channel) continue;
+    if (source.mcap_message_idx++ % frame_stride_ != 0) {
+      ++source.nr_skipped_frames;
+      continue;
+    }
+    // only the header is decoded here, the pixels are converted by the
+    // workers
+    io::RosImageMessage image;
+    if (!io::DecodeRosImage(
+            channel->schema_name, message.data, message.size, image)) {
+      ++source.nr_failed_reads;
+      continue;
+    }
+    job.frame_idx = source.next_frame_idx++;
+    job.timestamp_s = reader.ToRelativeTimeS(
+        image.stamp_ns > 0 ? image.stamp_ns
+                           : static_cast<int64_t>(message.log_time_ns));
+    if (!InTimeRange(job.timestamp_s)) continue;
+    job.mcap_schema = channel->schema_name;
+    job.mcap_message.assign(message.data, message.data + message.size);
+    job.image.release();
+    source.timestamps_s.push_back(job.timestamp_s);
+    return true;
+  }
+  if (source.mcap_channel < 0) {
+    LOG(ERROR) << "No image topic "
+               << (mcap_image_topic_.empty() ? "" : mcap_image_topic_ + " ")
+               << "in the MCAP file.";
+  }
+  return false;
+}
+
+double BoardExtractor::LoadFrameImage(
+    FrameJob& job,
+    const double img_downsample_factor) const {
+  if (!job.image_path.empty()) {
+    utils::ScopedTimer decode_timer("frame_decode", 1);
+    OPENICC_TRACE_ZONE("frame_decode");
+    // libjpeg scales the DCT while decoding, which skips most of the decode
+    // and the resize. The full resolution refinement needs the full image.
+    int reduction = 1;
+    if (!refine_full_resolution_ && IsJpegPath(job.image_path)) {
+      while (reduction < 8 && 2 * reduction <= img_downsample_factor) {
+        reduction *= 2;
+      }
+    }
+    const std::map<int, int> reduced_flags = {
+        {1, cv::IMREAD_GRAYSCALE},
+        {2, cv::IMREAD_REDUCED_GRAYSCALE_2},
+        {4, cv::IMREAD_REDUCED_GRAYSCALE_4},
+        {8, cv::IMREAD_REDUCED_GRAYSCALE_8}};
+    job.image = cv::imread(job.image_path, reduced_flags.at(reduction));
+    return img_downsample_factor / reduction;
+  } else if (!job.mcap_message.empty()) {
+    utils::ScopedTimer decode_timer("frame_decode", 1);
+    OPENICC_TRACE_ZONE("frame_decode");
+    io::RosImageMessage image;
+    if (!io::DecodeRosImage(job.mcap_schema,
+                            job.mcap_message.data(),
+                            job.mcap_message.size(),
+                            image) ||
+        !RosImageToGray(image, job.image)) {
+      LOG(WARNING) << "Could not decode the " << image.encoding
+                   << " image of frame " << job.frame_idx;
+      job.image = cv::Mat();
+    }
+  }
+  return img_downsample_factor;
+}
+
+bool BoardExtractor::NextFrame(FrameSource& source, FrameJob& job) const {
+  if (source.mcap) {
+    return NextMcapFrame(source, job);
+  }
+  if (!source.video) {
+    if (source.next_file >= source.filenames.size()) return false;
+    job.frame_idx = source.next_frame_idx++;
+    job.timestamp_s = source.timestamps_s[source.next_file];
+    job.image_path = source.filenames[source.next_file];
+    ++source.next_file;
+    return true;
+  }
+
+  if (!source.sample_frames.empty()) {
+    return NextSampledVideoFrame(source, job);
+  }
+
+  // reads the next frame that passes the stride and the frame difference
+  // filter. Frames skipped by the stride are only grabbed, not retrieved.
+  VideoCapture& input_video = *source.video;
   while (true) {
-    Mat image;
-    if (!input_video.read(image)) {
-      cnt_wrong++;
-      if (cnt_wrong > 500) break;
+    if (source.video_frame_idx++ % frame_stride_ != 0) {
+      if (input_video.grab()) {
+        ++source.nr_skipped_frames;
+      } else if (++source.nr_failed_reads > 500) {
+        return false;
+      }
       continue;
     }
+    bool frame_read;
+    {
+      utils::ScopedTimer decode_timer("frame_decode", 1);
+      OPENICC_TRACE_ZONE("frame_decode");
+      frame_read = input_video.read(job.image);
+    }
+    if (!frame_read) {
+      if (++source.nr_failed_reads > 500) return false;
+      continue;
+    }
+    if (IsNearDuplicateFrame(job.image, source.last_thumbnail)) {
+      ++source.nr_skipped_frames;
+      continue;
+    }
+    if (!VideoFrameTimestamp(source, job.timestamp_s) ||
+        job.timestamp_s >= t_end_s_) {
+      return false;
+    }
+    if (!InTimeRange(job.timestamp_s)) continue;
+    job.frame_idx = source.next_frame_idx++;
+    return true;
+  }
+}
 
-    const double timstamp_s = input_video.get(cv::CAP_PROP_POS_MSEC) * 1e-3;
-    const std::string view_us = std::to_string(timstamp_s * S_TO_US);
-    ++frame_cnt;
+bool BoardExtractor::NextSampledVideoFrame(FrameSource& source,
+                                           FrameJob& job) const {
+  if (source.next_sample >= source.sample_frames.size()) {
+    return false;
+  }
+  // every sample gets its frame index, so that the pipelined extraction can
+  // restore the order of all segments
+  const int target = source.sample_frames[source.next_sample];
+  job.frame_idx = source.sample_offset + source.next_sample++;
 
-    const double fxfy = 1. / img_downsample_factor;
-    cv::resize(image, image, cv::Size(), fxfy, fxfy);
+  // seeking decodes from the previous keyframe, grabbing a few frames is
+  // cheaper than that
+  const int kMaxGrabbedFrames = 16;
+  VideoCapture& input_video = *source.video;
+  bool frame_read;
+  {
+    utils::ScopedTimer decode_timer("frame_decode", 1);
+    OPENICC_TRACE_ZONE("frame_decode");
+    if (target < source.video_frame_idx ||
+        target - source.video_frame_idx > kMaxGrabbedFrames) {
+      input_video.set(cv::CAP_PROP_POS_FRAMES, target);
+      source.video_frame_idx = target;
+    }
+    while (source.video_frame_idx < target && input_video.grab()) {
+      ++source.video_frame_idx;
+    }
+    frame_read = input_video.read(job.image);
+    ++source.video_frame_idx;
+  }
+  if (!frame_read) {
+    ++source.nr_failed_reads;
+    job.image.release();
+  } else if (!VideoFrameTimestamp(source, job.timestamp_s) ||
+             !InTimeRange(job.timestamp_s) ||
+             IsNearDuplicateFrame(job.image, source.last_thumbnail)) {
+    ++source.nr_skipped_frames;
+    job.image.release();
+  }
+  return true;
+}
 
+bool BoardExtractor::VideoFrameTimestamp(const FrameSource& source,
+                                         double& timestamp_s) const {
+  if (source.timestamps_s.empty()) {
+    timestamp_s = source.video->get(cv::CAP_PROP_POS_MSEC) * 1e-3;
+    return true;
+  }
+  const size_t frame =
+      static_cast<size_t>(source.video->get(cv::CAP_PROP_POS_FRAMES)) - 1;
+  if (frame >= source.timestamps_s.size()) {
+    LOG(WARNING) << "No timestamp for video frame " << frame << ".";
+    return false;
+  }
+  timestamp_s = source.timestamps_s[frame];
+  return true;
+}
+
+bool BoardExtractor::ExtractFromSource(FrameSource& source,
+                                       const double img_downsample_factor,
+                                       io::SceneWriter& scene_writer) {
+  if (num_threads_ > 1) {
+    ExtractFramesPipelined({&source}, img_downsample_factor, {&scene_writer});
+  } else {
+    StartPreview();
+    int frame_cnt = 0;
+    bool set_img_size = false;
+    // the decode buffer is reused by every video read
+    FrameJob job;
     aligned_vector<Eigen::Vector2d> corners;
     std::vector<int> ids;
-    cv::cvtColor(image, image, cv::COLOR_BGR2GRAY);
-    ExtractBoard(image, corners, ids);
+    while (NextFrame(source, job)) {
+      const double downsample_factor =
+          LoadFrameImage(job, img_downsample_factor);
+      if (job.image.empty()) continue;
+      ++frame_cnt;
 
-    for (size_t c = 0; c < ids.size(); ++c) {
-      output_json["views"][view_us]["image_points"][std::to_string(ids[c])] = {
-          corners[c][0], corners[c][1]};
+      corners.clear();
+      ids.clear();
+      ContinueCornerTracks(job.source_idx, job.frame_idx);
+      const Mat& image =
+          PreprocessAndExtract(job.image, downsample_factor, corners, ids);
+
+      scene_writer.AddView(job.timestamp_s * S_TO_US, corners, ids);
+      const bool covered = UpdateCoverage(source, image.size(), corners, ids);
+      if (!set_img_size) {
+        source.header["image_width"] = image.cols;
+        source.header["image_height"] = image.rows;
+        set_img_size = true;
+      }
+
+      LOG_IF(INFO, frame_cnt % 60 == 0)
+          << "Extracting corners from frame " << frame_cnt << " / "
+          << source.total_nr_frames << "\n";
+
+      PostPreview(image, corners, ids);
+      OPENICC_TRACE_FRAME("extracted_frame");
+      if (covered) break;
+    }
+    StopPreview();
+  }
+  return FinishSource(source, scene_writer);
+}
+
+bool BoardExtractor::UpdateCoverage(
+    FrameSource& source,
+    const cv::Size& image_size,
+    const aligned_vector<Eigen::Vector2d>& corners,
+    const std::vector<int>& object_pt_ids) {
+  if (!stop_when_covered_ || board_pts3d_.empty()) {
+    return false;
+  }
+  if (!source.coverage) {
+    source.coverage.reset(
+        new ExtractionCoverage(coverage_options_, board_pts3d_[0]));
+  }
+  source.coverage->AddView(image_size, corners, object_pt_ids);
+  if (source.coverage->TargetsMet()) {
+    source.covered = true;
+  }
+  return source.covered;
+}
+
+bool BoardExtractor::FinishSource(FrameSource& source,
+                                  io::SceneWriter& scene_writer) const {
+  if (source.mcap) {
+    if (source.mcap->Failed()) {
+      LOG(ERROR) << "Could not read the MCAP file to its end.\n";
+      return false;
+    }
+    std::vector<double> delta_ts;
+    for (size_t i = 1; i < source.timestamps_s.size(); ++i) {
+      delta_ts.push_back(source.timestamps_s[i] - source.timestamps_s[i - 1]);
     }
-    if (!set_img_size) {
-      output_json["image_width"] = image.cols;
-      output_json["image_height"] = image.rows;
-      set_img_size = true;
+    if (!delta_ts.empty()) {
+      source.header["camera_fps"] =
+          1. / utils::MedianOfDoubleVec(delta_ts) * frame_stride_;
     }
+  }
+  int nr_skipped_frames = source.nr_skipped_frames;
+  for (const auto& segment : source.segments) {
+    nr_skipped_frames += segment->nr_skipped_frames;
+  }
+  LOG_IF(INFO, nr_skipped_frames > 0)
+      << "Skipped board detection on " << nr_skipped_frames << " frames.";
+  if (source.coverage) {
+    source.header["extraction_coverage"] = source.coverage->ToJson();
+    if (source.covered) {
+      LOG(INFO) << "Stopped the extraction after "
+                << source.coverage->NumViews()
+                << " views, the image coverage and board tilt targets are "
+                   "met.";
+    } else {
+      LOG(INFO) << "The extraction did not meet the coverage targets, "
+                << "covered " << 100. * source.coverage->CoveredCellFraction()
+                << "% of the image.";
+    }
+  }
 
-    LOG_IF(INFO, frame_cnt % 60 == 0)
-        << "Extracting corners from frame " << frame_cnt << " / "
-        << total_nr_frames << "\n";
+  if (!scene_writer.Close(source.header)) {
+    LOG(ERROR) << "Could not write the scene.\n";
+    return false;
+  }
+  return true;
+}
 
-    if (verbose_plot_) {
-      for (size_t i = 0; i < corners.size(); ++i) {
-        cv::drawMarker(
-            image,
-            cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
-            cv::Scalar(0, 0, 255),
-            cv::MARKER_CROSS,
-            10,
-            3);
-
-        cv::putText(image,
-                    std::to_string(ids[i]),
-                    cv::Point(cvRound(corners[i][0]), cvRound(corners[i][1])),
-                    cv::FONT_HERSHEY_PLAIN,
-                    1,
-                    cv::Scalar(0, 0, 255));
+bool BoardExtractor::OpenVideo(const std::string& video_path,
+                               cv::VideoCapture& video) const {
+  if (video_hw_acceleration_ != "none") {
+#if OPENICC_CV_VERSION >= 40502
+    const std::map<std::string, cv::VideoAccelerationType> hw_types = {
+        {"any", cv::VIDEO_ACCELERATION_ANY},
+        {"d3d11", cv::VIDEO_ACCELERATION_D3D11},
+        {"vaapi", cv::VIDEO_ACCELERATION_VAAPI},
+        {"mfx", cv::VIDEO_ACCELERATION_MFX}};
+    const auto hw_type = hw_types.find(video_hw_acceleration_);
+    if (hw_type == hw_types.end()) {
+      LOG(WARNING) << "Unknown hardware acceleration "
+                   << video_hw_acceleration_ << ", using the default decoder.";
+    } else if (video.open(video_path,
+                          cv::CAP_ANY,
+                          {cv::CAP_PROP_HW_ACCELERATION, hw_type->second})) {
+      const int hw_used =
+          static_cast<int>(video.get(cv::CAP_PROP_HW_ACCELERATION));
+      if (hw_used != cv::VIDEO_ACCELERATION_NONE) {
+        LOG(INFO) << "Decoding " << video_path << " with "
+                  << video.getBackendName() << " hardware acceleration type "
+                  << hw_used;
+        return true;
       }
-      cv::putText(image,
-                  "Number corners: " + std::to_string(corners.size()),
-                  cv::Point(10, 20),
-                  cv::FONT_HERSHEY_COMPLEX_SMALL,
-                  2,
-                  cv::Scalar(0, 0, 255));
-      cv::imshow("corners", image);
-      cv::waitKey(1);
+      LOG(WARNING) << "No hardware decoder available for " << video_path
+                   << ", using the default decoder.";
+      video.release();
+    } else {
+      LOG(WARNING) << "Could not open " << video_path
+                   << " with hardware acceleration, using the default decoder.";
     }
+#else
+    LOG(WARNING) << "Hardware decoding needs OpenCV >= 4.5.2, using the "
+                    "default decoder.";
+#endif
   }
+  if (!video.open(video_path)) {
+    return false;
+  }
+  LOG(INFO) << "Decoding " << video_path << " with " << video.getBackendName()
+            << " software decoder";
+  return true;
+}
 
-  std::vector<std::uint8_t> v_bson = nlohmann::json::to_ubjson(output_json);
+bool BoardExtractor::IsNearDuplicateFrame(const cv::Mat& image,
+                                          cv::Mat& last_thumbnail) const {
+  if (min_frame_difference_ <= 0.0) {
+    return false;
+  }
+  // a small thumbnail is enough to see if the camera moved
+  const double kThumbnailWidth = 64.0;
+  const double scale = std::min(1.0, kThumbnailWidth / image.cols);
+  cv::Mat thumbnail;
+  cv::resize(image, thumbnail, cv::Size(), scale, scale, cv::INTER_AREA);
+  if (thumbnail.channels() == 3) {
+    cv::cvtColor(thumbnail, thumbnail, cv::COLOR_BGR2GRAY);
+  }
+  if (!last_thumbnail.empty() && last_thumbnail.size() == thumbnail.size()) {
+    cv::Mat difference;
+    cv::absdiff(thumbnail, last_thumbnail, difference);
+    if (cv::mean(difference)[0] < min_frame_difference_) {
+      return true;
+    }
+  }
+  last_thumbnail = thumbnail;
+  return false;
+}
 
-  std::ofstream calib_txt_output(save_path, std::ios::out | std::ios::binary);
-  calib_txt_output.write(reinterpret_cast<const char*>(&v_bson[0]),
-                         v_bson.size() * sizeof(std::uint8_t));
+void BoardExtractor::ExtractFramesPipelined(
+    const std::vector<FrameSource*>& sources,
+    const double img_downsample_factor,
+    const std::vector<io::SceneWriter*>& scene_writers) {
+  // a few frames per worker keep the detectors busy without buffering the
+  // whole video
+  const size_t queue_size = 2 * num_threads_;
+  utils::BoundedQueue<FrameJob> job_queue(queue_size);
+  utils::BoundedQueue<FrameResult> result_queue(queue_size);
+  StartPreview();
 
-  return true;
+  // frames handed back by the workers, so the decoders read into images
+  // that are already allocated
+  utils::BoundedQueue<cv::Mat> free_frames(2 * queue_size + num_threads_);
+
+  // the corner tracks need consecutive frames, so every run of
+  // redetect_interval_ frames goes to the queue of one worker
+  const bool route_runs =
+      corner_tracking_ && !utils::ExecutionContext::Deterministic();
+  std::vector<std::unique_ptr<utils::BoundedQueue<FrameJob>>> worker_queues;
+  if (route_runs) {
+    for (int t = 0; t < num_threads_; ++t) {
+      worker_queues.emplace_back(
+          new utils::BoundedQueue<FrameJob>(redetect_interval_));
+    }
+  }
+
+  // one decoder per source or per segment of a sparsely sampled video, all
+  // feeding the same workers
+  std::vector<std::pair<size_t, FrameSource*>> readers;
+  for (size_t s = 0; s < sources.size(); ++s) {
+    if (sources[s]->segments.empty()) {
+      readers.emplace_back(s, sources[s]);
+    }
+    for (const auto& segment : sources[s]->segments) {
+      readers.emplace_back(s, segment.get());
+    }
+  }
+  std::vector<std::thread> decoders;
+  std::atomic<int> active_decoders(static_cast<int>(readers.size()));
+  for (const auto& reader : readers) {
+    decoders.emplace_back([&, reader]() {
+      OPENICC_TRACE_THREAD("extraction_decoder");
+      while (true) {
+        FrameJob job;
+        job.source_idx = reader.first;
+        free_frames.TryPop(job.image);
+        if (sources[reader.first]->covered) break;
+        if (!NextFrame(*reader.second, job)) break;
+        utils::BoundedQueue<FrameJob>& queue =
+            route_runs
+                ? *worker_queues[(job.frame_idx / redetect_interval_) %
+                                 num_threads_]
+                : job_queue;
+        if (!queue.Push(std::move(job))) break;
+      }
+      if (--active_decoders == 0) {
+        job_queue.Close();
+        for (auto& queue : worker_queues) {
+          queue->Close();
+        }
+      }
+    });
+  }
+
+  // every worker gets its own detector state, kept across extractions
+  ReserveDetectorPool(num_threads_);
+  std::vector<std::thread> workers;
+  std::atomic<int> active_workers(num_threads_);
+  for (int t = 0; t < num_threads_; ++t) {
+    BoardExtractor* extractor = &PooledDetector(t);
+    utils::BoundedQueue<FrameJob>* queue =
+        route_runs ? worker_queues[t].get() : &job_queue;
+    workers.emplace_back([&, extractor, queue]() {
+      OPENICC_TRACE_THREAD("extraction_worker");
+      FrameJob job;
+      while (queue->Pop(job)) {
+        const double downsample_factor =
+            LoadFrameImage(job, img_downsample_factor);
+        FrameResult result;
+        result.source_idx = job.source_idx;
+        result.frame_idx = job.frame_idx;
+        result.timestamp_s = job.timestamp_s;
+        // frames that could not be decoded keep an empty image size and are
+        // not written
+        if (!job.image.empty()) {
+          extractor->ContinueCornerTracks(job.source_idx, job.frame_idx);
+          const cv::Mat& image = extractor->PreprocessAndExtract(
+              job.image, downsample_factor, result.corners, result.ids);
+          result.image_size = image.size();
+          if (verbose_plot_) {
+            result.image = image.clone();
+          }
+        }
+        if (job.image_path.empty() && job.mcap_message.empty()) {
+          free_frames.TryPush(std::move(job.image));
+        }
+        result_queue.Push(std::move(result));
+        OPENICC_TRACE_FRAME("extracted_frame");
+      }
+      if (--active_workers == 0) {
+        result_queue.Close();
+      }
+    });
+  }
+
+  // collect results in frame order per source, so that the output is the
+  // same as for the serial extraction
+  std::vector<std::map<int, FrameResult>> pending_results(sources.size());
+  std::vector<int> next_frame_idx(sources.size(), 0);
+  std::vector<bool> set_img_size(sources.size(), false);
+  FrameResult result;
+  while (result_queue.Pop(result)) {
+    const size_t s = result.source_idx;
+    std::map<int, FrameResult>& pending = pending_results[s];
+    pending.emplace(result.frame_idx, std::move(result));
+    while (!pending.empty() && pending.begin()->first == next_frame_idx[s]) {
+      FrameResult& res = pending.begin()->second;
+      // the frames that were in flight when the targets were met
+      if (sources[s]->covered) {
+        pending.erase(pending.begin());
+        ++next_frame_idx[s];
+        continue;
+      }
+      if (res.image_size.area() > 0) {
+        scene_writers[s]->AddView(
+            res.timestamp_s * S_TO_US, res.corners, res.ids);
+        UpdateCoverage(*sources[s], res.image_size, res.corners, res.ids);
+      }
+      if (!set_img_size[s] && res.image_size.area() > 0) {
+        sources[s]->header["image_width"] = res.image_size.width;
+        sources[s]->header["image_height"] = res.image_size.height;
+        set_img_size[s] = true;
+      }
+
+      const int frame_cnt = ++next_frame_idx[s];
+      LOG_IF(INFO, frame_cnt % 60 == 0)
+          << "Extracting corners from frame " << frame_cnt << " / "
+          << sources[s]->total_nr_frames << "\n";
+
+      PostPreview(res.image, res.corners, res.ids);
+      pending.erase(pending.begin());
+    }
+  }
+
+  for (auto& d : decoders) {
+    d.join();
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  StopPreview();
 }
 
 }  // namespace core
@@ -0,0 +1,344 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/board_point_refiner.h"
+
+#include <ceres/ceres.h>
+#include <glog/logging.h>
+#include <theia/sfm/bundle_adjustment/create_reprojection_error_cost_function.h>
+
+#include <Eigen/Cholesky>
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/execution_context.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+using Mat66 = Eigen::Matrix<double, 6, 6>;
+using Mat63 = Eigen::Matrix<double, 6, 3>;
+using Vec6 = Eigen::Matrix<double, 6, 1>;
+
+//! largest reduced system copy per thread, larger boards use fewer threads
+//! for the Schur complement
+const double kMaxReducedSystemBytes = 256.0 * 1024.0 * 1024.0;
+
+//! reduced system copies of a deterministic run, independent of the threads
+const int kDeterministicReductionChunks = 8;
+
+struct BoardObservation {
+  int point_idx;
+  std::unique_ptr<ceres::CostFunction> cost_function;
+};
+
+struct BoardView {
+  double* extrinsics;
+  const double* intrinsics;
+  std::vector<BoardObservation> observations;
+
+  //! normal equations at the current linearization point
+  Mat66 H_vv;
+  Vec6 g_v;
+  //! pose-point blocks and point blocks, one per observation
+  aligned_vector<Mat63> H_vp;
+  aligned_vector<Eigen::Matrix3d> H_pp;
+  vec3_vector g_p;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+class BoardPointProblem {
+ public:
+  BoardPointProblem(const BoardPointRefinementOptions& options,
+                    theia::Reconstruction* reconstruction)
+      : options_(options) {
+    std::unordered_map<theia::TrackId, int> point_ids;
+    for (const theia::ViewId view_id : reconstruction->ViewIds()) {
+      theia::View* view = reconstruction->MutableView(view_id);
+      if (!view->IsEstimated()) continue;
+      theia::Camera* camera = view->MutableCamera();
+      std::unique_ptr<BoardView> board_view(new BoardView);
+      board_view->extrinsics = camera->mutable_extrinsics();
+      board_view->intrinsics = camera->mutable_intrinsics();
+      for (const theia::TrackId track_id : view->TrackIds()) {
+        theia::Track* track = reconstruction->MutableTrack(track_id);
+        if (!track->IsEstimated()) continue;
+        const auto inserted =
+            point_ids.emplace(track_id, static_cast<int>(points_.size()));
+        if (inserted.second) {
+          points_.push_back(track->MutablePoint()->data());
+        }
+        BoardObservation observation;
+        observation.point_idx = inserted.first->second;
+        observation.cost_function.reset(
+            theia::CreateReprojectionErrorCostFunction(
+                camera->GetCameraIntrinsicsModelType(),
+                *view->GetFeature(track_id)));
+        board_view->observations.push_back(std::move(observation));
+      }
+      if (!board_view->observations.empty()) {
+        views_.push_back(std::move(board_view));
+      }
+    }
+  }
+
+  size_t NumViews() const { return views_.size(); }
+  size_t NumPoints() const { return points_.size(); }
+
+  double Cost() const {
+    std::vector<double> view_costs(views_.size(), 0.0);
+    utils::ParallelFor(
+        0,
+        static_cast<int>(views_.size()),
+        options_.num_threads,
+        [&](const int v) {
+          const BoardView& view = *views_[v];
+          for (const BoardObservation& obs : view.observations) {
+            Eigen::Vector2d residual;
+            if (!Evaluate(view, obs, &residual, nullptr, nullptr)) continue;
+            view_costs[v] += 0.5 * Rho(residual.squaredNorm());
+          }
+        });
+    double cost = 0.0;
+    for (const double c : view_costs) cost += c;
+    return cost;
+  }
+
+  //! Solves the damped normal equations for a step of all poses and points
+  void ComputeStep(const double lambda,
+                   aligned_vector<Vec6>* pose_steps,
+                   Eigen::VectorXd* point_steps) {
+    utils::ParallelFor(0,
+                       static_cast<int>(views_.size()),
+                       options_.num_threads,
+                       [&](const int v) { Linearize(views_[v].get()); });
+
+    // reduced system S dp = -b over the points only, with
+    // S = H_pp - sum_v H_pv H_vv^-1 H_vp and b = g_p - sum_v H_pv H_vv^-1 g_v
+    const int nr_params = 3 * static_cast<int>(points_.size());
+    const double bytes_per_copy =
+        static_cast<double>(nr_params) * nr_params * sizeof(double);
+    // the chunks are summed in a fixed order, a deterministic run also fixes
+    // their number so the sum does not depend on the threads
+    const int max_chunks = utils::ExecutionContext::Deterministic()
+                               ? kDeterministicReductionChunks
+                               : options_.num_threads;
+    const int nr_chunks = std::max(
+        1,
+        std::min({max_chunks,
+                  static_cast<int>(views_.size()),
+                  static_cast<int>(kMaxReducedSystemBytes / bytes_per_copy)}));
+    std::vector<Eigen::MatrixXd> S_chunks(nr_chunks);
+    std::vector<Eigen::VectorXd> b_chunks(nr_chunks);
+    const int nr_chunk_threads =
+        std::max(1, std::min(nr_chunks, options_.num_threads));
+    utils::ParallelFor(0, nr_chunks, nr_chunk_threads, [&](const int c) {
+      Eigen::MatrixXd& S = S_chunks[c];
+      Eigen::VectorXd& b = b_chunks[c];
+      S.setZero(nr_params, nr_params);
+      b.setZero(nr_params);
+      aligned_vector<Mat63> H_inv_H_vp;
+      for (size_t v = c; v < views_.size(); v += nr_chunks) {
+        const BoardView& view = *views_[v];
+        const Eigen::LDLT<Mat66> H_vv_ldlt(Damped(view.H_vv, lambda));
+        const Vec6 H_inv_g = H_vv_ldlt.solve(view.g_v);
+        const size_t nr_obs = view.observations.size();
+        H_inv_H_vp.resize(nr_obs);
+        for (size_t k = 0; k < nr_obs; ++k) {
+          H_inv_H_vp[k] = H_vv_ldlt.solve(view.H_vp[k]);
+        }
+        for (size_t k = 0; k < nr_obs; ++k) {
+          const int row = 3 * view.observations[k].point_idx;
+          b.segment<3>(row) -= view.H_vp[k].transpose() * H_inv_g;
+          for (size_t l = 0; l < nr_obs; ++l) {
+            const int col = 3 * view.observations[l].point_idx;
+            S.block<3, 3>(row, col) -=
+                view.H_vp[k].transpose() * H_inv_H_vp[l];
+          }
+        }
+      }
+    });
+
+    Eigen::MatrixXd& S = S_chunks[0];
+    Eigen::VectorXd& b = b_chunks[0];
+    for (int c = 1; c < nr_chunks; ++c) {
+      S += S_chunks[c];
+      b += b_chunks[c];
+    }
+    Eigen::VectorXd H_pp_diagonal = Eigen::VectorXd::Zero(nr_params);
+    for (const auto& view : views_) {
+      for (size_t k = 0; k < view->observations.size(); ++k) {
+        const int row = 3 * view->observations[k].point_idx;
+        S.block<3, 3>(row, row) += view->H_pp[k];
+        H_pp_diagonal.segment<3>(row) += view->H_pp[k].diagonal();
+        b.segment<3>(row) += view->g_p[k];
+      }
+    }
+    // Marquardt damping of the point blocks. It also regularizes the gauge
+    // freedom of the joint board point and pose problem.
+    S.diagonal() += lambda * H_pp_diagonal;
+    *point_steps = S.ldlt().solve(-b);
+
+    // back substitution of the pose steps
+    pose_steps->resize(views_.size());
+    utils::ParallelFor(
+        0,
+        static_cast<int>(views_.size()),
+        options_.num_threads,
+        [&](const int v) {
+          const BoardView& view = *views_[v];
+          Vec6 rhs = view.g_v;
+          for (size_t k = 0; k < view.observations.size(); ++k) {
+            const int row = 3 * view.observations[k].point_idx;
+            rhs += view.H_vp[k] * point_steps->segment<3>(row);
+          }
+          (*pose_steps)[v] = -Damped(view.H_vv, lambda).ldlt().solve(rhs);
+        });
+  }
+
+  //! Adds (sign = 1) or removes (sign = -1) a step
+  void ApplyStep(const aligned_vector<Vec6>& pose_steps,
+                 const Eigen::VectorXd& point_steps,
+                 const double sign) {
+    for (size_t v = 0; v < views_.size(); ++v) {
+      Eigen::Map<Vec6> extrinsics(views_[v]->extrinsics);
+      extrinsics += sign * pose_steps[v];
+    }
+    for (size_t p = 0; p < points_.size(); ++p) {
+      Eigen::Map<Eigen::Vector3d> point(points_[p]);
+      point += sign * point_steps.segment<3>(3 * p);
+    }
+  }
+
+ private:
+  static Mat66 Damped(const Mat66& H, const double lambda) {
+    Mat66 H_damped = H;
+    H_damped.diagonal() *= 1.0 + lambda;
+    return H_damped;
+  }
+
+  //! Huber loss of the squared residual norm, same as ceres::HuberLoss
+  double Rho(const double s) const {
+    const double a = options_.robust_loss_width;
+    return s <= a * a ? s : 2.0 * a * std::sqrt(s) - a * a;
+  }
+
+  //! Derivative of Rho, used as weight of the Gauss-Newton terms
+  double RhoDerivative(const double s) const {
+    const double a = options_.robust_loss_width;
+    return s <= a * a ? 1.0 : a / std::sqrt(s);
+  }
+
+  bool Evaluate(const BoardView& view,
+                const BoardObservation& obs,
+                Eigen::Vector2d* residual,
+                Eigen::Matrix<double, 2, 6, Eigen::RowMajor>* J_pose,
+                Eigen::Matrix<double, 2, 4, Eigen::RowMajor>* J_point) const {
+    const double* parameters[3] = {
+        view.extrinsics, view.intrinsics, points_[obs.point_idx]};
+    double* jacobians[3] = {J_pose ? J_pose->data() : nullptr,
+                            nullptr,
+                            J_point ? J_point->data() : nullptr};
+    return obs.cost_function->Evaluate(
+        parameters, residual->data(), J_pose ? jacobians : nullptr);
+  }
+
+  void Linearize(BoardView* view) const {
+    const size_t nr_obs = view->observations.size();
+    view->H_vv.setZero();
+    view->g_v.setZero();
+    view->H_vp.assign(nr_obs, Mat63::Zero());
+    view->H_pp.assign(nr_obs, Eigen::Matrix3d::Zero());
+    view->g_p.assign(nr_obs, Eigen::Vector3d::Zero());
+    Eigen::Vector2d residual;
+    Eigen::Matrix<double, 2, 6, Eigen::RowMajor> J_pose;
+    Eigen::Matrix<double, 2, 4, Eigen::RowMajor> J_point;
+    for (size_t k = 0; k < nr_obs; ++k) {
+      if (!Evaluate(
+              *view, view->observations[k], &residual, &J_pose, &J_point)) {
+        continue;
+      }
+      const double w = RhoDerivative(residual.squaredNorm());
+      const Eigen::Matrix<double, 2, 3> J_xyz = J_point.leftCols<3>();
+      view->H_vv += w * J_pose.transpose() * J_pose;
+      view->g_v += w * J_pose.transpose() * residual;
+      view->H_vp[k] = w * J_pose.transpose() * J_xyz;
+      view->H_pp[k] = w * J_xyz.transpose() * J_xyz;
+      view->g_p[k] = w * J_xyz.transpose() * residual;
+    }
+  }
+
+  const BoardPointRefinementOptions& options_;
+  std::vector<std::unique_ptr<BoardView>> views_;
+  std::vector<double*> points_;
+};
+
+}  // namespace
+
+BoardPointRefinementSummary RefineBoardPoints(
+    const BoardPointRefinementOptions& options,
+    theia::Reconstruction* reconstruction) {
+  BoardPointRefinementSummary summary;
+  BoardPointProblem problem(options, reconstruction);
+  if (problem.NumViews() == 0 || problem.NumPoints() == 0) {
+    return summary;
+  }
+
+  double cost = problem.Cost();
+  summary.initial_cost = cost;
+  double lambda = options.initial_lambda;
+  aligned_vector<Vec6> pose_steps;
+  Eigen::VectorXd point_steps;
+  for (int it = 0; it < options.max_iterations; ++it) {
+    problem.ComputeStep(lambda, &pose_steps, &point_steps);
+    problem.ApplyStep(pose_steps, point_steps, 1.0);
+    const double new_cost = problem.Cost();
+    if (options.verbose) {
+      LOG(INFO) << "Board point refinement iteration " << it
+                << " cost: " << new_cost << " lambda: " << lambda;
+    }
+    if (!(new_cost < cost)) {
+      problem.ApplyStep(pose_steps, point_steps, -1.0);
+      lambda *= 10.0;
+      if (lambda > 1e10) break;
+      continue;
+    }
+    const double relative_decrease = (cost - new_cost) / cost;
+    cost = new_cost;
+    lambda = std::max(lambda / 10.0, 1e-12);
+    ++summary.iterations;
+    if (relative_decrease < options.function_tolerance) break;
+  }
+  summary.final_cost = cost;
+  summary.success = true;
+  LOG(INFO) << "Refined " << problem.NumPoints() << " board points with "
+            << problem.NumViews() << " views. Cost: " << summary.initial_cost
+            << " -> " << summary.final_cost << " in " << summary.iterations
+            << " iterations.";
+  return summary;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,246 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/camera_calibration_problem.h"
+
+#include <theia/sfm/bundle_adjustment/create_loss_function.h>
+#include <theia/sfm/bundle_adjustment/create_reprojection_error_cost_function.h>
+#include <theia/sfm/camera/camera.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "OpenCameraCalibrator/utils/execution_context.h"
+
+namespace OpenICC {
+namespace core {
+
+void CameraCalibrationProblem::Build(
+    const theia::BundleAdjustmentOptions& options,
+    theia::Reconstruction* reconstruction) {
+  Reset();
+  reconstruction_ = reconstruction;
+  // fast removal for RemoveView
+  ceres::Problem::Options problem_options;
+  problem_options.enable_fast_removal = true;
+  problem_ = std::make_unique<ceres::Problem>(problem_options);
+
+  // one loss function shared by all residual blocks, the problem owns it
+  ceres::LossFunction* loss_function = theia::CreateLossFunction(
+      options.loss_function_type, options.robust_loss_width);
+
+  std::unordered_set<const double*> intrinsics_in_problem;
+  std::unordered_set<theia::TrackId> tracks_in_problem;
+  for (const theia::ViewId view_id : reconstruction_->ViewIds()) {
+    theia::View* view = reconstruction_->MutableView(view_id);
+    if (!view->IsEstimated()) continue;
+    theia::Camera* camera = view->MutableCamera();
+    double* extrinsics = camera->mutable_extrinsics();
+    double* intrinsics = camera->mutable_intrinsics();
+
+    bool view_in_problem = false;
+    for (const theia::TrackId track_id : view->TrackIds()) {
+      theia::Track* track = reconstruction_->MutableTrack(track_id);
+      if (!track->IsEstimated()) continue;
+      problem_->AddResidualBlock(
+          theia::CreateReprojectionErrorCostFunction(
+              camera->GetCameraIntrinsicsModelType(),
+              *view->GetFeature(track_id)),
+          loss_function,
+          extrinsics,
+          intrinsics,
+          track->MutablePoint()->data());
+      view_in_problem = true;
+      if (tracks_in_problem.insert(track_id).second) {
+        track_ids_.push_back(track_id);
+      }
+    }
+    if (!view_in_problem) continue;
+    view_ids_.push_back(view_id);
+    if (intrinsics_in_problem.insert(intrinsics).second) {
+      intrinsics_.push_back(camera->CameraIntrinsics());
+    }
+  }
+  LOG(INFO) << "Built calibration problem with " << view_ids_.size()
+            << " views, " << track_ids_.size() << " tracks and "
+            << problem_->NumResidualBlocks() << " residuals.";
+}
+
+void CameraCalibrationProblem::Reset() {
+  problem_.reset();
+  reconstruction_ = nullptr;
+  view_ids_.clear();
+  track_ids_.clear();
+  intrinsics_.clear();
+}
+
+bool CameraCalibrationProblem::RemoveView(const theia::ViewId view_id) {
+  if (!problem_) return false;
+  auto it = std::find(view_ids_.begin(), view_ids_.end(), view_id);
+  if (it == view_ids_.end()) return false;
+  view_ids_.erase(it);
+
+  // removes all residuals of the view as well
+  theia::View* view = reconstruction_->MutableView(view_id);
+  problem_->RemoveParameterBlock(view->MutableCamera()->mutable_extrinsics());
+
+  // the reconstruction drops tracks without any observation
+  for (const theia::TrackId track_id : view->TrackIds()) {
+    theia::Track* track = reconstruction_->MutableTrack(track_id);
+    double* point = track->MutablePoint()->data();
+    if (track->NumViews() > 1 || !problem_->HasParameterBlock(point)) {
+      continue;
+    }
+    problem_->RemoveParameterBlock(point);
+    track_ids_.erase(
+        std::remove(track_ids_.begin(), track_ids_.end(), track_id),
+        track_ids_.end());
+  }
+  return true;
+}
+
+theia::BundleAdjustmentSummary CameraCalibrationProblem::OptimizeViews(
+    const theia::BundleAdjustmentOptions& options) {
+  SetCamerasConstant(options, false);
+  SetTracksConstant(options, true);
+  return Solve(options);
+}
+
+theia::BundleAdjustmentSummary CameraCalibrationProblem::OptimizeTracks(
+    const theia::BundleAdjustmentOptions& options) {
+  SetCamerasConstant(options, true);
+  SetTracksConstant(options, false);
+  return Solve(options);
+}
+
+void CameraCalibrationProblem::SetCamerasConstant(
+    const theia::BundleAdjustmentOptions& options,
+    const bool constant) {
+  std::vector<int> constant_extrinsics;
+  if (options.constant_camera_position) {
+    for (int i = 0; i < 3; ++i) {
+      constant_extrinsics.push_back(theia::Camera::POSITION + i);
+    }
+  }
+  if (options.constant_camera_orientation) {
+    for (int i = 0; i < 3; ++i) {
+      constant_extrinsics.push_back(theia::Camera::ORIENTATION + i);
+    }
+  }
+  const bool extrinsics_constant =
+      constant || static_cast<int>(constant_extrinsics.size()) ==
+                      theia::Camera::kExtrinsicsSize;
+  for (const theia::ViewId view_id : view_ids_) {
+    double* extrinsics = reconstruction_->MutableView(view_id)
+                             ->MutableCamera()
+                             ->mutable_extrinsics();
+    // parameterizations replaced here are kept alive by the problem
+    problem_->SetParameterization(extrinsics, nullptr);
+    if (extrinsics_constant) {
+      problem_->SetParameterBlockConstant(extrinsics);
+      continue;
+    }
+    problem_->SetParameterBlockVariable(extrinsics);
+    if (!constant_extrinsics.empty()) {
+      problem_->SetParameterization(
+          extrinsics,
+          new ceres::SubsetParameterization(theia::Camera::kExtrinsicsSize,
+                                            constant_extrinsics));
+    }
+  }
+
+  for (const auto& camera_intrinsics : intrinsics_) {
+    double* intrinsics = camera_intrinsics->mutable_parameters();
+    const int nr_intrinsics = camera_intrinsics->NumParameters();
+    const std::vector<int> constant_intrinsics =
+        camera_intrinsics->GetSubsetFromOptimizeIntrinsicsType(
+            options.intrinsics_to_optimize);
+    problem_->SetParameterization(intrinsics, nullptr);
+    if (constant ||
+        static_cast<int>(constant_intrinsics.size()) == nr_intrinsics) {
+      problem_->SetParameterBlockConstant(intrinsics);
+      continue;
+    }
+    problem_->SetParameterBlockVariable(intrinsics);
+    if (!constant_intrinsics.empty()) {
+      problem_->SetParameterization(
+          intrinsics,
+          new ceres::SubsetParameterization(nr_intrinsics,
+                                            constant_intrinsics));
+    }
+  }
+}
+
+void CameraCalibrationProblem::SetTracksConstant(
+    const theia::BundleAdjustmentOptions& options,
+    const bool constant) {
+  for (const theia::TrackId track_id : track_ids_) {
+    double* point =
+        reconstruction_->MutableTrack(track_id)->MutablePoint()->data();
+    problem_->SetParameterization(point, nullptr);
+    if (constant) {
+      problem_->SetParameterBlockConstant(point);
+      continue;
+    }
+    problem_->SetParameterBlockVariable(point);
+    if (options.use_homogeneous_point_parametrization) {
+      problem_->SetParameterization(
+          point, new ceres::HomogeneousVectorParameterization(4));
+    }
+  }
+}
+
+theia::BundleAdjustmentSummary CameraCalibrationProblem::Solve(
+    const theia::BundleAdjustmentOptions& options) {
+  theia::BundleAdjustmentSummary summary;
+  if (!problem_ || problem_->NumResidualBlocks() == 0) {
+    summary.success = false;
+    return summary;
+  }
+
+  ceres::Solver::Options solver_options;
+  solver_options.linear_solver_type = options.linear_solver_type;
+  solver_options.preconditioner_type = options.preconditioner_type;
+  solver_options.visibility_clustering_type =
+      options.visibility_clustering_type;
+  solver_options.logging_type =
+      options.verbose ? ceres::PER_MINIMIZER_ITERATION : ceres::SILENT;
+  solver_options.minimizer_progress_to_stdout = options.verbose;
+  solver_options.num_threads =
+      utils::ExecutionContext::SolverThreads(options.num_threads);
+  solver_options.max_num_iterations = options.max_num_iterations;
+  solver_options.max_solver_time_in_seconds =
+      options.max_solver_time_in_seconds;
+  solver_options.function_tolerance = options.function_tolerance;
+  solver_options.gradient_tolerance = options.gradient_tolerance;
+  solver_options.parameter_tolerance = options.parameter_tolerance;
+  solver_options.max_trust_region_radius = options.max_trust_region_radius;
+
+  ceres::Solver::Summary solver_summary;
+  ceres::Solve(solver_options, problem_.get(), &solver_summary);
+  if (options.verbose) {
+    LOG(INFO) << solver_summary.FullReport();
+  }
+
+  summary.setup_time_in_seconds = solver_summary.preprocessor_time_in_seconds;
+  summary.solve_time_in_seconds = solver_summary.total_time_in_seconds;
+  summary.initial_cost = solver_summary.initial_cost;
+  summary.final_cost = solver_summary.final_cost;
+  summary.success = solver_summary.IsSolutionUsable();
+  return summary;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -34,14 +34,33 @@
 #include <theia/sfm/camera/pinhole_camera_model.h>
 #include <theia/sfm/camera/pinhole_radial_tangential_camera_model.h>
 
+#include "OpenCameraCalibrator/core/board_point_refiner.h"
 #include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/reconstruction_builder.h"
 #include "OpenCameraCalibrator/io/write_camera_calibration.h"
+#include "OpenCameraCalibrator/utils/execution_context.h"
 #include "OpenCameraCalibrator/utils/intrinsic_initializer.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/planar_pose.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+#include "OpenCameraCalibrator/utils/time_budget.h"
 #include "OpenCameraCalibrator/utils/types.h"
+#include "OpenCameraCalibrator/utils/undistortion.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
+#include <theia/util/random.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
 #include <thread>
+#include <unordered_map>
 
 namespace OpenICC {
 namespace core {
@@ -57,17 +76,25 @@ CameraCalibrator::CameraCalibrator(const std::string& camera_model,
 }
 
 void CameraCalibrator::RemoveViewsReprojError(const double max_reproj_error) {
+  OPENICC_TRACE_ZONE("camera_remove_outlier_views");
   // reproj error per view, remove some views which have a high error
+  const std::vector<theia::ViewId> view_ids = recon_calib_dataset_.ViewIds();
+  std::vector<double> view_reproj_errors(view_ids.size());
+  utils::ParallelFor(
+      0, static_cast<int>(view_ids.size()), num_threads_, [&](const int i) {
+        view_reproj_errors[i] =
+            utils::GetReprojErrorOfView(recon_calib_dataset_, view_ids[i]);
+      });
   std::map<theia::ViewId, double> ids_to_remove;
-  for (int i = 0; i < recon_calib_dataset_.NumViews(); ++i) {
-    const theia::ViewId v_id = recon_calib_dataset_.ViewIds()[i];
-    const double view_reproj_error =
-        utils::GetReprojErrorOfView(recon_calib_dataset_, v_id);
-    if (view_reproj_error > max_reproj_error) {
-      ids_to_remove[v_id] = view_reproj_error;
+  for (size_t i = 0; i < view_ids.size(); ++i) {
+    if (view_reproj_errors[i] > max_reproj_error) {
+      ids_to_remove[view_ids[i]] = view_reproj_errors[i];
     }
   }
+  // the residuals of the views are removed from the existing problem, so
+  // the next stage does not rebuild it
   for (auto v_id : ids_to_remove) {
+    calib_problem_.RemoveView(v_id.first);
     recon_calib_dataset_.RemoveView(v_id.first);
     LOG(INFO) << "Removed view: " << v_id.first
               << " with RMSE reproj error: " << v_id.second << "\n";
@@ -93,6 +120,24 @@ theia::ViewId CameraCalibrator::AddView(
   std::string view_name = std::to_string((uint64_t)(timestamp_s * S_TO_US));
   theia::ViewId view_id =
       recon_calib_dataset_.AddView(view_name, group_id, timestamp_s);
+  InitializeViewCamera(view_id,
+                       initial_rotation,
+                       initial_position,
+                       initial_focal_length,
+                       initial_distortion,
+                       image_width,
+                       image_height);
+  return view_id;
+}
+
+void CameraCalibrator::InitializeViewCamera(
+    const theia::ViewId view_id,
+    const Eigen::Matrix3d& initial_rotation,
+    const Eigen::Vector3d& initial_position,
+    const double initial_focal_length,
+    const double initial_distortion,
+    const int image_width,
+    const int image_height) {
   theia::View* theia_view = recon_calib_dataset_.MutableView(view_id);
   theia_view->SetEstimated(true);
 
@@ -124,8 +169,6 @@ theia::ViewId CameraCalibrator::AddView(
   } else if (camera_model_ == "FISHEYE") {
   } else if (camera_model_ == "PINHOLE_RADIAL_TANGENTIAL") {
   }
-
-  return view_id;
 }
 
 bool CameraCalibrator::RunCalibration() {
@@ -136,12 +179,41 @@ bool CameraCalibrator::RunCalibration() {
 
   std::cout << "Using " << recon_calib_dataset_.NumViews()
             << " views for camera calibration.\n";
+  utils::ScopedTimer timer("camera_bundle_adjustment",
+                           recon_calib_dataset_.NumViews());
+  OPENICC_TRACE_ZONE("camera_bundle_adjustment");
   // bundle adjust everything
   theia::BundleAdjustmentOptions ba_options;
   ba_options.verbose = true;
   ba_options.loss_function_type = theia::LossFunctionType::HUBER;
   ba_options.robust_loss_width = 1.345;
-  ba_options.num_threads = std::thread::hardware_concurrency();
+  const int num_ba_threads = ba_num_threads_ > 0
+                                 ? ba_num_threads_
+                                 : utils::ExecutionContext::NumThreads();
+  ba_options.num_threads =
+      utils::ExecutionContext::SolverThreads(num_ba_threads);
+
+  // the stages share the time budget, a skipped stage keeps the solution of
+  // the previous ones
+  utils::TimeBudgetScheduler scheduler(time_budget_s_);
+  scheduler.AddStage("focal_length_distortion", 2.0);
+  scheduler.AddStage("principal_point", 1.0);
+  scheduler.AddStage("full", 3.0);
+  if (optimize_board_pts_) {
+    scheduler.AddStage("board_points", 2.0);
+  }
+  auto begin_stage = [&](const std::string& name) {
+    const double time_s = scheduler.BeginStage(name);
+    if (scheduler.IsLimited()) {
+      ba_options.max_solver_time_in_seconds = time_s;
+    }
+    return time_s > 0.0;
+  };
+  auto finish = [&]() {
+    time_budget_report_ =
+        scheduler.IsLimited() ? scheduler.Report() : nlohmann::json();
+    return true;
+  };
 
   /////////////////////////////////////////////////
   /// 1. Optimize focal length and radial distortion, keep principal point fixed
@@ -156,8 +228,17 @@ bool CameraCalibrator::RunCalibration() {
   }
   LOG(INFO) << "Bundle adjusting focal length and radial distortion.\n";
 
-  theia::BundleAdjustmentSummary summary = BundleAdjustViews(
-      ba_options, recon_calib_dataset_.ViewIds(), &recon_calib_dataset_);
+  // the residuals are built once and reused by all stages below
+  calib_problem_.Reset();
+  if (!begin_stage("focal_length_distortion")) {
+    return finish();
+  }
+  theia::BundleAdjustmentSummary summary;
+  {
+    OPENICC_TRACE_ZONE("camera_ba_focal_length_distortion");
+    summary = OptimizeViews(ba_options);
+  }
+  scheduler.EndStage(summary.initial_cost, summary.final_cost);
 
   RemoveViewsReprojError(5.0);
 
@@ -170,8 +251,14 @@ bool CameraCalibrator::RunCalibration() {
   ba_options.intrinsics_to_optimize =
       theia::OptimizeIntrinsicsType::PRINCIPAL_POINTS;
 
-  summary = theia::BundleAdjustViews(
-      ba_options, recon_calib_dataset_.ViewIds(), &recon_calib_dataset_);
+  if (!begin_stage("principal_point")) {
+    return finish();
+  }
+  {
+    OPENICC_TRACE_ZONE("camera_ba_principal_point");
+    summary = OptimizeViews(ba_options);
+  }
+  scheduler.EndStage(summary.initial_cost, summary.final_cost);
 
   if (recon_calib_dataset_.NumViews() < min_num_view_) {
     std::cout << "Not enough views left for proper calibration!" << std::endl;
@@ -195,8 +282,14 @@ bool CameraCalibrator::RunCalibration() {
     ba_options.intrinsics_to_optimize |=
         theia::OptimizeIntrinsicsType::TANGENTIAL_DISTORTION;
   }
-  summary = theia::BundleAdjustViews(
-      ba_options, recon_calib_dataset_.ViewIds(), &recon_calib_dataset_);
+  if (!begin_stage("full")) {
+    return finish();
+  }
+  {
+    OPENICC_TRACE_ZONE("camera_ba_full");
+    summary = OptimizeViews(ba_options);
+  }
+  scheduler.EndStage(summary.initial_cost, summary.final_cost);
 
   RemoveViewsReprojError(2.0);
 
@@ -205,145 +298,536 @@ bool CameraCalibrator::RunCalibration() {
     return false;
   }
 
-  if (optimize_board_pts_) {
+  if (optimize_board_pts_ && begin_stage("board_points")) {
+    OPENICC_TRACE_ZONE("camera_ba_board_points");
     LOG(INFO) << "Optimizing board points.";
     ba_options.use_homogeneous_point_parametrization = true;
     ba_options.verbose = true;
-    theia::BundleAdjustTracks(
-        ba_options, recon_calib_dataset_.TrackIds(), &recon_calib_dataset_);
-    summary = theia::BundleAdjustViews(
-        ba_options, recon_calib_dataset_.ViewIds(), &recon_calib_dataset_);
+    if (fast_board_pt_refinement_) {
+      BoardPointRefinementOptions refinement_options;
+      refinement_options.robust_loss_width = ba_options.robust_loss_width;
+      refinement_options.num_threads = num_ba_threads;
+      refinement_options.verbose = verbose_;
+      RefineBoardPoints(refinement_options, &recon_calib_dataset_);
+    } else {
+      OptimizeTracks(ba_options);
+    }
+    summary = OptimizeViews(ba_options);
+    scheduler.EndStage(summary.initial_cost, summary.final_cost);
   }
 
-  return true;
+  return finish();
 }
 
-bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
-                                               const std::string& output_path) {
-  io::scene_points_to_calib_dataset(scene_json, recon_calib_dataset_);
+theia::BundleAdjustmentSummary CameraCalibrator::OptimizeViews(
+    const theia::BundleAdjustmentOptions& options) {
+  if (!calib_problem_.IsBuilt()) {
+    OPENICC_TRACE_ZONE("camera_problem_build");
+    calib_problem_.Build(options, &recon_calib_dataset_);
+  }
+  return calib_problem_.OptimizeViews(options);
+}
 
-  const int image_width = scene_json["image_width"];
-  const int image_height = scene_json["image_height"];
+theia::BundleAdjustmentSummary CameraCalibrator::OptimizeTracks(
+    const theia::BundleAdjustmentOptions& options) {
+  if (!calib_problem_.IsBuilt()) {
+    OPENICC_TRACE_ZONE("camera_problem_build");
+    calib_problem_.Build(options, &recon_calib_dataset_);
+  }
+  return calib_problem_.OptimizeTracks(options);
+}
+
+std::vector<size_t> CameraCalibrator::SelectViewsPerVoxel(
+    const std::vector<ViewInitialization>& view_inits) const {
+  OPENICC_TRACE_ZONE("camera_voxel_view_selection");
+  // voxel index of the position and, if enabled, of the viewing direction.
+  // The direction is binned on a grid with the chord length of the bin angle.
+  using VoxelKey = std::array<int64_t, 6>;
+  struct VoxelKeyHash {
+    size_t operator()(const VoxelKey& key) const {
+      size_t hash = 0;
+      for (const int64_t k : key) {
+        hash ^= std::hash<int64_t>()(k) + 0x9e3779b9 + (hash << 6) +
+                (hash >> 2);
+      }
+      return hash;
+    }
+  };
+  const double dir_bin_size =
+      2.0 * std::sin(0.5 * orientation_bin_deg_ * M_PI / 180.0);
+  auto voxel_key = [&](const ViewInitialization& view_init) {
+    VoxelKey key{0, 0, 0, 0, 0, 0};
+    for (int d = 0; d < 3; ++d) {
+      key[d] = static_cast<int64_t>(
+          std::floor(view_init.position[d] / grid_size_));
+    }
+    if (dir_bin_size > 0.0) {
+      // camera z axis in world coordinates
+      const Eigen::Vector3d view_dir = view_init.rotation.row(2);
+      for (int d = 0; d < 3; ++d) {
+        key[3 + d] =
+            static_cast<int64_t>(std::floor(view_dir[d] / dir_bin_size));
+      }
+    }
+    return key;
+  };
+
+  std::unordered_map<VoxelKey, size_t, VoxelKeyHash> voxel_to_view;
+  for (size_t v = 0; v < view_inits.size(); ++v) {
+    if (!view_inits[v].success) {
+      continue;
+    }
+    if (grid_size_ <= 0.0) {
+      voxel_to_view[VoxelKey{0, 0, 0, 0, 0, static_cast<int64_t>(v)}] = v;
+      continue;
+    }
+    const auto inserted = voxel_to_view.emplace(voxel_key(view_inits[v]), v);
+    size_t& kept_view = inserted.first->second;
+    if (!inserted.second && keep_most_corners_per_voxel_ &&
+        view_inits[v].corners.size() > view_inits[kept_view].corners.size()) {
+      kept_view = v;
+    }
+  }
+
+  std::vector<size_t> selected_views;
+  selected_views.reserve(voxel_to_view.size());
+  for (const auto& voxel : voxel_to_view) {
+    selected_views.push_back(voxel.second);
+  }
+  std::sort(selected_views.begin(), selected_views.end());
+  return selected_views;
+}
+
+std::vector<size_t> CameraCalibrator::SelectViewsByInformation(
+    const std::vector<ViewInitialization>& view_inits,
+    const std::vector<size_t>& candidate_views) const {
+  OPENICC_TRACE_ZONE("camera_information_view_selection");
+  // intrinsics f, cx, cy, k of a radial model u = f * x * (1 + k * r^2) + c,
+  // linearized at k = 0 and the median initial focal length
+  using Matrix4d = Eigen::Matrix4d;
+  std::vector<double> focal_lengths;
+  for (const size_t v : candidate_views) {
+    focal_lengths.push_back(view_inits[v].focal_length);
+  }
+  if (focal_lengths.empty()) {
+    return candidate_views;
+  }
+  std::nth_element(focal_lengths.begin(),
+                   focal_lengths.begin() + focal_lengths.size() / 2,
+                   focal_lengths.end());
+  const double f = focal_lengths[focal_lengths.size() / 2];
+
+  // information of every view with its pose marginalized by the Schur
+  // complement. The views are independent, so this runs in parallel.
+  aligned_vector<Matrix4d> view_information(candidate_views.size());
+  auto compute_information = [&](const int c) {
+    const ViewInitialization& view_init = view_inits[candidate_views[c]];
+    Matrix4d A = Matrix4d::Zero();
+    Eigen::Matrix<double, 4, 6> B = Eigen::Matrix<double, 4, 6>::Zero();
+    Eigen::Matrix<double, 6, 6> C = Eigen::Matrix<double, 6, 6>::Zero();
+    for (const int pt_id : view_init.board_pt3_ids) {
+      const Eigen::Vector3d X =
+          recon_calib_dataset_.Track(pt_id)->Point().hnormalized();
+      const Eigen::Vector3d p = view_init.rotation * (X - view_init.position);
+      if (p[2] <= 0.0) {
+        continue;
+      }
+      const double a = p[0] / p[2];
+      const double b = p[1] / p[2];
+      const double r2 = a * a + b * b;
+      Eigen::Matrix<double, 2, 4> J_intr;
+      J_intr << a, 1.0, 0.0, f * a * r2, b, 0.0, 1.0, f * b * r2;
+      Eigen::Matrix<double, 2, 3> J_proj;
+      J_proj << 1.0 / p[2], 0.0, -a / p[2], 0.0, 1.0 / p[2], -b / p[2];
+      // rotation perturbation in the camera frame and camera position
+      Eigen::Matrix<double, 3, 6> J_p_pose;
+      J_p_pose.leftCols<3>() = -Sophus::SO3d::hat(p);
+      J_p_pose.rightCols<3>() = -view_init.rotation;
+      const Eigen::Matrix<double, 2, 6> J_pose = f * J_proj * J_p_pose;
+      A += J_intr.transpose() * J_intr;
+      B += J_intr.transpose() * J_pose;
+      C += J_pose.transpose() * J_pose;
+    }
+    const Eigen::LDLT<Eigen::Matrix<double, 6, 6>> C_ldlt(C);
+    view_information[c] = C_ldlt.info() == Eigen::Success
+                              ? Matrix4d(A - B * C_ldlt.solve(B.transpose()))
+                              : Matrix4d::Zero();
+  };
+  utils::ParallelFor(0,
+                     static_cast<int>(candidate_views.size()),
+                     num_threads_,
+                     compute_information);
+
+  // a single view does not determine all intrinsics, so start from a weak
+  // prior relative to the average view information
+  double mean_trace = 0.0;
+  for (const Matrix4d& info : view_information) {
+    mean_trace += info.trace();
+  }
+  mean_trace /= view_information.size();
+  Matrix4d information = Matrix4d::Identity() * 1e-6 * mean_trace;
+  auto log_det = [](const Matrix4d& M) {
+    const Eigen::LDLT<Matrix4d> ldlt(M);
+    return ldlt.vectorD().array().max(1e-300).log().sum();
+  };
+
+  std::vector<bool> used(candidate_views.size(), false);
+  std::vector<size_t> selected_views;
+  double current_log_det = log_det(information);
+  const size_t max_views = std::min(max_information_views_,
+                                    candidate_views.size());
+  while (selected_views.size() < max_views) {
+    int best = -1;
+    double best_log_det = -std::numeric_limits<double>::max();
+    for (size_t c = 0; c < candidate_views.size(); ++c) {
+      if (used[c]) continue;
+      const double value = log_det(information + view_information[c]);
+      if (value > best_log_det) {
+        best_log_det = value;
+        best = static_cast<int>(c);
+      }
+    }
+    const bool enough_views =
+        static_cast<int>(selected_views.size()) >= min_num_view_;
+    const double gain = best_log_det - current_log_det;
+    if (best < 0 || (enough_views && gain < min_information_gain_)) {
+      break;
+    }
+    used[best] = true;
+    information += view_information[best];
+    current_log_det = best_log_det;
+    selected_views.push_back(candidate_views[best]);
+  }
+  std::sort(selected_views.begin(), selected_views.end());
+  return selected_views;
+}
+
+void CameraCalibrator::InitializeView(const nlohmann::json& image_points,
+                                      const int image_width,
+                                      const int image_height,
+                                      const unsigned int seed,
+                                      ViewInitialization* view_init) const {
   // initial principal point
   const double px = static_cast<double>(image_width) / 2.0;
   const double py = static_cast<double>(image_height) / 2.0;
 
-  vec3_vector saved_poses;
-  // iterate views and estimate poses
-  const auto views = scene_json["views"];
-  const size_t total_nr_views = views.size();
-  int views_initialized = 0;
-  for (const auto& view : views.items()) {
-    const double timestamp_us = std::stod(view.key());  // to seconds
-    const double timestamp_s = timestamp_us * 1e-6;     // to seconds
-    const auto image_points = view.value()["image_points"];
-    std::vector<int> board_pt3_ids;
-    aligned_vector<Eigen::Vector2d> corners;
-    for (const auto& img_pts : image_points.items()) {
-      board_pt3_ids.push_back(std::stoi(img_pts.key()));
-      corners.push_back(
-          Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
-    }
+  for (const auto& img_pts : image_points.items()) {
+    view_init->board_pt3_ids.push_back(std::stoi(img_pts.key()));
+    view_init->corners.push_back(Eigen::Vector2d(
+        img_pts.value()[0].get<double>(), img_pts.value()[1].get<double>()));
+  }
 
-    LOG(INFO) << "Initializing view at timestamp: " << timestamp_s << "\n";
-    // initialize cam pose
-    std::vector<theia::FeatureCorrespondence2D3D> correspondences(
-        board_pt3_ids.size());
-    for (size_t i = 0; i < board_pt3_ids.size(); ++i) {
-      theia::FeatureCorrespondence2D3D correspondence;
-      correspondence.feature[0] = corners[i][0] - px;
-      correspondence.feature[1] = corners[i][1] - py;
-      const Eigen::Vector4d track =
-          recon_calib_dataset_.Track(board_pt3_ids[i])->Point();
-      correspondence.world_point = track.hnormalized();
-      correspondences[i] = correspondence;
-    }
+  // initialize cam pose
+  const std::vector<int>& board_pt3_ids = view_init->board_pt3_ids;
+  std::vector<theia::FeatureCorrespondence2D3D> correspondences(
+      board_pt3_ids.size());
+  for (size_t i = 0; i < board_pt3_ids.size(); ++i) {
+    theia::FeatureCorrespondence2D3D correspondence;
+    correspondence.feature[0] = view_init->corners[i][0] - px;
+    correspondence.feature[1] = view_init->corners[i][1] - py;
+    const Eigen::Vector4d track =
+        recon_calib_dataset_.Track(board_pt3_ids[i])->Point();
+    correspondence.world_point = track.hnormalized();
+    correspondences[i] = correspondence;
+  }
 
-    theia::RansacSummary ransac_summary;
-    Eigen::Matrix3d rotation;
-    Eigen::Vector3d position;
-    bool success_init = false;
-    double focal_length = 0.0, radial_distortion = 0.0;
-    LOG(INFO) << "Initializing " << camera_model_ << " camera model.\n";
-
-    // set error thresh 0.3% from image size
-    ransac_params_.error_thresh = 0.003 * image_height;
-    if (camera_model_ == "PINHOLE" ||
-        camera_model_ == "PINHOLE_RADIAL_TANGENTIAL") {
-      success_init = utils::initialize_pinhole_camera(correspondences,
-                                                      ransac_params_,
-                                                      ransac_summary,
-                                                      rotation,
-                                                      position,
-                                                      focal_length,
-                                                      verbose_);
-    } else if (camera_model_ == "DIVISION_UNDISTORTION") {
-      success_init = utils::initialize_radial_undistortion_camera(
-          correspondences,
-          ransac_params_,
-          ransac_summary,
-          cv::Size(image_width, image_height),
-          rotation,
-          position,
-          focal_length,
-          radial_distortion,
-          verbose_);
-    } else {
-      success_init = utils::initialize_radial_undistortion_camera(
-          correspondences,
-          ransac_params_,
-          ransac_summary,
-          cv::Size(image_width, image_height),
-          rotation,
-          position,
-          focal_length,
-          radial_distortion,
-          verbose_);
-      //        success_init = utils::initialize_doublesphere_model(
-      //                correspondences, board_pt3_ids, cv::Size(9, 7),
-      //                ransac_params_, image_width, image_height,
-      //                ransac_summary, rotation, position, focal_length,
-      //                verbose_);
+  theia::RansacParameters ransac_params = ransac_params_;
+  // set error thresh 0.3% from image size
+  ransac_params.error_thresh = 0.003 * image_height;
+  ransac_params.rng = std::make_shared<theia::RandomNumberGenerator>(seed);
+  theia::RansacSummary ransac_summary;
+  utils::ScopedTimer timer("pnp", 1);
+  OPENICC_TRACE_ZONE("pnp");
+  if (camera_model_ == "PINHOLE" ||
+      camera_model_ == "PINHOLE_RADIAL_TANGENTIAL") {
+    // a board seen at an angle fixes the focal length and the pose in closed
+    // form, RANSAC is only needed for fronto-parallel or noisy views
+    view_init->success =
+        utils::initialize_pinhole_camera_planar(correspondences,
+                                                ransac_params.error_thresh,
+                                                view_init->rotation,
+                                                view_init->position,
+                                                view_init->focal_length,
+                                                verbose_) ||
+        utils::initialize_pinhole_camera(correspondences,
+                                         ransac_params,
+                                         ransac_summary,
+                                         view_init->rotation,
+                                         view_init->position,
+                                         view_init->focal_length,
+                                         verbose_);
+  } else {
+    view_init->success = utils::initialize_radial_undistortion_camera(
+        correspondences,
+        ransac_params,
+        ransac_summary,
+        cv::Size(image_width, image_height),
+        view_init->rotation,
+        view_init->position,
+        view_init->focal_length,
+        view_init->radial_distortion,
+        verbose_);
+    //        success_init = utils::initialize_doublesphere_model(
+    //                correspondences, board_pt3_ids, cv::Size(9, 7),
+    //                ransac_params_, image_width, image_height,
+    //                ransac_summary, rotation, position, focal_length,
+    //                verbose_);
+  }
+}
+
+std::pair<double, double> CameraCalibrator::SelectInitialIntrinsics(
+    const std::vector<ViewInitialization>& view_inits,
+    const std::vector<size_t>& selected_views,
+    const int image_width,
+    const int image_height) const {
+  std::vector<std::pair<double, double>> candidates;
+  candidates.reserve(selected_views.size());
+  for (const size_t v : selected_views) {
+    candidates.emplace_back(view_inits[v].focal_length,
+                            view_inits[v].radial_distortion);
+  }
+  // start from the view with the median focal length, which does not depend
+  // on the processing order
+  std::vector<std::pair<double, double>> sorted_candidates = candidates;
+  std::nth_element(sorted_candidates.begin(),
+                   sorted_candidates.begin() + sorted_candidates.size() / 2,
+                   sorted_candidates.end());
+  const std::pair<double, double> median_intrinsics =
+      sorted_candidates[sorted_candidates.size() / 2];
+  // without distortion every focal length maps the board to a homography
+  if (camera_model_ == "PINHOLE" ||
+      camera_model_ == "PINHOLE_RADIAL_TANGENTIAL") {
+    return median_intrinsics;
+  }
+
+  // random subsets with a fixed seed bound the cost of the n x m scoring
+  // independently of the dataset size
+  std::mt19937 rng(42);
+  auto sample = [&rng](const size_t n, const size_t max_samples) {
+    std::vector<size_t> indices(n);
+    for (size_t i = 0; i < n; ++i) {
+      indices[i] = i;
     }
-    if (views_initialized % 100 == 0) {
-      std::cout << "View: " << views_initialized << "/" << total_nr_views
-                << " initialized for calibration.\n";
+    if (max_samples > 0 && max_samples < n) {
+      std::shuffle(indices.begin(), indices.end(), rng);
+      indices.resize(max_samples);
+      std::sort(indices.begin(), indices.end());
     }
-    ++views_initialized;
-
-    // check if a very close by pose is already present
-    bool take_image = true;
-    for (size_t i = 0; i < saved_poses.size(); ++i) {
-      if ((position - saved_poses[i]).norm() < grid_size_) {
-        take_image = false;
-        break;
-      }
+    return indices;
+  };
+  const std::vector<size_t> candidate_ids =
+      sample(candidates.size(), max_intrinsics_candidates_);
+  std::vector<size_t> scoring_views =
+      sample(selected_views.size(), max_intrinsics_scoring_views_);
+  for (size_t& v : scoring_views) {
+    v = selected_views[v];
+  }
+
+  utils::ScopedTimer timer("intrinsics_candidate_scoring",
+                           candidate_ids.size());
+  OPENICC_TRACE_ZONE("intrinsics_candidate_scoring");
+  std::vector<double> scores(candidate_ids.size());
+  auto score_candidate = [&](const int c) {
+    scores[c] = ScoreIntrinsicsCandidate(view_inits,
+                                         scoring_views,
+                                         candidates[candidate_ids[c]],
+                                         image_width,
+                                         image_height);
+  };
+  utils::ParallelFor(0,
+                     static_cast<int>(candidate_ids.size()),
+                     num_threads_,
+                     score_candidate);
+
+  // first minimum, so ties do not depend on the number of threads
+  size_t best = 0;
+  for (size_t c = 1; c < scores.size(); ++c) {
+    if (scores[c] < scores[best]) {
+      best = c;
     }
+  }
+  if (!std::isfinite(scores[best])) {
+    LOG(WARNING) << "No intrinsics candidate undistorts the board, using the "
+                    "median focal length.";
+    return median_intrinsics;
+  }
+  if (verbose_) {
+    LOG(INFO) << "Best of " << candidate_ids.size()
+              << " intrinsics candidates scored on " << scoring_views.size()
+              << " views: " << scores[best] << "px homography RMSE.";
+  }
+  return candidates[candidate_ids[best]];
+}
 
-    if (!take_image || !success_init) {
+double CameraCalibrator::ScoreIntrinsicsCandidate(
+    const std::vector<ViewInitialization>& view_inits,
+    const std::vector<size_t>& scoring_views,
+    const std::pair<double, double>& intrinsics,
+    const int image_width,
+    const int image_height) const {
+  theia::Camera camera;
+  camera.SetCameraIntrinsicsModelType(
+      theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION);
+  camera.SetImageSize(image_width, image_height);
+  camera.SetPrincipalPoint(image_width / 2.0, image_height / 2.0);
+  camera.SetFocalLength(intrinsics.first);
+  camera.CameraIntrinsics()->SetParameter(
+      theia::DivisionUndistortionCameraModel::RADIAL_DISTORTION_1,
+      intrinsics.second);
+
+  std::vector<double> view_errors;
+  view_errors.reserve(scoring_views.size());
+  vec2_vector normalized;
+  std::vector<theia::FeatureCorrespondence2D3D> correspondences;
+  for (const size_t v : scoring_views) {
+    const ViewInitialization& view_init = view_inits[v];
+    utils::PixelsToNormalizedCoordinates(
+        camera, view_init.corners, &normalized);
+    correspondences.resize(normalized.size());
+    for (size_t i = 0; i < normalized.size(); ++i) {
+      correspondences[i].feature = normalized[i];
+      correspondences[i].world_point =
+          recon_calib_dataset_.Track(view_init.board_pt3_ids[i])
+              ->Point()
+              .hnormalized();
+    }
+    Eigen::Matrix3d homography;
+    if (!utils::EstimateBoardHomography(correspondences, &homography)) {
       continue;
     }
+    double sq_error = 0.0;
+    for (const auto& correspondence : correspondences) {
+      const Eigen::Vector3d projected =
+          homography * correspondence.world_point.head<2>().homogeneous();
+      sq_error +=
+          (projected.hnormalized() - correspondence.feature).squaredNorm();
+    }
+    const double rmse =
+        intrinsics.first * std::sqrt(sq_error / correspondences.size());
+    if (std::isfinite(rmse)) {
+      view_errors.push_back(rmse);
+    }
+  }
+  if (view_errors.empty()) {
+    return std::numeric_limits<double>::infinity();
+  }
+  std::nth_element(view_errors.begin(),
+                   view_errors.begin() + view_errors.size() / 2,
+                   view_errors.end());
+  return view_errors[view_errors.size() / 2];
+}
 
-    saved_poses.push_back(position);
+bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
+                                               const std::string& output_path) {
+  OPENICC_TRACE_ZONE("camera_calibration");
+  io::scene_points_to_calib_dataset(scene_json, recon_calib_dataset_);
 
-    theia::ViewId view_id = AddView(rotation,
-                                    position,
-                                    focal_length,
-                                    radial_distortion,
-                                    image_width,
-                                    image_height,
-                                    timestamp_s);
+  const int image_width = scene_json["image_width"];
+  const int image_height = scene_json["image_height"];
+
+  // json objects are ordered by key string, so sort the views by time
+  const auto& views = scene_json["views"];
+  std::vector<std::pair<double, const nlohmann::json*>> timed_views;
+  for (const auto& view : views.items()) {
+    const double timestamp_us = std::stod(view.key());
+    timed_views.emplace_back(timestamp_us * US_TO_S,
+                             &view.value()["image_points"]);
+  }
+  std::sort(timed_views.begin(),
+            timed_views.end(),
+            [](const std::pair<double, const nlohmann::json*>& a,
+               const std::pair<double, const nlohmann::json*>& b) {
+              return a.first < b.first;
+            });
+
+  // the views are initialized in parallel into their own slot
+  LOG(INFO) << "Initializing " << camera_model_ << " camera model.\n";
+  const size_t total_nr_views = timed_views.size();
+  std::vector<ViewInitialization> view_inits(total_nr_views);
+  std::atomic<int> views_initialized(0);
+  auto initialize_view = [&](const int v) {
+    view_inits[v].timestamp_s = timed_views[v].first;
+    InitializeView(
+        *timed_views[v].second, image_width, image_height, v, &view_inits[v]);
+    const int nr_initialized = ++views_initialized;
+    if (nr_initialized % 100 == 0) {
+      std::cout << "View: " << nr_initialized << "/" << total_nr_views
+                << " initialized for calibration.\n";
+    }
+  };
+  utils::ParallelFor(
+      0, static_cast<int>(total_nr_views), num_threads_, initialize_view);
+
+  // voxel filter and view creation in timestamp order
+  std::vector<size_t> selected_views = SelectViewsPerVoxel(view_inits);
+  LOG(INFO) << "Voxel filter kept " << selected_views.size() << " of "
+            << total_nr_views << " views.";
+  if (max_information_views_ > 0) {
+    const size_t nr_voxel_views = selected_views.size();
+    selected_views = SelectViewsByInformation(view_inits, selected_views);
+    LOG(INFO) << "Information based selection kept " << selected_views.size()
+              << " of " << nr_voxel_views << " views.";
+  }
+  io::ReconstructionBuilder builder;
+  size_t nr_observations = 0;
+  for (const size_t v : selected_views) {
+    nr_observations += view_inits[v].board_pt3_ids.size();
+  }
+  builder.Reserve(0, selected_views.size(), nr_observations);
+  for (const size_t v : selected_views) {
+    const ViewInitialization& view_init = view_inits[v];
+    builder.AddView(
+        std::to_string((uint64_t)(view_init.timestamp_s * S_TO_US)),
+        view_init.timestamp_s);
+    for (size_t i = 0; i < view_init.board_pt3_ids.size(); ++i) {
+      builder.AddObservation(view_init.board_pt3_ids[i],
+                             view_init.corners[i].x(),
+                             view_init.corners[i].y());
+    }
+  }
+  std::vector<theia::ViewId> view_ids;
+  builder.Build(recon_calib_dataset_, &view_ids);
+  for (size_t i = 0; i < view_ids.size(); ++i) {
+    if (view_ids[i] == theia::kInvalidViewId) {
+      continue;
+    }
+    const ViewInitialization& view_init = view_inits[selected_views[i]];
+    InitializeViewCamera(view_ids[i],
+                         view_init.rotation,
+                         view_init.position,
+                         view_init.focal_length,
+                         view_init.radial_distortion,
+                         image_width,
+                         image_height);
+  }
 
-    for (size_t i = 0; i < board_pt3_ids.size(); ++i) {
-      AddObservation(view_id, board_pt3_ids[i], corners[i]);
+  // all views share one set of intrinsics
+  if (!selected_views.empty()) {
+    const std::pair<double, double> initial_intrinsics =
+        SelectInitialIntrinsics(
+            view_inits, selected_views, image_width, image_height);
+    LOG(INFO) << "Initial focal length: " << initial_intrinsics.first
+              << "px, distortion: " << initial_intrinsics.second;
+    for (const theia::ViewId view_id : recon_calib_dataset_.ViewIds()) {
+      theia::Camera* cam =
+          recon_calib_dataset_.MutableView(view_id)->MutableCamera();
+      cam->SetFocalLength(initial_intrinsics.first);
+      if (camera_model_ == "DIVISION_UNDISTORTION") {
+        cam->CameraIntrinsics()->SetParameter(
+            theia::DivisionUndistortionCameraModel::RADIAL_DISTORTION_1,
+            initial_intrinsics.second);
+      }
     }
   }
 
-  theia::WritePlyFile(output_path + "_ransac_poses.ply",
-                      recon_calib_dataset_,
-                      Eigen::Vector3i(255, 0, 0),
-                      1);
+  if (output_path != "") {
+    theia::WritePlyFile(output_path + "_ransac_poses.ply",
+                        recon_calib_dataset_,
+                        Eigen::Vector3i(255, 0, 0),
+                        1);
+  }
 
+  reproj_error_ = -1.0;
   if (!RunCalibration()) {
     LOG(ERROR) << "Calibration failed.\n";
     return false;
@@ -363,6 +847,7 @@ bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
 
   const double total_repro_error =
       reproj_error / recon_calib_dataset_.NumViews();
+  reproj_error_ = total_repro_error;
   std::cout << "Final camera calibration reprojection error: "
             << total_repro_error << " from " << recon_calib_dataset_.NumViews()
             << " view." << std::endl;
@@ -387,6 +872,15 @@ bool CameraCalibrator::CalibrateCameraFromJson(const nlohmann::json& scene_json,
   return true;
 }
 
+bool CameraCalibrator::GetCalibratedCamera(theia::Camera& camera) const {
+  if (reproj_error_ < 0.0 || recon_calib_dataset_.NumViews() == 0) {
+    return false;
+  }
+  camera =
+      recon_calib_dataset_.View(recon_calib_dataset_.ViewIds()[0])->Camera();
+  return true;
+}
+
 void CameraCalibrator::PrintResult() {
   const theia::Camera cam =
       recon_calib_dataset_.View(recon_calib_dataset_.ViewIds()[0])->Camera();
@@ -0,0 +1,153 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/extraction_coverage.h"
+
+#include <opencv2/calib3d.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+const char* kTiltNames[ExtractionCoverage::kNumTilts] = {
+    "frontal", "depth_along_x_pos", "depth_along_x_neg", "depth_along_y_pos",
+    "depth_along_y_neg"};
+
+int GridCell(const double x, const int size, const int nr_cells) {
+  const int cell = static_cast<int>(x * nr_cells / size);
+  return std::min(std::max(cell, 0), nr_cells - 1);
+}
+}  // namespace
+
+ExtractionCoverage::ExtractionCoverage(
+    const ExtractionCoverageOptions& options,
+    const std::vector<cv::Point3f>& board_pts)
+    : options_(options),
+      cell_corners_(std::max(1, options.grid_cols * options.grid_rows), 0) {
+  if (board_pts.empty()) {
+    return;
+  }
+  cv::Point2f min_pt(board_pts[0].x, board_pts[0].y), max_pt = min_pt;
+  for (const cv::Point3f& p : board_pts) {
+    min_pt.x = std::min(min_pt.x, p.x);
+    min_pt.y = std::min(min_pt.y, p.y);
+    max_pt.x = std::max(max_pt.x, p.x);
+    max_pt.y = std::max(max_pt.y, p.y);
+  }
+  const cv::Point2f center = 0.5f * (min_pt + max_pt);
+  const float extent =
+      std::max(std::max(max_pt.x - min_pt.x, max_pt.y - min_pt.y), 1e-6f);
+  for (const cv::Point3f& p : board_pts) {
+    board_xy_.push_back((cv::Point2f(p.x, p.y) - center) / extent);
+  }
+}
+
+void ExtractionCoverage::AddView(
+    const cv::Size& image_size,
+    const aligned_vector<Eigen::Vector2d>& corners,
+    const std::vector<int>& object_pt_ids) {
+  const size_t kMinCorners = 4;
+  if (corners.size() < kMinCorners || image_size.area() <= 0) {
+    return;
+  }
+  ++nr_views_;
+  for (const auto& c : corners) {
+    const int col = GridCell(c[0], image_size.width, options_.grid_cols);
+    const int row = GridCell(c[1], image_size.height, options_.grid_rows);
+    if (++cell_corners_[row * options_.grid_cols + col] ==
+        options_.min_corners_per_cell) {
+      ++nr_covered_cells_;
+    }
+  }
+  Tilt tilt;
+  if (TiltOfView(corners, object_pt_ids, &tilt)) {
+    ++tilt_views_[tilt];
+  }
+}
+
+bool ExtractionCoverage::TiltOfView(
+    const aligned_vector<Eigen::Vector2d>& corners,
+    const std::vector<int>& object_pt_ids,
+    Tilt* tilt) const {
+  const size_t kMinCorners = 8;
+  if (corners.size() < kMinCorners) {
+    return false;
+  }
+  std::vector<cv::Point2f> board_xy, image_xy;
+  for (size_t i = 0; i < corners.size(); ++i) {
+    const int id = object_pt_ids[i];
+    if (id < 0 || id >= static_cast<int>(board_xy_.size())) {
+      return false;
+    }
+    board_xy.push_back(board_xy_[id]);
+    image_xy.emplace_back(corners[i][0], corners[i][1]);
+  }
+  const cv::Mat H = cv::findHomography(board_xy, image_xy);
+  if (H.empty() || std::abs(H.at<double>(2, 2)) < 1e-12) {
+    return false;
+  }
+  // the last row of H is proportional to the depth of a board point, so on
+  // the unit board it is the relative depth change along each axis
+  const double gx = H.at<double>(2, 0) / H.at<double>(2, 2);
+  const double gy = H.at<double>(2, 1) / H.at<double>(2, 2);
+  if (std::hypot(gx, gy) < options_.min_tilt) {
+    *tilt = FRONTAL;
+  } else if (std::abs(gx) > std::abs(gy)) {
+    *tilt = gx > 0.0 ? TILT_X_POS : TILT_X_NEG;
+  } else {
+    *tilt = gy > 0.0 ? TILT_Y_POS : TILT_Y_NEG;
+  }
+  return true;
+}
+
+double ExtractionCoverage::CoveredCellFraction() const {
+  return static_cast<double>(nr_covered_cells_) / cell_corners_.size();
+}
+
+bool ExtractionCoverage::TargetsMet() const {
+  if (nr_views_ < options_.min_views ||
+      CoveredCellFraction() < options_.min_cell_fraction) {
+    return false;
+  }
+  for (const int nr_views : tilt_views_) {
+    if (nr_views < options_.min_views_per_tilt) {
+      return false;
+    }
+  }
+  return true;
+}
+
+nlohmann::json ExtractionCoverage::ToJson() const {
+  nlohmann::json json;
+  json["targets_met"] = TargetsMet();
+  json["nr_views"] = nr_views_;
+  json["min_views"] = options_.min_views;
+  json["covered_cell_fraction"] = CoveredCellFraction();
+  json["min_cell_fraction"] = options_.min_cell_fraction;
+  json["grid_cols"] = options_.grid_cols;
+  json["grid_rows"] = options_.grid_rows;
+  json["cell_corners"] = cell_corners_;
+  for (int t = 0; t < kNumTilts; ++t) {
+    json["tilt_views"][kTiltNames[t]] = tilt_views_[t];
+  }
+  json["min_views_per_tilt"] = options_.min_views_per_tilt;
+  return json;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -15,10 +15,192 @@
 
 #include "OpenCameraCalibrator/core/imu_camera_calibrator.h"
 
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <string>
+
+#include "OpenCameraCalibrator/io/reconstruction_builder.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+
 namespace OpenICC {
 namespace core {
 
-void ImuCameraCalibrator::BatchInitSpline(
+void BuildSplineCalibrationDataset(const theia::Reconstruction& pose_dataset,
+                                   const nlohmann::json& scene_json,
+                                   const theia::Camera& camera,
+                                   const double t_offset_cam_s,
+                                   theia::Reconstruction& recon_calib_dataset) {
+  // fill tracks. we use the ones from pose estimation because they might have
+  // been optimized (to account for non planarity of the target)
+  io::ReconstructionBuilder builder;
+  builder.Reserve(pose_dataset.NumTracks(), pose_dataset.NumViews(), 0);
+  for (const auto& old_track_id : pose_dataset.TrackIds()) {
+    builder.AddTrack(old_track_id, pose_dataset.Track(old_track_id)->Point());
+  }
+
+  std::vector<theia::ViewId> old_view_ids;
+  old_view_ids.reserve(pose_dataset.NumViews());
+  for (const auto& view : scene_json["views"].items()) {
+    const double timestamp_us = std::stod(view.key());
+    const double timestamp_s = timestamp_us * US_TO_S;  // to seconds
+    std::string view_name = std::to_string((uint64_t)timestamp_us);
+    theia::ViewId old_view_id = pose_dataset.ViewIdFromName(view_name);
+    if (old_view_id == theia::kInvalidViewId) {
+      continue;
+    }
+    builder.AddView(view_name, timestamp_s + t_offset_cam_s);
+    old_view_ids.push_back(old_view_id);
+    for (const auto& img_pts : view.value()["image_points"].items()) {
+      const nlohmann::json& corner = img_pts.value();
+      builder.AddObservation(std::stoi(img_pts.key()),
+                             corner[0].get<double>(),
+                             corner[1].get<double>());
+    }
+  }
+
+  std::vector<theia::ViewId> view_ids;
+  builder.Build(recon_calib_dataset, &view_ids);
+  const theia::CameraIntrinsicsPrior intrinsics_prior =
+      camera.CameraIntrinsicsPriorFromIntrinsics();
+  for (size_t i = 0; i < view_ids.size(); ++i) {
+    if (view_ids[i] == theia::kInvalidViewId) {
+      continue;
+    }
+    theia::Camera* mutable_cam =
+        recon_calib_dataset.MutableView(view_ids[i])->MutableCamera();
+    const theia::Camera& cam_old = pose_dataset.View(old_view_ids[i])->Camera();
+    mutable_cam->SetOrientationFromAngleAxis(
+        cam_old.GetOrientationAsAngleAxis());
+    mutable_cam->SetPosition(cam_old.GetPosition());
+    mutable_cam->SetFromCameraIntrinsicsPriors(intrinsics_prior);
+  }
+}
+
+namespace {
+//! Copies the views of dataset shifted by shift_s and the board points that
+//! are not in target yet. The views keep their intrinsics group unless
+//! group is a valid one
+void CopyCalibrationViews(const theia::Reconstruction& dataset,
+                          const theia::CameraIntrinsicsGroupId group,
+                          const double shift_s,
+                          theia::Reconstruction& target) {
+  for (const theia::TrackId track_id : dataset.TrackIds()) {
+    if (target.Track(track_id)) {
+      continue;
+    }
+    target.AddTrack(track_id);
+    theia::Track* track = target.MutableTrack(track_id);
+    track->SetEstimated(true);
+    *track->MutablePoint() = dataset.Track(track_id)->Point();
+  }
+  for (const theia::ViewId view_id : dataset.ViewIds()) {
+    const theia::View* view = dataset.View(view_id);
+    const double t = view->GetTimestamp() + shift_s;
+    const theia::CameraIntrinsicsGroupId view_group =
+        group != theia::kInvalidCameraIntrinsicsGroupId
+            ? group
+            : dataset.CameraIntrinsicsGroupIdFromViewId(view_id);
+    // views of different cameras can share a timestamp
+    std::string view_name = std::to_string(static_cast<uint64_t>(t * S_TO_US));
+    if (view_group != 0) {
+      view_name = "cam" + std::to_string(view_group) + "_" + view_name;
+    }
+    const theia::ViewId new_view_id = target.AddView(view_name, view_group, t);
+    if (new_view_id == theia::kInvalidViewId) {
+      LOG(WARNING) << "Skipping duplicate view " << view_name << ".";
+      continue;
+    }
+    theia::View* new_view = target.MutableView(new_view_id);
+    *new_view->MutableCamera() = view->Camera();
+    new_view->SetEstimated(view->IsEstimated());
+    for (const theia::TrackId track_id : view->TrackIds()) {
+      target.AddObservation(new_view_id, track_id, *view->GetFeature(track_id));
+    }
+  }
+}
+}  // namespace
+
+void AddRigCameraViews(const theia::Reconstruction& camera_dataset,
+                       const theia::CameraIntrinsicsGroupId camera,
+                       const double time_shift_s,
+                       theia::Reconstruction& rig_dataset) {
+  CopyCalibrationViews(camera_dataset, camera, time_shift_s, rig_dataset);
+}
+
+bool MergeSplineRecordings(
+    const std::vector<SplineRecording>& recordings,
+    const double gap_s,
+    const int num_threads,
+    theia::Reconstruction& merged_dataset,
+    CameraTelemetryData& merged_telemetry,
+    std::vector<std::pair<double, double>>& recording_segments_s) {
+  // time shift of every recording from its camera time range
+  std::vector<double> shifts_s(recordings.size(), 0.0);
+  recording_segments_s.clear();
+  double next_start_s = 0.0;
+  for (size_t r = 0; r < recordings.size(); ++r) {
+    const theia::Reconstruction& dataset = *recordings[r].vision_dataset;
+    double t_min = std::numeric_limits<double>::max();
+    double t_max = std::numeric_limits<double>::lowest();
+    for (const theia::ViewId view_id : dataset.ViewIds()) {
+      const double t = dataset.View(view_id)->GetTimestamp();
+      t_min = std::min(t_min, t);
+      t_max = std::max(t_max, t);
+    }
+    if (dataset.NumViews() == 0) {
+      LOG(ERROR) << "Recording " << r << " has no views.";
+      return false;
+    }
+    shifts_s[r] = r == 0 ? 0.0 : next_start_s - t_min;
+    recording_segments_s.emplace_back(t_min + shifts_s[r],
+                                      t_max + shifts_s[r]);
+    next_start_s = t_max + shifts_s[r] + gap_s;
+  }
+
+  // the IMU samples of the recordings are shifted in parallel, only the
+  // samples inside their recording are kept so the merged time axis stays
+  // sorted
+  std::vector<CameraTelemetryData> shifted(recordings.size());
+  utils::ParallelFor(
+      0, static_cast<int>(recordings.size()), num_threads, [&](const int r) {
+        const CameraTelemetryData& telemetry = *recordings[r].telemetry_data;
+        const double shift_s =
+            recordings[r].time_offset_imu_to_cam + shifts_s[r];
+        for (size_t i = 0; i < telemetry.accelerometer.size(); ++i) {
+          const double t = telemetry.accelerometer[i].timestamp_s() + shift_s;
+          if (t < recording_segments_s[r].first ||
+              t > recording_segments_s[r].second) {
+            continue;
+          }
+          shifted[r].accelerometer.emplace_back(
+              t, telemetry.accelerometer[i].data());
+          shifted[r].gyroscope.emplace_back(t, telemetry.gyroscope[i].data());
+        }
+      });
+  merged_telemetry = CameraTelemetryData();
+  for (const CameraTelemetryData& telemetry : shifted) {
+    merged_telemetry.accelerometer.insert(merged_telemetry.accelerometer.end(),
+                                          telemetry.accelerometer.begin(),
+                                          telemetry.accelerometer.end());
+    merged_telemetry.gyroscope.insert(merged_telemetry.gyroscope.end(),
+                                      telemetry.gyroscope.begin(),
+                                      telemetry.gyroscope.end());
+  }
+
+  // the board is the same in every recording, so the tracks are shared
+  for (size_t r = 0; r < recordings.size(); ++r) {
+    CopyCalibrationViews(*recordings[r].vision_dataset,
+                         theia::kInvalidCameraIntrinsicsGroupId,
+                         shifts_s[r],
+                         merged_dataset);
+  }
+  return true;
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::BatchInitSpline(
     const theia::Reconstruction& vision_dataset,
     const Sophus::SE3<double>& T_i_c_init,
     const SplineWeightingData& spline_weight_data,
@@ -27,24 +209,51 @@ void ImuCameraCalibrator::BatchInitSpline(
     const double initial_line_delay,
     const ThreeAxisSensorCalibParams<double> accl_intrinsics,
     const ThreeAxisSensorCalibParams<double> gyro_intrinsics) {
-  image_data_ = vision_dataset;
+  BatchInitSpline(std::make_shared<const theia::Reconstruction>(vision_dataset),
+                  T_i_c_init,
+                  spline_weight_data,
+                  time_offset_imu_to_cam,
+                  telemetry_data,
+                  initial_line_delay,
+                  accl_intrinsics,
+                  gyro_intrinsics);
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::BatchInitSpline(
+    std::shared_ptr<const theia::Reconstruction> vision_dataset,
+    const Sophus::SE3<double>& T_i_c_init,
+    const SplineWeightingData& spline_weight_data,
+    const double time_offset_imu_to_cam,
+    const OpenICC::CameraTelemetryData& telemetry_data,
+    const double initial_line_delay,
+    const ThreeAxisSensorCalibParams<double> accl_intrinsics,
+    const ThreeAxisSensorCalibParams<double> gyro_intrinsics) {
+  OPENICC_TRACE_ZONE("spline_batch_init");
+  image_data_ = std::move(vision_dataset);
   spline_weight_data_ = spline_weight_data;
-  T_i_c_init_ = T_i_c_init;
+  T_i_c_init_ = warm_start_ ? warm_start_->T_i_c : T_i_c_init;
 
-  trajectory_.SetT_i_c(T_i_c_init);
+  trajectory_.SetT_i_c(T_i_c_init_);
   trajectory_.SetIMUIntrinsics(accl_intrinsics, gyro_intrinsics);
 
   // set camera timestamps and sort them
-  const auto& view_ids = vision_dataset.ViewIds();
+  const auto& view_ids = image_data_->ViewIds();
   for (const theia::ViewId view_id : view_ids) {
-    cam_timestamps_.push_back(
-        vision_dataset.View(view_id)->GetTimestamp());
+    cam_timestamps_.push_back(image_data_->View(view_id)->GetTimestamp());
   }
   std::sort(cam_timestamps_.begin(), cam_timestamps_.end());
 
   // initialize readout with 1/fps * 1/image_rows
-  inital_cam_line_delay_s_ = initial_line_delay;
+  inital_cam_line_delay_s_ =
+      warm_start_ ? warm_start_->line_delay_s : initial_line_delay;
   trajectory_.SetCameraLineDelay(inital_cam_line_delay_s_);
+  CHECK_EQ(rig_T_i_c_init_.size(), rig_line_delays_s_.size());
+  trajectory_.SetNumRigCameras(1 + rig_T_i_c_init_.size());
+  for (size_t c = 0; c < rig_T_i_c_init_.size(); ++c) {
+    trajectory_.SetRigCameraT_i_c(c + 1, rig_T_i_c_init_[c]);
+    trajectory_.SetRigCameraLineDelay(c + 1, rig_line_delays_s_[c]);
+  }
 
   std::cout << "Initialized Line Delay to: "
             << inital_cam_line_delay_s_ * S_TO_US << "ns\n";
@@ -66,8 +275,8 @@ void ImuCameraCalibrator::BatchInitSpline(
             << " knots spacing r3/so3: " << spline_weight_data_.dt_r3 << "/"
             << spline_weight_data_.dt_so3;
 
-  nr_knots_so3_ = (end_t_ns - start_t_ns) / dt_so3_ns + SPLINE_N;
-  nr_knots_r3_ = (end_t_ns - start_t_ns) / dt_r3_ns + SPLINE_N;
+  nr_knots_so3_ = (end_t_ns - start_t_ns) / dt_so3_ns + _N;
+  nr_knots_r3_ = (end_t_ns - start_t_ns) / dt_r3_ns + _N;
 
   std::cout << "Initializing " << nr_knots_so3_ << " SO3 knots.\n";
   std::cout << "Initializing " << nr_knots_r3_ << " R3 knots.\n";
@@ -75,63 +284,376 @@ void ImuCameraCalibrator::BatchInitSpline(
   // after initing times, let's now initialize the knots using the known
   // camera poses (T_w_c)
   trajectory_.SetImageData(image_data_);
-  trajectory_.BatchInitSO3R3VisPoses();
-  // TODO make the bias spline dt configurable
+  trajectory_.BatchInitSO3R3VisPoses(fit_initial_knots_);
+  double bias_dt_accl_s = bias_dt_accl_s_;
+  double bias_dt_gyro_s = bias_dt_gyro_s_;
+  if (adaptive_bias_dt_) {
+    const double duration_s = (end_t_ns - start_t_ns) * NS_TO_S;
+    const double max_dt_s = std::max(kMinBiasKnotSpacingS, duration_s);
+    bias_dt_accl_s =
+        std::min(std::max(bias_dt_accl_s, kMinBiasKnotSpacingS), max_dt_s);
+    bias_dt_gyro_s =
+        std::min(std::max(bias_dt_gyro_s, kMinBiasKnotSpacingS), max_dt_s);
+  }
+  LOG(INFO) << "Bias spline knot spacing accl/gyro: " << bias_dt_accl_s << "/"
+            << bias_dt_gyro_s << "s";
   trajectory_.InitBiasSplines(accl_intrinsics.GetBiasVector(),
                               gyro_intrinsics.GetBiasVector(),
-                              10 * 1e9,
-                              10 * 1e9,
+                              bias_dt_accl_s * S_TO_NS,
+                              bias_dt_gyro_s * S_TO_NS,
                               1.0,
                               1e-1);
+  if (warm_start_) {
+    const bool knots_restored = trajectory_.InitFromSnapshot(*warm_start_);
+    gravity_init_ = warm_start_->gravity;
+    gravity_initialized_ = true;
+    LOG(INFO) << "Warm started spline from snapshot, "
+              << (knots_restored ? "knots taken over"
+                                 : "knots initialized from camera poses");
+  }
 
-  LOG(INFO) << "Adding Vision measurements to spline";
+  imu_timestamps_s_.clear();
+  gyro_measurements_.clear();
+  accl_measurements_.clear();
+  AppendImuSamples(telemetry_data, time_offset_imu_to_cam, tend_s_);
 
-  // rolling shutter camera
-  if (inital_cam_line_delay_s_ != 0.0) {
-    for (const auto& vid : vision_dataset.ViewIds()) {
-      trajectory_.AddRSCameraMeasurement(vision_dataset.View(vid), 0.0);
+  segments_.clear();
+  if (select_excited_segments_) {
+    segments_ = utils::SelectExcitedSegments(imu_timestamps_s_,
+                                             gyro_measurements_,
+                                             accl_measurements_,
+                                             excitation_options_);
+    double segments_s = 0.0;
+    for (const auto& segment : segments_) {
+      segments_s += segment.second - segment.first;
     }
-  } else {
-    for (const auto& vid : vision_dataset.ViewIds()) {
-      trajectory_.AddGSCameraMeasurement(vision_dataset.View(vid), 0.0);
+    if (segments_.empty()) {
+      LOG(WARNING) << "No excited IMU segment found, using the whole spline.";
+    } else {
+      LOG(INFO) << "Using " << segments_.size() << " excited segments with "
+                << segments_s << "s of " << tend_s_ - t0_s_ << "s.";
     }
   }
+  if (!recording_segments_.empty()) {
+    if (segments_.empty()) {
+      segments_ = recording_segments_;
+    } else {
+      // excited segments must not bridge the gap between two recordings
+      std::vector<std::pair<double, double>> clipped;
+      for (const auto& segment : segments_) {
+        for (const auto& recording : recording_segments_) {
+          const double start = std::max(segment.first, recording.first);
+          const double end = std::min(segment.second, recording.second);
+          if (start < end) {
+            clipped.emplace_back(start, end);
+          }
+        }
+      }
+      segments_ = clipped;
+    }
+    InitializeRecordingGravity();
+  }
+
+  LOG(INFO) << "Adding Vision measurements to spline";
+  AddVisionMeasurements(t0_s_, tend_s_);
   LOG(INFO) << "Added all Vision measurements to the spline estimator";
 
   LOG(INFO) << "Adding IMU measurements to spline";
+  AddImuMeasurements(t0_s_, tend_s_);
+  LOG(INFO) << "Added all IMU measurements to the spline estimator";
+
+  InitializeGravity(telemetry_data);
+  for (size_t r = 1; r < recording_segments_.size(); ++r) {
+    Eigen::Vector3d gravity = gravity_init_;
+    if (EstimateGravityFromImuSamples(recording_segments_[r].first,
+                                      recording_segments_[r].second,
+                                      gravity)) {
+      LOG(INFO) << "Recording " << r << " g_a initialized with "
+                << gravity.transpose();
+    }
+    trajectory_.SetSegmentGravity(r, gravity);
+  }
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::AppendImuSamples(
+    const OpenICC::CameraTelemetryData& telemetry_data,
+    const double time_offset_imu_to_cam,
+    const double t_end_s) {
+  // samples before the last stored one were added already
+  const double t_begin_s =
+      imu_timestamps_s_.empty() ? t0_s_ : imu_timestamps_s_.back();
+  std::vector<std::pair<double, size_t>> imu_samples;
+  imu_samples.reserve(telemetry_data.accelerometer.size());
   for (size_t i = 0; i < telemetry_data.accelerometer.size(); ++i) {
     const double t =
         telemetry_data.accelerometer[i].timestamp_s() + time_offset_imu_to_cam;
-    if (t < t0_s_ || t >= tend_s_) continue;
-    gyro_measurements_[t] = telemetry_data.gyroscope[i].data();
-    accl_measurements_[t] = telemetry_data.accelerometer[i].data();
-    if (!trajectory_.AddAccelerometerMeasurement(
-            telemetry_data.accelerometer[i].data(),
-            t * S_TO_NS,
-            1. / spline_weight_data.std_r3)) {
-      std::cerr << "Failed to add accelerometer measurement at time: " << t
-                << "\n";
-    }
-    if (!trajectory_.AddGyroscopeMeasurement(telemetry_data.gyroscope[i].data(),
-                                             t * S_TO_NS,
-                                             1. / spline_weight_data.std_so3)) {
-      std::cerr << "Failed to add gyroscope measurement at time: " << t << "\n";
+    if (t < t_begin_s || t >= t_end_s) continue;
+    imu_samples.emplace_back(t, i);
+  }
+  // telemetry is usually ordered already. Keep the last sample for duplicate
+  // timestamps, as the map based storage did before.
+  std::stable_sort(
+      imu_samples.begin(),
+      imu_samples.end(),
+      [](const std::pair<double, size_t>& a,
+         const std::pair<double, size_t>& b) { return a.first < b.first; });
+  const size_t nr_samples = imu_timestamps_s_.size() + imu_samples.size();
+  imu_timestamps_s_.reserve(nr_samples);
+  gyro_measurements_.reserve(nr_samples);
+  accl_measurements_.reserve(nr_samples);
+  for (const auto& sample : imu_samples) {
+    const Eigen::Vector3d gyro = telemetry_data.gyroscope[sample.second].data();
+    const Eigen::Vector3d accl =
+        telemetry_data.accelerometer[sample.second].data();
+    const bool duplicate =
+        !imu_timestamps_s_.empty() && imu_timestamps_s_.back() == sample.first;
+    if (duplicate) {
+      gyro_measurements_.back() = gyro;
+      accl_measurements_.back() = accl;
+      continue;
     }
+    imu_timestamps_s_.push_back(sample.first);
+    gyro_measurements_.push_back(gyro);
+    accl_measurements_.push_back(accl);
   }
-  LOG(INFO) << "Added all IMU measurements to the spline estimator";
+}
 
-  InitializeGravity(telemetry_data);
+template <int _N>
+void ImuCameraCalibratorT<_N>::InitOnlineSpline(
+    std::shared_ptr<const theia::Reconstruction> vision_dataset,
+    const Sophus::SE3<double>& T_i_c_init,
+    const SplineWeightingData& spline_weight_data,
+    const double t0_s,
+    const double initial_line_delay,
+    const ThreeAxisSensorCalibParams<double> accl_intrinsics,
+    const ThreeAxisSensorCalibParams<double> gyro_intrinsics) {
+  OPENICC_TRACE_ZONE("spline_online_init");
+  ClearSpline();
+  image_data_ = std::move(vision_dataset);
+  spline_weight_data_ = spline_weight_data;
+  T_i_c_init_ = T_i_c_init;
+
+  trajectory_.SetT_i_c(T_i_c_init_);
+  trajectory_.SetIMUIntrinsics(accl_intrinsics, gyro_intrinsics);
+  inital_cam_line_delay_s_ = initial_line_delay;
+  trajectory_.SetCameraLineDelay(inital_cam_line_delay_s_);
+
+  segments_.clear();
+  // the spline starts without any duration and grows with OptimizeOnline
+  t0_s_ = t0_s;
+  tend_s_ = t0_s;
+  const int64_t start_t_ns = t0_s_ * S_TO_NS;
+  const int64_t dt_so3_ns = spline_weight_data_.dt_so3 * S_TO_NS;
+  const int64_t dt_r3_ns = spline_weight_data_.dt_r3 * S_TO_NS;
+  trajectory_.SetTimes(dt_so3_ns, dt_r3_ns, start_t_ns, start_t_ns);
+  trajectory_.SetImageData(image_data_);
+
+  // the duration is unknown, so the bias spacing is not adapted to it
+  const double bias_dt_accl_s =
+      std::max(bias_dt_accl_s_, kMinBiasKnotSpacingS);
+  const double bias_dt_gyro_s =
+      std::max(bias_dt_gyro_s_, kMinBiasKnotSpacingS);
+  trajectory_.InitBiasSplines(accl_intrinsics.GetBiasVector(),
+                              gyro_intrinsics.GetBiasVector(),
+                              bias_dt_accl_s * S_TO_NS,
+                              bias_dt_gyro_s * S_TO_NS,
+                              1.0,
+                              1e-1);
+  trajectory_.ExtendKnots(start_t_ns);
+  LOG(INFO) << "Online spline initialized at " << t0_s_
+            << "s, knots spacing r3/so3: " << spline_weight_data_.dt_r3 << "/"
+            << spline_weight_data_.dt_so3;
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::AddImuSamples(
+    const OpenICC::CameraTelemetryData& telemetry_data,
+    const double time_offset_imu_to_cam,
+    const double t_end_s) {
+  AppendImuSamples(telemetry_data, time_offset_imu_to_cam, t_end_s);
+}
+
+template <int _N>
+double ImuCameraCalibratorT<_N>::OptimizeOnline(
+    const double t_now_s,
+    const double lag_s,
+    const int iterations,
+    const int optim_flags,
+    const SplineSolverOptions& solver_options) {
+  OPENICC_TRACE_ZONE("spline_optimize_online");
+  CHECK_GT(lag_s, 0.0) << "The online window needs a positive lag";
+  tend_s_ = std::max(tend_s_, t_now_s);
+
+  cam_timestamps_.clear();
+  for (const theia::ViewId view_id : image_data_->ViewIds()) {
+    const double t = image_data_->View(view_id)->GetTimestamp();
+    if (t >= t0_s_ && t <= tend_s_) {
+      cam_timestamps_.push_back(t);
+    }
+  }
+  std::sort(cam_timestamps_.begin(), cam_timestamps_.end());
+  if (cam_timestamps_.empty()) {
+    return 0.0;
+  }
+
+  // same margin as BatchInitSpline for the rolling shutter readout
+  trajectory_.ResetProblem();
+  trajectory_.ExtendKnots((tend_s_ + 0.01) * S_TO_NS);
+  if (!gravity_initialized_) {
+    InitializeGravityFromImuSamples();
+  }
+
+  // knots before the window keep their last estimate and the measurements
+  // that only constrain them are dropped
+  const double t_start_s = std::max(t0_s_, tend_s_ - lag_s);
+  AddVisionMeasurements(t_start_s, tend_s_);
+  AddImuMeasurements(t_start_s, tend_s_);
+  const int64_t start_ns = t_start_s <= t0_s_
+                               ? std::numeric_limits<int64_t>::min()
+                               : t_start_s * S_TO_NS;
+  trajectory_.Optimize(iterations,
+                       optim_flags,
+                       start_ns,
+                       std::numeric_limits<int64_t>::max(),
+                       solver_options);
+  return trajectory_.GetMeanReprojectionError(&reprojection_errors_);
 }
 
-void ImuCameraCalibrator::SetKnownGravityDir(const Eigen::Vector3d& gravity) {
-  trajectory_.SetGravity(gravity);
+template <int _N>
+bool ImuCameraCalibratorT<_N>::InSelectedSegment(const double t_s) const {
+  if (segments_.empty()) {
+    return true;
+  }
+  // first segment starting after t_s
+  const auto next = std::upper_bound(
+      segments_.begin(),
+      segments_.end(),
+      t_s,
+      [](const double t, const std::pair<double, double>& segment) {
+        return t < segment.first;
+      });
+  return next != segments_.begin() && t_s <= std::prev(next)->second;
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::AddVisionMeasurements(const double t_start_s,
+                                                     const double t_end_s) {
+  utils::ScopedTimer timer("spline_vision_residuals");
+  OPENICC_TRACE_ZONE("spline_vision_residuals");
+  for (const auto& vid : image_data_->ViewIds()) {
+    const theia::View* view = image_data_->View(vid);
+    const double t = view->GetTimestamp();
+    if (t < t_start_s || t > t_end_s || !InSelectedSegment(t)) continue;
+    timer.AddItems(view->NumFeatures());
+    const size_t camera = trajectory_.RigCameraOf(vid);
+    // rolling shutter camera
+    if (trajectory_.GetRigCameraLineDelay(camera) != 0.0) {
+      trajectory_.AddRSCameraMeasurement(view, 0.0, camera);
+    } else {
+      trajectory_.AddGSCameraMeasurement(view, 0.0, camera);
+    }
+  }
 }
 
-void ImuCameraCalibrator::InitializeGravity(
+template <int _N>
+void ImuCameraCalibratorT<_N>::AddImuMeasurements(const double t_start_s,
+                                                  const double t_end_s,
+                                                  const bool gyro_only) {
+  // consecutive samples are averaged into one residual (imu_decimation_ = 1
+  // adds every sample). A group is flushed when it is full or when the next
+  // sample falls into another SO3 knot span. The groups are collected first,
+  // the residuals are then built in parallel by the spline estimator.
+  utils::ScopedTimer timer("spline_imu_residuals");
+  OPENICC_TRACE_ZONE("spline_imu_residuals");
+  const int64_t start_t_ns = t0_s_ * S_TO_NS;
+  const int64_t dt_so3_ns = spline_weight_data_.dt_so3 * S_TO_NS;
+  const size_t first = std::lower_bound(imu_timestamps_s_.begin(),
+                                        imu_timestamps_s_.end(),
+                                        t_start_s) -
+                       imu_timestamps_s_.begin();
+  const size_t last = std::lower_bound(imu_timestamps_s_.begin(),
+                                       imu_timestamps_s_.end(),
+                                       t_end_s) -
+                      imu_timestamps_s_.begin();
+
+  const size_t nr_imu_samples = last > first ? last - first : 0;
+  std::vector<int64_t> times_ns;
+  vec3_vector accl_means, gyro_means;
+  std::vector<double> weights_se3, weights_so3;
+  times_ns.reserve(nr_imu_samples);
+  accl_means.reserve(nr_imu_samples);
+  gyro_means.reserve(nr_imu_samples);
+  weights_se3.reserve(nr_imu_samples);
+  weights_so3.reserve(nr_imu_samples);
+
+  Eigen::Vector3d accl_sum(0.0, 0.0, 0.0), gyro_sum(0.0, 0.0, 0.0);
+  double t_sum = 0.0;
+  int nr_in_group = 0;
+  int64_t group_span = -1;
+  auto add_imu_group = [&]() {
+    if (nr_in_group == 0) return;
+    const double weight_scale = std::sqrt(static_cast<double>(nr_in_group));
+    times_ns.push_back(t_sum / nr_in_group * S_TO_NS);
+    accl_means.push_back(accl_sum / nr_in_group);
+    gyro_means.push_back(gyro_sum / nr_in_group);
+    weights_se3.push_back(weight_scale / spline_weight_data_.std_r3);
+    weights_so3.push_back(weight_scale / spline_weight_data_.std_so3);
+    accl_sum.setZero();
+    gyro_sum.setZero();
+    t_sum = 0.0;
+    nr_in_group = 0;
+  };
+
+  for (size_t i = first; i < last; ++i) {
+    const double t = imu_timestamps_s_[i];
+    if (!InSelectedSegment(t)) {
+      add_imu_group();
+      continue;
+    }
+    const int64_t span = (t * S_TO_NS - start_t_ns) / dt_so3_ns;
+    if (nr_in_group == imu_decimation_ || span != group_span) {
+      add_imu_group();
+      group_span = span;
+    }
+    accl_sum += accl_measurements_[i];
+    gyro_sum += gyro_measurements_[i];
+    t_sum += t;
+    ++nr_in_group;
+  }
+  add_imu_group();
+
+  const size_t nr_imu_residuals =
+      gyro_only ? trajectory_.AddGyroscopeMeasurements(
+                      times_ns, gyro_means, weights_so3, num_threads_)
+                : trajectory_.AddImuMeasurements(times_ns,
+                                                 accl_means,
+                                                 gyro_means,
+                                                 weights_se3,
+                                                 weights_so3,
+                                                 num_threads_);
+  LOG(INFO) << "Added " << nr_imu_residuals << " IMU residuals for "
+            << nr_imu_samples << " IMU samples (decimation " << imu_decimation_
+            << ")";
+  timer.AddItems(nr_imu_residuals);
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::SetKnownGravityDir(
+    const Eigen::Vector3d& gravity) {
+  gravity_init_ = gravity;
+  gravity_initialized_ = true;
+  for (size_t s = 0; s < trajectory_.NumGravitySegments(); ++s) {
+    trajectory_.SetSegmentGravity(s, gravity);
+  }
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::InitializeGravity(
     const OpenICC::CameraTelemetryData& telemetry_data) {
   for (size_t j = 0; j < cam_timestamps_.size(); ++j) {
     const theia::View* v =
-        image_data_.View(image_data_.ViewIdFromTimestamp(cam_timestamps_[j]));
+        image_data_->View(image_data_->ViewIdFromTimestamp(cam_timestamps_[j]));
     if (!v) {
       continue;
     }
@@ -160,14 +682,187 @@ void ImuCameraCalibrator::InitializeGravity(
   trajectory_.SetGravity(gravity_init_);
 }
 
-double ImuCameraCalibrator::Optimize(const int iterations,
-                                     const int optim_flags) {
+template <int _N>
+bool ImuCameraCalibratorT<_N>::EstimateGravityFromImuSamples(
+    const double t_start_s,
+    const double t_end_s,
+    Eigen::Vector3d& gravity) const {
+  for (const double t_cam : cam_timestamps_) {
+    if (t_cam < t_start_s || t_cam > t_end_s) {
+      continue;
+    }
+    // T_i_c_init_ is the extrinsic of the first rig camera
+    const theia::ViewId view_id = image_data_->ViewIdFromTimestamp(t_cam);
+    const theia::View* v = image_data_->View(view_id);
+    const auto it = std::lower_bound(
+        imu_timestamps_s_.begin(), imu_timestamps_s_.end(), t_cam);
+    if (!v || trajectory_.RigCameraOf(view_id) != 0 ||
+        it == imu_timestamps_s_.end() ||
+        std::abs(*it - t_cam) >= 1. / 30.) {
+      continue;
+    }
+    const auto q_w_c = Eigen::Quaterniond(
+        v->Camera().GetOrientationAsRotationMatrix().transpose());
+    const auto p_w_c = v->Camera().GetPosition();
+    const Sophus::SE3d T_a_i =
+        Sophus::SE3d(q_w_c, p_w_c) * T_i_c_init_.inverse();
+    gravity = T_a_i.so3() * accl_measurements_[it - imu_timestamps_s_.begin()];
+    return true;
+  }
+  return false;
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::InitializeGravityFromImuSamples() {
+  if (!EstimateGravityFromImuSamples(std::numeric_limits<double>::lowest(),
+                                     std::numeric_limits<double>::max(),
+                                     gravity_init_)) {
+    return;
+  }
+  gravity_initialized_ = true;
+  std::cout << "g_a initialized with " << gravity_init_.transpose()
+            << std::endl;
+  trajectory_.SetGravity(gravity_init_);
+}
+
+template <int _N>
+void ImuCameraCalibratorT<_N>::InitializeRecordingGravity() {
+  const double max_dt_s =
+      std::max(spline_weight_data_.dt_so3, spline_weight_data_.dt_r3);
+  std::vector<int64_t> segment_starts_ns;
+  for (size_t r = 1; r < recording_segments_.size(); ++r) {
+    const double gap_s =
+        recording_segments_[r].first - recording_segments_[r - 1].second;
+    LOG_IF(WARNING, gap_s <= _N * max_dt_s)
+        << "Recordings " << r - 1 << " and " << r << " are only " << gap_s
+        << "s apart, residuals of both share knots.";
+    segment_starts_ns.push_back(recording_segments_[r].first * S_TO_NS);
+  }
+  trajectory_.SetGravitySegments(segment_starts_ns);
+  LOG(INFO) << "Calibrating " << recording_segments_.size()
+            << " recordings jointly.";
+}
+
+template <int _N>
+double ImuCameraCalibratorT<_N>::Optimize(
+    const int iterations,
+    const int optim_flags,
+    const SplineSolverOptions& solver_options) {
+  OPENICC_TRACE_ZONE("spline_optimize");
+  const SplineProblemMemoryReport memory = trajectory_.GetProblemMemoryReport();
+  LOG(INFO) << "Spline problem: " << memory.num_parameter_blocks
+            << " parameter blocks (" << memory.num_parameters
+            << " parameters), " << memory.num_residual_blocks
+            << " residual blocks (" << memory.num_residuals
+            << " residuals), " << memory.num_shared_objects
+            << " shared loss functions and parameterizations instead of "
+            << memory.objects_without_sharing << ", peak RSS "
+            << memory.peak_rss_mb << "MB.";
   ceres::Solver::Summary summary =
-      trajectory_.Optimize(iterations, optim_flags);
-  return trajectory_.GetMeanReprojectionError();
+      trajectory_.Optimize(iterations, optim_flags, solver_options);
+  return trajectory_.GetMeanReprojectionError(&reprojection_errors_);
+}
+
+template <int _N>
+double ImuCameraCalibratorT<_N>::OptimizeWindowed(
+    const int iterations,
+    const int optim_flags,
+    const double window_s,
+    const double overlap_s,
+    const SplineSolverOptions& solver_options) {
+  OPENICC_TRACE_ZONE("spline_optimize_windowed");
+  CHECK_GT(window_s, overlap_s) << "Window has to be larger than the overlap";
+  const double step_s = window_s - overlap_s;
+  for (double t_start_s = t0_s_; t_start_s < tend_s_; t_start_s += step_s) {
+    const double t_end_s = std::min(t_start_s + window_s, tend_s_);
+    const bool first_window = t_start_s == t0_s_;
+    const bool last_window = t_end_s >= tend_s_;
+    LOG(INFO) << "Optimizing spline window [" << t_start_s << ", " << t_end_s
+              << "]";
+
+    trajectory_.ResetProblem();
+    AddVisionMeasurements(t_start_s, t_end_s);
+    AddImuMeasurements(t_start_s, t_end_s);
+
+    // knots reaching over the window start were estimated in the previous
+    // window and are kept fixed. Knots reaching over the window end are fixed
+    // to their current value and estimated in the next window.
+    const int64_t start_ns = first_window ? std::numeric_limits<int64_t>::min()
+                                          : t_start_s * S_TO_NS;
+    const int64_t end_ns =
+        last_window ? std::numeric_limits<int64_t>::max() : t_end_s * S_TO_NS;
+    trajectory_.Optimize(
+        iterations, optim_flags, start_ns, end_ns, solver_options);
+    if (last_window) break;
+  }
+  return trajectory_.GetMeanReprojectionError(&reprojection_errors_);
+}
+
+template <int _N>
+double ImuCameraCalibratorT<_N>::OptimizeCoarseLevels(
+    const std::vector<int>& coarse_factors,
+    const int iterations,
+    const int optim_flags,
+    const SplineSolverOptions& solver_options) {
+  OPENICC_TRACE_ZONE("spline_optimize_coarse");
+  const int64_t dt_so3_ns = spline_weight_data_.dt_so3 * S_TO_NS;
+  const int64_t dt_r3_ns = spline_weight_data_.dt_r3 * S_TO_NS;
+  // the IMU residuals are grouped by target SO3 knot span, which never
+  // crosses a coarse span for integer factors
+  auto resample = [&](const int factor) {
+    trajectory_.ResampleKnots(factor * dt_so3_ns, factor * dt_r3_ns);
+    AddVisionMeasurements(t0_s_, tend_s_);
+    AddImuMeasurements(t0_s_, tend_s_);
+  };
+
+  double reprojection_error =
+      trajectory_.GetMeanReprojectionError(&reprojection_errors_);
+  for (const int factor : coarse_factors) {
+    if (factor <= 1) continue;
+    LOG(INFO) << "Optimizing spline at " << factor << "x knot spacing";
+    resample(factor);
+    reprojection_error = Optimize(iterations, optim_flags, solver_options);
+  }
+  resample(1);
+  return reprojection_error;
+}
+
+template <int _N>
+double ImuCameraCalibratorT<_N>::PreSolveRotation(
+    const int iterations,
+    const int optim_flags,
+    const SplineSolverOptions& solver_options) {
+  OPENICC_TRACE_ZONE("spline_presolve_rotation");
+  trajectory_.ResetProblem();
+  size_t nr_orientations = 0;
+  for (const auto& vid : image_data_->ViewIds()) {
+    const theia::View* view = image_data_->View(vid);
+    if (!InSelectedSegment(view->GetTimestamp())) continue;
+    nr_orientations += trajectory_.AddOrientationMeasurement(
+        view, 1.0 / kPreSolveOrientationStdRad, trajectory_.RigCameraOf(vid));
+  }
+  AddImuMeasurements(t0_s_, tend_s_, true);
+  LOG(INFO) << "Rotation only pre-solve with " << nr_orientations
+            << " view orientations.";
+
+  int rotation_flags = SplineOptimFlags::SPLINE;
+  if (optim_flags &
+      (SplineOptimFlags::IMU_BIASES | SplineOptimFlags::GYR_BIAS)) {
+    rotation_flags |= SplineOptimFlags::GYR_BIAS;
+  }
+  trajectory_.Optimize(iterations, rotation_flags, solver_options);
+  if (!trajectory_.FitR3KnotsToViews()) {
+    LOG(WARNING) << "R3 knot fit failed, keeping the R3 knots.";
+  }
+
+  trajectory_.ResetProblem();
+  AddVisionMeasurements(t0_s_, tend_s_);
+  AddImuMeasurements(t0_s_, tend_s_);
+  return trajectory_.GetMeanReprojectionError(&reprojection_errors_);
 }
 
-void ImuCameraCalibrator::ToTheiaReconDataset(
+template <int _N>
+void ImuCameraCalibratorT<_N>::ToTheiaReconDataset(
     theia::Reconstruction& output_recon) {
   // convert spline to theia output
   for (size_t i = 0; i < cam_timestamps_.size(); ++i) {
@@ -185,13 +880,16 @@ void ImuCameraCalibrator::ToTheiaReconDataset(
   }
 }
 
-void ImuCameraCalibrator::ClearSpline() {
+template <int _N>
+void ImuCameraCalibratorT<_N>::ClearSpline() {
   cam_timestamps_.clear();
+  imu_timestamps_s_.clear();
   gyro_measurements_.clear();
   accl_measurements_.clear();
 }
 
-void ImuCameraCalibrator::GetIMUIntrinsics(
+template <int _N>
+void ImuCameraCalibratorT<_N>::GetIMUIntrinsics(
     ThreeAxisSensorCalibParams<double>& acc_intrinsics,
     ThreeAxisSensorCalibParams<double>& gyr_intrinsics,
     const int64_t time_ns) {
@@ -199,5 +897,9 @@ void ImuCameraCalibrator::GetIMUIntrinsics(
   gyr_intrinsics = trajectory_.GetGyroIntrinsics(time_ns);
 }
 
+template class ImuCameraCalibratorT<4>;
+template class ImuCameraCalibratorT<5>;
+template class ImuCameraCalibratorT<6>;
+
 }  // namespace core
 }  // namespace OpenICC
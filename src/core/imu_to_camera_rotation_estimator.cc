@@ -15,9 +15,13 @@
 
 #include "OpenCameraCalibrator/core/imu_to_camera_rotation_estimator.h"
 
-#include "OpenCameraCalibrator/utils/moving_average.h"
-
 #include <glog/logging.h>
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
 
 #include "OpenCameraCalibrator/utils/utils.h"
 
@@ -35,11 +39,92 @@ namespace core {
 
 constexpr double HUBER_K = 1.345;
 constexpr double HUBER_K2 = HUBER_K * HUBER_K;
+//! maximum time offset searched in seconds
+constexpr double MAX_TIME_OFFSET = 1.0;
+//! half width of the refinement bracket around the correlation peak in samples
+constexpr double REFINEMENT_HALF_WIDTH = 2.0;
+//! rate of the decimated grids of the coarse offset search
+constexpr double COARSE_GRID_RATE_HZ = 50.0;
+//! bracket tolerance of the golden-section search at the full rate in s
+constexpr double OFFSET_TOLERANCE = 1e-4;
+
+namespace {
+
+//! Linear interpolation of a signal on a uniform grid at the fractional index
+//! pos. Samples outside of the grid are set to the nearest boundary value.
+Vector3d InterpolateUniform(const vec3_vector& signal, const double pos) {
+  if (pos <= 0.0) return signal.front();
+  const size_t idx = static_cast<size_t>(pos);
+  if (idx + 1 >= signal.size()) return signal.back();
+  const double fraction = pos - static_cast<double>(idx);
+  return (1.0 - fraction) * signal[idx] + fraction * signal[idx + 1];
+}
+
+//! Single pass means and 3x3 cross covariance sum_i (a_i - a)(b_i - b)^T of
+//! two vector signals. Uses Welford's update, which does not suffer from the
+//! cancellation of sum(a b^T) - n a b^T on long recordings.
+class CrossCovarianceAccumulator {
+ public:
+  void Add(const Vector3d& a, const Vector3d& b) {
+    ++num_samples_;
+    const Vector3d delta_a = a - mean_a_;
+    mean_a_ += delta_a / static_cast<double>(num_samples_);
+    mean_b_ += (b - mean_b_) / static_cast<double>(num_samples_);
+    covariance_.noalias() += delta_a * (b - mean_b_).transpose();
+  }
+
+  const Vector3d& MeanA() const { return mean_a_; }
+  const Vector3d& MeanB() const { return mean_b_; }
+  const Matrix3d& Covariance() const { return covariance_; }
+
+ private:
+  size_t num_samples_ = 0;
+  Vector3d mean_a_ = Vector3d::Zero();
+  Vector3d mean_b_ = Vector3d::Zero();
+  Matrix3d covariance_ = Matrix3d::Zero();
+};
+
+//! Rotation R minimizing sum_i |(b_i - b) - R (a_i - a)|^2 from the cross
+//! covariance of a and b
+Matrix3d RotationFromCrossCovariance(const Matrix3d& covariance) {
+  Eigen::JacobiSVD<Matrix3d> svd(covariance,
+                                 Eigen::ComputeFullU | Eigen::ComputeFullV);
+  Matrix3d C;
+  C.setIdentity();
+  if ((svd.matrixV() * svd.matrixU().transpose()).determinant() < 0.0)
+    C(2, 2) = -1.0;
+  return svd.matrixV() * C * svd.matrixU().transpose();
+}
+
+//! Means of consecutive blocks of factor samples, a uniform grid with
+//! factor times the spacing
+vec3_vector DecimateUniform(const vec3_vector& grid, const size_t factor) {
+  vec3_vector decimated;
+  decimated.reserve(grid.size() / factor);
+  for (size_t i = 0; i + factor <= grid.size(); i += factor) {
+    Vector3d sum = Vector3d::Zero();
+    for (size_t j = i; j < i + factor; ++j) {
+      sum += grid[j];
+    }
+    decimated.push_back(sum / static_cast<double>(factor));
+  }
+  return decimated;
+}
+
+double HuberError(const Vector3d& D) {
+  const double err = D.squaredNorm();
+  if (err > HUBER_K) {
+    return 2.0 * HUBER_K * std::sqrt(err) - HUBER_K2;
+  }
+  return err;
+}
+
+}  // namespace
 
 double ImuToCameraRotationEstimator::SolveClosedForm(
     const vec3_vector& angVis,
     const vec3_vector& angImu,
-    const std::vector<double> timestamps_s,
+    const std::vector<double>& timestamps_s,
     const double td,
     const double dt_imu,
     Matrix3d& Rs,
@@ -53,64 +138,234 @@ double ImuToCameraRotationEstimator::SolveClosedForm(
   OpenICC::utils::InterpolateVector3d(
       time_with_offset, timestamps_s, angVis, interpolated_angVis);
 
-  // compute mean vectors
-  Vector3d mean_vis(0.0, 0.0, 0.0);
-  Vector3d mean_imu(0.0, 0.0, 0.0);
+  CrossCovarianceAccumulator accumulator;
   for (size_t i = 0; i < interpolated_angVis.size(); ++i) {
-    mean_imu += angImu[i];
-    mean_vis += interpolated_angVis[i];
+    accumulator.Add(angImu[i], interpolated_angVis[i]);
   }
-  mean_imu /= static_cast<double>(interpolated_angVis.size());
-  mean_vis /= static_cast<double>(interpolated_angVis.size());
+  Rs = RotationFromCrossCovariance(accumulator.Covariance());
 
-  // centralized
-  MatrixXd P, Q;
-  P.resize(interpolated_angVis.size(), 3);
-  Q.resize(interpolated_angVis.size(), 3);
+  // only estimate bias if it is zero,
+  // otherwise we got it from another estimation procedure
+  Eigen::Vector3d bias_est(0.0, 0.0, 0.0);
+  if (estimate_gyro_bias_) {
+    bias_est = accumulator.MeanB() - Rs * accumulator.MeanA();
+    bias = bias_est;
+  }
 
+  double error = 0.0;
   for (size_t i = 0; i < interpolated_angVis.size(); ++i) {
-    P.row(i) = angImu[i] - mean_imu;
-    Q.row(i) = interpolated_angVis[i] - mean_vis;
+    error += HuberError(interpolated_angVis[i] - (Rs * angImu[i] + bias_est));
   }
-  Eigen::JacobiSVD<MatrixXd> svd(P.transpose() * Q,
-                                 Eigen::ComputeFullU | Eigen::ComputeFullV);
+  return error;
+}
 
-  Matrix3d C;
-  C.setIdentity();
-  if ((svd.matrixV() * svd.matrixU().transpose()).determinant() < 0.0)
-    C(2, 2) = -1.0;
+double ImuToCameraRotationEstimator::SolveClosedFormUniform(
+    const vec3_vector& vis_grid,
+    const vec3_vector& imu_grid,
+    const double grid_dt,
+    const double td,
+    Matrix3d& Rs,
+    Vector3d& bias) const {
+  const double shift = td / grid_dt;
 
-  Rs = svd.matrixV() * C * svd.matrixU().transpose();
+  CrossCovarianceAccumulator accumulator;
+  for (size_t i = 0; i < imu_grid.size(); ++i) {
+    accumulator.Add(imu_grid[i], InterpolateUniform(vis_grid, i - shift));
+  }
+  Rs = RotationFromCrossCovariance(accumulator.Covariance());
 
-  // only estimate bias if it is zero,
-  // otherwise we got it from another estimation procedure
   Eigen::Vector3d bias_est(0.0, 0.0, 0.0);
   if (estimate_gyro_bias_) {
-    bias_est = mean_vis - Rs * mean_imu;
+    bias_est = accumulator.MeanB() - Rs * accumulator.MeanA();
     bias = bias_est;
   }
 
-  // threshold outliers
-  // first get error vector
-  std::vector<double> errors(angVis.size());
-  for (size_t i = 0; i < angVis.size(); ++i) {
-    Vector3d D = interpolated_angVis[i] - (Rs * angImu[i] + bias_est);
-    errors[i] = D.squaredNorm();
-  }
-  // get median error
-  // const double med_error = utils::MedianOfDoubleVec(errors);
   double error = 0.0;
-  for (size_t i = 0; i < angVis.size(); ++i) {
-    const Vector3d D = interpolated_angVis[i] - (Rs * angImu[i] + bias_est);
-    const double err = D.squaredNorm();
-    if (err > HUBER_K) {
-      error += 2.0 * HUBER_K * std::sqrt(err) - HUBER_K2;
+  for (size_t i = 0; i < imu_grid.size(); ++i) {
+    error += HuberError(InterpolateUniform(vis_grid, i - shift) -
+                        (Rs * imu_grid[i] + bias_est));
+  }
+  return error;
+}
+
+double ImuToCameraRotationEstimator::GoldenSectionTimeOffset(
+    const vec3_vector& vis_grid,
+    const vec3_vector& imu_grid,
+    const double grid_dt,
+    double a,
+    double b,
+    const double tolerance,
+    Matrix3d& Rs,
+    Vector3d& bias,
+    double& error,
+    unsigned int& iter) const {
+  const double gRatio = (1.0 + std::sqrt(5.0)) / 2.0;
+
+  double c = b - (b - a) / gRatio;
+  double d = a + (b - a) / gRatio;
+
+  Eigen::Matrix3d Rsc, Rsd;
+  Eigen::Vector3d biasc = bias, biasd = bias;
+  double fc =
+      SolveClosedFormUniform(vis_grid, imu_grid, grid_dt, c, Rsc, biasc);
+  double fd =
+      SolveClosedFormUniform(vis_grid, imu_grid, grid_dt, d, Rsd, biasd);
+  iter = 0;
+  while (std::abs(c - d) > tolerance) {
+    // only one of the two inner points is new in each iteration
+    if (fc < fd) {
+      b = d;
+      d = c;
+      fd = fc;
+      Rsd = Rsc;
+      biasd = biasc;
+      c = b - (b - a) / gRatio;
+      fc = SolveClosedFormUniform(vis_grid, imu_grid, grid_dt, c, Rsc, biasc);
     } else {
-      error += err;
+      a = c;
+      c = d;
+      fc = fd;
+      Rsc = Rsd;
+      biasc = biasd;
+      d = a + (b - a) / gRatio;
+      fd = SolveClosedFormUniform(vis_grid, imu_grid, grid_dt, d, Rsd, biasd);
     }
+    ++iter;
+  }
+  if (fc < fd) {
+    Rs = Rsc;
+    bias = biasc;
+    error = fc;
+  } else {
+    Rs = Rsd;
+    bias = biasd;
+    error = fd;
   }
+  return (b + a) / 2;
+}
 
-  return error;
+double ImuToCameraRotationEstimator::CorrelateTimeOffset(
+    const vec3_vector& vis_grid,
+    const vec3_vector& imu_grid,
+    const double grid_dt,
+    const double max_offset) const {
+  // The magnitude of the angular velocity does not depend on the unknown
+  // rotation, so the two magnitude signals can be aligned beforehand.
+  const int num_samples = static_cast<int>(imu_grid.size());
+  const int max_lag =
+      std::min(num_samples - 1, static_cast<int>(max_offset / grid_dt));
+  const int dft_size = cv::getOptimalDFTSize(num_samples + max_lag);
+  cv::Mat imu_norm = cv::Mat::zeros(1, dft_size, CV_64F);
+  cv::Mat vis_norm = cv::Mat::zeros(1, dft_size, CV_64F);
+  double mean_imu = 0.0, mean_vis = 0.0;
+  for (int i = 0; i < num_samples; ++i) {
+    imu_norm.at<double>(i) = imu_grid[i].norm();
+    vis_norm.at<double>(i) = vis_grid[i].norm();
+    mean_imu += imu_norm.at<double>(i);
+    mean_vis += vis_norm.at<double>(i);
+  }
+  mean_imu /= num_samples;
+  mean_vis /= num_samples;
+  for (int i = 0; i < num_samples; ++i) {
+    imu_norm.at<double>(i) -= mean_imu;
+    vis_norm.at<double>(i) -= mean_vis;
+  }
+
+  // corr[k] = sum_i imu[i] * vis[i - k], negative lags wrap around
+  cv::Mat imu_spectrum, vis_spectrum, corr_spectrum, corr;
+  cv::dft(imu_norm, imu_spectrum);
+  cv::dft(vis_norm, vis_spectrum);
+  cv::mulSpectrums(imu_spectrum, vis_spectrum, corr_spectrum, 0, true);
+  cv::dft(corr_spectrum,
+          corr,
+          cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+
+  int best_lag = 0;
+  double best_corr = -std::numeric_limits<double>::max();
+  for (int lag = -max_lag; lag <= max_lag; ++lag) {
+    const int idx = lag >= 0 ? lag : dft_size + lag;
+    const double overlap = num_samples - std::abs(lag);
+    const double c = corr.at<double>(idx) / overlap;
+    if (c > best_corr) {
+      best_corr = c;
+      best_lag = lag;
+    }
+  }
+  return best_lag * grid_dt;
+}
+
+double ImuToCameraRotationEstimator::SetMeasurementsFromPoseDataset(
+    const theia::Reconstruction& pose_dataset,
+    const CameraTelemetryData& telemetry_data,
+    const Vector3d& gyro_bias) {
+  double delta_t0_cam = 0.0;
+  if (telemetry_data.img_timestamps_s.size() > 0) {
+    // if we have a more accurate image timestamp
+    // in the case of gopro the cori timestamp
+    delta_t0_cam = telemetry_data.img_timestamps_s[0];
+    LOG(INFO) << "It seems there are accurate image timestamps. Using first "
+                 "image timestamp as offset to video timestamps! Offset: "
+              << delta_t0_cam << " s.";
+  }
+
+  imu_angular_vel_.clear();
+  imu_angular_vel_.reserve(telemetry_data.gyroscope.size());
+  for (size_t i = 0; i < telemetry_data.gyroscope.size(); ++i) {
+    imu_angular_vel_.PushBack(telemetry_data.gyroscope[i].timestamp_s(),
+                              telemetry_data.gyroscope[i].data() - gyro_bias);
+  }
+  imu_angular_vel_.Sort();
+
+  // get mean hz imu
+  double imu_dt_s = 0.0;
+  for (size_t i = 1; i < telemetry_data.gyroscope.size(); ++i) {
+    imu_dt_s += telemetry_data.gyroscope[i].timestamp_s() -
+                telemetry_data.gyroscope[i - 1].timestamp_s();
+  }
+  imu_dt_s /= static_cast<double>(telemetry_data.gyroscope.size() - 1);
+  LOG(INFO) << "Mean IMU data rate: " << 1. / imu_dt_s << "Hz";
+
+  quat_series visual_rotations;
+  visual_rotations.reserve(pose_dataset.NumViews());
+  for (const theia::ViewId view_id : pose_dataset.ViewIds()) {
+    const theia::View* view = pose_dataset.View(view_id);
+    const double timestamp_s = view->GetTimestamp() + delta_t0_cam;
+    // cam to world trafo, so transposed rotation matrix
+    visual_rotations.PushBack(
+        timestamp_s,
+        Quaterniond(view->Camera().GetOrientationAsRotationMatrix()));
+  }
+  visual_rotations.Sort();
+
+  // get mean hz camera
+  std::vector<double> cams_dt_s;
+  cams_dt_s.reserve(visual_rotations.size());
+  for (size_t i = 1; i < visual_rotations.size(); ++i) {
+    cams_dt_s.push_back(visual_rotations.Time(i) -
+                        visual_rotations.Time(i - 1));
+  }
+  // we take the median as some images might not have been estimated
+  const double cam_dt_s = utils::MedianOfDoubleVec(cams_dt_s);
+
+  std::vector<double> tVis_all_frames;
+  for (double t = visual_rotations.FrontTime(); t < visual_rotations.BackTime();
+       t += cam_dt_s) {
+    tVis_all_frames.push_back(t);
+  }
+  LOG(INFO) << "Interpolating visual quaternions to IMU rate.";
+  // interpolate visual rotations as some views might be missing
+  quat_vector visual_rotations_interpolated;
+  utils::InterpolateQuaternions(visual_rotations.Times(),
+                                tVis_all_frames,
+                                visual_rotations.Values(),
+                                visual_rotations_interpolated);
+  visual_rotations_.clear();
+  visual_rotations_.reserve(visual_rotations_interpolated.size());
+  for (size_t i = 0; i < visual_rotations_interpolated.size(); ++i) {
+    visual_rotations_.PushBack(tVis_all_frames[i],
+                               visual_rotations_interpolated[i]);
+  }
+  return imu_dt_s;
 }
 
 bool ImuToCameraRotationEstimator::EstimateCameraImuRotation(
@@ -121,145 +376,128 @@ bool ImuToCameraRotationEstimator::EstimateCameraImuRotation(
     vec3_vector& smoothed_ang_imu,
     vec3_vector& smoothed_vis_vel) {
   // find start and end points of camera and imu
-  const double start_time_cam = visual_rotations_.begin()->first;
-  const double end_time_cam = visual_rotations_.rbegin()->first;
-  const double start_time_imu = imu_angular_vel_.begin()->first;
-  const double end_time_imu = imu_angular_vel_.rbegin()->first;
+  const double start_time_cam = visual_rotations_.FrontTime();
+  const double end_time_cam = visual_rotations_.BackTime();
+  const double start_time_imu = imu_angular_vel_.FrontTime();
+  const double end_time_imu = imu_angular_vel_.BackTime();
 
   double t0 =
       (start_time_cam >= start_time_imu) ? start_time_cam : start_time_imu;
   double tend = (end_time_cam >= end_time_imu) ? end_time_cam : end_time_imu;
 
-  // create zero-based maps
-  quat_map visual_rotations_clamped;
-  vec3_map imu_angular_vel_clamped;
-
-  for (auto const& imu_rot : imu_angular_vel_) {
-    if (imu_rot.first >= t0 && imu_rot.first <= tend) {
-      imu_angular_vel_clamped[imu_rot.first - t0] = imu_rot.second;
-    }
-  }
-  vec3_vector angImu;
-  for (const auto& imu : imu_angular_vel_clamped) {
-    angImu.push_back(imu.second);
-  }
-
-  // interpolate visual rotations
-  for (auto const& v_rot : visual_rotations_) {
-    if (v_rot.first >= t0 && v_rot.first <= tend) {
-      visual_rotations_clamped[v_rot.first - t0] = v_rot.second;
-    }
-  }
-
-  // get vectors of clamped imu angular velocities
+  // zero-based imu angular velocities and visual rotations in [t0, tend]
   std::vector<double> tIMU;
-  for (auto const& imu : imu_angular_vel_clamped) {
-    tIMU.push_back(imu.first);
+  vec3_vector angImu;
+  for (size_t i = imu_angular_vel_.LowerBound(t0);
+       i < imu_angular_vel_.size() && imu_angular_vel_.Time(i) <= tend;
+       ++i) {
+    tIMU.push_back(imu_angular_vel_.Time(i) - t0);
+    angImu.push_back(imu_angular_vel_.Value(i));
   }
 
   std::vector<double> tVis;
   quat_vector qtVis;
-
-  for (auto const& vis : visual_rotations_clamped) {
-    tVis.push_back(vis.first);
-    qtVis.push_back(vis.second);
+  for (size_t i = visual_rotations_.LowerBound(t0);
+       i < visual_rotations_.size() && visual_rotations_.Time(i) <= tend;
+       ++i) {
+    tVis.push_back(visual_rotations_.Time(i) - t0);
+    qtVis.push_back(visual_rotations_.Value(i));
   }
 
   quat_vector qtVis_interp;
   OpenICC::utils::InterpolateQuaternions(tVis, tIMU, qtVis, qtVis_interp);
 
-  // compute angular velocities
-  quat_vector qtDiffs;
-  vec3_vector angVis;
-  for (size_t i = 1; i < qtVis_interp.size(); ++i) {
-    Quaterniond q;
-    q.w() = qtVis_interp[i].w() - qtVis_interp[i - 1].w();
-    q.x() = qtVis_interp[i].x() - qtVis_interp[i - 1].x();
-    q.y() = qtVis_interp[i].y() - qtVis_interp[i - 1].y();
-    q.z() = qtVis_interp[i].z() - qtVis_interp[i - 1].z();
-    qtDiffs.push_back(q);
-  }
-  qtDiffs.push_back(qtDiffs[qtDiffs.size() - 1]);
-
-  for (size_t i = 0; i < qtDiffs.size(); ++i) {
-    Quaterniond angVisQ = qtDiffs[i] * qtVis_interp[i].inverse();
-    const double diff_dt = -2.0 / dt_imu;
-    Vector3d angVisVec(
-        diff_dt * angVisQ.x(), diff_dt * angVisQ.y(), diff_dt * angVisQ.z());
+  // angular velocities from the forward differences of the quaternions,
+  // the last sample reuses the previous difference
+  const size_t nr_vis = qtVis_interp.size();
+  vec3_vector angVis(nr_vis, Vector3d::Zero());
+  const double diff_dt = -2.0 / dt_imu;
+  for (size_t i = 0; i < nr_vis; ++i) {
+    const size_t k = std::max<size_t>(1, std::min(i + 1, nr_vis - 1));
+    Quaterniond qtDiff;
+    qtDiff.coeffs() = qtVis_interp[k].coeffs() - qtVis_interp[k - 1].coeffs();
+    const Vector3d angVisVec =
+        diff_dt * (qtDiff * qtVis_interp[i].inverse()).vec();
     // suppress extremely large velocities 6.28 rad/s ~ >360deg/s
-    if (std::abs(angVisVec[0]) > 2 * M_PI ||
-        std::abs(angVisVec[1]) > 2 * M_PI ||
-        std::abs(angVisVec[2]) > 2 * M_PI) {
+    if (angVisVec.cwiseAbs().maxCoeff() > 2 * M_PI) {
       if (i > 1) {
-        angVisVec = angVis[i - 1];
-      } else {
-        angVisVec.setZero();
+        angVis[i] = angVis[i - 1];
       }
+    } else {
+      angVis[i] = angVisVec;
     }
-    angVis.push_back(angVisVec);
   }
 
-  // calculate moving average to smooth the values a bit
-  SimpleMovingAverage x_imu(15), y_imu(15), z_imu(15);
-  SimpleMovingAverage x_vis(15), y_vis(15), z_vis(15);
-
-  // vec3_vector smoothed_ang_imu, smoothed_vis_vel;
-  for (size_t i = 0; i < angImu.size(); ++i) {
-    x_imu.add(angImu[i][0]);
-    y_imu.add(angImu[i][1]);
-    z_imu.add(angImu[i][2]);
-    smoothed_ang_imu.push_back(
-        Eigen::Vector3d(x_imu.avg(), y_imu.avg(), z_imu.avg()));
-    x_vis.add(angVis[i][0]);
-    y_vis.add(angVis[i][1]);
-    z_vis.add(angVis[i][2]);
-    smoothed_vis_vel.push_back(
-        Eigen::Vector3d(x_vis.avg(), y_vis.avg(), z_vis.avg()));
+  // causal moving average over 15 samples to smooth the values a bit
+  OpenICC::utils::BoxFilter3d(angImu, 15, false, smoothed_ang_imu);
+  OpenICC::utils::BoxFilter3d(angVis, 15, false, smoothed_vis_vel);
+
+  // resample both signals once to a uniform grid, so that shifting the
+  // visual signal by a time offset is a constant time lookup per sample
+  const size_t num_grid_samples =
+      static_cast<size_t>((tIMU.back() - tIMU.front()) / dt_imu) + 1;
+  std::vector<double> t_grid(num_grid_samples);
+  for (size_t i = 0; i < num_grid_samples; ++i) {
+    t_grid[i] = tIMU.front() + i * dt_imu;
+  }
+  vec3_vector vis_grid, imu_grid;
+  OpenICC::utils::InterpolateVector3d(tIMU, t_grid, smoothed_vis_vel, vis_grid);
+  OpenICC::utils::InterpolateVector3d(tIMU, t_grid, smoothed_ang_imu, imu_grid);
+
+  double a = -MAX_TIME_OFFSET;
+  double b = MAX_TIME_OFFSET;
+  if (!full_offset_search_) {
+    const double coarse_offset =
+        CorrelateTimeOffset(vis_grid, imu_grid, dt_imu, MAX_TIME_OFFSET);
+    LOG(INFO) << "Coarse time offset from cross-correlation: "
+              << coarse_offset << "s";
+    a = coarse_offset - REFINEMENT_HALF_WIDTH * dt_imu;
+    b = coarse_offset + REFINEMENT_HALF_WIDTH * dt_imu;
   }
 
-  const double gRatio = (1.0 + std::sqrt(5.0)) / 2.0;
-  const double tolerance = 1e-4;
-
-  const double maxOffset = 1.0;
-  double a = -maxOffset;
-  double b = maxOffset;
-
-  double c = b - (b - a) / gRatio;
-  double d = a + (b - a) / gRatio;
-
-  unsigned int iter = 0;
+  Eigen::Vector3d bias = gyro_bias;
   double error = 0.0;
+  unsigned int iter = 0;
   LOG(INFO) << "Estimating camera to IMU rotation.";
-  while (std::abs(c - d) > tolerance) {
-    Eigen::Matrix3d Rsc, Rsd;
-    Eigen::Vector3d biasc, biasd;
-    const double fc = SolveClosedForm(
-        smoothed_vis_vel, smoothed_ang_imu, tIMU, c, dt_imu, Rsc, biasc);
-    const double fd = SolveClosedForm(
-        smoothed_vis_vel, smoothed_ang_imu, tIMU, d, dt_imu, Rsd, biasd);
-
-    if (fc < fd) {
-      b = d;
-      R_imu_to_camera = Rsc;
-      if (estimate_gyro_bias_) {
-        gyro_bias = biasc;
-      }
-      error = fc;
-    } else {
-      a = c;
-      R_imu_to_camera = Rsd;
-      if (estimate_gyro_bias_) {
-        gyro_bias = biasd;
-      }
-      error = fd;
+  if (full_offset_search_) {
+    // narrow the whole range down on grids decimated to about
+    // COARSE_GRID_RATE_HZ, the full rate is only evaluated near the optimum
+    const size_t factor = std::max<size_t>(
+        1, static_cast<size_t>(1.0 / (COARSE_GRID_RATE_HZ * dt_imu)));
+    if (factor > 1) {
+      const double coarse_dt = factor * dt_imu;
+      const vec3_vector coarse_vis = DecimateUniform(vis_grid, factor);
+      const vec3_vector coarse_imu = DecimateUniform(imu_grid, factor);
+      const double coarse_offset = GoldenSectionTimeOffset(coarse_vis,
+                                                           coarse_imu,
+                                                           coarse_dt,
+                                                           a,
+                                                           b,
+                                                           0.5 * coarse_dt,
+                                                           R_imu_to_camera,
+                                                           bias,
+                                                           error,
+                                                           iter);
+      LOG(INFO) << "Coarse time offset at " << 1. / coarse_dt
+                << "Hz: " << coarse_offset << "s in " << iter
+                << " iterations";
+      a = std::max(a, coarse_offset - REFINEMENT_HALF_WIDTH * coarse_dt);
+      b = std::min(b, coarse_offset + REFINEMENT_HALF_WIDTH * coarse_dt);
     }
-
-    c = b - (b - a) / gRatio;
-    d = a + (b - a) / gRatio;
-
-    iter = iter + 1;
   }
-  time_offset_imu_to_camera = (b + a) / 2;
+  time_offset_imu_to_camera = GoldenSectionTimeOffset(vis_grid,
+                                                      imu_grid,
+                                                      dt_imu,
+                                                      a,
+                                                      b,
+                                                      OFFSET_TOLERANCE,
+                                                      R_imu_to_camera,
+                                                      bias,
+                                                      error,
+                                                      iter);
+  if (estimate_gyro_bias_) {
+    gyro_bias = bias;
+  }
 
   LOG(INFO) << "Finished golden-section search in " << iter << " iterations.\n";
   Eigen::Quaterniond qat(R_imu_to_camera);
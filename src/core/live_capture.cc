@@ -0,0 +1,161 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/live_capture.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/utils.h"
+
+namespace OpenICC {
+namespace core {
+
+bool LiveCapture::OpenCamera(const std::string& device) {
+  const bool is_index =
+      !device.empty() && std::all_of(device.begin(), device.end(), ::isdigit);
+  const bool opened = is_index
+                          ? camera_.open(std::stoi(device), cv::CAP_V4L2)
+                          : camera_.open(device, cv::CAP_GSTREAMER);
+  if (!opened) {
+    LOG(ERROR) << "Could not open camera " << device << "\n";
+    return false;
+  }
+  // keep the driver queue short, buffering happens in frames_
+  camera_.set(cv::CAP_PROP_BUFFERSIZE, 1);
+  return true;
+}
+
+bool LiveCapture::Start() {
+  if (running_) {
+    return true;
+  }
+  if (!camera_.isOpened()) {
+    LOG(ERROR) << "Camera is not opened.\n";
+    return false;
+  }
+  running_ = true;
+  camera_thread_ = std::thread(&LiveCapture::CaptureFrames, this);
+  if (imu_source_) {
+    imu_thread_ = std::thread(&LiveCapture::CaptureImu, this);
+  } else {
+    LOG(WARNING) << "Live capture without IMU source.";
+  }
+  return true;
+}
+
+void LiveCapture::Stop() {
+  running_ = false;
+  if (imu_source_) {
+    imu_source_->Close();
+  }
+  if (camera_thread_.joinable()) {
+    camera_thread_.join();
+  }
+  if (imu_thread_.joinable()) {
+    imu_thread_.join();
+  }
+  LOG_IF(WARNING, nr_dropped_frames_ > 0)
+      << "Dropped " << nr_dropped_frames_ << " frames, board detection "
+      << "could not keep up with the camera.";
+  LOG_IF(WARNING, nr_dropped_imu_samples_ > 0)
+      << "Dropped " << nr_dropped_imu_samples_ << " IMU samples.";
+}
+
+void LiveCapture::CaptureFrames() {
+  const auto start = std::chrono::steady_clock::now();
+  Frame frame;
+  while (running_) {
+    if (!camera_.read(frame.image) || frame.image.empty()) {
+      LOG(ERROR) << "Camera stopped delivering frames.";
+      break;
+    }
+    // driver timestamp if the backend has one
+    frame.timestamp_s = camera_.get(cv::CAP_PROP_POS_MSEC) * MS_TO_S;
+    if (frame.timestamp_s <= 0.0) {
+      frame.timestamp_s = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    }
+    // the image is moved into the buffer, so the next read allocates a new
+    // one. A dropped frame keeps its image for the next read.
+    if (!frames_.TryPush(frame)) {
+      ++nr_dropped_frames_;
+    }
+  }
+}
+
+void LiveCapture::CaptureImu() {
+  ImuSample sample;
+  while (running_ &&
+         imu_source_->Read(sample.accelerometer, sample.gyroscope)) {
+    if (!imu_samples_.TryPush(sample)) {
+      ++nr_dropped_imu_samples_;
+    }
+  }
+}
+
+size_t LiveCapture::Process(BoardExtractor& extractor,
+                            const double img_downsample_factor,
+                            io::SceneWriter& scene_writer) {
+  ImuSample sample;
+  while (imu_samples_.TryPop(sample)) {
+    telemetry_.accelerometer.push_back(sample.accelerometer);
+    telemetry_.gyroscope.push_back(sample.gyroscope);
+  }
+
+  size_t nr_frames = 0;
+  Frame frame;
+  aligned_vector<Eigen::Vector2d> corners;
+  std::vector<int> ids;
+  while (frames_.TryPop(frame)) {
+    utils::ScopedTimer timer("live_frame", 1);
+    corners.clear();
+    ids.clear();
+    image_size_ = extractor.ExtractFrame(
+        frame.image, img_downsample_factor, corners, ids);
+    frame_timestamps_s_.push_back(frame.timestamp_s);
+    scene_writer.AddView(frame.timestamp_s * S_TO_US, corners, ids);
+    ++nr_frames;
+  }
+  return nr_frames;
+}
+
+bool LiveCapture::Finish(BoardExtractor& extractor,
+                         io::SceneWriter& scene_writer) {
+  std::vector<double> delta_ts;
+  for (size_t i = 1; i < frame_timestamps_s_.size(); ++i) {
+    delta_ts.push_back(frame_timestamps_s_[i] - frame_timestamps_s_[i - 1]);
+  }
+  const double fps =
+      delta_ts.empty() ? camera_.get(cv::CAP_PROP_FPS)
+                       : 1. / utils::MedianOfDoubleVec(delta_ts);
+  nlohmann::json header;
+  extractor.GetSceneHeader(fps, header);
+  header["image_width"] = image_size_.width;
+  header["image_height"] = image_size_.height;
+  if (!scene_writer.Close(header)) {
+    LOG(ERROR) << "Could not write the scene.\n";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -16,6 +16,11 @@
 #include "OpenCameraCalibrator/core/pose_estimator.h"
 
 #include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/planar_pose.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+#include "OpenCameraCalibrator/utils/undistortion.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
 #include <theia/io/reconstruction_reader.h>
@@ -25,6 +30,7 @@
 #include <theia/sfm/estimators/estimate_calibrated_absolute_pose.h>
 #include <theia/sfm/estimators/feature_correspondence_2d_3d.h>
 #include <theia/sfm/reconstruction.h>
+#include <theia/util/random.h>
 
 #include <theia/sfm/camera/division_undistortion_camera_model.h>
 #include <theia/sfm/camera/double_sphere_camera_model.h>
@@ -33,6 +39,12 @@
 #include <theia/sfm/camera/pinhole_camera_model.h>
 #include <theia/sfm/camera/pinhole_radial_tangential_camera_model.h>
 
+#include <Eigen/LU>
+#include <sophus/so3.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
 #include <thread>
 
 namespace OpenICC {
@@ -51,21 +63,172 @@ PoseEstimator::PoseEstimator() {
   ba_options_.intrinsics_to_optimize = theia::OptimizeIntrinsicsType::NONE;
 }
 
-bool PoseEstimator::EstimatePosePinhole(
-    const theia::ViewId& view_id,
+bool PoseEstimator::RansacPose(
     const std::vector<theia::FeatureCorrespondence2D3D>& correspondences_undist,
-    const std::vector<int>& board_pts3_ids) {
-  // Estimate camera pose using
-  theia::CalibratedAbsolutePose pose;
+    const unsigned int seed,
+    theia::CalibratedAbsolutePose* pose,
+    std::vector<int>* inliers) const {
+  utils::ScopedTimer timer("pnp", 1);
+  OPENICC_TRACE_ZONE("pnp");
+  // every call gets its own generator, so parallel calls neither share state
+  // nor depend on the order in which the views are processed
+  theia::RansacParameters ransac_params = ransac_params_;
+  ransac_params.rng = std::make_shared<theia::RandomNumberGenerator>(seed);
   theia::RansacSummary ransac_summary;
-  theia::EstimateCalibratedAbsolutePose(
-      ransac_params_, theia::RansacType::RANSAC, pnp_type_, correspondences_undist, &pose,
-      &ransac_summary);
+  theia::EstimateCalibratedAbsolutePose(ransac_params,
+                                        theia::RansacType::RANSAC,
+                                        pnp_type_,
+                                        correspondences_undist,
+                                        pose,
+                                        &ransac_summary);
+  *inliers = ransac_summary.inliers;
+  return inliers->size() >= 6;
+}
+
+bool PoseEstimator::PredictPose(
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences_undist,
+    const theia::CalibratedAbsolutePose& previous_pose,
+    theia::CalibratedAbsolutePose* pose,
+    std::vector<int>* inliers) const {
+  utils::ScopedTimer timer("pose_prediction", 1);
+  OPENICC_TRACE_ZONE("pose_prediction");
+  *pose = previous_pose;
+  return RefineAndCheckPose(correspondences_undist, pose, inliers);
+}
+
+bool PoseEstimator::PlanarPose(
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences_undist,
+    theia::CalibratedAbsolutePose* pose,
+    std::vector<int>* inliers) const {
+  utils::ScopedTimer timer("planar_pose", 1);
+  OPENICC_TRACE_ZONE("planar_pose");
+  Eigen::Matrix3d homography;
+  if (!utils::EstimateBoardHomography(correspondences_undist, &homography) ||
+      !utils::PoseFromBoardHomography(
+          homography, &pose->rotation, &pose->position)) {
+    return false;
+  }
+  return RefineAndCheckPose(correspondences_undist, pose, inliers);
+}
 
-  if (ransac_summary.inliers.size() < 6) {
+bool PoseEstimator::RefineAndCheckPose(
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences_undist,
+    theia::CalibratedAbsolutePose* pose,
+    std::vector<int>* inliers) const {
+  vec3_vector points(correspondences_undist.size());
+  vec2_vector features(correspondences_undist.size());
+  for (size_t i = 0; i < correspondences_undist.size(); ++i) {
+    points[i] = correspondences_undist[i].world_point;
+    features[i] = correspondences_undist[i].feature;
+  }
+  const double max_error = ransac_params_.error_thresh;
+  if (!RefinePose(points,
+                  features,
+                  max_error,
+                  5,
+                  &pose->rotation,
+                  &pose->position)) {
     return false;
   }
 
+  // the correspondences are known by id, so almost all have to agree
+  inliers->clear();
+  for (size_t i = 0; i < points.size(); ++i) {
+    const Eigen::Vector3d p_c = pose->rotation * (points[i] - pose->position);
+    if (p_c[2] > 0.0 && (p_c.hnormalized() - features[i]).norm() < max_error) {
+      inliers->push_back(static_cast<int>(i));
+    }
+  }
+  return inliers->size() >= min_num_points_ &&
+         inliers->size() >=
+             kMinPredictionInlierRatio * correspondences_undist.size();
+}
+
+bool PoseEstimator::RefinePose(const vec3_vector& points,
+                               const vec2_vector& features,
+                               const double huber_width,
+                               const int max_iterations,
+                               Eigen::Matrix3d* rotation,
+                               Eigen::Vector3d* position) {
+  OPENICC_TRACE_ZONE("pose_refinement");
+  using Matrix6d = Eigen::Matrix<double, 6, 6>;
+  using Vector6d = Eigen::Matrix<double, 6, 1>;
+  // Huber cost of the current pose, optionally with its normal equations
+  auto evaluate = [&](const Eigen::Matrix3d& R,
+                      const Eigen::Vector3d& c,
+                      Matrix6d* JtJ,
+                      Vector6d* Jtr) {
+    double cost = 0.0;
+    if (JtJ) {
+      JtJ->setZero();
+      Jtr->setZero();
+    }
+    for (size_t i = 0; i < points.size(); ++i) {
+      const Eigen::Vector3d p_c = R * (points[i] - c);
+      if (p_c[2] <= 0.0) {
+        continue;
+      }
+      const double inv_z = 1.0 / p_c[2];
+      const Eigen::Vector2d r = p_c.head<2>() * inv_z - features[i];
+      const double norm = r.norm();
+      // IRLS weight of the Huber loss
+      const double w = norm <= huber_width ? 1.0 : huber_width / norm;
+      cost += norm <= huber_width ? 0.5 * norm * norm
+                                  : huber_width * (norm - 0.5 * huber_width);
+      if (!JtJ) {
+        continue;
+      }
+      Eigen::Matrix<double, 2, 3> d_r_d_pc;
+      d_r_d_pc << inv_z, 0.0, -p_c[0] * inv_z * inv_z, 0.0, inv_z,
+          -p_c[1] * inv_z * inv_z;
+      // left perturbation of R and additive update of c
+      Eigen::Matrix<double, 2, 6> J;
+      J.leftCols<3>() = -d_r_d_pc * Sophus::SO3d::hat(p_c);
+      J.rightCols<3>() = -d_r_d_pc * R;
+      *JtJ += w * J.transpose() * J;
+      *Jtr += w * J.transpose() * r;
+    }
+    return cost;
+  };
+
+  Matrix6d JtJ;
+  Vector6d Jtr;
+  double cost = evaluate(*rotation, *position, &JtJ, &Jtr);
+  double lambda = 1e-4;
+  for (int it = 0; it < max_iterations; ++it) {
+    Matrix6d A = JtJ;
+    A.diagonal() *= 1.0 + lambda;
+    const Eigen::LDLT<Matrix6d> ldlt(A);
+    if (ldlt.info() != Eigen::Success) {
+      return false;
+    }
+    const Vector6d delta = -ldlt.solve(Jtr);
+    const Eigen::Matrix3d R_new =
+        Sophus::SO3d::exp(delta.head<3>()).matrix() * *rotation;
+    const Eigen::Vector3d c_new = *position + delta.tail<3>();
+    const double new_cost = evaluate(R_new, c_new, nullptr, nullptr);
+    if (new_cost < cost) {
+      *rotation = R_new;
+      *position = c_new;
+      lambda *= 0.1;
+      const bool converged = cost - new_cost < 1e-10 * cost;
+      cost = evaluate(*rotation, *position, &JtJ, &Jtr);
+      if (converged) {
+        break;
+      }
+    } else {
+      lambda *= 10.0;
+    }
+  }
+  return true;
+}
+
+bool PoseEstimator::AddPoseToView(
+    const theia::ViewId& view_id,
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences_undist,
+    const std::vector<int>& board_pts3_ids,
+    const theia::CalibratedAbsolutePose& pose,
+    const std::vector<int>& inliers) {
   theia::View* theia_view = pose_dataset_.MutableView(view_id);
   theia_view->SetEstimated(true);
 
@@ -73,9 +236,7 @@ bool PoseEstimator::EstimatePosePinhole(
   cam->SetPosition(pose.position);
   cam->SetOrientationFromRotationMatrix(pose.rotation);
 
-  for (size_t i = 0; i < ransac_summary.inliers.size(); ++i) {
-    int inlier = ransac_summary.inliers[i];
-
+  for (const int inlier : inliers) {
     pose_dataset_.AddObservation(
         view_id,
         board_pts3_ids[inlier],
@@ -83,14 +244,199 @@ bool PoseEstimator::EstimatePosePinhole(
   }
 
   // optimize pose
+  utils::ScopedTimer timer("pose_bundle_adjustment", 1);
+  OPENICC_TRACE_ZONE("pose_bundle_adjustment");
   theia::BundleAdjustmentSummary summary =
       theia::BundleAdjustView(ba_options_, view_id, &pose_dataset_);
 
   return summary.success;
 }
 
+bool PoseEstimator::EstimatePosePinhole(
+    const theia::ViewId& view_id,
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences_undist,
+    const std::vector<int>& board_pts3_ids) {
+  // Estimate camera pose using
+  theia::CalibratedAbsolutePose pose;
+  std::vector<int> inliers;
+  if (!RansacPose(correspondences_undist, view_id, &pose, &inliers)) {
+    return false;
+  }
+  return AddPoseToView(
+      view_id, correspondences_undist, board_pts3_ids, pose, inliers);
+}
+
+PoseEstimator::~PoseEstimator() {
+  if (stream_jobs_) {
+    stream_jobs_->Close();
+    for (std::thread& thread : stream_threads_) {
+      thread.join();
+    }
+  }
+}
+
 bool PoseEstimator::EstimatePosesFromJson(const nlohmann::json& scene_json,
                                           const theia::Camera camera) {
+  OPENICC_TRACE_ZONE("pose_estimation");
+  PrepareDataset(scene_json, camera);
+
+  // json objects are ordered by key string, so sort the views by time
+  const auto& views = scene_json["views"];
+  std::vector<std::pair<double, const nlohmann::json*>> timed_views;
+  for (const auto& view : views.items()) {
+    const double timestamp_us = std::stod(view.key());
+    timed_views.emplace_back(timestamp_us * US_TO_S, &view.value());
+  }
+  std::sort(timed_views.begin(),
+            timed_views.end(),
+            [](const std::pair<double, const nlohmann::json*>& a,
+               const std::pair<double, const nlohmann::json*>& b) {
+              return a.first < b.first;
+            });
+
+  // undistortion and pose estimation only read the camera and the board
+  // points, so all views are processed in parallel into their own result slot
+  std::vector<ViewPoseEstimate> estimates(timed_views.size());
+  auto undistort_view = [&](const int v) {
+    ViewPoseEstimate& estimate = estimates[v];
+    estimate.timestamp_s = timed_views[v].first;
+    const auto& image_points = (*timed_views[v].second)["image_points"];
+    for (const auto& img_pts : image_points.items()) {
+      estimate.board_pts3_ids.push_back(std::stoi(img_pts.key()));
+      estimate.corners.emplace_back(img_pts.value()[0].get<double>(),
+                                    img_pts.value()[1].get<double>());
+    }
+    UndistortView(camera, &estimate);
+  };
+  utils::ParallelFor(0,
+                     static_cast<int>(timed_views.size()),
+                     num_threads_,
+                     undistort_view);
+
+  // consecutive frames have almost the same pose, so inside a block of views
+  // the previous pose is refined first. Otherwise the pose of the planar
+  // board is initialized from its homography and RANSAC only runs if both
+  // fail. The blocks do not depend on the number of threads.
+  const int nr_views = static_cast<int>(timed_views.size());
+  const int block_size = temporal_prediction_ ? kTemporalBlockSize : 1;
+  const int nr_blocks = (nr_views + block_size - 1) / block_size;
+  std::vector<int> nr_predicted(nr_blocks, 0);
+  std::vector<int> nr_planar(nr_blocks, 0);
+  auto estimate_block_poses = [&](const int b) {
+    const int first = b * block_size;
+    EstimateBlockPoses(first,
+                       std::min(nr_views, first + block_size) - first,
+                       &estimates[first],
+                       &nr_predicted[b],
+                       &nr_planar[b]);
+  };
+  utils::ParallelFor(0, nr_blocks, num_threads_, estimate_block_poses);
+  int total_predicted = 0;
+  for (const int n : nr_predicted) {
+    total_predicted += n;
+  }
+  int total_planar = 0;
+  for (const int n : nr_planar) {
+    total_planar += n;
+  }
+  LOG(INFO) << total_predicted << " of " << nr_views
+            << " view poses predicted from the previous view, "
+            << total_planar << " initialized from the board homography.";
+  return AddEstimatesToDataset(estimates, camera);
+}
+
+void PoseEstimator::StartStreaming(const nlohmann::json& board_json,
+                                   const theia::Camera& camera) {
+  OPENICC_TRACE_ZONE("pose_streaming_start");
+  PrepareDataset(board_json, camera);
+  stream_camera_ = camera;
+  stream_blocks_.clear();
+  stream_nr_views_ = 0;
+  stream_nr_predicted_ = 0;
+  stream_nr_planar_ = 0;
+  stream_jobs_.reset(new utils::BoundedQueue<StreamBlock*>(4 * num_threads_));
+  for (int t = 0; t < num_threads_; ++t) {
+    stream_threads_.emplace_back([this]() {
+      StreamBlock* block = nullptr;
+      while (stream_jobs_->Pop(block)) {
+        OPENICC_TRACE_ZONE("pose_streaming_block");
+        for (ViewPoseEstimate& estimate : block->estimates) {
+          UndistortView(stream_camera_, &estimate);
+        }
+        int nr_predicted = 0;
+        int nr_planar = 0;
+        EstimateBlockPoses(block->first_view,
+                           static_cast<int>(block->estimates.size()),
+                           block->estimates.data(),
+                           &nr_predicted,
+                           &nr_planar);
+        stream_nr_predicted_ += nr_predicted;
+        stream_nr_planar_ += nr_planar;
+      }
+    });
+  }
+}
+
+void PoseEstimator::AddStreamingView(
+    const double timestamp_us,
+    const aligned_vector<Eigen::Vector2d>& corners,
+    const std::vector<int>& ids) {
+  if (!stream_jobs_ || ids.empty()) {
+    return;
+  }
+  const size_t block_size = temporal_prediction_ ? kTemporalBlockSize : 1;
+  if (stream_blocks_.empty() ||
+      stream_blocks_.back()->estimates.size() == block_size) {
+    stream_blocks_.emplace_back(new StreamBlock);
+    stream_blocks_.back()->first_view = stream_nr_views_;
+    stream_blocks_.back()->estimates.reserve(block_size);
+  }
+  StreamBlock& block = *stream_blocks_.back();
+  block.estimates.emplace_back();
+  ViewPoseEstimate& estimate = block.estimates.back();
+  estimate.timestamp_s = timestamp_us * US_TO_S;
+  estimate.board_pts3_ids = ids;
+  estimate.corners = corners;
+  ++stream_nr_views_;
+  // full blocks are estimated while the next views are detected
+  if (block.estimates.size() == block_size) {
+    stream_jobs_->Push(&block);
+  }
+}
+
+bool PoseEstimator::FinishStreaming() {
+  if (!stream_jobs_) {
+    return false;
+  }
+  OPENICC_TRACE_ZONE("pose_streaming_finish");
+  const size_t block_size = temporal_prediction_ ? kTemporalBlockSize : 1;
+  if (!stream_blocks_.empty() &&
+      stream_blocks_.back()->estimates.size() < block_size) {
+    stream_jobs_->Push(stream_blocks_.back().get());
+  }
+  stream_jobs_->Close();
+  for (std::thread& thread : stream_threads_) {
+    thread.join();
+  }
+  stream_threads_.clear();
+  stream_jobs_.reset();
+
+  std::vector<ViewPoseEstimate> estimates;
+  estimates.reserve(stream_nr_views_);
+  for (const std::unique_ptr<StreamBlock>& block : stream_blocks_) {
+    std::move(block->estimates.begin(),
+              block->estimates.end(),
+              std::back_inserter(estimates));
+  }
+  stream_blocks_.clear();
+  LOG(INFO) << stream_nr_predicted_ << " of " << stream_nr_views_
+            << " streamed view poses predicted from the previous view, "
+            << stream_nr_planar_ << " initialized from the board homography.";
+  return AddEstimatesToDataset(estimates, stream_camera_);
+}
+
+void PoseEstimator::PrepareDataset(const nlohmann::json& scene_json,
+                                   const theia::Camera& camera) {
   const double image_diag =
       std::sqrt(camera.ImageWidth() * camera.ImageWidth() +
                 camera.ImageHeight() * camera.ImageHeight());
@@ -107,37 +453,70 @@ bool PoseEstimator::EstimatePosesFromJson(const nlohmann::json& scene_json,
   for (const auto t_id : pose_dataset_.TrackIds()) {
     tracks_to_nr_obs_[t_id] = 0;
   }
+}
+
+void PoseEstimator::UndistortView(const theia::Camera& camera,
+                                  ViewPoseEstimate* estimate) const {
+  vec2_vector undist_pts;
+  utils::PixelsToNormalizedCoordinates(
+      camera, undistortion_lut_.get(), estimate->corners, &undist_pts);
+
+  estimate->correspondences_undist.resize(estimate->corners.size());
+  for (size_t i = 0; i < estimate->corners.size(); ++i) {
+    const Eigen::Vector4d track =
+        pose_dataset_.Track(estimate->board_pts3_ids[i])->Point();
+    theia::FeatureCorrespondence2D3D& corr_undist =
+        estimate->correspondences_undist[i];
+    corr_undist.world_point = track.hnormalized();
+    corr_undist.feature = undist_pts[i];
+  }
+  estimate->corners.clear();
+}
 
-  const auto views = scene_json["views"];
+void PoseEstimator::EstimateBlockPoses(const int first_view,
+                                       const int nr_views,
+                                       ViewPoseEstimate* estimates,
+                                       int* nr_predicted,
+                                       int* nr_planar) const {
+  const ViewPoseEstimate* previous = nullptr;
+  for (int v = 0; v < nr_views; ++v) {
+    ViewPoseEstimate& estimate = estimates[v];
+    if (estimate.correspondences_undist.size() < min_num_points_) {
+      continue;
+    }
+    if (previous && estimate.timestamp_s - previous->timestamp_s <=
+                        max_temporal_prediction_gap_s_) {
+      estimate.success = PredictPose(estimate.correspondences_undist,
+                                     previous->pose,
+                                     &estimate.pose,
+                                     &estimate.inliers);
+      *nr_predicted += estimate.success;
+    }
+    if (!estimate.success) {
+      estimate.success = PlanarPose(
+          estimate.correspondences_undist, &estimate.pose, &estimate.inliers);
+      *nr_planar += estimate.success;
+    }
+    if (!estimate.success) {
+      estimate.success = RansacPose(estimate.correspondences_undist,
+                                    first_view + v,
+                                    &estimate.pose,
+                                    &estimate.inliers);
+    }
+    previous = estimate.success ? &estimate : nullptr;
+  }
+}
+
+bool PoseEstimator::AddEstimatesToDataset(
+    const std::vector<ViewPoseEstimate>& estimates,
+    const theia::Camera& camera) {
+  const double max_reproj_error = 0.004 * camera.ImageHeight();
   double total_repro_error = 0.0;
   int processed_frames = 0;
 
-  for (const auto& view : views.items()) {
-    const double timestamp_us = std::stod(view.key());
-    const double timestamp_s = timestamp_us * US_TO_S;  // to seconds
-    const auto image_points = view.value()["image_points"];
-    std::vector<int> board_pts3_ids;
-    aligned_vector<Eigen::Vector2d> corners;
-    std::vector<theia::FeatureCorrespondence2D3D> correspondences_undist;
-
-    for (const auto& img_pts : image_points.items()) {
-      const int board_pt3_id = std::stoi(img_pts.key());
-      board_pts3_ids.push_back(std::stoi(img_pts.key()));
-      const Eigen::Vector2d corner(
-          Eigen::Vector2d(img_pts.value()[0], img_pts.value()[1]));
-      corners.push_back(corner);
-      Eigen::Vector3d undist_pt = camera.PixelToNormalizedCoordinates(corner);
-      undist_pt /= undist_pt[2];
-
-      const Eigen::Vector4d track = pose_dataset_.Track(board_pt3_id)->Point();
-
-      theia::FeatureCorrespondence2D3D corr_undist;
-      corr_undist.world_point = track.hnormalized();
-      corr_undist.feature[0] = undist_pt[0];
-      corr_undist.feature[1] = undist_pt[1];
-      correspondences_undist.push_back(corr_undist);
-    }
-    if (correspondences_undist.size() < min_num_points_) {
+  for (const ViewPoseEstimate& estimate : estimates) {
+    const double timestamp_s = estimate.timestamp_s;
+    if (estimate.correspondences_undist.size() < min_num_points_) {
       LOG(INFO) << "Skipping view at timestamp : " << timestamp_s
                 << "s. Not enough points found.";
       continue;
@@ -151,9 +530,14 @@ bool PoseEstimator::EstimatePosesFromJson(const nlohmann::json& scene_json,
     cam->SetFocalLength(1.0);
     cam->SetPrincipalPoint(0.0, 0.0);
     cam->SetImageSize(1.0, 1.0);
-    if (!EstimatePosePinhole(view_id, correspondences_undist, board_pts3_ids)) {
+    if (!estimate.success || !AddPoseToView(view_id,
+                                            estimate.correspondences_undist,
+                                            estimate.board_pts3_ids,
+                                            estimate.pose,
+                                            estimate.inliers)) {
       LOG(INFO) << "Pose estimation failed for view at timestamp "
-                << timestamp_s << "s from " << correspondences_undist.size()
+                << timestamp_s << "s from "
+                << estimate.correspondences_undist.size()
                 << " points. Max reproj error was: "
                 << ransac_params_.error_thresh;
       pose_dataset_.RemoveView(view_id);
@@ -190,13 +574,13 @@ bool PoseEstimator::EstimatePosesFromJson(const nlohmann::json& scene_json,
   return true;
 }
 
-void PoseEstimator::OptimizeBoardPoints() {
+void PoseEstimator::OptimizeBoardPoints(const bool compute_covariance) {
   ba_options_.constant_camera_orientation = true;
   ba_options_.constant_camera_position = true;
   ba_options_.verbose = true;
+  utils::ScopedTimer timer("board_point_bundle_adjustment");
+  OPENICC_TRACE_ZONE("board_point_bundle_adjustment");
 
-  std::map<theia::TrackId, Eigen::Matrix3d> emp_covariance_matrices;
-  double empirical_variance_factor;
   // only use track ids that have actually been observed more than 3 times
   std::vector<theia::TrackId> track_ids_to_optimize;
   for (const auto& pair : tracks_to_nr_obs_) {
@@ -204,38 +588,145 @@ void PoseEstimator::OptimizeBoardPoints() {
       track_ids_to_optimize.push_back(pair.first);
     }
   }
-  theia::BundleAdjustTracks(ba_options_,
-                            track_ids_to_optimize,
-                            &pose_dataset_,
-                            &emp_covariance_matrices,
-                            &empirical_variance_factor);
+  theia::BundleAdjustTracks(ba_options_, track_ids_to_optimize, &pose_dataset_);
+  board_point_covariances_.clear();
+  empirical_variance_factor_ = 0.0;
+  if (!compute_covariance) {
+    return;
+  }
+
+  ComputeBoardPointCovariances(track_ids_to_optimize);
   std::cout << "Empirical variance factor after board point optimization: "
-            << empirical_variance_factor << "\n";
+            << empirical_variance_factor_ << "\n";
   Eigen::Vector3d mean_std(0.0, 0.0, 0.0);
-  for (const auto& c : emp_covariance_matrices) {
+  for (const auto& c : board_point_covariances_) {
     Eigen::Vector3d stddev = c.second.diagonal().array().sqrt() * 1e3;
     mean_std += stddev;
     std::cout << "Track Id: " << c.first << " std dev: " << stddev.transpose()
               << " mm\n";
   }
-  mean_std /= (double)emp_covariance_matrices.size();
+  mean_std /= (double)board_point_covariances_.size();
   std::cout << "Mean board point standard deviation after optimization: "
             << mean_std.transpose() << " mm\n";
 }
 
+void PoseEstimator::ComputeBoardPointCovariances(
+    const std::vector<theia::TrackId>& track_ids) {
+  OPENICC_TRACE_ZONE("board_point_covariance");
+  // the views observe normalized image coordinates, see
+  // EstimatePosesFromJson
+  std::vector<Eigen::Matrix3d> inv_normal_equations(track_ids.size());
+  std::vector<double> squared_residuals(track_ids.size(), 0.0);
+  std::vector<int> nr_observations(track_ids.size(), 0);
+  std::vector<char> valid(track_ids.size(), 0);
+  utils::ParallelFor(
+      0, static_cast<int>(track_ids.size()), num_threads_, [&](const int t) {
+        const theia::Track* track = pose_dataset_.Track(track_ids[t]);
+        if (!track) {
+          return;
+        }
+        const Eigen::Vector3d point = track->Point().hnormalized();
+        Eigen::Matrix3d normal_equations = Eigen::Matrix3d::Zero();
+        for (const theia::ViewId view_id : track->ViewIds()) {
+          const theia::View* view = pose_dataset_.View(view_id);
+          const theia::Feature* feature =
+              view ? view->GetFeature(track_ids[t]) : nullptr;
+          if (!feature) {
+            continue;
+          }
+          const Eigen::Matrix3d R =
+              view->Camera().GetOrientationAsRotationMatrix();
+          const Eigen::Vector3d p =
+              R * (point - view->Camera().GetPosition());
+          if (p[2] <= 0.0) {
+            continue;
+          }
+          const double inv_z = 1.0 / p[2];
+          Eigen::Matrix<double, 2, 3> d_proj_d_p;
+          d_proj_d_p << inv_z, 0.0, -p[0] * inv_z * inv_z, 0.0, inv_z,
+              -p[1] * inv_z * inv_z;
+          const Eigen::Matrix<double, 2, 3> J = d_proj_d_p * R;
+          normal_equations += J.transpose() * J;
+          squared_residuals[t] +=
+              (p.head<2>() * inv_z - feature->point_).squaredNorm();
+          ++nr_observations[t];
+        }
+        Eigen::FullPivLU<Eigen::Matrix3d> lu(normal_equations);
+        if (nr_observations[t] < 2 || !lu.isInvertible()) {
+          return;
+        }
+        inv_normal_equations[t] = lu.inverse();
+        valid[t] = 1;
+      });
+
+  double sum_squared_residuals = 0.0;
+  int redundancy = 0;
+  for (size_t t = 0; t < track_ids.size(); ++t) {
+    if (valid[t]) {
+      sum_squared_residuals += squared_residuals[t];
+      redundancy += 2 * nr_observations[t] - 3;
+    }
+  }
+  if (redundancy <= 0) {
+    LOG(WARNING) << "Not enough observations for the board point covariance.";
+    return;
+  }
+  empirical_variance_factor_ = sum_squared_residuals / redundancy;
+  for (size_t t = 0; t < track_ids.size(); ++t) {
+    if (valid[t]) {
+      board_point_covariances_[track_ids[t]] =
+          empirical_variance_factor_ * inv_normal_equations[t];
+    }
+  }
+}
+
 void PoseEstimator::OptimizeAllPoses() {
   ba_options_.constant_camera_orientation = false;
   ba_options_.constant_camera_position = false;
   ba_options_.verbose = false;
   LOG(INFO) << "Optimizing all estimated poses.";
-  for (auto vid : pose_dataset_.ViewIds()) {
-    theia::BundleAdjustView(
-        ba_options_, vid, &pose_dataset_);
+  utils::ScopedTimer timer("pose_bundle_adjustment",
+                           pose_dataset_.NumViews());
+  OPENICC_TRACE_ZONE("pose_bundle_adjustment");
+  // the views of the pose dataset observe normalized image coordinates, see
+  // EstimatePosesFromJson, so the refinement can work on them directly
+  const std::vector<theia::ViewId> view_ids = pose_dataset_.ViewIds();
+  std::vector<Eigen::Matrix3d> rotations(view_ids.size());
+  vec3_vector positions(view_ids.size());
+  std::vector<char> refined(view_ids.size(), 0);
+  utils::ParallelFor(
+      0, static_cast<int>(view_ids.size()), num_threads_, [&](const int v) {
+        const theia::View* view = pose_dataset_.View(view_ids[v]);
+        vec3_vector points;
+        vec2_vector features;
+        for (const theia::TrackId track_id : view->TrackIds()) {
+          const theia::Track* track = pose_dataset_.Track(track_id);
+          points.push_back(track->Point().hnormalized());
+          features.push_back(view->GetFeature(track_id)->point_);
+        }
+        rotations[v] = view->Camera().GetOrientationAsRotationMatrix();
+        positions[v] = view->Camera().GetPosition();
+        refined[v] = RefinePose(points,
+                                features,
+                                ba_options_.robust_loss_width,
+                                20,
+                                &rotations[v],
+                                &positions[v]);
+      });
+  for (size_t v = 0; v < view_ids.size(); ++v) {
+    if (!refined[v]) {
+      continue;
+    }
+    theia::Camera* cam =
+        pose_dataset_.MutableView(view_ids[v])->MutableCamera();
+    cam->SetOrientationFromRotationMatrix(rotations[v]);
+    cam->SetPosition(positions[v]);
   }
   LOG(INFO) << "Finished optimizing camera poses.";
 }
 
 void PoseEstimator::FilterBadPoses() {
+  OPENICC_TRACE_ZONE("pose_filter");
 
   // sometimes it happens that poses are far away or
   // on the wrong side of the calibration board
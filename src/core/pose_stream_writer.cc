@@ -0,0 +1,43 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/pose_stream_writer.h"
+
+namespace OpenICC {
+namespace core {
+
+bool PoseStreamSceneWriter::Open(const std::string& save_path) {
+  return scene_writer_->Open(save_path);
+}
+
+void PoseStreamSceneWriter::AddView(
+    const double timestamp_us,
+    const aligned_vector<Eigen::Vector2d>& corners,
+    const std::vector<int>& ids) {
+  if (ids.empty()) {
+    return;
+  }
+  scene_writer_->AddView(timestamp_us, corners, ids);
+  pose_estimator_->AddStreamingView(timestamp_us, corners, ids);
+  ++num_views_;
+}
+
+bool PoseStreamSceneWriter::Close(const nlohmann::json& header) {
+  const bool scene_written = scene_writer_->Close(header);
+  return pose_estimator_->FinishStreaming() && scene_written;
+}
+
+}  // namespace core
+}  // namespace OpenICC
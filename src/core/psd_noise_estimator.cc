@@ -0,0 +1,177 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/psd_noise_estimator.h"
+
+#include <glog/logging.h>
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+nlohmann::json AxesToJson(const Eigen::Vector3d& values) {
+  nlohmann::json j;
+  j["x"] = values[0];
+  j["y"] = values[1];
+  j["z"] = values[2];
+  return j;
+}
+
+}  // namespace
+
+PsdNoiseEstimator::PsdNoiseEstimator(const PsdNoiseEstimatorOptions& options)
+    : options_(options) {
+  // even length, so that the segments overlap by exactly one half
+  options_.segment_length = std::max(16, options_.segment_length & ~1);
+  const int n = options_.segment_length;
+  segment_.resize(n);
+  window_.resize(n);
+  for (int i = 0; i < n; ++i) {
+    window_[i] = 0.5 - 0.5 * std::cos(2.0 * M_PI * i / n);
+  }
+  periodogram_sum_.assign(n / 2 + 1, Eigen::Matrix<double, 6, 1>::Zero());
+}
+
+void PsdNoiseEstimator::Push(const Eigen::Vector3d& accl,
+                             const Eigen::Vector3d& gyro,
+                             const double t_s) {
+  if (nr_samples_ == 0) {
+    first_t_s_ = t_s;
+  }
+  last_t_s_ = t_s;
+  ++nr_samples_;
+
+  segment_[nr_buffered_] << accl, gyro;
+  if (++nr_buffered_ < options_.segment_length) {
+    return;
+  }
+  AccumulateSegment();
+  // the second half starts the next segment
+  const int half = options_.segment_length / 2;
+  std::copy(segment_.begin() + half, segment_.end(), segment_.begin());
+  nr_buffered_ = half;
+}
+
+void PsdNoiseEstimator::Push(const CameraTelemetryData& telemetry_data) {
+  const size_t nr_samples = std::min(telemetry_data.accelerometer.size(),
+                                     telemetry_data.gyroscope.size());
+  for (size_t i = 0; i < nr_samples; ++i) {
+    Push(telemetry_data.accelerometer[i].data(),
+         telemetry_data.gyroscope[i].data(),
+         telemetry_data.accelerometer[i].timestamp_s());
+  }
+}
+
+void PsdNoiseEstimator::AccumulateSegment() {
+  const int n = options_.segment_length;
+  cv::Mat axis(1, n, CV_64F), spectrum;
+  for (int a = 0; a < 6; ++a) {
+    // remove the segment mean, i.e. the bias and gravity
+    double mean = 0.0;
+    for (int i = 0; i < n; ++i) {
+      mean += segment_[i][a];
+    }
+    mean /= n;
+    for (int i = 0; i < n; ++i) {
+      axis.at<double>(i) = window_[i] * (segment_[i][a] - mean);
+    }
+    cv::dft(axis, spectrum, cv::DFT_COMPLEX_OUTPUT);
+    for (int k = 0; k <= n / 2; ++k) {
+      const cv::Vec2d& s = spectrum.at<cv::Vec2d>(k);
+      periodogram_sum_[k][a] += s[0] * s[0] + s[1] * s[1];
+    }
+  }
+  ++nr_segments_;
+}
+
+bool PsdNoiseEstimator::Finish() {
+  if (nr_segments_ == 0 || last_t_s_ <= first_t_s_) {
+    LOG(ERROR) << "PSD noise estimation needs at least "
+               << options_.segment_length << " samples, got " << nr_samples_;
+    return false;
+  }
+  const int n = options_.segment_length;
+  sample_rate_ = (nr_samples_ - 1) / (last_t_s_ - first_t_s_);
+  double window_power = 0.0;
+  for (const double w : window_) {
+    window_power += w * w;
+  }
+  // two sided PSD of bin k in units^2 / Hz
+  const double scale = 1.0 / (nr_segments_ * sample_rate_ * window_power);
+  const double df = sample_rate_ / n;
+
+  // the ratios are relative to the sample rate, bin k is at k / n of it
+  const int min_bin = std::max(
+      1, (int)std::ceil(options_.white_noise_min_freq_ratio * n));
+  const int max_bin = std::min(
+      n / 2 - 1, (int)std::floor(options_.white_noise_max_freq_ratio * n));
+  if (max_bin < min_bin) {
+    LOG(ERROR) << "The white noise band contains no frequency bin.";
+    return false;
+  }
+  Eigen::Matrix<double, 6, 1> white_psd = Eigen::Matrix<double, 6, 1>::Zero();
+  for (int k = min_bin; k <= max_bin; ++k) {
+    white_psd += periodogram_sum_[k] * scale;
+  }
+  white_psd /= max_bin - min_bin + 1;
+
+  // sigma_b^2 = (S(f) - sigma^2) (2 pi f)^2, averaged over the lowest bins
+  // before clamping, so that the PSD scatter does not bias it upwards. The
+  // Hann window leaks the removed mean into bin 1, start at bin 2.
+  const int nr_walk_bins =
+      std::max(1, std::min(options_.nr_random_walk_bins, min_bin - 2));
+  Eigen::Matrix<double, 6, 1> walk_var = Eigen::Matrix<double, 6, 1>::Zero();
+  for (int k = 2; k < 2 + nr_walk_bins; ++k) {
+    const double omega = 2.0 * M_PI * k * df;
+    walk_var += omega * omega * (periodogram_sum_[k] * scale - white_psd);
+  }
+  const Eigen::Matrix<double, 6, 1> random_walk =
+      (walk_var / nr_walk_bins).cwiseMax(0.0).cwiseSqrt();
+
+  const Eigen::Matrix<double, 6, 1> noise_density = white_psd.cwiseSqrt();
+  accl_noise_density_ = noise_density.head<3>();
+  gyro_noise_density_ = noise_density.tail<3>();
+  accl_random_walk_ = random_walk.head<3>();
+  gyro_random_walk_ = random_walk.tail<3>();
+
+  LOG(INFO) << "PSD of " << nr_segments_ << " segments at " << sample_rate_
+            << " Hz. Noise density accelerometer: "
+            << accl_noise_density_.transpose()
+            << ", gyroscope: " << gyro_noise_density_.transpose();
+  return true;
+}
+
+nlohmann::json PsdNoiseEstimator::ToJson() const {
+  nlohmann::json j;
+  j["accelerometer_noise_density"] = accl_noise_density_.mean();
+  j["accelerometer_random_walk"] = accl_random_walk_.mean();
+  j["gyroscope_noise_density"] = gyro_noise_density_.mean();
+  j["gyroscope_random_walk"] = gyro_random_walk_.mean();
+  j["update_rate"] = sample_rate_;
+  j["accl_noise_density"] = AxesToJson(accl_noise_density_);
+  j["accl_random_walk"] = AxesToJson(accl_random_walk_);
+  j["gyro_noise_density"] = AxesToJson(gyro_noise_density_);
+  j["gyro_random_walk"] = AxesToJson(gyro_random_walk_);
+  j["nr_segments"] = nr_segments_;
+  return j;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,88 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/reprojection_error_report.h"
+
+#include <algorithm>
+
+namespace OpenICC {
+namespace core {
+
+void ViewReprojectionErrors::Add(const double error,
+                                 const ReprojectionHistogramOptions& options) {
+  sum_error += error;
+  max_error = std::max(max_error, error);
+  ++nr_points;
+  // clamped before the cast, failed projections have huge errors
+  const int bin = static_cast<int>(std::min(
+      error / options.bin_width_px, static_cast<double>(options.nr_bins - 1)));
+  ++histogram[bin];
+}
+
+double ViewReprojectionErrors::MeanError() const {
+  return nr_points > 0 ? sum_error / nr_points : 0.0;
+}
+
+int ReprojectionErrorReport::NumPoints() const {
+  int nr_points = 0;
+  for (const ViewReprojectionErrors& view : views) {
+    nr_points += view.nr_points;
+  }
+  return nr_points;
+}
+
+double ReprojectionErrorReport::MeanError() const {
+  // summed in view order, independent of the evaluation threads
+  double sum_error = 0.0;
+  for (const ViewReprojectionErrors& view : views) {
+    sum_error += view.sum_error;
+  }
+  const int nr_points = NumPoints();
+  return nr_points > 0 ? sum_error / nr_points : 0.0;
+}
+
+std::vector<int> ReprojectionErrorReport::Histogram() const {
+  std::vector<int> histogram(histogram_options.nr_bins, 0);
+  for (const ViewReprojectionErrors& view : views) {
+    for (size_t b = 0; b < view.histogram.size(); ++b) {
+      histogram[b] += view.histogram[b];
+    }
+  }
+  return histogram;
+}
+
+nlohmann::json ReprojectionErrorReportToJson(
+    const ReprojectionErrorReport& report) {
+  nlohmann::json report_json;
+  report_json["mean_error_px"] = report.MeanError();
+  report_json["nr_points"] = report.NumPoints();
+  report_json["histogram_bin_width_px"] = report.histogram_options.bin_width_px;
+  report_json["histogram"] = report.Histogram();
+  report_json["views"] = nlohmann::json::array();
+  for (const ViewReprojectionErrors& view : report.views) {
+    nlohmann::json view_json;
+    view_json["view_id"] = view.view_id;
+    view_json["timestamp_s"] = view.timestamp_s;
+    view_json["nr_points"] = view.nr_points;
+    view_json["mean_error_px"] = view.MeanError();
+    view_json["max_error_px"] = view.max_error;
+    view_json["histogram"] = view.histogram;
+    report_json["views"].push_back(view_json);
+  }
+  return report_json;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,244 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/reprojection_video_renderer.h"
+
+#include <glog/logging.h>
+
+
+#include "OpenCameraCalibrator/utils/bounded_queue.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+// frames and views match if they are closer than this
+const int64_t kMaxTimestampDiffNs = 1000000;
+}  // namespace
+
+ReprojectionVideoRenderer::ReprojectionVideoRenderer(
+    const theia::Camera& camera,
+    const nlohmann::json& scene_json,
+    const aligned_map<int64_t, Sophus::SE3d>& T_w_c)
+    : camera_(camera), T_w_c_(T_w_c) {
+  for (const auto& pt : scene_json["scene_pts"].items()) {
+    if (pt.value().is_null()) continue;
+    board_pts_[std::stoi(pt.key())] =
+        Eigen::Vector3d(pt.value()[0], pt.value()[1], pt.value()[2]);
+  }
+  for (const auto& view : scene_json["views"].items()) {
+    const int64_t t_ns = std::stod(view.key()) * US_TO_S * S_TO_NS;
+    FrameObservations& obs = observations_[t_ns];
+    for (const auto& img_pt : view.value()["image_points"].items()) {
+      obs.ids.push_back(std::stoi(img_pt.key()));
+      obs.corners.push_back(
+          Eigen::Vector2d(img_pt.value()[0], img_pt.value()[1]));
+    }
+  }
+}
+
+ReprojectionVideoRenderer::~ReprojectionVideoRenderer() { Wait(); }
+
+bool ReprojectionVideoRenderer::Start(const std::string& video_path,
+                                      const std::string& output_path) {
+  if (thread_.joinable()) {
+    LOG(ERROR) << "The renderer is already running.";
+    return false;
+  }
+  success_ = false;
+  thread_ = std::thread(
+      [this, video_path, output_path]() { Run(video_path, output_path); });
+  return true;
+}
+
+bool ReprojectionVideoRenderer::Wait() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  return success_;
+}
+
+template <typename T, typename Map>
+const T* ReprojectionVideoRenderer::FindClosest(const Map& map,
+                                                const int64_t t_ns,
+                                                const int64_t max_dt_ns) {
+  auto it = map.lower_bound(t_ns);
+  const T* closest = nullptr;
+  int64_t min_dt_ns = max_dt_ns + 1;
+  if (it != map.end()) {
+    min_dt_ns = it->first - t_ns;
+    closest = &it->second;
+  }
+  if (it != map.begin()) {
+    --it;
+    if (t_ns - it->first < min_dt_ns) {
+      min_dt_ns = t_ns - it->first;
+      closest = &it->second;
+    }
+  }
+  return min_dt_ns <= max_dt_ns ? closest : nullptr;
+}
+
+void ReprojectionVideoRenderer::Render(RenderJob& job) const {
+  utils::ScopedTimer timer("reprojection_render", 1);
+  cv::Mat& image = job.image;
+  if (image.cols != camera_.ImageWidth() ||
+      image.rows != camera_.ImageHeight()) {
+    cv::resize(
+        image, image, cv::Size(camera_.ImageWidth(), camera_.ImageHeight()));
+  }
+  theia::Camera camera = camera_;
+  camera.SetOrientationFromRotationMatrix(
+      job.T_w_c->rotationMatrix().transpose());
+  camera.SetPosition(job.T_w_c->translation());
+
+  const FrameObservations& obs = *job.observations;
+  double reproj_error = 0.0;
+  int nr_reprojected = 0;
+  for (size_t i = 0; i < obs.ids.size(); ++i) {
+    const auto board_pt = board_pts_.find(obs.ids[i]);
+    if (board_pt == board_pts_.end()) continue;
+    Eigen::Vector2d pixel;
+    if (camera.ProjectPoint(board_pt->second.homogeneous(), &pixel) < 0.0) {
+      continue;
+    }
+    cv::drawMarker(image,
+                   cv::Point(cvRound(obs.corners[i][0]),
+                             cvRound(obs.corners[i][1])),
+                   cv::Scalar(0, 255, 0),
+                   cv::MARKER_TILTED_CROSS,
+                   8,
+                   1);
+    cv::drawMarker(image,
+                   cv::Point(cvRound(pixel[0]), cvRound(pixel[1])),
+                   cv::Scalar(0, 0, 255),
+                   cv::MARKER_CROSS,
+                   10,
+                   1);
+    reproj_error += (obs.corners[i] - pixel).norm();
+    ++nr_reprojected;
+  }
+  if (nr_reprojected > 0) {
+    reproj_error /= nr_reprojected;
+  }
+  cv::putText(image,
+              "Reprojection error: " + std::to_string(reproj_error) + " pixel",
+              cv::Point(20, 20),
+              cv::FONT_HERSHEY_COMPLEX_SMALL,
+              1.0,
+              cv::Scalar(255, 0, 0));
+}
+
+void ReprojectionVideoRenderer::Run(const std::string& video_path,
+                                    const std::string& output_path) {
+  cv::VideoCapture input_video(video_path);
+  if (!input_video.isOpened()) {
+    LOG(ERROR) << "Could not open " << video_path;
+    return;
+  }
+  const double fps = input_video.get(cv::CAP_PROP_FPS);
+  cv::VideoWriter output_video(
+      output_path,
+      cv::VideoWriter::fourcc('m', 'p', '4', 'v'),
+      fps > 0.0 ? fps / frame_stride_ : 30.0,
+      cv::Size(camera_.ImageWidth(), camera_.ImageHeight()));
+  if (!output_video.isOpened()) {
+    LOG(ERROR) << "Could not open " << output_path;
+    return;
+  }
+
+  const size_t queue_size = 2 * num_threads_;
+  utils::BoundedQueue<RenderJob> job_queue(queue_size);
+  utils::BoundedQueue<RenderJob> result_queue(queue_size);
+  // frames handed back by the writer, so the decoder reads into images that
+  // are already allocated
+  utils::BoundedQueue<cv::Mat> free_frames(2 * queue_size + num_threads_);
+
+  // only frames with observations and a spline pose are rendered
+  std::thread decoder([&]() {
+    int nr_failed_reads = 0;
+    int nr_matched = 0;
+    int frame_idx = 0;
+    while (max_frames_ <= 0 || frame_idx < max_frames_) {
+      RenderJob job;
+      free_frames.TryPop(job.image);
+      bool frame_read;
+      {
+        utils::ScopedTimer decode_timer("frame_decode", 1);
+        frame_read = input_video.read(job.image);
+      }
+      if (!frame_read) {
+        if (++nr_failed_reads > 500) break;
+        continue;
+      }
+      job.t_ns = input_video.get(cv::CAP_PROP_POS_MSEC) * MS_TO_S * S_TO_NS;
+      job.observations = FindClosest<FrameObservations>(
+          observations_, job.t_ns, kMaxTimestampDiffNs);
+      job.T_w_c =
+          FindClosest<Sophus::SE3d>(T_w_c_, job.t_ns, kMaxTimestampDiffNs);
+      if (!job.observations || !job.T_w_c) {
+        free_frames.TryPush(std::move(job.image));
+        continue;
+      }
+      if (nr_matched++ % frame_stride_ != 0) {
+        free_frames.TryPush(std::move(job.image));
+        continue;
+      }
+      job.frame_idx = frame_idx++;
+      if (!job_queue.Push(std::move(job))) break;
+    }
+    job_queue.Close();
+  });
+
+  std::vector<std::thread> workers;
+  std::atomic<int> active_workers(num_threads_);
+  for (int t = 0; t < num_threads_; ++t) {
+    workers.emplace_back([&]() {
+      RenderJob job;
+      while (job_queue.Pop(job)) {
+        Render(job);
+        result_queue.Push(std::move(job));
+      }
+      if (--active_workers == 0) {
+        result_queue.Close();
+      }
+    });
+  }
+
+  // write in frame order
+  std::map<int, RenderJob> pending;
+  int next_frame_idx = 0;
+  RenderJob job;
+  while (result_queue.Pop(job)) {
+    pending.emplace(job.frame_idx, std::move(job));
+    while (!pending.empty() && pending.begin()->first == next_frame_idx) {
+      output_video.write(pending.begin()->second.image);
+      free_frames.TryPush(std::move(pending.begin()->second.image));
+      pending.erase(pending.begin());
+      ++next_frame_idx;
+    }
+  }
+
+  decoder.join();
+  for (auto& w : workers) {
+    w.join();
+  }
+  LOG(INFO) << "Rendered " << next_frame_idx << " frames to " << output_path;
+  success_ = true;
+}
+
+}  // namespace core
+}  // namespace OpenICC
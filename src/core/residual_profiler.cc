@@ -0,0 +1,148 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/residual_profiler.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+std::atomic<uint64_t> next_profiler_id{1};
+
+}  // namespace
+
+const char* ResidualProfiler::TypeName(const Type type) {
+  switch (type) {
+    case ACCELEROMETER:
+      return "accelerometer";
+    case GYROSCOPE:
+      return "gyroscope";
+    case IMU:
+      return "imu";
+    case GPS:
+      return "gps";
+    case GS_REPROJECTION:
+      return "gs_reprojection";
+    case RS_REPROJECTION:
+      return "rs_reprojection";
+    case ORIENTATION:
+      return "orientation";
+  }
+  return "unknown";
+}
+
+ResidualProfiler::ResidualProfiler() : id_(next_profiler_id++) {}
+
+ResidualProfiler::ThreadCounters& ResidualProfiler::Local() {
+  // the last profiler this thread recorded to
+  thread_local uint64_t cached_id = 0;
+  thread_local ThreadCounters* cached_counters = nullptr;
+  if (cached_id == id_) {
+    return *cached_counters;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const std::thread::id thread = std::this_thread::get_id();
+  ThreadCounters* counters = nullptr;
+  for (const auto& t : threads_) {
+    if (t->thread == thread) {
+      counters = t.get();
+      break;
+    }
+  }
+  if (!counters) {
+    threads_.emplace_back(new ThreadCounters);
+    counters = threads_.back().get();
+    counters->thread = thread;
+  }
+  cached_id = id_;
+  cached_counters = counters;
+  return *counters;
+}
+
+void ResidualProfiler::Record(const Type type,
+                              const bool jacobians,
+                              const double time_s) {
+  Counter& counter = Local().counters[type];
+  ++counter.evaluations;
+  if (jacobians) {
+    ++counter.jacobian_evaluations;
+  }
+  counter.time_s += time_s;
+}
+
+std::vector<ResidualTypeProfile> ResidualProfiler::Merge() const {
+  std::array<ResidualTypeProfile, kNumTypes> sums;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& t : threads_) {
+    for (int i = 0; i < kNumTypes; ++i) {
+      sums[i].evaluations += t->counters[i].evaluations;
+      sums[i].jacobian_evaluations += t->counters[i].jacobian_evaluations;
+      sums[i].time_s += t->counters[i].time_s;
+    }
+  }
+  std::vector<ResidualTypeProfile> profile;
+  for (int i = 0; i < kNumTypes; ++i) {
+    if (sums[i].evaluations == 0) continue;
+    sums[i].type = TypeName(static_cast<Type>(i));
+    profile.push_back(sums[i]);
+  }
+  return profile;
+}
+
+void ResidualProfiler::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& t : threads_) {
+    t->counters = std::array<Counter, kNumTypes>();
+  }
+}
+
+ProfiledCostFunction::ProfiledCostFunction(ceres::CostFunction* cost_function,
+                                           ResidualProfiler* profiler,
+                                           const ResidualProfiler::Type type)
+    : cost_function_(cost_function), profiler_(profiler), type_(type) {
+  set_num_residuals(cost_function->num_residuals());
+  *mutable_parameter_block_sizes() = cost_function->parameter_block_sizes();
+}
+
+bool ProfiledCostFunction::Evaluate(double const* const* parameters,
+                                    double* residuals,
+                                    double** jacobians) const {
+  const auto start = std::chrono::steady_clock::now();
+  const bool success =
+      cost_function_->Evaluate(parameters, residuals, jacobians);
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  profiler_->Record(type_, jacobians != nullptr, elapsed.count());
+  return success;
+}
+
+void PrintResidualProfile(const std::vector<ResidualTypeProfile>& profile,
+                          std::ostream& os) {
+  for (const ResidualTypeProfile& type : profile) {
+    os << "Residual " << type.type << ": " << type.evaluations
+       << " evaluations (" << type.jacobian_evaluations
+       << " with jacobians) took " << type.time_s << "s, "
+       << 1e6 * type.time_s / static_cast<double>(type.evaluations)
+       << "us per evaluation\n";
+  }
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,117 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/residual_time_index.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+bool EarlierThan(const ResidualTimeIndex::Entry& a,
+                 const ResidualTimeIndex::Entry& b) {
+  return a.time_ns < b.time_ns;
+}
+
+template <class KnotOf>
+ResidualTimeIndex::KnotRange KnotsOf(const ResidualTimeIndex::Range& range,
+                                     const int N,
+                                     const KnotOf& knot_of) {
+  ResidualTimeIndex::KnotRange knots;
+  knots.first = std::numeric_limits<int64_t>::max();
+  knots.last = std::numeric_limits<int64_t>::min();
+  for (const ResidualTimeIndex::Entry& entry : range) {
+    const int64_t s = knot_of(entry);
+    if (s < 0) continue;
+    knots.first = std::min(knots.first, s);
+    knots.last = std::max(knots.last, s + N);
+  }
+  if (knots.empty()) {
+    knots = ResidualTimeIndex::KnotRange();
+  }
+  return knots;
+}
+
+}  // namespace
+
+void ResidualTimeIndex::Add(const Sensor sensor,
+                            const int64_t time_ns,
+                            const ceres::ResidualBlockId id,
+                            const int64_t s_so3,
+                            const int64_t s_r3) {
+  std::vector<Entry>& entries = entries_[sensor];
+  if (!entries.empty() && time_ns < entries.back().time_ns) {
+    sorted_[sensor] = false;
+  }
+  entries.push_back(Entry{time_ns, id, s_so3, s_r3});
+}
+
+void ResidualTimeIndex::Clear() {
+  for (int s = 0; s < kNumSensors; ++s) {
+    entries_[s].clear();
+    sorted_[s] = true;
+  }
+}
+
+void ResidualTimeIndex::Sort(const Sensor sensor) const {
+  if (sorted_[sensor]) return;
+  std::stable_sort(entries_[sensor].begin(),
+                   entries_[sensor].end(),
+                   EarlierThan);
+  sorted_[sensor] = true;
+}
+
+ResidualTimeIndex::Range ResidualTimeIndex::Select(
+    const Sensor sensor,
+    const int64_t start_time_ns,
+    const int64_t end_time_ns) const {
+  Sort(sensor);
+  const std::vector<Entry>& entries = entries_[sensor];
+  Entry start{start_time_ns, nullptr, -1, -1};
+  Entry end{end_time_ns, nullptr, -1, -1};
+  const auto first =
+      std::lower_bound(entries.begin(), entries.end(), start, EarlierThan);
+  const auto last = std::upper_bound(first, entries.end(), end, EarlierThan);
+  return Range{entries.data() + (first - entries.begin()),
+               entries.data() + (last - entries.begin())};
+}
+
+void ResidualTimeIndex::Select(
+    const int64_t start_time_ns,
+    const int64_t end_time_ns,
+    std::vector<ceres::ResidualBlockId>* ids) const {
+  for (int s = 0; s < kNumSensors; ++s) {
+    for (const Entry& entry :
+         Select(static_cast<Sensor>(s), start_time_ns, end_time_ns)) {
+      ids->push_back(entry.id);
+    }
+  }
+}
+
+ResidualTimeIndex::KnotRange ResidualTimeIndex::SO3Knots(const Range& range,
+                                                         const int N) {
+  return KnotsOf(range, N, [](const Entry& e) { return e.s_so3; });
+}
+
+ResidualTimeIndex::KnotRange ResidualTimeIndex::R3Knots(const Range& range,
+                                                        const int N) {
+  return KnotsOf(range, N, [](const Entry& e) { return e.s_r3; });
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,105 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/solver_log.h"
+
+#include <algorithm>
+
+namespace OpenICC {
+namespace core {
+
+ceres::CallbackReturnType SolverIterationRecorder::operator()(
+    const ceres::IterationSummary& summary) {
+  SolverIterationLog log;
+  log.iteration = summary.iteration;
+  log.cost = summary.cost;
+  log.cost_change = summary.cost_change;
+  log.gradient_norm = summary.gradient_norm;
+  log.gradient_max_norm = summary.gradient_max_norm;
+  log.step_norm = summary.step_norm;
+  log.step_is_successful = summary.step_is_successful;
+  log.linear_solver_iterations = summary.linear_solver_iterations;
+  log.iteration_time_s = summary.iteration_time_in_seconds;
+  log.linear_solver_time_s = summary.step_solver_time_in_seconds;
+  log.evaluation_time_s =
+      std::max(0.0, log.iteration_time_s - log.linear_solver_time_s);
+  log.cumulative_time_s = summary.cumulative_time_in_seconds;
+  iterations_.push_back(log);
+  return ceres::SOLVER_CONTINUE;
+}
+
+SolverRunLog MakeSolverRunLog(const std::string& solver,
+                              const SolverIterationRecorder& recorder,
+                              const ceres::Solver::Summary& summary) {
+  SolverRunLog run;
+  run.solver = solver;
+  run.iterations = recorder.Iterations();
+  run.initial_cost = summary.initial_cost;
+  run.final_cost = summary.final_cost;
+  run.total_time_s = summary.total_time_in_seconds;
+  run.residual_evaluation_time_s = summary.residual_evaluation_time_in_seconds;
+  run.jacobian_evaluation_time_s = summary.jacobian_evaluation_time_in_seconds;
+  run.linear_solver_time_s = summary.linear_solver_time_in_seconds;
+  run.termination = ceres::TerminationTypeToString(summary.termination_type);
+  return run;
+}
+
+nlohmann::json SolverLogToJson(const std::vector<SolverRunLog>& runs) {
+  nlohmann::json runs_json = nlohmann::json::array();
+  for (const SolverRunLog& run : runs) {
+    nlohmann::json run_json;
+    run_json["solver"] = run.solver;
+    run_json["initial_cost"] = run.initial_cost;
+    run_json["final_cost"] = run.final_cost;
+    run_json["total_time_s"] = run.total_time_s;
+    run_json["residual_evaluation_time_s"] = run.residual_evaluation_time_s;
+    run_json["jacobian_evaluation_time_s"] = run.jacobian_evaluation_time_s;
+    run_json["linear_solver_time_s"] = run.linear_solver_time_s;
+    run_json["termination"] = run.termination;
+    run_json["iterations"] = nlohmann::json::array();
+    for (const SolverIterationLog& it : run.iterations) {
+      nlohmann::json it_json;
+      it_json["iteration"] = it.iteration;
+      it_json["cost"] = it.cost;
+      it_json["cost_change"] = it.cost_change;
+      it_json["gradient_norm"] = it.gradient_norm;
+      it_json["gradient_max_norm"] = it.gradient_max_norm;
+      it_json["step_norm"] = it.step_norm;
+      it_json["step_is_successful"] = it.step_is_successful;
+      it_json["linear_solver_iterations"] = it.linear_solver_iterations;
+      it_json["iteration_time_s"] = it.iteration_time_s;
+      it_json["linear_solver_time_s"] = it.linear_solver_time_s;
+      it_json["evaluation_time_s"] = it.evaluation_time_s;
+      it_json["cumulative_time_s"] = it.cumulative_time_s;
+      run_json["iterations"].push_back(it_json);
+    }
+    if (!run.residual_profile.empty()) {
+      run_json["residual_profile"] = nlohmann::json::array();
+      for (const ResidualTypeProfile& type : run.residual_profile) {
+        nlohmann::json type_json;
+        type_json["type"] = type.type;
+        type_json["evaluations"] = type.evaluations;
+        type_json["jacobian_evaluations"] = type.jacobian_evaluations;
+        type_json["time_s"] = type.time_s;
+        run_json["residual_profile"].push_back(type_json);
+      }
+    }
+    runs_json.push_back(run_json);
+  }
+  return runs_json;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,215 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/spline_error_weighting.h"
+
+#include <glog/logging.h>
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+//! Squared reference spectrum of a 3 axis signal (make_reference_spectrum)
+//! and the absolute frequencies of its bins
+class ReferenceSpectrum {
+ public:
+  ReferenceSpectrum(const vec3_vector& signal, const double sample_rate)
+      : energy2_(signal.size(), 0.0), abs_freqs_(signal.size()) {
+    const int n = static_cast<int>(signal.size());
+    cv::Mat axis(1, n, CV_64F), spectrum;
+    for (int a = 0; a < 3; ++a) {
+      for (int i = 0; i < n; ++i) {
+        axis.at<double>(i) = signal[i][a];
+      }
+      cv::dft(axis, spectrum, cv::DFT_COMPLEX_OUTPUT);
+      for (int k = 0; k < n; ++k) {
+        const cv::Vec2d& s = spectrum.at<cv::Vec2d>(k);
+        energy2_[k] += (s[0] * s[0] + s[1] * s[1]) / 3.0;
+      }
+    }
+    // remove the DC component
+    energy2_[0] = 0.0;
+    // numpy.fft.fftfreq, the spline response only depends on |f|
+    for (int k = 0; k < n; ++k) {
+      abs_freqs_[k] = std::min(k, n - k) * sample_rate / n;
+    }
+  }
+
+  //! signal_energy(spectrum) = sum |spectrum|^2 / n
+  double Energy() const {
+    double energy = 0.0;
+    for (const double e2 : energy2_) {
+      energy += e2;
+    }
+    return energy / energy2_.size();
+  }
+
+  //! Energy of the part of the spectrum a spline with knot spacing dt_s
+  //! removes, signal_energy((1 - H) * Xhat)
+  double RemovedEnergy(const double dt_s) const {
+    double energy = 0.0;
+    for (size_t k = 0; k < energy2_.size(); ++k) {
+      const double h = 1.0 - SplineResponse(abs_freqs_[k] * dt_s);
+      energy += h * h * energy2_[k];
+    }
+    return energy / energy2_.size();
+  }
+
+  size_t size() const { return energy2_.size(); }
+
+ private:
+  //! Normalized cubic B-spline interpolation response at frequency f * dt
+  //! (Mihajlovic et al. 1999)
+  static double SplineResponse(const double f_dt) {
+    double sinc = 1.0;
+    if (f_dt != 0.0) {
+      sinc = std::sin(M_PI * f_dt) / (M_PI * f_dt);
+    }
+    const double sinc2 = sinc * sinc;
+    return 3.0 * sinc2 * sinc2 / (2.0 + std::cos(2.0 * M_PI * f_dt));
+  }
+
+  std::vector<double> energy2_;
+  std::vector<double> abs_freqs_;
+};
+
+//! find_max_quality_dt of sew.py. The final root search uses bisection
+//! instead of Brent's method.
+double FindMaxQualityDt(const ReferenceSpectrum& spectrum,
+                        const double quality,
+                        const double min_dt_s,
+                        const double max_dt_s) {
+  const double max_remove = spectrum.Energy() * (1.0 - quality);
+  auto quality_func = [&](const double dt) {
+    const double removed = spectrum.RemovedEnergy(dt);
+    if (removed <= 0.0) {
+      return std::numeric_limits<double>::max();
+    }
+    return max_remove / removed;
+  };
+
+  double dt = max_dt_s;
+  if (quality_func(dt) >= 1.0) {
+    return dt;
+  }
+
+  // backtrack until the quality is reached
+  double step = max_dt_s * 0.5;
+  double max_quality = 0.0;
+  double max_quality_dt = min_dt_s;
+  while (true) {
+    dt = std::max(dt - step, min_dt_s);
+    const double q = quality_func(dt);
+    if (q > 1.0) {
+      break;
+    }
+    step *= 0.5;
+    if (q > max_quality) {
+      max_quality = q;
+      max_quality_dt = dt;
+    }
+    if (dt <= min_dt_s) {
+      LOG(WARNING) << "No knot spacing reaches quality " << quality
+                   << ", returning the best: " << max_quality_dt << "s";
+      return max_quality_dt;
+    }
+  }
+
+  // quality_func(lower) > 1 >= quality_func(upper)
+  double lower = dt, upper = max_dt_s;
+  while (upper - lower > 1e-9) {
+    const double mid = 0.5 * (lower + upper);
+    if (quality_func(mid) > 1.0) {
+      lower = mid;
+    } else {
+      upper = mid;
+    }
+  }
+  return 0.5 * (lower + upper);
+}
+
+}  // namespace
+
+bool KnotSpacingAndVariance(const vec3_vector& signal,
+                            const std::vector<double>& times_s,
+                            const double quality,
+                            const double min_dt_s,
+                            const double max_dt_s,
+                            double& dt_s,
+                            double& variance) {
+  if (signal.size() < 2 || signal.size() != times_s.size() ||
+      times_s.back() <= times_s.front()) {
+    LOG(ERROR) << "Spline error weighting needs at least two sorted samples.";
+    return false;
+  }
+  const double sample_rate =
+      (times_s.size() - 1) / (times_s.back() - times_s.front());
+  const ReferenceSpectrum spectrum(signal, sample_rate);
+  dt_s = FindMaxQualityDt(spectrum, quality, min_dt_s, max_dt_s);
+  variance = spectrum.RemovedEnergy(dt_s) / spectrum.size();
+  return true;
+}
+
+bool ComputeSplineErrorWeighting(
+    const CameraTelemetryData& telemetry_data,
+    const SplineErrorWeightingOptions& options,
+    SplineWeightingData& spline_weighting) {
+  const size_t nr_samples = std::min(telemetry_data.accelerometer.size(),
+                                     telemetry_data.gyroscope.size());
+  std::vector<double> times_s(nr_samples);
+  vec3_vector accl(nr_samples), gyro(nr_samples);
+  for (size_t i = 0; i < nr_samples; ++i) {
+    times_s[i] = telemetry_data.accelerometer[i].timestamp_s();
+    accl[i] = telemetry_data.accelerometer[i].data();
+    gyro[i] = telemetry_data.gyroscope[i].data();
+  }
+
+  double var_r3, var_so3;
+  if (!KnotSpacingAndVariance(accl,
+                              times_s,
+                              options.quality_r3,
+                              options.min_dt_r3,
+                              options.max_dt_r3,
+                              spline_weighting.dt_r3,
+                              var_r3) ||
+      !KnotSpacingAndVariance(gyro,
+                              times_s,
+                              options.quality_so3,
+                              options.min_dt_so3,
+                              options.max_dt_so3,
+                              spline_weighting.dt_so3,
+                              var_so3)) {
+    return false;
+  }
+  spline_weighting.std_r3 = std::sqrt(var_r3);
+  spline_weighting.std_so3 = std::sqrt(var_so3);
+  spline_weighting.cam_fps = options.camera_fps;
+
+  LOG(INFO) << "Knot spacing SO3: " << spline_weighting.dt_so3
+            << "s, R3: " << spline_weighting.dt_r3
+            << "s. Weighting factor gyroscope: "
+            << 1. / spline_weighting.std_so3
+            << ", accelerometer: " << 1. / spline_weighting.std_r3;
+  return true;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,102 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/spline_parameter_arena.h"
+
+#include <algorithm>
+
+namespace OpenICC {
+namespace core {
+
+void SplineParameterArena::SetSpacing(const Spline spline,
+                                      const int64_t dt_ns) {
+  if (dt_ns_[spline] == dt_ns) {
+    return;
+  }
+  dt_ns_[spline] = dt_ns;
+  std::array<size_t, kNumSplines> nr_knots;
+  for (int s = 0; s < kNumSplines; ++s) {
+    nr_knots[s] = offsets_[s].size();
+  }
+  Relayout(nr_knots);
+}
+
+void SplineParameterArena::Resize(const Spline spline,
+                                  const size_t nr_knots) {
+  if (offsets_[spline].size() == nr_knots) {
+    return;
+  }
+  std::array<size_t, kNumSplines> sizes;
+  for (int s = 0; s < kNumSplines; ++s) {
+    sizes[s] = offsets_[s].size();
+  }
+  sizes[spline] = nr_knots;
+  Relayout(sizes);
+}
+
+bool SplineParameterArena::CopyValues(const SplineParameterArena& other) {
+  if (!SameLayout(other)) {
+    return false;
+  }
+  std::copy(other.lines_.begin(), other.lines_.end(), lines_.begin());
+  return true;
+}
+
+void SplineParameterArena::Relayout(
+    const std::array<size_t, kNumSplines>& nr_knots) {
+  // knot i of a spline starts at i * dt, ties go to the lower spline
+  std::array<std::vector<size_t>, kNumSplines> offsets;
+  std::array<size_t, kNumSplines> next{};
+  size_t nr_blocks = 0;
+  for (int s = 0; s < kNumSplines; ++s) {
+    offsets[s].resize(nr_knots[s]);
+    nr_blocks += nr_knots[s];
+  }
+  auto next_knot_time = [&](const int s) {
+    return static_cast<int64_t>(next[s]) * dt_ns_[s];
+  };
+  for (size_t b = 0; b < nr_blocks; ++b) {
+    int first = -1;
+    for (int s = 0; s < kNumSplines; ++s) {
+      if (next[s] < nr_knots[s] &&
+          (first < 0 || next_knot_time(s) < next_knot_time(first))) {
+        first = s;
+      }
+    }
+    offsets[first][next[first]++] = b * kBlockSize;
+  }
+
+  const size_t nr_doubles_per_line = sizeof(CacheLine) / sizeof(double);
+  std::vector<CacheLine> lines(
+      (nr_blocks * kBlockSize + nr_doubles_per_line - 1) /
+      nr_doubles_per_line);
+  double* data = reinterpret_cast<double*>(lines.data());
+  for (int s = 0; s < kNumSplines; ++s) {
+    for (size_t i = 0; i < nr_knots[s]; ++i) {
+      double* block = data + offsets[s][i];
+      if (i < offsets_[s].size()) {
+        std::copy_n(Block(static_cast<Spline>(s), i), kBlockSize, block);
+      } else if (s == SO3) {
+        // identity quaternion, x y z w
+        block[3] = 1.0;
+      }
+    }
+  }
+  lines_.swap(lines);
+  offsets_.swap(offsets);
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -0,0 +1,27 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/spline_trajectory_estimator.h"
+
+namespace OpenICC {
+namespace core {
+
+// the spline orders selectable at runtime, see ImuCameraCalibratorT
+template class SplineTrajectoryEstimator<4>;
+template class SplineTrajectoryEstimator<5>;
+template class SplineTrajectoryEstimator<6>;
+
+}  // namespace core
+}  // namespace OpenICC
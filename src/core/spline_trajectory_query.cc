@@ -0,0 +1,247 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/core/spline_trajectory_query.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+
+#include "OpenCameraCalibrator/basalt_spline/ceres_calib_split_residuals.h"
+#include "OpenCameraCalibrator/basalt_spline/ceres_spline_helper.h"
+#include "OpenCameraCalibrator/io/spline_snapshot.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+
+namespace OpenICC {
+namespace core {
+
+namespace {
+
+// spline orders the query is compiled for, the same as the estimator
+const int kMinSplineOrder = 4;
+const int kMaxSplineOrder = 6;
+
+}  // namespace
+
+bool SplineTrajectoryQuery::Init(const SplineSnapshot& snapshot) {
+  const int N = snapshot.spline_order;
+  if (N < kMinSplineOrder || N > kMaxSplineOrder) {
+    std::cerr << "Spline order " << N << " is not supported.\n";
+    return false;
+  }
+  if (snapshot.so3_knots.size() < static_cast<size_t>(N) ||
+      snapshot.r3_knots.size() < static_cast<size_t>(N) ||
+      snapshot.dt_so3_ns <= 0 || snapshot.dt_r3_ns <= 0) {
+    std::cerr << "Spline snapshot has no valid knot grid.\n";
+    return false;
+  }
+  snapshot_ = snapshot;
+  return true;
+}
+
+bool SplineTrajectoryQuery::Load(const std::string& path_to_snapshot) {
+  SplineSnapshot snapshot;
+  if (!io::ReadSplineSnapshot(path_to_snapshot, snapshot)) {
+    return false;
+  }
+  return Init(snapshot);
+}
+
+bool SplineTrajectoryQuery::CalcTimes(const int64_t time_ns,
+                                      const int64_t dt_ns,
+                                      const size_t nr_knots,
+                                      const int N,
+                                      double& u,
+                                      int64_t& s) const {
+  const int64_t st_ns = time_ns - snapshot_.start_t_ns;
+  if (st_ns < 0 || dt_ns <= 0) {
+    return false;
+  }
+  s = st_ns / dt_ns;
+  if (static_cast<size_t>(s + N) > nr_knots) {
+    return false;
+  }
+  u = double(st_ns % dt_ns) / double(dt_ns);
+  return true;
+}
+
+template <int _N>
+void SplineTrajectoryQuery::EvaluateRange(const int64_t* times_ns,
+                                          const size_t nr_times,
+                                          TrajectorySample* samples) const {
+  using Helper = CeresSplineHelper<double, _N>;
+  using BiasHelper = CeresSplineHelper<double, BIAS_SPLINE_N>;
+  const int DEG = _N - 1;
+  const double inv_so3_dt = S_TO_NS / snapshot_.dt_so3_ns;
+  const double inv_r3_dt = S_TO_NS / snapshot_.dt_r3_ns;
+
+  auto eval_bias = [&](const int64_t t_ns,
+                       const int64_t dt_ns,
+                       const vec3_vector& knots,
+                       Eigen::Vector3d& bias) {
+    bias.setZero();
+    double u;
+    int64_t s;
+    if (!CalcTimes(t_ns, dt_ns, knots.size(), BIAS_SPLINE_N, u, s)) {
+      return;
+    }
+    std::array<const double*, BIAS_SPLINE_N> ptrs;
+    for (int k = 0; k < BIAS_SPLINE_N; ++k) {
+      ptrs[k] = knots[s + k].data();
+    }
+    BiasHelper::template evaluate<3, 0>(
+        ptrs.data(), u, S_TO_NS / dt_ns, &bias);
+  };
+
+  // increments of the last SO3 segment
+  int64_t cached_s_so3 = -1;
+  Sophus::SO3d so3_p00;
+  std::array<Eigen::Vector3d, DEG> so3_deltas;
+
+  for (size_t i = 0; i < nr_times; ++i) {
+    TrajectorySample& sample = samples[i];
+    sample = TrajectorySample();
+    double u_so3, u_r3;
+    int64_t s_so3, s_r3;
+    if (!CalcTimes(times_ns[i],
+                   snapshot_.dt_so3_ns,
+                   snapshot_.so3_knots.size(),
+                   _N,
+                   u_so3,
+                   s_so3) ||
+        !CalcTimes(times_ns[i],
+                   snapshot_.dt_r3_ns,
+                   snapshot_.r3_knots.size(),
+                   _N,
+                   u_r3,
+                   s_r3)) {
+      continue;
+    }
+    sample.valid = true;
+
+    if (s_so3 != cached_s_so3) {
+      so3_p00 = snapshot_.so3_knots[s_so3];
+      for (int k = 0; k < DEG; ++k) {
+        so3_deltas[k] = (snapshot_.so3_knots[s_so3 + k].inverse() *
+                         snapshot_.so3_knots[s_so3 + k + 1])
+                            .log();
+      }
+      cached_s_so3 = s_so3;
+    }
+    const typename Helper::VecN so3_coeff =
+        Helper::template coeffs<0, true>(u_so3, inv_so3_dt);
+    const typename Helper::VecN so3_dcoeff =
+        Helper::template coeffs<1, true>(u_so3, inv_so3_dt);
+    Sophus::SO3d rot;
+    Helper::template evaluate_lie_deltas<Sophus::SO3>(
+        so3_p00,
+        so3_deltas.data(),
+        so3_coeff,
+        &so3_dcoeff,
+        nullptr,
+        nullptr,
+        &rot,
+        &sample.angular_velocity);
+
+    std::array<const double*, _N> r3_ptrs;
+    for (int k = 0; k < _N; ++k) {
+      r3_ptrs[k] = snapshot_.r3_knots[s_r3 + k].data();
+    }
+    Eigen::Vector3d position, accel_world;
+    Helper::template evaluate_coeffs<3>(
+        r3_ptrs.data(),
+        Helper::template coeffs<0, false>(u_r3, inv_r3_dt),
+        &position);
+    Helper::template evaluate_coeffs<3>(
+        r3_ptrs.data(),
+        Helper::template coeffs<1, false>(u_r3, inv_r3_dt),
+        &sample.velocity);
+    Helper::template evaluate_coeffs<3>(
+        r3_ptrs.data(),
+        Helper::template coeffs<2, false>(u_r3, inv_r3_dt),
+        &accel_world);
+
+    sample.pose = Sophus::SE3d(rot, position);
+    sample.acceleration = rot.inverse() * (accel_world + snapshot_.gravity);
+    eval_bias(times_ns[i],
+              snapshot_.dt_gyro_bias_ns,
+              snapshot_.gyro_bias_knots,
+              sample.gyro_bias);
+    eval_bias(times_ns[i],
+              snapshot_.dt_accl_bias_ns,
+              snapshot_.accl_bias_knots,
+              sample.accl_bias);
+  }
+}
+
+bool SplineTrajectoryQuery::Evaluate(const int64_t time_ns,
+                                     TrajectorySample& sample) const {
+  switch (snapshot_.spline_order) {
+    case 4:
+      EvaluateRange<4>(&time_ns, 1, &sample);
+      break;
+    case 5:
+      EvaluateRange<5>(&time_ns, 1, &sample);
+      break;
+    case 6:
+      EvaluateRange<6>(&time_ns, 1, &sample);
+      break;
+    default:
+      sample = TrajectorySample();
+  }
+  return sample.valid;
+}
+
+void SplineTrajectoryQuery::Evaluate(const std::vector<int64_t>& times_ns,
+                                     aligned_vector<TrajectorySample>& samples,
+                                     const int num_threads) const {
+  samples.resize(times_ns.size());
+
+  const int kChunkSize = 1024;
+  const int nr_chunks = (times_ns.size() + kChunkSize - 1) / kChunkSize;
+  utils::ParallelFor(0, nr_chunks, num_threads, [&](const int chunk) {
+    const size_t begin = static_cast<size_t>(chunk) * kChunkSize;
+    const size_t nr_times =
+        std::min(times_ns.size() - begin, static_cast<size_t>(kChunkSize));
+    switch (snapshot_.spline_order) {
+      case 4:
+        EvaluateRange<4>(&times_ns[begin], nr_times, &samples[begin]);
+        break;
+      case 5:
+        EvaluateRange<5>(&times_ns[begin], nr_times, &samples[begin]);
+        break;
+      case 6:
+        EvaluateRange<6>(&times_ns[begin], nr_times, &samples[begin]);
+        break;
+      default:
+        std::fill(samples.begin() + begin,
+                  samples.begin() + begin + nr_times,
+                  TrajectorySample());
+    }
+  });
+}
+
+bool SplineTrajectoryQuery::CameraPose(const int64_t time_ns,
+                                       Sophus::SE3d& T_w_c) const {
+  TrajectorySample sample;
+  if (!Evaluate(time_ns, sample)) {
+    return false;
+  }
+  T_w_c = sample.pose * snapshot_.T_i_c;
+  return true;
+}
+
+}  // namespace core
+}  // namespace OpenICC
@@ -1,9 +1,11 @@
 #include "OpenCameraCalibrator/core/static_imu_calibrator.h"
 #include "OpenCameraCalibrator/utils/gyro_integration.h"
 #include "OpenCameraCalibrator/utils/imu_data_interval.h"
+#include "OpenCameraCalibrator/utils/parallel_for.h"
 
 #include "ceres/ceres.h"
 #include <glog/logging.h>
+#include <algorithm>
 #include <iostream>
 #include <limits>
 
@@ -47,9 +49,77 @@ StaticImuCalibrator::StaticImuCalibrator()
       init_interval_duration_(30.0),
       interval_n_samples_(100),
       acc_use_means_(false),
+      acc_means_sample_limit_(0),
       gyro_dt_(-1.0),
       optimize_gyro_bias_(false),
-      verbose_output_(true) {}
+      verbose_output_(true),
+      num_threads_(1) {}
+
+void StaticImuCalibrator::CalibrateAccThreshold(
+    const ImuReadings& acc_samples,
+    const double threshold,
+    ThresholdCalibration* calibration) const {
+  ImuReadings static_samples;
+  std::vector<double>& acc_calib_params = calibration->calib_params;
+  acc_calib_params.resize(9);
+
+  acc_calib_params[0] = init_acc_calib_.misYZ();
+  acc_calib_params[1] = init_acc_calib_.misZY();
+  acc_calib_params[2] = init_acc_calib_.misZX();
+
+  acc_calib_params[3] = init_acc_calib_.scaleX();
+  acc_calib_params[4] = init_acc_calib_.scaleY();
+  acc_calib_params[5] = init_acc_calib_.scaleZ();
+
+  acc_calib_params[6] = init_acc_calib_.biasX();
+  acc_calib_params[7] = init_acc_calib_.biasY();
+  acc_calib_params[8] = init_acc_calib_.biasZ();
+
+  std::vector<DataInterval> extracted_intervals;
+  StaticIntervalsDetector(
+      acc_variance_norms_, threshold, calibration->static_intervals);
+  // Every static sample is one residual, fall back to the interval means if
+  // the problem would get too large
+  const size_t nr_samples =
+      calibration->static_intervals.size() * interval_n_samples_;
+  const bool use_means =
+      acc_use_means_ ||
+      (acc_means_sample_limit_ > 0 && nr_samples > acc_means_sample_limit_);
+  ExtractIntervalsSamples(acc_samples,
+                          calibration->static_intervals,
+                          static_samples,
+                          extracted_intervals,
+                          interval_n_samples_,
+                          use_means);
+  calibration->nr_extracted_intervals = extracted_intervals.size();
+  if (extracted_intervals.size() < min_num_intervals_) {
+    calibration->valid = false;
+    return;
+  }
+
+  ceres::Problem problem;
+  for (int i = 0; i < static_samples.size(); i++) {
+    ceres::CostFunction* cost_function =
+        MultiPosAccResidual::Create(g_mag_, static_samples[i].data());
+
+    problem.AddResidualBlock(
+        cost_function, NULL /* squared loss */, acc_calib_params.data());
+  }
+
+  // A single 9 parameter block and thousands of residuals: forming the 9x9
+  // normal equations is much cheaper than a QR of the full jacobian. The
+  // threads left over by the concurrent threshold solves evaluate residuals.
+  ceres::Solver::Options options;
+  options.linear_solver_type = ceres::DENSE_NORMAL_CHOLESKY;
+  options.num_threads = std::max(1, num_threads_ / kNumThresholdMultipliers);
+  // progress of concurrent solves would interleave
+  options.minimizer_progress_to_stdout = verbose_output_ && num_threads_ == 1;
+
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &problem, &summary);
+  calibration->cost = summary.final_cost;
+  calibration->valid = true;
+}
 
 bool StaticImuCalibrator::CalibrateAcc(const ImuReadings& acc_samples) {
   std::cout << "Accelerometers calibration: calibrating...";
@@ -72,71 +142,43 @@ bool StaticImuCalibrator::CalibrateAcc(const ImuReadings& acc_samples) {
   Vector3d acc_variance = DataVariance(acc_samples, init_static_interval);
   double norm_th = acc_variance.norm();
 
+  // Only the threshold changes below, so the local variance is computed once
+  LocalVarianceMagnitudes(acc_samples, acc_variance_norms_);
+
+  // Every threshold multiplier is an independent calibration with its own
+  // problem, so they run in parallel. The reduction below is serial and in
+  // th_mult order, which keeps the result independent of the thread count.
+  const int num_th_mults = kNumThresholdMultipliers;
+  std::vector<ThresholdCalibration> calibrations(num_th_mults);
+  utils::ParallelFor(0, num_th_mults, num_threads_, [&](const int i) {
+    CalibrateAccThreshold(acc_samples, (i + 1) * norm_th, &calibrations[i]);
+  });
+
   double min_cost = std::numeric_limits<double>::max();
   int min_cost_th = -1;
   std::vector<double> min_cost_calib_params;
-
-  for (int th_mult = 1; th_mult <= 10; th_mult++) {
-    std::vector<DataInterval> static_intervals;
-    ImuReadings static_samples;
-    std::vector<double> acc_calib_params(9);
-
-    acc_calib_params[0] = init_acc_calib_.misYZ();
-    acc_calib_params[1] = init_acc_calib_.misZY();
-    acc_calib_params[2] = init_acc_calib_.misZX();
-
-    acc_calib_params[3] = init_acc_calib_.scaleX();
-    acc_calib_params[4] = init_acc_calib_.scaleY();
-    acc_calib_params[5] = init_acc_calib_.scaleZ();
-
-    acc_calib_params[6] = init_acc_calib_.biasX();
-    acc_calib_params[7] = init_acc_calib_.biasY();
-    acc_calib_params[8] = init_acc_calib_.biasZ();
-
-    std::vector<DataInterval> extracted_intervals;
-    StaticIntervalsDetector(acc_samples, th_mult * norm_th, static_intervals);
-    ExtractIntervalsSamples(acc_samples,
-                            static_intervals,
-                            static_samples,
-                            extracted_intervals,
-                            interval_n_samples_,
-                            acc_use_means_);
-
+  for (int i = 0; i < num_th_mults; ++i) {
+    const ThresholdCalibration& calibration = calibrations[i];
+    const int th_mult = i + 1;
     if (verbose_output_) {
       std::cout << "Accelerometers calibration: extracted "
-                << extracted_intervals.size()
+                << calibration.nr_extracted_intervals
                 << " intervals using threshold multiplier " << th_mult
                 << " -> ";
     }
     // TODO Perform here a quality test
-    if (extracted_intervals.size() < min_num_intervals_) {
+    if (!calibration.valid) {
       if (verbose_output_)
         std::cout << "Not enough intervals, calibration is not possible";
       continue;
     }
-
-    ceres::Problem problem;
-    for (int i = 0; i < static_samples.size(); i++) {
-      ceres::CostFunction* cost_function =
-          MultiPosAccResidual::Create(g_mag_, static_samples[i].data());
-
-      problem.AddResidualBlock(
-          cost_function, NULL /* squared loss */, acc_calib_params.data());
-    }
-
-    ceres::Solver::Options options;
-    options.linear_solver_type = ceres::DENSE_QR;
-    options.minimizer_progress_to_stdout = verbose_output_;
-
-    ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
-    if (summary.final_cost < min_cost) {
-      min_cost = summary.final_cost;
+    if (calibration.cost < min_cost) {
+      min_cost = calibration.cost;
       min_cost_th = th_mult;
-      min_cost_static_intervals_ = static_intervals;
-      min_cost_calib_params = acc_calib_params;
+      min_cost_static_intervals_ = calibration.static_intervals;
+      min_cost_calib_params = calibration.calib_params;
     }
-    std::cout << "Accelerometer residual " << summary.final_cost << "\n";
+    std::cout << "Accelerometer residual " << calibration.cost << "\n";
   }
 
   if (min_cost_th < 0) {
@@ -279,20 +321,28 @@ bool StaticImuCalibrator::CalibrateAccGyro(const ImuReadings& acc_samples,
     DataInterval gyro_interval(gyro_idx0, gyro_idx1);
 
     ceres::CostFunction* cost_function =
-        MultiPosGyroResidual::Create(g_versor_pos0,
-                                     g_versor_pos1,
-                                     calib_gyro_samples_,
-                                     gyro_interval,
-                                     gyro_dt_,
-                                     optimize_gyro_bias_);
+        optimize_gyro_bias_
+            ? MultiPosGyroAnalyticResidual<12>::Create(g_versor_pos0,
+                                                       g_versor_pos1,
+                                                       calib_gyro_samples_,
+                                                       gyro_interval,
+                                                       gyro_dt_)
+            : MultiPosGyroAnalyticResidual<9>::Create(g_versor_pos0,
+                                                      g_versor_pos1,
+                                                      calib_gyro_samples_,
+                                                      gyro_interval,
+                                                      gyro_dt_);
 
     problem.AddResidualBlock(
         cost_function, NULL /* squared loss */, gyro_calib_params.data());
   }
 
   ceres::Solver::Options options;
-  options.linear_solver_type = ceres::DENSE_QR;
+  options.linear_solver_type = ceres::DENSE_NORMAL_CHOLESKY;
   options.minimizer_progress_to_stdout = verbose_output_;
+  // every interval between two static positions is one residual block, they
+  // are integrated concurrently
+  options.num_threads = num_threads_;
 
   ceres::Solver::Summary summary;
 
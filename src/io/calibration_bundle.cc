@@ -0,0 +1,275 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/calibration_bundle.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "OpenCameraCalibrator/io/read_camera_calibration.h"
+#include "OpenCameraCalibrator/io/read_misc.h"
+#include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+bool RecordNameLess(const CalibrationRecord& a, const CalibrationRecord& b) {
+  return std::strncmp(a.device_name,
+                      b.device_name,
+                      CALIBRATION_MAX_DEVICE_NAME) < 0;
+}
+}  // namespace
+
+bool WriteCalibrationBundle(const std::string& output_path,
+                            std::vector<CalibrationRecord> records) {
+  OPENICC_TRACE_ZONE("calibration_bundle_write");
+  std::sort(records.begin(), records.end(), RecordNameLess);
+  for (size_t i = 1; i < records.size(); ++i) {
+    if (!RecordNameLess(records[i - 1], records[i])) {
+      std::cerr << "Device " << records[i].device_name
+                << " is in the bundle twice.\n";
+      return false;
+    }
+  }
+  std::ofstream out(output_path, std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "Could not open: " << output_path << "\n";
+    return false;
+  }
+  CalibrationBundleHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CALIBRATION_BUNDLE_MAGIC, sizeof(header.magic));
+  header.version = CALIBRATION_BUNDLE_VERSION;
+  header.record_size = sizeof(CalibrationRecord);
+  header.num_records = records.size();
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(records.data()),
+            records.size() * sizeof(CalibrationRecord));
+  out.close();
+  return !out.fail();
+}
+
+MappedCalibrationBundle::~MappedCalibrationBundle() { Close(); }
+
+bool MappedCalibrationBundle::Open(const std::string& path) {
+  OPENICC_TRACE_ZONE("calibration_bundle_open");
+  Close();
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Can not open " << path << "\n";
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      file_stat.st_size < (off_t)sizeof(CalibrationBundleHeader)) {
+    std::cerr << "Not a calibration bundle: " << path << "\n";
+    close(fd);
+    return false;
+  }
+  size_ = file_stat.st_size;
+  data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    std::cerr << "Can not map " << path << "\n";
+    data_ = nullptr;
+    size_ = 0;
+    return false;
+  }
+
+  const char* base = static_cast<const char*>(data_);
+  header_ = reinterpret_cast<const CalibrationBundleHeader*>(base);
+  if (std::memcmp(header_->magic, CALIBRATION_BUNDLE_MAGIC, 8) != 0 ||
+      header_->version != CALIBRATION_BUNDLE_VERSION ||
+      header_->record_size != sizeof(CalibrationRecord)) {
+    std::cerr << "Wrong calibration bundle magic or version in " << path
+              << "\n";
+    Close();
+    return false;
+  }
+  if (sizeof(CalibrationBundleHeader) +
+          header_->num_records * sizeof(CalibrationRecord) >
+      size_) {
+    std::cerr << "Truncated calibration bundle " << path << "\n";
+    Close();
+    return false;
+  }
+  records_ = reinterpret_cast<const CalibrationRecord*>(
+      base + sizeof(CalibrationBundleHeader));
+  return true;
+}
+
+void MappedCalibrationBundle::Close() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+  records_ = nullptr;
+}
+
+const CalibrationRecord* MappedCalibrationBundle::Find(
+    const std::string& device_name) const {
+  if (device_name.size() >= CALIBRATION_MAX_DEVICE_NAME) {
+    return nullptr;
+  }
+  CalibrationRecord key;
+  std::memset(key.device_name, 0, sizeof(key.device_name));
+  std::memcpy(key.device_name, device_name.data(), device_name.size());
+  const CalibrationRecord* end = records_ + NumRecords();
+  const CalibrationRecord* it =
+      std::lower_bound(records_, end, key, RecordNameLess);
+  if (it == end || RecordNameLess(key, *it)) {
+    return nullptr;
+  }
+  return it;
+}
+
+void InitCalibrationRecord(const std::string& device_name,
+                           CalibrationRecord& record) {
+  std::memset(&record, 0, sizeof(record));
+  std::strncpy(record.device_name,
+               device_name.c_str(),
+               CALIBRATION_MAX_DEVICE_NAME - 1);
+  const ThreeAxisSensorCalibParamsd identity;
+  SetRecordImuIntrinsics(identity, identity, record);
+  // identity quaternion
+  record.T_i_c[3] = 1.0;
+}
+
+void SetRecordCamera(const theia::Camera& camera,
+                     const double fps,
+                     CalibrationRecord& record) {
+  record.camera_model =
+      static_cast<int32_t>(camera.GetCameraIntrinsicsModelType());
+  record.image_width = camera.ImageWidth();
+  record.image_height = camera.ImageHeight();
+  record.fps = fps;
+  const int num_intrinsics =
+      std::min(camera.CameraIntrinsics()->NumParameters(),
+               CALIBRATION_MAX_CAMERA_INTRINSICS);
+  record.num_camera_intrinsics = num_intrinsics;
+  std::copy(camera.intrinsics(),
+            camera.intrinsics() + num_intrinsics,
+            record.camera_intrinsics);
+}
+
+void RecordToCamera(const CalibrationRecord& record, theia::Camera& camera) {
+  camera.SetCameraIntrinsicsModelType(
+      static_cast<theia::CameraIntrinsicsModelType>(record.camera_model));
+  camera.SetImageSize(record.image_width, record.image_height);
+  const int num_intrinsics =
+      std::min(camera.CameraIntrinsics()->NumParameters(),
+               static_cast<int>(record.num_camera_intrinsics));
+  std::copy(record.camera_intrinsics,
+            record.camera_intrinsics + num_intrinsics,
+            camera.mutable_intrinsics());
+}
+
+void SetRecordImuIntrinsics(const ThreeAxisSensorCalibParamsd& acc_params,
+                            const ThreeAxisSensorCalibParamsd& gyro_params,
+                            CalibrationRecord& record) {
+  Eigen::Map<Eigen::Matrix3d>(record.accl_misalignment) =
+      acc_params.GetMisalignmentMatrix();
+  Eigen::Map<Eigen::Vector3d>(record.accl_scale) =
+      acc_params.GetScaleMatrix().diagonal();
+  Eigen::Map<Eigen::Vector3d>(record.accl_bias) = acc_params.GetBiasVector();
+  Eigen::Map<Eigen::Matrix3d>(record.gyro_misalignment) =
+      gyro_params.GetMisalignmentMatrix();
+  Eigen::Map<Eigen::Vector3d>(record.gyro_scale) =
+      gyro_params.GetScaleMatrix().diagonal();
+  Eigen::Map<Eigen::Vector3d>(record.gyro_bias) = gyro_params.GetBiasVector();
+}
+
+void RecordToImuIntrinsics(const CalibrationRecord& record,
+                           ThreeAxisSensorCalibParamsd& acc_params,
+                           ThreeAxisSensorCalibParamsd& gyro_params) {
+  acc_params.SetMisalignmentMatrix(
+      Eigen::Map<const Eigen::Matrix3d>(record.accl_misalignment));
+  acc_params.SetScale(Eigen::Map<const Eigen::Vector3d>(record.accl_scale));
+  acc_params.SetBias(Eigen::Map<const Eigen::Vector3d>(record.accl_bias));
+  gyro_params.SetMisalignmentMatrix(
+      Eigen::Map<const Eigen::Matrix3d>(record.gyro_misalignment));
+  gyro_params.SetScale(Eigen::Map<const Eigen::Vector3d>(record.gyro_scale));
+  gyro_params.SetBias(Eigen::Map<const Eigen::Vector3d>(record.gyro_bias));
+}
+
+bool CalibrationRecordFromJson(const std::string& device_name,
+                               const std::string& camera_calibration,
+                               const std::string& imu_intrinsics,
+                               const std::string& imu_bias,
+                               const std::string& imu_to_camera_result,
+                               CalibrationRecord& record) {
+  OPENICC_TRACE_ZONE("calibration_record_from_json");
+  if (device_name.empty() ||
+      device_name.size() >= CALIBRATION_MAX_DEVICE_NAME) {
+    std::cerr << "Device names need 1 to " << CALIBRATION_MAX_DEVICE_NAME - 1
+              << " characters: " << device_name << "\n";
+    return false;
+  }
+  InitCalibrationRecord(device_name, record);
+
+  if (!camera_calibration.empty()) {
+    theia::Camera camera;
+    double fps = 0.0;
+    if (!read_camera_calibration(camera_calibration, camera, fps)) {
+      return false;
+    }
+    SetRecordCamera(camera, fps, record);
+  }
+
+  ThreeAxisSensorCalibParamsd acc_params, gyro_params;
+  if (!ReadIMUIntrinsics(imu_intrinsics, imu_bias, acc_params, gyro_params)) {
+    std::cerr << "Could not open: " << imu_intrinsics << "\n";
+    return false;
+  }
+  SetRecordImuIntrinsics(acc_params, gyro_params, record);
+
+  if (!imu_to_camera_result.empty()) {
+    std::ifstream file(imu_to_camera_result);
+    if (!file.is_open()) {
+      std::cerr << "Could not open: " << imu_to_camera_result << "\n";
+      return false;
+    }
+    nlohmann::json j;
+    file >> j;
+    const Eigen::Quaterniond q_i_c(j["q_i_c"]["w"].get<double>(),
+                                   j["q_i_c"]["x"].get<double>(),
+                                   j["q_i_c"]["y"].get<double>(),
+                                   j["q_i_c"]["z"].get<double>());
+    record.T_i_c[0] = q_i_c.x();
+    record.T_i_c[1] = q_i_c.y();
+    record.T_i_c[2] = q_i_c.z();
+    record.T_i_c[3] = q_i_c.w();
+    record.T_i_c[4] = j["t_i_c"]["x"];
+    record.T_i_c[5] = j["t_i_c"]["y"];
+    record.T_i_c[6] = j["t_i_c"]["z"];
+    record.time_offset_imu_to_cam_s = j.value("time_offset_imu_to_cam_s", 0.0);
+    record.line_delay_s = j.value("calib_line_delay_us", 0.0) * US_TO_S;
+  }
+  return true;
+}
+
+}  // namespace io
+}  // namespace OpenICC
@@ -19,6 +19,7 @@
 
 #include "OpenCameraCalibrator/io/read_camera_calibration.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/trace.h"
 
 #include "theia/sfm/camera/division_undistortion_camera_model.h"
 #include "theia/sfm/camera/double_sphere_camera_model.h"
@@ -35,6 +36,7 @@ namespace io {
 bool read_camera_calibration(const std::string& input_json,
                              theia::Camera& camera,
                              double& fps) {
+  OPENICC_TRACE_ZONE("camera_calibration_read");
   std::ifstream input(input_json);
   if (!input.is_open()) {
     std::cerr << "Could not open: " << input_json << "\n";
@@ -0,0 +1,517 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/read_gopro_gpmf.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+
+// MP4 and GPMF are big endian
+uint16_t ReadU16(const uint8_t* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t ReadU32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+uint64_t ReadU64(const uint8_t* p) {
+  return (static_cast<uint64_t>(ReadU32(p)) << 32) | ReadU32(p + 4);
+}
+
+constexpr uint32_t FourCC(const char* s) {
+  return (static_cast<uint32_t>(s[0]) << 24) |
+         (static_cast<uint32_t>(s[1]) << 16) |
+         (static_cast<uint32_t>(s[2]) << 8) | static_cast<uint32_t>(s[3]);
+}
+
+//! Calls fn(type, payload, payload_size) for every box in data. False if a
+//! box is truncated
+template <typename Function>
+bool ForEachBox(const uint8_t* data, const uint64_t size, const Function& fn) {
+  uint64_t pos = 0;
+  while (pos + 8 <= size) {
+    uint64_t box_size = ReadU32(data + pos);
+    const uint32_t type = ReadU32(data + pos + 4);
+    uint64_t header_size = 8;
+    if (box_size == 1) {
+      if (pos + 16 > size) return false;
+      box_size = ReadU64(data + pos + 8);
+      header_size = 16;
+    } else if (box_size == 0) {
+      box_size = size - pos;
+    }
+    if (box_size < header_size || box_size > size - pos) return false;
+    fn(type, data + pos + header_size, box_size - header_size);
+    pos += box_size;
+  }
+  return true;
+}
+
+//! Sample tables of one track, see ISO/IEC 14496-12
+struct Mp4Track {
+  uint32_t handler = 0;
+  uint32_t format = 0;
+  uint32_t timescale = 0;
+  std::vector<uint32_t> sample_sizes;
+  std::vector<uint64_t> chunk_offsets;
+  //! first chunk (1 based) and samples per chunk
+  std::vector<std::pair<uint32_t, uint32_t>> sample_to_chunk;
+  //! number of samples and their duration
+  std::vector<std::pair<uint32_t, uint32_t>> time_to_sample;
+};
+
+struct Mp4Sample {
+  uint64_t offset;
+  uint32_t size;
+  double t_s;
+  double duration_s;
+};
+
+//! Number of table entries of a full box that fit into its payload
+uint32_t NumEntries(const uint8_t* data,
+                    const uint64_t size,
+                    const uint64_t header_size,
+                    const uint64_t entry_size) {
+  if (size < header_size) return 0;
+  const uint64_t max_entries = (size - header_size) / entry_size;
+  return static_cast<uint32_t>(
+      std::min<uint64_t>(ReadU32(data + header_size - 4), max_entries));
+}
+
+void ParseSampleTable(const uint32_t type,
+                      const uint8_t* data,
+                      const uint64_t size,
+                      Mp4Track& track) {
+  if (type == FourCC("stsd") && size >= 16) {
+    track.format = ReadU32(data + 12);
+  } else if (type == FourCC("stsz") && size >= 12) {
+    const uint32_t sample_size = ReadU32(data + 4);
+    if (sample_size != 0) {
+      track.sample_sizes.assign(ReadU32(data + 8), sample_size);
+    } else {
+      const uint32_t n = NumEntries(data, size, 12, 4);
+      track.sample_sizes.resize(n);
+      for (uint32_t i = 0; i < n; ++i) {
+        track.sample_sizes[i] = ReadU32(data + 12 + 4 * i);
+      }
+    }
+  } else if (type == FourCC("stco") || type == FourCC("co64")) {
+    const uint64_t entry_size = type == FourCC("stco") ? 4 : 8;
+    const uint32_t n = NumEntries(data, size, 8, entry_size);
+    track.chunk_offsets.resize(n);
+    for (uint32_t i = 0; i < n; ++i) {
+      const uint8_t* entry = data + 8 + entry_size * i;
+      track.chunk_offsets[i] =
+          entry_size == 4 ? ReadU32(entry) : ReadU64(entry);
+    }
+  } else if (type == FourCC("stsc")) {
+    const uint32_t n = NumEntries(data, size, 8, 12);
+    track.sample_to_chunk.resize(n);
+    for (uint32_t i = 0; i < n; ++i) {
+      track.sample_to_chunk[i] = {ReadU32(data + 8 + 12 * i),
+                                  ReadU32(data + 12 + 12 * i)};
+    }
+  } else if (type == FourCC("stts")) {
+    const uint32_t n = NumEntries(data, size, 8, 8);
+    track.time_to_sample.resize(n);
+    for (uint32_t i = 0; i < n; ++i) {
+      track.time_to_sample[i] = {ReadU32(data + 8 + 8 * i),
+                                 ReadU32(data + 12 + 8 * i)};
+    }
+  }
+}
+
+void ParseMediaInfo(const uint8_t* data, const uint64_t size, Mp4Track& track) {
+  ForEachBox(data, size, [&](uint32_t type, const uint8_t* d, uint64_t s) {
+    if (type == FourCC("stbl")) {
+      ForEachBox(d, s, [&](uint32_t table, const uint8_t* t, uint64_t n) {
+        ParseSampleTable(table, t, n, track);
+      });
+    }
+  });
+}
+
+void ParseMedia(const uint8_t* data, const uint64_t size, Mp4Track& track) {
+  ForEachBox(data, size, [&](uint32_t type, const uint8_t* d, uint64_t s) {
+    if (type == FourCC("mdhd") && s >= 24) {
+      // version 1 has 64 bit creation and modification times
+      track.timescale = ReadU32(d + (d[0] == 1 ? 20 : 12));
+    } else if (type == FourCC("hdlr") && s >= 12) {
+      track.handler = ReadU32(d + 8);
+    } else if (type == FourCC("minf")) {
+      ParseMediaInfo(d, s, track);
+    }
+  });
+}
+
+void ParseTrack(const uint8_t* data, const uint64_t size, Mp4Track& track) {
+  ForEachBox(data, size, [&](uint32_t type, const uint8_t* d, uint64_t s) {
+    if (type == FourCC("mdia")) {
+      ParseMedia(d, s, track);
+    }
+  });
+}
+
+//! File offsets and times of all samples of a track
+bool SampleLayout(const Mp4Track& track, std::vector<Mp4Sample>& samples) {
+  samples.clear();
+  if (track.timescale == 0 || track.sample_to_chunk.empty()) return false;
+  samples.reserve(track.sample_sizes.size());
+  size_t entry = 0;
+  for (size_t chunk = 0; chunk < track.chunk_offsets.size(); ++chunk) {
+    while (entry + 1 < track.sample_to_chunk.size() &&
+           track.sample_to_chunk[entry + 1].first <= chunk + 1) {
+      ++entry;
+    }
+    uint64_t offset = track.chunk_offsets[chunk];
+    for (uint32_t i = 0; i < track.sample_to_chunk[entry].second &&
+                         samples.size() < track.sample_sizes.size();
+         ++i) {
+      const uint32_t sample_size = track.sample_sizes[samples.size()];
+      samples.push_back({offset, sample_size, 0.0, 0.0});
+      offset += sample_size;
+    }
+  }
+
+  uint64_t t = 0;
+  size_t sample = 0;
+  for (const auto& tts : track.time_to_sample) {
+    for (uint32_t i = 0; i < tts.first && sample < samples.size(); ++i) {
+      samples[sample].t_s = static_cast<double>(t) / track.timescale;
+      samples[sample].duration_s =
+          static_cast<double>(tts.second) / track.timescale;
+      t += tts.second;
+      ++sample;
+    }
+  }
+  return sample == samples.size();
+}
+
+//! Size of a GPMF value type, 0 for types without numeric values
+int GpmfTypeSize(const char type) {
+  switch (type) {
+    case 'b':
+    case 'B':
+      return 1;
+    case 's':
+    case 'S':
+      return 2;
+    case 'l':
+    case 'L':
+    case 'f':
+    case 'q':
+      return 4;
+    case 'd':
+    case 'j':
+    case 'J':
+    case 'Q':
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+double GpmfValue(const char type, const uint8_t* p) {
+  switch (type) {
+    case 'b':
+      return static_cast<int8_t>(p[0]);
+    case 'B':
+      return p[0];
+    case 's':
+      return static_cast<int16_t>(ReadU16(p));
+    case 'S':
+      return ReadU16(p);
+    case 'l':
+      return static_cast<int32_t>(ReadU32(p));
+    case 'L':
+      return ReadU32(p);
+    case 'f': {
+      const uint32_t bits = ReadU32(p);
+      float value;
+      std::memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+    case 'q':
+      return static_cast<int32_t>(ReadU32(p)) / 65536.0;
+    case 'd': {
+      const uint64_t bits = ReadU64(p);
+      double value;
+      std::memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+    case 'j':
+      return static_cast<double>(static_cast<int64_t>(ReadU64(p)));
+    case 'J':
+      return static_cast<double>(ReadU64(p));
+    case 'Q':
+      return static_cast<int64_t>(ReadU64(p)) / 4294967296.0;
+    default:
+      return 0.0;
+  }
+}
+
+//! Scale and GPS precision of the STRM that is parsed
+struct GpmfStreamState {
+  std::vector<double> scale;
+  double gps_precision = 0.0;
+};
+
+class GpmfParser {
+ public:
+  GpmfParser(const size_t nr_payloads, CameraTelemetryData& telemetry)
+      : nr_payloads_(nr_payloads), telemetry_(telemetry) {}
+
+  //! Parses the GPMF payload of one MP4 sample
+  void ParsePayload(const uint8_t* data,
+                    const size_t size,
+                    const double t_s,
+                    const double duration_s) {
+    t_s_ = t_s;
+    duration_s_ = duration_s;
+    GpmfStreamState state;
+    Parse(data, size, state);
+    ++nr_parsed_payloads_;
+  }
+
+ private:
+  void Parse(const uint8_t* data, const size_t size, GpmfStreamState& state) {
+    size_t pos = 0;
+    while (pos + 8 <= size) {
+      const uint32_t key = ReadU32(data + pos);
+      const char type = static_cast<char>(data[pos + 4]);
+      const size_t struct_size = data[pos + 5];
+      const size_t repeat = ReadU16(data + pos + 6);
+      const size_t data_size = struct_size * repeat;
+      const uint8_t* value = data + pos + 8;
+      if (pos + 8 + data_size > size) return;
+      pos += 8 + ((data_size + 3) & ~size_t(3));
+
+      if (type == 0) {
+        // DEVC and STRM nest, every STRM has its own scale
+        GpmfStreamState nested;
+        Parse(value, data_size, nested);
+        continue;
+      }
+      const int type_size = GpmfTypeSize(type);
+      if (type_size == 0) continue;
+      const size_t nr_elements = struct_size / type_size;
+      if (key == FourCC("SCAL")) {
+        state.scale.resize(nr_elements * repeat);
+        for (size_t i = 0; i < state.scale.size(); ++i) {
+          state.scale[i] = GpmfValue(type, value + type_size * i);
+        }
+      } else if (key == FourCC("GPSP")) {
+        state.gps_precision = GpmfValue(type, value);
+      } else if (key == FourCC("ACCL") || key == FourCC("GYRO") ||
+                 key == FourCC("GPS5") || key == FourCC("CORI")) {
+        AddSamples(key, type, nr_elements, repeat, value, state);
+      }
+    }
+  }
+
+  void AddSamples(const uint32_t key,
+                  const char type,
+                  const size_t nr_elements,
+                  const size_t nr_samples,
+                  const uint8_t* data,
+                  const GpmfStreamState& state) {
+    const size_t min_elements =
+        key == FourCC("GPS5") ? 5 : (key == FourCC("CORI") ? 4 : 3);
+    if (nr_elements < min_elements || nr_samples == 0) return;
+    // reserve for the remaining payloads, they have about as many samples
+    const size_t expected =
+        nr_samples * (nr_payloads_ - nr_parsed_payloads_);
+    const int type_size = GpmfTypeSize(type);
+    double values[5];
+    for (size_t k = 0; k < nr_samples; ++k) {
+      const uint8_t* sample = data + k * nr_elements * type_size;
+      for (size_t e = 0; e < min_elements; ++e) {
+        double scale = 1.0;
+        if (state.scale.size() == 1) {
+          scale = state.scale[0];
+        } else if (e < state.scale.size()) {
+          scale = state.scale[e];
+        }
+        values[e] = GpmfValue(type, sample + e * type_size) /
+                    (scale != 0.0 ? scale : 1.0);
+      }
+      const double t_s =
+          t_s_ + duration_s_ * static_cast<double>(k) / nr_samples;
+      if (key == FourCC("ACCL")) {
+        Reserve(telemetry_.accelerometer, expected);
+        telemetry_.accelerometer.emplace_back(
+            t_s, Eigen::Vector3d(values[1], values[2], values[0]));
+      } else if (key == FourCC("GYRO")) {
+        Reserve(telemetry_.gyroscope, expected);
+        telemetry_.gyroscope.emplace_back(
+            t_s, Eigen::Vector3d(values[1], values[2], values[0]));
+      } else if (key == FourCC("GPS5")) {
+        GPXData& gps = telemetry_.gps;
+        Reserve(gps.lle, expected);
+        Reserve(gps.timestamp_ms, expected);
+        Reserve(gps.precision, expected);
+        Reserve(gps.vel2d_vel3d, expected);
+        gps.lle.emplace_back(values[0], values[1], values[2]);
+        gps.vel2d_vel3d.emplace_back(values[3], values[4]);
+        gps.timestamp_ms.push_back(t_s * S_TO_MS);
+        gps.precision.push_back(state.gps_precision);
+      } else {
+        Reserve(telemetry_.img_timestamps_s, expected);
+        telemetry_.img_timestamps_s.push_back(t_s);
+      }
+    }
+  }
+
+  template <typename Vector>
+  static void Reserve(Vector& v, const size_t expected) {
+    if (v.capacity() == v.size()) {
+      v.reserve(v.size() + expected);
+    }
+  }
+
+  const size_t nr_payloads_;
+  size_t nr_parsed_payloads_ = 0;
+  CameraTelemetryData& telemetry_;
+  double t_s_ = 0.0;
+  double duration_s_ = 0.0;
+};
+
+//! Reads the payload of the top level moov box
+bool ReadMoovBox(std::ifstream& file, std::vector<uint8_t>& moov) {
+  file.seekg(0, std::ios::end);
+  const uint64_t file_size = static_cast<uint64_t>(file.tellg());
+  uint64_t pos = 0;
+  uint8_t header[16];
+  while (pos + 8 <= file_size) {
+    file.seekg(pos);
+    if (!file.read(reinterpret_cast<char*>(header), 8)) return false;
+    uint64_t box_size = ReadU32(header);
+    uint64_t header_size = 8;
+    if (box_size == 1) {
+      if (!file.read(reinterpret_cast<char*>(header + 8), 8)) return false;
+      box_size = ReadU64(header + 8);
+      header_size = 16;
+    } else if (box_size == 0) {
+      box_size = file_size - pos;
+    }
+    if (box_size < header_size || box_size > file_size - pos) return false;
+    if (ReadU32(header + 4) == FourCC("moov")) {
+      moov.resize(box_size - header_size);
+      return static_cast<bool>(
+          file.read(reinterpret_cast<char*>(moov.data()), moov.size()));
+    }
+    pos += box_size;
+  }
+  return false;
+}
+
+}  // namespace
+
+bool IsMP4File(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  uint8_t header[8];
+  if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) {
+    return false;
+  }
+  const uint32_t type = ReadU32(header + 4);
+  return type == FourCC("ftyp") || type == FourCC("moov") ||
+         type == FourCC("mdat") || type == FourCC("wide");
+}
+
+bool ReadGoProMP4Telemetry(const std::string& path_to_mp4,
+                           CameraTelemetryData& telemetry) {
+  utils::ScopedTimer timer("gpmf_read");
+  OPENICC_TRACE_ZONE("gpmf_read");
+  std::ifstream file(path_to_mp4, std::ios::binary);
+  if (!file.is_open()) {
+    LOG(ERROR) << "Could not open " << path_to_mp4;
+    return false;
+  }
+  std::vector<uint8_t> moov;
+  if (!ReadMoovBox(file, moov)) {
+    LOG(ERROR) << "No moov box in " << path_to_mp4;
+    return false;
+  }
+
+  Mp4Track gpmf_track;
+  bool found = false;
+  ForEachBox(moov.data(),
+             moov.size(),
+             [&](uint32_t type, const uint8_t* data, uint64_t size) {
+               if (found || type != FourCC("trak")) return;
+               Mp4Track track;
+               ParseTrack(data, size, track);
+               if (track.handler == FourCC("meta") &&
+                   track.format == FourCC("gpmd")) {
+                 gpmf_track = std::move(track);
+                 found = true;
+               }
+             });
+  std::vector<Mp4Sample> samples;
+  if (!found || !SampleLayout(gpmf_track, samples)) {
+    LOG(ERROR) << "No GPMF track in " << path_to_mp4;
+    return false;
+  }
+
+  const size_t nr_accl = telemetry.accelerometer.size();
+  const size_t nr_img = telemetry.img_timestamps_s.size();
+  GpmfParser parser(samples.size(), telemetry);
+  std::vector<uint8_t> payload;
+  for (const Mp4Sample& sample : samples) {
+    payload.resize(sample.size);
+    file.seekg(sample.offset);
+    if (!file.read(reinterpret_cast<char*>(payload.data()), sample.size)) {
+      LOG(ERROR) << "Truncated GPMF payload in " << path_to_mp4;
+      return false;
+    }
+    parser.ParsePayload(
+        payload.data(), payload.size(), sample.t_s, sample.duration_s);
+  }
+  // ACCL and GYRO can differ by a few samples per payload, keep the common
+  // part like the python converter
+  const size_t nr_imu =
+      std::min(telemetry.accelerometer.size(), telemetry.gyroscope.size());
+  LOG_IF(WARNING,
+         telemetry.accelerometer.size() != telemetry.gyroscope.size())
+      << "Different number of ACCL and GYRO samples in " << path_to_mp4
+      << ", using the first " << nr_imu << ".";
+  telemetry.accelerometer.resize(nr_imu);
+  telemetry.gyroscope.resize(nr_imu);
+  LOG_IF(WARNING, telemetry.img_timestamps_s.size() == nr_img)
+      << "No CORI stream in " << path_to_mp4 << ", no image time stamps.";
+  timer.AddItems(telemetry.accelerometer.size() - nr_accl);
+  LOG(INFO) << "Read " << telemetry.accelerometer.size() - nr_accl
+            << " IMU samples from " << samples.size() << " GPMF payloads.";
+  return true;
+}
+
+}  // namespace io
+}  // namespace OpenICC
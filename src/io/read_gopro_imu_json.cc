@@ -16,6 +16,7 @@
 #include "OpenCameraCalibrator/io/read_gopro_imu_json.h"
 
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/trace.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include <fstream>
@@ -28,6 +29,7 @@ using json = nlohmann::json;
 
 bool ReadGoProTelemetry(const std::string& path_to_telemetry_file,
                         CameraTelemetryData& telemetry) {
+  OPENICC_TRACE_ZONE("gopro_json_read");
   std::ifstream file;
   file.open(path_to_telemetry_file.c_str());
   if (!file.is_open()) {
@@ -35,23 +37,31 @@ bool ReadGoProTelemetry(const std::string& path_to_telemetry_file,
   }
   json j;
   file >> j;
-  const auto accl = j["1"]["streams"]["ACCL"]["samples"];
-  const auto gyro = j["1"]["streams"]["GYRO"]["samples"];
-  const auto gps5 = j["1"]["streams"]["GPS5"]["samples"];
+  const auto& accl = j["1"]["streams"]["ACCL"]["samples"];
+  const auto& gyro = j["1"]["streams"]["GYRO"]["samples"];
+  const auto& gps5 = j["1"]["streams"]["GPS5"]["samples"];
+  telemetry.accelerometer.reserve(telemetry.accelerometer.size() +
+                                  accl.size());
+  telemetry.gyroscope.reserve(telemetry.gyroscope.size() + gyro.size());
   for (const auto& e : accl) {
     Eigen::Vector3d v;
     v << e["value"][1], e["value"][2], e["value"][0];
-    ImuReading<double> reading((double)e["cts"] * MS_TO_S, v);
-    telemetry.accelerometer.push_back(reading);
+    telemetry.accelerometer.emplace_back((double)e["cts"] * MS_TO_S, v);
   }
 
   for (const auto& e : gyro) {
     Eigen::Vector3d v;
     v << e["value"][1], e["value"][2], e["value"][0];
-    ImuReading<double> reading((double)e["cts"] * MS_TO_S, v);
-    telemetry.accelerometer.push_back(reading);
+    telemetry.gyroscope.emplace_back((double)e["cts"] * MS_TO_S, v);
   }
 
+  telemetry.gps.lle.reserve(telemetry.gps.lle.size() + gps5.size());
+  telemetry.gps.timestamp_ms.reserve(telemetry.gps.timestamp_ms.size() +
+                                     gps5.size());
+  telemetry.gps.precision.reserve(telemetry.gps.precision.size() +
+                                  gps5.size());
+  telemetry.gps.vel2d_vel3d.reserve(telemetry.gps.vel2d_vel3d.size() +
+                                    gps5.size());
   for (const auto& e : gps5) {
     Eigen::Vector3d v;
     Eigen::Vector2d vel2d_vel3d;
@@ -63,7 +73,9 @@ bool ReadGoProTelemetry(const std::string& path_to_telemetry_file,
     telemetry.gps.vel2d_vel3d.emplace_back(vel2d_vel3d);
   }
 
-  const auto cori = j["1"]["streams"]["CORI"]["samples"];
+  const auto& cori = j["1"]["streams"]["CORI"]["samples"];
+  telemetry.img_timestamps_s.reserve(telemetry.img_timestamps_s.size() +
+                                     cori.size());
   for (const auto& e : cori) {
     telemetry.img_timestamps_s.emplace_back((double)e["cts"] * MS_TO_S);
   }
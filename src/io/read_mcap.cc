@@ -0,0 +1,449 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/read_mcap.h"
+
+#include <glog/logging.h>
+
+#ifdef OPENICC_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+
+const uint8_t kMcapMagic[8] = {0x89, 'M', 'C', 'A', 'P', '0', '\r', '\n'};
+
+enum McapOpcode : uint8_t {
+  kMcapFooter = 0x02,
+  kMcapSchema = 0x03,
+  kMcapChannel = 0x04,
+  kMcapMessage = 0x05,
+  kMcapChunk = 0x06,
+  kMcapDataEnd = 0x0F,
+};
+
+const std::string kRosImageSchema = "sensor_msgs/msg/Image";
+const std::string kRosCompressedImageSchema = "sensor_msgs/msg/CompressedImage";
+const std::string kRosImuSchema = "sensor_msgs/msg/Imu";
+
+uint64_t ReadU64LE(const uint8_t* p) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) value = (value << 8) | p[i];
+  return value;
+}
+
+//! Bounds checked little endian reader for MCAP records and CDR messages.
+//! CDR aligns every primitive to its size, relative to the start of data
+class ByteReader {
+ public:
+  ByteReader(const uint8_t* data, const uint64_t size)
+      : data_(data), size_(size) {}
+
+  bool Ok() const { return ok_; }
+  uint64_t Remaining() const { return ok_ ? size_ - pos_ : 0; }
+  const uint8_t* Current() const { return data_ + pos_; }
+
+  void Align(const uint64_t alignment) {
+    pos_ = (pos_ + alignment - 1) / alignment * alignment;
+    if (pos_ > size_) ok_ = false;
+  }
+
+  const uint8_t* Skip(const uint64_t n) {
+    if (!ok_ || n > size_ - pos_) {
+      ok_ = false;
+      return nullptr;
+    }
+    const uint8_t* p = data_ + pos_;
+    pos_ += n;
+    return p;
+  }
+
+  uint64_t Unsigned(const int n) {
+    const uint8_t* p = Skip(n);
+    uint64_t value = 0;
+    for (int i = n - 1; p && i >= 0; --i) value = (value << 8) | p[i];
+    return value;
+  }
+
+  uint8_t U8() { return static_cast<uint8_t>(Unsigned(1)); }
+  uint16_t U16() { return static_cast<uint16_t>(Unsigned(2)); }
+  uint32_t U32() { return static_cast<uint32_t>(Unsigned(4)); }
+  uint64_t U64() { return Unsigned(8); }
+
+  double F64() {
+    const uint64_t bits = U64();
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  //! MCAP string: uint32 length and the characters
+  std::string String() {
+    const uint32_t length = U32();
+    const uint8_t* p = Skip(length);
+    return p ? std::string(reinterpret_cast<const char*>(p), length) : "";
+  }
+
+  //! CDR string: aligned uint32 length including the terminating zero
+  std::string CdrString() {
+    Align(4);
+    const uint32_t length = U32();
+    const uint8_t* p = Skip(length);
+    if (!p || length == 0) return "";
+    return std::string(reinterpret_cast<const char*>(p), length - 1);
+  }
+
+  //! CDR uint8 sequence
+  const uint8_t* CdrBytes(size_t& size) {
+    Align(4);
+    size = U32();
+    return Skip(size);
+  }
+
+ private:
+  const uint8_t* data_;
+  uint64_t size_;
+  uint64_t pos_ = 0;
+  bool ok_ = true;
+};
+
+//! Reader behind the CDR encapsulation header, only little endian CDR as
+//! written by ROS 2 is supported
+bool CdrReader(const uint8_t* data, const size_t size, ByteReader& reader) {
+  if (size < 4 || data[0] != 0x00 || data[1] != 0x01) {
+    return false;
+  }
+  reader = ByteReader(data + 4, size - 4);
+  return true;
+}
+
+//! std_msgs/msg/Header
+int64_t ReadRosHeader(ByteReader& reader) {
+  reader.Align(4);
+  const int32_t sec = static_cast<int32_t>(reader.U32());
+  const uint32_t nanosec = reader.U32();
+  reader.CdrString();
+  return static_cast<int64_t>(sec) * 1000000000 + nanosec;
+}
+
+}  // namespace
+
+bool McapReader::Open(const std::string& path) {
+  OPENICC_TRACE_ZONE("mcap_open");
+  file_.close();
+  file_.clear();
+  failed_ = false;
+  data_end_ = false;
+  chunk_ = nullptr;
+  has_first_log_time_ = false;
+  schema_names_.clear();
+  channels_.clear();
+  file_.open(path, std::ios::binary);
+  uint8_t magic[8];
+  if (!file_.read(reinterpret_cast<char*>(magic), sizeof(magic)) ||
+      std::memcmp(magic, kMcapMagic, sizeof(magic)) != 0) {
+    LOG(ERROR) << path << " is not an MCAP file.";
+    failed_ = true;
+    return false;
+  }
+  return true;
+}
+
+const McapChannel* McapReader::Channel(const uint16_t channel_id) const {
+  const auto channel = channels_.find(channel_id);
+  return channel == channels_.end() ? nullptr : &channel->second;
+}
+
+bool McapReader::NextMessage(McapMessage& message) {
+  while (!failed_ && !data_end_) {
+    if (chunk_ && chunk_pos_ + 9 <= chunk_size_) {
+      const uint8_t opcode = chunk_[chunk_pos_];
+      const uint64_t length = ReadU64LE(chunk_ + chunk_pos_ + 1);
+      if (length > chunk_size_ - chunk_pos_ - 9) {
+        LOG(ERROR) << "Truncated record in MCAP chunk.";
+        failed_ = true;
+        return false;
+      }
+      const uint8_t* data = chunk_ + chunk_pos_ + 9;
+      chunk_pos_ += 9 + length;
+      if (HandleRecord(opcode, data, length, message)) return true;
+      continue;
+    }
+    chunk_ = nullptr;
+
+    uint8_t header[9];
+    if (!file_.read(reinterpret_cast<char*>(header), sizeof(header))) {
+      // files that were not closed properly end without DataEnd
+      return false;
+    }
+    const uint64_t length = ReadU64LE(header + 1);
+    record_.resize(length);
+    if (!file_.read(reinterpret_cast<char*>(record_.data()), length)) {
+      LOG(WARNING) << "Truncated MCAP record, the file ends here.";
+      return false;
+    }
+    if (HandleRecord(header[0], record_.data(), length, message)) return true;
+  }
+  return false;
+}
+
+bool McapReader::HandleRecord(const uint8_t opcode,
+                              const uint8_t* data,
+                              const uint64_t size,
+                              McapMessage& message) {
+  ByteReader reader(data, size);
+  switch (opcode) {
+    case kMcapSchema: {
+      const uint16_t id = reader.U16();
+      const std::string name = reader.String();
+      if (reader.Ok()) schema_names_[id] = name;
+      return false;
+    }
+    case kMcapChannel: {
+      McapChannel channel;
+      channel.id = reader.U16();
+      const uint16_t schema_id = reader.U16();
+      channel.topic = reader.String();
+      channel.message_encoding = reader.String();
+      const auto schema = schema_names_.find(schema_id);
+      if (schema != schema_names_.end()) {
+        channel.schema_name = schema->second;
+      }
+      if (reader.Ok()) channels_[channel.id] = channel;
+      return false;
+    }
+    case kMcapMessage: {
+      message.channel_id = reader.U16();
+      reader.U32();  // sequence
+      message.log_time_ns = reader.U64();
+      reader.U64();  // publish time
+      if (!reader.Ok()) {
+        LOG(ERROR) << "Truncated MCAP message.";
+        failed_ = true;
+        return false;
+      }
+      message.data = reader.Current();
+      message.size = reader.Remaining();
+      if (!has_first_log_time_) {
+        first_log_time_ns_ = message.log_time_ns;
+        has_first_log_time_ = true;
+      }
+      return true;
+    }
+    case kMcapChunk:
+      failed_ = !LoadChunk(data, size);
+      return false;
+    case kMcapDataEnd:
+    case kMcapFooter:
+      data_end_ = true;
+      return false;
+    default:
+      return false;
+  }
+}
+
+bool McapReader::LoadChunk(const uint8_t* data, const uint64_t size) {
+  OPENICC_TRACE_ZONE("mcap_chunk_load");
+  ByteReader reader(data, size);
+  reader.U64();  // message start time
+  reader.U64();  // message end time
+  const uint64_t uncompressed_size = reader.U64();
+  reader.U32();  // crc
+  const std::string compression = reader.String();
+  const uint64_t records_size = reader.U64();
+  const uint8_t* records = reader.Skip(records_size);
+  if (!records) {
+    LOG(ERROR) << "Truncated MCAP chunk.";
+    return false;
+  }
+  if (compression.empty()) {
+    chunk_ = records;
+    chunk_size_ = records_size;
+  } else if (compression == "zstd") {
+#ifdef OPENICC_ZSTD
+    chunk_buffer_.resize(uncompressed_size);
+    const size_t result = ZSTD_decompress(
+        chunk_buffer_.data(), uncompressed_size, records, records_size);
+    if (ZSTD_isError(result) || result != uncompressed_size) {
+      LOG(ERROR) << "Could not decompress an MCAP chunk.";
+      return false;
+    }
+    chunk_ = chunk_buffer_.data();
+    chunk_size_ = uncompressed_size;
+#else
+    (void)uncompressed_size;
+    LOG(ERROR) << "zstd compressed MCAP chunks need BUILD_WITH_ZSTD, or "
+                  "decompress the file with: mcap compress --compression "
+                  "none";
+    return false;
+#endif
+  } else {
+    LOG(ERROR) << "Unsupported MCAP chunk compression " << compression;
+    return false;
+  }
+  chunk_pos_ = 0;
+  return true;
+}
+
+bool IsMcapFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  uint8_t magic[8];
+  return file.read(reinterpret_cast<char*>(magic), sizeof(magic)) &&
+         std::memcmp(magic, kMcapMagic, sizeof(magic)) == 0;
+}
+
+bool IsRosImageSchema(const std::string& schema_name) {
+  return schema_name == kRosImageSchema ||
+         schema_name == kRosCompressedImageSchema;
+}
+
+bool DecodeRosImage(const std::string& schema_name,
+                    const uint8_t* data,
+                    const size_t size,
+                    RosImageMessage& image) {
+  OPENICC_TRACE_ZONE("mcap_image_decode");
+  ByteReader reader(nullptr, 0);
+  if (!IsRosImageSchema(schema_name) || !CdrReader(data, size, reader)) {
+    return false;
+  }
+  image.stamp_ns = ReadRosHeader(reader);
+  image.compressed = schema_name == kRosCompressedImageSchema;
+  if (image.compressed) {
+    image.encoding = reader.CdrString();
+  } else {
+    image.height = reader.U32();
+    image.width = reader.U32();
+    image.encoding = reader.CdrString();
+    reader.U8();  // is_bigendian
+    reader.Align(4);
+    image.step = reader.U32();
+  }
+  image.data = reader.CdrBytes(image.size);
+  return reader.Ok() &&
+         (image.compressed ||
+          static_cast<uint64_t>(image.step) * image.height <= image.size);
+}
+
+bool DecodeRosImu(const uint8_t* data,
+                  const size_t size,
+                  int64_t& stamp_ns,
+                  Eigen::Vector3d& gyro,
+                  Eigen::Vector3d& accl) {
+  ByteReader reader(nullptr, 0);
+  if (!CdrReader(data, size, reader)) {
+    return false;
+  }
+  stamp_ns = ReadRosHeader(reader);
+  reader.Align(8);
+  // orientation and its covariance
+  reader.Skip(13 * sizeof(double));
+  for (int i = 0; i < 3; ++i) gyro[i] = reader.F64();
+  reader.Skip(9 * sizeof(double));
+  for (int i = 0; i < 3; ++i) accl[i] = reader.F64();
+  return reader.Ok();
+}
+
+bool ReadMcapTelemetry(const std::string& path_to_mcap,
+                       const std::string& imu_topic,
+                       CameraTelemetryData& telemetry) {
+  utils::ScopedTimer timer("mcap_telemetry_read");
+  OPENICC_TRACE_ZONE("mcap_telemetry_read");
+  McapReader reader;
+  if (!reader.Open(path_to_mcap)) {
+    return false;
+  }
+  const size_t nr_before = telemetry.accelerometer.size();
+  int imu_channel = -1;
+  McapMessage message;
+  while (reader.NextMessage(message)) {
+    if (imu_channel < 0) {
+      const McapChannel* channel = reader.Channel(message.channel_id);
+      if (!channel || channel->schema_name != kRosImuSchema ||
+          channel->message_encoding != "cdr" ||
+          (!imu_topic.empty() && channel->topic != imu_topic)) {
+        continue;
+      }
+      imu_channel = channel->id;
+      LOG(INFO) << "Reading IMU topic " << channel->topic << " of "
+                << path_to_mcap;
+    }
+    if (message.channel_id != imu_channel) continue;
+    int64_t stamp_ns;
+    Eigen::Vector3d gyro, accl;
+    if (!DecodeRosImu(message.data, message.size, stamp_ns, gyro, accl)) {
+      LOG(ERROR) << "Could not decode an IMU message of " << path_to_mcap;
+      return false;
+    }
+    // drivers without a clock leave the stamp empty
+    const double t_s = reader.ToRelativeTimeS(
+        stamp_ns > 0 ? stamp_ns : static_cast<int64_t>(message.log_time_ns));
+    telemetry.accelerometer.emplace_back(t_s, accl);
+    telemetry.gyroscope.emplace_back(t_s, gyro);
+  }
+  if (reader.Failed()) {
+    return false;
+  }
+  if (imu_channel < 0) {
+    LOG(ERROR) << "No " << kRosImuSchema << " topic "
+               << (imu_topic.empty() ? "" : imu_topic + " ") << "in "
+               << path_to_mcap;
+    return false;
+  }
+
+  // messages are stored in arrival order, which can differ from the stamps
+  auto sample_time = [&](const size_t i) {
+    return telemetry.accelerometer[i].timestamp_s();
+  };
+  std::vector<size_t> order(telemetry.accelerometer.size() - nr_before);
+  std::iota(order.begin(), order.end(), nr_before);
+  if (!std::is_sorted(order.begin(),
+                      order.end(),
+                      [&](const size_t a, const size_t b) {
+                        return sample_time(a) < sample_time(b);
+                      })) {
+    std::stable_sort(order.begin(),
+                     order.end(),
+                     [&](const size_t a, const size_t b) {
+                       return sample_time(a) < sample_time(b);
+                     });
+    CameraAccData accelerometer(telemetry.accelerometer.begin(),
+                                telemetry.accelerometer.begin() + nr_before);
+    CameraGyroData gyroscope(telemetry.gyroscope.begin(),
+                             telemetry.gyroscope.begin() + nr_before);
+    for (const size_t i : order) {
+      accelerometer.push_back(telemetry.accelerometer[i]);
+      gyroscope.push_back(telemetry.gyroscope[i]);
+    }
+    telemetry.accelerometer.swap(accelerometer);
+    telemetry.gyroscope.swap(gyroscope);
+  }
+  timer.AddItems(order.size());
+  LOG(INFO) << "Read " << order.size() << " IMU samples from "
+            << path_to_mcap;
+  return true;
+}
+
+}  // namespace io
+}  // namespace OpenICC
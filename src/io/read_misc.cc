@@ -16,6 +16,7 @@
 #include "OpenCameraCalibrator/io/read_misc.h"
 
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/trace.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
 #include <fstream>
@@ -30,6 +31,7 @@ using json = nlohmann::json;
 bool ReadSplineErrorWeighting(
     const std::string& path_to_spline_error_weighting_json,
     SplineWeightingData& spline_weighting) {
+  OPENICC_TRACE_ZONE("spline_error_weighting_read");
   std::ifstream file;
   file.open(path_to_spline_error_weighting_json.c_str());
   if (!file.is_open()) {
@@ -49,6 +51,7 @@ bool ReadSplineErrorWeighting(
 bool ReadIMUBias(const std::string& path_to_imu_bias,
                  Eigen::Vector3d& gyro_bias,
                  Eigen::Vector3d& accl_bias) {
+  OPENICC_TRACE_ZONE("imu_bias_read");
   std::ifstream file;
   file.open(path_to_imu_bias.c_str());
   if (!file.is_open()) {
@@ -65,6 +68,7 @@ bool ReadIMUBias(const std::string& path_to_imu_bias,
 bool ReadIMU2CamInit(const std::string& path_to_file,
                      Eigen::Quaterniond& imu_to_cam_rotation,
                      double& time_offset_imu_to_cam) {
+  OPENICC_TRACE_ZONE("imu_to_camera_init_read");
   std::ifstream file;
   file.open(path_to_file.c_str());
   if (!file.is_open()) {
@@ -85,6 +89,7 @@ bool ReadIMUIntrinsics(const std::string& path_to_imu_intrinsics,
                        const std::string& path_to_initial_imu_bias,
                        ThreeAxisSensorCalibParamsd& acc_params,
                        ThreeAxisSensorCalibParamsd& gyro_params) {
+  OPENICC_TRACE_ZONE("imu_intrinsics_read");
   if (path_to_initial_imu_bias != "") {
     LOG(INFO) << "Initial IMU biases supplied.";
     Eigen::Vector3d gyr_bias, acc_bias;
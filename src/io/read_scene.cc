@@ -13,17 +13,320 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
 #include <fstream>
 #include <ios>
 #include <iostream>
+#include <vector>
 
 #include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/reconstruction_builder.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
 
 namespace OpenICC {
 namespace io {
 
+namespace {
+inline size_t AlignTo8(const size_t offset) { return (offset + 7) & ~size_t(7); }
+
+bool HasSceneMagic(const std::string& input_path, const char* scene_magic) {
+  std::ifstream input(input_path, std::ios::binary);
+  char magic[8];
+  if (!input.read(magic, sizeof(magic))) {
+    return false;
+  }
+  return std::memcmp(magic, scene_magic, sizeof(magic)) == 0;
+}
+
+//! Bounds checked cursor over a compact scene, see SCENE_COMPACT_MAGIC
+class CompactSceneCursor {
+ public:
+  CompactSceneCursor(const uint8_t* data, const size_t size)
+      : pos_(data), end_(data + size) {}
+
+  bool Ok() const { return ok_; }
+
+  uint64_t Varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos_ == end_) {
+        ok_ = false;
+        return 0;
+      }
+      const uint8_t byte = *pos_++;
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    ok_ = false;
+    return 0;
+  }
+
+  int64_t ZigZag() {
+    const uint64_t value = Varint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+
+  template <class T>
+  T Raw() {
+    T value;
+    if (static_cast<size_t>(end_ - pos_) < sizeof(T)) {
+      ok_ = false;
+      std::memset(&value, 0, sizeof(T));
+      return value;
+    }
+    std::memcpy(&value, pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return value;
+  }
+
+  const uint8_t* Bytes(const size_t size) {
+    if (static_cast<size_t>(end_ - pos_) < size) {
+      ok_ = false;
+      return nullptr;
+    }
+    const uint8_t* bytes = pos_;
+    pos_ += size;
+    return bytes;
+  }
+
+ private:
+  const uint8_t* pos_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+}  // namespace
+
+SceneBinaryLayout::SceneBinaryLayout(const SceneBinaryHeader& header) {
+  frames = sizeof(SceneBinaryHeader);
+  ids = frames + header.num_frames * sizeof(SceneBinaryFrame);
+  xy = AlignTo8(ids + header.num_observations * sizeof(int32_t));
+  scene_pt_ids = xy + 2 * header.num_observations * sizeof(double);
+  scene_pts_xyz =
+      AlignTo8(scene_pt_ids + header.num_scene_pts * sizeof(int32_t));
+  total_size = scene_pts_xyz + 3 * header.num_scene_pts * sizeof(double);
+}
+
+MappedScene::~MappedScene() { Close(); }
+
+bool MappedScene::Open(const std::string& path) {
+  OPENICC_TRACE_ZONE("scene_map");
+  Close();
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Can not open " << path << "\n";
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      file_stat.st_size < (off_t)sizeof(SceneBinaryHeader)) {
+    std::cerr << "Not a binary scene file: " << path << "\n";
+    close(fd);
+    return false;
+  }
+  size_ = file_stat.st_size;
+  data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    std::cerr << "Can not map " << path << "\n";
+    data_ = nullptr;
+    size_ = 0;
+    return false;
+  }
+
+  const char* base = static_cast<const char*>(data_);
+  header_ = reinterpret_cast<const SceneBinaryHeader*>(base);
+  if (std::memcmp(header_->magic, SCENE_BINARY_MAGIC, 8) != 0 ||
+      header_->version != SCENE_BINARY_VERSION) {
+    std::cerr << "Wrong binary scene magic or version in " << path << "\n";
+    Close();
+    return false;
+  }
+  const SceneBinaryLayout layout(*header_);
+  if (layout.total_size > size_) {
+    std::cerr << "Truncated binary scene file " << path << "\n";
+    Close();
+    return false;
+  }
+  frames_ = reinterpret_cast<const SceneBinaryFrame*>(base + layout.frames);
+  ids_ = reinterpret_cast<const int32_t*>(base + layout.ids);
+  xy_ = reinterpret_cast<const double*>(base + layout.xy);
+  scene_pt_ids_ = reinterpret_cast<const int32_t*>(base + layout.scene_pt_ids);
+  scene_pts_xyz_ = reinterpret_cast<const double*>(base + layout.scene_pts_xyz);
+  return true;
+}
+
+void MappedScene::Close() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+  frames_ = nullptr;
+  ids_ = nullptr;
+  xy_ = nullptr;
+  scene_pt_ids_ = nullptr;
+  scene_pts_xyz_ = nullptr;
+}
+
+bool is_binary_scene(const std::string& input_path) {
+  return HasSceneMagic(input_path, SCENE_BINARY_MAGIC);
+}
+
+bool is_compact_scene(const std::string& input_path) {
+  return HasSceneMagic(input_path, SCENE_COMPACT_MAGIC);
+}
+
+bool read_scene_binary(const std::string& input_path,
+                       nlohmann::json& scene_json) {
+  OPENICC_TRACE_ZONE("scene_read_binary");
+  MappedScene scene;
+  if (!scene.Open(input_path)) {
+    return false;
+  }
+  const SceneBinaryHeader& header = scene.Header();
+  scene_json = nlohmann::json();
+  scene_json["image_width"] = header.image_width;
+  scene_json["image_height"] = header.image_height;
+  scene_json["calibration_board_type"] = header.board_type;
+  scene_json["camera_fps"] = header.camera_fps;
+  scene_json["square_size_meter"] = header.square_size_meter;
+
+  const int32_t* pt_ids = scene.ScenePointIds();
+  const double* xyz = scene.ScenePointsXYZ();
+  for (size_t i = 0; i < scene.NumScenePoints(); ++i) {
+    scene_json["scene_pts"][std::to_string(pt_ids[i])] = {
+        xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]};
+  }
+
+  for (size_t f = 0; f < scene.NumFrames(); ++f) {
+    const SceneBinaryFrame& frame = scene.Frame(f);
+    const int32_t* ids = scene.FrameIds(f);
+    const double* xy = scene.FrameXY(f);
+    nlohmann::json& image_points =
+        scene_json["views"][std::to_string(frame.timestamp_us)]
+                  ["image_points"];
+    for (size_t c = 0; c < frame.num_obs; ++c) {
+      image_points[std::to_string(ids[c])] = {xy[2 * c], xy[2 * c + 1]};
+    }
+  }
+  return true;
+}
+
+bool read_scene_compact(const std::string& input_path,
+                        nlohmann::json& scene_json) {
+  OPENICC_TRACE_ZONE("scene_read_compact");
+  std::ifstream input(input_path, std::ios::binary | std::ios::ate);
+  if (!input.is_open()) {
+    std::cerr << "Can not open " << input_path << "\n";
+    return false;
+  }
+  std::vector<uint8_t> content(static_cast<size_t>(input.tellg()));
+  input.seekg(0);
+  if (!input.read(reinterpret_cast<char*>(content.data()), content.size())) {
+    std::cerr << "Can not read " << input_path << "\n";
+    return false;
+  }
+
+  CompactSceneCursor cursor(content.data(), content.size());
+  const SceneBinaryHeader header = cursor.Raw<SceneBinaryHeader>();
+  if (!cursor.Ok() ||
+      std::memcmp(header.magic, SCENE_COMPACT_MAGIC, 8) != 0 ||
+      header.version != SCENE_COMPACT_VERSION) {
+    std::cerr << "Wrong compact scene magic or version in " << input_path
+              << "\n";
+    return false;
+  }
+  scene_json = nlohmann::json();
+  scene_json["image_width"] = header.image_width;
+  scene_json["image_height"] = header.image_height;
+  scene_json["calibration_board_type"] = header.board_type;
+  scene_json["camera_fps"] = header.camera_fps;
+  scene_json["square_size_meter"] = header.square_size_meter;
+
+  int64_t pt_id = -1;
+  for (uint64_t i = 0; i < header.num_scene_pts && cursor.Ok(); ++i) {
+    pt_id += static_cast<int64_t>(cursor.Varint());
+    const double x = cursor.Raw<double>();
+    const double y = cursor.Raw<double>();
+    const double z = cursor.Raw<double>();
+    scene_json["scene_pts"][std::to_string(pt_id)] = {x, y, z};
+  }
+  const size_t mask_size = header.num_scene_pts > 0 ? (pt_id + 8) / 8 : 0;
+
+  std::vector<int64_t> ids;
+  for (uint64_t f = 0; f < header.num_frames && cursor.Ok(); ++f) {
+    const double timestamp_us = cursor.Raw<double>();
+    const uint64_t num_obs = cursor.Varint();
+    const uint8_t id_coding = cursor.Raw<uint8_t>();
+    if (!cursor.Ok()) {
+      break;
+    }
+    if (num_obs > header.num_observations) {
+      std::cerr << "Corrupt frame in " << input_path << "\n";
+      return false;
+    }
+    ids.clear();
+    if (id_coding == 1) {
+      const uint8_t* mask = cursor.Bytes(mask_size);
+      for (size_t i = 0; mask && i < 8 * mask_size; ++i) {
+        if (mask[i / 8] & (1 << (i % 8))) ids.push_back(i);
+      }
+      if (ids.size() != num_obs) {
+        std::cerr << "Corrupt id mask in " << input_path << "\n";
+        return false;
+      }
+    } else {
+      int64_t id = -1;
+      for (uint64_t c = 0; c < num_obs; ++c) {
+        id += static_cast<int64_t>(cursor.Varint());
+        ids.push_back(id);
+      }
+    }
+
+    nlohmann::json& image_points =
+        scene_json["views"][std::to_string(timestamp_us)]["image_points"];
+    int64_t prev[2][2] = {{0, 0}, {0, 0}};
+    for (size_t c = 0; c < ids.size(); ++c) {
+      const bool extrapolate =
+          c >= 2 && ids[c] - ids[c - 1] == ids[c - 1] - ids[c - 2];
+      double xy[2];
+      for (int k = 0; k < 2; ++k) {
+        const int64_t prediction =
+            extrapolate ? 2 * prev[0][k] - prev[1][k] : prev[0][k];
+        const int64_t q = prediction + cursor.ZigZag();
+        prev[1][k] = prev[0][k];
+        prev[0][k] = q;
+        xy[k] = q / SCENE_COMPACT_SUBPIXEL;
+      }
+      image_points[std::to_string(ids[c])] = {xy[0], xy[1]};
+    }
+  }
+  if (!cursor.Ok()) {
+    std::cerr << "Truncated compact scene file " << input_path << "\n";
+    return false;
+  }
+  return true;
+}
+
 bool read_scene_bson(const std::string& input_bson,
                      nlohmann::json& scene_json) {
+  utils::ScopedTimer timer("scene_read", 1);
+  OPENICC_TRACE_ZONE("scene_read");
+  if (is_binary_scene(input_bson)) {
+    return read_scene_binary(input_bson, scene_json);
+  }
+  if (is_compact_scene(input_bson)) {
+    return read_scene_compact(input_bson, scene_json);
+  }
   std::ifstream input_corner_json(input_bson, std::ios::binary);
   if (!input_corner_json.is_open()) {
     std::cerr << "Can not open " << input_bson << "\n";
@@ -42,19 +345,34 @@ bool read_scene_bson(const std::string& input_bson,
 
 void scene_points_to_calib_dataset(const nlohmann::json& json,
                                    theia::Reconstruction& reconstruction) {
-  // fill reconstruction with board points
-  const auto scene_pts_it = json["scene_pts"];
-  for (auto& it : scene_pts_it.items()) {
-    const theia::TrackId track_id = (theia::TrackId)std::stoi(it.key());
-    reconstruction.AddTrack(track_id);
-    theia::Track* track = reconstruction.MutableTrack(track_id);
-    track->SetEstimated(true);
-    Eigen::Vector4d* point = track->MutablePoint();
-    (*point)[0] = static_cast<double>(it.value()[0]);
-    (*point)[1] = static_cast<double>(it.value()[1]);
-    (*point)[2] = static_cast<double>(it.value()[2]);
-    (*point)[3] = 1.0;
-  }
+  OPENICC_TRACE_ZONE("scene_points_to_dataset");
+  ReconstructionBuilder builder;
+  builder.AddScenePoints(json);
+  builder.Build(reconstruction);
+}
+
+void scene_points_to_calib_dataset(const MappedScene& scene,
+                                   theia::Reconstruction& reconstruction) {
+  OPENICC_TRACE_ZONE("scene_points_to_dataset");
+  ReconstructionBuilder builder;
+  builder.AddScenePoints(scene);
+  builder.Build(reconstruction);
+}
+
+void scene_to_calib_dataset(const nlohmann::json& json,
+                            theia::Reconstruction& reconstruction) {
+  ReconstructionBuilder builder;
+  builder.AddScenePoints(json);
+  builder.AddSceneViews(json);
+  builder.Build(reconstruction);
+}
+
+void scene_to_calib_dataset(const MappedScene& scene,
+                            theia::Reconstruction& reconstruction) {
+  ReconstructionBuilder builder;
+  builder.AddScenePoints(scene);
+  builder.AddSceneViews(scene);
+  builder.Build(reconstruction);
 }
 
 }  // namespace io
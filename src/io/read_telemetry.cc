@@ -15,19 +15,262 @@
 
 #include "OpenCameraCalibrator/io/read_telemetry.h"
 
+#include "OpenCameraCalibrator/io/read_gopro_gpmf.h"
+#include "OpenCameraCalibrator/io/read_mcap.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
 #include "OpenCameraCalibrator/utils/types.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <istream>
+#include <limits>
+#include <string>
 
 namespace OpenICC {
 namespace io {
 using json = nlohmann::json;
 
+namespace {
+
+//! Collects the numbers of the telemetry arrays into flat vectors without
+//! building a json DOM
+class TelemetrySaxHandler : public nlohmann::json_sax<json> {
+ public:
+  std::vector<double> timestamps_ns;
+  std::vector<double> accl;
+  std::vector<double> gyro;
+  std::vector<double> img_timestamps_ns;
+
+  bool null() override { return true; }
+  bool boolean(bool) override { return true; }
+  bool number_integer(number_integer_t val) override {
+    return AddNumber((double)val);
+  }
+  bool number_unsigned(number_unsigned_t val) override {
+    return AddNumber((double)val);
+  }
+  bool number_float(number_float_t val, const string_t&) override {
+    return AddNumber((double)val);
+  }
+  bool string(string_t&) override { return true; }
+  bool start_object(std::size_t) override {
+    ++depth_;
+    return true;
+  }
+  bool key(string_t& val) override {
+    // only top level keys select the target array
+    if (depth_ != 1) return true;
+    if (val == "timestamps_ns") {
+      target_ = &timestamps_ns;
+    } else if (val == "accelerometer") {
+      target_ = &accl;
+    } else if (val == "gyroscope") {
+      target_ = &gyro;
+    } else if (val == "img_timestamps_ns") {
+      target_ = &img_timestamps_ns;
+    } else {
+      target_ = nullptr;
+    }
+    return true;
+  }
+  bool end_object() override { return EndContainer(); }
+  bool start_array(std::size_t) override {
+    ++depth_;
+    return true;
+  }
+  bool end_array() override { return EndContainer(); }
+  bool parse_error(std::size_t position,
+                   const std::string&,
+                   const nlohmann::detail::exception& ex) override {
+    std::cerr << "Telemetry parse error at byte " << position << ": "
+              << ex.what() << "\n";
+    return false;
+  }
+
+ private:
+  bool AddNumber(const double val) {
+    if (target_ && depth_ > 1) target_->push_back(val);
+    return true;
+  }
+  bool EndContainer() {
+    --depth_;
+    if (depth_ <= 1) target_ = nullptr;
+    return true;
+  }
+
+  int depth_ = 0;
+  std::vector<double>* target_ = nullptr;
+};
+
+//! Collects the time, sensor type and values of one ZED recorder line, e.g.
+//! {"time": 1.2, "sensor": {"type": "gyroscope", "values": [x, y, z]}}
+class ZedLineSaxHandler : public nlohmann::json_sax<json> {
+ public:
+  double time = 0.0;
+  bool has_time = false;
+  bool has_frames = false;
+  std::string sensor_type;
+  std::vector<double> values;
+
+  void Reset() {
+    has_time = false;
+    has_frames = false;
+    sensor_type.clear();
+    values.clear();
+    depth_ = 0;
+    key_ = Key::OTHER;
+    in_sensor_ = false;
+  }
+
+  bool null() override { return true; }
+  bool boolean(bool) override { return true; }
+  bool number_integer(number_integer_t val) override {
+    return AddNumber((double)val);
+  }
+  bool number_unsigned(number_unsigned_t val) override {
+    return AddNumber((double)val);
+  }
+  bool number_float(number_float_t val, const string_t&) override {
+    return AddNumber((double)val);
+  }
+  bool string(string_t& val) override {
+    if (in_sensor_ && depth_ == 2 && key_ == Key::TYPE) sensor_type = val;
+    return true;
+  }
+  bool start_object(std::size_t) override {
+    ++depth_;
+    return true;
+  }
+  bool key(string_t& val) override {
+    if (depth_ == 1) {
+      in_sensor_ = val == "sensor";
+      has_frames |= val == "frames";
+      key_ = val == "time" ? Key::TIME : Key::OTHER;
+    } else if (depth_ == 2 && in_sensor_) {
+      key_ = val == "type" ? Key::TYPE
+                           : (val == "values" ? Key::VALUES : Key::OTHER);
+    }
+    return true;
+  }
+  bool end_object() override {
+    --depth_;
+    return true;
+  }
+  bool start_array(std::size_t) override {
+    ++depth_;
+    return true;
+  }
+  bool end_array() override {
+    --depth_;
+    return true;
+  }
+  bool parse_error(std::size_t position,
+                   const std::string&,
+                   const nlohmann::detail::exception& ex) override {
+    std::cerr << "ZED telemetry parse error at byte " << position << ": "
+              << ex.what() << "\n";
+    return false;
+  }
+
+ private:
+  enum class Key { OTHER, TIME, TYPE, VALUES };
+
+  bool AddNumber(const double val) {
+    if (depth_ == 1 && key_ == Key::TIME) {
+      time = val;
+      has_time = true;
+    } else if (in_sensor_ && depth_ == 3 && key_ == Key::VALUES) {
+      values.push_back(val);
+    }
+    return true;
+  }
+
+  int depth_ = 0;
+  Key key_ = Key::OTHER;
+  bool in_sensor_ = false;
+};
+
+//! Parses up to max_values numbers separated by commas or whitespace
+size_t ParseCSVLine(const std::string& line,
+                    const size_t max_values,
+                    double* values) {
+  const char* p = line.c_str();
+  size_t nr_values = 0;
+  while (nr_values < max_values) {
+    while (*p == ',' || *p == ' ' || *p == '\t' || *p == '\r') ++p;
+    if (*p == '\0') break;
+    char* end;
+    values[nr_values] = std::strtod(p, &end);
+    if (end == p) break;
+    ++nr_values;
+    p = end;
+  }
+  return nr_values;
+}
+
+bool HasExtension(const std::string& path, const std::string& extension) {
+  if (path.size() < extension.size()) return false;
+  return std::equal(extension.rbegin(),
+                    extension.rend(),
+                    path.rbegin(),
+                    [](const char a, const char b) {
+                      return std::tolower(a) == std::tolower(b);
+                    });
+}
+
+}  // namespace
+
 bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
                        CameraTelemetryData& telemetry) {
+  OPENICC_TRACE_ZONE("telemetry_read_json");
+  std::ifstream file;
+  file.open(path_to_telemetry_file.c_str());
+  if (!file.is_open()) {
+    return false;
+  }
+  TelemetrySaxHandler handler;
+  if (!json::sax_parse(file, &handler)) {
+    return false;
+  }
+
+  const size_t nr_datapoints = handler.timestamps_ns.size();
+  if (handler.gyro.size() != 3 * nr_datapoints ||
+      handler.accl.size() != 3 * nr_datapoints) {
+    std::cerr << "Telemetry should have the same amount of timestamps, "
+                 "accelerometer and gyroscope values.\n";
+    return false;
+  }
+
+  telemetry.accelerometer.reserve(telemetry.accelerometer.size() +
+                                  nr_datapoints);
+  telemetry.gyroscope.reserve(telemetry.gyroscope.size() + nr_datapoints);
+  for (size_t i = 0; i < nr_datapoints; ++i) {
+    const double t_s = handler.timestamps_ns[i] * NS_TO_S;
+    telemetry.accelerometer.emplace_back(t_s, &handler.accl[3 * i]);
+    telemetry.gyroscope.emplace_back(t_s, &handler.gyro[3 * i]);
+  }
+
+  // if we have accurate image timestamps
+  // otherwise video timestamps will be used
+  telemetry.img_timestamps_s.reserve(telemetry.img_timestamps_s.size() +
+                                     handler.img_timestamps_ns.size());
+  for (const double t_ns : handler.img_timestamps_ns) {
+    telemetry.img_timestamps_s.emplace_back(t_ns * NS_TO_S);
+  }
+
+  file.close();
+  return true;
+}
+
+bool ReadTelemetryJSONDom(const std::string& path_to_telemetry_file,
+                          CameraTelemetryData& telemetry) {
+  OPENICC_TRACE_ZONE("telemetry_read_json_dom");
   std::ifstream file;
   file.open(path_to_telemetry_file.c_str());
   if (!file.is_open()) {
@@ -35,9 +278,9 @@ bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
   }
   json j;
   file >> j;
-  const auto accl = j["accelerometer"];
-  const auto gyro = j["gyroscope"];
-  const auto timestamps_ns = j["timestamps_ns"];
+  const auto& accl = j["accelerometer"];
+  const auto& gyro = j["gyroscope"];
+  const auto& timestamps_ns = j["timestamps_ns"];
 
   const size_t nr_datapoints = timestamps_ns.size();
   if (gyro.size() != nr_datapoints || accl.size() != nr_datapoints) {
@@ -46,18 +289,22 @@ bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
     return false;
   }
 
+  telemetry.accelerometer.reserve(telemetry.accelerometer.size() +
+                                  nr_datapoints);
+  telemetry.gyroscope.reserve(telemetry.gyroscope.size() + nr_datapoints);
   for (size_t i = 0; i < timestamps_ns.size(); ++i) {
     double t_s = (double)timestamps_ns[i] * NS_TO_S;
-    ImuReading<double> acc_reading(t_s, accl[i][0], accl[i][1], accl[i][2]);
-    ImuReading<double> gyr_reading(t_s, gyro[i][0], gyro[i][1], gyro[i][2]);
-    telemetry.accelerometer.push_back(acc_reading);
-    telemetry.gyroscope.push_back(gyr_reading);
+    telemetry.accelerometer.emplace_back(
+        t_s, accl[i][0], accl[i][1], accl[i][2]);
+    telemetry.gyroscope.emplace_back(t_s, gyro[i][0], gyro[i][1], gyro[i][2]);
   }
 
   // if we have accurate image timestamps
   // otherwise video timestamps will be used
-  const auto accurate_timestamps_ns = j["img_timestamps_ns"];
+  const auto& accurate_timestamps_ns = j["img_timestamps_ns"];
   if (accurate_timestamps_ns.size() > 0) {
+    telemetry.img_timestamps_s.reserve(telemetry.img_timestamps_s.size() +
+                                       accurate_timestamps_ns.size());
     for (size_t i = 0; i < accurate_timestamps_ns.size(); ++i) {
       telemetry.img_timestamps_s.emplace_back(
                   (double)accurate_timestamps_ns[i]*NS_TO_S);
@@ -68,5 +315,269 @@ bool ReadTelemetryJSON(const std::string& path_to_telemetry_file,
   return true;
 }
 
+bool ReadZedTelemetryJSONL(const std::string& path_to_telemetry_file,
+                           CameraTelemetryData& telemetry) {
+  OPENICC_TRACE_ZONE("telemetry_read_zed_jsonl");
+  std::ifstream file(path_to_telemetry_file);
+  if (!file.is_open()) {
+    return false;
+  }
+  // accelerometer and gyroscope lines alternate, the samples are paired in
+  // order and get the gyroscope time
+  std::vector<double> gyro_times_s;
+  std::vector<double> accl;
+  std::vector<double> gyro;
+  double t_first_frame_s = std::numeric_limits<double>::max();
+  double t_last_frame_s = std::numeric_limits<double>::lowest();
+  ZedLineSaxHandler handler;
+  std::string line;
+  size_t line_nr = 0;
+  while (std::getline(file, line)) {
+    ++line_nr;
+    if (line.empty() || line == "\r") continue;
+    handler.Reset();
+    if (!json::sax_parse(line, &handler)) {
+      std::cerr << "In line " << line_nr << " of " << path_to_telemetry_file
+                << "\n";
+      return false;
+    }
+    if (!handler.has_time) continue;
+    if (handler.has_frames) {
+      t_first_frame_s = std::min(t_first_frame_s, handler.time);
+      t_last_frame_s = std::max(t_last_frame_s, handler.time);
+    } else if (handler.values.size() == 3) {
+      if (handler.sensor_type == "gyroscope") {
+        gyro.insert(gyro.end(), handler.values.begin(), handler.values.end());
+        gyro_times_s.push_back(handler.time);
+      } else if (handler.sensor_type == "accelerometer") {
+        accl.insert(accl.end(), handler.values.begin(), handler.values.end());
+      }
+    }
+  }
+
+  // keep the IMU samples during the video, the first one is at time zero
+  const size_t nr_samples = std::min(gyro_times_s.size(), accl.size() / 3);
+  const bool has_frames = t_first_frame_s <= t_last_frame_s;
+  size_t begin = 0;
+  while (has_frames && begin < nr_samples &&
+         gyro_times_s[begin] < t_first_frame_s) {
+    ++begin;
+  }
+  size_t end = begin;
+  while (end < nr_samples &&
+         (!has_frames || gyro_times_s[end] <= t_last_frame_s)) {
+    ++end;
+  }
+  if (begin == end) {
+    std::cerr << "No IMU samples in " << path_to_telemetry_file << "\n";
+    return false;
+  }
+  telemetry.accelerometer.reserve(telemetry.accelerometer.size() + end -
+                                  begin);
+  telemetry.gyroscope.reserve(telemetry.gyroscope.size() + end - begin);
+  for (size_t i = begin; i < end; ++i) {
+    const double t_s = gyro_times_s[i] - gyro_times_s[begin];
+    telemetry.accelerometer.emplace_back(t_s, &accl[3 * i]);
+    telemetry.gyroscope.emplace_back(t_s, &gyro[3 * i]);
+  }
+  return true;
+}
+
+bool ReadTelemetryCSV(const std::string& path_to_telemetry_file,
+                      CameraTelemetryData& telemetry) {
+  OPENICC_TRACE_ZONE("telemetry_read_csv");
+  std::ifstream file(path_to_telemetry_file);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::string line;
+  size_t line_nr = 0;
+  double row[7];
+  while (std::getline(file, line)) {
+    ++line_nr;
+    const size_t nr_values = ParseCSVLine(line, 7, row);
+    // empty lines and a header
+    if (nr_values == 0) continue;
+    if (nr_values != 7) {
+      std::cerr << "Expected t_ns, gyro x y z, accl x y z in line " << line_nr
+                << " of " << path_to_telemetry_file << "\n";
+      return false;
+    }
+    const double t_s = row[0] * NS_TO_S;
+    telemetry.gyroscope.emplace_back(t_s, &row[1]);
+    telemetry.accelerometer.emplace_back(t_s, &row[4]);
+  }
+  return true;
+}
+
+bool TelemetryBinaryReader::Open(const std::string& path) {
+  OPENICC_TRACE_ZONE("telemetry_binary_open");
+  file_.close();
+  blocks_.clear();
+  img_timestamps_s_.clear();
+  file_.open(path, std::ios::in | std::ios::binary);
+  if (!file_.is_open()) {
+    std::cerr << "Can not open " << path << "\n";
+    return false;
+  }
+  if (!file_.read(reinterpret_cast<char*>(&header_), sizeof(header_)) ||
+      std::memcmp(header_.magic, TELEMETRY_BINARY_MAGIC, 8) != 0 ||
+      header_.version != TELEMETRY_BINARY_VERSION) {
+    std::cerr << "Not a binary telemetry file: " << path << "\n";
+    return false;
+  }
+  img_timestamps_s_.resize(header_.num_img_timestamps);
+  blocks_.resize(header_.num_blocks);
+  file_.read(reinterpret_cast<char*>(img_timestamps_s_.data()),
+             img_timestamps_s_.size() * sizeof(double));
+  file_.read(reinterpret_cast<char*>(blocks_.data()),
+             blocks_.size() * sizeof(TelemetryBinaryBlock));
+  if (!file_) {
+    std::cerr << "Truncated binary telemetry file: " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool TelemetryBinaryReader::ReadBlockSamples(const size_t i,
+                                             std::vector<double>& t_s,
+                                             std::vector<double>& accl,
+                                             std::vector<double>& gyro) {
+  const TelemetryBinaryBlock& block = blocks_[i];
+  t_s.resize(block.num_samples);
+  accl.resize(3 * block.num_samples);
+  gyro.resize(3 * block.num_samples);
+  file_.clear();
+  file_.seekg(block.offset);
+  file_.read(reinterpret_cast<char*>(t_s.data()), t_s.size() * sizeof(double));
+  file_.read(reinterpret_cast<char*>(accl.data()),
+             accl.size() * sizeof(double));
+  file_.read(reinterpret_cast<char*>(gyro.data()),
+             gyro.size() * sizeof(double));
+  return static_cast<bool>(file_);
+}
+
+bool TelemetryBinaryReader::ReadBlock(const size_t i,
+                                      CameraTelemetryData& telemetry) {
+  OPENICC_TRACE_ZONE("telemetry_binary_read_block");
+  std::vector<double> t_s, accl, gyro;
+  if (!ReadBlockSamples(i, t_s, accl, gyro)) {
+    return false;
+  }
+  for (size_t s = 0; s < t_s.size(); ++s) {
+    telemetry.accelerometer.emplace_back(t_s[s], &accl[3 * s]);
+    telemetry.gyroscope.emplace_back(t_s[s], &gyro[3 * s]);
+  }
+  return true;
+}
+
+bool TelemetryBinaryReader::ReadTimeWindow(const double t_start_s,
+                                           const double t_end_s,
+                                           CameraTelemetryData& telemetry) {
+  OPENICC_TRACE_ZONE("telemetry_binary_read_window");
+  // blocks are sorted in time, find the first one that ends after t_start_s
+  auto it = std::lower_bound(blocks_.begin(),
+                             blocks_.end(),
+                             t_start_s,
+                             [](const TelemetryBinaryBlock& b, double t) {
+                               return b.t_end_s < t;
+                             });
+  std::vector<double> t_s, accl, gyro;
+  for (; it != blocks_.end() && it->t_start_s < t_end_s; ++it) {
+    if (!ReadBlockSamples(it - blocks_.begin(), t_s, accl, gyro)) {
+      return false;
+    }
+    for (size_t s = 0; s < t_s.size(); ++s) {
+      if (t_s[s] < t_start_s || t_s[s] >= t_end_s) continue;
+      telemetry.accelerometer.emplace_back(t_s[s], &accl[3 * s]);
+      telemetry.gyroscope.emplace_back(t_s[s], &gyro[3 * s]);
+    }
+  }
+  return true;
+}
+
+bool IsBinaryTelemetry(const std::string& path_to_telemetry_file) {
+  std::ifstream file(path_to_telemetry_file, std::ios::binary);
+  char magic[8];
+  if (!file.read(magic, sizeof(magic))) {
+    return false;
+  }
+  return std::memcmp(magic, TELEMETRY_BINARY_MAGIC, sizeof(magic)) == 0;
+}
+
+bool ReadTelemetryBinary(const std::string& path_to_telemetry_file,
+                         CameraTelemetryData& telemetry) {
+  TelemetryBinaryReader reader;
+  if (!reader.Open(path_to_telemetry_file)) {
+    return false;
+  }
+  telemetry.accelerometer.reserve(telemetry.accelerometer.size() +
+                                  reader.NumSamples());
+  telemetry.gyroscope.reserve(telemetry.gyroscope.size() +
+                              reader.NumSamples());
+  for (size_t i = 0; i < reader.NumBlocks(); ++i) {
+    if (!reader.ReadBlock(i, telemetry)) {
+      return false;
+    }
+  }
+  telemetry.img_timestamps_s.insert(telemetry.img_timestamps_s.end(),
+                                    reader.ImageTimestamps().begin(),
+                                    reader.ImageTimestamps().end());
+  return true;
+}
+
+bool ReadTelemetry(const std::string& path_to_telemetry_file,
+                   CameraTelemetryData& telemetry) {
+  utils::ScopedTimer timer("telemetry_read");
+  OPENICC_TRACE_ZONE("telemetry_read");
+  const size_t nr_samples = telemetry.accelerometer.size();
+  bool success;
+  if (IsBinaryTelemetry(path_to_telemetry_file)) {
+    success = ReadTelemetryBinary(path_to_telemetry_file, telemetry);
+  } else if (IsMP4File(path_to_telemetry_file)) {
+    success = ReadGoProMP4Telemetry(path_to_telemetry_file, telemetry);
+  } else if (IsMcapFile(path_to_telemetry_file)) {
+    success = ReadMcapTelemetry(path_to_telemetry_file, "", telemetry);
+  } else if (HasExtension(path_to_telemetry_file, ".jsonl")) {
+    success = ReadZedTelemetryJSONL(path_to_telemetry_file, telemetry);
+  } else if (HasExtension(path_to_telemetry_file, ".csv")) {
+    success = ReadTelemetryCSV(path_to_telemetry_file, telemetry);
+  } else {
+    success = ReadTelemetryJSON(path_to_telemetry_file, telemetry);
+  }
+  timer.AddItems(telemetry.accelerometer.size() - nr_samples);
+  return success;
+}
+
+bool ReadFrameTimestamps(const std::string& path_to_timestamps,
+                         std::vector<double>& timestamps_s) {
+  OPENICC_TRACE_ZONE("frame_timestamps_read");
+  timestamps_s.clear();
+  if (!HasExtension(path_to_timestamps, ".txt")) {
+    CameraTelemetryData telemetry;
+    if (!ReadTelemetry(path_to_timestamps, telemetry)) {
+      return false;
+    }
+    timestamps_s = telemetry.img_timestamps_s;
+  } else {
+    std::ifstream file(path_to_timestamps);
+    if (!file.is_open()) {
+      return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+      double t_ns;
+      if (ParseCSVLine(line, 1, &t_ns) == 1) {
+        timestamps_s.push_back(t_ns * NS_TO_S);
+      }
+    }
+  }
+  if (timestamps_s.empty()) {
+    std::cerr << "No image timestamps in " << path_to_timestamps << "\n";
+    return false;
+  }
+  return true;
+}
+
 }  // namespace io
 }  // namespace OpenICC
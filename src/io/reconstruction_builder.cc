@@ -0,0 +1,159 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/reconstruction_builder.h"
+
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+#include "OpenCameraCalibrator/utils/types.h"
+
+namespace OpenICC {
+namespace io {
+
+void ReconstructionBuilder::Reserve(const size_t num_tracks,
+                                    const size_t num_views,
+                                    const size_t num_observations) {
+  track_ids_.reserve(track_ids_.size() + num_tracks);
+  track_points_.reserve(track_points_.size() + 4 * num_tracks);
+  views_.reserve(views_.size() + num_views);
+  obs_track_ids_.reserve(obs_track_ids_.size() + num_observations);
+  obs_xy_.reserve(obs_xy_.size() + 2 * num_observations);
+}
+
+void ReconstructionBuilder::AddTrack(const theia::TrackId track_id,
+                                     const Eigen::Vector4d& point) {
+  track_ids_.push_back(track_id);
+  track_points_.insert(track_points_.end(), point.data(), point.data() + 4);
+}
+
+size_t ReconstructionBuilder::AddView(
+    const std::string& name,
+    const double timestamp_s,
+    const theia::CameraIntrinsicsGroupId group_id) {
+  views_.push_back({name, timestamp_s, group_id, obs_track_ids_.size()});
+  return views_.size() - 1;
+}
+
+void ReconstructionBuilder::AddObservation(const theia::TrackId track_id,
+                                           const double x,
+                                           const double y) {
+  obs_track_ids_.push_back(track_id);
+  obs_xy_.push_back(x);
+  obs_xy_.push_back(y);
+}
+
+void ReconstructionBuilder::AddScenePoints(const nlohmann::json& scene_json) {
+  const nlohmann::json& scene_pts = scene_json["scene_pts"];
+  Reserve(scene_pts.size(), 0, 0);
+  for (const auto& it : scene_pts.items()) {
+    const nlohmann::json& xyz = it.value();
+    AddTrack((theia::TrackId)std::stoi(it.key()),
+             Eigen::Vector4d(xyz[0].get<double>(),
+                             xyz[1].get<double>(),
+                             xyz[2].get<double>(),
+                             1.0));
+  }
+}
+
+void ReconstructionBuilder::AddScenePoints(const MappedScene& scene) {
+  Reserve(scene.NumScenePoints(), 0, 0);
+  const int32_t* pt_ids = scene.ScenePointIds();
+  const double* xyz = scene.ScenePointsXYZ();
+  for (size_t i = 0; i < scene.NumScenePoints(); ++i) {
+    AddTrack((theia::TrackId)pt_ids[i],
+             Eigen::Vector4d(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], 1.0));
+  }
+}
+
+void ReconstructionBuilder::AddSceneViews(const nlohmann::json& scene_json,
+                                          const double t_offset_s) {
+  const nlohmann::json& views = scene_json["views"];
+  size_t num_observations = 0;
+  for (const auto& view : views) {
+    num_observations += view["image_points"].size();
+  }
+  Reserve(0, views.size(), num_observations);
+  for (const auto& view : views.items()) {
+    const double timestamp_us = std::stod(view.key());
+    AddView(std::to_string((uint64_t)timestamp_us),
+            timestamp_us * US_TO_S + t_offset_s);
+    for (const auto& img_pts : view.value()["image_points"].items()) {
+      const nlohmann::json& corner = img_pts.value();
+      AddObservation((theia::TrackId)std::stoi(img_pts.key()),
+                     corner[0].get<double>(),
+                     corner[1].get<double>());
+    }
+  }
+}
+
+void ReconstructionBuilder::AddSceneViews(const MappedScene& scene,
+                                          const double t_offset_s) {
+  Reserve(0, scene.NumFrames(), scene.Header().num_observations);
+  for (size_t i = 0; i < scene.NumFrames(); ++i) {
+    const SceneBinaryFrame& frame = scene.Frame(i);
+    AddView(std::to_string((uint64_t)frame.timestamp_us),
+            frame.timestamp_us * US_TO_S + t_offset_s);
+    const int32_t* ids = scene.FrameIds(i);
+    const double* xy = scene.FrameXY(i);
+    obs_track_ids_.insert(obs_track_ids_.end(), ids, ids + frame.num_obs);
+    obs_xy_.insert(obs_xy_.end(), xy, xy + 2 * frame.num_obs);
+  }
+}
+
+void ReconstructionBuilder::Build(theia::Reconstruction& reconstruction,
+                                  std::vector<theia::ViewId>* view_ids) {
+  utils::ScopedTimer timer("build_reconstruction", obs_track_ids_.size());
+  OPENICC_TRACE_ZONE("build_reconstruction");
+  for (size_t i = 0; i < track_ids_.size(); ++i) {
+    reconstruction.AddTrack(track_ids_[i]);
+    theia::Track* track = reconstruction.MutableTrack(track_ids_[i]);
+    track->SetEstimated(true);
+    *track->MutablePoint() = Eigen::Map<const Eigen::Vector4d>(
+        track_points_.data() + 4 * i);
+  }
+
+  if (view_ids) {
+    view_ids->assign(views_.size(), theia::kInvalidViewId);
+  }
+  // all corners share the covariance
+  const Eigen::Matrix2d covariance = Eigen::Matrix2d::Identity();
+  for (size_t v = 0; v < views_.size(); ++v) {
+    const StagedView& staged = views_[v];
+    const theia::ViewId view_id = reconstruction.AddView(
+        staged.name, staged.group_id, staged.timestamp_s);
+    if (view_id == theia::kInvalidViewId) {
+      continue;
+    }
+    const size_t end_obs = v + 1 < views_.size() ? views_[v + 1].first_obs
+                                                 : obs_track_ids_.size();
+    for (size_t i = staged.first_obs; i < end_obs; ++i) {
+      const Eigen::Vector2d corner(obs_xy_[2 * i], obs_xy_[2 * i + 1]);
+      reconstruction.AddObservation(
+          view_id, obs_track_ids_[i], theia::Feature(corner, covariance));
+    }
+    if (view_ids) {
+      (*view_ids)[v] = view_id;
+    }
+  }
+
+  track_ids_.clear();
+  track_points_.clear();
+  views_.clear();
+  obs_track_ids_.clear();
+  obs_xy_.clear();
+}
+
+}  // namespace io
+}  // namespace OpenICC
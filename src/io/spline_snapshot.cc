@@ -0,0 +1,160 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/io/spline_snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+
+void WriteVec3Knots(std::ofstream& file, const vec3_vector& knots) {
+  std::vector<double> buffer(3 * knots.size());
+  for (size_t i = 0; i < knots.size(); ++i) {
+    Eigen::Map<Eigen::Vector3d> knot(&buffer[3 * i]);
+    knot = knots[i];
+  }
+  file.write(reinterpret_cast<const char*>(buffer.data()),
+             buffer.size() * sizeof(double));
+}
+
+bool ReadVec3Knots(std::ifstream& file,
+                   const uint64_t num_knots,
+                   vec3_vector& knots) {
+  std::vector<double> buffer(3 * num_knots);
+  if (!file.read(reinterpret_cast<char*>(buffer.data()),
+                 buffer.size() * sizeof(double))) {
+    return false;
+  }
+  knots.resize(num_knots);
+  for (size_t i = 0; i < num_knots; ++i) {
+    knots[i] = Eigen::Map<const Eigen::Vector3d>(&buffer[3 * i]);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool WriteSplineSnapshot(const std::string& output_file,
+                         const core::SplineSnapshot& snapshot) {
+  OPENICC_TRACE_ZONE("spline_snapshot_write");
+  std::ofstream file(output_file, std::ios::out | std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Could not open: " << output_file << "\n";
+    return false;
+  }
+
+  SplineSnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SPLINE_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SPLINE_SNAPSHOT_VERSION;
+  header.spline_order = snapshot.spline_order;
+  header.start_t_ns = snapshot.start_t_ns;
+  header.end_t_ns = snapshot.end_t_ns;
+  header.dt_so3_ns = snapshot.dt_so3_ns;
+  header.dt_r3_ns = snapshot.dt_r3_ns;
+  header.dt_accl_bias_ns = snapshot.dt_accl_bias_ns;
+  header.dt_gyro_bias_ns = snapshot.dt_gyro_bias_ns;
+  header.num_so3_knots = snapshot.so3_knots.size();
+  header.num_r3_knots = snapshot.r3_knots.size();
+  header.num_accl_bias_knots = snapshot.accl_bias_knots.size();
+  header.num_gyro_bias_knots = snapshot.gyro_bias_knots.size();
+  std::memcpy(header.T_i_c, snapshot.T_i_c.data(), sizeof(header.T_i_c));
+  std::memcpy(header.gravity, snapshot.gravity.data(), sizeof(header.gravity));
+  std::memcpy(header.accl_intrinsics,
+              snapshot.accl_intrinsics.data(),
+              sizeof(header.accl_intrinsics));
+  std::memcpy(header.gyro_intrinsics,
+              snapshot.gyro_intrinsics.data(),
+              sizeof(header.gyro_intrinsics));
+  header.line_delay_s = snapshot.line_delay_s;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::vector<double> so3_buffer(4 * snapshot.so3_knots.size());
+  for (size_t i = 0; i < snapshot.so3_knots.size(); ++i) {
+    std::memcpy(&so3_buffer[4 * i],
+                snapshot.so3_knots[i].data(),
+                4 * sizeof(double));
+  }
+  file.write(reinterpret_cast<const char*>(so3_buffer.data()),
+             so3_buffer.size() * sizeof(double));
+  WriteVec3Knots(file, snapshot.r3_knots);
+  WriteVec3Knots(file, snapshot.accl_bias_knots);
+  WriteVec3Knots(file, snapshot.gyro_bias_knots);
+  file.close();
+  return !file.fail();
+}
+
+bool ReadSplineSnapshot(const std::string& path_to_snapshot,
+                        core::SplineSnapshot& snapshot) {
+  OPENICC_TRACE_ZONE("spline_snapshot_read");
+  std::ifstream file(path_to_snapshot, std::ios::in | std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Can not open " << path_to_snapshot << "\n";
+    return false;
+  }
+  SplineSnapshotHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, SPLINE_SNAPSHOT_MAGIC, 8) != 0 ||
+      header.version != SPLINE_SNAPSHOT_VERSION) {
+    std::cerr << "Not a spline snapshot file: " << path_to_snapshot << "\n";
+    return false;
+  }
+  snapshot.spline_order = header.spline_order;
+  snapshot.start_t_ns = header.start_t_ns;
+  snapshot.end_t_ns = header.end_t_ns;
+  snapshot.dt_so3_ns = header.dt_so3_ns;
+  snapshot.dt_r3_ns = header.dt_r3_ns;
+  snapshot.dt_accl_bias_ns = header.dt_accl_bias_ns;
+  snapshot.dt_gyro_bias_ns = header.dt_gyro_bias_ns;
+  snapshot.T_i_c = Eigen::Map<const Sophus::SE3d>(header.T_i_c);
+  snapshot.T_i_c.normalize();
+  snapshot.gravity = Eigen::Map<const Eigen::Vector3d>(header.gravity);
+  snapshot.accl_intrinsics =
+      Eigen::Map<const Eigen::Matrix<double, 6, 1>>(header.accl_intrinsics);
+  snapshot.gyro_intrinsics =
+      Eigen::Map<const Eigen::Matrix<double, 9, 1>>(header.gyro_intrinsics);
+  snapshot.line_delay_s = header.line_delay_s;
+
+  std::vector<double> so3_buffer(4 * header.num_so3_knots);
+  const bool knots_read =
+      file.read(reinterpret_cast<char*>(so3_buffer.data()),
+                so3_buffer.size() * sizeof(double)) &&
+      ReadVec3Knots(file, header.num_r3_knots, snapshot.r3_knots) &&
+      ReadVec3Knots(
+          file, header.num_accl_bias_knots, snapshot.accl_bias_knots) &&
+      ReadVec3Knots(
+          file, header.num_gyro_bias_knots, snapshot.gyro_bias_knots);
+  if (!knots_read) {
+    std::cerr << "Truncated spline snapshot file: " << path_to_snapshot << "\n";
+    return false;
+  }
+  snapshot.so3_knots.resize(header.num_so3_knots);
+  for (size_t i = 0; i < header.num_so3_knots; ++i) {
+    snapshot.so3_knots[i] =
+        Sophus::SO3d(Eigen::Map<const Eigen::Quaterniond>(&so3_buffer[4 * i]));
+  }
+  return true;
+}
+
+}  // namespace io
+}  // namespace OpenICC
@@ -19,6 +19,7 @@
 
 #include "OpenCameraCalibrator/io/write_camera_calibration.h"
 #include "OpenCameraCalibrator/utils/json.h"
+#include "OpenCameraCalibrator/utils/trace.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 
 #include "theia/sfm/camera/division_undistortion_camera_model.h"
@@ -36,6 +37,7 @@ bool write_camera_calibration(const std::string& output_file,
                               const double fps,
                               const int nr_calib_images,
                               const double total_reproj_error) {
+  OPENICC_TRACE_ZONE("camera_calibration_write");
   std::ofstream json_file(output_file);
   if (!json_file.is_open()) {
     std::cerr << "Could not open: " << output_file << "\n";
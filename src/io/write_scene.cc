@@ -0,0 +1,521 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ios>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "OpenCameraCalibrator/io/read_scene.h"
+#include "OpenCameraCalibrator/io/write_scene.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace io {
+
+namespace {
+const char UBJSON_OBJECT_BEGIN = '{';
+const char UBJSON_OBJECT_END = '}';
+
+void WritePadding(std::ofstream& out, const size_t target_offset) {
+  while ((size_t)out.tellp() < target_offset) {
+    out.put('\0');
+  }
+}
+
+//! Board points of the scene header, ordered by id
+void HeaderScenePoints(const nlohmann::json& header_json,
+                       std::vector<int32_t>& scene_pt_ids,
+                       std::vector<double>& scene_pts_xyz) {
+  scene_pt_ids.clear();
+  scene_pts_xyz.clear();
+  if (!header_json.contains("scene_pts")) {
+    return;
+  }
+  std::map<int32_t, Eigen::Vector3d> points;
+  for (const auto& it : header_json["scene_pts"].items()) {
+    if (it.value().is_null()) continue;
+    points[std::stoi(it.key())] = Eigen::Vector3d(it.value()[0].get<double>(),
+                                                  it.value()[1].get<double>(),
+                                                  it.value()[2].get<double>());
+  }
+  for (const auto& point : points) {
+    scene_pt_ids.push_back(point.first);
+    scene_pts_xyz.push_back(point.second[0]);
+    scene_pts_xyz.push_back(point.second[1]);
+    scene_pts_xyz.push_back(point.second[2]);
+  }
+}
+
+SceneBinaryHeader MakeSceneHeader(const nlohmann::json& header_json,
+                                  const char* magic,
+                                  const uint32_t version) {
+  SceneBinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, magic, sizeof(header.magic));
+  header.version = version;
+  header.image_width = header_json.value("image_width", 0);
+  header.image_height = header_json.value("image_height", 0);
+  header.board_type = header_json.value("calibration_board_type", 0);
+  header.camera_fps = header_json.value("camera_fps", 0.0);
+  header.square_size_meter = header_json.value("square_size_meter", 0.0);
+  return header;
+}
+
+void PutVarint(uint64_t value, std::vector<uint8_t>& out) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+void PutZigZag(const int64_t value, std::vector<uint8_t>& out) {
+  PutVarint((static_cast<uint64_t>(value) << 1) ^
+                static_cast<uint64_t>(value >> 63),
+            out);
+}
+
+template <class T>
+void PutRaw(const T& value, std::vector<uint8_t>& out) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+size_t VarintSize(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+}  // namespace
+
+SceneBsonWriter::~SceneBsonWriter() {
+  if (out_.is_open()) {
+    Close(nlohmann::json::object());
+  }
+}
+
+bool SceneBsonWriter::Open(const std::string& save_path) {
+  OPENICC_TRACE_ZONE("scene_open");
+  out_.open(save_path, std::ios::out | std::ios::binary);
+  if (!out_.is_open()) {
+    std::cerr << "Could not open: " << save_path << "\n";
+    return false;
+  }
+  num_views_ = 0;
+  out_.put(UBJSON_OBJECT_BEGIN);
+  WriteKey("views");
+  out_.put(UBJSON_OBJECT_BEGIN);
+  return true;
+}
+
+void SceneBsonWriter::WriteKey(const std::string& key) {
+  // object keys are strings without the leading 'S' type marker
+  const std::vector<std::uint8_t> key_bson =
+      nlohmann::json::to_ubjson(nlohmann::json(key));
+  out_.write(reinterpret_cast<const char*>(&key_bson[1]),
+             key_bson.size() - 1);
+}
+
+void SceneBsonWriter::AddView(const double timestamp_us,
+                              const aligned_vector<Eigen::Vector2d>& corners,
+                              const std::vector<int>& ids) {
+  if (ids.empty()) {
+    return;
+  }
+  utils::ScopedTimer timer("scene_write", 1);
+  OPENICC_TRACE_ZONE("scene_write");
+  nlohmann::json view;
+  for (size_t c = 0; c < ids.size(); ++c) {
+    view["image_points"][std::to_string(ids[c])] = {corners[c][0],
+                                                    corners[c][1]};
+  }
+  WriteKey(std::to_string(timestamp_us));
+  const std::vector<std::uint8_t> view_bson = nlohmann::json::to_ubjson(view);
+  out_.write(reinterpret_cast<const char*>(&view_bson[0]), view_bson.size());
+  ++num_views_;
+}
+
+bool SceneBsonWriter::Close(const nlohmann::json& header) {
+  if (!out_.is_open()) {
+    return false;
+  }
+  utils::ScopedTimer timer("scene_write");
+  OPENICC_TRACE_ZONE("scene_write");
+  // close "views"
+  out_.put(UBJSON_OBJECT_END);
+  for (const auto& it : header.items()) {
+    if (it.key() == "views") {
+      continue;
+    }
+    WriteKey(it.key());
+    const std::vector<std::uint8_t> value_bson =
+        nlohmann::json::to_ubjson(it.value());
+    out_.write(reinterpret_cast<const char*>(&value_bson[0]),
+               value_bson.size());
+  }
+  out_.put(UBJSON_OBJECT_END);
+  out_.close();
+  return !out_.fail();
+}
+
+bool SceneBinaryWriter::Open(const std::string& save_path) {
+  OPENICC_TRACE_ZONE("scene_open");
+  std::ofstream test_open(save_path, std::ios::out | std::ios::binary);
+  if (!test_open.is_open()) {
+    std::cerr << "Could not open: " << save_path << "\n";
+    return false;
+  }
+  save_path_ = save_path;
+  num_views_ = 0;
+  timestamps_us_.clear();
+  first_obs_.clear();
+  ids_.clear();
+  xy_.clear();
+  return true;
+}
+
+void SceneBinaryWriter::AddView(const double timestamp_us,
+                                const aligned_vector<Eigen::Vector2d>& corners,
+                                const std::vector<int>& ids) {
+  OPENICC_TRACE_ZONE("scene_write");
+  if (ids.empty()) {
+    return;
+  }
+  timestamps_us_.push_back(timestamp_us);
+  first_obs_.push_back(ids_.size());
+  for (size_t c = 0; c < ids.size(); ++c) {
+    ids_.push_back(ids[c]);
+    xy_.push_back(corners[c][0]);
+    xy_.push_back(corners[c][1]);
+  }
+  ++num_views_;
+}
+
+bool SceneBinaryWriter::Close(const nlohmann::json& header_json) {
+  if (save_path_.empty()) {
+    return false;
+  }
+  utils::ScopedTimer timer("scene_write", num_views_);
+  OPENICC_TRACE_ZONE("scene_write");
+  std::vector<int32_t> scene_pt_ids;
+  std::vector<double> scene_pts_xyz;
+  HeaderScenePoints(header_json, scene_pt_ids, scene_pts_xyz);
+
+  SceneBinaryHeader header = MakeSceneHeader(
+      header_json, SCENE_BINARY_MAGIC, SCENE_BINARY_VERSION);
+  header.num_frames = timestamps_us_.size();
+  header.num_observations = ids_.size();
+  header.num_scene_pts = scene_pt_ids.size();
+  const SceneBinaryLayout layout(header);
+
+  std::ofstream out(save_path_, std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "Could not open: " << save_path_ << "\n";
+    return false;
+  }
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (size_t f = 0; f < timestamps_us_.size(); ++f) {
+    const uint64_t next_obs =
+        f + 1 < first_obs_.size() ? first_obs_[f + 1] : ids_.size();
+    SceneBinaryFrame frame;
+    frame.timestamp_us = timestamps_us_[f];
+    frame.first_obs = first_obs_[f];
+    frame.num_obs = next_obs - first_obs_[f];
+    out.write(reinterpret_cast<const char*>(&frame), sizeof(frame));
+  }
+  out.write(reinterpret_cast<const char*>(ids_.data()),
+            ids_.size() * sizeof(int32_t));
+  WritePadding(out, layout.xy);
+  out.write(reinterpret_cast<const char*>(xy_.data()),
+            xy_.size() * sizeof(double));
+  out.write(reinterpret_cast<const char*>(scene_pt_ids.data()),
+            scene_pt_ids.size() * sizeof(int32_t));
+  WritePadding(out, layout.scene_pts_xyz);
+  out.write(reinterpret_cast<const char*>(scene_pts_xyz.data()),
+            scene_pts_xyz.size() * sizeof(double));
+  out.close();
+  save_path_.clear();
+  return !out.fail();
+}
+
+bool SceneCompactWriter::Close(const nlohmann::json& header_json) {
+  if (save_path_.empty()) {
+    return false;
+  }
+  utils::ScopedTimer timer("scene_write", num_views_);
+  OPENICC_TRACE_ZONE("scene_write");
+  std::vector<int32_t> scene_pt_ids;
+  std::vector<double> scene_pts_xyz;
+  HeaderScenePoints(header_json, scene_pt_ids, scene_pts_xyz);
+
+  SceneBinaryHeader header = MakeSceneHeader(
+      header_json, SCENE_COMPACT_MAGIC, SCENE_COMPACT_VERSION);
+  header.num_frames = timestamps_us_.size();
+  header.num_observations = ids_.size();
+  header.num_scene_pts = scene_pt_ids.size();
+
+  std::vector<uint8_t> buffer;
+  buffer.reserve(sizeof(header) + 4 * ids_.size() +
+                 32 * scene_pt_ids.size() + 16 * timestamps_us_.size());
+  PutRaw(header, buffer);
+  int64_t last_pt_id = -1;
+  for (size_t i = 0; i < scene_pt_ids.size(); ++i) {
+    PutVarint(scene_pt_ids[i] - last_pt_id, buffer);
+    last_pt_id = scene_pt_ids[i];
+    for (int k = 0; k < 3; ++k) {
+      PutRaw(scene_pts_xyz[3 * i + k], buffer);
+    }
+  }
+  // bitmask over the board points, only possible if the ids are known
+  const size_t mask_size =
+      scene_pt_ids.empty() ? 0 : (scene_pt_ids.back() + 8) / 8;
+
+  std::vector<size_t> order;
+  std::vector<uint8_t> mask;
+  for (size_t f = 0; f < timestamps_us_.size(); ++f) {
+    const size_t first = first_obs_[f];
+    const size_t end = f + 1 < first_obs_.size() ? first_obs_[f + 1]
+                                                 : ids_.size();
+    order.resize(end - first);
+    for (size_t c = 0; c < order.size(); ++c) order[c] = first + c;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return ids_[a] < ids_[b];
+    });
+
+    PutRaw(timestamps_us_[f], buffer);
+    PutVarint(order.size(), buffer);
+    size_t delta_size = 0;
+    bool maskable = mask_size > 0;
+    int64_t last_id = -1;
+    for (const size_t o : order) {
+      delta_size += VarintSize(ids_[o] - last_id);
+      maskable &= ids_[o] > last_id && ids_[o] <= scene_pt_ids.back();
+      last_id = ids_[o];
+    }
+    if (maskable && mask_size < delta_size) {
+      buffer.push_back(1);
+      mask.assign(mask_size, 0);
+      for (const size_t o : order) {
+        mask[ids_[o] / 8] |= static_cast<uint8_t>(1 << (ids_[o] % 8));
+      }
+      buffer.insert(buffer.end(), mask.begin(), mask.end());
+    } else {
+      buffer.push_back(0);
+      last_id = -1;
+      for (const size_t o : order) {
+        PutVarint(ids_[o] - last_id, buffer);
+        last_id = ids_[o];
+      }
+    }
+
+    // consecutive corners of a board row lie on a line, so extrapolating
+    // the last two leaves a residual of a few quantization steps
+    int64_t prev[2][2] = {{0, 0}, {0, 0}};
+    for (size_t c = 0; c < order.size(); ++c) {
+      const size_t o = order[c];
+      const int64_t q[2] = {
+          std::llround(xy_[2 * o] * SCENE_COMPACT_SUBPIXEL),
+          std::llround(xy_[2 * o + 1] * SCENE_COMPACT_SUBPIXEL)};
+      const bool extrapolate =
+          c >= 2 && ids_[o] - ids_[order[c - 1]] ==
+                        ids_[order[c - 1]] - ids_[order[c - 2]];
+      for (int k = 0; k < 2; ++k) {
+        const int64_t prediction =
+            extrapolate ? 2 * prev[0][k] - prev[1][k] : prev[0][k];
+        PutZigZag(q[k] - prediction, buffer);
+        prev[1][k] = prev[0][k];
+        prev[0][k] = q[k];
+      }
+    }
+  }
+
+  std::ofstream out(save_path_, std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "Could not open: " << save_path_ << "\n";
+    return false;
+  }
+  out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  out.close();
+  save_path_.clear();
+  return !out.fail();
+}
+
+bool SceneMemoryWriter::Open(const std::string& save_path) {
+  OPENICC_TRACE_ZONE("scene_open");
+  num_views_ = 0;
+  scene_ = nlohmann::json::object();
+  scene_["views"] = nlohmann::json::object();
+  file_writer_.reset();
+  if (!save_path.empty()) {
+    file_writer_ = CreateSceneWriter(save_path);
+    if (!file_writer_->Open(save_path)) {
+      file_writer_.reset();
+      return false;
+    }
+  }
+  return true;
+}
+
+void SceneMemoryWriter::AddView(const double timestamp_us,
+                                const aligned_vector<Eigen::Vector2d>& corners,
+                                const std::vector<int>& ids) {
+  OPENICC_TRACE_ZONE("scene_write");
+  if (ids.empty()) {
+    return;
+  }
+  nlohmann::json& view = scene_["views"][std::to_string(timestamp_us)];
+  for (size_t c = 0; c < ids.size(); ++c) {
+    view["image_points"][std::to_string(ids[c])] = {corners[c][0],
+                                                    corners[c][1]};
+  }
+  if (file_writer_) {
+    file_writer_->AddView(timestamp_us, corners, ids);
+  }
+  ++num_views_;
+}
+
+bool SceneMemoryWriter::Close(const nlohmann::json& header) {
+  OPENICC_TRACE_ZONE("scene_write");
+  for (const auto& it : header.items()) {
+    if (it.key() == "views") {
+      continue;
+    }
+    scene_[it.key()] = it.value();
+  }
+  if (file_writer_) {
+    const bool written = file_writer_->Close(header);
+    file_writer_.reset();
+    return written;
+  }
+  return true;
+}
+
+std::unique_ptr<SceneWriter> CreateSceneWriter(const std::string& save_path) {
+  auto has_extension = [&](const std::string& extension) {
+    return save_path.size() >= extension.size() &&
+           save_path.compare(save_path.size() - extension.size(),
+                             extension.size(),
+                             extension) == 0;
+  };
+  if (has_extension(SCENE_BINARY_EXTENSION)) {
+    return std::unique_ptr<SceneWriter>(new SceneBinaryWriter());
+  }
+  if (has_extension(SCENE_COMPACT_EXTENSION)) {
+    return std::unique_ptr<SceneWriter>(new SceneCompactWriter());
+  }
+  return std::unique_ptr<SceneWriter>(new SceneBsonWriter());
+}
+
+namespace {
+
+struct SceneView {
+  aligned_vector<Eigen::Vector2d> corners;
+  std::vector<int> ids;
+};
+
+}  // namespace
+
+bool MergeSceneFiles(const std::vector<std::string>& input_paths,
+                     const std::string& save_path) {
+  utils::ScopedTimer timer("scene_merge");
+  OPENICC_TRACE_ZONE("scene_merge");
+  nlohmann::json header = nlohmann::json::object();
+  std::map<double, SceneView> views;
+  for (const std::string& input_path : input_paths) {
+    nlohmann::json scene;
+    if (!read_scene_bson(input_path, scene)) {
+      std::cerr << "Could not read scene " << input_path << "\n";
+      return false;
+    }
+    for (const auto& it : scene.items()) {
+      if (it.key() == "views") {
+        continue;
+      }
+      if (!header.contains(it.key())) {
+        header[it.key()] = it.value();
+        continue;
+      }
+      // the frame rate of MCAP shards comes from their own frames
+      const bool same =
+          it.key() == "camera_fps"
+              ? std::abs(header[it.key()].get<double>() -
+                         it.value().get<double>()) <=
+                    1e-3 * header[it.key()].get<double>()
+              : header[it.key()] == it.value();
+      if (!same) {
+        std::cerr << "Field " << it.key() << " of " << input_path
+                  << " differs from the other shards.\n";
+        return false;
+      }
+    }
+
+    // binary scenes keep the corner order of the extraction, the json
+    // layout sorts the ids
+    std::vector<std::pair<double, SceneView>> shard_views;
+    if (is_binary_scene(input_path)) {
+      MappedScene mapped;
+      if (!mapped.Open(input_path)) {
+        return false;
+      }
+      for (size_t f = 0; f < mapped.NumFrames(); ++f) {
+        SceneView view;
+        const double* xy = mapped.FrameXY(f);
+        for (size_t c = 0; c < mapped.Frame(f).num_obs; ++c) {
+          view.ids.push_back(mapped.FrameIds(f)[c]);
+          view.corners.emplace_back(xy[2 * c], xy[2 * c + 1]);
+        }
+        shard_views.emplace_back(mapped.Frame(f).timestamp_us,
+                                 std::move(view));
+      }
+    } else if (scene.contains("views")) {
+      for (const auto& it : scene["views"].items()) {
+        SceneView view;
+        for (const auto& pt : it.value()["image_points"].items()) {
+          view.ids.push_back(std::stoi(pt.key()));
+          view.corners.emplace_back(pt.value()[0].get<double>(),
+                                    pt.value()[1].get<double>());
+        }
+        shard_views.emplace_back(std::stod(it.key()), std::move(view));
+      }
+    }
+    for (auto& view : shard_views) {
+      if (!views.emplace(view.first, std::move(view.second)).second) {
+        std::cerr << "Shards overlap at " << view.first << "us, keeping the "
+                  << "view of the first shard.\n";
+      }
+    }
+  }
+
+  std::unique_ptr<SceneWriter> writer = CreateSceneWriter(save_path);
+  if (!writer->Open(save_path)) {
+    return false;
+  }
+  for (const auto& view : views) {
+    writer->AddView(view.first, view.second.corners, view.second.ids);
+  }
+  timer.AddItems(views.size());
+  return writer->Close(header);
+}
+
+}  // namespace io
+}  // namespace OpenICC
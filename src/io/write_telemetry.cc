@@ -0,0 +1,151 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "OpenCameraCalibrator/io/read_telemetry.h"
+#include "OpenCameraCalibrator/io/write_telemetry.h"
+#include "OpenCameraCalibrator/utils/profiler.h"
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace io {
+
+bool WriteTelemetryBinary(const std::string& output_file,
+                          const CameraTelemetryData& telemetry,
+                          const uint32_t samples_per_block) {
+  const size_t nr_samples = telemetry.accelerometer.size();
+  utils::ScopedTimer timer("telemetry_write", nr_samples);
+  OPENICC_TRACE_ZONE("telemetry_write");
+  if (telemetry.gyroscope.size() != nr_samples || samples_per_block == 0) {
+    std::cerr << "Telemetry should have the same amount of accelerometer and "
+                 "gyroscope values.\n";
+    return false;
+  }
+  std::ofstream file(output_file, std::ios::out | std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Could not open: " << output_file << "\n";
+    return false;
+  }
+
+  TelemetryBinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, TELEMETRY_BINARY_MAGIC, sizeof(header.magic));
+  header.version = TELEMETRY_BINARY_VERSION;
+  header.samples_per_block = samples_per_block;
+  header.num_samples = nr_samples;
+  header.num_blocks = (nr_samples + samples_per_block - 1) / samples_per_block;
+  header.num_img_timestamps = telemetry.img_timestamps_s.size();
+
+  // 7 doubles per sample: t, accl xyz, gyro xyz
+  std::vector<TelemetryBinaryBlock> blocks(header.num_blocks);
+  uint64_t offset = sizeof(header) +
+                    header.num_img_timestamps * sizeof(double) +
+                    header.num_blocks * sizeof(TelemetryBinaryBlock);
+  for (size_t b = 0; b < blocks.size(); ++b) {
+    const size_t first = b * samples_per_block;
+    const size_t last =
+        std::min<size_t>(first + samples_per_block, nr_samples) - 1;
+    blocks[b].t_start_s = telemetry.accelerometer[first].timestamp_s();
+    blocks[b].t_end_s = telemetry.accelerometer[last].timestamp_s();
+    blocks[b].offset = offset;
+    blocks[b].num_samples = last - first + 1;
+    offset += 7 * blocks[b].num_samples * sizeof(double);
+  }
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(telemetry.img_timestamps_s.data()),
+             telemetry.img_timestamps_s.size() * sizeof(double));
+  file.write(reinterpret_cast<const char*>(blocks.data()),
+             blocks.size() * sizeof(TelemetryBinaryBlock));
+
+  std::vector<double> t_s, accl, gyro;
+  for (size_t b = 0; b < blocks.size(); ++b) {
+    const TelemetryBinaryBlock& block = blocks[b];
+    const size_t start = b * samples_per_block;
+    t_s.resize(block.num_samples);
+    accl.resize(3 * block.num_samples);
+    gyro.resize(3 * block.num_samples);
+    for (size_t s = 0; s < block.num_samples; ++s) {
+      const auto& acc_reading = telemetry.accelerometer[start + s];
+      const auto& gyr_reading = telemetry.gyroscope[start + s];
+      t_s[s] = acc_reading.timestamp_s();
+      for (int k = 0; k < 3; ++k) {
+        accl[3 * s + k] = acc_reading(k);
+        gyro[3 * s + k] = gyr_reading(k);
+      }
+    }
+    file.write(reinterpret_cast<const char*>(t_s.data()),
+               t_s.size() * sizeof(double));
+    file.write(reinterpret_cast<const char*>(accl.data()),
+               accl.size() * sizeof(double));
+    file.write(reinterpret_cast<const char*>(gyro.data()),
+               gyro.size() * sizeof(double));
+  }
+  file.close();
+  return !file.fail();
+}
+
+bool WriteTelemetryJSON(const std::string& output_file,
+                        const CameraTelemetryData& telemetry) {
+  const size_t nr_samples = telemetry.accelerometer.size();
+  utils::ScopedTimer timer("telemetry_write", nr_samples);
+  OPENICC_TRACE_ZONE("telemetry_write");
+  if (telemetry.gyroscope.size() != nr_samples) {
+    std::cerr << "Telemetry should have the same amount of accelerometer and "
+                 "gyroscope values.\n";
+    return false;
+  }
+  std::ofstream file(output_file);
+  if (!file.is_open()) {
+    std::cerr << "Could not open: " << output_file << "\n";
+    return false;
+  }
+  auto to_ns = [](const double t_s) {
+    return static_cast<int64_t>(std::llround(t_s * S_TO_NS));
+  };
+  auto write_readings = [&](const ImuReadings& readings) {
+    for (size_t i = 0; i < readings.size(); ++i) {
+      file << (i ? "," : "") << "[" << readings[i].x() << ","
+           << readings[i].y() << "," << readings[i].z() << "]";
+    }
+  };
+
+  file << std::setprecision(17);
+  file << "{\"timestamps_ns\":[";
+  for (size_t i = 0; i < nr_samples; ++i) {
+    file << (i ? "," : "") << to_ns(telemetry.accelerometer[i].timestamp_s());
+  }
+  file << "],\"accelerometer\":[";
+  write_readings(telemetry.accelerometer);
+  file << "],\"gyroscope\":[";
+  write_readings(telemetry.gyroscope);
+  file << "],\"img_timestamps_ns\":[";
+  for (size_t i = 0; i < telemetry.img_timestamps_s.size(); ++i) {
+    file << (i ? "," : "") << to_ns(telemetry.img_timestamps_s[i]);
+  }
+  file << "]}";
+  file.close();
+  return !file.fail();
+}
+
+}  // namespace io
+}  // namespace OpenICC
@@ -0,0 +1,159 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef OPENICC_COUNT_ALLOCATIONS
+namespace {
+
+// trivially constructed, so operator new can use them on any thread without
+// allocating itself
+thread_local size_t thread_allocations = 0;
+thread_local size_t thread_allocated_bytes = 0;
+thread_local bool thread_counting = true;
+
+//! Counts and allocates like operator new, but returns nullptr on failure.
+//! An alignment of 0 is the default alignment.
+void* CountedAllocate(const std::size_t size, const std::size_t alignment) {
+  if (thread_counting) {
+    ++thread_allocations;
+    thread_allocated_bytes += size;
+  }
+  // malloc(0) may return nullptr, operator new has to return a unique pointer
+  const std::size_t n = size == 0 ? 1 : size;
+  while (true) {
+    void* ptr = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+      ptr = std::malloc(n);
+    } else {
+      // aligned_alloc needs a multiple of the alignment
+      const std::size_t aligned_n = (n + alignment - 1) & ~(alignment - 1);
+      ptr = std::aligned_alloc(alignment, aligned_n);
+    }
+    if (ptr) {
+      return ptr;
+    }
+    const std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      return nullptr;
+    }
+    handler();
+  }
+}
+
+void* Allocate(const std::size_t size, const std::size_t alignment) {
+  void* ptr = CountedAllocate(size, alignment);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+}  // namespace
+#endif
+
+namespace OpenICC {
+namespace utils {
+
+AllocationCount ThreadAllocations() {
+  AllocationCount count;
+#ifdef OPENICC_COUNT_ALLOCATIONS
+  count.allocations = thread_allocations;
+  count.bytes = thread_allocated_bytes;
+#endif
+  return count;
+}
+
+#ifdef OPENICC_COUNT_ALLOCATIONS
+ScopedUncountedAllocations::ScopedUncountedAllocations()
+    : was_counting_(thread_counting) {
+  thread_counting = false;
+}
+
+ScopedUncountedAllocations::~ScopedUncountedAllocations() {
+  thread_counting = was_counting_;
+}
+#else
+ScopedUncountedAllocations::ScopedUncountedAllocations()
+    : was_counting_(false) {}
+
+ScopedUncountedAllocations::~ScopedUncountedAllocations() {}
+#endif
+
+}  // namespace utils
+}  // namespace OpenICC
+
+#ifdef OPENICC_COUNT_ALLOCATIONS
+// replacements of all global allocation functions, so that every new and
+// delete of the program goes through the counters and malloc/free
+void* operator new(std::size_t size) { return Allocate(size, 0); }
+void* operator new[](std::size_t size) { return Allocate(size, 0); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return CountedAllocate(size, 0);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return CountedAllocate(size, 0);
+}
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  return Allocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return Allocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new(std::size_t size,
+                   std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size,
+                     std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+void operator delete(void* ptr,
+                     std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void* ptr,
+                       std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+#endif
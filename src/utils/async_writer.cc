@@ -0,0 +1,95 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/async_writer.h"
+
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+// pending writes before Submit blocks
+constexpr size_t kMaxPendingWrites = 16;
+}  // namespace
+
+AsyncWriter::AsyncWriter(const int num_threads) : jobs_(kMaxPendingWrites) {
+  for (int t = 0; t < num_threads; ++t) {
+    threads_.emplace_back([this]() {
+      Job job;
+      while (jobs_.Pop(job)) {
+        Run(job);
+        job = Job();
+      }
+    });
+  }
+}
+
+AsyncWriter::~AsyncWriter() { Wait(); }
+
+void AsyncWriter::Submit(const std::string& path, WriteFunction write) {
+  Job job{path, std::move(write)};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!threads_.empty() && jobs_.Push(std::move(job))) {
+      return;
+    }
+  }
+  Run(job);
+}
+
+void AsyncWriter::SubmitJson(const std::string& path,
+                             nlohmann::json json,
+                             const int indent) {
+  Submit(path,
+         [json = std::move(json), indent](const std::string& tmp_path) {
+           std::ofstream file(tmp_path);
+           if (!file.is_open()) {
+             return false;
+           }
+           file << std::setw(indent) << json << std::endl;
+           return file.good();
+         });
+}
+
+bool AsyncWriter::Wait() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  jobs_.Close();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+  return success_;
+}
+
+void AsyncWriter::Run(Job& job) {
+  OPENICC_TRACE_ZONE("async_write");
+  const std::string tmp_path = job.path + ".tmp";
+  if (!job.write(tmp_path) ||
+      std::rename(tmp_path.c_str(), job.path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    LOG(ERROR) << "Could not write " << job.path;
+    success_ = false;
+  }
+}
+
+}  // namespace utils
+}  // namespace OpenICC
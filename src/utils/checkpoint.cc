@@ -0,0 +1,62 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/checkpoint.h"
+
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <fstream>
+
+namespace OpenICC {
+namespace utils {
+
+Checkpointer::Checkpointer(const std::string& path, const double interval_s)
+    : path_(path), interval_s_(interval_s), last_write_(Clock::now()) {}
+
+bool Checkpointer::Exists() const {
+  return Enabled() && std::ifstream(path_).good();
+}
+
+bool Checkpointer::Due() const {
+  return Enabled() &&
+         std::chrono::duration<double>(Clock::now() - last_write_).count() >=
+             interval_s_;
+}
+
+bool Checkpointer::Write(
+    const std::function<bool(const std::string&)>& write) {
+  if (!Enabled()) {
+    return false;
+  }
+  last_write_ = Clock::now();
+  const std::string tmp_path = path_ + ".tmp";
+  if (!write(tmp_path) ||
+      std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    LOG(WARNING) << "Could not write the checkpoint " << path_;
+    return false;
+  }
+  return true;
+}
+
+void Checkpointer::Remove() const {
+  if (Enabled()) {
+    std::remove(path_.c_str());
+  }
+}
+
+}  // namespace utils
+}  // namespace OpenICC
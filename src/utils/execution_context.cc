@@ -0,0 +1,183 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/execution_context.h"
+
+#include <glog/logging.h>
+#include <opencv2/core.hpp>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+std::atomic<int> configured_num_threads(0);
+std::atomic<bool> configured_deterministic(false);
+std::mutex cpus_mutex;
+std::vector<int> configured_cpus;
+
+//! CPUs the process may currently run on, empty if unknown
+std::vector<int> AllowedCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+  }
+#endif
+  return cpus;
+}
+}  // namespace
+
+bool ParseCpuList(const std::string& cpu_list, std::vector<int>& cpus) {
+  cpus.clear();
+  std::stringstream list(cpu_list);
+  for (std::string range; std::getline(list, range, ',');) {
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace),
+                range.end());
+    if (range.empty()) continue;
+    const size_t dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0, dash));
+      const int last =
+          dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      if (first < 0 || last < first) return false;
+      for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    } catch (const std::exception&) {
+      return false;
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return true;
+}
+
+bool ExecutionContext::Configure(const ExecutionContextOptions& options) {
+  std::vector<int> cpus = options.cpus;
+  bool success = true;
+  if (options.numa_node >= 0) {
+    std::ifstream cpulist_file("/sys/devices/system/node/node" +
+                               std::to_string(options.numa_node) +
+                               "/cpulist");
+    std::string cpulist;
+    std::vector<int> node_cpus;
+    if (!std::getline(cpulist_file, cpulist) ||
+        !ParseCpuList(cpulist, node_cpus)) {
+      LOG(ERROR) << "Could not read the CPUs of NUMA node "
+                 << options.numa_node;
+      success = false;
+    } else if (cpus.empty()) {
+      cpus = node_cpus;
+    } else {
+      std::vector<int> both;
+      std::set_intersection(cpus.begin(),
+                            cpus.end(),
+                            node_cpus.begin(),
+                            node_cpus.end(),
+                            std::back_inserter(both));
+      cpus = both;
+    }
+  }
+
+  if (!cpus.empty()) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+      if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      LOG(ERROR) << "Could not pin the process to the requested CPUs.";
+      success = false;
+    }
+#else
+    LOG(WARNING) << "CPU affinity is only supported on Linux.";
+    success = false;
+#endif
+  } else if (options.numa_node >= 0 || !options.cpus.empty()) {
+    LOG(ERROR) << "No CPU left after combining the CPU list and NUMA node.";
+    success = false;
+  }
+
+  const std::vector<int> allowed = AllowedCpus();
+  const int num_cpus =
+      allowed.empty()
+          ? std::max(1, static_cast<int>(std::thread::hardware_concurrency()))
+          : static_cast<int>(allowed.size());
+  const int num_threads =
+      options.num_threads > 0 ? std::min(options.num_threads, num_cpus)
+                              : num_cpus;
+  configured_num_threads = num_threads;
+  configured_deterministic = options.deterministic;
+  {
+    std::lock_guard<std::mutex> lock(cpus_mutex);
+    configured_cpus = success && !cpus.empty() ? allowed : std::vector<int>();
+  }
+  cv::setNumThreads(num_threads);
+  LOG(INFO) << "Execution context: " << num_threads << " threads on "
+            << num_cpus << " CPUs"
+            << (options.deterministic ? ", deterministic." : ".");
+  return success;
+}
+
+int ExecutionContext::NumThreads() {
+  const int num_threads = configured_num_threads;
+  if (num_threads > 0) {
+    return num_threads;
+  }
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+bool ExecutionContext::Deterministic() { return configured_deterministic; }
+
+int ExecutionContext::SolverThreads(const int num_threads) {
+  return Deterministic() ? 1 : std::max(1, num_threads);
+}
+
+std::vector<int> ExecutionContext::Cpus() {
+  std::lock_guard<std::mutex> lock(cpus_mutex);
+  return configured_cpus;
+}
+
+bool ConfigureExecutionContext(const int num_threads,
+                               const std::string& cpu_list,
+                               const int numa_node,
+                               const bool deterministic) {
+  ExecutionContextOptions options;
+  options.deterministic = deterministic;
+  options.num_threads = num_threads;
+  options.numa_node = numa_node;
+  if (!ParseCpuList(cpu_list, options.cpus)) {
+    LOG(ERROR) << "Malformed CPU list: " << cpu_list;
+    return false;
+  }
+  return ExecutionContext::Configure(options);
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <fstream>
+#include <limits>
 #include <vector>
 
 // CODE TAKEN FROM
@@ -32,6 +33,68 @@ namespace utils {
 
 using Vector3d = Eigen::Vector3d;
 
+namespace {
+
+//! Mean and variance of a fixed size window that slides over the samples one
+//! index at a time. As in a running moving average the statistics are
+//! updated with the sample entering and the one leaving the window (Welford
+//! style), so sliding is O(1). The sums are recomputed from scratch every
+//! RECOMPUTE_INTERVAL slides to keep rounding errors from accumulating.
+class SlidingWindowVariance {
+ public:
+  SlidingWindowVariance(const ImuReadings& samples,
+                        const int start_idx,
+                        const int win_size)
+      : samples_(samples), start_idx_(start_idx), win_size_(win_size) {
+    Recompute();
+  }
+
+  //! Moves the window one sample forward
+  void Slide() {
+    const Vector3d x_old = samples_[start_idx_].data();
+    const Vector3d x_new = samples_[start_idx_ + win_size_].data();
+    ++start_idx_;
+    if (++num_slides_ % RECOMPUTE_INTERVAL == 0) {
+      Recompute();
+      return;
+    }
+    const Vector3d old_mean = mean_;
+    mean_ += (x_new - x_old) / double(win_size_);
+    m2_ += ((x_new - x_old).array() *
+            (x_new - mean_ + x_old - old_mean).array())
+               .matrix();
+    m2_ = m2_.cwiseMax(0.0);
+  }
+
+  //! Unbiased variance of the current window, same as DataVariance
+  Vector3d Variance() const { return m2_ / double(win_size_ - 1); }
+
+ private:
+  static constexpr int RECOMPUTE_INTERVAL = 4096;
+
+  void Recompute() {
+    mean_.setZero();
+    for (int i = start_idx_; i < start_idx_ + win_size_; ++i) {
+      mean_ += samples_[i].data();
+    }
+    mean_ /= double(win_size_);
+    m2_.setZero();
+    for (int i = start_idx_; i < start_idx_ + win_size_; ++i) {
+      const Vector3d diff = samples_[i].data() - mean_;
+      m2_ += (diff.array() * diff.array()).matrix();
+    }
+  }
+
+  const ImuReadings& samples_;
+  int start_idx_;
+  const int win_size_;
+  int num_slides_ = 0;
+  Vector3d mean_;
+  Vector3d m2_;
+};
+
+}  // namespace
+
 Vector3d DataMean(const ImuReadings& samples, const DataInterval& interval) {
   DataInterval rev_interval = CheckInterval(samples, interval);
   int n_samp = rev_interval.end_idx - rev_interval.start_idx + 1;
@@ -108,26 +171,36 @@ void ExtractIntervalsSamples(const ImuReadings& samples,
   }
 }
 
-void StaticIntervalsDetector(const ImuReadings& samples,
-                             double threshold,
-                             std::vector<DataInterval>& intervals,
+void LocalVarianceMagnitudes(const ImuReadings& samples,
+                             std::vector<double>& variance_norms,
                              int win_size) {
   if (win_size < 11) win_size = 11;
   if (!(win_size % 2)) win_size++;
 
   int h = win_size / 2;
 
+  // Samples without a full window around them are never static
+  variance_norms.assign(samples.size(),
+                        std::numeric_limits<double>::infinity());
   if (win_size >= samples.size()) return;
 
+  SlidingWindowVariance window(samples, 0, win_size);
+  for (size_t i = h; i < samples.size() - h; i++) {
+    if (i > size_t(h)) window.Slide();
+    variance_norms[i] = window.Variance().norm();
+  }
+}
+
+void StaticIntervalsDetector(const std::vector<double>& variance_norms,
+                             double threshold,
+                             std::vector<DataInterval>& intervals) {
   intervals.clear();
 
   bool look_for_start = true;
   DataInterval current_interval;
 
-  for (size_t i = h; i < samples.size() - h; i++) {
-    Vector3d variance = DataVariance(samples, DataInterval(i - h, i + h));
-    double norm = variance.norm();
-
+  for (size_t i = 0; i < variance_norms.size(); i++) {
+    const double norm = variance_norms[i];
     if (look_for_start) {
       if (norm < threshold) {
         current_interval.start_idx = i;
@@ -144,11 +217,19 @@ void StaticIntervalsDetector(const ImuReadings& samples,
 
   // If the last interval has not been included in the intervals vector
   if (!look_for_start) {
-    current_interval.end_idx = samples.size() - h - 1;
-    // current_interval.end_ts = samples[current_interval.end_idx].timestamp();
+    current_interval.end_idx = variance_norms.size() - 1;
     intervals.push_back(current_interval);
   }
 }
 
+void StaticIntervalsDetector(const ImuReadings& samples,
+                             double threshold,
+                             std::vector<DataInterval>& intervals,
+                             int win_size) {
+  std::vector<double> variance_norms;
+  LocalVarianceMagnitudes(samples, variance_norms, win_size);
+  StaticIntervalsDetector(variance_norms, threshold, intervals);
+}
+
 }  // namespace utils
 }  // namespace OpenICC
@@ -0,0 +1,77 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/imu_excitation.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace OpenICC {
+namespace utils {
+
+std::vector<std::pair<double, double>> SelectExcitedSegments(
+    const std::vector<double>& timestamps_s,
+    const vec3_vector& gyro,
+    const vec3_vector& accl,
+    const ExcitationOptions& options) {
+  std::vector<std::pair<double, double>> segments;
+  if (timestamps_s.empty() || options.window_s <= 0.0) {
+    return segments;
+  }
+
+  // excited windows, consecutive ones are merged on the fly
+  size_t first = 0;
+  while (first < timestamps_s.size()) {
+    const double t_start = timestamps_s[first];
+    const double t_end = t_start + options.window_s;
+    Eigen::Vector3d accl_sum(0.0, 0.0, 0.0), accl_sq_sum(0.0, 0.0, 0.0);
+    double gyro_sq_sum = 0.0;
+    size_t last = first;
+    for (; last < timestamps_s.size() && timestamps_s[last] < t_end; ++last) {
+      gyro_sq_sum += gyro[last].squaredNorm();
+      accl_sum += accl[last];
+      accl_sq_sum += accl[last].cwiseAbs2();
+    }
+    const double n = static_cast<double>(last - first);
+    const double gyro_rms = std::sqrt(gyro_sq_sum / n);
+    const Eigen::Vector3d accl_mean = accl_sum / n;
+    const double accl_std = std::sqrt(std::max(
+        0.0, (accl_sq_sum / n - accl_mean.cwiseAbs2()).sum()));
+    const bool excited = gyro_rms >= options.min_gyro_rms_rad_s ||
+                         accl_std >= options.min_accl_std_m_s2;
+    if (excited) {
+      const double start = t_start - options.padding_s;
+      const double end = timestamps_s[last - 1] + options.padding_s;
+      if (!segments.empty() && start <= segments.back().second) {
+        segments.back().second = end;
+      } else {
+        segments.emplace_back(start, end);
+      }
+    }
+    first = last;
+  }
+
+  segments.erase(std::remove_if(segments.begin(),
+                                segments.end(),
+                                [&](const std::pair<double, double>& s) {
+                                  return s.second - s.first <
+                                         options.min_segment_s;
+                                }),
+                 segments.end());
+  return segments;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
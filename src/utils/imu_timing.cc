@@ -0,0 +1,251 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/imu_timing.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+//! Replaces the timestamps of samples [begin, end) by the least squares fit
+//! t_k = a + b * k of a constant rate clock. Returns false and keeps the
+//! timestamps if a correction would exceed max_correction_s.
+bool DejitterSegment(const size_t begin,
+                     const size_t end,
+                     const double max_correction_s,
+                     ImuReadings& samples,
+                     double& correction_sq_sum) {
+  const size_t m = end - begin;
+  if (m < 3) {
+    return true;
+  }
+  // relative to the first timestamp, so that the sums do not cancel
+  const double t0 = samples[begin].timestamp_s();
+  const double k_mean = 0.5 * static_cast<double>(m - 1);
+  double t_mean = 0.0;
+  for (size_t i = begin; i < end; ++i) {
+    t_mean += samples[i].timestamp_s() - t0;
+  }
+  t_mean /= static_cast<double>(m);
+  double s_kt = 0.0, s_kk = 0.0;
+  for (size_t k = 0; k < m; ++k) {
+    const double dk = static_cast<double>(k) - k_mean;
+    s_kt += dk * (samples[begin + k].timestamp_s() - t0 - t_mean);
+    s_kk += dk * dk;
+  }
+  const double slope = s_kt / s_kk;
+  auto fitted = [&](const size_t k) {
+    return t0 + t_mean + slope * (static_cast<double>(k) - k_mean);
+  };
+
+  for (size_t k = 0; k < m; ++k) {
+    if (std::abs(fitted(k) - samples[begin + k].timestamp_s()) >
+        max_correction_s) {
+      return false;
+    }
+  }
+  for (size_t k = 0; k < m; ++k) {
+    const double t = fitted(k);
+    const double correction = t - samples[begin + k].timestamp_s();
+    correction_sq_sum += correction * correction;
+    samples[begin + k] = ImuReading<double>(t, samples[begin + k].data());
+  }
+  return true;
+}
+
+void LogReport(const std::string& name, const ImuTimingReport& report) {
+  LOG(INFO) << name << ": nominal rate " << 1.0 / report.nominal_period_s
+            << " Hz, max interval " << report.max_interval_s * 1e3
+            << " ms, jitter RMS " << report.jitter_rms_s * 1e6 << " us, "
+            << report.gaps.size() << " gaps, " << report.num_dropped
+            << " dropped samples.";
+  if (report.num_segments_not_dejittered > 0) {
+    LOG(WARNING) << name << ": " << report.num_segments_not_dejittered
+                 << " segments are not close to a constant rate and kept "
+                    "their timestamps.";
+  }
+}
+
+}  // namespace
+
+double NominalSamplePeriod(const ImuReadings& samples) {
+  if (samples.size() < 2) {
+    return 0.0;
+  }
+  std::vector<double> intervals(samples.size() - 1);
+  for (size_t i = 1; i < samples.size(); ++i) {
+    intervals[i - 1] = samples[i].timestamp_s() - samples[i - 1].timestamp_s();
+  }
+  auto median = intervals.begin() + intervals.size() / 2;
+  std::nth_element(intervals.begin(), median, intervals.end());
+  return *median;
+}
+
+bool SanitizeImuTimestamps(const ImuTimingOptions& options,
+                           ImuReadings& samples,
+                           ImuTimingReport& report) {
+  report = ImuTimingReport();
+  auto earlier = [](const ImuReading<double>& a, const ImuReading<double>& b) {
+    return a.timestamp_s() < b.timestamp_s();
+  };
+  if (!std::is_sorted(samples.begin(), samples.end(), earlier)) {
+    std::stable_sort(samples.begin(), samples.end(), earlier);
+  }
+  // of samples with the same timestamp the first one is kept
+  size_t num_kept = std::min<size_t>(1, samples.size());
+  for (size_t i = 1; i < samples.size(); ++i) {
+    if (samples[i].timestamp_s() > samples[num_kept - 1].timestamp_s()) {
+      samples[num_kept++] = samples[i];
+    }
+  }
+  report.num_dropped = samples.size() - num_kept;
+  samples.resize(num_kept);
+  if (samples.size() < 2) {
+    return false;
+  }
+
+  report.nominal_period_s = NominalSamplePeriod(samples);
+  const double gap_threshold = options.gap_factor * report.nominal_period_s;
+  const double max_correction =
+      options.max_correction_factor * report.nominal_period_s;
+  double correction_sq_sum = 0.0;
+  size_t num_corrected = 0;
+  size_t segment_start = 0;
+  for (size_t i = 1; i <= samples.size(); ++i) {
+    if (i < samples.size()) {
+      const double dt =
+          samples[i].timestamp_s() - samples[i - 1].timestamp_s();
+      report.max_interval_s = std::max(report.max_interval_s, dt);
+      if (dt <= gap_threshold) {
+        continue;
+      }
+      report.gaps.emplace_back(samples[i - 1].timestamp_s(),
+                               samples[i].timestamp_s());
+    }
+    if (options.dejitter) {
+      if (DejitterSegment(segment_start,
+                          i,
+                          max_correction,
+                          samples,
+                          correction_sq_sum)) {
+        num_corrected += i - segment_start;
+      } else {
+        ++report.num_segments_not_dejittered;
+      }
+    }
+    segment_start = i;
+  }
+  if (num_corrected > 0) {
+    report.jitter_rms_s =
+        std::sqrt(correction_sq_sum / static_cast<double>(num_corrected));
+    // the median of the fitted intervals is the clock rate of the longest
+    // segments
+    report.nominal_period_s = NominalSamplePeriod(samples);
+  }
+  return true;
+}
+
+void ResampleImuUniform(const ImuReadings& samples,
+                        const double t_start_s,
+                        const double t_end_s,
+                        const double period_s,
+                        ImuReadings& resampled) {
+  resampled.clear();
+  if (samples.empty() || period_s <= 0.0 || t_end_s < t_start_s) {
+    return;
+  }
+  const size_t num_grid_samples =
+      static_cast<size_t>((t_end_s - t_start_s) / period_s + 1e-9) + 1;
+  resampled.reserve(num_grid_samples);
+  if (samples.size() == 1) {
+    for (size_t i = 0; i < num_grid_samples; ++i) {
+      resampled.emplace_back(t_start_s + i * period_s, samples[0].data());
+    }
+    return;
+  }
+
+  // the grid is sorted, so the interval search only walks forward
+  size_t idx = 0;
+  for (size_t i = 0; i < num_grid_samples; ++i) {
+    const double t = t_start_s + i * period_s;
+    while (idx + 2 < samples.size() && samples[idx + 1].timestamp_s() <= t) {
+      ++idx;
+    }
+    const ImuReading<double>& s0 = samples[idx];
+    const ImuReading<double>& s1 = samples[idx + 1];
+    // samples outside are set to the nearest boundary value
+    const double fraction =
+        std::min(1.0,
+                 std::max(0.0,
+                          (t - s0.timestamp_s()) /
+                              (s1.timestamp_s() - s0.timestamp_s())));
+    resampled.emplace_back(
+        t, (1.0 - fraction) * s0.data() + fraction * s1.data());
+  }
+}
+
+bool SanitizeImuTelemetry(const ImuTimingOptions& options,
+                          CameraTelemetryData& telemetry,
+                          double& period_s) {
+  ImuTimingReport gyro_report, accl_report;
+  if (!SanitizeImuTimestamps(options, telemetry.gyroscope, gyro_report) ||
+      !SanitizeImuTimestamps(options, telemetry.accelerometer, accl_report)) {
+    LOG(ERROR) << "Not enough IMU samples to sanitize the timestamps.";
+    return false;
+  }
+  LogReport("Gyroscope", gyro_report);
+  LogReport("Accelerometer", accl_report);
+  period_s = gyro_report.nominal_period_s;
+  if (!options.resample) {
+    return true;
+  }
+
+  if (options.resample_period_s > 0.0) {
+    period_s = options.resample_period_s;
+  }
+  const double t_start =
+      std::max(telemetry.gyroscope.front().timestamp_s(),
+               telemetry.accelerometer.front().timestamp_s());
+  const double t_end = std::min(telemetry.gyroscope.back().timestamp_s(),
+                                telemetry.accelerometer.back().timestamp_s());
+  if (t_end <= t_start) {
+    LOG(ERROR) << "Gyroscope and accelerometer do not overlap in time.";
+    return false;
+  }
+  const size_t num_gaps = gyro_report.gaps.size() + accl_report.gaps.size();
+  if (num_gaps > 0) {
+    LOG(WARNING) << "Resampling interpolates across " << num_gaps
+                 << " IMU gaps.";
+  }
+  ImuReadings resampled;
+  ResampleImuUniform(telemetry.gyroscope, t_start, t_end, period_s, resampled);
+  telemetry.gyroscope.swap(resampled);
+  ResampleImuUniform(
+      telemetry.accelerometer, t_start, t_end, period_s, resampled);
+  telemetry.accelerometer.swap(resampled);
+  LOG(INFO) << "Resampled the IMU to " << telemetry.gyroscope.size()
+            << " samples at " << 1.0 / period_s << " Hz.";
+  return true;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
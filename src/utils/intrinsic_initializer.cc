@@ -16,6 +16,8 @@
 #include <opencv2/aruco/charuco.hpp>
 
 #include "OpenCameraCalibrator/utils/intrinsic_initializer.h"
+#include "OpenCameraCalibrator/utils/planar_pose.h"
+#include "OpenCameraCalibrator/utils/undistortion.h"
 #include "OpenCameraCalibrator/utils/utils.h"
 #include "theia/sfm/camera/division_undistortion_camera_model.h"
 #include "theia/sfm/camera/double_sphere_camera_model.h"
@@ -66,6 +68,50 @@ bool initialize_pinhole_camera(
   return success;
 }
 
+bool initialize_pinhole_camera_planar(
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences,
+    const double error_thresh,
+    Eigen::Matrix3d& rotation,
+    Eigen::Vector3d& position,
+    double& focal_length,
+    const bool verbose) {
+  // the corners are identified by id, so almost all of them have to agree
+  const double min_inlier_ratio = 0.95;
+  if (correspondences.size() <= MIN_NUM_POINTS) {
+    return false;
+  }
+  Eigen::Matrix3d homography;
+  if (!EstimateBoardHomography(correspondences, &homography) ||
+      !FocalLengthFromBoardHomography(homography, &focal_length)) {
+    return false;
+  }
+  const Eigen::Matrix3d homography_normalized =
+      Eigen::Vector3d(1.0 / focal_length, 1.0 / focal_length, 1.0)
+          .asDiagonal() *
+      homography;
+  if (!PoseFromBoardHomography(homography_normalized, &rotation, &position)) {
+    return false;
+  }
+
+  size_t nr_inliers = 0;
+  for (const auto& correspondence : correspondences) {
+    const Eigen::Vector3d p_c =
+        rotation * (correspondence.world_point - position);
+    if (p_c[2] > 0.0 &&
+        (focal_length * p_c.hnormalized() - correspondence.feature).norm() <
+            error_thresh) {
+      ++nr_inliers;
+    }
+  }
+  if (verbose) {
+    std::cout << "Estimated focal length from homography: " << focal_length
+              << std::endl;
+    std::cout << "Number of homography inliers: " << nr_inliers << std::endl;
+  }
+  return nr_inliers >= MIN_NUM_POINTS &&
+         nr_inliers >= min_inlier_ratio * correspondences.size();
+}
+
 bool initialize_radial_undistortion_camera(
     const std::vector<theia::FeatureCorrespondence2D3D>& correspondences,
     const theia::RansacParameters& ransac_params,
@@ -238,9 +284,14 @@ bool initialize_doublesphere_model(
       std::vector<theia::FeatureCorrespondence2D3D> correspondences_new =
           correspondences;
 
-      for (auto& cor : correspondences_new) {
-        cor.feature =
-            cam.PixelToNormalizedCoordinates(cor.feature).hnormalized();
+      vec2_vector features, undist_features;
+      features.reserve(correspondences.size());
+      for (const auto& cor : correspondences) {
+        features.push_back(cor.feature);
+      }
+      PixelsToNormalizedCoordinates(cam, features, &undist_features);
+      for (size_t i = 0; i < correspondences_new.size(); ++i) {
+        correspondences_new[i].feature = undist_features[i];
       }
 
       theia::CalibratedAbsolutePose pose;
@@ -0,0 +1,122 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/job_scheduler.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "OpenCameraCalibrator/utils/trace.h"
+
+namespace OpenICC {
+namespace utils {
+
+int JobScheduler::AddJob(const std::string& name,
+                         const int num_threads,
+                         const JobFunction& fn,
+                         const std::vector<int>& dependencies) {
+  const int job_id = static_cast<int>(jobs_.size());
+  for (const int dependency : dependencies) {
+    CHECK(dependency >= 0 && dependency < job_id)
+        << "Job " << name << " depends on a job that was not added before.";
+  }
+  Job job;
+  job.name = name;
+  job.num_threads = std::max(1, num_threads);
+  job.fn = fn;
+  job.dependencies = dependencies;
+  jobs_.push_back(job);
+  return job_id;
+}
+
+bool JobScheduler::Run(const int thread_budget) {
+  const int budget = std::max(1, thread_budget);
+  std::mutex mutex;
+  std::condition_variable job_finished;
+  int free_threads = budget;
+  int nr_running = 0;
+  size_t nr_done = 0;
+  std::vector<std::thread> threads;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (nr_done < jobs_.size()) {
+    // start every waiting job that is ready and fits into the budget
+    for (size_t j = 0; j < jobs_.size(); ++j) {
+      Job& job = jobs_[j];
+      if (job.state != JobState::WAITING) continue;
+      bool ready = true;
+      bool dependency_failed = false;
+      for (const int dependency : job.dependencies) {
+        const JobState dep_state = jobs_[dependency].state;
+        if (dep_state == JobState::FAILED || dep_state == JobState::SKIPPED) {
+          dependency_failed = true;
+        } else if (dep_state != JobState::SUCCEEDED) {
+          ready = false;
+        }
+      }
+      if (dependency_failed) {
+        LOG(WARNING) << "Skipping " << job.name << ", a dependency failed.";
+        // dependents always come later in this pass, see AddJob
+        job.state = JobState::SKIPPED;
+        ++nr_done;
+        continue;
+      }
+      const int nr_threads = std::min(job.num_threads, budget);
+      if (!ready || nr_threads > free_threads) continue;
+
+      job.state = JobState::RUNNING;
+      free_threads -= nr_threads;
+      ++nr_running;
+      LOG(INFO) << "Starting " << job.name << " with " << nr_threads
+                << " threads.";
+      threads.emplace_back([&, j, nr_threads]() {
+        OPENICC_TRACE_THREAD(jobs_[j].name.c_str());
+        const auto start = std::chrono::steady_clock::now();
+        const bool success = jobs_[j].fn(nr_threads);
+        const double time_s = std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+        std::lock_guard<std::mutex> guard(mutex);
+        jobs_[j].time_s = time_s;
+        jobs_[j].state = success ? JobState::SUCCEEDED : JobState::FAILED;
+        free_threads += nr_threads;
+        --nr_running;
+        ++nr_done;
+        LOG(INFO) << "Finished " << jobs_[j].name
+                  << (success ? "" : " (failed)") << " in " << time_s << "s.";
+        job_finished.notify_one();
+      });
+    }
+    if (nr_done == jobs_.size()) break;
+    CHECK(nr_running > 0) << "No job can be started.";
+    job_finished.wait(lock);
+  }
+  lock.unlock();
+
+  for (auto& t : threads) {
+    t.join();
+  }
+  return std::all_of(jobs_.begin(), jobs_.end(), [](const Job& job) {
+    return job.state == JobState::SUCCEEDED;
+  });
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,168 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/planar_pose.h"
+
+#include <Eigen/Dense>
+
+#include <cmath>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+// the board may come from a refined scene, allow some bending relative to
+// its extent
+constexpr double kMaxRelativeBoardHeight = 1e-2;
+
+//! Similarity that moves the centroid to the origin and scales the mean
+//! distance to sqrt(2)
+template <class GetPoint>
+bool NormalizingTransform(const size_t nr_points,
+                          const GetPoint& get_point,
+                          Eigen::Matrix3d* T) {
+  Eigen::Vector2d centroid = Eigen::Vector2d::Zero();
+  for (size_t i = 0; i < nr_points; ++i) {
+    centroid += get_point(i);
+  }
+  centroid /= static_cast<double>(nr_points);
+  double mean_dist = 0.0;
+  for (size_t i = 0; i < nr_points; ++i) {
+    mean_dist += (get_point(i) - centroid).norm();
+  }
+  mean_dist /= static_cast<double>(nr_points);
+  if (mean_dist <= 0.0) {
+    return false;
+  }
+  const double s = std::sqrt(2.0) / mean_dist;
+  *T << s, 0.0, -s * centroid[0], 0.0, s, -s * centroid[1], 0.0, 0.0, 1.0;
+  return true;
+}
+
+}  // namespace
+
+bool EstimateBoardHomography(
+    const std::vector<theia::FeatureCorrespondence2D3D>& correspondences,
+    Eigen::Matrix3d* homography) {
+  const size_t nr_points = correspondences.size();
+  if (nr_points < 4) {
+    return false;
+  }
+  auto board_point = [&](const size_t i) -> Eigen::Vector2d {
+    return correspondences[i].world_point.head<2>();
+  };
+  auto feature = [&](const size_t i) -> Eigen::Vector2d {
+    return correspondences[i].feature;
+  };
+  Eigen::Matrix3d T_board, T_feature;
+  if (!NormalizingTransform(nr_points, board_point, &T_board) ||
+      !NormalizingTransform(nr_points, feature, &T_feature)) {
+    return false;
+  }
+  // T_board scales the mean distance to sqrt(2), so z is compared in the
+  // same units
+  for (const auto& correspondence : correspondences) {
+    if (std::abs(T_board(0, 0) * correspondence.world_point[2]) >
+        kMaxRelativeBoardHeight) {
+      return false;
+    }
+  }
+
+  // accumulate A^T A of the 2n x 9 DLT system instead of decomposing A
+  Eigen::Matrix<double, 9, 9> AtA = Eigen::Matrix<double, 9, 9>::Zero();
+  Eigen::Matrix<double, 9, 1> a_x, a_y;
+  for (size_t i = 0; i < nr_points; ++i) {
+    const Eigen::Vector3d X = T_board * board_point(i).homogeneous();
+    const Eigen::Vector3d x = T_feature * feature(i).homogeneous();
+    a_x << -X[0], -X[1], -1.0, 0.0, 0.0, 0.0, x[0] * X[0], x[0] * X[1], x[0];
+    a_y << 0.0, 0.0, 0.0, -X[0], -X[1], -1.0, x[1] * X[0], x[1] * X[1], x[1];
+    AtA.noalias() += a_x * a_x.transpose();
+    AtA.noalias() += a_y * a_y.transpose();
+  }
+  const Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 9, 9>> solver(
+      AtA);
+  if (solver.info() != Eigen::Success) {
+    return false;
+  }
+  // a unique solution needs a one dimensional null space
+  const Eigen::Matrix<double, 9, 1>& eigenvalues = solver.eigenvalues();
+  if (eigenvalues[1] <= 1e-12 * eigenvalues[8]) {
+    return false;
+  }
+  const Eigen::Matrix<double, 9, 1> h = solver.eigenvectors().col(0);
+  Eigen::Matrix3d H_normalized;
+  H_normalized << h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7], h[8];
+
+  *homography = T_feature.inverse() * H_normalized * T_board;
+  const double scale = homography->norm();
+  if (scale <= 0.0 || !homography->allFinite()) {
+    return false;
+  }
+  *homography /= scale;
+  return true;
+}
+
+bool FocalLengthFromBoardHomography(const Eigen::Matrix3d& H,
+                                    double* focal_length) {
+  // r1 . r2 = 0 and |r1| = |r2| with K = diag(f, f, 1) give a * 1/f^2 + b = 0
+  const double a1 = H(0, 0) * H(0, 1) + H(1, 0) * H(1, 1);
+  const double b1 = H(2, 0) * H(2, 1);
+  const double a2 = H(0, 0) * H(0, 0) + H(1, 0) * H(1, 0) -
+                    H(0, 1) * H(0, 1) - H(1, 1) * H(1, 1);
+  const double b2 = H(2, 0) * H(2, 0) - H(2, 1) * H(2, 1);
+  const double denom = a1 * a1 + a2 * a2;
+  if (denom <= 0.0) {
+    return false;
+  }
+  const double inv_f2 = -(a1 * b1 + a2 * b2) / denom;
+  if (!(inv_f2 > 0.0)) {
+    return false;
+  }
+  *focal_length = 1.0 / std::sqrt(inv_f2);
+  return std::isfinite(*focal_length);
+}
+
+bool PoseFromBoardHomography(const Eigen::Matrix3d& H,
+                             Eigen::Matrix3d* rotation,
+                             Eigen::Vector3d* position) {
+  // H = lambda [r1 r2 t]
+  const double n1 = H.col(0).norm();
+  const double n2 = H.col(1).norm();
+  if (n1 <= 0.0 || n2 <= 0.0) {
+    return false;
+  }
+  double lambda = 2.0 / (n1 + n2);
+  // the board origin has to be in front of the camera
+  if (H(2, 2) < 0.0) {
+    lambda = -lambda;
+  }
+  const Eigen::Vector3d r1 = lambda * H.col(0);
+  const Eigen::Vector3d r2 = lambda * H.col(1);
+  const Eigen::Vector3d t = lambda * H.col(2);
+  Eigen::Matrix3d R;
+  R << r1, r2, r1.cross(r2);
+  const Eigen::JacobiSVD<Eigen::Matrix3d> svd(
+      R, Eigen::ComputeFullU | Eigen::ComputeFullV);
+  *rotation = svd.matrixU() * svd.matrixV().transpose();
+  if (rotation->determinant() < 0.0) {
+    return false;
+  }
+  *position = -rotation->transpose() * t;
+  return rotation->allFinite() && position->allFinite();
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -0,0 +1,165 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/profiler.h"
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#include "OpenCameraCalibrator/utils/json.h"
+
+namespace OpenICC {
+namespace utils {
+
+double ThreadCpuTimeS() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+  return ProcessCpuTimeS();
+#endif
+}
+
+double ProcessCpuTimeS() {
+#if defined(CLOCK_PROCESS_CPUTIME_ID)
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+double PeakRssMB() {
+#if defined(__unix__) || defined(__APPLE__)
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0.0;
+  }
+#if defined(__APPLE__)
+  // bytes on macOS, kilobytes on Linux
+  return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  return usage.ru_maxrss / 1024.0;
+#endif
+#else
+  return 0.0;
+#endif
+}
+
+Profiler::Profiler() : start_(std::chrono::steady_clock::now()) {}
+
+Profiler& Profiler::Instance() {
+  static Profiler profiler;
+  return profiler;
+}
+
+void Profiler::Record(const std::string& stage,
+                      const double wall_s,
+                      const double cpu_s,
+                      const size_t items,
+                      const AllocationCount& allocations) {
+  const double peak_rss_mb = PeakRssMB();
+  std::lock_guard<std::mutex> lock(mutex_);
+  ProfileStage& s = stages_[stage];
+  ++s.calls;
+  s.items += items;
+  s.wall_s += wall_s;
+  s.cpu_s += cpu_s;
+  s.peak_rss_mb = std::max(s.peak_rss_mb, peak_rss_mb);
+  s.allocations += allocations.allocations;
+  s.allocated_bytes += allocations.bytes;
+}
+
+void Profiler::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stages_.clear();
+  start_ = std::chrono::steady_clock::now();
+}
+
+ProfileStage Profiler::Stage(const std::string& stage) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = stages_.find(stage);
+  return it == stages_.end() ? ProfileStage() : it->second;
+}
+
+bool Profiler::WriteReport(const std::string& path) const {
+  nlohmann::json report;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    report["wall_s"] = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start_)
+                           .count();
+    for (const auto& s : stages_) {
+      nlohmann::json& stage = report["stages"][s.first];
+      stage["calls"] = s.second.calls;
+      stage["items"] = s.second.items;
+      stage["wall_s"] = s.second.wall_s;
+      stage["cpu_s"] = s.second.cpu_s;
+      stage["peak_rss_mb"] = s.second.peak_rss_mb;
+      if (AllocationCountingEnabled()) {
+        stage["allocations"] = s.second.allocations;
+        stage["allocated_bytes"] = s.second.allocated_bytes;
+      }
+    }
+  }
+  report["cpu_s"] = ProcessCpuTimeS();
+  report["peak_rss_mb"] = PeakRssMB();
+
+  std::ofstream out_file(path);
+  if (!out_file.is_open()) {
+    std::cerr << "Could not open " << path << "\n";
+    return false;
+  }
+  out_file << std::setw(4) << report << std::endl;
+  return out_file.good();
+}
+
+ScopedTimer::ScopedTimer(const char* stage, const size_t items)
+    : stage_(stage), items_(items), enabled_(Profiler::Instance().Enabled()) {
+  if (enabled_) {
+    wall_start_ = std::chrono::steady_clock::now();
+    cpu_start_s_ = ThreadCpuTimeS();
+  }
+}
+
+ScopedTimer::~ScopedTimer() {
+  if (!enabled_) {
+    return;
+  }
+  const double wall_s = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - wall_start_)
+                            .count();
+  const AllocationCount allocations = allocation_counter_.Count();
+  // the stage map and names must not show up in the counts of outer stages
+  ScopedUncountedAllocations uncounted;
+  Profiler::Instance().Record(stage_,
+                              wall_s,
+                              ThreadCpuTimeS() - cpu_start_s_,
+                              items_,
+                              allocations);
+}
+
+}  // namespace utils
+}  // namespace OpenICC
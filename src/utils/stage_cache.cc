@@ -0,0 +1,164 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/stage_cache.h"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#include "OpenCameraCalibrator/utils/utils.h"
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+constexpr size_t kHashedBytesPerEnd = 1 << 20;
+
+bool CopyFile(const std::string& from, const std::string& to) {
+  std::ifstream in(from, std::ios::binary);
+  std::ofstream out(to, std::ios::binary);
+  if (!in.is_open() || !out.is_open()) {
+    return false;
+  }
+  out << in.rdbuf();
+  return static_cast<bool>(out);
+}
+}  // namespace
+
+void StageKey::Update(const void* data, const size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash_ ^= bytes[i];
+    hash_ *= 1099511628211ULL;
+  }
+}
+
+StageKey& StageKey::Add(const std::string& value) {
+  // prefix the length, so that ("ab", "c") and ("a", "bc") differ
+  const uint64_t size = value.size();
+  Update(&size, sizeof(size));
+  Update(value.data(), value.size());
+  return *this;
+}
+
+StageKey& StageKey::Add(const double value) {
+  Update(&value, sizeof(value));
+  return *this;
+}
+
+StageKey& StageKey::Add(const int value) {
+  Update(&value, sizeof(value));
+  return *this;
+}
+
+StageKey& StageKey::Add(const bool value) {
+  const char byte = value ? 1 : 0;
+  Update(&byte, 1);
+  return *this;
+}
+
+StageKey& StageKey::Add(const StageKey& upstream) {
+  Update(&upstream.hash_, sizeof(upstream.hash_));
+  return *this;
+}
+
+StageKey& StageKey::AddFile(const std::string& path) {
+  struct stat s;
+  if (stat(path.c_str(), &s) != 0) {
+    return Add(std::string("missing:") + path);
+  }
+  if (S_ISDIR(s.st_mode)) {
+    for (const std::string& file : load_images(path)) {
+      const size_t pos = file.find_last_of('/');
+      const std::string name = file.substr(pos + 1);
+      if (name == "." || name == "..") {
+        continue;
+      }
+      Add(name);
+      AddFile(file);
+    }
+    return *this;
+  }
+
+  const int64_t size = static_cast<int64_t>(s.st_size);
+  const int64_t mtime = static_cast<int64_t>(s.st_mtime);
+  Update(&size, sizeof(size));
+  Update(&mtime, sizeof(mtime));
+
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> buffer(kHashedBytesPerEnd);
+  file.read(buffer.data(), buffer.size());
+  Update(buffer.data(), static_cast<size_t>(file.gcount()));
+  if (size > static_cast<int64_t>(kHashedBytesPerEnd)) {
+    file.clear();
+    file.seekg(-static_cast<std::streamoff>(kHashedBytesPerEnd),
+               std::ios::end);
+    file.read(buffer.data(), buffer.size());
+    Update(buffer.data(), static_cast<size_t>(file.gcount()));
+  }
+  return *this;
+}
+
+std::string StageKey::Hex() const {
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash_);
+  return std::string(hex);
+}
+
+std::string StageCache::EntryPath(const std::string& stage,
+                                  const StageKey& key,
+                                  const std::string& extension) const {
+  if (!Enabled()) {
+    return "";
+  }
+  return cache_dir_ + "/" + stage + "_" + key.Hex() + extension;
+}
+
+bool StageCache::Contains(const std::string& stage,
+                          const StageKey& key,
+                          const std::string& extension) const {
+  return Enabled() && DoesFileExist(EntryPath(stage, key, extension));
+}
+
+bool StageCache::Store(const std::string& stage,
+                       const StageKey& key,
+                       const std::string& extension,
+                       const std::string& output_path) const {
+  if (!Enabled()) {
+    return false;
+  }
+  const std::string entry_path = EntryPath(stage, key, extension);
+  const std::string tmp_path = entry_path + ".tmp";
+  if (!CopyFile(output_path, tmp_path) ||
+      std::rename(tmp_path.c_str(), entry_path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool StageCache::Restore(const std::string& stage,
+                         const StageKey& key,
+                         const std::string& extension,
+                         const std::string& output_path) const {
+  return Contains(stage, key, extension) &&
+         CopyFile(EntryPath(stage, key, extension), output_path);
+}
+
+}  // namespace utils
+}  // namespace OpenICC
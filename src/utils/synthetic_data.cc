@@ -0,0 +1,207 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/synthetic_data.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+Eigen::Vector3d RandomVector(std::mt19937& rng, const double std_dev) {
+  std::normal_distribution<double> dist(0.0, std_dev);
+  return Eigen::Vector3d(dist(rng), dist(rng), dist(rng));
+}
+
+//! Rotation of a camera at position looking at target, with the image x axis
+//! along the board x axis
+Eigen::Matrix3d LookAt(const Eigen::Vector3d& position,
+                       const Eigen::Vector3d& target) {
+  const Eigen::Vector3d z = (target - position).normalized();
+  const Eigen::Vector3d y = z.cross(Eigen::Vector3d::UnitX()).normalized();
+  const Eigen::Vector3d x = y.cross(z);
+  Eigen::Matrix3d R_w_c;
+  R_w_c << x, y, z;
+  return R_w_c;
+}
+
+}  // namespace
+
+SyntheticTrajectory::SyntheticTrajectory(const SyntheticMotionOptions& options,
+                                         const Eigen::Vector3d& board_center,
+                                         const Sophus::SE3d& T_i_c)
+    : spline_(static_cast<int64_t>(options.knot_dt_s * S_TO_NS)),
+      T_i_c_(T_i_c),
+      duration_s_(options.duration_s) {
+  CHECK_GT(options.knot_dt_s, 0.0);
+  std::mt19937 rng(options.seed);
+  const Sophus::SE3d T_c_i = T_i_c.inverse();
+  const Eigen::Vector3d mean_position =
+      board_center - options.distance_m * Eigen::Vector3d::UnitZ();
+  // the spline covers (num_knots - N + 1) knot intervals
+  const int num_knots =
+      static_cast<int>(std::ceil(options.duration_s / options.knot_dt_s)) +
+      SYNTHETIC_SPLINE_N;
+  for (int i = 0; i < num_knots; ++i) {
+    const Eigen::Vector3d p_w_c =
+        mean_position + RandomVector(rng, options.position_std_m);
+    const Sophus::SO3d R_w_c =
+        Sophus::SO3d(LookAt(p_w_c, board_center)) *
+        Sophus::SO3d::exp(RandomVector(rng, options.rotation_std_rad));
+    spline_.knots_push_back(Sophus::SE3d(R_w_c, p_w_c) * T_c_i);
+  }
+}
+
+int64_t SyntheticTrajectory::SplineTimeNs(const double t_s) const {
+  const int64_t t_ns = static_cast<int64_t>(std::llround(t_s * S_TO_NS));
+  return std::min(std::max(t_ns, spline_.minTimeNs()), spline_.maxTimeNs());
+}
+
+Sophus::SE3d SyntheticTrajectory::ImuPose(const double t_s) const {
+  return spline_.pose(SplineTimeNs(t_s));
+}
+
+Sophus::SE3d SyntheticTrajectory::CameraPose(const double t_s) const {
+  return ImuPose(t_s) * T_i_c_;
+}
+
+Eigen::Vector3d SyntheticTrajectory::AngularVelocity(const double t_s) const {
+  return spline_.rotVelBody(SplineTimeNs(t_s));
+}
+
+Eigen::Vector3d SyntheticTrajectory::Acceleration(const double t_s) const {
+  return spline_.transAccelWorld(SplineTimeNs(t_s));
+}
+
+void SimulateTelemetry(const SyntheticTrajectory& trajectory,
+                       const SyntheticImuOptions& options,
+                       const double camera_fps,
+                       CameraTelemetryData* telemetry) {
+  CHECK_GT(options.imu_rate_hz, 0.0);
+  CHECK_GT(camera_fps, 0.0);
+  std::mt19937 rng(options.seed);
+  // discrete white noise and bias random walk per sample
+  const double sqrt_rate = std::sqrt(options.imu_rate_hz);
+  const double gyro_noise_std = options.gyro_noise_density * sqrt_rate;
+  const double accl_noise_std = options.accl_noise_density * sqrt_rate;
+  const double gyro_walk_std = options.gyro_bias_random_walk / sqrt_rate;
+  const double accl_walk_std = options.accl_bias_random_walk / sqrt_rate;
+
+  const size_t nr_samples =
+      static_cast<size_t>(trajectory.Duration() * options.imu_rate_hz) + 1;
+  telemetry->accelerometer.reserve(telemetry->accelerometer.size() +
+                                   nr_samples);
+  telemetry->gyroscope.reserve(telemetry->gyroscope.size() + nr_samples);
+  Eigen::Vector3d gyro_bias = options.gyro_bias;
+  Eigen::Vector3d accl_bias = options.accl_bias;
+  for (size_t i = 0; i < nr_samples; ++i) {
+    const double t_s = i / options.imu_rate_hz;
+    const Sophus::SO3d R_w_i = trajectory.ImuPose(t_s).so3();
+    const Eigen::Vector3d accl =
+        R_w_i.inverse() * (trajectory.Acceleration(t_s) + options.gravity) +
+        accl_bias + RandomVector(rng, accl_noise_std);
+    const Eigen::Vector3d gyro = trajectory.AngularVelocity(t_s) + gyro_bias +
+                                 RandomVector(rng, gyro_noise_std);
+    telemetry->accelerometer.emplace_back(t_s, accl);
+    telemetry->gyroscope.emplace_back(t_s, gyro);
+    gyro_bias += RandomVector(rng, gyro_walk_std);
+    accl_bias += RandomVector(rng, accl_walk_std);
+  }
+
+  const size_t nr_images =
+      static_cast<size_t>(trajectory.Duration() * camera_fps) + 1;
+  telemetry->img_timestamps_s.reserve(telemetry->img_timestamps_s.size() +
+                                      nr_images);
+  for (size_t i = 0; i < nr_images; ++i) {
+    telemetry->img_timestamps_s.push_back(i / camera_fps);
+  }
+}
+
+size_t SimulateScene(const SyntheticTrajectory& trajectory,
+                     const theia::Camera& camera,
+                     const std::vector<cv::Point3f>& board_pts,
+                     const std::vector<int>& board_pt_ids,
+                     const std::vector<double>& timestamps_s,
+                     const double pixel_noise_std,
+                     const unsigned int seed,
+                     io::SceneWriter* scene_writer,
+                     const size_t min_corners) {
+  CHECK_EQ(board_pts.size(), board_pt_ids.size());
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> pixel_noise(0.0, pixel_noise_std);
+  theia::Camera view_camera(camera);
+  const size_t nr_views_before = scene_writer->NumViews();
+  aligned_vector<Eigen::Vector2d> corners;
+  std::vector<int> ids;
+  for (const double t_s : timestamps_s) {
+    const Sophus::SE3d T_w_c = trajectory.CameraPose(t_s);
+    view_camera.SetOrientationFromRotationMatrix(
+        T_w_c.so3().inverse().matrix());
+    view_camera.SetPosition(T_w_c.translation());
+
+    corners.clear();
+    ids.clear();
+    for (size_t i = 0; i < board_pts.size(); ++i) {
+      const Eigen::Vector4d point(
+          board_pts[i].x, board_pts[i].y, board_pts[i].z, 1.0);
+      Eigen::Vector2d pixel;
+      if (view_camera.ProjectPoint(point, &pixel) <= 0.0) {
+        continue;
+      }
+      if (pixel_noise_std > 0.0) {
+        pixel += Eigen::Vector2d(pixel_noise(rng), pixel_noise(rng));
+      }
+      if (pixel[0] < 0.0 || pixel[1] < 0.0 ||
+          pixel[0] > camera.ImageWidth() - 1 ||
+          pixel[1] > camera.ImageHeight() - 1) {
+        continue;
+      }
+      corners.push_back(pixel);
+      ids.push_back(board_pt_ids[i]);
+    }
+    if (corners.size() >= min_corners) {
+      scene_writer->AddView(t_s * S_TO_US, corners, ids);
+    }
+  }
+  return scene_writer->NumViews() - nr_views_before;
+}
+
+nlohmann::json SyntheticSceneHeader(const theia::Camera& camera,
+                                    const double camera_fps,
+                                    const int board_type,
+                                    const double square_length_m,
+                                    const std::vector<cv::Point3f>& board_pts,
+                                    const std::vector<int>& board_pt_ids) {
+  nlohmann::json header;
+  header["image_width"] = camera.ImageWidth();
+  header["image_height"] = camera.ImageHeight();
+  header["camera_fps"] = camera_fps;
+  header["calibration_board_type"] = board_type;
+  header["square_size_meter"] = square_length_m;
+  for (size_t i = 0; i < board_pts.size(); ++i) {
+    header["scene_pts"][std::to_string(board_pt_ids[i])] = {
+        board_pts[i].x, board_pts[i].y, board_pts[i].z};
+  }
+  return header;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
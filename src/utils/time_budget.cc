@@ -0,0 +1,146 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/time_budget.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+//! bounds of the convergence rate factor, so no stage is starved
+const double kMinRateFactor = 0.25;
+const double kMaxRateFactor = 4.0;
+}  // namespace
+
+TimeBudgetScheduler::TimeBudgetScheduler(const double budget_s)
+    : budget_s_(budget_s), start_(std::chrono::steady_clock::now()) {}
+
+void TimeBudgetScheduler::AddStage(const std::string& name,
+                                   const double weight) {
+  Stage stage;
+  stage.name = name;
+  stage.weight = std::max(weight, 1e-6);
+  stages_.push_back(stage);
+}
+
+double TimeBudgetScheduler::ElapsedS() const {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start_)
+      .count();
+}
+
+double TimeBudgetScheduler::RemainingS() const {
+  return IsLimited() ? std::max(0.0, budget_s_ - ElapsedS()) : kUnlimitedS;
+}
+
+double TimeBudgetScheduler::Priority(const Stage& stage,
+                                     const double mean_rate) const {
+  double rate = -1.0;
+  for (const Stage& finished : stages_) {
+    if (finished.name == stage.name && finished.rate >= 0.0) {
+      rate = finished.rate;
+    }
+  }
+  if (rate < 0.0 || mean_rate <= 0.0) {
+    return stage.weight;
+  }
+  return stage.weight *
+         std::min(std::max(rate / mean_rate, kMinRateFactor), kMaxRateFactor);
+}
+
+double TimeBudgetScheduler::BeginStage(const std::string& name) {
+  CHECK_LT(running_, 0) << "Stage " << stages_[running_].name
+                        << " was not finished.";
+  auto it = std::find_if(stages_.begin(), stages_.end(), [&](const Stage& s) {
+    return s.name == name && !s.started;
+  });
+  CHECK(it != stages_.end()) << "No pending stage " << name;
+  it->started = true;
+  if (!IsLimited()) {
+    running_ = static_cast<int>(it - stages_.begin());
+    stage_start_ = std::chrono::steady_clock::now();
+    it->allocated_s = kUnlimitedS;
+    return kUnlimitedS;
+  }
+  const double remaining_s = RemainingS();
+  if (remaining_s <= 0.0) {
+    it->skipped = true;
+    LOG(WARNING) << "Time budget exhausted, skipping stage " << name;
+    return 0.0;
+  }
+
+  double rate_sum = 0.0;
+  int num_rates = 0;
+  for (const Stage& stage : stages_) {
+    if (stage.rate >= 0.0) {
+      rate_sum += stage.rate;
+      ++num_rates;
+    }
+  }
+  const double mean_rate = num_rates > 0 ? rate_sum / num_rates : 0.0;
+  double pending_priority = 0.0;
+  for (auto pending = it; pending != stages_.end(); ++pending) {
+    if (pending == it || !pending->started) {
+      pending_priority += Priority(*pending, mean_rate);
+    }
+  }
+  it->allocated_s = remaining_s * Priority(*it, mean_rate) / pending_priority;
+  running_ = static_cast<int>(it - stages_.begin());
+  stage_start_ = std::chrono::steady_clock::now();
+  LOG(INFO) << "Stage " << name << " gets " << it->allocated_s << "s of "
+            << remaining_s << "s left.";
+  return it->allocated_s;
+}
+
+void TimeBudgetScheduler::EndStage(const double initial_cost,
+                                   const double final_cost) {
+  CHECK_GE(running_, 0) << "No stage is running.";
+  Stage& stage = stages_[running_];
+  stage.used_s = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - stage_start_)
+                     .count();
+  stage.initial_cost = initial_cost;
+  stage.final_cost = final_cost;
+  const double reduction =
+      initial_cost > 0.0
+          ? std::max(0.0, (initial_cost - final_cost) / initial_cost)
+          : 0.0;
+  stage.rate = reduction / std::max(stage.used_s, 1e-6);
+  running_ = -1;
+}
+
+nlohmann::json TimeBudgetScheduler::Report() const {
+  nlohmann::json report;
+  report["budget_s"] = budget_s_;
+  report["elapsed_s"] = ElapsedS();
+  for (const Stage& stage : stages_) {
+    nlohmann::json stage_json;
+    stage_json["name"] = stage.name;
+    stage_json["skipped"] = stage.skipped || !stage.started;
+    stage_json["allocated_s"] = stage.allocated_s;
+    stage_json["used_s"] = stage.used_s;
+    stage_json["initial_cost"] = stage.initial_cost;
+    stage_json["final_cost"] = stage.final_cost;
+    report["stages"].push_back(stage_json);
+  }
+  return report;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
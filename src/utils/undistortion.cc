@@ -0,0 +1,117 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/undistortion.h"
+
+#include "OpenCameraCalibrator/utils/undistortion_lut.h"
+
+#include <theia/sfm/camera/division_undistortion_camera_model.h>
+#include <theia/sfm/camera/double_sphere_camera_model.h>
+#include <theia/sfm/camera/extended_unified_camera_model.h>
+#include <theia/sfm/camera/fisheye_camera_model.h>
+#include <theia/sfm/camera/pinhole_camera_model.h>
+#include <theia/sfm/camera/pinhole_radial_tangential_camera_model.h>
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+template <class CameraModel>
+void UndistortPixels(const double* intrinsics,
+                     const vec2_vector& pixels,
+                     vec2_vector* normalized) {
+  normalized->resize(pixels.size());
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    Eigen::Vector3d point;
+    CameraModel::PixelToCameraCoordinates(
+        intrinsics, pixels[i].data(), point.data());
+    (*normalized)[i] = point.hnormalized();
+  }
+}
+
+}  // namespace
+
+void PixelsToNormalizedCoordinates(const theia::Camera& camera,
+                                   const vec2_vector& pixels,
+                                   vec2_vector* normalized) {
+  const double* intrinsics = camera.intrinsics();
+  switch (camera.GetCameraIntrinsicsModelType()) {
+    case theia::CameraIntrinsicsModelType::DIVISION_UNDISTORTION:
+      UndistortPixels<theia::DivisionUndistortionCameraModel>(
+          intrinsics, pixels, normalized);
+      return;
+    case theia::CameraIntrinsicsModelType::DOUBLE_SPHERE:
+      UndistortPixels<theia::DoubleSphereCameraModel>(
+          intrinsics, pixels, normalized);
+      return;
+    case theia::CameraIntrinsicsModelType::PINHOLE:
+      UndistortPixels<theia::PinholeCameraModel>(
+          intrinsics, pixels, normalized);
+      return;
+    case theia::CameraIntrinsicsModelType::FISHEYE:
+      UndistortPixels<theia::FisheyeCameraModel>(
+          intrinsics, pixels, normalized);
+      return;
+    case theia::CameraIntrinsicsModelType::EXTENDED_UNIFIED:
+      UndistortPixels<theia::ExtendedUnifiedCameraModel>(
+          intrinsics, pixels, normalized);
+      return;
+    case theia::CameraIntrinsicsModelType::PINHOLE_RADIAL_TANGENTIAL:
+      UndistortPixels<theia::PinholeRadialTangentialCameraModel>(
+          intrinsics, pixels, normalized);
+      return;
+    default:
+      normalized->resize(pixels.size());
+      for (size_t i = 0; i < pixels.size(); ++i) {
+        (*normalized)[i] =
+            camera.PixelToNormalizedCoordinates(pixels[i]).hnormalized();
+      }
+      return;
+  }
+}
+
+void PixelsToNormalizedCoordinates(const theia::Camera& camera,
+                                   const UndistortionLut* lut,
+                                   const vec2_vector& pixels,
+                                   vec2_vector* normalized) {
+  if (!lut) {
+    PixelsToNormalizedCoordinates(camera, pixels, normalized);
+    return;
+  }
+  normalized->resize(pixels.size());
+  std::vector<size_t> misses;
+  vec2_vector missed_pixels;
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    Eigen::Vector2d point;
+    if (lut->Undistort(pixels[i], &point)) {
+      (*normalized)[i] = point;
+    } else {
+      misses.push_back(i);
+      missed_pixels.push_back(pixels[i]);
+    }
+  }
+  if (misses.empty()) {
+    return;
+  }
+  vec2_vector missed_normalized;
+  PixelsToNormalizedCoordinates(camera, missed_pixels, &missed_normalized);
+  for (size_t i = 0; i < misses.size(); ++i) {
+    (*normalized)[misses[i]] = missed_normalized[i];
+  }
+}
+
+}  // namespace utils
+}  // namespace OpenICC
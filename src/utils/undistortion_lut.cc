@@ -0,0 +1,222 @@
+/* Copyright (C) 2021 Steffen Urban
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "OpenCameraCalibrator/utils/undistortion_lut.h"
+
+#include <glog/logging.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "OpenCameraCalibrator/utils/parallel_for.h"
+#include "OpenCameraCalibrator/utils/undistortion.h"
+
+namespace OpenICC {
+namespace utils {
+
+namespace {
+
+const char kLutMagic[8] = {'O', 'I', 'C', 'C', 'L', 'U', 'T', '1'};
+
+struct LutHeader {
+  char magic[8];
+  uint64_t key;
+  int32_t width;
+  int32_t height;
+  int32_t step;
+  int32_t cols;
+  int32_t rows;
+  int32_t padding;
+};
+
+}  // namespace
+
+UndistortionLut::~UndistortionLut() { Unmap(); }
+
+void UndistortionLut::Unmap() {
+  if (mapped_) {
+    munmap(mapped_, mapped_size_);
+    mapped_ = nullptr;
+    mapped_size_ = 0;
+  }
+}
+
+void UndistortionLut::Build(const theia::Camera& camera,
+                            const int step,
+                            const int num_threads) {
+  Unmap();
+  width_ = camera.ImageWidth();
+  height_ = camera.ImageHeight();
+  step_ = std::max(1, step);
+  // the last node lies on or behind the last pixel
+  cols_ = (width_ - 1 + step_ - 1) / step_ + 1;
+  rows_ = (height_ - 1 + step_ - 1) / step_ + 1;
+  built_table_.resize(2 * static_cast<size_t>(cols_) * rows_);
+
+  ParallelFor(0, rows_, num_threads, [&](const int r) {
+    vec2_vector pixels(cols_), normalized;
+    for (int c = 0; c < cols_; ++c) {
+      pixels[c] = Eigen::Vector2d(c * step_, r * step_);
+    }
+    PixelsToNormalizedCoordinates(camera, pixels, &normalized);
+    float* row = built_table_.data() + 2 * static_cast<size_t>(r) * cols_;
+    for (int c = 0; c < cols_; ++c) {
+      row[2 * c] = static_cast<float>(normalized[c][0]);
+      row[2 * c + 1] = static_cast<float>(normalized[c][1]);
+    }
+  });
+  table_ = built_table_.data();
+}
+
+bool UndistortionLut::Load(const std::string& path, const uint64_t key) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < sizeof(LutHeader)) {
+    close(fd);
+    return false;
+  }
+  const size_t file_size = file_stat.st_size;
+  void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+
+  LutHeader header;
+  std::memcpy(&header, mapped, sizeof(LutHeader));
+  const size_t table_size = 2 * sizeof(float) *
+                            static_cast<size_t>(std::max(header.cols, 0)) *
+                            std::max(header.rows, 0);
+  if (std::memcmp(header.magic, kLutMagic, sizeof(kLutMagic)) != 0 ||
+      header.key != key || file_size != sizeof(LutHeader) + table_size) {
+    munmap(mapped, file_size);
+    return false;
+  }
+
+  Unmap();
+  built_table_.clear();
+  mapped_ = mapped;
+  mapped_size_ = file_size;
+  width_ = header.width;
+  height_ = header.height;
+  step_ = header.step;
+  cols_ = header.cols;
+  rows_ = header.rows;
+  table_ = reinterpret_cast<const float*>(static_cast<const char*>(mapped) +
+                                          sizeof(LutHeader));
+  return true;
+}
+
+bool UndistortionLut::Write(const std::string& path, const uint64_t key) const {
+  std::ofstream output(path, std::ios::binary);
+  if (!output.is_open()) {
+    std::cerr << "Could not open: " << path << "\n";
+    return false;
+  }
+  LutHeader header;
+  std::memcpy(header.magic, kLutMagic, sizeof(kLutMagic));
+  header.key = key;
+  header.width = width_;
+  header.height = height_;
+  header.step = step_;
+  header.cols = cols_;
+  header.rows = rows_;
+  header.padding = 0;
+  output.write(reinterpret_cast<const char*>(&header), sizeof(LutHeader));
+  output.write(reinterpret_cast<const char*>(table_),
+               2 * sizeof(float) * static_cast<size_t>(cols_) * rows_);
+  return output.good();
+}
+
+bool UndistortionLut::Undistort(const Eigen::Vector2d& pixel,
+                                Eigen::Vector2d* normalized) const {
+  if (!table_ || cols_ < 2 || rows_ < 2 || pixel[0] < 0.0 || pixel[1] < 0.0 ||
+      pixel[0] > width_ - 1 || pixel[1] > height_ - 1) {
+    return false;
+  }
+  const double gx = pixel[0] / step_;
+  const double gy = pixel[1] / step_;
+  const int c = std::min(static_cast<int>(gx), cols_ - 2);
+  const int r = std::min(static_cast<int>(gy), rows_ - 2);
+  const double ax = gx - c;
+  const double ay = gy - r;
+
+  const float* n00 = table_ + 2 * (static_cast<size_t>(r) * cols_ + c);
+  const float* n10 = n00 + 2 * cols_;
+  for (int d = 0; d < 2; ++d) {
+    const double v00 = n00[d], v01 = n00[2 + d];
+    const double v10 = n10[d], v11 = n10[2 + d];
+    const double value = (1.0 - ay) * ((1.0 - ax) * v00 + ax * v01) +
+                         ay * ((1.0 - ax) * v10 + ax * v11);
+    if (!std::isfinite(value)) {
+      return false;
+    }
+    (*normalized)[d] = value;
+  }
+  return true;
+}
+
+uint64_t HashFileContent(const std::string& path) {
+  std::ifstream input(path, std::ios::binary);
+  if (!input.is_open()) {
+    return 0;
+  }
+  uint64_t hash = 14695981039346656037ull;
+  char c;
+  while (input.get(c)) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::shared_ptr<const UndistortionLut> LoadOrBuildUndistortionLut(
+    const std::string& calibration_json,
+    const theia::Camera& camera,
+    const int step,
+    const int num_threads) {
+  const std::string lut_path = calibration_json + ".lut";
+  // the step is part of the key, so changing it rebuilds the table
+  const uint64_t key =
+      HashFileContent(calibration_json) ^ static_cast<uint64_t>(step);
+
+  auto lut = std::make_shared<UndistortionLut>();
+  if (lut->Load(lut_path, key)) {
+    LOG(INFO) << "Loaded undistortion table " << lut_path;
+    return lut;
+  }
+  LOG(INFO) << "Building undistortion table with a step of " << step
+            << " pixels";
+  lut->Build(camera, step, num_threads);
+  if (!lut->Write(lut_path, key)) {
+    LOG(WARNING) << "Could not cache undistortion table in " << lut_path;
+  }
+  return lut;
+}
+
+}  // namespace utils
+}  // namespace OpenICC
@@ -23,7 +23,9 @@
 #include <theia/sfm/camera/pinhole_camera_model.h>
 
 #include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <limits>
 #include <vector>
 
 using namespace cv;
@@ -192,22 +194,42 @@ std::vector<std::string> load_images(const std::string& img_dir_path) {
 }
 
 size_t FindClosestTimestamp(const double t_imu,
-                         const std::vector<double>& vis_timestamps,
-                         double& distance_to_nearest_timestamp) {
-  double dist = std::numeric_limits<double>::max();
-  size_t idx = 0;
-  for (size_t i = 0; i < vis_timestamps.size(); ++i) {
-    double new_dist = std::abs(t_imu - vis_timestamps[i]);
-    if (new_dist < dist) {
-      distance_to_nearest_timestamp = new_dist;
-      idx = i;
-      dist = new_dist;
-      if (distance_to_nearest_timestamp == 0.0) {
-        break;
-      }
-    }
+                            const std::vector<double>& vis_timestamps,
+                            double& distance_to_nearest_timestamp) {
+  distance_to_nearest_timestamp = std::numeric_limits<double>::max();
+  if (vis_timestamps.empty()) {
+    return 0;
+  }
+  const auto it =
+      std::lower_bound(vis_timestamps.begin(), vis_timestamps.end(), t_imu);
+  size_t idx = std::distance(vis_timestamps.begin(), it);
+  if (idx == vis_timestamps.size()) {
+    --idx;
+  } else if (idx > 0 &&
+             t_imu - vis_timestamps[idx - 1] <= vis_timestamps[idx] - t_imu) {
+    --idx;
   }
+  distance_to_nearest_timestamp = std::abs(t_imu - vis_timestamps[idx]);
+  return idx;
+}
 
+size_t FindTimestampInterval(const double t,
+                             const std::vector<double>& timestamps,
+                             const size_t hint) {
+  if (timestamps.size() < 2) {
+    return 0;
+  }
+  const size_t last_interval = timestamps.size() - 2;
+  size_t idx = std::min(hint, last_interval);
+  if (t < timestamps[idx]) {
+    // query went backwards, fall back to a binary search
+    const auto it = std::upper_bound(timestamps.begin(), timestamps.end(), t);
+    idx = std::distance(timestamps.begin(), it);
+    return idx == 0 ? 0 : std::min(idx - 1, last_interval);
+  }
+  while (idx < last_interval && timestamps[idx + 1] <= t) {
+    ++idx;
+  }
   return idx;
 }
 
@@ -217,46 +239,147 @@ Eigen::Vector3d lerp3d(const Eigen::Vector3d& v0,
   return (1.0 - fraction) * v0 + fraction * v1;
 }
 
-void InterpolateQuaternions(std::vector<double> t_old,
-                            std::vector<double> t_new,
+//! Interpolation fraction of t in [t0, t1], clamped to [0, 1]
+static double IntervalFraction(const double t,
+                               const double t0,
+                               const double t1) {
+  if (t1 <= t0) {
+    return 0.0;
+  }
+  return std::min(1.0, std::max(0.0, (t - t0) / (t1 - t0)));
+}
+
+void InterpolateQuaternions(const std::vector<double>& t_old,
+                            const std::vector<double>& t_new,
                             const quat_vector& input_q,
                             quat_vector& interpolated_q) {
   assert(input_q.size() == t_old.size());
+  if (t_old.empty()) {
+    return;
+  }
+  interpolated_q.reserve(interpolated_q.size() + t_new.size());
+  if (t_old.size() == 1) {
+    interpolated_q.insert(interpolated_q.end(), t_new.size(), input_q[0]);
+    return;
+  }
 
+  size_t idx = 0;
   for (size_t i = 0; i < t_new.size(); ++i) {
-    double dist_to_nearest_vis_t;
-    size_t nearest_old_idx =
-        FindClosestTimestamp(t_new[i], t_old, dist_to_nearest_vis_t);
-    if (nearest_old_idx < t_old.size()-1) {
-      const double fraction =
-          dist_to_nearest_vis_t /
-          (t_old[nearest_old_idx + 1] - t_old[nearest_old_idx]);
-      interpolated_q.push_back(input_q[nearest_old_idx].slerp(
-          fraction, input_q[nearest_old_idx + 1]));
-    } else {
-      interpolated_q.push_back(input_q[nearest_old_idx]);
-    }
+    idx = FindTimestampInterval(t_new[i], t_old, idx);
+    const double fraction =
+        IntervalFraction(t_new[i], t_old[idx], t_old[idx + 1]);
+    interpolated_q.push_back(input_q[idx].slerp(fraction, input_q[idx + 1]));
   }
 }
 
-void InterpolateVector3d(std::vector<double> t_old,
-                         std::vector<double> t_new,
+void InterpolateVector3d(const std::vector<double>& t_old,
+                         const std::vector<double>& t_new,
                          const vec3_vector& input_vec,
                          vec3_vector& interpolated_vec) {
+  assert(input_vec.size() == t_old.size());
+  if (t_old.empty()) {
+    return;
+  }
+  interpolated_vec.reserve(interpolated_vec.size() + t_new.size());
+  if (t_old.size() == 1) {
+    interpolated_vec.insert(
+        interpolated_vec.end(), t_new.size(), input_vec[0]);
+    return;
+  }
+
+  size_t idx = 0;
   for (size_t i = 0; i < t_new.size(); ++i) {
-    double dist_to_nearest_vis_t;
-    int nearest_old_idx =
-        FindClosestTimestamp(t_new[i], t_old, dist_to_nearest_vis_t);
+    idx = FindTimestampInterval(t_new[i], t_old, idx);
     const double fraction =
-        dist_to_nearest_vis_t /
-        (t_old[nearest_old_idx + 1] - t_old[nearest_old_idx]);
-    if (nearest_old_idx < t_new.size()) {
-      interpolated_vec.push_back(lerp3d(input_vec[nearest_old_idx],
-                                        input_vec[nearest_old_idx + 1],
-                                        fraction));
-    } else {
-      interpolated_vec.push_back(input_vec[nearest_old_idx]);
-    }
+        IntervalFraction(t_new[i], t_old[idx], t_old[idx + 1]);
+    interpolated_vec.push_back(
+        lerp3d(input_vec[idx], input_vec[idx + 1], fraction));
+  }
+}
+
+void BoxFilter3d(const vec3_vector& signal,
+                 const int window,
+                 const bool zero_phase,
+                 vec3_vector& filtered) {
+  const int n = static_cast<int>(signal.size());
+  filtered.resize(n);
+  if (n == 0) {
+    return;
+  }
+  // vec3_vector is contiguous, so all axes are processed as 3 x n blocks
+  using Matrix3Xd = Eigen::Matrix<double, 3, Eigen::Dynamic>;
+  const Eigen::Map<const Matrix3Xd> x(signal[0].data(), 3, n);
+  Eigen::Map<Matrix3Xd> y(filtered[0].data(), 3, n);
+  Matrix3Xd prefix(3, n + 1);
+  prefix.col(0).setZero();
+  for (int i = 0; i < n; ++i) {
+    prefix.col(i + 1) = prefix.col(i) + x.col(i);
+  }
+
+  const int w = std::max(1, std::min(window, n));
+  // y_i is the mean of x over [i - before, i + after]
+  const int before = zero_phase ? w / 2 : w - 1;
+  const int after = w - 1 - before;
+  auto border = [&](const int i) {
+    const int lo = std::max(0, i - before);
+    const int hi = std::min(n - 1, i + after);
+    y.col(i) = (prefix.col(hi + 1) - prefix.col(lo)) / double(hi - lo + 1);
+  };
+  for (int i = 0; i < std::min(before, n); ++i) {
+    border(i);
+  }
+  const int nr_inner = n - before - after;
+  if (nr_inner > 0) {
+    y.middleCols(before, nr_inner) =
+        (prefix.middleCols(w, nr_inner) - prefix.leftCols(nr_inner)) / w;
+  }
+  for (int i = std::max(before, n - after); i < n; ++i) {
+    border(i);
+  }
+}
+
+namespace {
+// WGS84 ellipsoid
+constexpr double kWGS84A = 6378137.0;
+constexpr double kWGS84E2 = 6.69437999014e-3;
+
+Eigen::Vector3d LLEToECEF(const double sin_lat,
+                          const double cos_lat,
+                          const double sin_lon,
+                          const double cos_lon,
+                          const double height) {
+  const double n = kWGS84A / std::sqrt(1.0 - kWGS84E2 * sin_lat * sin_lat);
+  return Eigen::Vector3d((n + height) * cos_lat * cos_lon,
+                         (n + height) * cos_lat * sin_lon,
+                         (n * (1.0 - kWGS84E2) + height) * sin_lat);
+}
+}  // namespace
+
+void ConvertLLEToENU(const vec3_vector& lle,
+                     const Eigen::Vector3d& lle_ref,
+                     vec3_vector& enu) {
+  const double deg_to_rad = M_PI / 180.0;
+  const double lat0 = lle_ref[0] * deg_to_rad;
+  const double lon0 = lle_ref[1] * deg_to_rad;
+  const double sin_lat0 = std::sin(lat0), cos_lat0 = std::cos(lat0);
+  const double sin_lon0 = std::sin(lon0), cos_lon0 = std::cos(lon0);
+  const Eigen::Vector3d ecef_ref =
+      LLEToECEF(sin_lat0, cos_lat0, sin_lon0, cos_lon0, lle_ref[2]);
+  Eigen::Matrix3d R_enu_ecef;
+  R_enu_ecef << -sin_lon0, cos_lon0, 0.0, -sin_lat0 * cos_lon0,
+      -sin_lat0 * sin_lon0, cos_lat0, cos_lat0 * cos_lon0,
+      cos_lat0 * sin_lon0, sin_lat0;
+
+  enu.resize(lle.size());
+  for (size_t i = 0; i < lle.size(); ++i) {
+    const double lat = lle[i][0] * deg_to_rad;
+    const double lon = lle[i][1] * deg_to_rad;
+    enu[i] = R_enu_ecef * (LLEToECEF(std::sin(lat),
+                                     std::cos(lat),
+                                     std::sin(lon),
+                                     std::cos(lon),
+                                     lle[i][2]) -
+                           ecef_ref);
   }
 }
 
@@ -1,10 +1,18 @@
 
 #include "apriltag.h"
 
+#include <algorithm>
+#include <cmath>
+
 #include <apriltags/TagDetector.h>
 
 #include <apriltags/Tag36h11.h>
 
+#ifdef OPENICC_APRILTAG3
+#include <apriltag/apriltag.h>
+#include <apriltag/tag36h11.h>
+#endif
+
 namespace OpenICC {
 
 struct ApriltagDetectorData {
@@ -15,10 +23,59 @@ struct ApriltagDetectorData {
         minBorderDistance(4.0),
         blackTagBorder(2),
         _tagCodes(AprilTags::tagCodes36h11) {
+#ifdef OPENICC_APRILTAG3
+    _family = tag36h11_create();
+    _detector = apriltag_detector_create();
+    // same error correction as the ETH detector
+    apriltag_detector_add_family_bits(_detector, _family, 1);
+    _detector->quad_decimate = 1.f;
+    _detector->nthreads = 1;
+#else
     _tagDetector =
         std::make_shared<AprilTags::TagDetector>(_tagCodes, blackTagBorder);
+#endif
+  }
+
+#ifdef OPENICC_APRILTAG3
+  ~ApriltagDetectorData() {
+    apriltag_detector_destroy(_detector);
+    tag36h11_destroy(_family);
   }
 
+  //! Runs apriltag3 and converts its detections, so that the filtering and
+  //! refinement below is shared by both backends. Both report the corners
+  //! counter-clockwise starting at the bottom left corner of the tag.
+  void extractTags(const cv::Mat& image,
+                   std::vector<AprilTags::TagDetection>& tags) {
+    image_u8_t im = {image.cols, image.rows, static_cast<int32_t>(image.step),
+                     image.data};
+    zarray_t* apriltag_detections = apriltag_detector_detect(_detector, &im);
+    tags.clear();
+    for (int i = 0; i < zarray_size(apriltag_detections); ++i) {
+      apriltag_detection_t* det;
+      zarray_get(apriltag_detections, i, &det);
+      AprilTags::TagDetection tag(det->id);
+      tag.good = true;
+      tag.hammingDistance = det->hamming;
+      tag.cxy = std::make_pair((float)det->c[0], (float)det->c[1]);
+      tag.observedPerimeter = 0.f;
+      for (int j = 0; j < 4; ++j) {
+        tag.p[j] = std::make_pair((float)det->p[j][0], (float)det->p[j][1]);
+        const int k = (j + 1) % 4;
+        tag.observedPerimeter += (float)std::hypot(det->p[k][0] - det->p[j][0],
+                                                   det->p[k][1] - det->p[j][1]);
+      }
+      tags.push_back(tag);
+    }
+    apriltag_detections_destroy(apriltag_detections);
+  }
+#else
+  void extractTags(const cv::Mat& image,
+                   std::vector<AprilTags::TagDetection>& tags) {
+    _tagDetector->extractTags(image, tags);
+  }
+#endif
+
   bool doSubpixRefinement;
   double
       maxSubpixDisplacement;  //!< maximum displacement for subpixel refinement.
@@ -28,7 +85,18 @@ struct ApriltagDetectorData {
   unsigned int blackTagBorder;
 
   AprilTags::TagCodes _tagCodes;
+#ifdef OPENICC_APRILTAG3
+  apriltag_family_t* _family;
+  apriltag_detector_t* _detector;
+#else
   std::shared_ptr<AprilTags::TagDetector> _tagDetector;
+#endif
+
+  // buffers reused from call to call
+  std::vector<AprilTags::TagDetection> detections;
+  std::vector<double> radiiRaw;
+  std::vector<cv::Point2f> tagCorners;
+  std::vector<cv::Point2f> tagCornersRaw;
 
   inline int size() { return 36 * 4; }
 };
@@ -37,6 +105,22 @@ ApriltagDetector::ApriltagDetector() { data = new ApriltagDetectorData; }
 
 ApriltagDetector::~ApriltagDetector() { delete data; }
 
+void ApriltagDetector::setQuadDecimate(const float quad_decimate) {
+#ifdef OPENICC_APRILTAG3
+  data->_detector->quad_decimate = quad_decimate;
+#else
+  (void)quad_decimate;
+#endif
+}
+
+void ApriltagDetector::setNumThreads(const int num_threads) {
+#ifdef OPENICC_APRILTAG3
+  data->_detector->nthreads = std::max(1, num_threads);
+#else
+  (void)num_threads;
+#endif
+}
+
 void ApriltagDetector::detectTags(
     const cv::Mat& image,
     std::vector<cv::Point2f>& corners,
@@ -53,8 +137,8 @@ void ApriltagDetector::detectTags(
   radii_rejected.clear();
 
   // detect the tags
-  std::vector<AprilTags::TagDetection> detections =
-      data->_tagDetector->extractTags(image);
+  std::vector<AprilTags::TagDetection>& detections = data->detections;
+  data->extractTags(image, detections);
 
   /* handle the case in which a tag is identified but not all tag
    * corners are in the image (all data bits in image but border
@@ -64,36 +148,32 @@ void ApriltagDetector::detectTags(
 
   // min. distance [px] of tag corners from image border (tag is not used if
   // violated)
-  std::vector<AprilTags::TagDetection>::iterator iter = detections.begin();
-  for (iter = detections.begin(); iter != detections.end();) {
+  auto isInvalid = [&](const AprilTags::TagDetection& detection) {
     // check all four corners for violation
     bool remove = false;
 
     for (int j = 0; j < 4; j++) {
-      remove |= iter->p[j].first < data->minBorderDistance;
-      remove |= iter->p[j].first >
+      remove |= detection.p[j].first < data->minBorderDistance;
+      remove |= detection.p[j].first >
                 (float)(image.cols) - data->minBorderDistance;  // width
-      remove |= iter->p[j].second < data->minBorderDistance;
-      remove |= iter->p[j].second >
+      remove |= detection.p[j].second < data->minBorderDistance;
+      remove |= detection.p[j].second >
                 (float)(image.rows) - data->minBorderDistance;  // height
     }
 
     // also remove tags that are flagged as bad
-    if (iter->good != 1) remove |= true;
+    if (detection.good != 1) remove |= true;
 
     // also remove if the tag ID is out-of-range for this grid (faulty
     // detection)
-    if (iter->id >= (int)data->size() / 4) remove |= true;
-
-    // delete flagged tags
-    if (remove) {
-      // delete the tag and advance in list
-      iter = detections.erase(iter);
-    } else {
-      // advance in list
-      ++iter;
-    }
-  }
+    if (detection.id >= (int)data->size() / 4) remove |= true;
+
+    return remove;
+  };
+  // delete flagged tags
+  detections.erase(
+      std::remove_if(detections.begin(), detections.end(), isInvalid),
+      detections.end());
 
   // did we find enough tags?
   if (detections.size() < data->minTagsForValidObs) return;
@@ -115,7 +195,8 @@ void ApriltagDetector::detectTags(
 
   // compute search radius for sub-pixel refinement depending on size of tag in
   // image
-  std::vector<double> radiiRaw;
+  std::vector<double>& radiiRaw = data->radiiRaw;
+  radiiRaw.clear();
   for (unsigned i = 0; i < detections.size(); i++) {
     const double minimalRadius = 2.0;
     const double percentOfSideLength = 7.5;
@@ -137,37 +218,31 @@ void ApriltagDetector::detectTags(
   ///    y     | TAG 0 |  | TAG 1 |
   ///   ^      0-------1  4-------5
   ///   |-->x
-  cv::Mat tagCorners(4 * detections.size(), 2, CV_32F);
+  std::vector<cv::Point2f>& tagCorners = data->tagCorners;
+  tagCorners.resize(4 * detections.size());
 
   for (unsigned i = 0; i < detections.size(); i++) {
     for (unsigned j = 0; j < 4; j++) {
-      tagCorners.at<float>(4 * i + j, 0) = detections[i].p[j].first;
-      tagCorners.at<float>(4 * i + j, 1) = detections[i].p[j].second;
+      tagCorners[4 * i + j] =
+          cv::Point2f(detections[i].p[j].first, detections[i].p[j].second);
     }
   }
 
   // store a copy of the corner list before subpix refinement
-  cv::Mat tagCornersRaw = tagCorners.clone();
+  std::vector<cv::Point2f>& tagCornersRaw = data->tagCornersRaw;
+  tagCornersRaw = tagCorners;
 
   // optional subpixel refinement on all tag corners (four corners each tag)
   if (data->doSubpixRefinement) {
     for (size_t i = 0; i < detections.size(); i++) {
-      cv::Mat currentCorners(4, 2, CV_32F);
-      for (unsigned j = 0; j < 4; j++) {
-        currentCorners.at<float>(j, 0) = tagCorners.at<float>(4 * i + j, 0);
-        currentCorners.at<float>(j, 1) = tagCorners.at<float>(4 * i + j, 1);
-      }
+      // header on the four corners of tag i, refined in place
+      cv::Mat currentCorners(4, 1, CV_32FC2, &tagCorners[4 * i]);
 
       const int radius = static_cast<int>(std::ceil(radiiRaw[i] + 1.0));
       cv::cornerSubPix(
           image, currentCorners, cv::Size(radius, radius), cv::Size(-1, -1),
           cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::MAX_ITER,
                            100, 0.01));
-
-      for (unsigned j = 0; j < 4; j++) {
-        tagCorners.at<float>(4 * i + j, 0) = currentCorners.at<float>(j, 0);
-        tagCorners.at<float>(4 * i + j, 1) = currentCorners.at<float>(j, 1);
-      }
     }
   }
 
@@ -200,12 +275,12 @@ void ApriltagDetector::detectTags(
       int pointId = (tagId << 2) + j;
 
       // refined corners
-      double corner_x = tagCorners.row(4 * i + j).at<float>(0);
-      double corner_y = tagCorners.row(4 * i + j).at<float>(1);
+      double corner_x = tagCorners[4 * i + j].x;
+      double corner_y = tagCorners[4 * i + j].y;
 
       // raw corners
-      double cornerRaw_x = tagCornersRaw.row(4 * i + j).at<float>(0);
-      double cornerRaw_y = tagCornersRaw.row(4 * i + j).at<float>(1);
+      double cornerRaw_x = tagCornersRaw[4 * i + j].x;
+      double cornerRaw_y = tagCornersRaw[4 * i + j].y;
 
       // only add point if the displacement in the subpixel refinement is below
       // a given threshold
@@ -6,12 +6,26 @@ namespace OpenICC {
 
 struct ApriltagDetectorData;
 
+//! Detects a 36h11 Apriltag grid. The detector keeps its scratch memory
+//! between calls and is not thread safe, use one detector per thread.
+//! Compiled with OPENICC_APRILTAG3 it runs the upstream apriltag3 library
+//! instead of the ETH port, with the same output.
 class ApriltagDetector {
  public:
   ApriltagDetector();
 
   ~ApriltagDetector();
 
+  ApriltagDetector(const ApriltagDetector&) = delete;
+  ApriltagDetector& operator=(const ApriltagDetector&) = delete;
+
+  //! apriltag3 only: detect quads on the image decimated by this factor.
+  //! Faster, but small tags are lost. 1 by default.
+  void setQuadDecimate(const float quad_decimate);
+
+  //! apriltag3 only: number of detector threads. 1 by default.
+  void setNumThreads(const int num_threads);
+
   void detectTags(const cv::Mat& img_raw,
                   std::vector<cv::Point2f> &corners,
                   std::vector<int>& ids,
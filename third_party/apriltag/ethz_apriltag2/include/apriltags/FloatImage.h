@@ -33,6 +33,10 @@ class FloatImage {
 
   FloatImage& operator=(const FloatImage& other);
 
+  //! Resizes the image, keeping the pixel memory if the size is unchanged.
+  //! Pixels are zero after a size change and undefined otherwise.
+  void resize(int widthArg, int heightArg);
+
   float get(int x, int y) const { return pixels[y * width + x]; }
   void set(int x, int y, float v) { pixels[y * width + x] = v; }
 
@@ -40,6 +44,7 @@ class FloatImage {
   int getHeight() const { return height; }
   int getNumFloatImagePixels() const { return width * height; }
   const std::vector<float>& getFloatImagePixels() const { return pixels; }
+  float* getFloatImagePixelData() { return pixels.data(); }
 
   //! TODO: Fix decimateAvg function. DO NOT USE!
   void decimateAvg();
@@ -50,6 +55,11 @@ class FloatImage {
   void filterFactoredCentered(const std::vector<float>& fhoriz,
                               const std::vector<float>& fvert);
 
+  //! Same as above, with caller owned scratch memory for repeated filtering
+  void filterFactoredCentered(const std::vector<float>& fhoriz,
+                              const std::vector<float>& fvert,
+                              std::vector<float>& scratch);
+
   template <typename T>
   void copyToSketch(DualCoding::Sketch<T>& sketch) {
     for (int i = 0; i < getNumFloatImagePixels(); i++)
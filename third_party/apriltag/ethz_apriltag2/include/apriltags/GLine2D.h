@@ -53,6 +53,9 @@ public:
 
   static GLine2D lsqFitXYW(const std::vector<XYWeight>& xyweights);
 
+  //! Same as above for n points stored contiguously
+  static GLine2D lsqFitXYW(const XYWeight* xyweights, size_t n);
+
   inline float getDx() const { return dx; }
   inline float getDy() const { return dy; }
   inline float getFirst() const { return p.first; }
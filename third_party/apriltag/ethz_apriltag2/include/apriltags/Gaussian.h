@@ -29,6 +29,10 @@ public:
    */
   static void convolveSymmetricCentered(const std::vector<float>& a, unsigned int aoff, unsigned int alen,
 					const std::vector<float>& f, std::vector<float>& r, unsigned int roff);
+
+  //! Same as above on raw buffers, e.g. parts of a scratch block
+  static void convolveSymmetricCentered(const float* a, unsigned int aoff, unsigned int alen,
+					const std::vector<float>& f, float* r, unsigned int roff);
   
 };
 
@@ -5,23 +5,58 @@
 
 #include "opencv2/opencv.hpp"
 
+#include "apriltags//Edge.h"
+#include "apriltags//FloatImage.h"
+#include "apriltags//Quad.h"
+#include "apriltags//Segment.h"
 #include "apriltags//TagDetection.h"
 #include "apriltags//TagFamily.h"
-#include "apriltags//FloatImage.h"
+#include "apriltags//UnionFindSimple.h"
+#include "apriltags//XYWeight.h"
 
 namespace AprilTags {
 
+//! Detects the tags of one family in gray images.
+/*! The image sized buffers of the detection are kept between calls, so
+ *  repeated detection on frames of the same size does not reallocate them.
+ *  Because of this a detector must not be shared between threads, use one
+ *  detector per thread instead.
+ */
 class TagDetector {
 public:
-	
+
 	const TagFamily thisTagFamily;
 
 	//! Constructor
   // note: TagFamily is instantiated here from TagCodes
-	TagDetector(const TagCodes& tagCodes, const size_t blackBorder=2) : thisTagFamily(tagCodes, blackBorder) {}
-	
+	TagDetector(const TagCodes& tagCodes, const size_t blackBorder=2) : thisTagFamily(tagCodes, blackBorder), uf(0) {}
+
 	std::vector<TagDetection> extractTags(const cv::Mat& image);
-	
+
+	//! Same as above, writes the detections to tags and reuses its memory
+	void extractTags(const cv::Mat& image, std::vector<TagDetection>& tags);
+
+private:
+	// scratch memory reused from call to call
+	FloatImage fimOrig, fimFiltered, fimSeg, fimTheta, fimMag;
+	std::vector<float> segFilter;
+	cv::Mat gradX, gradY;
+	UnionFindSimple uf;
+	std::vector<Edge> edges, sortedEdges;
+	std::vector<size_t> edgeCostOffsets;
+	std::vector<float> storage;
+	//! union-find root of every pixel in a large enough cluster, -1 if none
+	std::vector<int> pixelRep;
+	//! start of the points of each root in clusterPoints
+	std::vector<size_t> clusterOffsets, clusterFill;
+	//! roots of all clusters in ascending order
+	std::vector<int> clusterReps;
+	std::vector<XYWeight> clusterPoints;
+	std::vector<Segment> segments;
+	std::vector<Segment*> path;
+	std::vector<Quad> quads;
+	std::vector<TagDetection> detections;
+
 };
 
 } // namespace
@@ -17,6 +17,12 @@ public:
   explicit UnionFindSimple(int maxId) : data(maxId) {
     init();
   };
+
+  //! Makes every id in [0, maxId) its own set again, reusing the memory
+  void reset(int maxId) {
+    data.resize(maxId);
+    init();
+  }
   
   int getSetSize(int thisId) { return data[getRepresentative(thisId)].size; }
 
@@ -21,6 +21,14 @@ FloatImage& FloatImage::operator=(const FloatImage& other) {
   return *this;
 }
 
+void FloatImage::resize(int widthArg, int heightArg) {
+  if (widthArg != width || heightArg != height) {
+    width = widthArg;
+    height = heightArg;
+    pixels.assign(widthArg*heightArg, 0.f);
+  }
+}
+
 void FloatImage::decimateAvg() {
   int nWidth = width/2;
   int nHeight = height/2;
@@ -44,17 +52,24 @@ void FloatImage::normalize() {
 }
 
 void FloatImage::filterFactoredCentered(const std::vector<float>& fhoriz, const std::vector<float>& fvert) {
-  // do horizontal
-  std::vector<float> r(pixels);
+  std::vector<float> scratch;
+  filterFactoredCentered(fhoriz, fvert, scratch);
+}
+
+void FloatImage::filterFactoredCentered(const std::vector<float>& fhoriz, const std::vector<float>& fvert,
+                                        std::vector<float>& scratch) {
+  // one block for the horizontal result and the two column buffers
+  scratch.resize(pixels.size() + 2*height);
+  float* r = scratch.data();
+  float* tmp = r + pixels.size(); // column before convolution
+  float* tmp2 = tmp + height; // column after convolution
 
+  // do horizontal
   for (int y = 0; y < height; y++) {
-    Gaussian::convolveSymmetricCentered(pixels, y*width, width, fhoriz, r, y*width);
+    Gaussian::convolveSymmetricCentered(pixels.data(), y*width, width, fhoriz, r, y*width);
   }
 
   // do vertical
-  std::vector<float> tmp(height); // column before convolution
-  std::vector<float> tmp2(height); // column after convolution
-
   for (int x = 0; x < width; x++) {
 
     // copy the column out for locality
@@ -52,11 +52,15 @@ std::pair<float,float> GLine2D::intersectionWith(const GLine2D& line) const {
 }
 
 GLine2D GLine2D::lsqFitXYW(const std::vector<XYWeight>& xyweights) {
+  return lsqFitXYW(xyweights.data(), xyweights.size());
+}
+
+GLine2D GLine2D::lsqFitXYW(const XYWeight* xyweights, size_t n_points) {
   float Cxx=0, Cyy=0, Cxy=0, Ex=0, Ey=0, mXX=0, mYY=0, mXY=0, mX=0, mY=0;
   float n=0;
 
   int idx = 0;
-  for (unsigned int i = 0; i < xyweights.size(); i++) {
+  for (size_t i = 0; i < n_points; i++) {
     float x = xyweights[i].x;
     float y = xyweights[i].y;
     float alpha = xyweights[i].weight;
@@ -7,11 +7,15 @@ GLineSegment2D::GLineSegment2D(const std::pair<float,float>& p0Arg, const std::p
 : line(p0Arg,p1Arg), p0(p0Arg), p1(p1Arg), weight() {}
 
 GLineSegment2D GLineSegment2D::lsqFitXYW(const std::vector<XYWeight>& xyweight) {
-	GLine2D gline = GLine2D::lsqFitXYW(xyweight);
+	return lsqFitXYW(xyweight.data(), xyweight.size());
+}
+
+GLineSegment2D GLineSegment2D::lsqFitXYW(const XYWeight* xyweight, size_t n) {
+	GLine2D gline = GLine2D::lsqFitXYW(xyweight, n);
 	float maxcoord = -std::numeric_limits<float>::infinity();
 	float mincoord = std::numeric_limits<float>::infinity();;
 	
-	for (unsigned int i = 0; i < xyweight.size(); i++) {
+	for (size_t i = 0; i < n; i++) {
 		std::pair<float,float> p(xyweight[i].x, xyweight[i].y);
 		float coord = gline.getLineCoordinate(p);
 		maxcoord = std::max(maxcoord, coord);
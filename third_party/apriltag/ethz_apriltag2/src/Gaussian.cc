@@ -32,6 +32,11 @@ std::vector<float> Gaussian::makeGaussianFilter(float sigma, int n) {
 
 void Gaussian::convolveSymmetricCentered(const std::vector<float>& a, unsigned int aoff, unsigned int alen,
 					const std::vector<float>& f, std::vector<float>& r, unsigned int roff) {
+  convolveSymmetricCentered(a.data(), aoff, alen, f, r.data(), roff);
+}
+
+void Gaussian::convolveSymmetricCentered(const float* a, unsigned int aoff, unsigned int alen,
+					const std::vector<float>& f, float* r, unsigned int roff) {
   if ((f.size()&1)== 0 && !warned) {
     std::cout<<"convolveSymmetricCentered Warning: filter is not odd length\n";
     warned = true;
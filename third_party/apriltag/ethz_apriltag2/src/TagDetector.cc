@@ -35,19 +35,43 @@ using namespace std;
 
 namespace AprilTags {
 
+namespace {
+
+//! cv::Mat header on the pixels of a FloatImage
+cv::Mat floatImageMat(FloatImage &fim) {
+  return cv::Mat(fim.getHeight(), fim.getWidth(), CV_32F,
+                 fim.getFloatImagePixelData());
+}
+
+//! Separable blur with a symmetric filter and replicated borders like
+//! FloatImage::filterFactoredCentered, vectorized by OpenCV and without
+//! copying src
+void blurFactoredCentered(FloatImage &src, const std::vector<float> &filt,
+                          FloatImage &dst) {
+  dst.resize(src.getWidth(), src.getHeight());
+  cv::Mat dstMat = floatImageMat(dst);
+  const cv::Mat kernel(1, (int)filt.size(), CV_32F,
+                       const_cast<float *>(filt.data()));
+  cv::sepFilter2D(floatImageMat(src), dstMat, CV_32F, kernel, kernel,
+                  cv::Point(-1, -1), 0, cv::BORDER_REPLICATE);
+}
+
+}  // namespace
+
 std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
-  // convert to internal AprilTags image (todo: slow, change internally to
-  // OpenCV)
+  std::vector<TagDetection> tags;
+  extractTags(image, tags);
+  return tags;
+}
+
+void TagDetector::extractTags(const cv::Mat &image,
+                              std::vector<TagDetection> &goodDetections) {
+  // convert to internal AprilTags image. image may be a non continuous ROI.
   int width = image.cols;
   int height = image.rows;
-  AprilTags::FloatImage fimOrig(width, height);
-  int i = 0;
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      fimOrig.set(x, y, image.data[i] / 255.);
-      i++;
-    }
-  }
+  fimOrig.resize(width, height);
+  cv::Mat fimOrigMat = floatImageMat(fimOrig);
+  image.convertTo(fimOrigMat, CV_32F, 1. / 255.);
   std::pair<int, int> opticalCenter(width / 2, height / 2);
 
 #ifdef DEBUG_APRIL
@@ -97,8 +121,6 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   //================================================================
   // Step one: preprocess image (convert to grayscale) and low pass if necessary
 
-  FloatImage fim = fimOrig;
-
   //! Gaussian smoothing kernel applied to image (0 == no filter).
   /*! Used when sampling bits. Filtering is a good idea in cases
    * where A) a cheap camera is introducing artifical sharpening, B)
@@ -118,11 +140,15 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
    */
   float segSigma = 0.8f;
 
+  // only copy the image if it is filtered
+  const FloatImage *fimPtr = &fimOrig;
   if (sigma > 0) {
     int filtsz = ((int)max(3.0f, 3 * sigma)) | 1;
     std::vector<float> filt = Gaussian::makeGaussianFilter(sigma, filtsz);
-    fim.filterFactoredCentered(filt, filt);
+    blurFactoredCentered(fimOrig, filt, fimFiltered);
+    fimPtr = &fimFiltered;
   }
+  const FloatImage &fim = *fimPtr;
 
   //================================================================
   // Step two: Compute the local gradient. We store the direction and magnitude.
@@ -130,39 +156,41 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // break up segments, causing us to miss Quads. It is useful to do a Gaussian
   // low pass on this step even if we don't want it for encoding.
 
-  FloatImage fimSeg;
   if (segSigma > 0) {
     if (segSigma == sigma) {
       fimSeg = fim;
     } else {
-      // blur anew
-      int filtsz = ((int)max(3.0f, 3 * segSigma)) | 1;
-      std::vector<float> filt = Gaussian::makeGaussianFilter(segSigma, filtsz);
-      fimSeg = fimOrig;
-      fimSeg.filterFactoredCentered(filt, filt);
+      // blur anew, the filter only depends on segSigma
+      if (segFilter.empty()) {
+        int filtsz = ((int)max(3.0f, 3 * segSigma)) | 1;
+        segFilter = Gaussian::makeGaussianFilter(segSigma, filtsz);
+      }
+      blurFactoredCentered(fimOrig, segFilter, fimSeg);
     }
   } else {
     fimSeg = fimOrig;
   }
 
-  FloatImage fimTheta(fimSeg.getWidth(), fimSeg.getHeight());
-  FloatImage fimMag(fimSeg.getWidth(), fimSeg.getHeight());
-
-  for (int y = 1; y < fimSeg.getHeight() - 1; y++) {
-    for (int x = 1; x < fimSeg.getWidth() - 1; x++) {
-      float Ix = fimSeg.get(x + 1, y) - fimSeg.get(x - 1, y);
-      float Iy = fimSeg.get(x, y + 1) - fimSeg.get(x, y - 1);
-
-      float mag = Ix * Ix + Iy * Iy;
-#if 0  // kaess: fast version, but maybe less accurate?
-      float theta = MathUtil::fast_atan2(Iy, Ix);
-#else
-      float theta = atan2(Iy, Ix);
-#endif
-
-      fimTheta.set(x, y, theta);
-      fimMag.set(x, y, mag);
-    }
+  // the borders are never written and stay zero
+  fimTheta.resize(fimSeg.getWidth(), fimSeg.getHeight());
+  fimMag.resize(fimSeg.getWidth(), fimSeg.getHeight());
+
+  // Central differences on the interior. mag is the squared gradient norm,
+  // theta comes from the vectorized atan2 of cv::phase (about 0.3 degrees
+  // accurate, in [0, 2pi) instead of (-pi, pi]; all uses are mod 2pi).
+  if (fimSeg.getWidth() > 2 && fimSeg.getHeight() > 2) {
+    const cv::Rect inner(1, 1, fimSeg.getWidth() - 2, fimSeg.getHeight() - 2);
+    const cv::Mat seg = floatImageMat(fimSeg);
+    cv::subtract(seg(inner + cv::Point(1, 0)), seg(inner - cv::Point(1, 0)),
+                 gradX);
+    cv::subtract(seg(inner + cv::Point(0, 1)), seg(inner - cv::Point(0, 1)),
+                 gradY);
+
+    cv::Mat mag = floatImageMat(fimMag)(inner);
+    cv::Mat theta = floatImageMat(fimTheta)(inner);
+    cv::multiply(gradX, gradX, mag);
+    cv::accumulateSquare(gradY, mag);
+    cv::phase(gradX, gradY, theta);
   }
 
 #ifdef DEBUG_APRIL
@@ -192,22 +220,22 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // Step three. Extract edges by grouping pixels with similar
   // thetas together. This is a greedy algorithm: we start with
   // the most similar pixels.  We use 4-connectivity.
-  UnionFindSimple uf(fimSeg.getWidth() * fimSeg.getHeight());
+  uf.reset(fimSeg.getWidth() * fimSeg.getHeight());
 
-  vector<Edge> edges(width * height * 4);
+  edges.resize(width * height * 4);
   size_t nEdges = 0;
 
   // Bounds on the thetas assigned to this group. Note that because
   // theta is periodic, these are defined such that the average
   // value is contained *within* the interval.
-  {  // limit scope of storage
+  {
      /* Previously all this was on the stack, but this is 1.2MB for 320x240
       * images
       * That's already a problem for OS X (default 512KB thread stack size),
-      * could be a problem elsewhere for bigger images... so store on heap */
-    vector<float> storage(
-        width * height *
-        4);  // do all the memory in one big block, exception safe
+      * could be a problem elsewhere for bigger images... so store on heap.
+      * Only entries of pixels with edges are written and read. */
+    storage.resize(width * height *
+                   4);  // do all the memory in one big block
     float *tmin = &storage[width * height * 0];
     float *tmax = &storage[width * height * 1];
     float *mmin = &storage[width * height * 2];
@@ -232,9 +260,16 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
       }
     }
 
-    edges.resize(nEdges);
-    std::stable_sort(edges.begin(), edges.end());
-    Edge::mergeEdges(edges, uf, tmin, tmax, mmin, mmax);
+    // stable counting sort by cost, same order as std::stable_sort without
+    // its temporary buffer. Costs are in [0, WEIGHT_SCALE].
+    edgeCostOffsets.assign(Edge::WEIGHT_SCALE + 2, 0);
+    for (size_t e = 0; e < nEdges; e++) edgeCostOffsets[edges[e].cost + 1]++;
+    for (size_t c = 1; c < edgeCostOffsets.size(); c++)
+      edgeCostOffsets[c] += edgeCostOffsets[c - 1];
+    sortedEdges.resize(nEdges);
+    for (size_t e = 0; e < nEdges; e++)
+      sortedEdges[edgeCostOffsets[edges[e].cost]++] = edges[e];
+    Edge::mergeEdges(sortedEdges, uf, tmin, tmax, mmin, mmax);
   }
 
   //================================================================
@@ -242,7 +277,12 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // cluster.
   // We will soon fit lines (segments) to these points.
 
-  map<int, vector<XYWeight> > clusters;
+  // All points are stored in one flat buffer, cluster by cluster in the
+  // order of their representative (as with the former std::map). The first
+  // pass counts the points per representative, the second one fills them in.
+  const int nPixels = fimSeg.getWidth() * fimSeg.getHeight();
+  pixelRep.assign(nPixels, -1);
+  clusterOffsets.assign(nPixels + 1, 0);
   for (int y = 0; y + 1 < fimSeg.getHeight(); y++) {
     for (int x = 0; x + 1 < fimSeg.getWidth(); x++) {
       if (uf.getSetSize(y * fimSeg.getWidth() + x) <
@@ -250,31 +290,50 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
         continue;
 
       int rep = (int)uf.getRepresentative(y * fimSeg.getWidth() + x);
+      pixelRep[y * fimSeg.getWidth() + x] = rep;
+      clusterOffsets[rep]++;
+    }
+  }
 
-      map<int, vector<XYWeight> >::iterator it = clusters.find(rep);
-      if (it == clusters.end()) {
-        clusters[rep] = vector<XYWeight>();
-        it = clusters.find(rep);
-      }
-      vector<XYWeight> &points = it->second;
-      points.push_back(XYWeight(x, y, fimMag.get(x, y)));
+  clusterReps.clear();
+  size_t nPoints = 0;
+  for (int rep = 0; rep < nPixels; rep++) {
+    const size_t count = clusterOffsets[rep];
+    clusterOffsets[rep] = nPoints;
+    if (count > 0) clusterReps.push_back(rep);
+    nPoints += count;
+  }
+  clusterOffsets[nPixels] = nPoints;
+
+  clusterPoints.resize(nPoints);
+  clusterFill.assign(clusterOffsets.begin(), clusterOffsets.end());
+  for (int y = 0; y + 1 < fimSeg.getHeight(); y++) {
+    for (int x = 0; x + 1 < fimSeg.getWidth(); x++) {
+      int rep = pixelRep[y * fimSeg.getWidth() + x];
+      if (rep < 0) continue;
+      clusterPoints[clusterFill[rep]++] = XYWeight(x, y, fimMag.get(x, y));
     }
   }
 
   //================================================================
   // Step five: Loop over the clusters, fitting lines (which we call Segments).
-  std::vector<Segment> segments;  // used in Step six
-  std::map<int, std::vector<XYWeight> >::const_iterator clustersItr;
-  for (clustersItr = clusters.begin(); clustersItr != clusters.end();
-       clustersItr++) {
-    std::vector<XYWeight> points = clustersItr->second;
-    GLineSegment2D gseg = GLineSegment2D::lsqFitXYW(points);
+  // used in Step six, the segments (and their children lists) of the
+  // previous call are overwritten
+  size_t nSegments = 0;
+  for (size_t c = 0; c < clusterReps.size(); c++) {
+    const int rep = clusterReps[c];
+    const XYWeight *points = &clusterPoints[clusterOffsets[rep]];
+    const size_t nClusterPoints =
+        clusterOffsets[rep + 1] - clusterOffsets[rep];
+    GLineSegment2D gseg = GLineSegment2D::lsqFitXYW(points, nClusterPoints);
 
     // filter short lines
     float length = MathUtil::distance2D(gseg.getP0(), gseg.getP1());
     if (length < Segment::minimumLineLength) continue;
 
-    Segment seg;
+    if (nSegments == segments.size()) segments.emplace_back();
+    Segment &seg = segments[nSegments++];
+    seg.children.clear();
     float dy = gseg.getP1().second - gseg.getP0().second;
     float dx = gseg.getP1().first - gseg.getP0().first;
 
@@ -291,7 +350,7 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
     // could probably sample just one point!
 
     float flip = 0, noflip = 0;
-    for (unsigned int i = 0; i < points.size(); i++) {
+    for (size_t i = 0; i < nClusterPoints; i++) {
       XYWeight xyw = points[i];
 
       float theta = fimTheta.get((int)xyw.x, (int)xyw.y);
@@ -325,7 +384,6 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
       seg.setY1(gseg.getP1().second);
     }
 
-    segments.push_back(seg);
   }
 
 #ifdef DEBUG_APRIL
@@ -354,12 +412,12 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // first point. Remember that the first point has a specific meaning due to
   // our
   // left-hand rule above.
-  for (unsigned int i = 0; i < segments.size(); i++) {
+  for (unsigned int i = 0; i < nSegments; i++) {
     gridder.add(segments[i].getX0(), segments[i].getY0(), &segments[i]);
   }
 
   // Now, find child segments that begin where each parent segment ends.
-  for (unsigned i = 0; i < segments.size(); i++) {
+  for (unsigned i = 0; i < nSegments; i++) {
     Segment &parentseg = segments[i];
 
     // compute length of the line segment
@@ -403,12 +461,12 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // Step seven: Search all connected segments to see if any form a loop of
   // length 4.
   // Add those to the quads list.
-  vector<Quad> quads;
+  quads.clear();
 
-  vector<Segment *> tmp(5);
-  for (unsigned int i = 0; i < segments.size(); i++) {
-    tmp[0] = &segments[i];
-    Quad::search(fimOrig, tmp, segments[i], 0, quads, opticalCenter);
+  path.resize(5);
+  for (unsigned int i = 0; i < nSegments; i++) {
+    path[0] = &segments[i];
+    Quad::search(fimOrig, path, segments[i], 0, quads, opticalCenter);
   }
 
 #ifdef DEBUG_APRIL
@@ -450,7 +508,7 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // threshold color to decide between 0 and 1. Then, we read off the
   // bits and see if they make sense.
 
-  std::vector<TagDetection> detections;
+  detections.clear();
 
   for (unsigned int qi = 0; qi < quads.size(); qi++) {
     Quad &quad = quads[qi];
@@ -566,7 +624,7 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   // keep the one with the lowest error, and if the error is the same,
   // the one with the greatest observed perimeter.
 
-  std::vector<TagDetection> goodDetections;
+  goodDetections.clear();
 
   // NOTE: allow multiple non-overlapping detections of the same target.
 
@@ -603,11 +661,10 @@ std::vector<TagDetection> TagDetector::extractTags(const cv::Mat &image) {
   }
 
   // cout << "AprilTags: edges=" << nEdges << " clusters=" << clusters.size() <<
-  // " segments=" << segments.size()
+  // " segments=" << nSegments
   //     << " quads=" << quads.size() << " detections=" << detections.size() <<
   //     " unique tags=" << goodDetections.size() << endl;
 
-  return goodDetections;
 }
 
 }  // namespace